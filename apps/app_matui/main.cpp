@@ -24,7 +24,7 @@ static uint scrwidth = 0, scrheight = 0;
 static bool running = true, hasFocus = true;
 static bool leftButtonDown = false, leftClicked = false;
 static bool sceneChanges = false;
-static string materialFile;
+static string materialFile, materialLibrary;
 
 #include "main_ui.h"
 #include "main_tools.h"
@@ -38,12 +38,13 @@ void PrepareScene()
 	// initialize scene
 	int worldID = renderer->AddMesh( "materials.obj", "data\\mattest\\", 1.0f );
 	materialFile = string( "data\\mattest\\mattest_materials.xml" );
+	materialLibrary = string( "data\\mattest\\mattest_materials.lhm" );
 	int lightMat = renderer->AddMaterial( make_float3( 10, 10, 10 ) );
 	int lightQuad = renderer->AddQuad( make_float3( 0, -1, 0 ), make_float3( 0, 26.0f, 0 ), 6.9f, 6.9f, lightMat );
 	renderer->AddInstance( worldID );
 	renderer->AddInstance( lightQuad );
-	// read persistent material changes
-	renderer->DeserializeMaterials( materialFile.c_str() );
+	// read persistent material changes; the XML file is for interchange, and only read without a library
+	renderer->DeserializeMaterials( (FileExists( materialLibrary.c_str() ) ? materialLibrary : materialFile).c_str() );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -76,7 +77,7 @@ bool HandleInput( float frameTime )
 		{
 			currentMaterial = *renderer->GetMaterial( selectedMaterialID );
 			currentMaterialID = selectedMaterialID;
-			currentMaterial.Changed(); // update checksum so we can track changes
+			currentMaterial.ContentChanged(); // update checksum so we can track changes
 		}
 		camera->focalDistance = coreStats.probedDist;
 		changed = true;
@@ -96,7 +97,7 @@ void HandleMaterialChange()
 	else currentMaterial.flags &= ~HostMaterial::ISCONDUCTOR;
 	if (currentMaterialDielectric) currentMaterial.flags |= HostMaterial::ISDIELECTRIC;
 	else currentMaterial.flags &= ~HostMaterial::ISDIELECTRIC;
-	if (currentMaterial.Changed() && currentMaterialID != -1)
+	if (currentMaterial.ContentChanged() && currentMaterialID != -1)
 	{
 		// put it back
 		*renderer->GetMaterial( currentMaterialID ) = currentMaterial;
@@ -105,6 +106,24 @@ void HandleMaterialChange()
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  UpdateMaterialCost                                                         |
+//  |  Shading cost of the current material in the last frame: GetShadingData     |
+//  |  cycles per shaded hit and cycles per BSDF call. Only instrumentation       |
+//  |  builds of the core (SHADECOST) measure this.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void UpdateMaterialCost()
+{
+	static vector<CoreMaterialCost> costs;
+	if (currentMaterialID == -1) return;
+	costs.resize( currentMaterialID + 1 );
+	if (renderer->GetMaterialCosts( costs.data(), currentMaterialID + 1 ) <= currentMaterialID) return;
+	const CoreMaterialCost& cost = costs[currentMaterialID];
+	shadedHits = cost.invocations;
+	shadeCycles = cost.invocations ? (float)cost.shadingCycles / cost.invocations : 0;
+	bsdfCycles = cost.bsdfCalls ? (float)cost.bsdfCycles / cost.bsdfCalls : 0;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  main                                                                       |
 //  |  Application entry point.                                             LH2'19|
@@ -121,6 +140,7 @@ int main()
 	renderer = RenderAPI::CreateRenderAPI( "rendercore_optixprime_b.dll" );			// OPTIX PRIME, best for pre-RTX CUDA devices
 	// renderer = RenderAPI::CreateRenderAPI( "rendercore_primeref.dll" );			// REFERENCE, for image validation
 	// renderer = RenderAPI::CreateRenderAPI( "rendercore_softrasterizer.dll" );	// RASTERIZER, your only option if not on NVidia
+	// renderer = RenderAPI::CreateRenderAPI( "rendercore_opengl.dll" );			// OPENGL, hardware rasterized preview for editing
 
 	renderer->DeserializeCamera( "camera.xml" );
 	// initialize ui
@@ -142,7 +162,7 @@ int main()
 		// handle material changes
 		HandleMaterialChange();
 		// detect camera changes
-		if (renderer->GetCamera()->Changed()) sceneChanges = true;
+		if (renderer->GetCamera()->ContentChanged()) sceneChanges = true;
 		// poll events, may affect probepos so needs to happen between HandleInput and Render
 		glfwPollEvents();
 		// render
@@ -152,6 +172,7 @@ int main()
 		coreStats = renderer->GetCoreStats();
 		mraysincl = coreStats.totalRays / (coreStats.renderTime * 1000);
 		mraysexcl = coreStats.totalRays / (coreStats.traceTime0 * 1000);
+		UpdateMaterialCost();
 		if (HandleInput( deltaTime )) sceneChanges = true;
 		// finalize and present
 		shader->Bind();
@@ -169,6 +190,7 @@ int main()
 	// save camera
 	renderer->SerializeCamera( "camera.xml" );
 	// save material changes
+	renderer->SerializeMaterials( materialLibrary.c_str() );
 	renderer->SerializeMaterials( materialFile.c_str() );
 	// clean up
 	renderer->Shutdown();
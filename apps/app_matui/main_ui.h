@@ -21,6 +21,8 @@ TwBar* bar = 0;
 HostMaterial currentMaterial; // will contain a copy of the material we're editing
 bool currentMaterialConductor, currentMaterialDielectric;
 int currentMaterialID = -1;
+float shadeCycles = 0, bsdfCycles = 0; // cost of the current material, see UpdateMaterialCost
+uint shadedHits = 0;
 static CoreStats coreStats;
 
 //  +-----------------------------------------------------------------------------+
@@ -94,6 +96,9 @@ void RefreshUI()
 	TwAddVarRW( bar, "nrmlmap1", mapType, &currentMaterial.map[NORMALMAP1], " group='material' " );
 	TwAddVarRW( bar, "nrmlmap2", mapType, &currentMaterial.map[NORMALMAP2], " group='material' " );
 	TwAddSeparator( bar, "separator3", "group='material'" );
+	TwAddVarRO( bar, "hits", TW_TYPE_UINT32, &shadedHits, "group='material'" );
+	TwAddVarRO( bar, "shade cycles", TW_TYPE_FLOAT, &shadeCycles, "group='material'" );
+	TwAddVarRO( bar, "bsdf cycles", TW_TYPE_FLOAT, &bsdfCycles, "group='material'" );
 	TwSetParam( bar, "material", "opened", TW_PARAM_INT32, 1, &closed );
 	// create collapsed camera block
 	TwAddVarRO( bar, "position", float3Type, &renderer->GetCamera()->position, "group='camera'" );
@@ -0,0 +1,166 @@
+/* main.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Headless batch renderer: renders the frames of an animation at a fixed
+   sample count and writes them to disk. No window or OpenGL context is
+   created; the core renders to host memory (see SetHostTarget). Frames
+   can be distributed over several machines, see main_net.h.
+*/
+
+#include <winsock2.h>			// before windows.h, which platform.h includes
+#include <ws2tcpip.h>
+#include "platform.h"
+#include "system.h"
+#include "rendersystem.h"
+
+static RenderAPI* renderer = 0;
+static vector<float4> pixels;		// host render target
+
+struct BatchSettings
+{
+	int spp = 64;					// samples per pixel, one per pass
+	float fps = 30;					// animation time step between frames
+	int width = SCRWIDTH, height = SCRHEIGHT;
+	int tileRows = 0;				// render in bands of this many rows, to keep device buffers small; 0: at once
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  ToRGB / SavePPM                                                            |
+//  |  Convert the finalized frame to 8-bit RGB and write it as binary PPM. LH2'19|
+//  +-----------------------------------------------------------------------------+
+void ToRGB( vector<uchar>& rgb, const int w, const int h )
+{
+	// finalizeRenderKernel already applied brightness, contrast and gamma
+	rgb.resize( w * h * 3 );
+	for (int i = 0; i < w * h; i++)
+	{
+		rgb[i * 3 + 0] = (uchar)(255.0f * min( 1.0f, max( 0.0f, pixels[i].x ) ));
+		rgb[i * 3 + 1] = (uchar)(255.0f * min( 1.0f, max( 0.0f, pixels[i].y ) ));
+		rgb[i * 3 + 2] = (uchar)(255.0f * min( 1.0f, max( 0.0f, pixels[i].z ) ));
+	}
+}
+bool SavePPM( const char* file, const uchar* rgb, const int w, const int h )
+{
+	FILE* f = fopen( file, "wb" );
+	if (!f) { printf( "could not write %s.\n", file ); return false; }
+	fprintf( f, "P6\n%i %i\n255\n", w, h );
+	fwrite( rgb, 1, w * h * 3, f );
+	fclose( f );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderFrame                                                                |
+//  |  Render one frame of the animation. The animations are set to the time of   |
+//  |  the frame, so frames can be rendered in any order. With tiling, each band  |
+//  |  is fully converged before the next one; the core finalizes it into its     |
+//  |  rows of the host target, so the frame is assembled in place.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderFrame( const int frame, const BatchSettings& settings )
+{
+	for (int i = 0; i < renderer->AnimationCount(); i++)
+	{
+		renderer->ResetAnimation( i );
+		if (frame > 0) renderer->UpdateAnimation( i, frame / settings.fps );
+	}
+	renderer->SynchronizeSceneData();
+	RenderSettings* rs = renderer->GetSettings();
+	const int rows = settings.tileRows > 0 ? min( settings.tileRows, settings.height ) : settings.height;
+	rs->tileRows = settings.tileRows;
+	for (int y = 0; y < settings.height; y += rows)
+	{
+		rs->bandStart = (float)y / settings.height;
+		rs->bandEnd = (float)min( y + rows, settings.height ) / settings.height;
+		for (int pass = 0; pass < settings.spp; pass++) renderer->Render( pass == 0 ? Restart : Converge );
+	}
+	rs->bandStart = 0, rs->bandEnd = 1;
+}
+
+#include "main_net.h"
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	BatchSettings settings;
+	const char *sceneFile = 0, *sceneDir = 0, *cameraFile = "camera.xml", *core = "rendercore_optix7.dll", *worker = 0;
+	int firstFrame = 0, frames = 1, chunk = 8, coordinatorPort = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* a = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (!strcmp( a, "-frames" ) && hasValue) frames = atoi( argv[++i] );
+		else if (!strcmp( a, "-first" ) && hasValue) firstFrame = atoi( argv[++i] );
+		else if (!strcmp( a, "-spp" ) && hasValue) settings.spp = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-fps" ) && hasValue) settings.fps = (float)atof( argv[++i] );
+		else if (!strcmp( a, "-size" ) && i + 2 < argc) settings.width = atoi( argv[++i] ), settings.height = atoi( argv[++i] );
+		else if (!strcmp( a, "-camera" ) && hasValue) cameraFile = argv[++i];
+		else if (!strcmp( a, "-core" ) && hasValue) core = argv[++i];
+		else if (!strcmp( a, "-tile" ) && hasValue) settings.tileRows = max( 0, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-chunk" ) && hasValue) chunk = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-coordinator" ) && hasValue) coordinatorPort = atoi( argv[++i] );
+		else if (!strcmp( a, "-worker" ) && hasValue) worker = argv[++i];
+		else if (!sceneFile) sceneFile = a;
+		else sceneDir = a;
+	}
+	if ((coordinatorPort || worker) && !InitSockets()) { printf( "could not initialize winsock.\n" ); return 1; }
+	if (coordinatorPort) return RunCoordinator( coordinatorPort, firstFrame, frames, chunk );
+	if (!sceneFile || !sceneDir)
+	{
+		printf( "usage: batchapp <scene file> <scene dir> [-frames n] [-first n] [-spp n] [-fps f] [-size w h]\n" );
+		printf( "                [-tile rows] [-camera file] [-core dll] [-worker host:port]\n" );
+		printf( "       batchapp -coordinator <port> [-frames n] [-first n] [-chunk n]\n" );
+		return 1;
+	}
+	renderer = RenderAPI::CreateRenderAPI( core );
+	renderer->DeserializeCamera( cameraFile );
+	renderer->AddScene( sceneFile, sceneDir );
+	// render target in host memory
+	pixels.resize( settings.width * settings.height );
+	if (!renderer->SetHostTarget( pixels.data(), settings.width, settings.height, 1 ))
+	{
+		printf( "this core requires an OpenGL render target.\n" );
+		renderer->Shutdown();
+		return 1;
+	}
+	int result = 0;
+	if (worker)
+	{
+		// host:port of the coordinator
+		char host[256];
+		int port = 0;
+		if (sscanf( worker, "%255[^:]:%i", host, &port ) == 2) result = RunWorker( host, port, settings );
+		else printf( "expected host:port after -worker.\n" ), result = 1;
+	}
+	else
+	{
+		vector<uchar> rgb;
+		Timer timer;
+		for (int frame = firstFrame; frame < firstFrame + frames; frame++)
+		{
+			timer.reset();
+			RenderFrame( frame, settings );
+			ToRGB( rgb, settings.width, settings.height );
+			char file[64];
+			sprintf( file, "frame_%04i.ppm", frame );
+			if (SavePPM( file, rgb.data(), settings.width, settings.height )) printf( "%s: %i spp in %.2fs.\n", file, settings.spp, timer.elapsed() );
+		}
+	}
+	renderer->Shutdown();
+	return result;
+}
+
+// EOF
@@ -0,0 +1,184 @@
+/* main_net.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Distributed rendering: a coordinator hands out frame ranges to worker
+   processes, which render them headless and stream the frames back.
+   Each worker loads the scene once (and thus uses the scene cache), so a
+   worker is one process with one scene. All messages are text lines,
+   except the pixels that follow a FRAME line:
+
+	 coordinator to worker: "RENDER <first> <count>" or "QUIT"
+	 worker to coordinator: "FRAME <index> <width> <height>", then
+							width * height * 3 bytes of RGB.
+*/
+
+#pragma comment( lib, "ws2_32.lib" )
+
+//  +-----------------------------------------------------------------------------+
+//  |  Socket helpers                                                             |
+//  |  Blocking TCP sockets; all calls return false on a closed connection. LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool InitSockets() { WSADATA data; return WSAStartup( MAKEWORD( 2, 2 ), &data ) == 0; }
+bool SendAll( SOCKET s, const void* data, const int size )
+{
+	for (int sent = 0; sent < size;)
+	{
+		const int n = send( s, (const char*)data + sent, size - sent, 0 );
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+bool RecvAll( SOCKET s, void* data, const int size )
+{
+	for (int received = 0; received < size;)
+	{
+		const int n = recv( s, (char*)data + received, size - received, 0 );
+		if (n <= 0) return false;
+		received += n;
+	}
+	return true;
+}
+bool SendLine( SOCKET s, const char* line ) { return SendAll( s, line, (int)strlen( line ) ) && SendAll( s, "\n", 1 ); }
+bool RecvLine( SOCKET s, char* line, const int maxSize )
+{
+	// lines are short, so byte-wise reads are fine
+	for (int i = 0; i < maxSize - 1; i++)
+	{
+		if (!RecvAll( s, line + i, 1 )) return false;
+		if (line[i] == '\n') { line[i] = 0; return true; }
+	}
+	return false;
+}
+SOCKET Listen( const int port )
+{
+	SOCKET s = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl( INADDR_ANY );
+	addr.sin_port = htons( (u_short)port );
+	if (bind( s, (sockaddr*)&addr, sizeof( addr ) ) != 0 || listen( s, SOMAXCONN ) != 0) closesocket( s ), s = INVALID_SOCKET;
+	return s;
+}
+SOCKET Connect( const char* host, const int port )
+{
+	addrinfo hints = {}, *info = 0;
+	hints.ai_family = AF_INET, hints.ai_socktype = SOCK_STREAM, hints.ai_protocol = IPPROTO_TCP;
+	char service[16];
+	sprintf( service, "%i", port );
+	if (getaddrinfo( host, service, &hints, &info ) != 0) return INVALID_SOCKET;
+	SOCKET s = socket( info->ai_family, info->ai_socktype, info->ai_protocol );
+	if (connect( s, info->ai_addr, (int)info->ai_addrlen ) != 0) closesocket( s ), s = INVALID_SOCKET;
+	freeaddrinfo( info );
+	return s;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RunCoordinator                                                             |
+//  |  Accepts workers and feeds each of them ranges of 'chunk' frames until all  |
+//  |  frames are written. Ranges of workers that disconnect are handed out       |
+//  |  again.                                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RunCoordinator( const int port, const int firstFrame, const int frames, const int chunk )
+{
+	SOCKET server = Listen( port );
+	if (server == INVALID_SOCKET) { printf( "could not listen on port %i.\n", port ); return 1; }
+	printf( "coordinator: %i frames, waiting for workers on port %i.\n", frames, port );
+	mutex lock;
+	deque<int2> ranges; // first frame and count
+	for (int i = 0; i < frames; i += chunk) ranges.push_back( make_int2( firstFrame + i, min( chunk, frames - i ) ) );
+	atomic<int> framesDone( 0 );
+	vector<thread> workers;
+	while (framesDone < frames)
+	{
+		// poll the listening socket, so we notice when the last frame arrived
+		fd_set pending;
+		FD_ZERO( &pending );
+		FD_SET( server, &pending );
+		timeval timeout = { 1, 0 };
+		if (select( 0, &pending, 0, 0, &timeout ) <= 0) continue;
+		SOCKET s = accept( server, 0, 0 );
+		if (s == INVALID_SOCKET) continue;
+		workers.push_back( thread( [&, s]() {
+			vector<uchar> pixels;
+			char line[128];
+			while (1)
+			{
+				int2 range;
+				{
+					lock_guard<mutex> guard( lock );
+					if (ranges.empty()) break;
+					range = ranges.front();
+					ranges.pop_front();
+				}
+				int received = 0;
+				sprintf( line, "RENDER %i %i", range.x, range.y );
+				if (SendLine( s, line )) for (; received < range.y; received++)
+				{
+					int index, w, h;
+					if (!RecvLine( s, line, sizeof( line ) ) || sscanf( line, "FRAME %i %i %i", &index, &w, &h ) != 3) break;
+					pixels.resize( w * h * 3 );
+					if (!RecvAll( s, pixels.data(), w * h * 3 )) break;
+					char file[64];
+					sprintf( file, "frame_%04i.ppm", index );
+					SavePPM( file, pixels.data(), w, h );
+					framesDone++;
+				}
+				if (received < range.y)
+				{
+					// worker lost; return the frames it did not deliver
+					lock_guard<mutex> guard( lock );
+					ranges.push_back( make_int2( range.x + received, range.y - received ) );
+					closesocket( s );
+					return;
+				}
+				printf( "coordinator: frames %i..%i done (%i/%i).\n", range.x, range.x + range.y - 1, (int)framesDone, frames );
+			}
+			SendLine( s, "QUIT" );
+			closesocket( s );
+		} ) );
+	}
+	for (thread& t : workers) t.join();
+	closesocket( server );
+	return 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RunWorker                                                                  |
+//  |  Connects to the coordinator and renders the ranges it receives.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RunWorker( const char* host, const int port, const BatchSettings& settings )
+{
+	SOCKET s = Connect( host, port );
+	if (s == INVALID_SOCKET) { printf( "could not connect to %s:%i.\n", host, port ); return 1; }
+	vector<uchar> rgb;
+	char line[128];
+	int first, count;
+	while (RecvLine( s, line, sizeof( line ) ) && sscanf( line, "RENDER %i %i", &first, &count ) == 2)
+	{
+		bool connected = true;
+		for (int frame = first; frame < first + count && connected; frame++)
+		{
+			RenderFrame( frame, settings );
+			ToRGB( rgb, settings.width, settings.height );
+			sprintf( line, "FRAME %i %i %i", frame, settings.width, settings.height );
+			connected = SendLine( s, line ) && SendAll( s, rgb.data(), (int)rgb.size() );
+		}
+		if (!connected) break;
+	}
+	closesocket( s );
+	return 0;
+}
+
+// EOF
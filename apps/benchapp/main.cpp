@@ -0,0 +1,519 @@
+/* main.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Benchmark harness: renders a fixed set of reference scenes along
+   recorded camera paths, for a fixed number of frames, and writes the
+   per-frame CoreStats and SystemStats to CSV plus a JSON summary with
+   percentile frame times. A line is appended to summary.csv per run, so
+   results of different versions and cores can be compared.
+
+   The benchmark list is a text file with one run per line:
+     <name> <scene file> <scene dir> <camera path> <frames>
+   A camera path is a text file that lists camera xml files (see
+   Camera::Serialize), one per line; the camera is interpolated between
+   these keys over the frames of the run. Lines starting with # are
+   skipped in both files.
+
+   The RenderSystem holds a single scene, so each run executes in a
+   separate process: without -run, benchapp starts itself once per run
+   and per core. Rendering is headless (see SetHostTarget).
+
+   With -converge <seconds>, benchapp measures image quality over time
+   instead: the first camera key of each run is rendered with a high
+   sample count by the reference core (PrimeRef by default), and stored
+   in <name>_reference_<w>x<h>.bin, which later invocations reuse. Each core then
+   accumulates the same view for the given wall clock time; its RMSE and
+   relMSE against the reference are written to <name>_<core>_error.csv
+   at every -interval, and the final error is appended to errors.csv.
+   Errors are measured on the finalized frames, after tonemapping, so
+   a sampling or performance change is judged by the error it reaches
+   in a given time rather than by its ray throughput.
+*/
+
+#include "platform.h"
+#include "system.h"
+#include "rendersystem.h"
+
+static RenderAPI* renderer = 0;
+static vector<float4> pixels;		// host render target
+
+struct BenchRun
+{
+	string name, sceneFile, sceneDir, cameraPath;
+	int frames = 0;
+};
+
+struct BenchSettings
+{
+	int width = 1280, height = 720;
+	int spp = 1;					// passes per frame; every frame restarts
+	int warmup = 16;				// frames rendered before measuring, to fill caches and pools
+	float fps = 30;					// animation time step between frames
+	const char* tag = "";			// label for the runs in summary.csv, e.g. a version
+	float convergeTime = 0;			// convergence runs: seconds of accumulation per core; 0: frame time runs
+	float interval = 0.25f;			// convergence runs: seconds between error measurements
+	int referenceSpp = 4096;		// convergence runs: passes for the reference image
+	const char* referenceCore = "rendercore_primeref.dll";
+};
+
+struct CameraKey
+{
+	float3 position, direction;
+	float FOV;
+};
+
+struct FrameRecord
+{
+	float frameTime;				// host time for synchronization and rendering
+	CoreStats core;
+	SystemStats system;
+};
+
+struct ErrorRecord
+{
+	float time;						// seconds of rendering, excluding the error measurements
+	int passes;						// passes accumulated so far
+	double RMSE, relMSE;			// against the reference image
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  NextLine                                                                   |
+//  |  Read the next line of a list file that is not empty or a comment.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool NextLine( FILE* f, char* line, const int size )
+{
+	while (fgets( line, size, f ))
+	{
+		char* end = line + strlen( line );
+		while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ')) *--end = 0;
+		if (line[0] && line[0] != '#') return true;
+	}
+	return false;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  LoadBenchmarks                                                             |
+//  |  Read the list of runs.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool LoadBenchmarks( const char* file, vector<BenchRun>& runs )
+{
+	FILE* f = fopen( file, "r" );
+	if (!f) { printf( "could not open %s.\n", file ); return false; }
+	char line[1024], name[256], scene[256], dir[256], path[256];
+	while (NextLine( f, line, sizeof( line ) ))
+	{
+		BenchRun run;
+		if (sscanf( line, "%255s %255s %255s %255s %i", name, scene, dir, path, &run.frames ) != 5 || run.frames < 1)
+		{
+			printf( "skipping malformed benchmark line: %s\n", line );
+			continue;
+		}
+		run.name = name, run.sceneFile = scene, run.sceneDir = dir, run.cameraPath = path;
+		runs.push_back( run );
+	}
+	fclose( f );
+	return runs.size() > 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  LoadCameraPath                                                             |
+//  |  Load the camera keys of a path. Each key is loaded into the scene camera,  |
+//  |  so the remaining camera settings are those of the last key.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool LoadCameraPath( const char* file, vector<CameraKey>& keys )
+{
+	FILE* f = fopen( file, "r" );
+	if (!f) { printf( "could not open camera path %s.\n", file ); return false; }
+	char line[1024];
+	while (NextLine( f, line, sizeof( line ) ))
+	{
+		renderer->DeserializeCamera( line );
+		const Camera* camera = renderer->GetCamera();
+		CameraKey key = { camera->position, camera->direction, camera->FOV };
+		keys.push_back( key );
+	}
+	fclose( f );
+	return keys.size() > 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SetCamera                                                                  |
+//  |  Place the camera at time t (0..1) of the path.                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void SetCamera( const vector<CameraKey>& keys, const float t )
+{
+	const float p = t * (keys.size() - 1);
+	const int i = min( (int)p, (int)keys.size() - 1 ), j = min( i + 1, (int)keys.size() - 1 );
+	const float f = p - i;
+	Camera* camera = renderer->GetCamera();
+	camera->position = keys[i].position * (1 - f) + keys[j].position * f;
+	camera->direction = normalize( keys[i].direction * (1 - f) + keys[j].direction * f );
+	camera->FOV = keys[i].FOV * (1 - f) + keys[j].FOV * f;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Percentile                                                                 |
+//  |  Nearest-rank percentile of a sorted list.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+float Percentile( const vector<float>& sorted, const float p )
+{
+	const int rank = (int)ceilf( p * 0.01f * sorted.size() );
+	return sorted[max( 0, min( rank - 1, (int)sorted.size() - 1 ) )];
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  WriteResults                                                               |
+//  |  Per-frame CSV, a JSON summary and a line in summary.csv.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void WriteResults( const BenchRun& run, const char* coreName, const BenchSettings& settings, const vector<FrameRecord>& records )
+{
+	char file[512];
+	sprintf( file, "%s_%s.csv", run.name.c_str(), coreName );
+	FILE* f = fopen( file, "w" );
+	if (!f) { printf( "could not write %s.\n", file ); return; }
+	fprintf( f, "frame,frameTime,renderTime,Mrays,primaryRays,totalRays,traceTime0,traceTime1,traceTimeX,shadowTraceTime,shadeTime,sortTime,"
+		"denoiseTime,gasRebuildTime,gasRefitTime,syncTime,sceneUpdateTime,meshSyncTime,lightSyncTime,bytesSent,VRAMPeakTotal\n" );
+	vector<float> times;
+	double totalTime = 0, totalRays = 0;
+	for (int i = 0; i < (int)records.size(); i++)
+	{
+		const FrameRecord& r = records[i];
+		const CoreStats& c = r.core;
+		const SystemStats& s = r.system;
+		const float mrays = c.renderTime > 0 ? c.totalRays / (c.renderTime * 1e6f) : 0;
+		fprintf( f, "%i,%.6f,%.6f,%.3f,%u,%u,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%zu,%zu\n", i, r.frameTime, c.renderTime, mrays,
+			c.primaryRayCount, c.totalRays, c.traceTime0, c.traceTime1, c.traceTimeX, c.shadowTraceTime, c.shadeTime, c.sortTime, c.denoiseTime,
+			c.gasRebuildTime, c.gasRefitTime, s.syncTime, s.sceneUpdateTime, s.meshSyncTime, s.lightSyncTime, s.bytesSent, c.VRAMPeakTotal );
+		times.push_back( r.frameTime );
+		totalTime += c.renderTime, totalRays += c.totalRays;
+	}
+	fclose( f );
+	std::sort( times.begin(), times.end() );
+	double sum = 0;
+	for (float t : times) sum += t;
+	const float mean = (float)(sum / times.size()), p50 = Percentile( times, 50 ), p90 = Percentile( times, 90 ), p99 = Percentile( times, 99 );
+	const float mrays = totalTime > 0 ? (float)(totalRays / (totalTime * 1e6)) : 0;
+	const size_t peakVRAM = records.back().core.VRAMPeakTotal;
+	// JSON summary
+	sprintf( file, "%s_%s.json", run.name.c_str(), coreName );
+	f = fopen( file, "w" );
+	if (f)
+	{
+		fprintf( f, "{\n\t\"name\": \"%s\",\n\t\"core\": \"%s\",\n\t\"tag\": \"%s\",\n", run.name.c_str(), coreName, settings.tag );
+		fprintf( f, "\t\"width\": %i,\n\t\"height\": %i,\n\t\"spp\": %i,\n\t\"frames\": %i,\n", settings.width, settings.height, settings.spp, (int)records.size() );
+		fprintf( f, "\t\"frameTime\": { \"mean\": %.6f, \"min\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f },\n",
+			mean, times.front(), p50, p90, p99, times.back() );
+		fprintf( f, "\t\"Mrays\": %.3f,\n\t\"VRAMPeakTotal\": %zu\n}\n", mrays, peakVRAM );
+		fclose( f );
+	}
+	// summary line; the header is written when the file is new
+	FILE* s = fopen( "summary.csv", "r" );
+	const bool exists = s != 0;
+	if (s) fclose( s );
+	s = fopen( "summary.csv", "a" );
+	if (s)
+	{
+		if (!exists) fprintf( s, "tag,name,core,width,height,spp,frames,mean,p50,p90,p99,max,Mrays,VRAMPeakTotal\n" );
+		fprintf( s, "%s,%s,%s,%i,%i,%i,%i,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f,%zu\n", settings.tag, run.name.c_str(), coreName, settings.width, settings.height,
+			settings.spp, (int)records.size(), mean, p50, p90, p99, times.back(), mrays, peakVRAM );
+		fclose( s );
+	}
+	printf( "%s on %s: mean %.2fms, p50 %.2fms, p99 %.2fms, %.1f Mrays/s.\n", run.name.c_str(), coreName, mean * 1000, p50 * 1000, p99 * 1000, mrays );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreName                                                                   |
+//  |  Name of a core for result files: the dll name without path and             |
+//  |  extension.                                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+string CoreName( const char* core )
+{
+	string name = core;
+	const size_t slash = name.find_last_of( "/\\" );
+	if (slash != string::npos) name = name.substr( slash + 1 );
+	const size_t dot = name.find_last_of( '.' );
+	if (dot != string::npos) name = name.substr( 0, dot );
+	return name;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  OpenRun                                                                    |
+//  |  Create the renderer with a host target, load the scene of a run and its    |
+//  |  camera path.                                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool OpenRun( const BenchRun& run, const char* core, const BenchSettings& settings, vector<CameraKey>& keys )
+{
+	renderer = RenderAPI::CreateRenderAPI( core );
+	pixels.resize( settings.width * settings.height );
+	if (!renderer->SetHostTarget( pixels.data(), settings.width, settings.height, 1 ))
+	{
+		printf( "this core requires an OpenGL render target.\n" );
+		renderer->Shutdown();
+		return false;
+	}
+	renderer->AddScene( run.sceneFile.c_str(), run.sceneDir.c_str() );
+	if (!LoadCameraPath( run.cameraPath.c_str(), keys )) { renderer->Shutdown(); return false; }
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CloseRun                                                                   |
+//  |  Shut down the renderer of OpenRun.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CloseRun( const vector<CameraKey>& keys )
+{
+	// the camera saves itself to the last key file on shutdown; leave that key unchanged
+	SetCamera( keys, 1 );
+	renderer->Shutdown();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RunBenchmark                                                               |
+//  |  Execute a single run in this process. Animations and camera are set to     |
+//  |  the absolute time of each frame, so runs are reproducible.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RunBenchmark( const BenchRun& run, const char* core, const BenchSettings& settings )
+{
+	vector<CameraKey> keys;
+	if (!OpenRun( run, core, settings, keys )) return 1;
+	vector<FrameRecord> records;
+	Timer timer;
+	for (int frame = -settings.warmup; frame < run.frames; frame++)
+	{
+		// warmup frames replay the start of the run
+		const int f = max( 0, frame );
+		for (int i = 0; i < renderer->AnimationCount(); i++)
+		{
+			renderer->ResetAnimation( i );
+			if (f > 0) renderer->UpdateAnimation( i, f / settings.fps );
+		}
+		SetCamera( keys, run.frames > 1 ? (float)f / (run.frames - 1) : 0 );
+		timer.reset();
+		renderer->SynchronizeSceneData();
+		for (int pass = 0; pass < settings.spp; pass++) renderer->Render( pass == 0 ? Restart : Converge );
+		if (frame < 0) continue;
+		FrameRecord r = { timer.elapsed(), renderer->GetCoreStats(), renderer->GetSystemStats() };
+		records.push_back( r );
+	}
+	WriteResults( run, CoreName( core ).c_str(), settings, records );
+	CloseRun( keys );
+	return 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PrepareView                                                                |
+//  |  The view of the convergence runs: animations at their start, camera at the |
+//  |  first key of the path.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void PrepareView( const vector<CameraKey>& keys )
+{
+	for (int i = 0; i < renderer->AnimationCount(); i++) renderer->ResetAnimation( i );
+	SetCamera( keys, 0 );
+	renderer->SynchronizeSceneData();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ReferenceFile                                                              |
+//  |  Reference images are stored as width, height and pass count, followed by   |
+//  |  the float4 pixels. The name includes the size, so a reference is reused    |
+//  |  only at its own resolution.                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+string ReferenceFile( const BenchRun& run, const BenchSettings& settings )
+{
+	char file[512];
+	sprintf( file, "%s_reference_%ix%i.bin", run.name.c_str(), settings.width, settings.height );
+	return file;
+}
+bool LoadReference( const BenchRun& run, const BenchSettings& settings, vector<float4>& reference )
+{
+	FILE* f = fopen( ReferenceFile( run, settings ).c_str(), "rb" );
+	if (!f) return false;
+	int header[3] = {};
+	bool valid = fread( header, sizeof( header ), 1, f ) == 1 && header[0] == settings.width && header[1] == settings.height;
+	reference.resize( settings.width * settings.height );
+	if (valid) valid = fread( reference.data(), sizeof( float4 ), reference.size(), f ) == reference.size();
+	fclose( f );
+	return valid;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderReference                                                            |
+//  |  Accumulate the reference image of a run with the reference core.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderReference( const BenchRun& run, const BenchSettings& settings )
+{
+	vector<CameraKey> keys;
+	if (!OpenRun( run, settings.referenceCore, settings, keys )) return 1;
+	PrepareView( keys );
+	Timer timer;
+	for (int pass = 0; pass < settings.referenceSpp; pass++)
+	{
+		renderer->Render( pass == 0 ? Restart : Converge );
+		if ((pass & 255) == 255) printf( "reference for %s: %i of %i passes.\n", run.name.c_str(), pass + 1, settings.referenceSpp );
+	}
+	FILE* f = fopen( ReferenceFile( run, settings ).c_str(), "wb" );
+	const bool written = f != 0;
+	if (f)
+	{
+		const int header[3] = { settings.width, settings.height, settings.referenceSpp };
+		fwrite( header, sizeof( header ), 1, f );
+		fwrite( pixels.data(), sizeof( float4 ), pixels.size(), f );
+		fclose( f );
+	}
+	printf( "reference for %s: %i passes in %.1fs.\n", run.name.c_str(), settings.referenceSpp, timer.elapsed() );
+	CloseRun( keys );
+	return written ? 0 : 1;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  MeasureError                                                               |
+//  |  RMSE and relative MSE of the current frame against the reference, over the |
+//  |  rgb channels. relMSE divides by the squared reference value, so dark areas |
+//  |  weigh as much as bright ones; the epsilon keeps black pixels finite. LH2'19|
+//  +-----------------------------------------------------------------------------+
+void MeasureError( const vector<float4>& reference, double& RMSE, double& relMSE )
+{
+	double squared = 0, relative = 0;
+	for (size_t i = 0; i < pixels.size(); i++)
+	{
+		const float3 r = make_float3( reference[i] ), d = make_float3( pixels[i] ) - r, d2 = d * d;
+		squared += d2.x + d2.y + d2.z;
+		relative += d2.x / (r.x * r.x + 0.01f) + d2.y / (r.y * r.y + 0.01f) + d2.z / (r.z * r.z + 0.01f);
+	}
+	const double n = 3.0 * pixels.size();
+	RMSE = sqrt( squared / n ), relMSE = relative / n;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RunConvergence                                                             |
+//  |  Accumulate the view of the reference for the time budget and record the    |
+//  |  error over time. The clock is paused while the error is measured.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RunConvergence( const BenchRun& run, const char* core, const BenchSettings& settings )
+{
+	vector<float4> reference;
+	if (!LoadReference( run, settings, reference )) { printf( "no reference image for %s.\n", run.name.c_str() ); return 1; }
+	vector<CameraKey> keys;
+	if (!OpenRun( run, core, settings, keys )) return 1;
+	PrepareView( keys );
+	vector<ErrorRecord> records;
+	float elapsed = 0, nextMeasurement = 0;
+	Timer timer;
+	for (int pass = 0; elapsed < settings.convergeTime; pass++)
+	{
+		timer.reset();
+		renderer->Render( pass == 0 ? Restart : Converge );
+		elapsed += timer.elapsed();
+		if (elapsed < nextMeasurement && elapsed < settings.convergeTime) continue;
+		ErrorRecord r = { elapsed, pass + 1 };
+		MeasureError( reference, r.RMSE, r.relMSE );
+		records.push_back( r );
+		nextMeasurement = elapsed + settings.interval;
+	}
+	const string coreName = CoreName( core );
+	char file[512];
+	sprintf( file, "%s_%s_error.csv", run.name.c_str(), coreName.c_str() );
+	FILE* f = fopen( file, "w" );
+	if (f)
+	{
+		fprintf( f, "time,passes,RMSE,relMSE\n" );
+		for (const ErrorRecord& r : records) fprintf( f, "%.6f,%i,%.8f,%.8f\n", r.time, r.passes, r.RMSE, r.relMSE );
+		fclose( f );
+	}
+	// summary line; the header is written when the file is new
+	const ErrorRecord& last = records.back();
+	FILE* s = fopen( "errors.csv", "r" );
+	const bool exists = s != 0;
+	if (s) fclose( s );
+	s = fopen( "errors.csv", "a" );
+	if (s)
+	{
+		if (!exists) fprintf( s, "tag,name,core,width,height,time,passes,RMSE,relMSE\n" );
+		fprintf( s, "%s,%s,%s,%i,%i,%.6f,%i,%.8f,%.8f\n", settings.tag, run.name.c_str(), coreName.c_str(), settings.width, settings.height,
+			last.time, last.passes, last.RMSE, last.relMSE );
+		fclose( s );
+	}
+	printf( "%s on %s: %i passes in %.1fs, RMSE %.5f, relMSE %.5f.\n", run.name.c_str(), coreName.c_str(), last.passes, last.time, last.RMSE, last.relMSE );
+	CloseRun( keys );
+	return 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	BenchSettings settings;
+	const char* listFile = "benchmarks.txt";
+	vector<const char*> cores;
+	int runIdx = -1;
+	bool reference = false;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* a = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (!strcmp( a, "-core" ) && hasValue) cores.push_back( argv[++i] );
+		else if (!strcmp( a, "-size" ) && i + 2 < argc) settings.width = atoi( argv[++i] ), settings.height = atoi( argv[++i] );
+		else if (!strcmp( a, "-spp" ) && hasValue) settings.spp = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-warmup" ) && hasValue) settings.warmup = max( 0, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-fps" ) && hasValue) settings.fps = (float)atof( argv[++i] );
+		else if (!strcmp( a, "-tag" ) && hasValue) settings.tag = argv[++i];
+		else if (!strcmp( a, "-converge" ) && hasValue) settings.convergeTime = (float)atof( argv[++i] );
+		else if (!strcmp( a, "-interval" ) && hasValue) settings.interval = (float)atof( argv[++i] );
+		else if (!strcmp( a, "-refspp" ) && hasValue) settings.referenceSpp = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-refcore" ) && hasValue) settings.referenceCore = argv[++i];
+		else if (!strcmp( a, "-run" ) && hasValue) runIdx = atoi( argv[++i] );
+		else if (!strcmp( a, "-reference" )) reference = true;
+		else if (a[0] != '-') listFile = a;
+		else
+		{
+			printf( "usage: benchapp [benchmark list] [-core dll]... [-size w h] [-spp n] [-warmup n] [-fps f] [-tag label]\n"
+				"                [-converge seconds] [-interval seconds] [-refspp n] [-refcore dll]\n" );
+			return 1;
+		}
+	}
+	if (cores.empty()) cores.push_back( "rendercore_optix7.dll" );
+	vector<BenchRun> runs;
+	if (!LoadBenchmarks( listFile, runs )) return 1;
+	// child process: a single run on a single core, or the reference image of a run
+	if (runIdx >= (int)runs.size()) return 1;
+	if (runIdx >= 0 && reference) return RenderReference( runs[runIdx], settings );
+	if (runIdx >= 0) return settings.convergeTime > 0 ? RunConvergence( runs[runIdx], cores[0], settings ) : RunBenchmark( runs[runIdx], cores[0], settings );
+	// driver: one process per run and core, so each starts from a fresh scene and device
+	char options[1024];
+	sprintf( options, "-size %i %i -spp %i -warmup %i -fps %f -tag \"%s\" -converge %f -interval %f -refspp %i -refcore \"%s\"", settings.width,
+		settings.height, settings.spp, settings.warmup, settings.fps, settings.tag, settings.convergeTime, settings.interval, settings.referenceSpp,
+		settings.referenceCore );
+	int failed = 0;
+	char command[2048];
+	// convergence runs: render the missing reference images first
+	if (settings.convergeTime > 0) for (int i = 0; i < (int)runs.size(); i++)
+	{
+		vector<float4> existing;
+		if (LoadReference( runs[i], settings, existing )) continue;
+		sprintf( command, "\"\"%s\" \"%s\" -run %i -reference %s\"", argv[0], listFile, i, options );
+		printf( "rendering reference for %s on %s...\n", runs[i].name.c_str(), settings.referenceCore );
+		if (system( command ) != 0) printf( "reference for %s failed.\n", runs[i].name.c_str() ), failed++;
+	}
+	for (const char* core : cores) for (int i = 0; i < (int)runs.size(); i++)
+	{
+		sprintf( command, "\"\"%s\" \"%s\" -run %i -core \"%s\" %s\"", argv[0], listFile, i, core, options );
+		printf( "running %s on %s...\n", runs[i].name.c_str(), core );
+		if (system( command ) != 0) printf( "%s on %s failed.\n", runs[i].name.c_str(), core ), failed++;
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+// EOF
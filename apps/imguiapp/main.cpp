@@ -22,8 +22,10 @@ static GLTexture* renderTarget = 0;
 static Shader* shader = 0;
 static uint scrwidth = 0, scrheight = 0, scrspp = 1;
 static bool camMoved = false, spaceDown = false, hasFocus = true, running = true, animPaused = false;
+static bool showHUD = true;
 
 #include "main_tools.h"
+#include "main_hud.h"
 
 //  +-----------------------------------------------------------------------------+
 //  |  PrepareScene                                                               |
@@ -85,6 +87,7 @@ int main()
 	renderer = RenderAPI::CreateRenderAPI( "rendercore_optixprime_b.dll" );			// OPTIX PRIME, best for pre-RTX CUDA devices
 	// renderer = RenderAPI::CreateRenderAPI( "rendercore_primeref.dll" );			// REFERENCE, for image validation
 	// renderer = RenderAPI::CreateRenderAPI( "rendercore_softrasterizer.dll" );	// RASTERIZER, your only option if not on NVidia
+	// renderer = RenderAPI::CreateRenderAPI( "rendercore_opengl.dll" );			// OPENGL, hardware rasterized preview for editing
 
 	renderer->DeserializeCamera( "camera.xml" );
 	// initialize scene
@@ -95,6 +98,7 @@ int main()
 	Timer timer;
 	timer.reset();
 	float deltaTime = 0;
+	PerformanceHUD hud;
 	while (!glfwWindowShouldClose( window ))
 	{
 		// detect camera changes
@@ -138,6 +142,8 @@ int main()
 		ImGui::Text( "# deep rays:  %6ik (%6.1fM/s)", coreStats.deepRayCount / 1000, coreStats.deepRayCount / (max( 1.0f, coreStats.traceTimeX * 1000000 )) );
 		ImGui::Text( "# shadw rays: %6ik (%6.1fM/s)", coreStats.totalShadowRays / 1000, coreStats.totalShadowRays / (max( 1.0f, coreStats.shadowTraceTime * 1000000 )) );
 		ImGui::End();
+		hud.Update( deltaTime, coreStats, systemStats );
+		if (showHUD) hud.Draw();
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData( ImGui::GetDrawData() );
 		// finalize
@@ -0,0 +1,108 @@
+/* main_hud.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+
+#define HUDHISTORY		512		// frames kept for the graphs and the lows
+#define HUDBINS			32		// frame time histogram bins
+
+//  +-----------------------------------------------------------------------------+
+//  |  PerformanceHUD                                                             |
+//  |  Rolling history of the frame time and its phases, fed from CoreStats and   |
+//  |  SystemStats once per frame, drawn as an ImGui window.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+class PerformanceHUD
+{
+public:
+	enum { FRAME = 0, SCENE, PRIMARY, SECONDARY, DEEP, SHADOW, SHADE, FILTER, FINALIZE, PHASES };
+	void Update( const float frameTime, const CoreStats& core, const SystemStats& system )
+	{
+		// store the phase timings of the last frame, in milliseconds
+		float* t = history[cursor];
+		t[FRAME] = frameTime * 1000;
+		t[SCENE] = system.syncTime * 1000;
+		t[PRIMARY] = core.traceTime0 * 1000;
+		t[SECONDARY] = core.traceTime1 * 1000;
+		t[DEEP] = core.traceTimeX * 1000;
+		t[SHADOW] = core.shadowTraceTime * 1000;
+		t[SHADE] = (core.shadeTime + core.sortTime) * 1000;
+		t[FILTER] = core.denoiseTime * 1000;
+		t[FINALIZE] = core.finalizeTime * 1000;
+		cursor = (cursor + 1) % HUDHISTORY;
+		frames = min( frames + 1, HUDHISTORY );
+		stats = core;
+		mrays = core.totalRays / max( 1.0f, core.renderTime * 1000000 );
+	}
+	void Draw()
+	{
+		static const char* names[PHASES] = { "frame", "scene sync", "primary", "secondary", "deep", "shadow", "shade", "filter", "finalize" };
+		if (frames == 0) return;
+		ImGui::Begin( "Performance", 0 );
+		// rolling graphs, oldest frame left; all phases share the frame's scale so they compare at a glance
+		float values[HUDHISTORY], peak = 1;
+		for (int i = 0; i < frames; i++) peak = max( peak, history[i][FRAME] );
+		for (int p = 0; p < PHASES; p++)
+		{
+			float average = 0;
+			for (int i = 0; i < frames; i++)
+			{
+				const float v = history[(cursor - frames + i + HUDHISTORY) % HUDHISTORY][p];
+				values[i] = v, average += v;
+			}
+			char overlay[64];
+			sprintf( overlay, "%s %6.2fms", names[p], average / frames );
+			ImGui::PushID( p );
+			ImGui::PlotLines( "##phase", values, frames, 0, overlay, 0, p == FRAME ? peak : peak * 0.5f, ImVec2( -1, p == FRAME ? 60.0f : 30.0f ) );
+			ImGui::PopID();
+		}
+		// frame time distribution: the lows are the frame times that 1% and 0.1% of the frames exceed
+		float sorted[HUDHISTORY];
+		for (int i = 0; i < frames; i++) sorted[i] = history[i][FRAME];
+		std::sort( sorted, sorted + frames );
+		const float low1 = sorted[min( frames - 1, (int)(frames * 0.99f) )];
+		const float low01 = sorted[min( frames - 1, (int)(frames * 0.999f) )];
+		const float range = sorted[frames - 1] * 1.001f;
+		float bins[HUDBINS] = {};
+		for (int i = 0; i < frames; i++) bins[min( HUDBINS - 1, (int)(sorted[i] * HUDBINS / range) )]++;
+		char overlay[64];
+		sprintf( overlay, "0 - %.1fms", range );
+		ImGui::PlotHistogram( "##frametimes", bins, HUDBINS, 0, overlay, 0, FLT_MAX, ImVec2( -1, 60 ) );
+		ImGui::Text( "median:  %6.2fms (%5.1ffps)", sorted[frames / 2], 1000 / max( 0.001f, sorted[frames / 2] ) );
+		ImGui::Text( "1%% low:  %6.2fms (%5.1ffps)", low1, 1000 / max( 0.001f, low1 ) );
+		ImGui::Text( "0.1%% low:%6.2fms (%5.1ffps)", low01, 1000 / max( 0.001f, low01 ) );
+		ImGui::Text( "rays:    %6.1fM/s", mrays );
+		// device memory held by the tagged buffers of the core
+		static const char* categories[VRAMCategories] = { "other", "bvh", "geometry", "path states", "frame buffers", "textures", "scene" };
+		size_t total = 0;
+		for (int i = 0; i < VRAMCategories; i++) total += stats.VRAMInUse[i];
+		ImGui::Text( "VRAM:    %6.1fMB (peak %.1fMB, cached %.1fMB)", total / 1048576.0f, stats.VRAMPeakTotal / 1048576.0f, stats.VRAMCached / 1048576.0f );
+		if (stats.VRAMAliased) ImGui::Text( "aliased: %6.1fMB saved", stats.VRAMAliased / 1048576.0f );
+		if (stats.VRAMPeer) ImGui::Text( "peers:   %6.1fMB", stats.VRAMPeer / 1048576.0f );
+		for (int i = 0; i < VRAMCategories; i++)
+		{
+			char label[64];
+			sprintf( label, "%s %.1fMB", categories[i], stats.VRAMInUse[i] / 1048576.0f );
+			ImGui::ProgressBar( total ? (float)stats.VRAMInUse[i] / total : 0, ImVec2( -1, 0 ), label );
+		}
+		ImGui::End();
+	}
+private:
+	float history[HUDHISTORY][PHASES];	// ring buffer of phase timings, in ms
+	int cursor = 0, frames = 0;			// next slot in history, and the number of valid frames
+	CoreStats stats;					// statistics of the last frame
+	float mrays = 0;					// rays per microsecond of render time, i.e. Mrays/s
+};
+
+// EOF
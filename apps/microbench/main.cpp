@@ -0,0 +1,352 @@
+/* main.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Micro-benchmarks for the host-side hot paths of the RenderSystem, on
+   synthetic inputs: skinning and morphing, scene graph updates, MIP map
+   construction, bump to normal map conversion, change tracking, light
+   synchronization and the OBJ and glTF loaders. Input sizes grow with
+   -scale. The RenderSystem runs on a stub core that discards its input,
+   so only host work is measured. Compiled with RENDERSYSTEMBUILD, as the
+   benchmarks use the RenderSystem internals directly.
+*/
+
+#include "platform.h"
+#include "system.h"
+#include "rendersystem.h"
+
+static RenderSystem* renderSystem = 0;
+
+//  +-----------------------------------------------------------------------------+
+//  |  NullCore                                                                   |
+//  |  A core that accepts and discards all data.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+class NullCore : public CoreAPI_Base
+{
+public:
+	CoreStats GetCoreStats() { return CoreStats(); }
+	void Init() {}
+	void SetProbePos( const int2 pos ) {}
+	void SetTarget( GLTexture* target, const uint spp ) {}
+	void Setting( const char* name, float value ) {}
+	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast ) {}
+	void Shutdown() {}
+	void SetTextures( const CoreTexDesc* tex, const int textureCount ) {}
+	void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount ) {}
+	void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
+		const CorePointLight* pointLights, const int pointLightCount,
+		const CoreSpotLight* spotLights, const int spotLightCount,
+		const CoreDirectionalLight* directionalLights, const int directionalLightCount ) {}
+	void SetSkyData( const float3* pixels, const uint width, const uint height ) {}
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint ) {}
+	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform ) {}
+	void UpdateToplevel() {}
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Report                                                                     |
+//  |  Print the fastest and the median time of a benchmark.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void Report( const char* name, const char* size, vector<float> times )
+{
+	std::sort( times.begin(), times.end() );
+	printf( "%-28s %-22s min %9.3fms  median %9.3fms\n", name, size, times.front() * 1000, times[times.size() / 2] * 1000 );
+}
+
+// Measure: time each of a number of calls of a function
+template <class T> vector<float> Measure( const int iterations, const T& func )
+{
+	vector<float> times;
+	Timer timer;
+	for (int i = 0; i < iterations; i++) timer.reset(), func( i ), times.push_back( timer.elapsed() );
+	return times;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Grid                                                                       |
+//  |  Indexed triangle grid in the xz-plane, two triangles per cell.       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void Grid( const int cells, vector<int>& indices, vector<float3>& vertices, vector<float3>& normals, vector<float2>& uvs )
+{
+	for (int y = 0; y <= cells; y++) for (int x = 0; x <= cells; x++)
+	{
+		vertices.push_back( make_float3( (float)x, 0, (float)y ) );
+		normals.push_back( make_float3( 0, 1, 0 ) );
+		uvs.push_back( make_float2( (float)x / cells, (float)y / cells ) );
+	}
+	for (int y = 0; y < cells; y++) for (int x = 0; x < cells; x++)
+	{
+		const int v = x + y * (cells + 1);
+		indices.push_back( v ), indices.push_back( v + cells + 1 ), indices.push_back( v + 1 );
+		indices.push_back( v + 1 ), indices.push_back( v + cells + 1 ), indices.push_back( v + cells + 2 );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BenchSkinning                                                              |
+//  |  HostMesh::SetPose with a skin, and with morph targets.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BenchSkinning( const float scale )
+{
+	const int cells = (int)(256 * sqrtf( scale )), jointCount = 64, morphTargets = 4;
+	vector<int> indices;
+	vector<float3> vertices, normals;
+	vector<float2> uvs;
+	Grid( cells, indices, vertices, normals, uvs );
+	const int material = HostScene::AddMaterial( make_float3( 0.8f ) );
+	vector<uint4> joints;
+	vector<float4> weights;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		joints.push_back( make_uint4( RandomUInt() % jointCount, RandomUInt() % jointCount, RandomUInt() % jointCount, RandomUInt() % jointCount ) );
+		weights.push_back( make_float4( 0.4f, 0.3f, 0.2f, 0.1f ) );
+	}
+	char size[64];
+	sprintf( size, "%i tris", cells * cells * 2 );
+	// skin
+	HostMesh skinned;
+	skinned.BuildFromIndexedData( indices, vertices, normals, uvs, vector<HostMesh::Pose>(), joints, weights, material );
+	HostSkin skin;
+	skin.jointMat.resize( jointCount );
+	for (int i = 0; i < jointCount; i++) skin.jointMat[i] = mat4::RotateY( i * 0.01f ) * mat4::Translate( make_float3( 0, i * 0.01f, 0 ) );
+	Report( "HostMesh::SetPose (skin)", size, Measure( 20, [&]( int ) { skinned.SetPose( &skin, mat4() ); } ) );
+	// morph targets; the first pose is the base pose
+	vector<HostMesh::Pose> poses( morphTargets + 1 );
+	for (HostMesh::Pose& pose : poses)
+	{
+		pose.positions = vertices, pose.normals = normals;
+		pose.tangents.resize( vertices.size(), make_float3( 1, 0, 0 ) );
+	}
+	HostMesh morphed;
+	morphed.BuildFromIndexedData( indices, vertices, normals, uvs, poses, vector<uint4>(), vector<float4>(), material );
+	vector<float> morphWeights( morphTargets, 0.25f );
+	Report( "HostMesh::SetPose (morph)", size, Measure( 20, [&]( int ) { morphed.SetPose( morphWeights ); } ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BenchSceneGraph                                                            |
+//  |  Scene graph update through RenderSystem::SynchronizeSceneData, for a tree  |
+//  |  of empty nodes with instances of a small mesh as leaves. Every iteration   |
+//  |  moves all roots, so all combined transforms change.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BenchSceneGraph( const float scale )
+{
+	const int nodeCount = (int)(100000 * scale), fanout = 8, rootCount = 16;
+	vector<int> indices;
+	vector<float3> vertices, normals;
+	vector<float2> uvs;
+	Grid( 1, indices, vertices, normals, uvs );
+	HostMesh* mesh = new HostMesh();
+	mesh->BuildFromIndexedData( indices, vertices, normals, uvs, vector<HostMesh::Pose>(), vector<uint4>(), vector<float4>(), HostScene::AddMaterial( make_float3( 0.8f ) ) );
+	mesh->ID = (int)HostScene::meshes.size();
+	HostScene::meshes.push_back( mesh );
+	// breadth-first tree: the parent of node i is node (i - rootCount) / fanout
+	const int firstNode = (int)HostScene::nodes.size();
+	HostScene::nodePool.Reserve( nodeCount );
+	for (int i = 0; i < nodeCount; i++)
+	{
+		const bool leaf = i * fanout + rootCount >= nodeCount;
+		HostNode* node = HostScene::nodePool.New( leaf ? mesh->ID : -1, mat4::Translate( make_float3( (float)(i % 7), 0, (float)(i % 5) ) ) );
+		node->ID = firstNode + i;
+		HostScene::nodes.push_back( node );
+		if (i < rootCount) HostScene::scene.push_back( node->ID ); else HostScene::nodes[firstNode + (i - rootCount) / fanout]->childIdx.push_back( node->ID );
+	}
+	HostScene::graphChanged = true;
+	renderSystem->SynchronizeSceneData();
+	char size[64];
+	sprintf( size, "%i nodes", nodeCount );
+	vector<float> sceneUpdate, graphSync;
+	Measure( 20, [&]( int i ) {
+		for (int r = 0; r < rootCount; r++) HostScene::SetNodeTransform( firstNode + r, mat4::RotateY( i * 0.1f ) );
+		renderSystem->SynchronizeSceneData();
+		const SystemStats stats = renderSystem->GetSystemStats();
+		sceneUpdate.push_back( stats.sceneUpdateTime ), graphSync.push_back( stats.graphSyncTime );
+	} );
+	Report( "HostNode transforms", size, sceneUpdate );
+	Report( "UpdateSceneGraph", size, graphSync );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BenchTextures                                                              |
+//  |  HostTexture::ConstructMIPmaps and HostTexture::BumpToNormalMap.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BenchTextures( const float scale )
+{
+	HostTexture texture;
+	texture.width = texture.height = ((int)(2048 * sqrtf( scale )) + 15) & ~15;
+	texture.MIPlevels = MIPLEVELCOUNT;
+	const int pixels = texture.PixelsNeeded( texture.width, texture.height, MIPLEVELCOUNT );
+	texture.idata = (uchar4*)MALLOC64( pixels * sizeof( uchar4 ) );
+	for (uint i = 0; i < texture.width * texture.height; i++) ((uint*)texture.idata)[i] = RandomUInt();
+	char size[64];
+	sprintf( size, "%ix%i", texture.width, texture.height );
+	Report( "HostTexture::ConstructMIPmaps", size, Measure( 10, [&]( int ) { texture.ConstructMIPmaps(); } ) );
+	Report( "HostTexture::BumpToNormalMap", size, Measure( 10, [&]( int ) { texture.BumpToNormalMap( 1.0f ); } ) );
+	FREE64( texture.idata );
+	texture.idata = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BenchChangeTracking                                                        |
+//  |  TRACKCHANGES: Changed() and ContentChanged() over a large array of         |
+//  |  objects of the size of a typical scene object.                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct TrackedObject
+{
+	float4 data[8];
+	TRACKCHANGES;
+};
+void BenchChangeTracking( const float scale )
+{
+	const int count = (int)(1000000 * scale);
+	vector<TrackedObject> objects( count );
+	for (int i = 0; i < count; i += 100) objects[i].MarkAsDirty();
+	char size[64];
+	sprintf( size, "%i objects", count );
+	int changed = 0;
+	Report( "TRACKCHANGES Changed", size, Measure( 20, [&]( int ) { for (auto& o : objects) changed += o.Changed(); } ) );
+	Report( "TRACKCHANGES ContentChanged", size, Measure( 5, [&]( int ) { for (auto& o : objects) changed += o.ContentChanged(); } ) );
+	if (changed < 0) printf( "\n" ); // keep the loops
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BenchLights                                                                |
+//  |  RenderSystem::SynchronizeLights with many point and spot lights: change    |
+//  |  detection only, and with 1% of the lights moved.                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BenchLights( const float scale )
+{
+	const int pointCount = (int)(10000 * scale), spotCount = (int)(1000 * scale);
+	for (int i = 0; i < pointCount; i++) HostScene::AddPointLight( make_float3( (float)(i % 100), 5, (float)(i / 100) ), make_float3( 1 ) );
+	for (int i = 0; i < spotCount; i++) HostScene::AddSpotLight( make_float3( (float)(i % 100), 8, (float)(i / 100) ), make_float3( 0, -1, 0 ), 0.9f, 0.8f, make_float3( 1 ) );
+	renderSystem->SynchronizeSceneData();
+	char size[64];
+	sprintf( size, "%i lights", pointCount + spotCount );
+	vector<float> unchanged, moved;
+	Measure( 20, [&]( int ) { renderSystem->SynchronizeSceneData(); unchanged.push_back( renderSystem->GetSystemStats().lightSyncTime ); } );
+	Measure( 20, [&]( int i ) {
+		for (int j = i % 100; j < pointCount; j += 100)
+		{
+			HostPointLight* light = HostScene::pointLights[HostScene::pointLights.size() - pointCount + j];
+			light->position.y += 0.01f;
+			light->MarkAsDirty();
+		}
+		renderSystem->SynchronizeSceneData();
+		moved.push_back( renderSystem->GetSystemStats().lightSyncTime );
+	} );
+	Report( "SynchronizeLights (static)", size, unchanged );
+	Report( "SynchronizeLights (1% moved)", size, moved );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Base64                                                                     |
+//  |  Encode binary data, for the data uri of a glTF buffer.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+string Base64( const uchar* data, const size_t size )
+{
+	static const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string result;
+	result.reserve( (size + 2) / 3 * 4 );
+	for (size_t i = 0; i < size; i += 3)
+	{
+		const uint b = (data[i] << 16) | ((i + 1 < size ? data[i + 1] : 0) << 8) | (i + 2 < size ? data[i + 2] : 0);
+		result += digits[(b >> 18) & 63], result += digits[(b >> 12) & 63];
+		result += i + 1 < size ? digits[(b >> 6) & 63] : '=';
+		result += i + 2 < size ? digits[b & 63] : '=';
+	}
+	return result;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BenchLoaders                                                               |
+//  |  Load a synthetic grid as OBJ and as glTF with an embedded buffer. The      |
+//  |  scene cache is deleted before every glTF load.                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BenchLoaders( const float scale )
+{
+	const int cells = (int)(316 * sqrtf( scale ));
+	vector<int> indices;
+	vector<float3> vertices, normals;
+	vector<float2> uvs;
+	Grid( cells, indices, vertices, normals, uvs );
+	char size[64];
+	sprintf( size, "%i tris", cells * cells * 2 );
+	// obj
+	FILE* f = fopen( "microbench_grid.obj", "w" );
+	if (!f) { printf( "could not write microbench_grid.obj.\n" ); return; }
+	for (const float3& v : vertices) fprintf( f, "v %f %f %f\n", v.x, v.y, v.z );
+	for (const float3& n : normals) fprintf( f, "vn %f %f %f\n", n.x, n.y, n.z );
+	for (const float2& t : uvs) fprintf( f, "vt %f %f\n", t.x, t.y );
+	for (size_t i = 0; i < indices.size(); i += 3)
+		fprintf( f, "f %i/%i/%i %i/%i/%i %i/%i/%i\n", indices[i] + 1, indices[i] + 1, indices[i] + 1,
+			indices[i + 1] + 1, indices[i + 1] + 1, indices[i + 1] + 1, indices[i + 2] + 1, indices[i + 2] + 1, indices[i + 2] + 1 );
+	fclose( f );
+	Report( "OBJ loader", size, Measure( 3, [&]( int ) { HostScene::AddMesh( "microbench_grid.obj", "./" ); } ) );
+	// gltf: positions, followed by 32-bit indices, in a single embedded buffer
+	vector<uchar> buffer( vertices.size() * sizeof( float3 ) + indices.size() * sizeof( uint ) );
+	memcpy( buffer.data(), vertices.data(), vertices.size() * sizeof( float3 ) );
+	memcpy( buffer.data() + vertices.size() * sizeof( float3 ), indices.data(), indices.size() * sizeof( uint ) );
+	f = fopen( "microbench_grid.gltf", "w" );
+	if (!f) { printf( "could not write microbench_grid.gltf.\n" ); return; }
+	const size_t positionBytes = vertices.size() * sizeof( float3 ), indexBytes = indices.size() * sizeof( uint );
+	fprintf( f, "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],\n" );
+	fprintf( f, "\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorFactor\":[0.8,0.8,0.8,1]}}],\n" );
+	fprintf( f, "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0},\"indices\":1,\"material\":0}]}],\n" );
+	fprintf( f, "\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC3\",\"min\":[0,0,0],\"max\":[%i,0,%i]},", vertices.size(), cells, cells );
+	fprintf( f, "{\"bufferView\":1,\"componentType\":5125,\"count\":%zu,\"type\":\"SCALAR\"}],\n", indices.size() );
+	fprintf( f, "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":%zu,\"target\":34962},", positionBytes );
+	fprintf( f, "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34963}],\n", positionBytes, indexBytes );
+	fprintf( f, "\"buffers\":[{\"byteLength\":%zu,\"uri\":\"data:application/octet-stream;base64,%s\"}]}\n", buffer.size(), Base64( buffer.data(), buffer.size() ).c_str() );
+	fclose( f );
+	Report( "glTF loader", size, Measure( 3, [&]( int ) {
+		remove( "./microbench_grid.gltf.cache" );
+		HostScene::AddScene( "microbench_grid.gltf", "./", mat4::Identity() );
+	} ) );
+	remove( "./microbench_grid.gltf.cache" );
+	remove( "microbench_grid.obj" );
+	remove( "microbench_grid.gltf" );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	float scale = 1;
+	const char* only = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp( argv[i], "-scale" ) && i + 1 < argc) scale = max( 0.01f, (float)atof( argv[++i] ) );
+		else if (!strcmp( argv[i], "-only" ) && i + 1 < argc) only = argv[++i];
+		else
+		{
+			printf( "usage: microbench [-scale f] [-only skinning|graph|textures|tracking|lights|loaders]\n" );
+			return 1;
+		}
+	}
+	NullCore core;
+	renderSystem = new RenderSystem();
+	renderSystem->Init( &core );
+	auto Enabled = [&]( const char* name ) { return !only || !strcmp( only, name ); };
+	if (Enabled( "skinning" )) BenchSkinning( scale );
+	if (Enabled( "graph" )) BenchSceneGraph( scale );
+	if (Enabled( "textures" )) BenchTextures( scale );
+	if (Enabled( "tracking" )) BenchChangeTracking( scale );
+	if (Enabled( "lights" )) BenchLights( scale );
+	if (Enabled( "loaders" )) BenchLoaders( scale );
+	renderSystem->Shutdown();
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,374 @@
+/* main.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Synthetic scene generator for scaling tests. A scene is built from a
+   number of each element: unique meshes (small grids), instances of
+   those meshes, procedural textures, materials, emissive quads as area
+   lights, point lights and skinned characters (a strip skinned to a
+   chain of joint nodes). Every frame a fraction of the instances moves
+   and all characters animate, and the SystemStats phase timings of
+   SynchronizeSceneData are averaged over the frames, together with the
+   render and shade time of the core.
+
+   With -sweep <element>, the count of that element doubles from 1 to
+   -max, with the other counts fixed; each step runs in a separate
+   process, as the scene cannot be emptied, and appends a line to
+   scenegen.csv, which charts the scaling curve of every phase. Without
+   -core, the RenderSystem runs on a stub core that discards its input,
+   so only host work is measured. Compiled with RENDERSYSTEMBUILD, as the
+   scene is built in HostScene directly.
+*/
+
+#include "platform.h"
+#include "system.h"
+#include "rendersystem.h"
+
+static RenderSystem* renderSystem = 0;
+static vector<float4> pixels;		// host render target, with -core
+
+#define ELEMENTS	7
+static const char* elementNames[ELEMENTS] = { "meshes", "instances", "textures", "materials", "arealights", "pointlights", "skinned" };
+
+struct GenSettings
+{
+	int count[ELEMENTS] = { 16, 1024, 16, 16, 4, 16, 4 };	// per element, in the order of elementNames
+	int frames = 32;				// measured frames per step
+	float moving = 0.1f;			// fraction of the instances that moves every frame
+	int width = 640, height = 360;	// render target, with -core
+	const char* core = 0;			// core dll; 0: NullCore
+	const char* tag = "";			// label for the lines in scenegen.csv
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  NullCore                                                                   |
+//  |  A core that accepts and discards all data.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+class NullCore : public CoreAPI_Base
+{
+public:
+	CoreStats GetCoreStats() { return CoreStats(); }
+	void Init() {}
+	void SetProbePos( const int2 pos ) {}
+	void SetTarget( GLTexture* target, const uint spp ) {}
+	void Setting( const char* name, float value ) {}
+	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast ) {}
+	void Shutdown() {}
+	void SetTextures( const CoreTexDesc* tex, const int textureCount ) {}
+	void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount ) {}
+	void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
+		const CorePointLight* pointLights, const int pointLightCount,
+		const CoreSpotLight* spotLights, const int spotLightCount,
+		const CoreDirectionalLight* directionalLights, const int directionalLightCount ) {}
+	void SetSkyData( const float3* pixels, const uint width, const uint height ) {}
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint ) {}
+	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform ) {}
+	void UpdateToplevel() {}
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Grid                                                                       |
+//  |  Indexed triangle grid in the xz-plane, two triangles per cell, of size     |
+//  |  'extent'.                                                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+void Grid( const int cells, const float extent, vector<int>& indices, vector<float3>& vertices, vector<float3>& normals, vector<float2>& uvs )
+{
+	for (int y = 0; y <= cells; y++) for (int x = 0; x <= cells; x++)
+	{
+		vertices.push_back( make_float3( (float)x, 0, (float)y ) * (extent / cells) );
+		normals.push_back( make_float3( 0, 1, 0 ) );
+		uvs.push_back( make_float2( (float)x / cells, (float)y / cells ) );
+	}
+	for (int y = 0; y < cells; y++) for (int x = 0; x < cells; x++)
+	{
+		const int v = x + y * (cells + 1);
+		indices.push_back( v ), indices.push_back( v + cells + 1 ), indices.push_back( v + 1 );
+		indices.push_back( v + 1 ), indices.push_back( v + cells + 1 ), indices.push_back( v + cells + 2 );
+	}
+}
+
+// GridPosition: position i of a square grid of 'count' cells with a spacing of 'spacing'
+float3 GridPosition( const int i, const int count, const float spacing )
+{
+	const int side = max( 1, (int)ceilf( sqrtf( (float)count ) ) );
+	return make_float3( (i % side) - side * 0.5f, 0, (i / side) - side * 0.5f ) * spacing;
+}
+
+// AddMesh: add a mesh to the scene, as HostScene::AddMesh does for a loaded one
+int AddMesh( HostMesh* mesh )
+{
+	mesh->ID = (int)HostScene::meshes.size();
+	HostScene::meshes.push_back( mesh );
+	return mesh->ID;
+}
+
+// AddNode: add a node to the scene graph, as a root or as the child of 'parent'
+int AddNode( const int meshId, const mat4& transform, const int parent )
+{
+	HostNode* node = HostScene::nodePool.New( meshId, transform );
+	node->ID = (int)HostScene::nodes.size();
+	HostScene::nodes.push_back( node );
+	if (parent < 0) node->rootIdx = (int)HostScene::scene.size(), HostScene::scene.push_back( node->ID );
+	else HostScene::nodes[parent]->childIdx.push_back( node->ID );
+	HostScene::graphChanged = true;
+	return node->ID;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  AddTexture                                                                 |
+//  |  A procedural 64x64 checker texture with MIP maps. Each texture has its own |
+//  |  origin and colors, so none of them is shared.                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+int AddTexture( const int idx )
+{
+	HostTexture* texture = new HostTexture();
+	texture->width = texture->height = 64;
+	texture->MIPlevels = MIPLEVELCOUNT;
+	texture->flags = HostTexture::LDR;
+	texture->origin = texture->name = "scenegen_texture_" + to_string( idx );
+	texture->idata = (uchar4*)MALLOC64( texture->PixelsNeeded( 64, 64, MIPLEVELCOUNT ) * sizeof( uchar4 ) );
+	const uint color = RandomUInt() | 0xff000000;
+	for (int y = 0; y < 64; y++) for (int x = 0; x < 64; x++) ((uint*)texture->idata)[x + y * 64] = ((x ^ y) & 8) ? color : 0xff808080;
+	texture->ConstructMIPmaps();
+	texture->ID = (uint)HostScene::textures.size();
+	HostScene::textures.push_back( texture );
+	return texture->ID;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  AddCharacter                                                               |
+//  |  A vertical strip of 32x32 cells, skinned to a chain of joint nodes that    |
+//  |  starts at the root of the character.                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+#define CHARACTERJOINTS	8
+void AddCharacter( const float3 pos, const int material )
+{
+	vector<int> indices;
+	vector<float3> vertices, normals;
+	vector<float2> uvs;
+	Grid( 32, 2.0f, indices, vertices, normals, uvs );
+	// stand the strip up: the grid's z becomes the height, and selects the joint
+	vector<uint4> joints;
+	vector<float4> weights;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		vertices[i] = make_float3( vertices[i].x * 0.25f, vertices[i].z, 0 ), normals[i] = make_float3( 0, 0, 1 );
+		const int joint = min( CHARACTERJOINTS - 1, (int)(vertices[i].y * CHARACTERJOINTS * 0.5f) );
+		joints.push_back( make_uint4( joint, 0, 0, 0 ) ), weights.push_back( make_float4( 1, 0, 0, 0 ) );
+	}
+	HostMesh* mesh = new HostMesh();
+	mesh->BuildFromIndexedData( indices, vertices, normals, uvs, vector<HostMesh::Pose>(), joints, weights, material );
+	const int meshId = AddMesh( mesh );
+	// joint chain; at the bind pose, each joint is the translation of its height
+	HostSkin* skin = new HostSkin();
+	const float step = 2.0f / CHARACTERJOINTS;
+	int parent = AddNode( -1, mat4::Translate( pos ), -1 );
+	for (int j = 0; j < CHARACTERJOINTS; j++)
+	{
+		const int joint = j == 0 ? parent : AddNode( -1, mat4::Translate( make_float3( 0, step, 0 ) ), parent );
+		skin->joints.push_back( joint );
+		skin->inverseBindMatrices.push_back( mat4::Translate( make_float3( 0, -step * j, 0 ) ) );
+		parent = joint;
+	}
+	skin->jointMat.resize( CHARACTERJOINTS );
+	HostScene::skins.push_back( skin );
+	const int node = AddNode( meshId, mat4::Translate( pos ), -1 );
+	HostScene::nodes[node]->skinID = (int)HostScene::skins.size() - 1;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  StepResult                                                                 |
+//  |  Averages over the measured frames of a step, in seconds.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct StepResult
+{
+	float build = 0;				// HostScene construction
+	float firstSync = 0;			// the first SynchronizeSceneData, with everything dirty
+	float sceneUpdate = 0, graphSync = 0, lightSync = 0, materialSync = 0, textureSync = 0, meshSync = 0, sync = 0;
+	float render = 0, shade = 0;	// core timings, with -core
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  RunStep                                                                    |
+//  |  Build the scene for the counts of the settings, animate it and measure.    |
+//  |  'swept' is the element of the sweep, or -1.                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RunStep( const GenSettings& settings, const int swept )
+{
+	NullCore nullCore;
+	renderSystem = new RenderSystem();
+	if (settings.core) renderSystem->Init( settings.core ); else renderSystem->Init( &nullCore );
+	if (settings.core)
+	{
+		pixels.resize( settings.width * settings.height );
+		if (!renderSystem->SetHostTarget( pixels.data(), settings.width, settings.height, 1 ))
+		{
+			printf( "this core requires an OpenGL render target.\n" );
+			renderSystem->Shutdown();
+			return 1;
+		}
+	}
+	const int* count = settings.count;
+	const int meshCount = max( 1, count[0] ), instanceCount = count[1], textureCount = count[2], materialCount = max( 1, count[3] );
+	const int areaLightCount = count[4], pointLightCount = count[5], characterCount = count[6];
+	StepResult r;
+	Timer timer;
+	// materials, each with one of the textures; meshes use them round robin
+	for (int i = 0; i < textureCount; i++) AddTexture( i );
+	vector<int> materials;
+	for (int i = 0; i < materialCount; i++)
+	{
+		const int id = HostScene::AddMaterial( make_float3( RandomFloat(), RandomFloat(), RandomFloat() ) * 0.8f + 0.1f );
+		HostMaterial* material = HostScene::materials[id];
+		material->roughness = RandomFloat();
+		material->metallic = RandomFloat() < 0.3f ? 1.0f : 0.0f;
+		if (textureCount > 0) material->map[TEXTURE0].textureID = HostScene::textures[i % textureCount]->ID;
+		materials.push_back( id );
+	}
+	// meshes: 8x8 grids of 128 triangles
+	vector<int> meshes;
+	for (int i = 0; i < meshCount; i++)
+	{
+		vector<int> indices;
+		vector<float3> vertices, normals;
+		vector<float2> uvs;
+		Grid( 8, 0.8f, indices, vertices, normals, uvs );
+		for (float3& v : vertices) v.y = 0.1f * sinf( v.x * (i + 1) ) * cosf( v.z * (i + 1) );
+		HostMesh* mesh = new HostMesh();
+		mesh->BuildFromIndexedData( indices, vertices, normals, uvs, vector<HostMesh::Pose>(), vector<uint4>(), vector<float4>(), materials[i % materialCount] );
+		meshes.push_back( AddMesh( mesh ) );
+	}
+	// instances on a grid of 1x1 cells
+	vector<int> instances;
+	for (int i = 0; i < instanceCount; i++) instances.push_back( HostScene::AddInstance( meshes[i % meshCount], mat4::Translate( GridPosition( i, instanceCount, 1 ) ) ) );
+	// area lights: instances of one emissive quad, above the instances
+	if (areaLightCount > 0)
+	{
+		const int quad = HostScene::AddQuad( make_float3( 0, -1, 0 ), make_float3( 0 ), 0.5f, 0.5f, HostScene::AddMaterial( make_float3( 20 ) ) );
+		for (int i = 0; i < areaLightCount; i++) HostScene::AddInstance( quad, mat4::Translate( GridPosition( i, areaLightCount, 4 ) + make_float3( 0, 6, 0 ) ) );
+	}
+	for (int i = 0; i < pointLightCount; i++) HostScene::AddPointLight( GridPosition( i, pointLightCount, 3 ) + make_float3( 0, 3, 0 ), make_float3( 5 ) );
+	for (int i = 0; i < characterCount; i++) AddCharacter( GridPosition( i, characterCount, 2 ), materials[i % materialCount] );
+	r.build = timer.elapsed();
+	// camera above the scene, looking down at the center
+	const int side = max( 1, (int)ceilf( sqrtf( (float)max( 1, instanceCount ) ) ) );
+	Camera* camera = HostScene::camera;
+	camera->position = make_float3( 0, side * 0.5f + 2, -side * 0.6f - 2 );
+	camera->direction = normalize( -camera->position );
+	ViewPyramid view = camera->GetView();
+	timer.reset();
+	renderSystem->SynchronizeSceneData();
+	if (settings.core) renderSystem->Render( view, Restart );
+	r.firstSync = timer.elapsed();
+	// measured frames: move a fraction of the instances, bend the characters
+	const int moving = (int)(instances.size() * settings.moving);
+	for (int frame = 0; frame < settings.frames; frame++)
+	{
+		for (int i = 0; i < moving; i++)
+		{
+			const int idx = (frame * moving + i) % (int)instances.size();
+			const float3 pos = GridPosition( idx, instanceCount, 1 ) + make_float3( 0, 0.1f * sinf( frame * 0.3f + idx ), 0 );
+			HostScene::SetNodeTransform( instances[idx], mat4::Translate( pos ) * mat4::RotateY( frame * 0.05f ) );
+		}
+		for (HostSkin* skin : HostScene::skins) for (int j = 1; j < (int)skin->joints.size(); j++)
+			HostScene::SetNodeTransform( skin->joints[j], mat4::Translate( make_float3( 0, 2.0f / CHARACTERJOINTS, 0 ) ) * mat4::RotateZ( 0.2f * sinf( frame * 0.2f + j ) ) );
+		renderSystem->SynchronizeSceneData();
+		const SystemStats s = renderSystem->GetSystemStats();
+		r.sceneUpdate += s.sceneUpdateTime, r.graphSync += s.graphSyncTime, r.lightSync += s.lightSyncTime, r.materialSync += s.materialSyncTime;
+		r.textureSync += s.textureSyncTime, r.meshSync += s.meshSyncTime, r.sync += s.syncTime;
+		if (!settings.core) continue;
+		renderSystem->Render( view, Restart );
+		const CoreStats c = renderSystem->GetCoreStats();
+		r.render += c.renderTime, r.shade += c.shadeTime;
+	}
+	float* averaged[] = { &r.sceneUpdate, &r.graphSync, &r.lightSync, &r.materialSync, &r.textureSync, &r.meshSync, &r.sync, &r.render, &r.shade };
+	for (float* v : averaged) *v /= max( 1, settings.frames );
+	// append to scenegen.csv; the header is written when the file is new
+	FILE* f = fopen( "scenegen.csv", "r" );
+	const bool exists = f != 0;
+	if (f) fclose( f );
+	f = fopen( "scenegen.csv", "a" );
+	if (f)
+	{
+		if (!exists)
+		{
+			fprintf( f, "tag,core,sweep" );
+			for (int i = 0; i < ELEMENTS; i++) fprintf( f, ",%s", elementNames[i] );
+			fprintf( f, ",build,firstSync,sceneUpdate,graphSync,lightSync,materialSync,textureSync,meshSync,sync,renderTime,shadeTime\n" );
+		}
+		fprintf( f, "%s,%s,%s", settings.tag, settings.core ? settings.core : "null", swept >= 0 ? elementNames[swept] : "none" );
+		for (int i = 0; i < ELEMENTS; i++) fprintf( f, ",%i", count[i] );
+		fprintf( f, ",%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", r.build, r.firstSync, r.sceneUpdate, r.graphSync,
+			r.lightSync, r.materialSync, r.textureSync, r.meshSync, r.sync, r.render, r.shade );
+		fclose( f );
+	}
+	printf( "%-12s %9i: build %8.2fms, first sync %8.2fms, sync %8.3fms (graph %8.3fms, lights %8.3fms), render %8.3fms\n",
+		swept >= 0 ? elementNames[swept] : "scene", swept >= 0 ? count[swept] : 0, r.build * 1000, r.firstSync * 1000, r.sync * 1000, r.graphSync * 1000, r.lightSync * 1000, r.render * 1000 );
+	renderSystem->Shutdown();
+	return 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	GenSettings settings;
+	const char* sweep = 0;
+	int maxCount = 1000000;
+	bool child = false;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* a = argv[i];
+		const bool hasValue = i + 1 < argc;
+		int element = -1;
+		for (int e = 0; e < ELEMENTS; e++) if (a[0] == '-' && !strcmp( a + 1, elementNames[e] )) element = e;
+		if (element >= 0 && hasValue) settings.count[element] = max( 0, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-sweep" ) && hasValue) sweep = argv[++i];
+		else if (!strcmp( a, "-max" ) && hasValue) maxCount = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-frames" ) && hasValue) settings.frames = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-moving" ) && hasValue) settings.moving = clamp( (float)atof( argv[++i] ), 0.0f, 1.0f );
+		else if (!strcmp( a, "-size" ) && i + 2 < argc) settings.width = atoi( argv[++i] ), settings.height = atoi( argv[++i] );
+		else if (!strcmp( a, "-core" ) && hasValue) settings.core = argv[++i];
+		else if (!strcmp( a, "-tag" ) && hasValue) settings.tag = argv[++i];
+		else if (!strcmp( a, "-step" )) child = true;
+		else
+		{
+			printf( "usage: scenegen [-meshes n] [-instances n] [-textures n] [-materials n] [-arealights n] [-pointlights n] [-skinned n]\n"
+				"                [-sweep element] [-max n] [-frames n] [-moving f] [-size w h] [-core dll] [-tag label]\n" );
+			return 1;
+		}
+	}
+	int swept = -1;
+	for (int e = 0; e < ELEMENTS; e++) if (sweep && !strcmp( sweep, elementNames[e] )) swept = e;
+	if (sweep && swept < 0) { printf( "unknown element %s.\n", sweep ); return 1; }
+	// a single scene in this process
+	if (!sweep || child) return RunStep( settings, swept );
+	// driver: one process per step, so each starts from an empty scene
+	int failed = 0;
+	for (int n = 1; n <= maxCount; n *= 2)
+	{
+		string command = string( "\"\"" ) + argv[0] + "\" -step -sweep " + sweep;
+		for (int e = 0; e < ELEMENTS; e++) command += string( " -" ) + elementNames[e] + " " + to_string( e == swept ? n : settings.count[e] );
+		char options[512];
+		sprintf( options, " -frames %i -moving %f -size %i %i -tag \"%s\"", settings.frames, settings.moving, settings.width, settings.height, settings.tag );
+		command += options;
+		if (settings.core) command += string( " -core \"" ) + settings.core + "\"";
+		command += "\"";
+		if (system( command.c_str() ) != 0) printf( "step %i of %s failed.\n", n, sweep ), failed++;
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+// EOF
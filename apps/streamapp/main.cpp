@@ -0,0 +1,342 @@
+/* main.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Render server: keeps a scene loaded and streams progressive frames to
+   a thin client. The client sends camera updates and scene edits; each
+   frame is encoded on the GPU (see SetVideoTarget) and sent back. If the
+   core cannot encode video, raw RGB frames are sent instead. One client
+   at a time; all messages are text lines, except the frame data:
+
+	 client to server: "CAMERA <input> px py pz dx dy dz fov"
+					   "NODE <input> <node> m0 .. m15" (row major)
+					   "MATERIAL <input> <material> <field> <values>"
+					   "KEYFRAME" or "QUIT"
+	 server to client: "STREAM <h264|hevc|rgb> <width> <height>" once, then
+					   "FRAME <frame> <input> <key> <bytes>", then the data.
+
+   <input> is a number chosen by the client, e.g. a timestamp. Each frame
+   carries the last input it includes, so the client can measure the full
+   input-to-photon latency. The server reports its own part: from receiving
+   an input to sending the first frame that includes it.
+*/
+
+#include <winsock2.h>			// before windows.h, which platform.h includes
+#include <ws2tcpip.h>
+#include "platform.h"
+#include "system.h"
+#include "rendersystem.h"
+
+#pragma comment( lib, "ws2_32.lib" )
+
+static RenderAPI* renderer = 0;
+
+struct ServerSettings
+{
+	VideoTargetDesc video;			// size, codec and bitrate of the stream
+	int maxSpp = 256;				// progressive refinement stops here, until the next input
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Session                                                                    |
+//  |  State of the connection to the client. Lines are received on their own     |
+//  |  thread and queued; the render loop applies them between frames.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct Session
+{
+	struct Input { string line; float received; };
+	SOCKET s = INVALID_SOCKET;
+	atomic<bool> connected{ false };
+	mutex lock;
+	deque<Input> inputs;			// received, not yet applied
+	Timer clock;					// time base for the latency measurements
+	int frame = 0;					// frames sent
+	int input = 0;					// last input applied to the scene, echoed in FRAME lines
+	float inputReceived = -1;		// arrival time of that input if no frame included it yet, or -1
+	// statistics, reset each second
+	float latencySum = 0, latencyMax = 0;
+	int latencyCount = 0, frameCount = 0;
+	size_t bytesSent = 0;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Socket helpers                                                             |
+//  |  Blocking TCP sockets; all calls return false on a closed connection. LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool SendAll( SOCKET s, const void* data, const int size )
+{
+	for (int sent = 0; sent < size;)
+	{
+		const int n = send( s, (const char*)data + sent, size - sent, 0 );
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+bool SendLine( SOCKET s, const char* line ) { return SendAll( s, line, (int)strlen( line ) ) && SendAll( s, "\n", 1 ); }
+bool RecvLine( SOCKET s, char* line, const int maxSize )
+{
+	// lines are short, so byte-wise reads are fine
+	for (int i = 0; i < maxSize - 1; i++)
+	{
+		if (recv( s, line + i, 1, 0 ) != 1) return false;
+		if (line[i] == '\n') { line[i] = 0; return true; }
+	}
+	return false;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SendFrame                                                                  |
+//  |  Send a frame to the client, and record the latency of the input it is the  |
+//  |  first to include.                                                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void SendFrame( Session& session, const uchar* data, const int size, const bool keyFrame )
+{
+	if (!session.connected) return;
+	char line[128];
+	sprintf( line, "FRAME %i %i %i %i", session.frame++, session.input, keyFrame ? 1 : 0, size );
+	if (!SendLine( session.s, line ) || !SendAll( session.s, data, size )) { session.connected = false; return; }
+	session.frameCount++, session.bytesSent += size;
+	if (session.inputReceived < 0) return;
+	const float latency = session.clock.elapsed() - session.inputReceived;
+	session.latencySum += latency, session.latencyMax = max( session.latencyMax, latency ), session.latencyCount++;
+	session.inputReceived = -1;
+}
+void OnVideoPacket( const uchar* data, const int size, const int frame, const bool keyFrame, void* userData )
+{
+	// called by the core from within Render, right after encoding
+	SendFrame( *(Session*)userData, data, size, keyFrame );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ApplyInput                                                                 |
+//  |  Apply one line received from the client. Returns true if the scene or the  |
+//  |  camera changed, so accumulation restarts.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool ApplyInput( Session& session, const Session::Input& input )
+{
+	const char* line = input.line.c_str();
+	int nr, id;
+	float v[16];
+	if (sscanf( line, "CAMERA %i %f %f %f %f %f %f %f", &nr, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6] ) == 8)
+	{
+		Camera* camera = renderer->GetCamera();
+		camera->position = make_float3( v[0], v[1], v[2] );
+		camera->direction = normalize( make_float3( v[3], v[4], v[5] ) );
+		camera->FOV = v[6];
+	}
+	else if (sscanf( line, "NODE %i %i %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f", &nr, &id,
+		&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15] ) == 18)
+	{
+		mat4 transform;
+		memcpy( transform.cell, v, sizeof( v ) );
+		renderer->SetNodeTransform( id, transform );
+	}
+	else if (!strncmp( line, "MATERIAL ", 9 ))
+	{
+		char field[32];
+		const int values = sscanf( line, "MATERIAL %i %i %31s %f %f %f", &nr, &id, field, &v[0], &v[1], &v[2] ) - 3;
+		HostMaterial* m = values > 0 ? renderer->GetMaterial( id ) : 0;
+		if (!m) return false;
+		static const struct { const char* name; float HostMaterial::* value; } fields[] = {
+			{ "metallic", &HostMaterial::metallic }, { "subsurface", &HostMaterial::subsurface },
+			{ "specular", &HostMaterial::specular }, { "roughness", &HostMaterial::roughness },
+			{ "specularTint", &HostMaterial::specularTint }, { "anisotropic", &HostMaterial::anisotropic },
+			{ "sheen", &HostMaterial::sheen }, { "sheenTint", &HostMaterial::sheenTint },
+			{ "clearcoat", &HostMaterial::clearcoat }, { "clearcoatGloss", &HostMaterial::clearcoatGloss },
+			{ "transmission", &HostMaterial::transmission }, { "eta", &HostMaterial::eta } };
+		if (!strcmp( field, "color" ) && values == 3) m->color = make_float3( v[0], v[1], v[2] );
+		else if (!strcmp( field, "absorption" ) && values == 3) m->absorption = make_float3( v[0], v[1], v[2] );
+		else
+		{
+			int i = 0, count = sizeof( fields ) / sizeof( fields[0] );
+			while (i < count && strcmp( field, fields[i].name )) i++;
+			if (i == count) return false;
+			m->*fields[i].value = v[0];
+		}
+		m->MarkAsDirty();
+	}
+	else if (!strcmp( line, "KEYFRAME" ))
+	{
+		// e.g. after packet loss on the client side
+		renderer->GetSettings()->videoKeyFrame = true;
+		return false;
+	}
+	else
+	{
+		if (!strcmp( line, "QUIT" )) session.connected = false;
+		return false;
+	}
+	// the next frame includes this input; keep the arrival time of the oldest unsent one
+	session.input = nr;
+	if (session.inputReceived < 0) session.inputReceived = input.received;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Serve                                                                      |
+//  |  Render for one client until it disconnects. After an input, accumulation   |
+//  |  restarts; while nothing changes, frames converge up to maxSpp, after which |
+//  |  the server idles.                                                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void Serve( Session& session, const ServerSettings& settings, const bool video, vector<float4>& pixels )
+{
+	char line[1024];
+	sprintf( line, "STREAM %s %i %i", video ? (settings.video.codec == VIDEO_HEVC ? "hevc" : "h264") : "rgb", settings.video.width, settings.video.height );
+	if (!SendLine( session.s, line )) return;
+	// a new client needs a key frame to start decoding
+	renderer->GetSettings()->videoKeyFrame = true;
+	thread receiver( [&session]() {
+		char line[1024];
+		while (session.connected && RecvLine( session.s, line, sizeof( line ) ))
+		{
+			lock_guard<mutex> guard( session.lock );
+			session.inputs.push_back( { line, session.clock.elapsed() } );
+		}
+		session.connected = false;
+	} );
+	vector<uchar> rgb;
+	int spp = 0;
+	Timer statsTimer;
+	while (session.connected)
+	{
+		// apply all inputs that arrived during the last frame
+		bool changed = spp == 0;
+		{
+			lock_guard<mutex> guard( session.lock );
+			while (!session.inputs.empty())
+			{
+				changed |= ApplyInput( session, session.inputs.front() );
+				session.inputs.pop_front();
+			}
+		}
+		if (changed) spp = 0;
+		if (spp >= settings.maxSpp)
+		{
+			// converged; wait for the next input
+			Sleep( 1 );
+			continue;
+		}
+		renderer->SynchronizeSceneData();
+		renderer->Render( spp == 0 ? Restart : Converge );
+		spp++;
+		if (!video)
+		{
+			// raw fallback: the frame is in host memory now
+			const int w = settings.video.width, h = settings.video.height;
+			rgb.resize( w * h * 3 );
+			for (int i = 0; i < w * h; i++)
+			{
+				rgb[i * 3 + 0] = (uchar)(255.0f * min( 1.0f, max( 0.0f, pixels[i].x ) ));
+				rgb[i * 3 + 1] = (uchar)(255.0f * min( 1.0f, max( 0.0f, pixels[i].y ) ));
+				rgb[i * 3 + 2] = (uchar)(255.0f * min( 1.0f, max( 0.0f, pixels[i].z ) ));
+			}
+			SendFrame( session, rgb.data(), (int)rgb.size(), true );
+		}
+		if (statsTimer.elapsed() >= 1)
+		{
+			// input latency on the server: from arrival to sending the frame that includes it
+			const float seconds = statsTimer.elapsed();
+			const float avgLatency = session.latencyCount ? session.latencySum / session.latencyCount : 0;
+			printf( "%5.1f fps, %6.0f kbit/s, encode %4.1fms, input to send: avg %5.1fms, max %5.1fms (%i inputs)\n",
+				session.frameCount / seconds, session.bytesSent * 8 / (seconds * 1000), renderer->GetCoreStats().encodeTime * 1000,
+				avgLatency * 1000, session.latencyMax * 1000, session.latencyCount );
+			session.latencySum = session.latencyMax = 0, session.latencyCount = session.frameCount = 0, session.bytesSent = 0;
+			statsTimer.reset();
+		}
+	}
+	// unblock the receiver
+	shutdown( session.s, SD_BOTH );
+	receiver.join();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	ServerSettings settings;
+	const char *sceneFile = 0, *sceneDir = 0, *cameraFile = "camera.xml", *core = "rendercore_optix7.dll";
+	int port = 7777;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* a = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (!strcmp( a, "-port" ) && hasValue) port = atoi( argv[++i] );
+		else if (!strcmp( a, "-size" ) && i + 2 < argc) settings.video.width = atoi( argv[++i] ) & ~1, settings.video.height = atoi( argv[++i] ) & ~1;
+		else if (!strcmp( a, "-bitrate" ) && hasValue) settings.video.bitrate = (int)(atof( argv[++i] ) * 1000000);
+		else if (!strcmp( a, "-fps" ) && hasValue) settings.video.frameRate = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-hevc" )) settings.video.codec = VIDEO_HEVC;
+		else if (!strcmp( a, "-spp" ) && hasValue) settings.maxSpp = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-camera" ) && hasValue) cameraFile = argv[++i];
+		else if (!strcmp( a, "-core" ) && hasValue) core = argv[++i];
+		else if (!sceneFile) sceneFile = a;
+		else sceneDir = a;
+	}
+	if (!sceneFile || !sceneDir)
+	{
+		printf( "usage: streamapp <scene file> <scene dir> [-port n] [-size w h] [-bitrate mbit] [-fps n] [-hevc]\n" );
+		printf( "                 [-spp n] [-camera file] [-core dll]\n" );
+		return 1;
+	}
+	WSADATA data;
+	if (WSAStartup( MAKEWORD( 2, 2 ), &data ) != 0) { printf( "could not initialize winsock.\n" ); return 1; }
+	renderer = RenderAPI::CreateRenderAPI( core );
+	renderer->DeserializeCamera( cameraFile );
+	renderer->AddScene( sceneFile, sceneDir );
+	// one session object for the lifetime of the server; the encoder keeps a pointer to it
+	Session session;
+	settings.video.callback = OnVideoPacket, settings.video.userData = &session;
+	vector<float4> pixels;
+	const bool video = renderer->SetVideoTarget( settings.video, 1 );
+	if (!video)
+	{
+		printf( "video encoding not available; streaming raw RGB frames.\n" );
+		pixels.resize( settings.video.width * settings.video.height );
+		if (!renderer->SetHostTarget( pixels.data(), settings.video.width, settings.video.height, 1 ))
+		{
+			printf( "this core requires an OpenGL render target.\n" );
+			renderer->Shutdown();
+			return 1;
+		}
+	}
+	SOCKET server = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET, addr.sin_addr.s_addr = htonl( INADDR_ANY ), addr.sin_port = htons( (u_short)port );
+	if (bind( server, (sockaddr*)&addr, sizeof( addr ) ) != 0 || listen( server, 1 ) != 0)
+	{
+		printf( "could not listen on port %i.\n", port );
+		renderer->Shutdown();
+		return 1;
+	}
+	while (1)
+	{
+		printf( "waiting for a client on port %i.\n", port );
+		SOCKET s = accept( server, 0, 0 );
+		if (s == INVALID_SOCKET) break;
+		// frames are sent as soon as they are encoded; do not let TCP hold them back
+		const BOOL noDelay = TRUE;
+		setsockopt( s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof( noDelay ) );
+		session.s = s, session.connected = true, session.inputs.clear();
+		session.frame = session.input = 0, session.inputReceived = -1;
+		Serve( session, settings, video, pixels );
+		closesocket( s );
+		printf( "client disconnected.\n" );
+	}
+	closesocket( server );
+	renderer->Shutdown();
+	return 0;
+}
+
+// EOF
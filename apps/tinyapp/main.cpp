@@ -83,6 +83,7 @@ int main()
 	renderer = RenderAPI::CreateRenderAPI( "rendercore_optixprime_b.dll" );			// OPTIX PRIME, best for pre-RTX CUDA devices
 	// renderer = RenderAPI::CreateRenderAPI( "rendercore_primeref.dll" );			// REFERENCE, for image validation
 	// renderer = RenderAPI::CreateRenderAPI( "rendercore_softrasterizer.dll" );	// RASTERIZER, your only option if not on NVidia
+	// renderer = RenderAPI::CreateRenderAPI( "rendercore_opengl.dll" );			// OPENGL, hardware rasterized preview for editing
 
 	renderer->DeserializeCamera( "camera.xml" );
 	// initialize scene
@@ -99,7 +100,7 @@ int main()
 		Convergence c = Converge;
 		if (camMoved) c = Restart, camMoved = false;
 		// detect camera changes
-		if (renderer->GetCamera()->Changed()) camMoved = true;
+		if (renderer->GetCamera()->ContentChanged()) camMoved = true;
 		// poll events, may affect probepos so needs to happen between HandleInput and Render
 		glfwPollEvents();
 		// render
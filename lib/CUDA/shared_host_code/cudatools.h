@@ -13,7 +13,10 @@
    limitations under the License.
 */
 
-#pragma once 
+#pragma once
+
+#include <map>
+#include <deque>
 
 enum { NOT_ALLOCATED = 0, ON_HOST = 1, ON_DEVICE = 2 };
 
@@ -195,13 +198,296 @@ public:
 		// cleanup
 		CHK_NVRTC( nvrtcDestroyProgram( &prog ) );
 	}
+	// sky pyramid for SampleSkydome: level 0 is the sky itself, each next level a 2x2 box filter of the
+	// previous one, down to SKYMIPLEVELS levels or a single texel. A texel is rgb as three halfs in a uint2.
+	static int BuildSkyPyramid( const float3* pixels, const int width, const int height, vector<uint2>& texels )
+	{
+		int levels = 1, total = width * height;
+		for (int w = width, h = height; levels < SKYMIPLEVELS && (w > 1 || h > 1); levels++)
+			w = max( 1, w >> 1 ), h = max( 1, h >> 1 ), total += w * h;
+		texels.resize( total );
+		vector<float3> current, next;
+		const float3* src = pixels;
+		for (int level = 0, w = width, h = height, offset = 0; level < levels; level++)
+		{
+			RunJobs( h, [&]( const int y ) { for (int x = 0; x < w; x++)
+			{
+				// halfs are finite up to 65504
+				const float3 p = fminf( src[x + y * w], make_float3( 65504.0f ) );
+				const half_float::half r( p.x ), g( p.y ), b( p.z );
+				ushort hr, hg, hb;
+				memcpy( &hr, &r, 2 ), memcpy( &hg, &g, 2 ), memcpy( &hb, &b, 2 );
+				texels[offset + x + y * w] = make_uint2( hr + ((uint)hg << 16), hb );
+			} } );
+			if (level == levels - 1) break;
+			const int nw = max( 1, w >> 1 ), nh = max( 1, h >> 1 );
+			next.resize( nw * nh );
+			RunJobs( nh, [&]( const int y ) { for (int x = 0; x < nw; x++)
+			{
+				const int x0 = min( x * 2, w - 1 ), x1 = min( x * 2 + 1, w - 1 ), y0 = min( y * 2, h - 1 ), y1 = min( y * 2 + 1, h - 1 );
+				next[x + y * nw] = 0.25f * (src[x0 + y0 * w] + src[x1 + y0 * w] + src[x0 + y1 * w] + src[x1 + y1 * w]);
+			} } );
+			current.swap( next );
+			src = current.data(), offset += w * h, w = nw, h = nh;
+		}
+		return levels;
+	}
+};
+
+// CoreBufferPool: caches the device and pinned host allocations of CoreBuffers, so that
+// recreating buffers when a scene or window grows does not hit cudaMalloc/cudaFree each time.
+// Sizes are rounded up to size classes, four per power of two. A freed block is reused only
+// when the work that was queued on the legacy default stream before the free has completed.
+// Device allocations are tallied per VRAMCategory, at the size class that is actually held.
+class CoreBufferPool
+{
+public:
+	static void* Alloc( const __int64 size, const bool pinnedHost, const int category = VRAMOther )
+	{
+		if (pinnedHost) return Host().Allocate( size );
+		Tally( category, SizeClass( size ) );
+		return Device().Allocate( size );
+	}
+	static void Free( void* ptr, const __int64 size, const bool pinnedHost, const int category = VRAMOther )
+	{
+		if (pinnedHost) { Host().Release( ptr, size ); return; }
+		if (ptr) Tally( category, -SizeClass( size ) );
+		Device().Release( ptr, size );
+	}
+	static void Trim() { Device().ReleaseCached(); Host().ReleaseCached(); }
+	static void GetVRAMStats( size_t* inUse, size_t* peak, size_t& peakTotal, size_t& cached )
+	{
+		{
+			std::lock_guard<std::mutex> lock( tallyMutex() );
+			for (int i = 0; i < VRAMCategories; i++) inUse[i] = (size_t)tally()[i], peak[i] = (size_t)tally()[VRAMCategories + 1 + i];
+			peakTotal = (size_t)tally()[2 * VRAMCategories + 1];
+		}
+		std::lock_guard<std::mutex> lock( Device().poolMutex );
+		cached = (size_t)Device().cached;
+	}
+private:
+	// tally layout: in use per category, total in use, peak per category, peak total
+	static __int64* tally() { static __int64 t[2 * VRAMCategories + 2] = {}; return t; }
+	static std::mutex& tallyMutex() { static std::mutex m; return m; }
+	static void Tally( const int category, const __int64 bytes )
+	{
+		std::lock_guard<std::mutex> lock( tallyMutex() );
+		__int64* t = tally(), *peak = t + VRAMCategories + 1;
+		t[category] += bytes, t[VRAMCategories] += bytes;
+		if (t[category] > peak[category]) peak[category] = t[category];
+		if (t[VRAMCategories] > peak[VRAMCategories]) peak[VRAMCategories] = t[VRAMCategories];
+	}
+	struct Block { void* ptr; cudaEvent_t done; };
+	CoreBufferPool( const bool pinned, const __int64 limit ) : host( pinned ), cacheLimit( limit ) {}
+	static CoreBufferPool& Device() { static CoreBufferPool pool( false, 512 << 20 ); return pool; }
+	static CoreBufferPool& Host() { static CoreBufferPool pool( true, 256 << 20 ); return pool; }
+	static __int64 SizeClass( const __int64 size )
+	{
+		if (size <= 256) return 256;
+		const __int64 large = 2 << 20;
+		if (size > 32 * large) return (size + large - 1) / large * large; // 2MB granularity for big buffers
+		__int64 pow2 = 256;
+		while (pow2 * 2 <= size) pow2 *= 2;
+		const __int64 step = pow2 / 4;
+		return (size + step - 1) / step * step;
+	}
+	void* Allocate( const __int64 size )
+	{
+		const __int64 bytes = SizeClass( size );
+		Block block = { 0, 0 };
+		{
+			std::lock_guard<std::mutex> lock( poolMutex );
+			auto it = cache.find( bytes );
+			if (it != cache.end() && !it->second.empty()) block = it->second.back(), it->second.pop_back(), cached -= bytes;
+		}
+		if (block.ptr)
+		{
+			// normally long completed; the previous owner may still have kernels or copies in flight
+			CUDACHECK( "cudaEventSynchronize", cudaEventSynchronize( block.done ) );
+			cudaEventDestroy( block.done );
+			return block.ptr;
+		}
+		void* ptr = 0;
+		cudaError_t result = host ? cudaMallocHost( &ptr, bytes ) : cudaMalloc( &ptr, bytes );
+		if (result != cudaSuccess)
+		{
+			// out of memory: hand the cached blocks back to the driver and try again
+			cudaGetLastError();
+			ReleaseCached();
+			result = host ? cudaMallocHost( &ptr, bytes ) : cudaMalloc( &ptr, bytes );
+		}
+		CUDACHECK( host ? "cudaMallocHost" : "cudaMalloc", result );
+		return ptr;
+	}
+	void Release( void* ptr, const __int64 size )
+	{
+		if (!ptr) return;
+		const __int64 bytes = SizeClass( size );
+		std::unique_lock<std::mutex> lock( poolMutex );
+		if (cached + bytes > cacheLimit)
+		{
+			lock.unlock();
+			if (host) CUDACHECK( "cudaFreeHost", cudaFreeHost( ptr ) ); else CUDACHECK( "cudaFree", cudaFree( ptr ) );
+			return;
+		}
+		Block block = { ptr, 0 };
+		CUDACHECK( "cudaEventCreateWithFlags", cudaEventCreateWithFlags( &block.done, cudaEventDisableTiming ) );
+		CUDACHECK( "cudaEventRecord", cudaEventRecord( block.done, 0 ) );
+		cache[bytes].push_back( block );
+		cached += bytes;
+	}
+	void ReleaseCached()
+	{
+		std::lock_guard<std::mutex> lock( poolMutex );
+		for (auto& sizeClass : cache) for (Block& block : sizeClass.second)
+		{
+			cudaEventSynchronize( block.done );
+			cudaEventDestroy( block.done );
+			if (host) cudaFreeHost( block.ptr ); else cudaFree( block.ptr );
+		}
+		cache.clear();
+		cached = 0;
+	}
+	// data members; blocks are not freed at exit, the CUDA context may already be gone by then
+	const bool host;
+	const __int64 cacheLimit;
+	__int64 cached = 0;
+	std::map<__int64, std::vector<Block>> cache;
+	std::mutex poolMutex;
+};
+
+// PeerMemory: device memory of another GPU, which kernels on the render device read through peer
+// access, over NVLink or PCIe. This spreads large read-only pools over the GPUs of a system; the
+// render device must have enabled peer access to the device. CoreBufferPool does not cache these
+// blocks: its cache only holds memory of the current device.
+class PeerMemory
+{
+public:
+	static void* Alloc( const int device, const __int64 size )
+	{
+		int current;
+		cudaGetDevice( &current );
+		cudaSetDevice( device );
+		void* ptr = 0;
+		const cudaError_t result = cudaMalloc( &ptr, size );
+		cudaSetDevice( current );
+		CUDACHECK( "cudaMalloc", result );
+		std::lock_guard<std::mutex> lock( mutex() );
+		inUse() += size;
+		return ptr;
+	}
+	static void Free( void* ptr, const int device, const __int64 size )
+	{
+		if (!ptr) return;
+		// frees are rare, and the render device may still read the block
+		cudaDeviceSynchronize();
+		int current;
+		cudaGetDevice( &current );
+		cudaSetDevice( device );
+		CUDACHECK( "cudaFree", cudaFree( ptr ) );
+		cudaSetDevice( current );
+		std::lock_guard<std::mutex> lock( mutex() );
+		inUse() -= size;
+	}
+	static size_t InUse() { std::lock_guard<std::mutex> lock( mutex() ); return (size_t)inUse(); }
+private:
+	static __int64& inUse() { static __int64 bytes = 0; return bytes; }
+	static std::mutex& mutex() { static std::mutex m; return m; }
+};
+
+// StagingRing: pinned, persistently allocated ring buffer for host-to-device uploads.
+// Upload copies the data into the ring and issues an asynchronous copy on the ring's
+// stream, so the caller can release or modify its data right away. Slots are reused
+// once the event recorded after their copy has completed; uploads larger than the
+// ring are split. Work that consumes the uploads waits for Flush.
+class StagingRing
+{
+public:
+	StagingRing( const size_t bytes, const cudaStream_t copyStream ) : size( bytes ), stream( copyStream )
+	{
+		CUDACHECK( "cudaMallocHost", cudaMallocHost( (void**)&ring, size ) );
+		CUDACHECK( "cudaEventCreateWithFlags", cudaEventCreateWithFlags( &flushed, cudaEventDisableTiming ) );
+	}
+	~StagingRing()
+	{
+		cudaStreamSynchronize( stream );
+		for (Slot& slot : inFlight) cudaEventDestroy( slot.done );
+		for (cudaEvent_t e : spareEvents) cudaEventDestroy( e );
+		cudaEventDestroy( flushed );
+		cudaFreeHost( ring );
+	}
+	void Upload( void* deviceDst, const void* src, size_t bytes )
+	{
+		uchar* dst = (uchar*)deviceDst;
+		const uchar* data = (const uchar*)src;
+		while (bytes > 0)
+		{
+			const size_t chunk = min( bytes, size );
+			const size_t offset = Reserve( chunk );
+			memcpy( ring + offset, data, chunk );
+			CUDACHECK( "cudaMemcpyAsync", cudaMemcpyAsync( dst, ring + offset, chunk, cudaMemcpyHostToDevice, stream ) );
+			const Slot slot = { offset, offset + chunk, NewEvent() };
+			CUDACHECK( "cudaEventRecord", cudaEventRecord( slot.done, stream ) );
+			inFlight.push_back( slot );
+			head = slot.end;
+			dst += chunk, data += chunk, bytes -= chunk;
+		}
+	}
+	void Flush( const cudaStream_t consumer )
+	{
+		// make later work on the consumer stream wait for all uploads so far
+		CUDACHECK( "cudaEventRecord", cudaEventRecord( flushed, stream ) );
+		CUDACHECK( "cudaStreamWaitEvent", cudaStreamWaitEvent( consumer, flushed, 0 ) );
+	}
+	cudaStream_t Stream() const { return stream; }
+private:
+	struct Slot { size_t start, end; cudaEvent_t done; };
+	size_t Reserve( const size_t bytes )
+	{
+		while (1)
+		{
+			if (inFlight.empty()) return 0;
+			const size_t tail = inFlight.front().start;
+			const size_t start = (head + 255) & ~(size_t)255; // keep copies 256-byte aligned
+			if (head > tail)
+			{
+				// free space at the end of the ring, or at its start after wrapping around
+				if (start + bytes <= size) return start;
+				if (bytes <= tail) return 0;
+			}
+			else if (head < tail && start + bytes <= tail) return start;
+			// ring full: wait for the oldest copy
+			const Slot oldest = inFlight.front();
+			inFlight.pop_front();
+			CUDACHECK( "cudaEventSynchronize", cudaEventSynchronize( oldest.done ) );
+			spareEvents.push_back( oldest.done );
+		}
+	}
+	cudaEvent_t NewEvent()
+	{
+		// reuse the events of completed slots
+		while (!inFlight.empty() && cudaEventQuery( inFlight.front().done ) == cudaSuccess)
+			spareEvents.push_back( inFlight.front().done ), inFlight.pop_front();
+		cudaEvent_t e;
+		if (spareEvents.size() > 0) e = spareEvents.back(), spareEvents.pop_back();
+		else CUDACHECK( "cudaEventCreateWithFlags", cudaEventCreateWithFlags( &e, cudaEventDisableTiming ) );
+		return e;
+	}
+	// data members
+	uchar* ring = 0;
+	const size_t size;
+	size_t head = 0;				// next free byte
+	std::deque<Slot> inFlight;		// copies that may still read from the ring, oldest first
+	vector<cudaEvent_t> spareEvents;
+	cudaEvent_t flushed;
+	const cudaStream_t stream;
 };
 
 template <class T> class CoreBuffer
 {
 public:
 	CoreBuffer() = default;
-	CoreBuffer( __int64 elements, __int64 loc, const void* source = 0 ) : location( loc )
+	CoreBuffer( __int64 elements, __int64 loc, const void* source = 0, const int tag = VRAMOther ) : location( loc ), category( tag )
 	{
 		numElements = elements;
 		sizeInBytes = elements * sizeof( T );
@@ -210,7 +496,7 @@ public:
 			if (location & ON_DEVICE)
 			{
 				// location is ON_DEVICE; allocate room on device
-				CUDACHECK( "cudaMalloc", cudaMalloc( &devPtr, sizeInBytes ) );
+				devPtr = (T*)CoreBufferPool::Alloc( sizeInBytes, false, category );
 				owner |= ON_DEVICE;
 			}
 			if (location & ON_HOST)
@@ -223,7 +509,8 @@ public:
 				}
 				else 
 				{
-					hostPtr = (T*)_aligned_malloc( sizeInBytes, 64 ), owner |= ON_HOST;
+					// pinned when the buffer also lives on the device, so async copies are truly asynchronous
+					AllocHost( (location & ON_DEVICE) > 0 );
 				}
 			}
 			else if (source && (location & ON_DEVICE))
@@ -241,13 +528,12 @@ public:
 		{
 			if (owner & ON_HOST)
 			{
-				_aligned_free( hostPtr );
-				hostPtr = 0;
-				owner &= ~ON_HOST;
+				FreeHost();
 			}
 			if (owner & ON_DEVICE)
 			{
-				CUDACHECK( "cudaFree", cudaFree( devPtr ) );
+				if (peerDevice >= 0) PeerMemory::Free( devPtr, peerDevice, sizeInBytes );
+				else CoreBufferPool::Free( devPtr, sizeInBytes, false, category );
 				owner &= ~ON_DEVICE;
 			}
 		}
@@ -258,7 +544,7 @@ public:
 		{
 			if (!(location & ON_DEVICE))
 			{
-				CUDACHECK( "cudaMalloc", cudaMalloc( &devPtr, sizeInBytes ) );
+				devPtr = (T*)CoreBufferPool::Alloc( sizeInBytes, false, category );
 				location |= ON_DEVICE;
 				owner |= ON_DEVICE;
 			}
@@ -266,13 +552,33 @@ public:
 		}
 		return devPtr;
 	}
+	void* CopyToDevice( const __int64 first, const __int64 count )
+	{
+		// copy a range of elements; the device allocation must already exist
+		if (count > 0)
+		{
+			assert( (location & ON_DEVICE) && first + count <= numElements );
+			CUDACHECK( "cudaMemcpy", cudaMemcpy( devPtr + first, hostPtr + first, count * sizeof( T ), cudaMemcpyHostToDevice ) );
+		}
+		return devPtr;
+	}
+	void* CopyToDeviceAsync( const __int64 first, const __int64 count, cudaStream_t stream )
+	{
+		// asynchronous version of the range copy
+		if (count > 0)
+		{
+			assert( (location & ON_DEVICE) && first + count <= numElements );
+			CUDACHECK( "cudaMemcpyAsync", cudaMemcpyAsync( devPtr + first, hostPtr + first, count * sizeof( T ), cudaMemcpyHostToDevice, stream ) );
+		}
+		return devPtr;
+	}
 	void* CopyToDeviceAsync( cudaStream_t stream )
 	{
 		if (sizeInBytes > 0)
 		{
 			if (!(location & ON_DEVICE))
 			{
-				CUDACHECK( "cudaMalloc", cudaMalloc( &devPtr, sizeInBytes ) );
+				devPtr = (T*)CoreBufferPool::Alloc( sizeInBytes, false, category );
 				location |= ON_DEVICE;
 				owner |= ON_DEVICE;
 			}
@@ -283,9 +589,8 @@ public:
 	void* MoveToDevice()
 	{
 		CopyToDevice();
-		if (sizeInBytes > 0) _aligned_free( hostPtr );
+		if (owner & ON_HOST) FreeHost();
 		hostPtr = 0;
-		owner &= ~ON_HOST;
 		location &= ~ON_HOST;
 		return devPtr;
 	}
@@ -295,23 +600,31 @@ public:
 		{
 			if (!(location & ON_HOST))
 			{
-				hostPtr = (T*)_aligned_malloc( sizeInBytes, 64 );
+				AllocHost( true );
 				location |= ON_HOST;
-				owner |= ON_HOST;
 			}
 			CUDACHECK( "cudaMemcpy", cudaMemcpy( hostPtr, devPtr, sizeInBytes, cudaMemcpyDeviceToHost ) );
 		}
 		return hostPtr;
 	}
+	T* CopyToHost( const __int64 first, const __int64 count )
+	{
+		// copy a range of elements; the host allocation must already exist
+		if (count > 0)
+		{
+			assert( (location & ON_HOST) && first + count <= numElements );
+			CUDACHECK( "cudaMemcpy", cudaMemcpy( hostPtr + first, devPtr + first, count * sizeof( T ), cudaMemcpyDeviceToHost ) );
+		}
+		return hostPtr;
+	}
 	T* CopyToHostAsync( cudaStream_t stream )
 	{
 		if (sizeInBytes > 0)
 		{
 			if (!(location & ON_HOST))
 			{
-				hostPtr = (T*)_aligned_malloc( sizeInBytes, 64 );
+				AllocHost( true );
 				location |= ON_HOST;
-				owner |= ON_HOST;
 			}
 			CUDACHECK( "cudaMemcpyAsync", cudaMemcpyAsync( hostPtr, devPtr, sizeInBytes, cudaMemcpyDeviceToHost, stream ) );
 		}
@@ -332,9 +645,130 @@ public:
 	T** DevPtrPtr() { return &devPtr; /* Optix7 wants an array of pointers; this returns an array of 1 pointers. */ } 
 	T* HostPtr() { return hostPtr; }
 	void SetHostData( T* hostData ) { hostPtr = hostData; }
-	// member data
+	// a buffer on device memory that belongs to someone else, e.g. a TransientHeap; deleting it frees nothing
+	static CoreBuffer* Alias( T* deviceMemory, const __int64 elements )
+	{
+		CoreBuffer* buffer = new CoreBuffer();
+		buffer->location = ON_DEVICE, buffer->devPtr = deviceMemory;
+		buffer->numElements = elements, buffer->sizeInBytes = elements * sizeof( T );
+		return buffer;
+	}
+	// a device buffer in the memory of another GPU, see PeerMemory; the copy methods work as usual
+	static CoreBuffer* OnPeer( const int device, const __int64 elements )
+	{
+		CoreBuffer* buffer = new CoreBuffer();
+		buffer->numElements = elements, buffer->sizeInBytes = elements * sizeof( T );
+		buffer->devPtr = (T*)PeerMemory::Alloc( device, buffer->sizeInBytes );
+		buffer->location = buffer->owner = ON_DEVICE, buffer->peerDevice = device;
+		return buffer;
+	}
+	int PeerDevice() const { return peerDevice; }
 private:
+	void AllocHost( const bool pin )
+	{
+		pinned = pin;
+		hostPtr = pinned ? (T*)CoreBufferPool::Alloc( sizeInBytes, true ) : (T*)_aligned_malloc( sizeInBytes, 64 );
+		owner |= ON_HOST;
+	}
+	void FreeHost()
+	{
+		if (pinned) CoreBufferPool::Free( hostPtr, sizeInBytes, true ); else _aligned_free( hostPtr );
+		hostPtr = 0;
+		owner &= ~ON_HOST;
+	}
+	// member data
 	__int64 location = NOT_ALLOCATED, owner = 0, sizeInBytes = 0, numElements = 0;
+	int category = VRAMOther;			// VRAMCategory of the device allocation
+	int peerDevice = -1;				// device that holds devPtr, if it is not the current one
+	bool pinned = false;
 	T* devPtr = 0;
 	T* hostPtr = 0;
-};
\ No newline at end of file
+};
+
+// TransientHeap: device memory for buffers that are only used during part of a frame. Each buffer
+// is declared with the range of frame stages that use it; Commit packs the declarations into one
+// pooled allocation, in which buffers with disjoint stage ranges share bytes, and replaces the
+// declared CoreBuffer pointers by aliases of their placements. Shared bytes are only safe when the
+// stages run in order on one stream, or on streams that synchronize with it.
+class TransientHeap
+{
+public:
+	TransientHeap( const int tag = VRAMOther ) : category( tag ) {}
+	~TransientHeap() { Clear(); CoreBufferPool::Free( memory, capacity, false, category ); }
+	// declare or resize a transient buffer; it holds 0 until the next Commit
+	template <class T> void Declare( CoreBuffer<T>*& buffer, const __int64 elements, const int firstStage, const int lastStage )
+	{
+		Transient* t = 0;
+		for (Transient& d : declared) if (d.owner == (void*)&buffer) t = &d;
+		if (!t) declared.push_back( Transient() ), t = &declared.back();
+		t->owner = (void*)&buffer, t->bytes = elements * sizeof( T );
+		t->firstStage = firstStage, t->lastStage = lastStage;
+		t->bind = [&buffer, elements]( uchar* ptr ) { delete buffer; buffer = ptr ? CoreBuffer<T>::Alias( (T*)ptr, elements ) : 0; };
+		t->bind( 0 );
+		dirty = true;
+	}
+	template <class T> void Remove( CoreBuffer<T>*& buffer )
+	{
+		for (int i = 0; i < (int)declared.size(); i++) if (declared[i].owner == (void*)&buffer)
+			declared[i].bind( 0 ), declared.erase( declared.begin() + i ), dirty = true;
+	}
+	// drop all declarations and their aliases; the memory is kept for the next Commit
+	void Clear()
+	{
+		for (Transient& t : declared) t.bind( 0 );
+		declared.clear();
+		dirty = true;
+	}
+	// place the declared buffers and rebind their aliases; returns false if nothing changed. Without
+	// aliasing, each buffer gets a range of its own, as if it had been allocated separately.
+	bool Commit( const bool alias = true )
+	{
+		if (!dirty && alias == aliased) return false;
+		// first fit, largest buffers first: the lowest offset that does not overlap a placed buffer with overlapping stages
+		vector<Transient*> order;
+		for (Transient& t : declared) order.push_back( &t );
+		std::sort( order.begin(), order.end(), []( const Transient* a, const Transient* b ) { return a->bytes > b->bytes; } );
+		__int64 heapSize = 0;
+		for (int i = 0; i < (int)order.size(); i++)
+		{
+			Transient& t = *order[i];
+			t.offset = 0;
+			for (bool moved = true; moved; )
+			{
+				moved = false;
+				for (int j = 0; j < i; j++)
+				{
+					const Transient& p = *order[j];
+					const bool live = !alias || (p.firstStage <= t.lastStage && t.firstStage <= p.lastStage);
+					if (live && p.offset < t.offset + t.bytes && t.offset < p.offset + p.bytes) t.offset = (p.offset + p.bytes + 255) & ~255ll, moved = true;
+				}
+			}
+			heapSize = std::max( heapSize, t.offset + t.bytes );
+		}
+		if (heapSize > capacity)
+		{
+			// the pool keeps the old block until the work queued before the free has completed
+			CoreBufferPool::Free( memory, capacity, false, category );
+			memory = (uchar*)CoreBufferPool::Alloc( heapSize, false, category );
+			capacity = heapSize;
+		}
+		for (Transient& t : declared) t.bind( memory + t.offset );
+		used = heapSize, dirty = false, aliased = alias;
+		return true;
+	}
+	__int64 HeapSize() const { return used; }
+	__int64 DeclaredSize() const { __int64 total = 0; for (const Transient& t : declared) total += t.bytes; return total; }
+private:
+	struct Transient
+	{
+		void* owner = 0;						// address of the declared CoreBuffer pointer
+		__int64 bytes = 0, offset = 0;
+		int firstStage = 0, lastStage = 0;
+		std::function<void( uchar* )> bind;		// replaces the alias; 0 deletes it
+	};
+	vector<Transient> declared;
+	uchar* memory = 0;
+	__int64 capacity = 0, used = 0;
+	const int category;
+	bool dirty = false, aliased = true;
+};
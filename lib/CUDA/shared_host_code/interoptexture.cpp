@@ -49,25 +49,29 @@ void InteropTexture::LinkToSurface( const surfaceReference* s )
 		CUDACHECK( "cudaGraphicsUnregisterResource", cudaGraphicsUnregisterResource( res ) );
 	}
 	CUDACHECK( "cudaGraphicsGLRegisterImage", cudaGraphicsGLRegisterImage( &res, texture->ID, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsSurfaceLoadStore ) );
+	// finalize overwrites every pixel; the driver does not need to preserve the old contents
+	CUDACHECK( "cudaGraphicsResourceSetMapFlags", cudaGraphicsResourceSetMapFlags( res, cudaGraphicsMapFlagsWriteDiscard ) );
 	linked = true;
 }
 
-void InteropTexture::BindSurface()
+void InteropTexture::BindSurface( const cudaStream_t stream )
 {
+	// mapping guarantees that OpenGL work on the texture issued before this call completes
+	// before subsequent CUDA work in the stream starts; no glFinish is needed.
 	assert( !bound );
-	cudaArray* ar;
-	CUDACHECK( "cudaGraphicsMapResources", cudaGraphicsMapResources( 1, &res, 0 /* DEFAULTSTREAM */ ) );
-	CUDACHECK( "cudaGraphicsSubResourceGetMappedArray", cudaGraphicsSubResourceGetMappedArray( &ar, res, 0, 0 ) );
+	CUDACHECK( "cudaGraphicsMapResources", cudaGraphicsMapResources( 1, &res, stream ) );
+	CUDACHECK( "cudaGraphicsSubResourceGetMappedArray", cudaGraphicsSubResourceGetMappedArray( &array, res, 0, 0 ) );
 	cudaChannelFormatDesc desc;
-	CUDACHECK( "cudaGetChannelDesc", cudaGetChannelDesc( &desc, ar ) );
-	CUDACHECK( "cudaBindSurfaceToArray", cudaBindSurfaceToArray( surfRef, ar, &desc ) );
+	CUDACHECK( "cudaGetChannelDesc", cudaGetChannelDesc( &desc, array ) );
+	CUDACHECK( "cudaBindSurfaceToArray", cudaBindSurfaceToArray( surfRef, array, &desc ) );
 	bound = true;
 }
 
-void InteropTexture::UnbindSurface()
+void InteropTexture::UnbindSurface( const cudaStream_t stream )
 {
+	// unmapping orders CUDA work in the stream before subsequent OpenGL use of the texture
 	assert( bound );
-	CUDACHECK( "cudaGraphicsUnmapResources", cudaGraphicsUnmapResources( 1, &res, 0 ) );
+	CUDACHECK( "cudaGraphicsUnmapResources", cudaGraphicsUnmapResources( 1, &res, stream ) );
 	bound = false;
 }
 
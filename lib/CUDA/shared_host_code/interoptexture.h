@@ -29,14 +29,16 @@ public:
 	// get / set
 	void SetTexture( GLTexture* t );
 	cudaGraphicsResource** GetResID() { return &res; }
+	cudaArray* GetArray() { return bound ? array : 0; } // the texture data while the surface is bound, e.g. for readback
 	void LinkToSurface( const surfaceReference* s );
 	// methods
-	void BindSurface();
-	void UnbindSurface();
+	void BindSurface( const cudaStream_t stream = 0 );
+	void UnbindSurface( const cudaStream_t stream = 0 );
 private:
 	// data members
 	GLTexture* texture = 0;
 	cudaGraphicsResource* res = nullptr;
+	cudaArray* array = nullptr;
 	const surfaceReference* surfRef = nullptr;
 	bool linked = false, bound = false;
 };
@@ -0,0 +1,165 @@
+/* videoencoder.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+#ifdef NVENCODER
+
+#pragma comment(lib, "cuda.lib" )	// cuCtxGetCurrent: NVENC needs the driver context
+
+typedef NVENCSTATUS( NVENCAPI* CreateInstanceFunction )(NV_ENCODE_API_FUNCTION_LIST*);
+
+#define CHK_NVENC( c ) do { NVENCSTATUS r = c; if (r != NV_ENC_SUCCESS) { \
+	printf( "NVENC error %i: %s\n", (int)r, #c ); Shutdown(); return false; } } while( 0 )
+
+//  +-----------------------------------------------------------------------------+
+//  |  VideoEncoder::Init                                                         |
+//  |  Open an encode session on the current CUDA context and allocate the input  |
+//  |  buffer. Returns false if the driver or the device does not support NVENC,  |
+//  |  or the codec. Low latency preset: constant bitrate, no B-frames, a VBV     |
+//  |  buffer of one frame, and parameter sets with each key frame.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool VideoEncoder::Init( const VideoTargetDesc& desc )
+{
+	Shutdown();
+	if ((desc.width & 1) || (desc.height & 1)) return false; // 4:2:0 needs even sizes
+	static CreateInstanceFunction createInstance = 0;
+	if (!createInstance)
+	{
+		HMODULE module = LoadLibrary( "nvEncodeAPI64.dll" );
+		if (module == 0) return false;
+		createInstance = (CreateInstanceFunction)GetProcAddress( module, "NvEncodeAPICreateInstance" );
+		if (createInstance == 0) return false;
+	}
+	settings = desc;
+	api = {};
+	api.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+	if (createInstance( &api ) != NV_ENC_SUCCESS) return false;
+	// session on the context that renders the frames, so the input is a plain device pointer
+	CUcontext context;
+	cuCtxGetCurrent( &context );
+	NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS session = { NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER };
+	session.device = context, session.deviceType = NV_ENC_DEVICE_TYPE_CUDA, session.apiVersion = NVENCAPI_VERSION;
+	CHK_NVENC( api.nvEncOpenEncodeSessionEx( &session, &encoder ) );
+	// start from the low latency preset, then set the rate control
+	const GUID codec = desc.codec == VIDEO_HEVC ? NV_ENC_CODEC_HEVC_GUID : NV_ENC_CODEC_H264_GUID;
+	NV_ENC_PRESET_CONFIG preset = { NV_ENC_PRESET_CONFIG_VER, { NV_ENC_CONFIG_VER } };
+	CHK_NVENC( api.nvEncGetEncodePresetConfigEx( encoder, codec, NV_ENC_PRESET_P3_GUID, NV_ENC_TUNING_INFO_LOW_LATENCY, &preset ) );
+	NV_ENC_CONFIG config = preset.presetCfg;
+	config.gopLength = desc.gopLength;
+	config.frameIntervalP = 1; // no B-frames: each frame leaves the encoder right away
+	config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
+	config.rcParams.averageBitRate = config.rcParams.maxBitRate = desc.bitrate;
+	config.rcParams.vbvBufferSize = config.rcParams.vbvInitialDelay = desc.bitrate / max( 1, desc.frameRate );
+	if (desc.codec == VIDEO_HEVC)
+	{
+		config.encodeCodecConfig.hevcConfig.idrPeriod = desc.gopLength;
+		config.encodeCodecConfig.hevcConfig.repeatSPSPPS = 1; // a client can start decoding at any key frame
+	}
+	else
+	{
+		config.encodeCodecConfig.h264Config.idrPeriod = desc.gopLength;
+		config.encodeCodecConfig.h264Config.repeatSPSPPS = 1;
+	}
+	NV_ENC_INITIALIZE_PARAMS params = { NV_ENC_INITIALIZE_PARAMS_VER };
+	params.encodeGUID = codec, params.presetGUID = NV_ENC_PRESET_P3_GUID, params.tuningInfo = NV_ENC_TUNING_INFO_LOW_LATENCY;
+	params.encodeWidth = params.darWidth = desc.width;
+	params.encodeHeight = params.darHeight = desc.height;
+	params.frameRateNum = desc.frameRate, params.frameRateDen = 1;
+	params.enablePTD = 1; // the encoder decides the picture types
+	params.encodeConfig = &config;
+	CHK_NVENC( api.nvEncInitializeEncoder( encoder, &params ) );
+	// input: a pitched RGBA8 device buffer, registered once
+	size_t bytes;
+	CHK_CUDA( cudaMallocPitch( (void**)&input, &bytes, desc.width * sizeof( uint ), desc.height ) );
+	pitch = (int)bytes;
+	NV_ENC_REGISTER_RESOURCE resource = { NV_ENC_REGISTER_RESOURCE_VER };
+	resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR;
+	resource.resourceToRegister = input;
+	resource.width = desc.width, resource.height = desc.height, resource.pitch = pitch;
+	resource.bufferFormat = NV_ENC_BUFFER_FORMAT_ABGR;
+	resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+	CHK_NVENC( api.nvEncRegisterResource( encoder, &resource ) );
+	inputResource = resource.registeredResource;
+	NV_ENC_CREATE_BITSTREAM_BUFFER output = { NV_ENC_CREATE_BITSTREAM_BUFFER_VER };
+	CHK_NVENC( api.nvEncCreateBitstreamBuffer( encoder, &output ) );
+	bitstream = output.bitstreamBuffer;
+	frame = 0;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  VideoEncoder::Encode                                                       |
+//  |  Encode the frame in the input buffer and pass the bitstream to the         |
+//  |  callback. The frame must be complete on the device. Waits for the encoder; |
+//  |  without B-frames, its output is the frame that was just submitted.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void VideoEncoder::Encode( const bool forceKeyFrame )
+{
+	if (!encoder) return;
+	NV_ENC_MAP_INPUT_RESOURCE map = { NV_ENC_MAP_INPUT_RESOURCE_VER };
+	map.registeredResource = inputResource;
+	if (api.nvEncMapInputResource( encoder, &map ) != NV_ENC_SUCCESS) return;
+	NV_ENC_PIC_PARAMS picture = { NV_ENC_PIC_PARAMS_VER };
+	picture.inputBuffer = map.mappedResource, picture.bufferFmt = map.mappedBufferFmt;
+	picture.inputWidth = settings.width, picture.inputHeight = settings.height, picture.inputPitch = pitch;
+	picture.outputBitstream = bitstream;
+	picture.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+	picture.inputTimeStamp = frame;
+	if (forceKeyFrame) picture.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+	if (api.nvEncEncodePicture( encoder, &picture ) == NV_ENC_SUCCESS)
+	{
+		NV_ENC_LOCK_BITSTREAM lock = { NV_ENC_LOCK_BITSTREAM_VER };
+		lock.outputBitstream = bitstream;
+		if (api.nvEncLockBitstream( encoder, &lock ) == NV_ENC_SUCCESS)
+		{
+			const bool keyFrame = lock.pictureType == NV_ENC_PIC_TYPE_IDR || lock.pictureType == NV_ENC_PIC_TYPE_I;
+			if (settings.callback) settings.callback( (const uchar*)lock.bitstreamBufferPtr, lock.bitstreamSizeInBytes, frame, keyFrame, settings.userData );
+			api.nvEncUnlockBitstream( encoder, bitstream );
+		}
+	}
+	api.nvEncUnmapInputResource( encoder, map.mappedResource );
+	frame++;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  VideoEncoder::Shutdown                                                     |
+//  |  Flush and close the session, and free the input buffer.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void VideoEncoder::Shutdown()
+{
+	if (encoder)
+	{
+		NV_ENC_PIC_PARAMS eos = { NV_ENC_PIC_PARAMS_VER };
+		eos.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
+		api.nvEncEncodePicture( encoder, &eos );
+		if (inputResource) api.nvEncUnregisterResource( encoder, inputResource );
+		if (bitstream) api.nvEncDestroyBitstreamBuffer( encoder, bitstream );
+		api.nvEncDestroyEncoder( encoder );
+	}
+	if (input) cudaFree( input );
+	encoder = 0, inputResource = 0, bitstream = 0, input = 0;
+}
+
+#else
+
+// without the Video Codec SDK, SetVideoTarget reports that video encoding is not available
+bool VideoEncoder::Init( const VideoTargetDesc& desc ) { return false; }
+void VideoEncoder::Encode( const bool forceKeyFrame ) {}
+void VideoEncoder::Shutdown() {}
+
+#endif
+
+// EOF
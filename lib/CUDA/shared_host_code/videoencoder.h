@@ -0,0 +1,64 @@
+/* videoencoder.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   NVENC is part of the NVIDIA Video Codec SDK, which is not included
+   with LH2. To enable the encoder, place nvEncodeAPI.h from the SDK
+   in lib/CUDA/nvenc and define NVENCODER in the core settings. The
+   encoder library itself ships with the driver.
+*/
+
+#pragma once
+
+#ifdef NVENCODER
+#include "nvenc/nvEncodeAPI.h"
+#endif
+
+namespace lh2core {
+
+//  +-----------------------------------------------------------------------------+
+//  |  VideoEncoder                                                               |
+//  |  Hardware H.264 / HEVC encoding of frames in device memory, using NVENC.    |
+//  |  The frame is read directly from an RGBA8 device buffer; NVENC converts it  |
+//  |  to YUV itself, so the pixels never pass through host memory.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+class VideoEncoder
+{
+public:
+	// constructor / destructor
+	~VideoEncoder() { Shutdown(); }
+	// methods
+	bool Init( const VideoTargetDesc& desc );
+	void Encode( const bool forceKeyFrame = false );
+	void Shutdown();
+	// get / set
+	uint* GetInput() { return input; }
+	int GetPitch() const { return pitch; }
+	bool IsReady() const { return encoder != 0; }
+private:
+	// data members
+	VideoTargetDesc settings;				// as passed to Init
+	uint* input = 0;						// device buffer that receives the frame, ABGR: red in the lowest byte
+	int pitch = 0;							// bytes per row of input
+	int frame = 0;							// frames encoded since Init
+	void* encoder = 0;						// NVENC session
+#ifdef NVENCODER
+	NV_ENCODE_API_FUNCTION_LIST api = {};	// NVENC entry points
+	NV_ENC_REGISTERED_PTR inputResource = 0;	// input, registered with NVENC
+	NV_ENC_OUTPUT_PTR bitstream = 0;		// receives the encoded frame
+#endif
+};
+
+} // namespace lh2core
+
+// EOF
@@ -21,9 +21,11 @@
 //  +-----------------------------------------------------------------------------+
 //  |  finalizeRenderKernel                                                       |
 //  |  Presenting the accumulator; including brightness, contrast and gamma       |
-//  |  correction.                                                          LH2'19|
+//  |  correction. Writes to the render target surface, or to target if it is     |
+//  |  set, for cores that render without OpenGL (see SetFinalizeTarget).         |
+//  |  A core that renders a band of the image writes it from firstRow.     LH2'19|
 //  +-----------------------------------------------------------------------------+
-__global__ void finalizeRenderKernel( const float4* accumulator, const int scrwidth, const int scrheight, const float pixelValueScale, const float brightness, const float contrastFactor )
+__global__ void finalizeRenderKernel( const float4* accumulator, float4* target, const int firstRow, const int scrwidth, const int scrheight, const float pixelValueScale, const float brightness, const float contrastFactor )
 {
 	// get x and y for pixel
 	const int x = threadIdx.x + blockIdx.x * blockDim.x;
@@ -34,15 +36,22 @@ __global__ void finalizeRenderKernel( const float4* accumulator, const int scrwi
 	float r = sqrtf( max( 0.0f, (value.x - 0.5f) * contrastFactor + 0.5f + brightness ) );
 	float g = sqrtf( max( 0.0f, (value.y - 0.5f) * contrastFactor + 0.5f + brightness ) );
 	float b = sqrtf( max( 0.0f, (value.z - 0.5f) * contrastFactor + 0.5f + brightness ) );
-	surf2Dwrite<float4>( make_float4( r, g, b, value.w ), renderTarget, x * sizeof( float4 ), y, cudaBoundaryModeClamp );
+	if (target) target[x + (y + firstRow) * scrwidth] = make_float4( r, g, b, value.w );
+	else surf2Dwrite<float4>( make_float4( r, g, b, value.w ), renderTarget, x * sizeof( float4 ), y + firstRow, cudaBoundaryModeClamp );
 }
+static int2 finalizeBlock = make_int2( 32, 8 ); // block size for finalizeRenderKernel, see SetFinalizeBlockSize
+static float4* finalizeTarget = 0; // device-accessible buffer that replaces the render target surface, or 0
+static int finalizeFirstRow = 0; // target row of the first accumulator row
+__host__ void SetFinalizeBlockSize( const int x, const int y ) { finalizeBlock = make_int2( x, y ); }
+__host__ void SetFinalizeTarget( float4* p, const int firstRow ) { finalizeTarget = p, finalizeFirstRow = firstRow; }
 __host__ void finalizeRender( const float4* accumulator, const int w, const int h, const int spp, const float brightness, const float contrast )
 {
 	const float pixelValueScale = 1.0f / (float)spp;
-	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	const int bx = finalizeBlock.x, by = finalizeBlock.y;
+	const dim3 gridDim( (w + bx - 1) / bx, (h + by - 1) / by ), blockDim( bx, by );
 	// https://www.dfstudios.co.uk/articles/programming/image-programming-algorithms/image-processing-algorithms-part-5-contrast-adjustment
 	const float contrastFactor = (259.0f * (contrast * 256.0f + 255.0f)) / (255.0f * (259.0f - 256.0f * contrast));
-	finalizeRenderKernel << < gridDim, blockDim >> > (accumulator, w, h, pixelValueScale, brightness, contrastFactor);
+	finalizeRenderKernel << < gridDim, blockDim >> > (accumulator, finalizeTarget, finalizeFirstRow, w, h, pixelValueScale, brightness, contrastFactor);
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -50,7 +59,9 @@ __host__ void finalizeRender( const float4* accumulator, const int w, const int
 //  |  Split albedo and illumination for filtering. And:                          |
 //  |  1st and 2nd moment of the luminance, for variance estimation.              |
 //  |  Combined because the moments require the luminance, which is already       |
-//  |  available during the split process. Saves array I/O.                 LH2'19|
+//  |  available during the split process. Saves array I/O. If the core wrote     |
+//  |  the motion of the primary hits (see MotionControl in the OptiX 7 core),    |
+//  |  hitMotion replaces the camera reprojection and the specular search.  LH2'19|
 //  +-----------------------------------------------------------------------------+
 LH2_DEVFUNC float WorldDistance( const int2& pixel, const float4& currentWorldPos, const float4* prevWorldPos, const int w, const int h )
 {
@@ -96,8 +107,8 @@ LH2_DEVFUNC void FinalRefine( int2& currentScreenPos, const float4& currentWorld
 	d = WorldDistance( pixelPos6, currentWorldPos, prevWorldPos, w, h ); if (d < bestDist) bestDist = d, currentScreenPos = pixelPos6;
 	d = WorldDistance( pixelPos7, currentWorldPos, prevWorldPos, w, h ); if (d < bestDist) bestDist = d, currentScreenPos = pixelPos7;
 }
-__global__ void prepareFilterKernel( const float4* accumulator, uint4* features, const float4* worldPos, const float4* prevWorldPos,
-	float4* shading, float2* motion, float4* moments, float4* prevMoments, const float4* deltaDepth,
+__global__ void prepareFilterKernel( const float4* accumulator, FilterFeature* features, const float4* worldPos, const float4* prevWorldPos,
+	FilterShading* shading, float2* motion, const float2* hitMotion, FilterMoments* moments, const FilterMoments* prevMoments, const float4* deltaDepth,
 	const float4 prevPos, const float4 prevE, const float4 prevRight, const float4 prevUp, const float j0, const float j1, const float prevj0, const float prevj1,
 	const int scrwidth, const int scrheight, const float pixelValueScale, const float directClamp, const float indirectClamp, const int flags )
 {
@@ -107,13 +118,14 @@ __global__ void prepareFilterKernel( const float4* accumulator, uint4* features,
 	if ((x >= scrwidth) || (y >= scrheight)) return;
 	const int pixelIdx = x + y * scrwidth;
 	// split direct and indirect light from albedo and clamp
+	FilterFeature localFeature = features[pixelIdx];
 	const float3 direct = make_float3( accumulator[pixelIdx] ) * pixelValueScale;
-	const float3 albedo = RGB32toHDRmin1( features[pixelIdx].x );
+	const float3 albedo = FeatureAlbedoMin1( localFeature );
 	const float3 indirect = make_float3( accumulator[pixelIdx + scrwidth * scrheight] ) * pixelValueScale;
 	const float3 reciAlbedo = make_float3( 1.0f / albedo.x, 1.0f / albedo.y, 1.0f / albedo.z );
 	const float3 directLight = min3( direct * reciAlbedo, directClamp );
 	const float3 indirectLight = min3( indirect * reciAlbedo, indirectClamp );
-	shading[pixelIdx] = CombineToFloat4( directLight, indirectLight );
+	shading[pixelIdx] = PackShading( directLight, indirectLight );
 	// calculate location in screen space of the current pixel in the previous frame
 	const float4 localPos = worldPos[pixelIdx];
 	const float4 D = make_float4( normalize( make_float3( localPos - prevPos ) ), 0 );
@@ -121,7 +133,13 @@ __global__ void prepareFilterKernel( const float4* accumulator, uint4* features,
 	float2 prevPixelPos = make_float2( dot( S, prevRight ) - prevRight.w - j0, dot( S, prevUp ) - prevUp.w - j1 );
 	float lumDirect = Luminance( directLight ), lumDirect2 = lumDirect * lumDirect;
 	float lumIndirect = Luminance( indirectLight ), lumIndirect2 = lumIndirect * lumIndirect;
-	if ((__float_as_uint( localPos.w ) & 3) == 0)
+	if (hitMotion)
+	{
+		// offset to the position of the hit in the previous frame, in pixels
+		const float2 m = hitMotion[pixelIdx];
+		prevPixelPos = m.x > -1e29f ? make_float2( x + m.x, y + m.y ) : make_float2( -1e30f );
+	}
+	else if ((__float_as_uint( localPos.w ) & 3) == 0)
 	{
 		// zero motion vectors for stationary camera, hack as proposed by Victor
 		if (flags & 1) prevPixelPos = make_float2( x, y ); else
@@ -196,13 +214,12 @@ __global__ void prepareFilterKernel( const float4* accumulator, uint4* features,
 	prevPixelPos += make_float2( 0.5f, 0.5f );
 	const float px = prevPixelPos.x;
 	const float py = prevPixelPos.y;
-	const uint4 localFeature = features[pixelIdx];
 	if (px >= 0 && px < scrwidth && py >= 0 && py < scrheight)
 	{
 		const float localDdx = deltaDepth[pixelIdx].z;
 		const float localDdy = deltaDepth[pixelIdx].w;
 		const float allowedDist = max( 0.05f, fabs( localDdx ) + fabs( localDdy ) );
-		const float3 localNormal = UnpackNormal2( localFeature.y );
+		const float3 localNormal = FeatureNormal( localFeature );
 		const float4 history = ReadTexelConsistent( prevMoments, prevWorldPos, localPos, allowedDist, localNormal, px, py, scrwidth, scrheight );
 		if (history.x > -1)
 		{
@@ -210,20 +227,21 @@ __global__ void prepareFilterKernel( const float4* accumulator, uint4* features,
 			lumDirect2 = 0.2f * lumDirect2 + 0.8f * history.y;
 			lumIndirect = 0.2f * lumIndirect + 0.8f * history.z;
 			lumIndirect2 = 0.2f * lumIndirect2 + 0.8f * history.w;
-			int historySize = features[pixelIdx].w & 15;
-			if (historySize < 15) features[pixelIdx].w++;
+			const uint historySize = FeatureHistory( localFeature );
+			if (historySize < FILTERMAXHISTORY) SetFeatureHistory( localFeature, historySize + 1 );
 		}
-		else features[pixelIdx].w &= 0xfffffff0; // reset history count
+		else SetFeatureHistory( localFeature, 0 ); // reset history count
 	}
-	else features[pixelIdx].w &= 0xfffffff0; // reset history count
-	// store motion vector and luminance moments
+	else SetFeatureHistory( localFeature, 0 ); // reset history count
+	// store history count, motion vector and luminance moments
+	features[pixelIdx] = localFeature;
 	motion[pixelIdx] = prevPixelPos;
-	moments[pixelIdx] = make_float4( lumDirect, lumDirect2, lumIndirect, lumIndirect2 );
+	moments[pixelIdx] = PackMoments( make_float4( lumDirect, lumDirect2, lumIndirect, lumIndirect2 ) );
 }
-__host__ void prepareFilter( const float4* accumulator, uint4* features, const float4* worldPos, const float4* prevWorldPos,
-	float4* shading, float2* motion, float4* moments, float4* prevMoments, const float4* deltaDepth,
+__host__ void prepareFilter( const float4* accumulator, FilterFeature* features, const float4* worldPos, const float4* prevWorldPos,
+	FilterShading* shading, float2* motion, FilterMoments* moments, const FilterMoments* prevMoments, const float4* deltaDepth,
 	const ViewPyramid& prevView, const float j0, const float j1, const float prevj0, const float prevj1,
-	const int w, const int h, const uint spp, const float directClamp, const float indirectClamp, const int flags )
+	const int w, const int h, const uint spp, const float directClamp, const float indirectClamp, const int flags, const float2* hitMotion = 0 )
 {
 	const float pixelValueScale = 1.0f / (float)spp;
 	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
@@ -235,7 +253,7 @@ __host__ void prepareFilter( const float4* accumulator, uint4* features, const f
 	const float focalDistance = length( centre - prevView.pos );
 	const float screenSize = length( prevView.p3 - prevView.p1 );
 	const float lenReci = h / screenSize;
-	prepareFilterKernel << < gridDim, blockDim >> > (accumulator, features, worldPos, prevWorldPos, shading, motion, moments, prevMoments, deltaDepth,
+	prepareFilterKernel << < gridDim, blockDim >> > (accumulator, features, worldPos, prevWorldPos, shading, motion, hitMotion, moments, prevMoments, deltaDepth,
 		make_float4( prevView.pos, -(dot( prevView.pos, direction ) - dot( centre, direction )) ),
 		make_float4( direction, 0 ),
 		make_float4( right * lenReci, dot( prevView.p1, right ) * lenReci ),
@@ -245,11 +263,15 @@ __host__ void prepareFilter( const float4* accumulator, uint4* features, const f
 
 //  +-----------------------------------------------------------------------------+
 //  |  applyFilterKernel                                                          |
-//  |  Multi-phase SVGF filter kernel.                                      LH2'19|
+//  |  Multi-phase SVGF filter kernel. The TILED variant first loads the          |
+//  |  features and shading of the block plus an apron of two taps into shared    |
+//  |  memory, so the 24 taps per pixel do not go to global memory. C receives    |
+//  |  the final color with lastPass, and FilterShading records otherwise;        |
+//  |  see FilterFeature in tools_shared.h for the record layouts.          LH2'19|
 //  +-----------------------------------------------------------------------------+
-__global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per sm */ ) applyFilterKernel(
-	const uint4* features, const float4* prevWorldPos, const float4* worldPos, const float4* deltaDepth, const float2* motion, const float4* moments,
-	const float4* A, const float4* B, float4* C,
+template <bool TILED> __global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per sm */ ) applyFilterKernel(
+	const FilterFeature* features, const float4* prevWorldPos, const float4* worldPos, const float4* deltaDepth, const float2* motion, const FilterMoments* moments,
+	const FilterShading* A, const FilterShading* B, float4* C,
 	const uint scrwidth, const uint scrheight, const int phase, const uint lastPass,
 	const float brightness, const float contrastFactor )
 {
@@ -257,36 +279,52 @@ __global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per
 	// get x and y for pixel
 	const int x = threadIdx.x + blockIdx.x * blockDim.x;
 	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	const int step = 1 << (phase - 1);
+	// tiled: features, then shading, of the pixels within two taps of the block; out of bounds reads are clamped
+	extern __shared__ FilterFeature tileFeatures[];
+	const int tileX = blockIdx.x * blockDim.x - 2 * step, tileY = blockIdx.y * blockDim.y - 2 * step;
+	const int tileW = blockDim.x + 4 * step, tileH = blockDim.y + 4 * step;
+	FilterShading* tileShading = (FilterShading*)(tileFeatures + tileW * tileH);
+	if (TILED)
+	{
+		for (int i = threadIdx.x + threadIdx.y * blockDim.x; i < tileW * tileH; i += blockDim.x * blockDim.y)
+		{
+			const int u = clamp( tileX + i % tileW, 0, (int)scrwidth - 1 );
+			const int v = clamp( tileY + i / tileW, 0, (int)scrheight - 1 );
+			tileFeatures[i] = features[u + v * scrwidth], tileShading[i] = A[u + v * scrwidth];
+		}
+		__syncthreads();
+	}
 	if ((x >= scrwidth) || (y >= scrheight)) return;
 	const uint pixelIdx = x + y * scrwidth;
 	// prepare reconstruction: gather info on local pixel
-	const uint4 localFeature = features[pixelIdx];
+	const FilterFeature localFeature = features[pixelIdx];
 	const float4 localPos = worldPos[pixelIdx];
-	const float3 localNormal = UnpackNormal2( localFeature.y );
-	const float3 localColor = RGB32toHDR( localFeature.x );
-	const int localMatID = localFeature.w >> 4;
+	const float3 localNormal = FeatureNormal( localFeature );
+	const float3 localColor = FeatureAlbedo( localFeature );
+	const uint localMatID = FeatureMatID( localFeature );
 	float directlightWeightSum = 1;
 	float indirectlightWeightSum = 1;
-	const float4 combined = A[pixelIdx];
-	float3 directLightSum = directlightWeightSum * GetDirectFromFloat4( combined );
-	float3 indirectLightSum = indirectlightWeightSum * GetIndirectFromFloat4( combined );
-	const float localDirect = Luminance( GetDirectFromFloat4( combined ) );
-	const float localIndirect = Luminance( GetIndirectFromFloat4( combined ) );
-	const float localDepth = __uint_as_float( localFeature.z );
+	const FilterShading combined = A[pixelIdx];
+	float3 directLightSum = directlightWeightSum * ShadingDirect( combined );
+	float3 indirectLightSum = indirectlightWeightSum * ShadingIndirect( combined );
+	const float localDirect = Luminance( ShadingDirect( combined ) );
+	const float localIndirect = Luminance( ShadingIndirect( combined ) );
+	const float localDepth = FeatureDepth( localFeature );
+	const float depthSlack = FeatureDepthSlack( localDepth );
 	const float localDdx = deltaDepth[pixelIdx].z;
 	const float localDdy = deltaDepth[pixelIdx].w;
 	// determine variance
 	float sigma_dir = 10.0f * oneoverpow2( phase - 1 );
 	float sigma_ind = 10.0f * oneoverpow2( phase - 1 );
-	const uint historySize = localFeature.w & 15;
+	const uint historySize = FeatureHistory( localFeature );
 	const float factor = historySize == 0 ? 400.0f : 1.0f;
-	const float4 m = moments[pixelIdx];
+	const float4 m = UnpackMoments( moments[pixelIdx] );
 	const float var_dir = m.y - m.x * m.x;
 	const float var_ind = m.w - m.z * m.z;
 	const float reci_sqrt_filt_var_dir_p = -1.0f / (sigma_dir * factor * sqrtf( var_dir + 0.00001f ) + 0.00001f);
 	const float reci_sqrt_filt_var_ind_p = -1.0f / (sigma_ind * factor * sqrtf( var_ind + 0.00001f ) + 0.00001f);
 	// reconstruct illumination
-	const int step = 1 << (phase - 1);
 	for (int vv = -2; vv <= 2; vv++)
 	{
 		const int v = vv * step + y;
@@ -295,21 +333,21 @@ __global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per
 		{
 			const int u = clamp( uu * step + x, 0, (int)scrwidth - 1 );
 			// edge stopping weights
-			const uint localPixelIdx = u + v * scrwidth;
-			const float4 combined = A[localPixelIdx];
-			const uint4 neighborFeature = features[localPixelIdx];
+			const uint localPixelIdx = u + v * scrwidth, tileIdx = (u - tileX) + (v - tileY) * tileW;
+			const FilterShading combined = TILED ? tileShading[tileIdx] : A[localPixelIdx];
+			const FilterFeature neighborFeature = TILED ? tileFeatures[tileIdx] : features[localPixelIdx];
 			const float w_dist = (uu * uu + vv * vv) * (-1.0f / 7.5f);
-			const float3 neighborDirect = GetDirectFromFloat4( combined );
-			const float3 neighborIndirectLight = GetIndirectFromFloat4( combined );
-			const float3 neighborNormal = UnpackNormal2( neighborFeature.y );
+			const float3 neighborDirect = ShadingDirect( combined );
+			const float3 neighborIndirectLight = ShadingIndirect( combined );
+			const float3 neighborNormal = FeatureNormal( neighborFeature );
 			float w_normal = powf( max( 0.0f, dot( neighborNormal, localNormal ) ), 128 );
 			// depth weight. Don't set too aggressive or it will break with curved surfaces.
 			const float expectedNeighborDepth = localDepth + localDdx * (float)(uu * step) + localDdy * (float)(vv * step);
-			const float neighborDepthError = fabs( expectedNeighborDepth - __uint_as_float( neighborFeature.z ) );
+			const float neighborDepthError = max( 0.0f, fabs( expectedNeighborDepth - FeatureDepth( neighborFeature ) ) - depthSlack );
 			const float expectedDifference = fabs( expectedNeighborDepth - localDepth );
 			const float w_depth = neighborDepthError / max( 0.00001f, (0.5f + phase * 0.5f) * expectedDifference );
 			// minor weighting on albedo, different materials
-			w_normal *= ((neighborFeature.w >> 4) != localMatID) ? 0.0001 : dot( localColor, RGB32toHDR( neighborFeature.x ) );
+			w_normal *= (FeatureMatID( neighborFeature ) != localMatID) ? 0.0001 : dot( localColor, FeatureAlbedo( neighborFeature ) );
 			// luminance weight, calculate separately for direct and indirect
 			float w_dir = w_normal * __expf( fabs( localDirect - Luminance( neighborDirect ) ) * reci_sqrt_filt_var_dir_p + w_dist - w_depth );
 			float w_ind = w_normal * __expf( fabs( localIndirect - Luminance( neighborIndirectLight ) ) * reci_sqrt_filt_var_ind_p + w_dist - w_depth );
@@ -339,20 +377,20 @@ __global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per
 				prevDirect = RGBToYCoCg( prevDirect ), prevIndirect = RGBToYCoCg( prevIndirect );
 				float3 dirAvg = RGBToYCoCg( directFiltered ), dirVar = dirAvg * dirAvg, f;
 				float3 indAvg = RGBToYCoCg( indirectFiltered ), indVar = indAvg * indAvg, g;
-				float4 c4;
+				FilterShading c4;
 				if (x > 1)
 				{
-					if (y > 1) c4 = A[pixelIdx - scrwidth - 1], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
-					c4 = A[pixelIdx - 1], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
-					if (y < (scrheight - 1)) c4 = A[pixelIdx + scrwidth - 1], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+					if (y > 1) c4 = A[pixelIdx - scrwidth - 1], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+					c4 = A[pixelIdx - 1], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+					if (y < (scrheight - 1)) c4 = A[pixelIdx + scrwidth - 1], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
 				}
-				if (y > 1) c4 = A[pixelIdx - scrwidth], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
-				if (y < (scrheight - 1)) c4 = A[pixelIdx + scrwidth], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+				if (y > 1) c4 = A[pixelIdx - scrwidth], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+				if (y < (scrheight - 1)) c4 = A[pixelIdx + scrwidth], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
 				if (x < (scrwidth - 1))
 				{
-					if (y > 1) c4 = A[pixelIdx + 1 - scrwidth], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
-					c4 = A[pixelIdx + 1], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
-					if (y < (scrheight - 1)) c4 = A[pixelIdx + 1 + scrwidth], f = RGBToYCoCg( GetDirectFromFloat4( c4 ) ), g = RGBToYCoCg( GetIndirectFromFloat4( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+					if (y > 1) c4 = A[pixelIdx + 1 - scrwidth], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+					c4 = A[pixelIdx + 1], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
+					if (y < (scrheight - 1)) c4 = A[pixelIdx + 1 + scrwidth], f = RGBToYCoCg( ShadingDirect( c4 ) ), g = RGBToYCoCg( ShadingIndirect( c4 ) ), dirAvg += f, dirVar += f * f, indAvg += g, indVar += g * g;
 				}
 				dirAvg *= 1.0f / 9.0f, dirVar *= 1.0f / 9.0f, indAvg *= 1.0f / 9.0f, indVar *= 1.0f / 9.0f;
 				float3 sigmaDir = max3( make_float3( 0.0f ), dirVar - dirAvg * dirAvg );
@@ -376,7 +414,7 @@ __global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per
 	}
 	if (lastPass)
 	{
-		const float3 albedo = RGB32toHDR( localFeature.x );
+		const float3 albedo = FeatureAlbedo( localFeature );
 		const float3 combined = (directFiltered + indirectFiltered) * albedo;
 		// do brightness, contrast and gamma here, input for TAA
 		const float r = sqrtf( max( 0.0f, (combined.x - 0.5f) * contrastFactor + 0.5f + brightness ) );
@@ -388,18 +426,158 @@ __global__ void __launch_bounds__( 64 /* max block size */, 6 /* min blocks per
 	{
 		// store the filtered value so we can reuse it in the next frame
 		// if (isnan( directFiltered.x + directFiltered.y + directFiltered.z )) directFiltered = make_float3( 0 ); // happens...
-		C[pixelIdx] = CombineToFloat4( directFiltered, indirectFiltered );
+		((FilterShading*)C)[pixelIdx] = PackShading( directFiltered, indirectFiltered );
 	}
 }
 __host__ void applyFilter(
-	const uint4* features, const float4* prevWorldPos, const float4* worldPos, const float4* deltaDepth, const float2* motion, const float4* moments,
-	const float4* A, const float4* B, float4* C, const uint w, const uint h, const int phase, const uint lastPass,
+	const FilterFeature* features, const float4* prevWorldPos, const float4* worldPos, const float4* deltaDepth, const float2* motion, const FilterMoments* moments,
+	const FilterShading* A, const FilterShading* B, float4* C, const uint w, const uint h, const int phase, const uint lastPass,
 	const float brightness, const float contrast )
 {
 	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 2 ) / 2 ), blockDim( 32, 2 );
 	// https://www.dfstudios.co.uk/articles/programming/image-programming-algorithms/image-processing-algorithms-part-5-contrast-adjustment
 	const float contrastFactor = (259.0f * (contrast * 256.0f + 255.0f)) / (255.0f * (259.0f - 256.0f * contrast));
-	applyFilterKernel << < gridDim, blockDim >> > (features, prevWorldPos, worldPos, deltaDepth, motion, moments, A, B, C, w, h, phase, lastPass, brightness, contrastFactor);
+	// the apron grows with the a-trous step; beyond FILTERTILESTEP the tile holds more pixels than the taps read
+	const int step = 1 << (phase - 1);
+	if (step <= FILTERTILESTEP)
+	{
+		const size_t tileBytes = (blockDim.x + 4 * step) * (blockDim.y + 4 * step) * (sizeof( FilterFeature ) + sizeof( FilterShading ));
+		applyFilterKernel<true> << < gridDim, blockDim, tileBytes >> > (features, prevWorldPos, worldPos, deltaDepth, motion, moments, A, B, C, w, h, phase, lastPass, brightness, contrastFactor);
+	}
+	else applyFilterKernel<false> << < gridDim, blockDim >> > (features, prevWorldPos, worldPos, deltaDepth, motion, moments, A, B, C, w, h, phase, lastPass, brightness, contrastFactor);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  downsampleFilterKernel                                                     |
+//  |  Reduced resolution filtering: one pixel per scale x scale block. The       |
+//  |  block keeps the features, world position and motion of its center pixel,   |
+//  |  and averages the shading and moments of the pixels that lie on the same    |
+//  |  surface. applyFilter then runs on the reduced buffers (never with          |
+//  |  lastPass set), and upsampleFilter restores the full resolution.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void downsampleFilterKernel( const FilterFeature* features, const float4* worldPos, const float4* deltaDepth,
+	const FilterShading* shading, const FilterMoments* moments, const float2* motion,
+	FilterFeature* lowFeatures, float4* lowWorldPos, float4* lowDeltaDepth, FilterShading* lowShading, FilterMoments* lowMoments, float2* lowMotion,
+	const int scrwidth, const int scrheight, const int scale )
+{
+	// get x and y for the reduced pixel
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	const int lw = (scrwidth + scale - 1) / scale, lh = (scrheight + scale - 1) / scale;
+	if ((x >= lw) || (y >= lh)) return;
+	const int x0 = x * scale, y0 = y * scale;
+	const int cx = min( x0 + scale / 2, scrwidth - 1 ), cy = min( y0 + scale / 2, scrheight - 1 );
+	const int centerIdx = cx + cy * scrwidth, lowIdx = x + y * lw;
+	const FilterFeature centerFeature = features[centerIdx];
+	const float3 centerNormal = FeatureNormal( centerFeature );
+	const float centerDepth = FeatureDepth( centerFeature );
+	const float depthSlack = FeatureDepthSlack( centerDepth );
+	const float4 dd = deltaDepth[centerIdx];
+	// average the block pixels that lie on the surface of the center pixel
+	float3 directSum = make_float3( 0 ), indirectSum = make_float3( 0 );
+	float4 momentSum = make_float4( 0 );
+	float count = 0;
+	for (int v = y0; v < min( y0 + scale, scrheight ); v++) for (int u = x0; u < min( x0 + scale, scrwidth ); u++)
+	{
+		const int pixelIdx = u + v * scrwidth;
+		const FilterFeature feature = features[pixelIdx];
+		if (pixelIdx != centerIdx)
+		{
+			if (FeatureMatID( feature ) != FeatureMatID( centerFeature )) continue;
+			if (dot( FeatureNormal( feature ), centerNormal ) < 0.9f) continue;
+			const float expectedDepth = centerDepth + dd.z * (u - cx) + dd.w * (v - cy);
+			if (fabs( FeatureDepth( feature ) - expectedDepth ) > max( 0.05f, fabs( dd.z ) + fabs( dd.w ) ) * scale + depthSlack) continue;
+		}
+		const FilterShading combined = shading[pixelIdx];
+		directSum += ShadingDirect( combined ), indirectSum += ShadingIndirect( combined );
+		momentSum += UnpackMoments( moments[pixelIdx] ), count++;
+	}
+	const float reci = 1.0f / count;
+	lowFeatures[lowIdx] = centerFeature;
+	lowWorldPos[lowIdx] = worldPos[centerIdx];
+	lowDeltaDepth[lowIdx] = make_float4( dd.x, dd.y, dd.z * scale, dd.w * scale ); // depth gradient per reduced pixel
+	lowShading[lowIdx] = PackShading( directSum * reci, indirectSum * reci );
+	lowMoments[lowIdx] = PackMoments( momentSum * reci );
+	lowMotion[lowIdx] = motion[centerIdx] * (1.0f / scale);
+}
+__host__ void downsampleFilter( const FilterFeature* features, const float4* worldPos, const float4* deltaDepth,
+	const FilterShading* shading, const FilterMoments* moments, const float2* motion,
+	FilterFeature* lowFeatures, float4* lowWorldPos, float4* lowDeltaDepth, FilterShading* lowShading, FilterMoments* lowMoments, float2* lowMotion,
+	const int w, const int h, const int scale )
+{
+	const int lw = (w + scale - 1) / scale, lh = (h + scale - 1) / scale;
+	const dim3 gridDim( NEXTMULTIPLEOF( lw, 32 ) / 32, NEXTMULTIPLEOF( lh, 8 ) / 8 ), blockDim( 32, 8 );
+	downsampleFilterKernel << < gridDim, blockDim >> > (features, worldPos, deltaDepth, shading, moments, motion,
+		lowFeatures, lowWorldPos, lowDeltaDepth, lowShading, lowMoments, lowMotion, w, h, scale);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  upsampleFilterKernel                                                       |
+//  |  Joint bilateral upsampling of the reduced resolution filter output. Each   |
+//  |  pixel blends the four nearest reduced pixels, weighted by distance and by  |
+//  |  how well their normal, depth and material match its own full resolution    |
+//  |  features. If none match, the nearest one is used. With lastPass, the       |
+//  |  full resolution albedo is applied, as in applyFilter.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void upsampleFilterKernel( const FilterShading* lowShading, const FilterFeature* lowFeatures, const FilterFeature* features, const float4* deltaDepth,
+	float4* C, const int scrwidth, const int scrheight, const int scale, const uint lastPass, const float brightness, const float contrastFactor )
+{
+	// get x and y for pixel
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	if ((x >= scrwidth) || (y >= scrheight)) return;
+	const int pixelIdx = x + y * scrwidth;
+	const int lw = (scrwidth + scale - 1) / scale, lh = (scrheight + scale - 1) / scale;
+	const FilterFeature localFeature = features[pixelIdx];
+	const float3 localNormal = FeatureNormal( localFeature );
+	const float localDepth = FeatureDepth( localFeature );
+	const uint localMatID = FeatureMatID( localFeature );
+	const float4 dd = deltaDepth[pixelIdx];
+	const float depthScale = -1.0f / (max( 0.05f, fabs( dd.z ) + fabs( dd.w ) ) * scale);
+	// position in the reduced image; reduced pixel i represents full resolution pixel i * scale + scale / 2
+	const float fx = (x - scale / 2) * (1.0f / scale), fy = (y - scale / 2) * (1.0f / scale);
+	const int ix = (int)floorf( fx ), iy = (int)floorf( fy );
+	const float ax = fx - ix, ay = fy - iy;
+	float3 directSum = make_float3( 0 ), indirectSum = make_float3( 0 );
+	float weightSum = 0;
+	for (int j = 0; j < 2; j++) for (int i = 0; i < 2; i++)
+	{
+		const int u = clamp( ix + i, 0, lw - 1 ), v = clamp( iy + j, 0, lh - 1 );
+		const FilterFeature neighborFeature = lowFeatures[u + v * lw];
+		if (FeatureMatID( neighborFeature ) != localMatID) continue;
+		const float w_bilinear = (i ? ax : 1 - ax) * (j ? ay : 1 - ay) + 0.001f;
+		const float w_normal = powf( max( 0.0f, dot( FeatureNormal( neighborFeature ), localNormal ) ), 32 );
+		const float w_depth = __expf( max( 0.0f, fabs( FeatureDepth( neighborFeature ) - localDepth ) - FeatureDepthSlack( localDepth ) ) * depthScale );
+		const float weight = w_bilinear * w_normal * w_depth;
+		const FilterShading combined = lowShading[u + v * lw];
+		directSum += ShadingDirect( combined ) * weight, indirectSum += ShadingIndirect( combined ) * weight;
+		weightSum += weight;
+	}
+	float3 directFiltered, indirectFiltered;
+	if (weightSum > 0.0001f) directFiltered = directSum * (1.0f / weightSum), indirectFiltered = indirectSum * (1.0f / weightSum); else
+	{
+		// no reduced pixel shares this surface; take the nearest one
+		const FilterShading combined = lowShading[clamp( x / scale, 0, lw - 1 ) + clamp( y / scale, 0, lh - 1 ) * lw];
+		directFiltered = ShadingDirect( combined ), indirectFiltered = ShadingIndirect( combined );
+	}
+	if (lastPass)
+	{
+		const float3 albedo = FeatureAlbedo( localFeature );
+		const float3 combined = (directFiltered + indirectFiltered) * albedo;
+		// do brightness, contrast and gamma here, input for TAA
+		const float r = sqrtf( max( 0.0f, (combined.x - 0.5f) * contrastFactor + 0.5f + brightness ) );
+		const float g = sqrtf( max( 0.0f, (combined.y - 0.5f) * contrastFactor + 0.5f + brightness ) );
+		const float b = sqrtf( max( 0.0f, (combined.z - 0.5f) * contrastFactor + 0.5f + brightness ) );
+		C[pixelIdx] = make_float4( r, g, b, 1 );
+	}
+	else ((FilterShading*)C)[pixelIdx] = PackShading( directFiltered, indirectFiltered );
+}
+__host__ void upsampleFilter( const FilterShading* lowShading, const FilterFeature* lowFeatures, const FilterFeature* features, const float4* deltaDepth,
+	float4* C, const int w, const int h, const int scale, const uint lastPass, const float brightness, const float contrast )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	const float contrastFactor = (259.0f * (contrast * 256.0f + 255.0f)) / (255.0f * (259.0f - 256.0f * contrast));
+	upsampleFilterKernel << < gridDim, blockDim >> > (lowShading, lowFeatures, features, deltaDepth, C, w, h, scale, lastPass, brightness, contrastFactor);
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -455,7 +633,7 @@ __global__ void TAApassKernel(
 		pixel = YCoCgToRGB( newPixel * 0.1f + history * 0.9f );
 		if (isnan( pixel.x + pixel.y + pixel.z )) pixel = YCoCgToRGB( newPixel );
 	}
-	pixels[pixelIdx] = make_float4( min3( make_float3( 10 ), pixel ), 0 ); // for next frame
+	pixels[pixelIdx] = make_float4( min3( make_float3( 10 ), pixel ), pixels[pixelIdx].w ); // for next frame; w is kept for the DOF shader
 }
 __host__ void TAApass(
 	float4* pixels, float4* prevPixels, float pj0, float pj1, const float4* worldPos, const float4* prevWorldPos, const float2* motion,
@@ -465,6 +643,133 @@ __host__ void TAApass(
 	TAApassKernel << < gridDim, blockDim >> > (pixels, prevPixels, pj0, pj1, worldPos, prevWorldPos, motion, w, h);
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  reprojectAccumulatorKernel                                                 |
+//  |  Temporal reprojection: combines the spp samples in the accumulator with a  |
+//  |  history of average radiance and sample count per pixel. If prevFrame is    |
+//  |  specified, the history is first rebuilt: each pixel follows its motion     |
+//  |  vector into the previous frame, and keeps what it finds there if the depth |
+//  |  matches prevDepth, the distance of its hit to the previous eye. Else the   |
+//  |  surface was occluded, and the pixel starts over. frame receives averages,  |
+//  |  with the mean hit distance in w, like the accumulator.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void reprojectAccumulatorKernel( const float4* accumulator, const int spp, const float2* motion, const float* prevDepth,
+	const float4* prevFrame, const float4* prevHistory, const int prevSpp, float4* history, float4* frame,
+	const int w, const int h, const float maxHistory, const float depthTolerance )
+{
+	// get x and y for pixel
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	if ((x >= w) || (y >= h)) return;
+	const int pixelIdx = x + y * w;
+	float4 H;
+	if (prevFrame)
+	{
+		H = make_float4( 0 );
+		const float2 m = motion[pixelIdx];
+		const int px = (int)floorf( x + 0.5f + m.x ), py = (int)floorf( y + 0.5f + m.y );
+		if (m.x > -1e29f && px >= 0 && py >= 0 && px < w && py < h)
+		{
+			// the frame and its sample count: the history it inherited plus its own samples
+			const float4 prev = prevFrame[px + py * w];
+			const float depth = prevDepth[pixelIdx];
+			if (fabs( prev.w - depth ) < depthTolerance * depth)
+				H = make_float4( make_float3( prev ), min( maxHistory, prevHistory[px + py * w].w + prevSpp ) );
+		}
+		history[pixelIdx] = H;
+	}
+	else H = history[pixelIdx];
+	const float4 sum = accumulator[pixelIdx];
+	frame[pixelIdx] = make_float4( (make_float3( sum ) + make_float3( H ) * H.w) * (1.0f / (spp + H.w)), sum.w / spp );
+}
+__host__ void reprojectAccumulator( const float4* accumulator, const int spp, const float2* motion, const float* prevDepth,
+	const float4* prevFrame, const float4* prevHistory, const int prevSpp, float4* history, float4* frame,
+	const int w, const int h, const float maxHistory, const float depthTolerance )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	reprojectAccumulatorKernel << < gridDim, blockDim >> > (accumulator, spp, motion, prevDepth, prevFrame, prevHistory, prevSpp,
+		history, frame, w, h, maxHistory, depthTolerance);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  upscaleKernel                                                              |
+//  |  Dynamic resolution: resamples the accumulator, rendered at rw x rh, to     |
+//  |  the w x h target, and reprojects each target pixel into the previous       |
+//  |  view using the primary hit distance in accumulator.w. The result is the    |
+//  |  input for finalizeTAA: motion holds the pixel position in the previous     |
+//  |  frame. Views are given as eye position, top-left corner and screen         |
+//  |  edges. If the shade kernel wrote the motion of the primary hits, which     |
+//  |  includes moving instances, hitMotion holds it per rendered pixel; the      |
+//  |  camera reprojection is then not used.                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void upscaleKernel( const float4* accumulator, const int rw, const int rh, const float pixelValueScale,
+	float4* pixels, float2* motion, const float2* hitMotion, const int w, const int h,
+	const float3 pos, const float3 p1, const float3 right, const float3 up,
+	const float3 prevPos, const float3 prevP1, const float3 prevRight, const float3 prevUp )
+{
+	// get x and y for pixel
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	if ((x >= w) || (y >= h)) return;
+	// bilinear resample of the color; nearest sample for the depth, to keep silhouettes intact
+	const float u = clamp( (x + 0.5f) * rw / w - 0.5f, 0.0f, rw - 1.0f ), v = clamp( (y + 0.5f) * rh / h - 0.5f, 0.0f, rh - 1.0f );
+	const int x0 = (int)u, y0 = (int)v, x1 = min( x0 + 1, rw - 1 ), y1 = min( y0 + 1, rh - 1 );
+	const float fx = u - x0, fy = v - y0;
+	const float4 top = lerp( accumulator[x0 + y0 * rw], accumulator[x1 + y0 * rw], fx );
+	const float4 bottom = lerp( accumulator[x0 + y1 * rw], accumulator[x1 + y1 * rw], fx );
+	float4 value = lerp( top, bottom, fy ) * pixelValueScale;
+	value.w = accumulator[(int)(u + 0.5f) + (int)(v + 0.5f) * rw].w * pixelValueScale;
+	pixels[x + y * w] = value;
+	if (hitMotion)
+	{
+		// motion of the nearest rendered pixel, scaled to target pixels
+		const float2 m = hitMotion[(int)(u + 0.5f) + (int)(v + 0.5f) * rw];
+		motion[x + y * w] = m.x > -1e29f ? make_float2( x + 0.5f + m.x * w / rw, y + 0.5f + m.y * h / rh ) : make_float2( -1 );
+		return;
+	}
+	// primary hit point, projected on the screen plane of the previous view
+	const float3 D = normalize( p1 + right * ((x + 0.5f) / w) + up * ((y + 0.5f) / h) - pos );
+	const float3 d = pos + D * value.w - prevPos, N = cross( prevRight, prevUp );
+	const float t = dot( prevP1 - prevPos, N ) / dot( d, N );
+	const float3 Q = prevPos + d * t - prevP1;
+	motion[x + y * w] = t > 0 ? make_float2( dot( Q, prevRight ) / dot( prevRight, prevRight ) * w, dot( Q, prevUp ) / dot( prevUp, prevUp ) * h ) : make_float2( -1 );
+}
+__host__ void upscale( const float4* accumulator, const int rw, const int rh, const int spp,
+	float4* pixels, float2* motion, const float2* hitMotion, const int w, const int h,
+	const float3 pos, const float3 p1, const float3 right, const float3 up,
+	const float3 prevPos, const float3 prevP1, const float3 prevRight, const float3 prevUp )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	upscaleKernel << < gridDim, blockDim >> > (accumulator, rw, rh, 1.0f / (float)spp, pixels, motion, hitMotion, w, h, pos, p1, right, up, prevPos, prevP1, prevRight, prevUp);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  prepareDenoiseKernel                                                       |
+//  |  Fills the input layers of the OptiX denoiser: color, albedo and normal,    |
+//  |  each w * h float4s, from the accumulator and the accumulated guides        |
+//  |  (albedo, then normal). Normals are converted to camera space. The depth    |
+//  |  in the accumulator's w passes through in the color's alpha.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void prepareDenoiseKernel( const float4* accumulator, const float4* guides, float4* layers,
+	const int w, const int h, const float pixelValueScale, const float3 right, const float3 up, const float3 forward )
+{
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	if ((x >= w) || (y >= h)) return;
+	const int pixelIdx = x + y * w, layerSize = w * h;
+	const float3 N = make_float3( guides[pixelIdx + layerSize] );
+	const float l = length( N );
+	layers[pixelIdx] = accumulator[pixelIdx] * pixelValueScale;
+	layers[pixelIdx + layerSize] = guides[pixelIdx] * pixelValueScale;
+	layers[pixelIdx + layerSize * 2] = l > 0 ? make_float4( dot( N, right ), dot( N, up ), dot( N, forward ), 0 ) * (1.0f / l) : make_float4( 0 );
+}
+__host__ void prepareDenoise( const float4* accumulator, const float4* guides, float4* layers,
+	const int w, const int h, const int spp, const float3 right, const float3 up, const float3 forward )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	prepareDenoiseKernel << < gridDim, blockDim >> > (accumulator, guides, layers, w, h, 1.0f / (float)spp, right, up, forward);
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  unsharpenTAAKernel                                                         |
 //  |  Partial fix for the blur introduced by TAA.                          LH2'19|
@@ -496,6 +801,89 @@ __host__ void unsharpenTAA( const float4* pixels, const uint w, const uint h )
 	unsharpenTAAKernel << < gridDim, blockDim >> > (pixels, w, h);
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  finalizeTAAKernel                                                          |
+//  |  TAApass, unsharpenTAA and finalizeRender in a single pass. A block stages  |
+//  |  its pixels plus an apron of two in shared memory, resolves TAA for itself  |
+//  |  plus a ring of one, and sharpens and presents the resolved colors. The     |
+//  |  resolved colors go to history for the next frame; history may not alias    |
+//  |  pixels or prevPixels, as other blocks still read those. Without            |
+//  |  prevPixels the resolve is skipped, e.g. for the first frame.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+#define TAATILEX	32
+#define TAATILEY	8
+__global__ void __launch_bounds__( TAATILEX * TAATILEY ) finalizeTAAKernel(
+	const float4* pixels, const float4* prevPixels, float4* history, const float2* motion,
+	float4* target, const int firstRow, const int scrwidth, const int scrheight, const float brightness, const float contrastFactor )
+{
+	__shared__ float3 current[TAATILEY + 4][TAATILEX + 4];	// input, YCoCg; border pixels repeat outside the screen
+	__shared__ float3 resolved[TAATILEY + 2][TAATILEX + 2];	// TAA output, RGB
+	const int tid = threadIdx.x + threadIdx.y * TAATILEX;
+	const int x0 = blockIdx.x * TAATILEX, y0 = blockIdx.y * TAATILEY;
+	for (int i = tid; i < (TAATILEX + 4) * (TAATILEY + 4); i += TAATILEX * TAATILEY)
+	{
+		const int lx = i % (TAATILEX + 4), ly = i / (TAATILEX + 4);
+		const int gx = clamp( x0 + lx - 2, 0, scrwidth - 1 ), gy = clamp( y0 + ly - 2, 0, scrheight - 1 );
+		current[ly][lx] = RGBToYCoCg( make_float3( pixels[gx + gy * scrwidth] ) );
+	}
+	__syncthreads();
+	for (int i = tid; i < (TAATILEX + 2) * (TAATILEY + 2); i += TAATILEX * TAATILEY)
+	{
+		const int lx = i % (TAATILEX + 2), ly = i / (TAATILEX + 2);
+		const int gx = clamp( x0 + lx - 1, 0, scrwidth - 1 ), gy = clamp( y0 + ly - 1, 0, scrheight - 1 );
+		const float3 newPixel = current[ly + 1][lx + 1];
+		float3 pixel = newPixel;
+		const float2 prevPixelPos = motion[gx + gy * scrwidth] - make_float2( 0.5f, 0.5f );
+		if (prevPixels && prevPixelPos.x >= 0 && prevPixelPos.x < scrwidth && prevPixelPos.y >= 0 && prevPixelPos.y < scrheight)
+		{
+			// Marco Salvi's Implementation (by Chris Wyman), as in TAApassKernel
+			float3 history = RGBToYCoCg( ReadTexelBmitchellNetravali( prevPixels, prevPixelPos.x, prevPixelPos.y, scrwidth, scrheight ) );
+			float3 colorAvg = make_float3( 0 ), colorVar = make_float3( 0 );
+			for (int v = 0; v < 3; v++) for (int u = 0; u < 3; u++)
+			{
+				const float3 f = current[ly + v][lx + u];
+				colorAvg += f, colorVar += f * f;
+			}
+			colorAvg *= 1.0f / 9.0f, colorVar *= 1.0f / 9.0f;
+			float3 sigma = max3( make_float3( 0.0f ), colorVar - colorAvg * colorAvg );
+			sigma.x = sqrtf( sigma.x ), sigma.y = sqrtf( sigma.y ), sigma.z = sqrtf( sigma.z );
+			history = clamp( history, colorAvg - 1.25f * sigma, colorAvg + 1.25f * sigma );
+			pixel = newPixel * 0.1f + history * 0.9f;
+		}
+		float3 rgb = YCoCgToRGB( pixel );
+		if (isnan( rgb.x + rgb.y + rgb.z )) rgb = YCoCgToRGB( newPixel );
+		resolved[ly][lx] = min3( make_float3( 10 ), rgb );
+	}
+	__syncthreads();
+	const int x = x0 + threadIdx.x, y = y0 + threadIdx.y;
+	if ((x >= scrwidth) || (y >= scrheight)) return;
+	const int lx = threadIdx.x + 1, ly = threadIdx.y + 1, pixelIdx = x + y * scrwidth;
+	const float depth = pixels[pixelIdx].w;
+	float3 pixel = resolved[ly][lx];
+	history[pixelIdx] = make_float4( pixel, depth ); // for next frame; w is kept for the DOF shader
+	if (x > 0 && y > 0 && x < (scrwidth - 1) && y < (scrheight - 1))
+	{
+		// partial fix for the blur introduced by TAA, as in unsharpenTAAKernel
+		const float3 corners = resolved[ly - 1][lx - 1] + resolved[ly - 1][lx + 1] + resolved[ly + 1][lx + 1] + resolved[ly + 1][lx - 1];
+		const float3 edges = resolved[ly - 1][lx] + resolved[ly][lx + 1] + resolved[ly + 1][lx] + resolved[ly][lx - 1];
+		pixel = max3( pixel, pixel * 2.7f - 0.5f * (0.35f * corners + 0.5f * edges) );
+	}
+	// brightness, contrast and gamma, as in finalizeRenderKernel
+	const float r = sqrtf( max( 0.0f, (pixel.x - 0.5f) * contrastFactor + 0.5f + brightness ) );
+	const float g = sqrtf( max( 0.0f, (pixel.y - 0.5f) * contrastFactor + 0.5f + brightness ) );
+	const float b = sqrtf( max( 0.0f, (pixel.z - 0.5f) * contrastFactor + 0.5f + brightness ) );
+	if (target) target[x + (y + firstRow) * scrwidth] = make_float4( r, g, b, depth );
+	else surf2Dwrite<float4>( make_float4( r, g, b, depth ), renderTarget, x * sizeof( float4 ), y + firstRow, cudaBoundaryModeClamp );
+}
+__host__ void finalizeTAA( const float4* pixels, const float4* prevPixels, float4* history, const float2* motion,
+	const int w, const int h, const float brightness, const float contrast )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, TAATILEX ) / TAATILEX, NEXTMULTIPLEOF( h, TAATILEY ) / TAATILEY ), blockDim( TAATILEX, TAATILEY );
+	// https://www.dfstudios.co.uk/articles/programming/image-programming-algorithms/image-processing-algorithms-part-5-contrast-adjustment
+	const float contrastFactor = (259.0f * (contrast * 256.0f + 255.0f)) / (255.0f * (259.0f - 256.0f * contrast));
+	finalizeTAAKernel << < gridDim, blockDim >> > (pixels, prevPixels, history, motion, finalizeTarget, finalizeFirstRow, w, h, brightness, contrastFactor);
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  finalizeNoTAAKernel                                                        |
 //  |  Finish the frame without TAA.                                        LH2'19|
@@ -520,6 +908,33 @@ __host__ void finalizeNoTAA( float4* pixels, const uint w, const uint h, const f
 	finalizeNoTAAKernel << < gridDim, blockDim >> > (pixels, w, h, brightness, contrastFactor);
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  finalizeHeatmapKernel                                                      |
+//  |  Debug view: per pixel cost as a false color ramp, from blue (free) via     |
+//  |  green to red (1 / scale or more). Component 0 of cost holds trace cycles,  |
+//  |  component 1 any-hit invocations. Rendered at rw x rh; each target pixel    |
+//  |  shows the nearest rendered pixel. Writes like finalizeRenderKernel.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void finalizeHeatmapKernel( const uint2* cost, float4* target, const int firstRow, const int rw, const int rh,
+	const int scrwidth, const int scrheight, const int component, const float scale )
+{
+	// get x and y for pixel
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	if ((x >= scrwidth) || (y >= scrheight)) return;
+	const uint2 c = cost[x * rw / scrwidth + (y * rh / scrheight) * rw];
+	const float t = min( 1.0f, (component ? c.y : c.x) * scale );
+	const float4 color = make_float4( clamp( 1.5f - fabs( 4 * t - 3 ), 0.0f, 1.0f ),
+		clamp( 1.5f - fabs( 4 * t - 2 ), 0.0f, 1.0f ), clamp( 1.5f - fabs( 4 * t - 1 ), 0.0f, 1.0f ), 1 );
+	if (target) target[x + (y + firstRow) * scrwidth] = color;
+	else surf2Dwrite<float4>( color, renderTarget, x * sizeof( float4 ), y + firstRow, cudaBoundaryModeClamp );
+}
+__host__ void finalizeHeatmap( const uint2* cost, const int rw, const int rh, const int w, const int h, const int component, const float scale )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	finalizeHeatmapKernel << < gridDim, blockDim >> > (cost, finalizeTarget, finalizeFirstRow, rw, rh, w, h, component, scale);
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  finalizeFilterDebugKernel                                                  |
 //  |  Raw dump of debug data.                                              LH2'19|
@@ -539,4 +954,27 @@ __host__ void finalizeFilterDebug( const uint w, const uint h )
 	finalizeFilterDebugKernel << < gridDim, blockDim >> > (w, h);
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  packVideoFrameKernel                                                       |
+//  |  Convert a finalized frame to the RGBA8 input of the video encoder: red in  |
+//  |  the lowest byte of each uint, rows 'pitch' bytes apart.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void packVideoFrameKernel( const float4* pixels, uint* frame, const int pitch, const int scrwidth, const int scrheight )
+{
+	// get x and y for pixel
+	const int x = threadIdx.x + blockIdx.x * blockDim.x;
+	const int y = threadIdx.y + blockIdx.y * blockDim.y;
+	if ((x >= scrwidth) || (y >= scrheight)) return;
+	const float4 pixel = pixels[x + y * scrwidth];
+	const uint r = (uint)(__saturatef( pixel.x ) * 255.0f + 0.5f);
+	const uint g = (uint)(__saturatef( pixel.y ) * 255.0f + 0.5f);
+	const uint b = (uint)(__saturatef( pixel.z ) * 255.0f + 0.5f);
+	((uint*)((char*)frame + y * pitch))[x] = r + (g << 8) + (b << 16) + 0xff000000;
+}
+__host__ void packVideoFrame( const float4* pixels, uint* frame, const int pitch, const int w, const int h )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 32 ) / 32, NEXTMULTIPLEOF( h, 8 ) / 8 ), blockDim( 32, 8 );
+	packVideoFrameKernel << < gridDim, blockDim >> > (pixels, frame, pitch, w, h);
+}
+
 // EOF
\ No newline at end of file
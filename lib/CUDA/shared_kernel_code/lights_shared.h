@@ -20,6 +20,8 @@
 
 #define ISLIGHTS
 #define MAXISLIGHTS	8
+#define LIGHTTREE				// select lights by traversing the light tree; takes precedence over ISLIGHTS
+#define ALIASLIGHTS				// without LIGHTTREE: select lights proportional to power using the alias table
 
 #define AREALIGHTCOUNT			lightCounts.x
 #define POINTLIGHTCOUNT			lightCounts.y
@@ -103,6 +105,148 @@ LH2_DEVFUNC float PotentialDirectionalLightContribution( const int idx, const fl
 	return DIRLIGHT_ENERGY * LNdotL;
 }
 
+#ifdef LIGHTTREE
+//  +-----------------------------------------------------------------------------+
+//  |  LightTreeNodeImportance                                                    |
+//  |  Conservative estimate of the contribution of the lights below a node of    |
+//  |  the light tree, based on its energy, distance, bounding sphere and         |
+//  |  emission cone, and on the orientation of the receiving surface.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float LightTreeNodeImportance( const int idx, const float3& I, const float3& N )
+{
+	const CoreLightTreeNode4& node = (const CoreLightTreeNode4&)lightTree[idx];
+	const float3 bmin = make_float3( node.data0 ), bmax = make_float3( node.data1 );
+	const float4 cone = node.data2;
+	const float3 extent = bmax - bmin;
+	const float r2 = 0.25f * dot( extent, extent );
+	float3 L = 0.5f * (bmin + bmax) - I;
+	const float l2 = dot( L, L );
+	// the distance is clamped to the radius of the bounding sphere to avoid the singularity near the lights
+	const float d2 = max( l2, max( r2, 1e-8f ) );
+	L *= rsqrtf( max( l2, 1e-16f ) );
+	const float thetaU = asinf( sqrtf( r2 / d2 ) );
+	// receiver: some part of the bounding sphere must be above the surface
+	const float thetaI = max( 0.0f, acosf( clamp( dot( N, L ), -1.0f, 1.0f ) ) - thetaU );
+	if (thetaI >= 0.5f * PI) return 0;
+	// emitter: the shading point must be inside the emission cone, widened by the bounding sphere
+	float cosE = 1;
+	if (cone.w > -1)
+	{
+		const float thetaE = max( 0.0f, acosf( clamp( -dot( make_float3( cone ), L ), -1.0f, 1.0f ) ) - acosf( cone.w ) - thetaU );
+		if (thetaE >= 0.5f * PI) return 0;
+		cosE = cosf( thetaE );
+	}
+	return node.data3.x * cosf( thetaI ) * cosE / d2;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SampleLightTree                                                            |
+//  |  Stochastic traversal of the light tree: at each node, a child is picked    |
+//  |  with a probability proportional to its importance. Random number r is      |
+//  |  reused at each level. Returns the leaf, or -1 if no light contributes.     |
+//  |                                                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC int SampleLightTree( float r, const float3& I, const float3& N, float& prob )
+{
+	int node = 0;
+	prob = 1;
+	while (1)
+	{
+		const int left = lightTree[node].left, right = lightTree[node].right;
+		if (left < 0) return node;
+		const float wl = LightTreeNodeImportance( left, I, N ), wr = LightTreeNodeImportance( right, I, N );
+		if (wl + wr <= 0) return -1;
+		const float pl = wl / (wl + wr);
+		if (r < pl) r = min( r / pl, 0.99999f ), prob *= pl, node = left;
+		else r = min( (r - pl) / (1 - pl), 0.99999f ), prob *= 1 - pl, node = right;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  LightTreePickProb                                                          |
+//  |  Probability that SampleLightTree selects the specified light, obtained by  |
+//  |  walking from its leaf to the root.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float LightTreePickProb( const int lightIdx, const float3& I, const float3& N )
+{
+	int node = AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT - 1 + lightIdx, parent;
+	float prob = 1;
+	while ((parent = lightTree[node].parent) >= 0)
+	{
+		const int sibling = lightTree[parent].left == node ? lightTree[parent].right : lightTree[parent].left;
+		const float w = LightTreeNodeImportance( node, I, N );
+		if (w <= 0) return 0;
+		prob *= w / (w + LightTreeNodeImportance( sibling, I, N ));
+		node = parent;
+	}
+	return prob;
+}
+#endif
+
+#ifdef SKYIMPORTANCE
+//  +-----------------------------------------------------------------------------+
+//  |  SkyNEEProb                                                                 |
+//  |  Probability that next event estimation connects to the sky dome rather     |
+//  |  than to one of the lights.                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float SkyNEEProb()
+{
+	if (skyCDF == 0) return 0;
+	return (AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT + DIRECTIONALLIGHTCOUNT) == 0 ? 1 : SKYNEEPROB;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SampleSkyCDF                                                               |
+//  |  Find the interval of a normalized cdf of n values that contains r.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC int SampleSkyCDF( const float* cdf, const int n, const float r )
+{
+	int lo = 0, hi = n - 1;
+	while (lo < hi)
+	{
+		const int mid = (lo + hi) >> 1;
+		if (cdf[mid + 1] <= r) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SkyPdf                                                                     |
+//  |  Solid angle pdf of selecting direction D with SampleSkyDirection. The      |
+//  |  mapping matches SampleSkydome.                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float SkyPdf( const float3& D )
+{
+	const int w = skyCDFSize.x, h = skyCDFSize.y;
+	const float u = 0.5f * (1.0f + atan2f( D.x, -D.z ) * INVPI), v = acosf( clamp( D.y, -1.0f, 1.0f ) ) * INVPI;
+	const int x = clamp( (int)(u * w), 0, w - 1 ), y = clamp( (int)(v * h), 0, h - 1 );
+	const float* conditional = skyCDF + h + 1 + y * (w + 1);
+	const float sinTheta = sqrtf( max( 0.0f, 1 - D.y * D.y ) );
+	if (sinTheta <= 0) return 0;
+	return (skyCDF[y + 1] - skyCDF[y]) * h * (conditional[x + 1] - conditional[x]) * w / (2 * PI * PI * sinTheta);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SampleSkyDirection                                                         |
+//  |  Select a direction towards the sky dome, in proportion to luminance:       |
+//  |  r0 selects a row using the marginal cdf, r1 a cell in that row.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float3 SampleSkyDirection( const float r0, const float r1, float& pdf )
+{
+	const int w = skyCDFSize.x, h = skyCDFSize.y;
+	const int y = SampleSkyCDF( skyCDF, h, r0 );
+	const float* conditional = skyCDF + h + 1 + y * (w + 1);
+	const int x = SampleSkyCDF( conditional, w, r1 );
+	// continuous position inside the cell
+	const float dv = skyCDF[y + 1] - skyCDF[y], du = conditional[x + 1] - conditional[x];
+	const float v = ((float)y + clamp( (r0 - skyCDF[y]) / max( dv, 1e-12f ), 0.0f, 1.0f )) / h;
+	const float u = ((float)x + clamp( (r1 - conditional[x]) / max( du, 1e-12f ), 0.0f, 1.0f )) / w;
+	const float theta = v * PI, phi = (2 * u - 1) * PI, sinTheta = sinf( theta );
+	pdf = sinTheta > 0 ? dv * h * du * w / (2 * PI * PI * sinTheta) : 0;
+	return make_float3( sinTheta * sinf( phi ), cosf( theta ), -sinTheta * cosf( phi ) );
+}
+#endif
+
 //  +-----------------------------------------------------------------------------+
 //  |  CalculateLightPDF                                                          |
 //  |  Calculates the solid angle of a light source.                        LH2'19|
@@ -119,7 +263,14 @@ LH2_DEVFUNC float CalculateLightPDF( const float3& D, const float t, const float
 //  +-----------------------------------------------------------------------------+
 LH2_DEVFUNC float LightPickProb( int idx, const float3& O, const float3& N, const float3& I )
 {
-#ifdef ISLIGHTS
+#ifdef LIGHTTREE
+	// directional lights are not in the tree; they are picked uniformly, see RandomPointOnLight
+	const float lightCount = AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT + DIRECTIONALLIGHTCOUNT;
+	return LightTreePickProb( idx, O, N ) * (1 - DIRECTIONALLIGHTCOUNT / lightCount);
+#elif defined ALIASLIGHTS
+	// area lights are the first entries of the alias table
+	return lightAlias[idx].pickProb;
+#elif defined ISLIGHTS
 	// for implicit connections; calculates the chance that the light would have been explicitly selected
 	float potential[MAXISLIGHTS];
 	float sum = 0;
@@ -161,54 +312,20 @@ LH2_DEVFUNC float3 RandomBarycentrics( const float r0 )
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  RandomPointOnLight                                                         |
-//  |  Selects a random point on a random light. Returns a position, a normal on  |
-//  |  the light source, the probability that this particular light would have    |
-//  |  been picked and the importance of the explicit connection.           LH2'19|
+//  |  LightSamplePoint                                                           |
+//  |  Evaluates the connection from I to light lightIdx. P is the point on the   |
+//  |  light for area lights, and ignored for the others. Returns the position    |
+//  |  to connect to, and yields the radiance and the importance of the           |
+//  |  connection like RandomPointOnLight does for the point it selects.    LH2'19|
 //  +-----------------------------------------------------------------------------+
-LH2_DEVFUNC float3 RandomPointOnLight( float r0, float r1, const float3& I, const float3& N, float& pickProb, float& lightPdf, float3& lightColor )
+LH2_DEVFUNC float3 LightSamplePoint( const int lightIdx, const float3& P, const float3& I, const float3& N, float& lightPdf, float3& lightColor )
 {
-	const float lightCount = AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT + DIRECTIONALLIGHTCOUNT;
-#ifdef ISLIGHTS
-	// predetermine the barycentrics for any area light we sample
-	float3 bary = RandomBarycentrics( r0 );
-	// importance sampling of lights, pickProb is per-light probability
-	float potential[MAXISLIGHTS];
-	float sum = 0, total = 0;
-	int lights = 0, lightIdx = 0;
-	for (int i = 0; i < AREALIGHTCOUNT; i++) { float c = PotentialAreaLightContribution( i, I, N, make_float3( 0 ), bary ); potential[lights++] = c; sum += c; }
-	for (int i = 0; i < POINTLIGHTCOUNT; i++) { float c = PotentialPointLightContribution( i, I, N ); potential[lights++] = c; sum += c; }
-	for (int i = 0; i < SPOTLIGHTCOUNT; i++) { float c = PotentialSpotLightContribution( i, I, N ); potential[lights++] = c; sum += c; }
-	for (int i = 0; i < DIRECTIONALLIGHTCOUNT; i++) { float c = PotentialDirectionalLightContribution( i, I, N ); potential[lights++] = c; sum += c; }
-	if (sum <= 0) // no potential lights found
-	{
-		lightPdf = 0;
-		return make_float3( 1 /* light direction; don't return 0 or nan, this will be slow */ );
-	}
-	r1 *= sum;
-	for (int i = 0; i < lights; i++)
-	{
-		total += potential[i];
-		if (total >= r1) { lightIdx = i; break; }
-	}
-	pickProb = potential[lightIdx] / sum;
-#else
-	// uniform random sampling of lights, pickProb is simply 1.0 / lightCount
-	pickProb = 1.0f / lightCount;
-	int lightIdx = (int)(r0 * lightCount);
-	r0 = (r0 - (float)lightIdx * (1.0f / lightCount)) * lightCount;
-#endif
-	lightIdx = clamp( lightIdx, 0, (int)lightCount - 1 );
 	if (lightIdx < AREALIGHTCOUNT)
 	{
-		// pick an area light
+		// area light
 		const CoreLightTri4& light = (const CoreLightTri4&)areaLights[lightIdx];
-		const float4 V0 = light.data3;			// vertex0
-		const float4 V1 = light.data4;			// vertex1
-		const float4 V2 = light.data5;			// vertex2
 		lightColor = make_float3( light.data2 );	// radiance
 		const float4 LN = light.data1;			// N
-		const float3 P = make_float3( bary.x * V0 + bary.y * V1 + bary.z * V2 );
 		float3 L = I - P; // reversed: from light to intersection point
 		const float sqDist = dot( L, L );
 		L = normalize( L );
@@ -219,10 +336,10 @@ LH2_DEVFUNC float3 RandomPointOnLight( float r0, float r1, const float3& I, cons
 	}
 	else if (lightIdx < (AREALIGHTCOUNT + POINTLIGHTCOUNT))
 	{
-		// pick a pointlight
+		// pointlight
 		const CorePointLight4& light = (const CorePointLight4&)pointLights[lightIdx - AREALIGHTCOUNT];
-		const float3 pos = make_float3( light.data0 );			// position
-		const float3 lightColor = make_float3( light.data1 );	// radiance
+		const float3 pos = make_float3( light.data0 );	// position
+		lightColor = make_float3( light.data1 );		// radiance
 		const float3 L = I - pos; // reversed
 		const float sqDist = dot( L, L );
 		lightPdf = dot( L, N ) < 0 ? sqDist : 0;
@@ -230,7 +347,7 @@ LH2_DEVFUNC float3 RandomPointOnLight( float r0, float r1, const float3& I, cons
 	}
 	else if (lightIdx < (AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT))
 	{
-		// pick a spotlight
+		// spotlight
 		const CoreSpotLight4& light = (const CoreSpotLight4&)spotLights[lightIdx - (AREALIGHTCOUNT + POINTLIGHTCOUNT)];
 		const float4 P = light.data0;			// position + cos_inner
 		const float4 E = light.data1;			// radiance + cos_outer
@@ -247,7 +364,7 @@ LH2_DEVFUNC float3 RandomPointOnLight( float r0, float r1, const float3& I, cons
 	}
 	else
 	{
-		// pick a directional light
+		// directional light
 		const CoreDirectionalLight4& light = (const CoreDirectionalLight4&)directionalLights[lightIdx - (AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT)];
 		const float3 L = make_float3( light.data0 );	// direction
 		lightColor = make_float3( light.data1 );		// radiance
@@ -257,4 +374,87 @@ LH2_DEVFUNC float3 RandomPointOnLight( float r0, float r1, const float3& I, cons
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RandomPointOnLight                                                         |
+//  |  Selects a random point on a random light. Returns a position, a normal on  |
+//  |  the light source, the probability that this particular light would have    |
+//  |  been picked and the importance of the explicit connection. If specified,   |
+//  |  sampledLight receives the index of the light, see LightSamplePoint.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float3 RandomPointOnLight( float r0, float r1, const float3& I, const float3& N, float& pickProb, float& lightPdf, float3& lightColor, int* sampledLight = 0 )
+{
+	const float lightCount = AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT + DIRECTIONALLIGHTCOUNT;
+#ifdef LIGHTTREE
+	// predetermine the barycentrics for any area light we sample
+	float3 bary = RandomBarycentrics( r0 );
+	// directional lights get a share proportional to their count; the others are selected using the tree
+	const int treeLights = AREALIGHTCOUNT + POINTLIGHTCOUNT + SPOTLIGHTCOUNT;
+	const float directionalProb = DIRECTIONALLIGHTCOUNT / lightCount;
+	int lightIdx;
+	if (r1 < directionalProb)
+	{
+		lightIdx = treeLights + (int)(r1 * lightCount);
+		pickProb = 1.0f / lightCount;
+	}
+	else
+	{
+		const int leaf = SampleLightTree( (r1 - directionalProb) / (1 - directionalProb), I, N, pickProb );
+		if (leaf < 0) // no potential lights found
+		{
+			lightPdf = 0;
+			return make_float3( 1 /* light direction; don't return 0 or nan, this will be slow */ );
+		}
+		lightIdx = leaf - (treeLights - 1);
+		pickProb *= 1 - directionalProb;
+	}
+#elif defined ALIASLIGHTS
+	// predetermine the barycentrics for any area light we sample
+	float3 bary = RandomBarycentrics( r0 );
+	// alias method: pick an entry uniformly, then the entry or its alias, using the fraction of r1
+	const float x = r1 * lightCount;
+	int lightIdx = min( (int)x, (int)lightCount - 1 );
+	const CoreLightAlias entry = lightAlias[lightIdx];
+	if (x - (float)lightIdx >= entry.threshold) lightIdx = entry.alias;
+	pickProb = lightAlias[lightIdx].pickProb;
+#elif defined ISLIGHTS
+	// predetermine the barycentrics for any area light we sample
+	float3 bary = RandomBarycentrics( r0 );
+	// importance sampling of lights, pickProb is per-light probability
+	float potential[MAXISLIGHTS];
+	float sum = 0, total = 0;
+	int lights = 0, lightIdx = 0;
+	for (int i = 0; i < AREALIGHTCOUNT; i++) { float c = PotentialAreaLightContribution( i, I, N, make_float3( 0 ), bary ); potential[lights++] = c; sum += c; }
+	for (int i = 0; i < POINTLIGHTCOUNT; i++) { float c = PotentialPointLightContribution( i, I, N ); potential[lights++] = c; sum += c; }
+	for (int i = 0; i < SPOTLIGHTCOUNT; i++) { float c = PotentialSpotLightContribution( i, I, N ); potential[lights++] = c; sum += c; }
+	for (int i = 0; i < DIRECTIONALLIGHTCOUNT; i++) { float c = PotentialDirectionalLightContribution( i, I, N ); potential[lights++] = c; sum += c; }
+	if (sum <= 0) // no potential lights found
+	{
+		lightPdf = 0;
+		return make_float3( 1 /* light direction; don't return 0 or nan, this will be slow */ );
+	}
+	r1 *= sum;
+	for (int i = 0; i < lights; i++)
+	{
+		total += potential[i];
+		if (total >= r1) { lightIdx = i; break; }
+	}
+	pickProb = potential[lightIdx] / sum;
+#else
+	// uniform random sampling of lights, pickProb is simply 1.0 / lightCount
+	pickProb = 1.0f / lightCount;
+	int lightIdx = (int)(r0 * lightCount);
+	r0 = (r0 - (float)lightIdx * (1.0f / lightCount)) * lightCount;
+#endif
+	lightIdx = clamp( lightIdx, 0, (int)lightCount - 1 );
+	if (sampledLight) *sampledLight = lightIdx;
+	float3 P = make_float3( 0 );
+	if (lightIdx < AREALIGHTCOUNT)
+	{
+		// pick a point on an area light
+		const CoreLightTri4& light = (const CoreLightTri4&)areaLights[lightIdx];
+		P = make_float3( bary.x * light.data3 + bary.y * light.data4 + bary.z * light.data5 );
+	}
+	return LightSamplePoint( lightIdx, P, I, N, lightPdf, lightColor );
+}
+
 // EOF
\ No newline at end of file
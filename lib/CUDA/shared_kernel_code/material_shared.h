@@ -16,6 +16,28 @@
    used in RenderCore_OptixPrime and RenderCore_OptixRTX.
 */
 
+LH2_DEVFUNC float2 UnpackHalf2( const uint h )
+{
+	return __half22float2( __halves2half2( __ushort_as_half( h & 0xffff ), __ushort_as_half( h >> 16 ) ) );
+}
+
+// expand a compact shading record to the fields of a CoreTri4 that GetShadingData reads.
+LH2_DEVFUNC void UnpackTriangle( const CoreTriPacked& packed, CoreTri4& tri )
+{
+	const uint4 uv = packed.uv, normals = packed.normals, frame = packed.frame;
+	const float2 uv0 = UnpackHalf2( uv.x ), uv1 = UnpackHalf2( uv.y ), uv2 = UnpackHalf2( uv.z );
+	const float3 F = UnpackNormalOct( normals.w );
+	const float2 alpha01 = UnpackHalf2( frame.z ), alpha2LOD = UnpackHalf2( frame.w );
+	tri.u4 = make_float4( uv0.x, uv1.x, uv2.x, __int_as_float( -1 ) );
+	tri.v4 = make_float4( uv0.y, uv1.y, uv2.y, __uint_as_float( uv.w ) );
+	tri.vN0 = make_float4( UnpackNormalOct( normals.x ), F.x );
+	tri.vN1 = make_float4( UnpackNormalOct( normals.y ), F.y );
+	tri.vN2 = make_float4( UnpackNormalOct( normals.z ), F.z );
+	tri.T4 = make_float4( UnpackNormalOct( frame.x ), 0 );
+	tri.B4 = make_float4( UnpackNormalOct( frame.y ), 0 );
+	tri.alpha4 = make_float4( alpha01.x, alpha01.y, alpha2LOD.x, alpha2LOD.y );
+}
+
 LH2_DEVFUNC void GetShadingData(
 	const float3 D,							// IN:	incoming ray direction, used for consistent normals
 	const float u, const float v,			//		barycentric coordinates of intersection point
@@ -29,12 +29,80 @@ LH2_DEVFUNC float4 __uchar4_to_float4( const uint v4 )
 	return make_float4( (float)(v4 & 255) * r, (float)((v4 >> 8) & 255) * r, (float)((v4 >> 16) & 255) * r, (float)(v4 >> 24) * r );
 }
 
+#ifdef VIRTUALTEXTURES
+// virtual texel pools (see TexelPager in the OptiX7 core): the page table holds the physical page of each virtual
+// page, or NOTRESIDENT, plus the average texel of the page, which stands in for its texels until it is streamed in.
+LH2_DEVFUNC uint FetchPagedTexel( const uint* pool, const uint2* pages, uint* usage, const int address )
+{
+	const uint page = address >> TEXPAGESHIFT, bit = 1u << (page & 31);
+	if (!(usage[page >> 5] & bit)) atomicOr( usage + (page >> 5), bit );
+	const uint2 entry = pages[page];
+	return entry.x == NOTRESIDENT ? entry.y : pool[(entry.x << TEXPAGESHIFT) + (address & (TEXPAGESIZE - 1))];
+}
+#define ARGB32TEXEL(a)	FetchPagedTexel( argb32, argb32Pages, argb32Usage, a )
+#define NRM32TEXEL(a)	FetchPagedTexel( nrm32, nrm32Pages, nrm32Usage, a )
+#else
+#define ARGB32TEXEL(a)	argb32[a]
+#define NRM32TEXEL(a)	nrm32[a]
+#endif
+
+#ifdef BCTEXTURES
+// block compressed texels (see EncodeBC1 / EncodeBC5 in the OptiX7 core): textures with BCTEXTURE set in their
+// offset store 4x4 texel blocks; BC1 (color, opaque) for ARGB32 textures, BC5 (x and y) for normal maps.
+LH2_DEVFUNC float4 FetchBC1Texel( const uint2 block, const int t )
+{
+	const uint c0 = block.x & 0xffff, c1 = block.x >> 16, idx = (block.y >> (2 * t)) & 3;
+	const float3 e0 = make_float3( (float)(c0 >> 11) * (1.0f / 31), (float)((c0 >> 5) & 63) * (1.0f / 63), (float)(c0 & 31) * (1.0f / 31) );
+	const float3 e1 = make_float3( (float)(c1 >> 11) * (1.0f / 31), (float)((c1 >> 5) & 63) * (1.0f / 63), (float)(c1 & 31) * (1.0f / 31) );
+	const float3 c = idx == 0 ? e0 : idx == 1 ? e1 : idx == 2 ? (2 * e0 + e1) * (1.0f / 3) : (e0 + 2 * e1) * (1.0f / 3);
+	return make_float4( c, 1 );
+}
+LH2_DEVFUNC float FetchBC4Value( const uint lo, const uint hi, const int t )
+{
+	const float r0 = (float)(lo & 255), r1 = (float)((lo >> 8) & 255);
+	const uint idx = (uint)((((unsigned long long)hi << 16) | (lo >> 16)) >> (3 * t)) & 7;
+	const float v = idx == 0 ? r0 : idx == 1 ? r1 : ((8 - idx) * r0 + (idx - 1) * r1) * (1.0f / 7);
+	return v * (1.0f / 256.0f);
+}
+LH2_DEVFUNC float4 FetchBlockTexel( const int o, const int w, const int x, const int y, const TexelStorage storage )
+{
+	const int b = o + (x >> 2) + (y >> 2) * ((w + 3) >> 2), t = (x & 3) + (y & 3) * 4;
+	if (storage == ARGB32) return FetchBC1Texel( bc1[b], t );
+	// BC5 stores x and y; z is reconstructed for a unit length tangent space normal
+	const uint4 block = bc5[b];
+	const float nx = FetchBC4Value( block.x, block.y, t ), ny = FetchBC4Value( block.z, block.w, t );
+	const float ux = nx * 2 - 1, uy = ny * 2 - 1, uz = sqrtf( max( 0.0f, 1 - ux * ux - uy * uy ) );
+	return make_float4( nx, ny, uz * 0.5f + 0.5f, 1 );
+}
+#define MIPLEVELSIZE(o,w,h)	(((o) & BCTEXTURE) ? (((w) + 3) >> 2) * (((h) + 3) >> 2) : (w) * (h))
+#else
+#define MIPLEVELSIZE(o,w,h)	((w) * (h))
+#endif
+
 LH2_DEVFUNC float4 FetchTexel( const float2 texCoord, const int o, const int w, const int h,
 	const TexelStorage storage = ARGB32 )
 {
+#ifdef HWTEXTURES
+	// texture objects (see SyncTextureObjects in the OptiX7 core): filtering is done by the texture units
+	if (o & HWTEXTURE) return tex2DLod<float4>( texObjects[o & (HWTEXTURE - 1)], texCoord.x, texCoord.y, 0 );
+#endif
 	const float2 tc = make_float2( (max( texCoord.x + 1000, 0.0f ) * w) - 0.5f, (max( texCoord.y + 1000, 0.0f ) * h) - 0.5f );
 	const int iu = ((int)tc.x) % w;
 	const int iv = ((int)tc.y) % h;
+#ifdef BCTEXTURES
+	if (o & BCTEXTURE)
+	{
+		const int b = o & (BCTEXTURE - 1);
+	#ifdef BILINEAR
+		const float fu = tc.x - floor( tc.x ), fv = tc.y - floor( tc.y );
+		const int iu1 = (iu + 1) % w, iv1 = (iv + 1) % h;
+		return FetchBlockTexel( b, w, iu, iv, storage ) * ((1 - fu) * (1 - fv)) + FetchBlockTexel( b, w, iu1, iv, storage ) * (fu * (1 - fv)) +
+			FetchBlockTexel( b, w, iu, iv1, storage ) * ((1 - fu) * fv) + FetchBlockTexel( b, w, iu1, iv1, storage ) * (fu * fv);
+	#else
+		return FetchBlockTexel( b, w, iu, iv, storage );
+	#endif
+	}
+#endif
 #ifdef BILINEAR
 	const float fu = tc.x - floor( tc.x );
 	const float fv = tc.y - floor( tc.y );
@@ -45,39 +113,42 @@ LH2_DEVFUNC float4 FetchTexel( const float2 texCoord, const int o, const int w,
 	float4 p0, p1, p2, p3;
 	const uint iu1 = (iu + 1) % w, iv1 = (iv + 1) % h;
 	if (storage == ARGB32)
-		p0 = __uchar4_to_float4( argb32[o + iu + iv * w] ),
-		p1 = __uchar4_to_float4( argb32[o + iu1 + iv * w] ),
-		p2 = __uchar4_to_float4( argb32[o + iu + iv1 * w] ),
-		p3 = __uchar4_to_float4( argb32[o + iu1 + iv1 * w] );
+		p0 = __uchar4_to_float4( ARGB32TEXEL( o + iu + iv * w ) ),
+		p1 = __uchar4_to_float4( ARGB32TEXEL( o + iu1 + iv * w ) ),
+		p2 = __uchar4_to_float4( ARGB32TEXEL( o + iu + iv1 * w ) ),
+		p3 = __uchar4_to_float4( ARGB32TEXEL( o + iu1 + iv1 * w ) );
 	else if (storage == ARGB128)
 		p0 = argb128[o + iu + iv * w],
 		p1 = argb128[o + iu1 + iv * w],
 		p2 = argb128[o + iu + iv1 * w],
 		p3 = argb128[o + iu1 + iv1 * w];
 	else /* if (storage == NRM32) */
-		p0 = __uchar4_to_float4( nrm32[o + iu + iv * w] ),
-		p1 = __uchar4_to_float4( nrm32[o + iu1 + iv * w] ),
-		p2 = __uchar4_to_float4( nrm32[o + iu + iv1 * w] ),
-		p3 = __uchar4_to_float4( nrm32[o + iu1 + iv1 * w] );
+		p0 = __uchar4_to_float4( NRM32TEXEL( o + iu + iv * w ) ),
+		p1 = __uchar4_to_float4( NRM32TEXEL( o + iu1 + iv * w ) ),
+		p2 = __uchar4_to_float4( NRM32TEXEL( o + iu + iv1 * w ) ),
+		p3 = __uchar4_to_float4( NRM32TEXEL( o + iu1 + iv1 * w ) );
 	return p0 * w0 + p1 * w1 + p2 * w2 + p3 * w3;
 #else
-	if (storage == ARGB32) return __uchar4_to_float4( argb32[o + iu + iv * w] );
+	if (storage == ARGB32) return __uchar4_to_float4( ARGB32TEXEL( o + iu + iv * w ) );
 	else if (storage == ARGB128) return argb128[o + iu + iv * w];
-	/* else if (storage == NRM32) */ return __uchar4_to_float4( nrm32[o + iu + iv * w] );
+	/* else if (storage == NRM32) */ return __uchar4_to_float4( NRM32TEXEL( o + iu + iv * w ) );
 #endif
 }
 
 LH2_DEVFUNC float4 FetchTexelTrilinear( const float lambda, const float2 texCoord, const int offset, const int width, const int height )
 {
+#ifdef HWTEXTURES
+	if (offset & HWTEXTURE) return tex2DLod<float4>( texObjects[offset & (HWTEXTURE - 1)], texCoord.x, texCoord.y, min( lambda, (float)(MIPLEVELCOUNT - 1) ) );
+#endif
 	const int level0 = min( MIPLEVELCOUNT - 1, (int)lambda );
 	const int level1 = min( MIPLEVELCOUNT - 1, level0 + 1 );
 	const float f = lambda - floor( lambda );
 	// select first MIP level
 	int o0 = offset, w0 = width, h0 = height;
-	for (int i = 0; i < level0; i++) o0 += w0 * h0, w0 >>= 1, h0 >>= 1;
+	for (int i = 0; i < level0; i++) o0 += MIPLEVELSIZE( offset, w0, h0 ), w0 >>= 1, h0 >>= 1;
 	// select second MIP level
 	int o1 = offset, w1 = width, h1 = height;
-	for (int i = 0; i < level1; i++) o1 += w1 * h1, w1 >>= 1, h1 >>= 1; // TODO: start at o0, h0, w0
+	for (int i = 0; i < level1; i++) o1 += MIPLEVELSIZE( offset, w1, h1 ), w1 >>= 1, h1 >>= 1; // TODO: start at o0, h0, w0
 	// read actual data
 	const float4 p0 = FetchTexel( texCoord, o0, w0, h0 );
 	const float4 p1 = FetchTexel( texCoord, o1, w1, h1 );
@@ -115,7 +186,7 @@ LH2_DEVFUNC float3 ReadTexelBmitchellNetravali( const float4* buffer, float u, f
 	return make_float3( total * (1.0f / totalWeight) );
 }
 
-LH2_DEVFUNC float4 ReadTexelConsistent( const float4* buffer, const float4* prevWorldPos,
+LH2_DEVFUNC float4 ReadTexelConsistent( const FilterMoments* buffer, const float4* prevWorldPos,
 	const float4 localPos, const float allowedDist, const float3 localNormal, float u, float v, int w, int h )
 {
 	// part of reprojection:
@@ -124,10 +195,10 @@ LH2_DEVFUNC float4 ReadTexelConsistent( const float4* buffer, const float4* prev
 	const int iu1 = (int)floor( u ), iv1 = (int)floor( v ), iu0 = max( 0, iu1 - 1 ), iv0 = max( 0, iv1 - 1 );
 	if (iu1 >= w || iv1 >= h || iu1 < 0 || iv1 < 0) return make_float4( -1 );
 	const float2 fuv = make_float2( u - floor( u ), v - floor( v ) );
-	const float4 p0 = buffer[iu0 + iv0 * w], pp0 = prevWorldPos[iu0 + iv0 * w];
-	const float4 p1 = buffer[iu1 + iv0 * w], pp1 = prevWorldPos[iu1 + iv0 * w];
-	const float4 p2 = buffer[iu0 + iv1 * w], pp2 = prevWorldPos[iu0 + iv1 * w];
-	const float4 p3 = buffer[iu1 + iv1 * w], pp3 = prevWorldPos[iu1 + iv1 * w];
+	const float4 p0 = UnpackMoments( buffer[iu0 + iv0 * w] ), pp0 = prevWorldPos[iu0 + iv0 * w];
+	const float4 p1 = UnpackMoments( buffer[iu1 + iv0 * w] ), pp1 = prevWorldPos[iu1 + iv0 * w];
+	const float4 p2 = UnpackMoments( buffer[iu0 + iv1 * w] ), pp2 = prevWorldPos[iu0 + iv1 * w];
+	const float4 p3 = UnpackMoments( buffer[iu1 + iv1 * w] ), pp3 = prevWorldPos[iu1 + iv1 * w];
 	const uint localSpecularity = __float_as_uint( localPos.w ) & 3;
 	float w0 = (1 - fuv.x) * (1 - fuv.y), w1 = fuv.x * (1 - fuv.y), w2 = (1 - fuv.x) * fuv.y, w3 = 1 - (w0 + w1 + w2);
 	{	// scope reduction
@@ -156,7 +227,7 @@ LH2_DEVFUNC float4 ReadTexelConsistent( const float4* buffer, const float4* prev
 	if (sum == 0 /* shouldn't happen */) return make_float4( -1 ); else return (w0 * p0 + w1 * p1 + w2 * p2 + w3 * p3) * (1.0f / sum);
 }
 
-LH2_DEVFUNC void ReadTexelConsistent2( const float4* buffer, const float4* prevWorldPos,
+LH2_DEVFUNC void ReadTexelConsistent2( const FilterShading* buffer, const float4* prevWorldPos,
 	const float4 localPos, const float allowedDist2, const float3 localNormal, float u, float v, int w, int h,
 	float3& direct, float3& indirect )
 {
@@ -168,10 +239,14 @@ LH2_DEVFUNC void ReadTexelConsistent2( const float4* buffer, const float4* prevW
 	const int iu1 = (int)floor( u ), iv1 = (int)floor( v ), iu0 = max( 0, iu1 - 1 ), iv0 = max( 0, iv1 - 1 );
 	if (iu1 >= w || iv1 >= h || iu1 < 0 || iv1 < 0) return;
 	const float2 fuv = make_float2( u - floor( u ), v - floor( v ) );
-	const float4 p0 = buffer[iu0 + iv0 * w], pp0 = prevWorldPos[iu0 + iv0 * w], pd0 = make_float4( GetDirectFromFloat4( p0 ), 1 ), pi0 = make_float4( GetIndirectFromFloat4( p0 ) );
-	const float4 p1 = buffer[iu1 + iv0 * w], pp1 = prevWorldPos[iu1 + iv0 * w], pd1 = make_float4( GetDirectFromFloat4( p1 ), 1 ), pi1 = make_float4( GetIndirectFromFloat4( p1 ) );
-	const float4 p2 = buffer[iu0 + iv1 * w], pp2 = prevWorldPos[iu0 + iv1 * w], pd2 = make_float4( GetDirectFromFloat4( p2 ), 1 ), pi2 = make_float4( GetIndirectFromFloat4( p2 ) );
-	const float4 p3 = buffer[iu1 + iv1 * w], pp3 = prevWorldPos[iu1 + iv1 * w], pd3 = make_float4( GetDirectFromFloat4( p3 ), 1 ), pi3 = make_float4( GetIndirectFromFloat4( p3 ) );
+	const FilterShading p0 = buffer[iu0 + iv0 * w];
+	const float4 pp0 = prevWorldPos[iu0 + iv0 * w], pd0 = make_float4( ShadingDirect( p0 ), 1 ), pi0 = make_float4( ShadingIndirect( p0 ) );
+	const FilterShading p1 = buffer[iu1 + iv0 * w];
+	const float4 pp1 = prevWorldPos[iu1 + iv0 * w], pd1 = make_float4( ShadingDirect( p1 ), 1 ), pi1 = make_float4( ShadingIndirect( p1 ) );
+	const FilterShading p2 = buffer[iu0 + iv1 * w];
+	const float4 pp2 = prevWorldPos[iu0 + iv1 * w], pd2 = make_float4( ShadingDirect( p2 ), 1 ), pi2 = make_float4( ShadingIndirect( p2 ) );
+	const FilterShading p3 = buffer[iu1 + iv1 * w];
+	const float4 pp3 = prevWorldPos[iu1 + iv1 * w], pd3 = make_float4( ShadingDirect( p3 ), 1 ), pi3 = make_float4( ShadingIndirect( p3 ) );
 	const uint localSpecularity = __float_as_uint( localPos.w ) & 3;
 	float w0 = (1 - fuv.x) * (1 - fuv.y), w1 = fuv.x * (1 - fuv.y), w2 = (1 - fuv.x) * fuv.y, w3 = 1 - (w0 + w1 + w2);
 	{	// scope reduction
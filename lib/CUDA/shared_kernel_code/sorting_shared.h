@@ -0,0 +1,114 @@
+/* sorting_shared.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   THIS IS A SHARED FILE:
+   used in RenderCore_Optix7 and RenderCore_OptixPrime_B.
+
+   Material-coherent path sorting. Before shading, paths are binned on a
+   coarse key: bin 0 holds the paths that left the scene, the other bins
+   hold the paths that hit a material, modulo SORTBINS - 1 (see
+   common_settings.h). This is a counting sort: a key pass builds a
+   histogram, a single block turns it into bin offsets, and a core-specific
+   gather kernel copies the path states to their bins, so that neighbouring
+   shade threads evaluate the same material and textures.
+
+   A core may split the material bins in SORTCLASSES contiguous ranges, one
+   per shade kernel specialization, by defining MaterialShadeClass before
+   including this file. Each class then gets (SORTBINS - 1) / SORTCLASSES
+   bins, and its paths form a single range of the sorted order.
+*/
+
+#include "noerrors.h"
+
+#ifndef SORTCLASSES
+#define SORTCLASSES			1
+#define MaterialShadeClass(m)	0
+#endif
+#define CLASSBINS			((SORTBINS - 1) / SORTCLASSES)	// material bins per shade class
+
+//  +-----------------------------------------------------------------------------+
+//  |  MaterialSortKey                                                            |
+//  |  Sort key for a hit: 0 for a miss, otherwise derived from the material and  |
+//  |  its shade class. Instance descriptors must be in sync.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC uint MaterialSortKey( const int instIdx, const int primIdx )
+{
+	if (primIdx == NOHIT) return 0;
+	const CoreInstanceDesc& desc = instanceDescriptors[instIdx];
+	const uint material = desc.packed ? ((const CoreTriPacked*)desc.triangles)[primIdx].uv.w : __float_as_uint( desc.triangles[primIdx].v4.w );
+	return 1 + MaterialShadeClass( material ) * CLASSBINS + material % CLASSBINS;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  sortKeysKernel                                                             |
+//  |  Stores the sort key for each active path and counts the paths per bin.     |
+//  |  The hit layout differs per core; hits are accessed as ints, with the       |
+//  |  given stride and offsets of the instance and primitive index.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void sortKeysKernel( const int* hits, const int hitStride, const int instOffset, const int primOffset,
+	uint* keys, uint* bins, const uint pathCount )
+{
+	// per-block histogram in shared memory, to keep global atomics low
+	__shared__ uint localBins[SORTBINS];
+	for (int i = threadIdx.x; i < SORTBINS; i += blockDim.x) localBins[i] = 0;
+	__syncthreads();
+	const uint jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
+	if (jobIndex < pathCount && jobIndex < counters->activePaths)
+	{
+		const int* hit = hits + jobIndex * hitStride;
+		const uint key = MaterialSortKey( hit[instOffset], hit[primOffset] );
+		keys[jobIndex] = key;
+		atomicAdd( &localBins[key], 1 );
+	}
+	__syncthreads();
+	for (int i = threadIdx.x; i < SORTBINS; i += blockDim.x) if (localBins[i] > 0) atomicAdd( &bins[i], localBins[i] );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  sortOffsetsKernel                                                          |
+//  |  Exclusive prefix sum over the bin counts; executed by a single block.      |
+//  |  Afterwards, bins[i] is the first sorted index for key i.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void sortOffsetsKernel( uint* bins )
+{
+	__shared__ uint sum[SORTBINS];
+	const int i = threadIdx.x;
+	const uint count = bins[i];
+	sum[i] = count;
+	__syncthreads();
+	for (int offset = 1; offset < SORTBINS; offset <<= 1)
+	{
+		const uint v = i >= offset ? sum[i - offset] : 0;
+		__syncthreads();
+		sum[i] += v;
+		__syncthreads();
+	}
+	bins[i] = sum[i] - count;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  sortPathKeys                                                               |
+//  |  Host-side access point for the key and offset passes. The gather pass is   |
+//  |  implemented by each core, for its own path state layout.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void sortPathKeys( const void* hits, const int hitStride, const int instOffset, const int primOffset,
+	uint* keys, uint* bins, const int pathCount, const cudaStream_t stream )
+{
+	cudaMemsetAsync( bins, 0, SORTBINS * sizeof( uint ), stream );
+	const dim3 gridDim( NEXTMULTIPLEOF( pathCount, 128 ) / 128, 1 ), blockDim( 128, 1 );
+	sortKeysKernel<<<gridDim.x, 128, 0, stream>>>( (const int*)hits, hitStride, instOffset, primOffset, keys, bins, pathCount );
+	sortOffsetsKernel<<<1, SORTBINS, 0, stream>>>( bins );
+}
+
+// EOF
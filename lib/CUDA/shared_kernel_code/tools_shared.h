@@ -57,6 +57,26 @@ struct ShadingData4 { float4 data0, data1; uint4 data2; /* for fast 128-bit acce
 LH2_DEVFUNC __inline__ uint WangHash( uint s ) { s = (s ^ 61) ^ (s >> 16), s *= 9, s = s ^ (s >> 4), s *= 0x27d4eb2d, s = s ^ (s >> 15); return s; }
 LH2_DEVFUNC __inline__ uint RandomInt( uint& s ) { s ^= s << 13, s ^= s >> 17, s ^= s << 5; return s; }
 LH2_DEVFUNC __inline__ float RandomFloat( uint& s ) { return RandomInt( s ) * 2.3283064365387e-10f; }
+// motion blur: one ray time per path and pass, so all segments and connections of a path see the same scene;
+// the shutter closes at time 1, and opens at 1 - shutter
+LH2_DEVFUNC __inline__ float RayTime( const uint pathIdx, const uint pass, const float shutter )
+{
+	uint seed = WangHash( pathIdx * 17 + pass * 0x9e3779b9 ) | 1;
+	return 1 - shutter * RandomFloat( seed );
+}
+
+// warp-aggregated atomic increment, for stream compaction: the first active lane reserves a slot for each active
+// lane with a single atomic, and broadcasts the base; the lanes then take consecutive slots in lane order. The
+// returned indices are the same set as with an atomicAdd per thread, so the counter holds the same total.
+LH2_DEVFUNC uint AtomicAggInc( uint* counter )
+{
+	const uint mask = __activemask();
+	const int lane = threadIdx.x & 31, leader = __ffs( mask ) - 1;
+	uint base = 0;
+	if (lane == leader) base = atomicAdd( counter, __popc( mask ) );
+	base = __shfl_sync( mask, base, leader );
+	return base + __popc( mask & ((1u << lane) - 1) );
+}
 
 // math helpers
 
@@ -115,6 +135,16 @@ LH2_DEVFUNC float3 UnpackNormal2( uint pi )
 	const uint z = pi >> 22u;
 	return make_float3( x * (1.0f / 511.0f) - 1, y * (1.0f / 511.0f) - 1, z * (1.0f / 511.0f) - 1 );
 }
+LH2_DEVFUNC float3 UnpackNormalOct( uint pi )
+{
+	// octahedral encoding, 16 bits per component; see PackNormalOct in rendercore_optix7/core_mesh.cpp.
+	const float x = (pi & 65535u) * (2.0f / 65535.0f) - 1, y = (pi >> 16u) * (2.0f / 65535.0f) - 1;
+	float3 N = make_float3( x, y, 1 - fabs( x ) - fabs( y ) );
+	const float t = max( -N.z, 0.0f );
+	N.x += N.x >= 0 ? -t : t;
+	N.y += N.y >= 0 ? -t : t;
+	return normalize( N );
+}
 
 // color conversions
 
@@ -163,13 +193,28 @@ LH2_DEVFUNC float3 RGB32toHDRmin1( const uint c )
 		(float)max( 1u, c & 2047 ) * (1.0f / 2047.0f) );
 }
 
-LH2_DEVFUNC float4 SampleSkydome( float3 D, const int pathLength )
+//  +-----------------------------------------------------------------------------+
+//  |  SampleSkydome                                                              |
+//  |  Sky color in direction D. The sky is a pyramid of half precision texels,   |
+//  |  see CUDATools::BuildSkyPyramid; the level is the one at which a texel      |
+//  |  spans the ray cone. spread is the cone angle in radians. Connections to    |
+//  |  the sky pass 0: they must see the texels that the importance cdf saw.LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float4 SampleSkydome( float3 D, const int pathLength, const float spread = 0 )
 {
+	// level: log2 of the number of level 0 texels that the cone spans horizontally
+	int w = skywidth, h = skyheight, offset = 0;
+	const float texels = spread * skywidth * INV2PI;
+	const int level = texels > 2 ? min( skyLevels - 1, (int)log2f( texels ) ) : 0;
+	for (int i = 0; i < level; i++) offset += w * h, w = max( 1, w >> 1 ), h = max( 1, h >> 1 );
 	// formulas by Paul Debevec, http://www.pauldebevec.com/Probes
-	uint u = (uint)(skywidth * 0.5f * (1.0f + atan2( D.x, -D.z ) * INVPI));
-	uint v = (uint)(skyheight * acos( D.y ) * INVPI);
-	uint idx = u + v * skywidth;
-	return idx < skywidth * skyheight ? make_float4( skyPixels[idx], 1.0f ) : make_float4( 0 );
+	uint u = (uint)(w * 0.5f * (1.0f + atan2( D.x, -D.z ) * INVPI));
+	uint v = (uint)(h * acos( D.y ) * INVPI);
+	uint idx = u + v * w;
+	if (idx >= w * h) return make_float4( 0 );
+	const uint2 texel = skyPixels[offset + idx];
+	const float2 rg = __half22float2( __halves2half2( __ushort_as_half( texel.x & 0xffff ), __ushort_as_half( texel.x >> 16 ) ) );
+	return make_float4( rg.x, rg.y, __half2float( __ushort_as_half( texel.y & 0xffff ) ), 1.0f );
 }
 
 LH2_DEVFUNC float SurvivalProbability( const float3& diffuse )
@@ -289,6 +334,123 @@ LH2_DEVFUNC float3 GetIndirectFromFloat4( const float4& X )
 	return make_float3( (float)(v2 >> 16) * (1.0f / 2048.0f), (float)(v2 & 65535) * (1.0f / 2048.0f), (float)v3 * (1.0f / 2048.0f) );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  FilterFeature, FilterShading, FilterMoments                                |
+//  |  Per pixel records of the filter in finalize_shared.h. By default, a        |
+//  |  feature is a uint4: RGB32 albedo, PackNormal2 normal, depth, and the       |
+//  |  history size | material << 4; shading is CombineToFloat4 and moments are   |
+//  |  four floats. With PACKEDFILTER, each record is 8 bytes: the feature holds  |
+//  |  a sqrt encoded 8:8:8 albedo, a 2 bit history size and 6 material bits,     |
+//  |  an 8:8 octahedral normal and a half depth; shading is two RGB9E5 colors,   |
+//  |  moments are four halves. Filtering only compares materials for equality,   |
+//  |  so material bits that collide merely fall back to the albedo weight. LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC uint PackRGB9E5( const float3& c )
+{
+	// 9 bit mantissas with a shared 5 bit exponent (bias 15), as in EXT_texture_shared_exponent
+	const float r = clamp( c.x, 0.0f, 65408.0f ), g = clamp( c.y, 0.0f, 65408.0f ), b = clamp( c.z, 0.0f, 65408.0f );
+	const float m = max( 1e-10f, max( r, max( g, b ) ) );
+	int e = max( -16, (int)floorf( log2f( m ) ) ) + 16;
+	float reciScale = __uint_as_float( (151 - e) << 23 ); // 2^(24 - e)
+	if ((uint)(m * reciScale + 0.5f) == 512) reciScale *= 0.5f, e++;
+	return (uint)(r * reciScale + 0.5f) + ((uint)(g * reciScale + 0.5f) << 9) + ((uint)(b * reciScale + 0.5f) << 18) + (e << 27);
+}
+LH2_DEVFUNC float3 UnpackRGB9E5( const uint p )
+{
+	const float scale = __uint_as_float( ((p >> 27) + 103) << 23 ); // 2^(e - 24)
+	return make_float3( (float)(p & 511), (float)((p >> 9) & 511), (float)((p >> 18) & 511) ) * scale;
+}
+LH2_DEVFUNC uint PackHalf2( const float a, const float b )
+{
+	return (uint)__half_as_ushort( __float2half_rn( a ) ) + ((uint)__half_as_ushort( __float2half_rn( b ) ) << 16);
+}
+LH2_DEVFUNC float2 UnpackHalf2( const uint h )
+{
+	return __half22float2( __halves2half2( __ushort_as_half( h & 0xffff ), __ushort_as_half( h >> 16 ) ) );
+}
+LH2_DEVFUNC uint PackNormalOct8( float3 N )
+{
+	// octahedral encoding, 8 bits per component; the fold mirrors UnpackNormalOct
+	N *= 1.0f / (fabs( N.x ) + fabs( N.y ) + fabs( N.z ));
+	if (N.z < 0)
+	{
+		const float x = N.x;
+		N.x = (1 - fabs( N.y )) * (x >= 0 ? 1 : -1);
+		N.y = (1 - fabs( x )) * (N.y >= 0 ? 1 : -1);
+	}
+	const uint x = (uint)((N.x * 0.5f + 0.5f) * 255.0f + 0.5f), y = (uint)((N.y * 0.5f + 0.5f) * 255.0f + 0.5f);
+	return min( x, 255u ) + (min( y, 255u ) << 8);
+}
+LH2_DEVFUNC float3 UnpackNormalOct8( const uint pi )
+{
+	const float x = (pi & 255u) * (2.0f / 255.0f) - 1, y = ((pi >> 8) & 255u) * (2.0f / 255.0f) - 1;
+	float3 N = make_float3( x, y, 1 - fabs( x ) - fabs( y ) );
+	const float t = max( -N.z, 0.0f );
+	N.x += N.x >= 0 ? -t : t;
+	N.y += N.y >= 0 ? -t : t;
+	return normalize( N );
+}
+#ifdef PACKEDFILTER
+typedef uint2 FilterFeature;
+typedef uint2 FilterShading;
+typedef uint2 FilterMoments;
+#define FILTERMAXHISTORY 3
+LH2_DEVFUNC FilterFeature MakeFilterFeature( const float3& albedo, const float3& N, const float depth, const uint matID )
+{
+	const uint r = (uint)(sqrtf( clamp( albedo.x, 0.0f, 1.0f ) ) * 255.0f + 0.5f);
+	const uint g = (uint)(sqrtf( clamp( albedo.y, 0.0f, 1.0f ) ) * 255.0f + 0.5f);
+	const uint b = (uint)(sqrtf( clamp( albedo.z, 0.0f, 1.0f ) ) * 255.0f + 0.5f);
+	return make_uint2( (r << 24) + (g << 16) + (b << 8) + ((matID & 63) << 2), PackNormalOct8( N ) + ((uint)__half_as_ushort( __float2half_rn( depth ) ) << 16) );
+}
+LH2_DEVFUNC float3 FeatureAlbedo( const FilterFeature& f )
+{
+	const float3 s = make_float3( (float)(f.x >> 24), (float)((f.x >> 16) & 255), (float)((f.x >> 8) & 255) ) * (1.0f / 255.0f);
+	return s * s;
+}
+LH2_DEVFUNC float3 FeatureAlbedoMin1( const FilterFeature& f )
+{
+	const float3 s = make_float3( (float)max( 1u, f.x >> 24 ), (float)max( 1u, (f.x >> 16) & 255 ), (float)max( 1u, (f.x >> 8) & 255 ) ) * (1.0f / 255.0f);
+	return s * s;
+}
+LH2_DEVFUNC float3 FeatureNormal( const FilterFeature& f ) { return UnpackNormalOct8( f.y ); }
+LH2_DEVFUNC float FeatureDepth( const FilterFeature& f ) { return __half2float( __ushort_as_half( f.y >> 16 ) ); }
+LH2_DEVFUNC float FeatureDepthSlack( const float depth ) { return depth * (1.0f / 1024.0f); } // rounding of two halves
+LH2_DEVFUNC uint FeatureMatID( const FilterFeature& f ) { return (f.x >> 2) & 63; }
+LH2_DEVFUNC uint FeatureHistory( const FilterFeature& f ) { return f.x & 3; }
+LH2_DEVFUNC void SetFeatureHistory( FilterFeature& f, const uint h ) { f.x = (f.x & 0xfffffffc) + h; }
+LH2_DEVFUNC FilterShading PackShading( const float3& A, const float3& B ) { return make_uint2( PackRGB9E5( A ), PackRGB9E5( B ) ); }
+LH2_DEVFUNC float3 ShadingDirect( const FilterShading& s ) { return UnpackRGB9E5( s.x ); }
+LH2_DEVFUNC float3 ShadingIndirect( const FilterShading& s ) { return UnpackRGB9E5( s.y ); }
+LH2_DEVFUNC FilterMoments PackMoments( const float4& m ) { return make_uint2( PackHalf2( m.x, m.y ), PackHalf2( m.z, m.w ) ); }
+LH2_DEVFUNC float4 UnpackMoments( const FilterMoments& m )
+{
+	const float2 a = UnpackHalf2( m.x ), b = UnpackHalf2( m.y );
+	return make_float4( a.x, a.y, b.x, b.y );
+}
+#else
+typedef uint4 FilterFeature;
+typedef float4 FilterShading;
+typedef float4 FilterMoments;
+#define FILTERMAXHISTORY 15
+LH2_DEVFUNC FilterFeature MakeFilterFeature( const float3& albedo, const float3& N, const float depth, const uint matID )
+{
+	return make_uint4( HDRtoRGB32( albedo ), PackNormal2( N ), __float_as_uint( depth ), matID << 4 );
+}
+LH2_DEVFUNC float3 FeatureAlbedo( const FilterFeature& f ) { return RGB32toHDR( f.x ); }
+LH2_DEVFUNC float3 FeatureAlbedoMin1( const FilterFeature& f ) { return RGB32toHDRmin1( f.x ); }
+LH2_DEVFUNC float3 FeatureNormal( const FilterFeature& f ) { return UnpackNormal2( f.y ); }
+LH2_DEVFUNC float FeatureDepth( const FilterFeature& f ) { return __uint_as_float( f.z ); }
+LH2_DEVFUNC float FeatureDepthSlack( const float depth ) { return 0; }
+LH2_DEVFUNC uint FeatureMatID( const FilterFeature& f ) { return f.w >> 4; }
+LH2_DEVFUNC uint FeatureHistory( const FilterFeature& f ) { return f.w & 15; }
+LH2_DEVFUNC void SetFeatureHistory( FilterFeature& f, const uint h ) { f.w = (f.w & 0xfffffff0) + h; }
+LH2_DEVFUNC FilterShading PackShading( const float3& A, const float3& B ) { return CombineToFloat4( A, B ); }
+LH2_DEVFUNC float3 ShadingDirect( const FilterShading& s ) { return GetDirectFromFloat4( s ); }
+LH2_DEVFUNC float3 ShadingIndirect( const FilterShading& s ) { return GetIndirectFromFloat4( s ); }
+LH2_DEVFUNC FilterMoments PackMoments( const float4& m ) { return m; }
+LH2_DEVFUNC float4 UnpackMoments( const FilterMoments& m ) { return m; }
+#endif
+
 LH2_DEVFUNC float blueNoiseSampler( const uint* blueNoise, int x, int y, int sampleIndex, int sampleDimension )
 {
 	// wrap arguments
@@ -307,4 +469,34 @@ LH2_DEVFUNC float blueNoiseSampler( const uint* blueNoise, int x, int y, int sam
 	return (0.5f + value) * (1.0f / 256.0f);
 }
 
+// Owen-scrambled Sobol, after Burley, "Practical Hash-based Owen Scrambling", JCGT 2020. The sequence is
+// generated on the fly: dimensions 0 and 1 of Sobol need no direction number tables. Dimensions are padded
+// in pairs; each pair uses its own shuffle of the sample index, and each dimension its own scramble.
+LH2_DEVFUNC uint LaineKarrasPermutation( uint x, const uint seed )
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu, x ^= x * 0xb82f1e52u, x ^= x * 0xc7afe638u, x ^= x * 0x8d22f6e6u;
+	return x;
+}
+LH2_DEVFUNC uint NestedUniformScramble( const uint x, const uint seed ) { return __brev( LaineKarrasPermutation( __brev( x ), seed ) ); }
+LH2_DEVFUNC uint Sobol1( uint index )
+{
+	// second Sobol dimension: direction numbers follow v[i] = v[i-1] ^ (v[i-1] >> 1)
+	uint result = 0;
+	for (uint v = 1u << 31; index; index >>= 1, v ^= v >> 1) if (index & 1) result ^= v;
+	return result;
+}
+LH2_DEVFUNC float SobolOwenSampler( const int x, const int y, const uint sampleIndex, const uint sampleDimension )
+{
+	// one sequence for all pixels, decorrelated per pixel by a toroidal shift. The shifts follow the R2 sequence
+	// over the screen, so neighbouring pixels receive well separated shifts: their errors differ, in a blue noise
+	// like pattern, without the ranking and scrambling tables that blueNoiseSampler reads.
+	const uint pair = sampleDimension >> 1;
+	const uint index = NestedUniformScramble( sampleIndex, WangHash( pair * 0x9e3779b9u + 0x68bc21ebu ) );
+	const uint value = NestedUniformScramble( (sampleDimension & 1) ? Sobol1( index ) : __brev( index ), WangHash( sampleDimension * 0x85ebca6bu + 0x02e5be93u ) );
+	const float shift = x * 0.7548776662f + y * 0.5698402910f + sampleDimension * 0.6180339887f;
+	const float r = (value >> 8) * (1.0f / 16777216.0f) + shift;
+	return r - floorf( r );
+}
+
 // EOF
\ No newline at end of file
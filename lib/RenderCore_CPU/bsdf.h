@@ -0,0 +1,101 @@
+/* bsdf.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   The shared BSDF code expects a ShadingData struct, its parameter
+   macros and a few sampling helpers from the core that includes it.
+   This file provides host versions of these, matching the ones in
+   CUDA/shared_kernel_code/tools_shared.h, so the CPU core evaluates
+   the same BSDF as the GPU cores.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+#define CHAR2FLT(a,s) (((float)(((a)>>s)&255))*(1.0f/255.0f))
+
+struct ShadingData
+{
+	// This structure is filled for an intersection point. It will contain the spatially varying material properties.
+	float3 color; int flags;
+	float3 absorption; int matID;
+	uint4 parameters;
+	/* 16 uchars:   x: roughness, metallic, specTrans, specularTint;
+					y: diffTrans, anisotropic, sheen, sheenTint;
+					z: clearcoat, clearcoatGloss, scatterDistance, relativeIOR;
+					w: flatness, ior, dummy1, dummy2. */
+	bool IsEmissive() const { return color.x > 1.0f || color.y > 1.0f || color.z > 1.0f; }
+#define METALLIC CHAR2FLT( shadingData.parameters.x, 0 )
+#define SUBSURFACE CHAR2FLT( shadingData.parameters.x, 8 )
+#define SPECULAR CHAR2FLT( shadingData.parameters.x, 16 )
+#define ROUGHNESS (max( 0.001f, CHAR2FLT( shadingData.parameters.x, 24 ) ))
+#define SPECTINT CHAR2FLT( shadingData.parameters.y, 0 )
+#define ANISOTROPIC CHAR2FLT( shadingData.parameters.y, 8 )
+#define SHEEN CHAR2FLT( shadingData.parameters.y, 16 )
+#define SHEENTINT CHAR2FLT( shadingData.parameters.y, 24 )
+#define CLEARCOAT CHAR2FLT( shadingData.parameters.z, 0 )
+#define CLEARCOATGLOSS CHAR2FLT( shadingData.parameters.z, 8 )
+#define TRANSMISSION CHAR2FLT( shadingData.parameters.z, 16 )
+#define ETA CHAR2FLT( shadingData.parameters.z, 24 )
+};
+
+// sampling helpers used by the shared BSDF code
+
+static inline float3 Tangent2World( const float3& V, const float3& N )
+{
+	// "Building an Orthonormal Basis, Revisited"
+	const float sign = copysignf( 1.0f, N.z );
+	const float a = -1.0f / (sign + N.z);
+	const float b = N.x * N.y * a;
+	const float3 B = make_float3( 1.0f + sign * N.x * N.x * a, sign * b, -sign * N.x );
+	const float3 T = make_float3( b, sign + N.y * N.y * a, -N.y );
+	return V.x * T + V.y * B + V.z * N;
+}
+
+static inline float3 DiffuseReflectionUniform( const float r0, const float r1 )
+{
+	const float term1 = TWOPI * r0, term2 = sqrtf( 1 - r1 * r1 );
+	return make_float3( cosf( term1 ) * term2, sinf( term1 ) * term2, r1 );
+}
+
+static inline float3 DiffuseReflectionCosWeighted( const float r0, const float r1 )
+{
+	const float term1 = TWOPI * r0, term2 = sqrtf( 1 - r1 );
+	return make_float3( cosf( term1 ) * term2, sinf( term1 ) * term2, sqrtf( r1 ) );
+}
+
+// multiscatter energy compensation: bilinear lookup in the directional albedo table,
+// matching the texture the GPU cores sample
+#ifdef GGXCOMPENSATION
+#include "ggx_albedo.h"
+static inline float GGXAlbedoBilinear( const float cosTheta, const float alpha )
+{
+	const float u = clamp( cosTheta * GGXALBEDORES - 0.5f, 0.0f, GGXALBEDORES - 1.0f );
+	const float v = clamp( alpha * GGXALBEDORES - 0.5f, 0.0f, GGXALBEDORES - 1.0f );
+	const int u0 = min( (int)u, GGXALBEDORES - 2 ), v0 = min( (int)v, GGXALBEDORES - 2 );
+	const float fu = u - u0, fv = v - v0;
+	const float* t = ggxAlbedoTable + u0 + v0 * GGXALBEDORES;
+	return (t[0] * (1 - fu) + t[1] * fu) * (1 - fv) + (t[GGXALBEDORES] * (1 - fu) + t[GGXALBEDORES + 1] * fu) * fv;
+}
+#define GGXALBEDO( cosTheta, alpha ) GGXAlbedoBilinear( cosTheta, alpha )
+#endif
+
+// forward to Meir's API-agnostic sharedBRDFs folder; host functions instead of device functions.
+#define LH2_DEVFUNC static inline
+#include "sharedbsdf.h"
+
+} // namespace lh2core
+
+// EOF
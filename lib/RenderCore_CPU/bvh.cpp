@@ -0,0 +1,192 @@
+/* bvh.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVH4::Build                                                                |
+//  |  Builds a binary tree over the primitive bounds using the binned SAH, and   |
+//  |  collapses it to the four-wide tree.                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BVH4::Build( const aabb* bounds, const int count )
+{
+	nodeCount = 0;
+	rootBounds.Reset();
+	primIdx.resize( count );
+	if (count == 0) return;
+	vector<float3> centroids( count );
+	for (int i = 0; i < count; i++)
+	{
+		primIdx[i] = i;
+		centroids[i] = (bounds[i].bmin3 + bounds[i].bmax3) * 0.5f;
+		rootBounds.Grow( bounds[i] );
+	}
+	// binary tree; a tree over n primitives has at most 2n - 1 nodes, so references into it remain valid
+	buildNodes.clear();
+	buildNodes.reserve( 2 * count );
+	BuildNode root;
+	root.bounds = rootBounds, root.left = -1, root.first = 0, root.count = count;
+	buildNodes.push_back( root );
+	Subdivide( 0, bounds, centroids.data() );
+	// every four-wide node replaces at least one interior node of the binary tree
+	const int required = max( 1, ((int)buildNodes.size() - 1) / 2 );
+	if (required > maxNodes)
+	{
+		FREE64( nodes );
+		nodes = (BVHNode4*)MALLOC64( required * sizeof( BVHNode4 ) );
+		maxNodes = required;
+	}
+	nodeCount = 1;
+	if (buildNodes[0].left >= 0) Collapse( 0, 0 ); else
+	{
+		// a single leaf: the root gets one child
+		BVHNode4& node = nodes[0];
+		for (int i = 0; i < 4; i++)
+		{
+			node.bminx[i] = node.bmaxx[i] = node.bminy[i] = node.bmaxy[i] = node.bminz[i] = node.bmaxz[i] = 1e30f;
+			node.child[i] = 0, node.count[i] = -1;
+		}
+		node.bminx[0] = rootBounds.bmin[0], node.bminy[0] = rootBounds.bmin[1], node.bminz[0] = rootBounds.bmin[2];
+		node.bmaxx[0] = rootBounds.bmax[0], node.bmaxy[0] = rootBounds.bmax[1], node.bmaxz[0] = rootBounds.bmax[2];
+		node.child[0] = 0, node.count[0] = count;
+	}
+	vector<BuildNode>().swap( buildNodes );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVH4::Subdivide                                                            |
+//  |  Splits a node of the binary tree at the best of BVHBINS - 1 planes per     |
+//  |  axis. Nodes with more than BVHLEAFSIZE primitives are always split; if all |
+//  |  centroids coincide, the primitives are divided in two halves.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BVH4::Subdivide( const int nodeIdx, const aabb* bounds, const float3* centroids )
+{
+	BuildNode& node = buildNodes[nodeIdx];
+	if (node.count < 2) return;
+	aabb centroidBounds;
+	centroidBounds.Reset();
+	for (int i = 0; i < node.count; i++) centroidBounds.Grow( centroids[primIdx[node.first + i]] );
+	// evaluate the SAH for the planes between the bins; a split costs one traversal step
+	const float leafCost = node.count;
+	float bestCost = 1e34f, bestScale = 0;
+	int bestAxis = -1, bestSplit = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = centroidBounds.Extend( axis );
+		if (extent <= 0) continue;
+		aabb binBounds[BVHBINS];
+		int binCount[BVHBINS] = {};
+		for (int i = 0; i < BVHBINS; i++) binBounds[i].Reset();
+		const float scale = BVHBINS / extent, origin = centroidBounds.bmin[axis];
+		for (int i = 0; i < node.count; i++)
+		{
+			const uint p = primIdx[node.first + i];
+			const int bin = min( BVHBINS - 1, (int)((((const float*)&centroids[p])[axis] - origin) * scale) );
+			binCount[bin]++, binBounds[bin].Grow( bounds[p] );
+		}
+		float leftArea[BVHBINS - 1], rightArea[BVHBINS - 1];
+		int leftCount[BVHBINS - 1], rightCount[BVHBINS - 1];
+		aabb leftBox, rightBox;
+		leftBox.Reset(), rightBox.Reset();
+		int leftSum = 0, rightSum = 0;
+		for (int i = 0; i < BVHBINS - 1; i++)
+		{
+			leftSum += binCount[i], leftCount[i] = leftSum, leftBox.Grow( binBounds[i] ), leftArea[i] = leftBox.Area();
+			rightSum += binCount[BVHBINS - 1 - i], rightCount[BVHBINS - 2 - i] = rightSum;
+			rightBox.Grow( binBounds[BVHBINS - 1 - i] ), rightArea[BVHBINS - 2 - i] = rightBox.Area();
+		}
+		const float invArea = 1.0f / max( 1e-20f, node.bounds.Area() );
+		for (int i = 0; i < BVHBINS - 1; i++)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+			const float cost = 1 + (leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i]) * invArea;
+			if (cost < bestCost) bestCost = cost, bestAxis = axis, bestSplit = i, bestScale = scale;
+		}
+	}
+	if (bestCost >= leafCost && node.count <= BVHLEAFSIZE) return;
+	// partition the primitive indices
+	int i = node.first, j = node.first + node.count - 1;
+	if (bestAxis >= 0)
+	{
+		const float origin = centroidBounds.bmin[bestAxis];
+		while (i <= j)
+		{
+			const int bin = min( BVHBINS - 1, (int)((((const float*)&centroids[primIdx[i]])[bestAxis] - origin) * bestScale) );
+			if (bin <= bestSplit) i++; else swap( primIdx[i], primIdx[j--] );
+		}
+	}
+	else i = node.first + node.count / 2; // coinciding centroids: any division is as good as another
+	const int leftCount = i - node.first;
+	if (leftCount == 0 || leftCount == node.count) return;
+	// create the children
+	const int left = (int)buildNodes.size();
+	for (int k = 0; k < 2; k++)
+	{
+		BuildNode child;
+		child.left = -1;
+		child.first = k == 0 ? node.first : i;
+		child.count = k == 0 ? leftCount : (node.count - leftCount);
+		child.bounds.Reset();
+		for (int p = 0; p < child.count; p++) child.bounds.Grow( bounds[primIdx[child.first + p]] );
+		buildNodes.push_back( child );
+	}
+	node.left = left;
+	Subdivide( left, bounds, centroids );
+	Subdivide( left + 1, bounds, centroids );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVH4::Collapse                                                             |
+//  |  Fills a four-wide node with the children of an interior node of the binary |
+//  |  tree: the child with the largest surface area is replaced by its own       |
+//  |  children until there are four, or until all are leaves.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void BVH4::Collapse( const int node2Idx, const int node4Idx )
+{
+	int children[4] = { buildNodes[node2Idx].left, buildNodes[node2Idx].left + 1 }, n = 2;
+	while (n < 4)
+	{
+		int best = -1;
+		float bestArea = -1;
+		for (int i = 0; i < n; i++)
+		{
+			const BuildNode& c = buildNodes[children[i]];
+			if (c.left >= 0 && c.bounds.Area() > bestArea) best = i, bestArea = c.bounds.Area();
+		}
+		if (best < 0) break;
+		const int left = buildNodes[children[best]].left;
+		children[best] = left, children[n++] = left + 1;
+	}
+	BVHNode4& node = nodes[node4Idx];
+	for (int i = 0; i < 4; i++)
+	{
+		if (i < n)
+		{
+			const BuildNode& c = buildNodes[children[i]];
+			node.bminx[i] = c.bounds.bmin[0], node.bminy[i] = c.bounds.bmin[1], node.bminz[i] = c.bounds.bmin[2];
+			node.bmaxx[i] = c.bounds.bmax[0], node.bmaxy[i] = c.bounds.bmax[1], node.bmaxz[i] = c.bounds.bmax[2];
+			if (c.left < 0) node.child[i] = c.first, node.count[i] = c.count;
+			else node.child[i] = nodeCount++, node.count[i] = 0;
+		}
+		else
+		{
+			node.bminx[i] = node.bmaxx[i] = node.bminy[i] = node.bmaxy[i] = node.bminz[i] = node.bmaxz[i] = 1e30f;
+			node.child[i] = 0, node.count[i] = -1;
+		}
+	}
+	for (int i = 0; i < n; i++) if (node.count[i] == 0) Collapse( children[i], node.child[i] );
+}
+
+// EOF
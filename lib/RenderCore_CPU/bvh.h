@@ -0,0 +1,259 @@
+/* bvh.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements the acceleration structure of the CPU core: a
+   four-wide bvh, built by collapsing a binary bvh that was built using
+   the binned surface area heuristic. A node stores the bounds of its
+   four children in SoA form, so a single ray tests all four with a few
+   SSE instructions. Packets of four coherent rays (2x2 primary rays)
+   test one child at a time, for all four rays at once. The same tree
+   is used for the triangles of a mesh and for the instances of the
+   scene; the leaves are intersected by a functor, see CoreMesh and
+   RenderCore::Intersect.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+//  +-----------------------------------------------------------------------------+
+//  |  Ray                                                                        |
+//  |  A single ray, and its nearest hit so far.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct Ray
+{
+	Ray() = default;
+	Ray( const float3& origin, const float3& direction, const float tmax = 1e34f ) : O( origin ), D( direction ), t( tmax )
+	{
+		// avoid infinities in the reciprocal direction; slab tests with 0 * inf produce nans
+		rD = make_float3( 1.0f / (fabs( D.x ) > 1e-12f ? D.x : copysignf( 1e-12f, D.x )),
+			1.0f / (fabs( D.y ) > 1e-12f ? D.y : copysignf( 1e-12f, D.y )),
+			1.0f / (fabs( D.z ) > 1e-12f ? D.z : copysignf( 1e-12f, D.z )) );
+	}
+	float3 O, D, rD;						// origin, direction and reciprocal direction
+	float t = 1e34f;						// distance of the nearest hit, or the maximum distance
+	float u = 0, v = 0;						// barycentrics of the nearest hit
+	int instIdx = -1, primIdx = -1;			// instance and triangle of the nearest hit; -1 for a miss
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  RayPacket4                                                                 |
+//  |  Four rays in SoA form, for coherent rays that traverse the bvh together.   |
+//  |  Hit data is stored per ray, as in Ray.                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+__declspec(align(16)) struct RayPacket4
+{
+	void Set( const int lane, const Ray& ray )
+	{
+		Ox[lane] = ray.O.x, Oy[lane] = ray.O.y, Oz[lane] = ray.O.z;
+		Dx[lane] = ray.D.x, Dy[lane] = ray.D.y, Dz[lane] = ray.D.z;
+		rDx[lane] = ray.rD.x, rDy[lane] = ray.rD.y, rDz[lane] = ray.rD.z;
+		t[lane] = ray.t, u[lane] = v[lane] = 0, instIdx[lane] = primIdx[lane] = -1;
+	}
+	union { __m128 Ox4; float Ox[4]; };
+	union { __m128 Oy4; float Oy[4]; };
+	union { __m128 Oz4; float Oz[4]; };
+	union { __m128 Dx4; float Dx[4]; };
+	union { __m128 Dy4; float Dy[4]; };
+	union { __m128 Dz4; float Dz[4]; };
+	union { __m128 rDx4; float rDx[4]; };
+	union { __m128 rDy4; float rDy[4]; };
+	union { __m128 rDz4; float rDz[4]; };
+	union { __m128 t4; float t[4]; };
+	union { __m128 u4; float u[4]; };
+	union { __m128 v4; float v[4]; };
+	int instIdx[4], primIdx[4];
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVHNode4                                                                   |
+//  |  Node of the four-wide bvh: the bounds of its children in SoA form, and per |
+//  |  child the index of its node (count 0) or of its first primitive in         |
+//  |  BVH4::primIdx (count > 0). Unused slots have count -1 and a point as       |
+//  |  bounds, far outside the scene. 128 bytes.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct BVHNode4
+{
+	union { __m128 bminx4; float bminx[4]; };
+	union { __m128 bmaxx4; float bmaxx[4]; };
+	union { __m128 bminy4; float bminy[4]; };
+	union { __m128 bmaxy4; float bmaxy[4]; };
+	union { __m128 bminz4; float bminz[4]; };
+	union { __m128 bmaxz4; float bmaxz[4]; };
+	int child[4], count[4];
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVH4                                                                       |
+//  |  Four-wide bvh over a set of primitives, of which only the bounds are       |
+//  |  known. Traverse and Traverse4 call the supplied functor for the leaves     |
+//  |  that a ray or a packet visits:                                             |
+//  |  - bool intersect( Ray& ray, const uint* prims, const int count ): update   |
+//  |    the hit in ray and return true if any primitive was hit;                 |
+//  |  - void intersect( RayPacket4& packet, const uint* prims, const int count,  |
+//  |    const int laneMask ): the same, for the lanes set in laneMask.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+class BVH4
+{
+public:
+	BVH4() = default;
+	~BVH4() { FREE64( nodes ); }
+	BVH4( const BVH4& ) = delete;
+	BVH4& operator=( const BVH4& ) = delete;
+	void Build( const aabb* bounds, const int count );
+	aabb Bounds() const { return rootBounds; }
+	// single ray; with anyHit, traversal stops at the first leaf that reports a hit
+	template <bool anyHit, class T> bool Traverse( Ray& ray, const T& intersect ) const;
+	// four rays; lanes not in laneMask are ignored
+	template <class T> void Traverse4( RayPacket4& packet, const T& intersect, const int laneMask = 15 ) const;
+	// data members
+	BVHNode4* nodes = 0;					// node 0 is the root
+	int nodeCount = 0;						// nodes in use
+	vector<uint> primIdx;					// primitive indices, referenced by the leaves
+private:
+	struct BuildNode { aabb bounds; int left, first, count; };	// node of the binary tree; left is -1 for leaves
+	void Subdivide( const int nodeIdx, const aabb* bounds, const float3* centroids );
+	void Collapse( const int node2Idx, const int node4Idx );
+	vector<BuildNode> buildNodes;			// binary tree, during Build
+	int maxNodes = 0;						// capacity of nodes
+	aabb rootBounds;						// bounds of all primitives
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVH4::Traverse                                                             |
+//  |  Closest hit (or any hit) traversal for a single ray. The four children of  |
+//  |  a node are tested at once; the children that are hit are pushed far to     |
+//  |  near, so the nearest one is visited first.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <bool anyHit, class T> bool BVH4::Traverse( Ray& ray, const T& intersect ) const
+{
+	if (nodeCount == 0) return false;
+	struct { int idx, count; float tmin; } stack[BVHSTACKSIZE];
+	const __m128 Ox4 = _mm_set1_ps( ray.O.x ), Oy4 = _mm_set1_ps( ray.O.y ), Oz4 = _mm_set1_ps( ray.O.z );
+	const __m128 rDx4 = _mm_set1_ps( ray.rD.x ), rDy4 = _mm_set1_ps( ray.rD.y ), rDz4 = _mm_set1_ps( ray.rD.z );
+	const __m128 zero4 = _mm_setzero_ps();
+	bool hit = false;
+	int stackPtr = 0, idx = 0, count = 0;
+	while (1)
+	{
+		if (count > 0)
+		{
+			// leaf
+			if (intersect( ray, primIdx.data() + idx, count ))
+			{
+				hit = true;
+				if (anyHit) return true;
+			}
+		}
+		else
+		{
+			// interior node: slab test for the four children
+			const BVHNode4& node = nodes[idx];
+			const __m128 t4 = _mm_set1_ps( ray.t );
+			const __m128 tx1 = _mm_mul_ps( _mm_sub_ps( node.bminx4, Ox4 ), rDx4 ), tx2 = _mm_mul_ps( _mm_sub_ps( node.bmaxx4, Ox4 ), rDx4 );
+			const __m128 ty1 = _mm_mul_ps( _mm_sub_ps( node.bminy4, Oy4 ), rDy4 ), ty2 = _mm_mul_ps( _mm_sub_ps( node.bmaxy4, Oy4 ), rDy4 );
+			const __m128 tz1 = _mm_mul_ps( _mm_sub_ps( node.bminz4, Oz4 ), rDz4 ), tz2 = _mm_mul_ps( _mm_sub_ps( node.bmaxz4, Oz4 ), rDz4 );
+			union { __m128 tmin4; float tmin[4]; };
+			tmin4 = _mm_max_ps( _mm_max_ps( _mm_min_ps( tx1, tx2 ), _mm_min_ps( ty1, ty2 ) ), _mm_max_ps( _mm_min_ps( tz1, tz2 ), zero4 ) );
+			const __m128 tmax4 = _mm_min_ps( _mm_min_ps( _mm_max_ps( tx1, tx2 ), _mm_max_ps( ty1, ty2 ) ), _mm_min_ps( _mm_max_ps( tz1, tz2 ), t4 ) );
+			int mask = _mm_movemask_ps( _mm_cmple_ps( tmin4, tmax4 ) );
+			// push the children that were hit, far to near
+			int order[4], hits = 0;
+			for (int c = 0; c < 4; c++) if ((mask & (1 << c)) && node.count[c] >= 0)
+			{
+				int i = hits++;
+				while (i > 0 && tmin[order[i - 1]] < tmin[c]) order[i] = order[i - 1], i--;
+				order[i] = c;
+			}
+			for (int i = 0; i < hits; i++)
+			{
+				const int c = order[i];
+				stack[stackPtr].idx = node.child[c], stack[stackPtr].count = node.count[c], stack[stackPtr++].tmin = tmin[c];
+			}
+		}
+		// pop the nearest entry that is not beyond the nearest hit
+		do
+		{
+			if (stackPtr == 0) return hit;
+			stackPtr--;
+		} while (stack[stackPtr].tmin > ray.t);
+		idx = stack[stackPtr].idx, count = stack[stackPtr].count;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BVH4::Traverse4                                                            |
+//  |  Closest hit traversal for a packet of four rays. A child is visited if it  |
+//  |  is hit by any of the active rays, which are tested at once; the leaf       |
+//  |  functor receives the mask of the rays that hit the leaf.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <class T> void BVH4::Traverse4( RayPacket4& packet, const T& intersect, const int laneMask ) const
+{
+	if (nodeCount == 0 || laneMask == 0) return;
+	struct { int idx, count, mask; float tmin; } stack[BVHSTACKSIZE];
+	const __m128 zero4 = _mm_setzero_ps();
+	int stackPtr = 0, idx = 0, count = 0, mask = laneMask;
+	while (1)
+	{
+		if (count > 0) intersect( packet, primIdx.data() + idx, count, mask );
+		else
+		{
+			const BVHNode4& node = nodes[idx];
+			int order[4], masks[4], hits = 0;
+			float dist[4];
+			for (int c = 0; c < 4; c++) if (node.count[c] >= 0)
+			{
+				// slab test of child c for the four rays
+				const __m128 tx1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.bminx[c] ), packet.Ox4 ), packet.rDx4 );
+				const __m128 tx2 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.bmaxx[c] ), packet.Ox4 ), packet.rDx4 );
+				const __m128 ty1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.bminy[c] ), packet.Oy4 ), packet.rDy4 );
+				const __m128 ty2 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.bmaxy[c] ), packet.Oy4 ), packet.rDy4 );
+				const __m128 tz1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.bminz[c] ), packet.Oz4 ), packet.rDz4 );
+				const __m128 tz2 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.bmaxz[c] ), packet.Oz4 ), packet.rDz4 );
+				union { __m128 tmin4; float tmin[4]; };
+				tmin4 = _mm_max_ps( _mm_max_ps( _mm_min_ps( tx1, tx2 ), _mm_min_ps( ty1, ty2 ) ), _mm_max_ps( _mm_min_ps( tz1, tz2 ), zero4 ) );
+				const __m128 tmax4 = _mm_min_ps( _mm_min_ps( _mm_max_ps( tx1, tx2 ), _mm_max_ps( ty1, ty2 ) ), _mm_min_ps( _mm_max_ps( tz1, tz2 ), packet.t4 ) );
+				const int childMask = _mm_movemask_ps( _mm_cmple_ps( tmin4, tmax4 ) ) & mask;
+				if (!childMask) continue;
+				// order by the nearest entry distance of the rays that hit the child
+				float d = 1e34f;
+				for (int lane = 0; lane < 4; lane++) if (childMask & (1 << lane)) d = min( d, tmin[lane] );
+				int i = hits++;
+				while (i > 0 && dist[i - 1] < d) order[i] = order[i - 1], masks[i] = masks[i - 1], dist[i] = dist[i - 1], i--;
+				order[i] = c, masks[i] = childMask, dist[i] = d;
+			}
+			for (int i = 0; i < hits; i++)
+			{
+				const int c = order[i];
+				stack[stackPtr].idx = node.child[c], stack[stackPtr].count = node.count[c];
+				stack[stackPtr].mask = masks[i], stack[stackPtr++].tmin = dist[i];
+			}
+		}
+		// pop the nearest entry that is not beyond the nearest hits of its rays
+		while (1)
+		{
+			if (stackPtr == 0) return;
+			stackPtr--;
+			int alive = 0;
+			for (int lane = 0; lane < 4; lane++) if (packet.t[lane] >= stack[stackPtr].tmin) alive |= 1 << lane;
+			if (alive & stack[stackPtr].mask) break;
+		}
+		idx = stack[stackPtr].idx, count = stack[stackPtr].count, mask = stack[stackPtr].mask;
+	}
+}
+
+} // namespace lh2core
+
+// EOF
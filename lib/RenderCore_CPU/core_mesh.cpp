@@ -0,0 +1,206 @@
+/* core_mesh.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+RenderCore* CoreMesh::renderCore = 0;
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::SetGeometry                                                      |
+//  |  Set the geometry data and build the bvh.                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphas )
+{
+	assert( vertexCount == triCount * 3 );
+	vector<float4>().swap( spheres );
+	triangles.assign( tris, tris + triCount );
+	accel.resize( triCount );
+	vector<aabb> bounds( triCount );
+	for (int i = 0; i < triCount; i++)
+	{
+		const float3 v0 = make_float3( vertexData[i * 3 + 0] );
+		const float3 v1 = make_float3( vertexData[i * 3 + 1] );
+		const float3 v2 = make_float3( vertexData[i * 3 + 2] );
+		accel[i].v0 = v0, accel[i].e1 = v1 - v0, accel[i].e2 = v2 - v0;
+		bounds[i].Reset();
+		bounds[i].Grow( v0 ), bounds[i].Grow( v1 ), bounds[i].Grow( v2 );
+	}
+	// keep the alpha flags only if they are needed, so regular meshes skip the test altogether
+	alphaFlags.clear();
+	if (alphas) for (int i = 0; i < triCount; i++) if (alphas[i])
+	{
+		alphaFlags.assign( alphas, alphas + triCount );
+		break;
+	}
+	bvh.Build( bounds.data(), triCount );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::SetParticles                                                     |
+//  |  Set the spheres of a point cloud, and build the bvh over them. The mesh    |
+//  |  no longer has triangles; hits report the sphere index as primIdx.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::SetParticles( const float4* sphereData, const int count, const int material )
+{
+	vector<CoreTri>().swap( triangles ), vector<TriAccel>().swap( accel ), alphaFlags.clear();
+	spheres.assign( sphereData, sphereData + count );
+	sphereMaterial = material;
+	vector<aabb> bounds( count );
+	for (int i = 0; i < count; i++)
+	{
+		const float3 C = make_float3( spheres[i] ), R = make_float3( spheres[i].w );
+		bounds[i] = aabb( C - R, C + R );
+	}
+	bvh.Build( bounds.data(), count );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::IntersectSphere                                                  |
+//  |  Nearest positive distance along D at which a ray enters sphere idx, or     |
+//  |  leaves it, for rays that start inside. D need not be normalized.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool CoreMesh::IntersectSphere( const uint idx, const float3& O, const float3& D, float& t ) const
+{
+	const float3 C = make_float3( spheres[idx] ), OC = O - C;
+	const float r = spheres[idx].w;
+	const float a = dot( D, D ), b = dot( OC, D ), c = dot( OC, OC ) - r * r;
+	const float disc = b * b - a * c;
+	if (disc < 0) return false;
+	const float root = sqrtf( disc );
+	t = (-b - root) / a;
+	if (t <= 1e-5f * r) t = (-b + root) / a;
+	return t > 1e-5f * r;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::AlphaHit                                                         |
+//  |  Alpha test for a hit on an alpha mapped triangle.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool CoreMesh::AlphaHit( const uint triIdx, const float u, const float v ) const
+{
+	return !renderCore->IsTransparent( triangles[triIdx], u, v );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::Intersect                                                        |
+//  |  Intersect a ray with the triangles of a bvh leaf.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool CoreMesh::Intersect( Ray& ray, const uint* prims, const int count ) const
+{
+	bool hit = false;
+	if (!spheres.empty())
+	{
+		for (int i = 0; i < count; i++)
+		{
+			float t;
+			if (IntersectSphere( prims[i], ray.O, ray.D, t ) && t < ray.t) ray.t = t, ray.u = ray.v = 0, ray.primIdx = prims[i], hit = true;
+		}
+		return hit;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		const uint idx = prims[i];
+		if (!alphaFlags.empty() && alphaFlags[idx] == ALPHA_TRANSPARENT) continue; // baked: transparent everywhere
+		const TriAccel& tri = accel[idx];
+		const float3 h = cross( ray.D, tri.e2 );
+		const float a = dot( tri.e1, h );
+		if (fabs( a ) < 1e-12f) continue; // ray parallel to triangle
+		const float f = 1 / a;
+		const float3 s = ray.O - tri.v0;
+		const float u = f * dot( s, h );
+		if (u < 0 || u > 1) continue;
+		const float3 q = cross( s, tri.e1 );
+		const float v = f * dot( ray.D, q );
+		if (v < 0 || u + v > 1) continue;
+		const float t = f * dot( tri.e2, q );
+		if (t <= 0 || t >= ray.t) continue;
+		if (!alphaFlags.empty() && alphaFlags[idx] && !AlphaHit( idx, u, v )) continue;
+		ray.t = t, ray.u = u, ray.v = v, ray.primIdx = idx, hit = true;
+	}
+	return hit;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::Intersect4                                                       |
+//  |  Intersect the rays of a packet in laneMask with the triangles of a bvh     |
+//  |  leaf. Each triangle is tested against the four rays at once.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::Intersect4( RayPacket4& packet, const uint* prims, const int count, const int laneMask ) const
+{
+	if (!spheres.empty())
+	{
+		// spheres are tested per lane
+		for (int lane = 0; lane < 4; lane++) if (laneMask & (1 << lane))
+		{
+			const float3 O = make_float3( packet.Ox[lane], packet.Oy[lane], packet.Oz[lane] );
+			const float3 D = make_float3( packet.Dx[lane], packet.Dy[lane], packet.Dz[lane] );
+			for (int i = 0; i < count; i++)
+			{
+				float t;
+				if (IntersectSphere( prims[i], O, D, t ) && t < packet.t[lane])
+					packet.t[lane] = t, packet.u[lane] = packet.v[lane] = 0, packet.primIdx[lane] = prims[i];
+			}
+		}
+		return;
+	}
+	const __m128 zero4 = _mm_setzero_ps(), one4 = _mm_set1_ps( 1 ), eps4 = _mm_set1_ps( 1e-12f );
+	const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+	for (int i = 0; i < count; i++)
+	{
+		const uint idx = prims[i];
+		if (!alphaFlags.empty() && alphaFlags[idx] == ALPHA_TRANSPARENT) continue; // baked: transparent everywhere
+		const TriAccel& tri = accel[idx];
+		const __m128 e1x = _mm_set1_ps( tri.e1.x ), e1y = _mm_set1_ps( tri.e1.y ), e1z = _mm_set1_ps( tri.e1.z );
+		const __m128 e2x = _mm_set1_ps( tri.e2.x ), e2y = _mm_set1_ps( tri.e2.y ), e2z = _mm_set1_ps( tri.e2.z );
+		// h = cross( D, e2 ), a = dot( e1, h )
+		const __m128 hx = _mm_sub_ps( _mm_mul_ps( packet.Dy4, e2z ), _mm_mul_ps( packet.Dz4, e2y ) );
+		const __m128 hy = _mm_sub_ps( _mm_mul_ps( packet.Dz4, e2x ), _mm_mul_ps( packet.Dx4, e2z ) );
+		const __m128 hz = _mm_sub_ps( _mm_mul_ps( packet.Dx4, e2y ), _mm_mul_ps( packet.Dy4, e2x ) );
+		const __m128 a = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, hx ), _mm_mul_ps( e1y, hy ) ), _mm_mul_ps( e1z, hz ) );
+		const __m128 f = _mm_div_ps( one4, a );
+		// s = O - v0, u = f * dot( s, h )
+		const __m128 sx = _mm_sub_ps( packet.Ox4, _mm_set1_ps( tri.v0.x ) );
+		const __m128 sy = _mm_sub_ps( packet.Oy4, _mm_set1_ps( tri.v0.y ) );
+		const __m128 sz = _mm_sub_ps( packet.Oz4, _mm_set1_ps( tri.v0.z ) );
+		union { __m128 u4; float u[4]; };
+		u4 = _mm_mul_ps( f, _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, hx ), _mm_mul_ps( sy, hy ) ), _mm_mul_ps( sz, hz ) ) );
+		// q = cross( s, e1 ), v = f * dot( D, q ), t = f * dot( e2, q )
+		const __m128 qx = _mm_sub_ps( _mm_mul_ps( sy, e1z ), _mm_mul_ps( sz, e1y ) );
+		const __m128 qy = _mm_sub_ps( _mm_mul_ps( sz, e1x ), _mm_mul_ps( sx, e1z ) );
+		const __m128 qz = _mm_sub_ps( _mm_mul_ps( sx, e1y ), _mm_mul_ps( sy, e1x ) );
+		union { __m128 v4; float v[4]; };
+		v4 = _mm_mul_ps( f, _mm_add_ps( _mm_add_ps( _mm_mul_ps( packet.Dx4, qx ), _mm_mul_ps( packet.Dy4, qy ) ), _mm_mul_ps( packet.Dz4, qz ) ) );
+		const __m128 t4 = _mm_mul_ps( f, _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ) );
+		__m128 valid = _mm_cmpgt_ps( _mm_and_ps( a, absMask ), eps4 );
+		valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( u4, zero4 ), _mm_cmpge_ps( v4, zero4 ) ) );
+		valid = _mm_and_ps( valid, _mm_cmple_ps( _mm_add_ps( u4, v4 ), one4 ) );
+		valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpgt_ps( t4, zero4 ), _mm_cmplt_ps( t4, packet.t4 ) ) );
+		int mask = _mm_movemask_ps( valid ) & laneMask;
+		if (!mask) continue;
+		if (!alphaFlags.empty() && alphaFlags[idx])
+		{
+			for (int lane = 0; lane < 4; lane++) if ((mask & (1 << lane)) && !AlphaHit( idx, u[lane], v[lane] )) mask &= ~(1 << lane);
+			if (!mask) continue;
+		}
+		// store the new nearest hits
+		const __m128 hit4 = _mm_castsi128_ps( _mm_set_epi32( mask & 8 ? -1 : 0, mask & 4 ? -1 : 0, mask & 2 ? -1 : 0, mask & 1 ? -1 : 0 ) );
+		packet.t4 = _mm_or_ps( _mm_and_ps( hit4, t4 ), _mm_andnot_ps( hit4, packet.t4 ) );
+		packet.u4 = _mm_or_ps( _mm_and_ps( hit4, u4 ), _mm_andnot_ps( hit4, packet.u4 ) );
+		packet.v4 = _mm_or_ps( _mm_and_ps( hit4, v4 ), _mm_andnot_ps( hit4, packet.v4 ) );
+		for (int lane = 0; lane < 4; lane++) if (mask & (1 << lane)) packet.primIdx[lane] = idx;
+	}
+}
+
+// EOF
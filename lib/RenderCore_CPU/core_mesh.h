@@ -0,0 +1,80 @@
+/* core_mesh.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+//  +-----------------------------------------------------------------------------+
+//  |  TriAccel                                                                   |
+//  |  Triangle data for Moeller-Trumbore intersection: a vertex and the two      |
+//  |  edges that leave it. Barycentrics follow the OptiX convention: u weighs    |
+//  |  vertex1, v weighs vertex2.                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct TriAccel
+{
+	float3 v0, e1, e2;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh                                                                   |
+//  |  Container for geometry data:                                               |
+//  |  - accel and bvh are used for intersection, in object space;                |
+//  |  - triangles contains the fully equiped triangle data;                      |
+//  |  - or, for particles, spheres replaces both.                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+class RenderCore;
+class CoreMesh
+{
+public:
+	// methods
+	void SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags = 0 );
+	void SetParticles( const float4* sphereData, const int count, const int material );
+	// leaf intersection, for BVH4::Traverse and BVH4::Traverse4
+	bool Intersect( Ray& ray, const uint* prims, const int count ) const;
+	void Intersect4( RayPacket4& packet, const uint* prims, const int count, const int laneMask ) const;
+	// data
+	vector<TriAccel> accel;					// intersection data, one entry per triangle
+	vector<CoreTri> triangles;				// original triangle data, as received from RenderSystem
+	vector<uint> alphaFlags;				// per triangle: non-zero for alpha mapped triangles; empty if there are none
+	vector<float4> spheres;					// particles: centre and radius; empty for triangle meshes
+	int sphereMaterial = 0;					// particles: material of all spheres
+	BVH4 bvh;								// four-wide bvh over the triangles or spheres
+	static RenderCore* renderCore;			// for access to material list, in case of alpha mapped triangles
+private:
+	bool AlphaHit( const uint triIdx, const float u, const float v ) const;
+	bool IntersectSphere( const uint idx, const float3& O, const float3& D, float& t ) const;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreInstance                                                               |
+//  |  Stores the data for a scene graph object.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+class CoreInstance
+{
+public:
+	// constructor / destructor
+	CoreInstance() = default;
+	// data
+	int mesh = 0;							// ID of the mesh used for this instance
+	mat4 transform = mat4();				// object to world
+	mat4 invTransform = mat4();				// world to object, for the rays that visit the instance
+	aabb bounds;							// world space bounds of the transformed mesh
+};
+
+} // namespace lh2core
+
+// EOF
@@ -0,0 +1,55 @@
+/* core_settings.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   The settings and classes in this file are core-specific:
+   - avilable in host and device code
+   - specific to this particular core.
+   Global settings can be configured shared.h.
+*/
+
+#pragma once
+
+// core-specific settings
+#define MAXPATHLENGTH	8		// default path length cap; see the "maxPathLength" setting
+#define TILESIZE		16		// screen tiles are rendered in parallel; must be a multiple of 2 for the 2x2 ray packets
+#define BVHBINS			8		// bins per axis for the binned SAH bvh build
+#define BVHLEAFSIZE		4		// max primitives in a bvh leaf
+#define BVHSTACKSIZE	128		// traversal stack entries; up to three per level of the four-wide tree
+#define BILINEAR				// enable bilinear interpolation
+#define GGXCOMPENSATION			// multiscatter energy compensation for the specular lobe, see ggx_albedo.h
+// #define NOTEXTURES			// all texture reads will be white
+
+#define APPLYSAFENORMALS	if (dot( N, wi ) <= 0) pdf = 0;
+
+#include "platform.h"
+#include "system.h"				// for vector types
+
+using namespace lighthouse2;
+
+#include "core_api_base.h"
+#include "core_api.h"
+#include "bvh.h"
+#include "core_mesh.h"
+#include "bsdf.h"
+#include "rendercore.h"
+
+using namespace lh2core;
+
+#ifdef _DEBUG
+#pragma comment(lib, "../platform/lib/debug/platform.lib" )
+#else
+#pragma comment(lib, "../platform/lib/release/platform.lib" )
+#endif
+
+// EOF
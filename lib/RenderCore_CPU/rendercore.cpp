@@ -0,0 +1,812 @@
+/* rendercore.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+using namespace lh2core;
+
+namespace lh2core
+{
+
+// helpers
+
+static inline uint WangHash( uint s ) { s = (s ^ 61) ^ (s >> 16), s *= 9, s = s ^ (s >> 4), s *= 0x27d4eb2d, s = s ^ (s >> 15); return s; }
+
+static inline float3 TransformPosition( const mat4& M, const float3& p )
+{
+	return make_float3( M.cell[0] * p.x + M.cell[1] * p.y + M.cell[2] * p.z + M.cell[3],
+		M.cell[4] * p.x + M.cell[5] * p.y + M.cell[6] * p.z + M.cell[7],
+		M.cell[8] * p.x + M.cell[9] * p.y + M.cell[10] * p.z + M.cell[11] );
+}
+
+static inline float3 TransformVector( const mat4& M, const float3& v )
+{
+	return make_float3( M.cell[0] * v.x + M.cell[1] * v.y + M.cell[2] * v.z,
+		M.cell[4] * v.x + M.cell[5] * v.y + M.cell[6] * v.z,
+		M.cell[8] * v.x + M.cell[9] * v.y + M.cell[10] * v.z );
+}
+
+// normals transform with the transpose of the inverse
+static inline float3 TransformNormal( const mat4& invM, const float3& n )
+{
+	return make_float3( invM.cell[0] * n.x + invM.cell[4] * n.y + invM.cell[8] * n.z,
+		invM.cell[1] * n.x + invM.cell[5] * n.y + invM.cell[9] * n.z,
+		invM.cell[2] * n.x + invM.cell[6] * n.y + invM.cell[10] * n.z );
+}
+
+// suppress fireflies by clamping, and drop invalid samples
+static inline float3 ClampContribution( const float3& c, const float clampValue )
+{
+	if (!(c.x == c.x && c.y == c.y && c.z == c.z)) return make_float3( 0 );
+	const float v = max( c.x, max( c.y, c.z ) );
+	return v > clampValue ? c * (clampValue / v) : c;
+}
+
+// random point on a nine-bladed aperture, as in the PrimeRef core
+static inline float3 RandomPointOnLens( const float r0, float r1, const float3& pos, const float aperture, const float3& right, const float3& up )
+{
+	const float blade = (float)(int)(r0 * 9);
+	float r2 = (r0 - blade * (1.0f / 9.0f)) * 9.0f;
+	const float x1 = sinf( blade * PI / 4.5f ), y1 = cosf( blade * PI / 4.5f );
+	const float x2 = sinf( (blade + 1.0f) * PI / 4.5f ), y2 = cosf( (blade + 1.0f) * PI / 4.5f );
+	if ((r1 + r2) > 1) r1 = 1.0f - r1, r2 = 1.0f - r2;
+	return pos + aperture * (right * (x1 * r1 + x2 * r2) + up * (y1 * r1 + y2 * r2));
+}
+
+} // namespace lh2core
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetProbePos                                                    |
+//  |  Set the pixel for which the triid will be captured.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetProbePos( int2 pos )
+{
+	probePos = pos; // triangle id for this pixel will be stored in coreStats
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Init                                                           |
+//  |  Initialization.                                                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Init()
+{
+	CoreMesh::renderCore = this;
+	coreStats.SMcount = JobSystem::WorkerCount(); // the closest thing we have to multiprocessors
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Resize                                                         |
+//  |  Reallocate the accumulator for a new target size.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Resize( const int width, const int height, const uint spp )
+{
+	scrspp = max( 1u, spp );
+	if (width == scrwidth && height == scrheight) return;
+	scrwidth = width, scrheight = height;
+	accumulator.assign( scrwidth * scrheight, make_float4( 0 ) );
+	samplesTaken = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTarget                                                      |
+//  |  Set the OpenGL texture that serves as the render target.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTarget( GLTexture* target, const uint spp )
+{
+	Resize( target->width, target->height, spp );
+	pixels.resize( scrwidth * scrheight );
+	targetTextureID = target->ID;
+	hostTarget = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetHostTarget                                                  |
+//  |  Headless rendering: finalize each frame to host memory. There is no copy   |
+//  |  to make; the pixels are written directly.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::SetHostTarget( float4* target, const int width, const int height, const uint spp )
+{
+	Resize( width, height, spp );
+	hostTarget = target;
+	targetTextureID = 0;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetGeometry                                                    |
+//  |  Set the geometry data for a model.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags )
+{
+	// Note: for first-time setup, meshes are expected to be passed in sequential order.
+	// This will result in new CoreMesh pointers being pushed into the meshes vector.
+	// Subsequent mesh changes will be applied to existing CoreMeshes. This is deliberately
+	// minimalistic; RenderSystem is responsible for a proper (fault-tolerant) interface.
+	if (meshIdx >= meshes.size())
+	{
+		assert( meshIdx == meshes.size() );
+		meshes.push_back( new CoreMesh() );
+	}
+	Timer timer;
+	meshes[meshIdx]->SetGeometry( vertexData, vertexCount, triangleCount, triangles, alphaFlags );
+	coreStats.gasRebuilds++;
+	coreStats.gasRebuildTime += timer.elapsed();
+	instancesDirty = true; // the bounds of the instances of this mesh changed
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetParticles                                                   |
+//  |  Set the spheres of a point cloud mesh; see SetGeometry.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetParticles( const int meshIdx, const float4* spheres, const int count, const int material )
+{
+	if (meshIdx >= meshes.size())
+	{
+		assert( meshIdx == meshes.size() );
+		meshes.push_back( new CoreMesh() );
+	}
+	Timer timer;
+	meshes[meshIdx]->SetParticles( spheres, count, material );
+	coreStats.gasRebuilds++;
+	coreStats.gasRebuildTime += timer.elapsed();
+	instancesDirty = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetInstance                                                    |
+//  |  Set instance details.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const mat4& matrix )
+{
+	// Note: for first-time setup, instances are expected to be passed in sequential order.
+	if (instanceIdx >= instances.size())
+	{
+		assert( instanceIdx == instances.size() );
+		instances.push_back( new CoreInstance() );
+	}
+	CoreInstance* instance = instances[instanceIdx];
+	instance->mesh = meshIdx;
+	instance->transform = matrix;
+	instance->invTransform = matrix.Inverted();
+	instancesDirty = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateToplevel                                                 |
+//  |  Rebuild the bvh over the world space bounds of the instances.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateToplevel()
+{
+	if (!instancesDirty) return;
+	Timer timer;
+	vector<aabb> bounds( instances.size() );
+	for (int i = 0; i < (int)instances.size(); i++)
+	{
+		CoreInstance* instance = instances[i];
+		const CoreMesh* mesh = meshes[instance->mesh];
+		if (mesh->triangles.size() == 0 && mesh->spheres.size() == 0)
+		{
+			// nothing to hit; keep the instance out of the way
+			instance->bounds = aabb( make_float3( 1e30f ), make_float3( 1e30f ) );
+		}
+		else
+		{
+			// transform the corners of the object space bounds
+			const aabb b = mesh->bvh.Bounds();
+			instance->bounds.Reset();
+			for (int c = 0; c < 8; c++) instance->bounds.Grow( TransformPosition( instance->transform,
+				make_float3( b.bmin[0] + (c & 1) * b.Extend( 0 ), b.bmin[1] + ((c >> 1) & 1) * b.Extend( 1 ), b.bmin[2] + (c >> 2) * b.Extend( 2 ) ) ) );
+		}
+		bounds[i] = instance->bounds;
+	}
+	topLevel.Build( bounds.data(), (int)instances.size() );
+	instancesDirty = false;
+	coreStats.topLevelRebuilds++;
+	coreStats.topLevelRefit = false;
+	coreStats.bvhBuildTime = timer.elapsed();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTextures                                                    |
+//  |  Set the texture data.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTextures( const CoreTexDesc* tex, const int textureCount )
+{
+	// copy the first MIP level of each texture; the path tracer does not filter over levels
+	textures.resize( textureCount );
+	coreStats.argb32TexelCount = coreStats.argb128TexelCount = 0;
+	for (int i = 0; i < textureCount; i++)
+	{
+		Texture& t = textures[i];
+		t.width = tex[i].width, t.height = tex[i].height;
+		const uint texels = t.width * t.height;
+		t.argb32.clear(), t.argb128.clear();
+		if (tex[i].storage == ARGB128)
+		{
+			t.argb128.assign( tex[i].fdata, tex[i].fdata + texels );
+			coreStats.argb128TexelCount += texels;
+		}
+		else
+		{
+			t.argb32.assign( (const uint*)tex[i].idata, (const uint*)tex[i].idata + texels );
+			coreStats.argb32TexelCount += texels;
+		}
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetMaterials                                                   |
+//  |  Set the material data.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount )
+{
+	materials.resize( materialCount );
+	for (int i = 0; i < materialCount; i++)
+	{
+		Material& m = materials[i];
+		const uint flags = mat[i].flags;
+		m.color = make_float3( (float)mat[i].diffuse_r, (float)mat[i].diffuse_g, (float)mat[i].diffuse_b );
+		m.absorption = make_float3( (float)mat[i].transmittance_r, (float)mat[i].transmittance_g, (float)mat[i].transmittance_b );
+		m.parameters = mat[i].parameters;
+		m.flags = flags;
+		m.texture = -1;
+		if (MAT_HASDIFFUSEMAP && matEx[i].texture[TEXTURE0] >= 0 && matEx[i].texture[TEXTURE0] < (int)textures.size())
+		{
+			m.texture = matEx[i].texture[TEXTURE0];
+			m.uvscale = make_float2( (float)mat[i].uscale0, (float)mat[i].vscale0 );
+			m.uvoffs = make_float2( (float)mat[i].uoffs0, (float)mat[i].voffs0 );
+		}
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLights                                                      |
+//  |  Set the light data.                                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLights( const CoreLightTri* areaLightData, const int areaLightCount,
+	const CorePointLight* pointLightData, const int pointLightCount,
+	const CoreSpotLight* spotLightData, const int spotLightCount,
+	const CoreDirectionalLight* directionalLightData, const int directionalLightCount )
+{
+	areaLights.assign( areaLightData, areaLightData + areaLightCount );
+	pointLights.assign( pointLightData, pointLightData + pointLightCount );
+	spotLights.assign( spotLightData, spotLightData + spotLightCount );
+	directionalLights.assign( directionalLightData, directionalLightData + directionalLightCount );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetSkyData                                                     |
+//  |  Set the sky dome data.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetSkyData( const float3* pixels, const uint width, const uint height )
+{
+	skyPixels.assign( pixels, pixels + width * height );
+	skywidth = width;
+	skyheight = height;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Setting                                                        |
+//  |  Modify a render setting.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Setting( const char* name, const float value )
+{
+	if (!strcmp( name, "epsilon" ))
+	{
+		geometryEpsilon = value;
+	}
+	else if (!strcmp( name, "clampValue" ))
+	{
+		clampValue = value;
+	}
+	else if (!strcmp( name, "maxPathLength" ))
+	{
+		maxPathLength = max( 1, min( MAXPATHLENGTH, (int)value ) );
+	}
+	else if (!strcmp( name, "russianRoulette" ))
+	{
+		// path length from which paths are terminated with a probability based on their throughput; 0 disables it
+		rrDepth = max( 0, (int)value );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Intersect                                                      |
+//  |  Find the nearest hit of a ray in the scene. A ray that visits an instance  |
+//  |  continues into the bvh of its mesh in object space; the distance along the |
+//  |  transformed (unnormalized) direction is the world space distance.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Intersect( Ray& ray ) const
+{
+	topLevel.Traverse<false>( ray, [&]( Ray& worldRay, const uint* prims, const int count ) {
+		bool hit = false;
+		for (int i = 0; i < count; i++)
+		{
+			const CoreInstance* instance = instances[prims[i]];
+			const CoreMesh* mesh = meshes[instance->mesh];
+			Ray local( TransformPosition( instance->invTransform, worldRay.O ), TransformVector( instance->invTransform, worldRay.D ), worldRay.t );
+			if (mesh->bvh.Traverse<false>( local, [mesh]( Ray& r, const uint* tris, const int n ) { return mesh->Intersect( r, tris, n ); } ))
+			{
+				worldRay.t = local.t, worldRay.u = local.u, worldRay.v = local.v;
+				worldRay.primIdx = local.primIdx, worldRay.instIdx = prims[i], hit = true;
+			}
+		}
+		return hit;
+	} );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::IsOccluded                                                     |
+//  |  Test if anything is hit before ray.t.                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::IsOccluded( Ray& ray ) const
+{
+	return topLevel.Traverse<true>( ray, [&]( Ray& worldRay, const uint* prims, const int count ) {
+		for (int i = 0; i < count; i++)
+		{
+			const CoreInstance* instance = instances[prims[i]];
+			const CoreMesh* mesh = meshes[instance->mesh];
+			Ray local( TransformPosition( instance->invTransform, worldRay.O ), TransformVector( instance->invTransform, worldRay.D ), worldRay.t );
+			if (mesh->bvh.Traverse<true>( local, [mesh]( Ray& r, const uint* tris, const int n ) { return mesh->Intersect( r, tris, n ); } )) return true;
+		}
+		return false;
+	} );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Intersect4                                                     |
+//  |  Find the nearest hits of a packet of four rays. The packet is transformed  |
+//  |  to object space for each instance it visits, and traverses the bvh of the  |
+//  |  mesh as a whole.                                                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Intersect4( RayPacket4& packet ) const
+{
+	topLevel.Traverse4( packet, [&]( RayPacket4& worldPacket, const uint* prims, const int count, const int laneMask ) {
+		for (int i = 0; i < count; i++)
+		{
+			const CoreInstance* instance = instances[prims[i]];
+			const CoreMesh* mesh = meshes[instance->mesh];
+			RayPacket4 local;
+			for (int lane = 0; lane < 4; lane++)
+			{
+				const float3 O = make_float3( worldPacket.Ox[lane], worldPacket.Oy[lane], worldPacket.Oz[lane] );
+				const float3 D = make_float3( worldPacket.Dx[lane], worldPacket.Dy[lane], worldPacket.Dz[lane] );
+				local.Set( lane, Ray( TransformPosition( instance->invTransform, O ), TransformVector( instance->invTransform, D ), worldPacket.t[lane] ) );
+			}
+			mesh->bvh.Traverse4( local, [mesh]( RayPacket4& p, const uint* tris, const int n, const int mask ) { mesh->Intersect4( p, tris, n, mask ); }, laneMask );
+			for (int lane = 0; lane < 4; lane++) if ((laneMask & (1 << lane)) && local.primIdx[lane] >= 0)
+			{
+				worldPacket.t[lane] = local.t[lane], worldPacket.u[lane] = local.u[lane], worldPacket.v[lane] = local.v[lane];
+				worldPacket.primIdx[lane] = local.primIdx[lane], worldPacket.instIdx[lane] = prims[i];
+			}
+		}
+	} );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::FetchTexel                                                     |
+//  |  Texture lookup with wrapping, as in the FetchTexel of the CUDA cores.      |
+//  +-----------------------------------------------------------------------------+
+float4 RenderCore::FetchTexel( const int texture, const float2 uv ) const
+{
+#ifdef NOTEXTURES
+	return make_float4( 1 );
+#else
+	const Texture& tex = textures[texture];
+	const int w = tex.width, h = tex.height;
+	if (w == 0 || h == 0) return make_float4( 1 );
+	const float2 tc = make_float2( (max( uv.x + 1000, 0.0f ) * w) - 0.5f, (max( uv.y + 1000, 0.0f ) * h) - 0.5f );
+	const int iu = ((int)tc.x) % w, iv = ((int)tc.y) % h;
+	const float r = 1.0f / 256.0f;
+	auto texel = [&]( const int x, const int y ) {
+		if (tex.argb128.size()) return tex.argb128[x + y * w];
+		const uint v = tex.argb32[x + y * w];
+		return make_float4( (float)(v & 255) * r, (float)((v >> 8) & 255) * r, (float)((v >> 16) & 255) * r, (float)(v >> 24) * r );
+	};
+#ifdef BILINEAR
+	const float fu = tc.x - floorf( tc.x ), fv = tc.y - floorf( tc.y );
+	const int iu1 = (iu + 1) % w, iv1 = (iv + 1) % h;
+	return texel( iu, iv ) * ((1 - fu) * (1 - fv)) + texel( iu1, iv ) * (fu * (1 - fv)) +
+		texel( iu, iv1 ) * ((1 - fu) * fv) + texel( iu1, iv1 ) * (fu * fv);
+#else
+	return texel( iu, iv );
+#endif
+#endif
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::IsTransparent                                                  |
+//  |  Alpha test: true if the diffuse map of an alpha mapped material is         |
+//  |  transparent at barycentrics u, v of a triangle.                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::IsTransparent( const CoreTri& tri, const float u, const float v ) const
+{
+	const Material& mat = materials[tri.material];
+	const uint flags = mat.flags;
+	if (!MAT_HASALPHA || mat.texture < 0) return false;
+	const float w = 1 - (u + v);
+	const float2 uv = make_float2( w * tri.u0 + u * tri.u1 + v * tri.u2, w * tri.v0 + u * tri.v1 + v * tri.v2 );
+	return FetchTexel( mat.texture, mat.uvscale * (mat.uvoffs + uv) ).w < 0.5f;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SkyColor                                                       |
+//  |  Sky dome lookup; same mapping as SampleSkydome in the CUDA cores.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+float3 RenderCore::SkyColor( const float3& D ) const
+{
+	if (skyPixels.size() == 0) return make_float3( 0 );
+	// formulas by Paul Debevec, http://www.pauldebevec.com/Probes
+	const uint u = (uint)(skywidth * 0.5f * (1.0f + atan2f( D.x, -D.z ) * INVPI));
+	const uint v = (uint)(skyheight * acosf( clamp( D.y, -1.0f, 1.0f ) ) * INVPI);
+	const uint idx = u + v * skywidth;
+	return idx < skyPixels.size() ? skyPixels[idx] : make_float3( 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::GetShadingData                                                 |
+//  |  Material properties and world space normals and tangent at the hit point   |
+//  |  of a ray. For emissive triangles, area receives the world space area of    |
+//  |  the triangle, for MIS. Particles are not in the light list: for spheres,   |
+//  |  area is 0.                                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::GetShadingData( const Ray& ray, ShadingData& shadingData, float3& N, float3& iN, float3& T, float& area ) const
+{
+	const CoreInstance* instance = instances[ray.instIdx];
+	const CoreMesh* mesh = meshes[instance->mesh];
+	if (!mesh->spheres.empty())
+	{
+		GetSphereShadingData( ray, shadingData, N, iN, T );
+		area = 0;
+		return;
+	}
+	const CoreTri& tri = mesh->triangles[ray.primIdx];
+	const Material& mat = materials[tri.material];
+	const uint flags = mat.flags;
+	const float u = ray.u, v = ray.v, w = 1 - (u + v);
+	shadingData.color = mat.color, shadingData.flags = 0;
+	shadingData.absorption = mat.absorption, shadingData.matID = tri.material;
+	shadingData.parameters = mat.parameters;
+	// normals, in world space
+	N = iN = make_float3( tri.Nx, tri.Ny, tri.Nz );
+	if (MAT_HASSMOOTHNORMALS) iN = w * tri.vN0 + u * tri.vN1 + v * tri.vN2;
+	N = normalize( TransformNormal( instance->invTransform, N ) );
+	iN = normalize( TransformNormal( instance->invTransform, iN ) );
+	// tangent, orthogonal to the shading normal; meshes without texture coordinates may not have one
+	T = TransformVector( instance->transform, tri.T );
+	T -= iN * dot( T, iN );
+	if (dot( T, T ) < 1e-12f) T = cross( iN, fabs( iN.x ) > 0.9f ? make_float3( 0, 1, 0 ) : make_float3( 1, 0, 0 ) );
+	T = normalize( T );
+	// texturing
+	if (mat.texture >= 0)
+	{
+		const float2 uv = make_float2( w * tri.u0 + u * tri.u1 + v * tri.u2, w * tri.v0 + u * tri.v1 + v * tri.v2 );
+		shadingData.color *= make_float3( FetchTexel( mat.texture, mat.uvscale * (mat.uvoffs + uv) ) );
+	}
+	area = 0;
+	if (shadingData.IsEmissive())
+	{
+		const TriAccel& accel = mesh->accel[ray.primIdx];
+		area = 0.5f * length( cross( TransformVector( instance->transform, accel.e1 ), TransformVector( instance->transform, accel.e2 ) ) );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::GetSphereShadingData                                           |
+//  |  GetShadingData for a hit on a particle: the normal points away from the    |
+//  |  centre, and the texture is mapped using latitude and longitude.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::GetSphereShadingData( const Ray& ray, ShadingData& shadingData, float3& N, float3& iN, float3& T ) const
+{
+	const CoreInstance* instance = instances[ray.instIdx];
+	const CoreMesh* mesh = meshes[instance->mesh];
+	const Material& mat = materials[mesh->sphereMaterial];
+	shadingData.color = mat.color, shadingData.flags = 0;
+	shadingData.absorption = mat.absorption, shadingData.matID = mesh->sphereMaterial;
+	shadingData.parameters = mat.parameters;
+	// object space normal at the hit point
+	const float3 P = TransformPosition( instance->invTransform, ray.O + ray.t * ray.D );
+	const float3 n = normalize( P - make_float3( mesh->spheres[ray.primIdx] ) );
+	N = iN = normalize( TransformNormal( instance->invTransform, n ) );
+	T = TransformVector( instance->transform, make_float3( -n.z, 0, n.x ) );
+	T -= iN * dot( T, iN );
+	if (dot( T, T ) < 1e-12f) T = cross( iN, fabs( iN.x ) > 0.9f ? make_float3( 0, 1, 0 ) : make_float3( 1, 0, 0 ) );
+	T = normalize( T );
+	if (mat.texture >= 0)
+	{
+		const float2 uv = make_float2( 0.5f + atan2f( n.x, -n.z ) * 0.5f * INVPI, acosf( clamp( n.y, -1.0f, 1.0f ) ) * INVPI );
+		shadingData.color *= make_float3( FetchTexel( mat.texture, mat.uvscale * (mat.uvoffs + uv) ) );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SampleLight                                                    |
+//  |  Select a random light, uniformly, and a random point on it. Returns the    |
+//  |  radiance (or intensity) of the light, the direction and distance to it,    |
+//  |  and the pdf of the connection: the pick probability times the solid angle  |
+//  |  pdf for area lights, or times the squared distance over the falloff for    |
+//  |  point and spot lights. isArea is set for area lights, which can also be    |
+//  |  hit by bsdf sampling.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+float3 RenderCore::SampleLight( const float3& I, const float3& N, uint& seed, float3& L, float& dist, float& pickPdf, bool& isArea ) const
+{
+	const int areaCount = (int)areaLights.size(), pointCount = (int)pointLights.size(), spotCount = (int)spotLights.size();
+	const int lightCount = areaCount + pointCount + spotCount + (int)directionalLights.size();
+	pickPdf = 0, isArea = false;
+	if (lightCount == 0) return make_float3( 0 );
+	const float pickProb = 1.0f / lightCount;
+	const int lightIdx = min( (int)(RandomFloat( seed ) * lightCount), lightCount - 1 );
+	if (lightIdx < areaCount)
+	{
+		// area light: uniform point on the triangle
+		const CoreLightTri& light = areaLights[lightIdx];
+		float r0 = RandomFloat( seed ), r1 = RandomFloat( seed );
+		if (r0 + r1 > 1) r0 = 1 - r0, r1 = 1 - r1;
+		const float3 P = light.vertex0 + r0 * (light.vertex1 - light.vertex0) + r1 * (light.vertex2 - light.vertex0);
+		L = P - I;
+		const float sqDist = dot( L, L );
+		dist = sqrtf( sqDist ), L *= 1.0f / dist;
+		const float cosLight = -dot( L, light.N );
+		if (cosLight <= 0 || dot( L, N ) <= 0) return make_float3( 0 );
+		pickPdf = pickProb * sqDist / (cosLight * light.area), isArea = true;
+		return light.radiance;
+	}
+	else if (lightIdx < areaCount + pointCount)
+	{
+		const CorePointLight& light = pointLights[lightIdx - areaCount];
+		L = light.position - I;
+		const float sqDist = dot( L, L );
+		dist = sqrtf( sqDist ), L *= 1.0f / dist;
+		if (dot( L, N ) <= 0) return make_float3( 0 );
+		pickPdf = pickProb * sqDist;
+		return light.radiance;
+	}
+	else if (lightIdx < areaCount + pointCount + spotCount)
+	{
+		const CoreSpotLight& light = spotLights[lightIdx - (areaCount + pointCount)];
+		L = light.position - I;
+		const float sqDist = dot( L, L );
+		dist = sqrtf( sqDist ), L *= 1.0f / dist;
+		const float falloff = min( 1.0f, (max( 0.0f, -dot( L, light.direction ) ) - light.cosOuter) / (light.cosInner - light.cosOuter) );
+		if (falloff <= 0 || dot( L, N ) <= 0) return make_float3( 0 );
+		pickPdf = pickProb * sqDist / falloff;
+		return light.radiance;
+	}
+	else
+	{
+		const CoreDirectionalLight& light = directionalLights[lightIdx - (areaCount + pointCount + spotCount)];
+		L = light.direction * -1.0f, dist = 1e34f;
+		if (dot( L, N ) <= 0) return make_float3( 0 );
+		pickPdf = pickProb;
+		return light.radiance;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::TracePath                                                      |
+//  |  Radiance arriving along a ray of which the nearest hit is already known.   |
+//  |  Next event estimation at each non-specular vertex; hits on area lights     |
+//  |  after a bsdf sample are combined with it using MIS. rays is increased by   |
+//  |  the number of rays traced.                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+float3 RenderCore::TracePath( Ray& ray, uint& seed, int& rays ) const
+{
+	const float lightCount = (float)(areaLights.size() + pointLights.size() + spotLights.size() + directionalLights.size());
+	float3 throughput = make_float3( 1 ), radiance = make_float3( 0 );
+	float lastPdf = 1;
+	bool lastSpecular = true; // the camera counts as specular: nothing else could have found what the primary ray hits
+	for (int pathLength = 1; pathLength <= maxPathLength; pathLength++)
+	{
+		if (pathLength > 1) Intersect( ray ), rays++;
+		if (ray.primIdx < 0)
+		{
+			radiance += ClampContribution( throughput * SkyColor( ray.D ), clampValue );
+			break;
+		}
+		ShadingData shadingData;
+		float3 N, iN, T;
+		float area;
+		GetShadingData( ray, shadingData, N, iN, T, area );
+		const float3 I = ray.O + ray.t * ray.D;
+		// stop on light
+		if (shadingData.IsEmissive() /* r, g or b exceeds 1 */)
+		{
+			const float DdotNL = -dot( ray.D, N );
+			if (DdotNL > 0 /* lights are not double sided */)
+			{
+				// emitters that are not in the light list (area 0) cannot be found by next event estimation
+				if (lastSpecular || area == 0) radiance += ClampContribution( throughput * shadingData.color, clampValue );
+				else
+				{
+					// last vertex was not specular: apply MIS
+					const float lightPdf = (ray.t * ray.t) / (DdotNL * area) / lightCount;
+					radiance += ClampContribution( throughput * shadingData.color * (lastPdf / (lastPdf + lightPdf)), clampValue );
+				}
+			}
+			break;
+		}
+		// normal alignment for backfacing polygons
+		if (dot( ray.D, N ) > 0) N *= -1.0f, iN *= -1.0f;
+		const bool specular = ROUGHNESS < 0.01f;
+		const float3 wo = ray.D * -1.0f;
+		// next event estimation: connect to a light, unless the vertex is specular
+		if (!specular)
+		{
+			float3 L;
+			float dist, pickPdf;
+			bool isArea;
+			const float3 lightColor = SampleLight( I, iN, seed, L, dist, pickPdf, isArea );
+			const float NdotL = dot( L, iN );
+			if (pickPdf > 0 && NdotL > 0 && dot( L, N ) > 0)
+			{
+				float bsdfPdf;
+				const float3 sampledBSDF = EvaluateBSDF( shadingData, iN, T, wo, L, bsdfPdf );
+				if (bsdfPdf > 0)
+				{
+					const float3 contribution = throughput * sampledBSDF * lightColor * (NdotL / (pickPdf + (isArea ? bsdfPdf : 0)));
+					if (contribution.x + contribution.y + contribution.z > 0)
+					{
+						Ray shadowRay( I + N * geometryEpsilon, L, dist - 2 * geometryEpsilon );
+						rays++;
+						if (!IsOccluded( shadowRay )) radiance += ClampContribution( contribution, clampValue );
+					}
+				}
+			}
+		}
+		if (pathLength == maxPathLength) break;
+		// evaluate bsdf to obtain direction for next path segment
+		float3 R;
+		float pdf;
+		const float r3 = RandomFloat( seed ), r4 = RandomFloat( seed );
+		const float3 bsdf = SampleBSDF( shadingData, iN, N, T, wo, r3, r4, R, pdf );
+		if (!(pdf > EPSILON)) break;
+		throughput *= bsdf * (fabs( dot( iN, R ) ) / pdf);
+		// Russian roulette: survival probability follows the throughput of the new segment
+		if (rrDepth > 0 && pathLength >= rrDepth)
+		{
+			const float survive = min( 1.0f, max( throughput.x, max( throughput.y, throughput.z ) ) );
+			if (!(RandomFloat( seed ) < survive)) break;
+			throughput *= 1.0f / survive;
+		}
+		lastPdf = pdf, lastSpecular = specular;
+		ray = Ray( I + N * (dot( R, N ) > 0 ? geometryEpsilon : -geometryEpsilon), R );
+	}
+	return radiance;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::RenderTile                                                     |
+//  |  Render scrspp samples for the pixels of a screen tile, in 2x2 quads: the   |
+//  |  primary rays of a quad are traced as a packet, after which each path       |
+//  |  continues on its own.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::RenderTile( const int tileIdx, const ViewPyramid& view, const uint frameSeed, int& rays )
+{
+	const int tilesX = (scrwidth + TILESIZE - 1) / TILESIZE;
+	const int x0 = (tileIdx % tilesX) * TILESIZE, y0 = (tileIdx / tilesX) * TILESIZE;
+	const int x1 = min( x0 + TILESIZE, scrwidth ), y1 = min( y0 + TILESIZE, scrheight );
+	const float3 right = view.p2 - view.p1, up = view.p3 - view.p1;
+	for (int sample = 0; sample < scrspp; sample++) for (int y = y0; y < y1; y += 2) for (int x = x0; x < x1; x += 2)
+	{
+		RayPacket4 packet;
+		uint seeds[4];
+		int laneMask = 0;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			const int px = x + (lane & 1), py = y + (lane >> 1);
+			if (px >= x1 || py >= y1)
+			{
+				packet.Set( lane, Ray( view.pos, make_float3( 0, 0, 1 ), 0 ) ); // inactive
+				continue;
+			}
+			laneMask |= 1 << lane;
+			uint seed = WangHash( (px + py * scrwidth) * 7919 + sample * 104729 + frameSeed ) | 1;
+			const float r0 = RandomFloat( seed ), r1 = RandomFloat( seed ), r2 = RandomFloat( seed ), r3 = RandomFloat( seed );
+			const float3 posOnPixel = view.p1 + ((float)px + r0) * (right / (float)scrwidth) + ((float)py + r1) * (up / (float)scrheight);
+			const float3 posOnLens = RandomPointOnLens( r2, r3, view.pos, view.aperture, normalize( right ), normalize( up ) );
+			packet.Set( lane, Ray( posOnLens, normalize( posOnPixel - posOnLens ) ) );
+			seeds[lane] = seed;
+		}
+		Intersect4( packet );
+		for (int lane = 0; lane < 4; lane++) if (laneMask & (1 << lane))
+		{
+			const int px = x + (lane & 1), py = y + (lane >> 1);
+			Ray ray( make_float3( packet.Ox[lane], packet.Oy[lane], packet.Oz[lane] ), make_float3( packet.Dx[lane], packet.Dy[lane], packet.Dz[lane] ), packet.t[lane] );
+			ray.u = packet.u[lane], ray.v = packet.v[lane];
+			ray.instIdx = packet.instIdx[lane], ray.primIdx = packet.primIdx[lane];
+			rays++;
+			if (sample == 0 && px == probePos.x && py == probePos.y)
+			{
+				// only one tile contains the probe pixel, so there is a single writer
+				coreStats.probedInstid = ray.instIdx;
+				coreStats.probedTriid = ray.primIdx;
+				coreStats.probedDist = ray.primIdx < 0 ? 1e34f : ray.t;
+			}
+			accumulator[px + py * scrwidth] += make_float4( TracePath( ray, seeds[lane], rays ), 0 );
+		}
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Finalize                                                       |
+//  |  Present the accumulator; including brightness, contrast and gamma as in    |
+//  |  finalizeRenderKernel.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Finalize( const float brightness, const float contrast )
+{
+	const float pixelValueScale = 1.0f / (float)samplesTaken;
+	// https://www.dfstudios.co.uk/articles/programming/image-programming-algorithms/image-processing-algorithms-part-5-contrast-adjustment
+	const float contrastFactor = (259.0f * (contrast * 256.0f + 255.0f)) / (255.0f * (259.0f - 256.0f * contrast));
+	float4* target = hostTarget ? hostTarget : pixels.data();
+	RunJobs( scrheight, [&]( const int y ) {
+		for (int x = 0; x < scrwidth; x++)
+		{
+			const float4 value = accumulator[x + y * scrwidth] * pixelValueScale;
+			const float r = sqrtf( max( 0.0f, (value.x - 0.5f) * contrastFactor + 0.5f + brightness ) );
+			const float g = sqrtf( max( 0.0f, (value.y - 0.5f) * contrastFactor + 0.5f + brightness ) );
+			const float b = sqrtf( max( 0.0f, (value.z - 0.5f) * contrastFactor + 0.5f + brightness ) );
+			target[x + y * scrwidth] = make_float4( r, g, b, value.w );
+		}
+	} );
+	if (hostTarget) return;
+	// copy to OpenGL render target texture
+	glBindTexture( GL_TEXTURE_2D, targetTextureID );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA32F, scrwidth, scrheight, 0, GL_RGBA, GL_FLOAT, pixels.data() );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Render                                                         |
+//  |  Produce one image.                                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast )
+{
+	if (scrwidth == 0 || (targetTextureID == 0 && hostTarget == 0)) return;
+	Timer timer;
+	UpdateToplevel(); // in case the instances changed without a call
+	if (converge == Restart || samplesTaken == 0)
+	{
+		memset( accumulator.data(), 0, accumulator.size() * sizeof( float4 ) );
+		samplesTaken = 0;
+	}
+	// render the tiles in parallel
+	const int tilesX = (scrwidth + TILESIZE - 1) / TILESIZE, tilesY = (scrheight + TILESIZE - 1) / TILESIZE;
+	vector<int> tileRays( tilesX * tilesY, 0 );
+	const uint frameSeed = WangHash( ++frameIdx * 0x9e3779b9u );
+	coreStats.probedInstid = coreStats.probedTriid = -1, coreStats.probedDist = 1e34f;
+	RunJobs( tilesX * tilesY, [&]( const int i ) { RenderTile( i, view, frameSeed, tileRays[i] ); } );
+	samplesTaken += scrspp;
+	Finalize( brightness, contrast );
+	// statistics
+	uint rays = 0;
+	for (int i = 0; i < tilesX * tilesY; i++) rays += tileRays[i];
+	coreStats.primaryRayCount = scrwidth * scrheight * scrspp;
+	coreStats.totalRays = rays;
+	coreStats.renderTime = timer.elapsed();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Shutdown                                                       |
+//  |  Free all resources.                                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Shutdown()
+{
+	for (CoreMesh* mesh : meshes) delete mesh;
+	for (CoreInstance* instance : instances) delete instance;
+	meshes.clear();
+	instances.clear();
+}
+
+// EOF
@@ -0,0 +1,130 @@
+/* rendercore.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+//  +-----------------------------------------------------------------------------+
+//  |  Texture                                                                    |
+//  |  Texel data of a texture; one of the two arrays is used.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct Texture
+{
+	int width = 0, height = 0;
+	vector<uint> argb32;					// regular texture data; byte 0 holds red
+	vector<float4> argb128;					// hdr texture data
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Material                                                                   |
+//  |  The fields of a CoreMaterial that the path tracer reads, decoded.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct Material
+{
+	float3 color;							// diffuse color; emissive if a component exceeds 1
+	float3 absorption;						// transmittance
+	uint4 parameters;						// Disney principled BRDF parameters, see ShadingData
+	uint flags;								// see the MAT_ macros in CoreMaterial4
+	int texture = -1;						// diffuse map, or -1
+	float2 uvscale, uvoffs;					// diffuse map coordinate transform
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore                                                                 |
+//  |  Path tracer that runs on the host: tiles of the screen are rendered in     |
+//  |  parallel by the job system. Primary rays are traced in 2x2 packets, the    |
+//  |  rays of the bounces one at a time.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+class RenderCore
+{
+public:
+	// methods
+	void Init();
+	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast );
+	void Setting( const char* name, const float value );
+	void SetTarget( GLTexture* target, const uint spp );
+	bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
+	void Shutdown();
+	void KeyDown( const uint key ) {}
+	void KeyUp( const uint key ) {}
+	// passing data. Note: RenderCore always copies what it needs; the passed data thus remains the
+	// property of the caller, and can be safely deleted or modified as soon as these calls return.
+	void SetTextures( const CoreTexDesc* tex, const int textureCount );
+	void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount ); // textures must be in sync when calling this
+	void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
+		const CorePointLight* pointLights, const int pointLightCount,
+		const CoreSpotLight* spotLights, const int spotLightCount,
+		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	void SetSkyData( const float3* pixels, const uint width, const uint height );
+	// geometry and instances:
+	// a scene is setup by first passing a number of meshes (geometry), then a number of instances.
+	// note that stored meshes can be used zero, one or multiple times in the scene.
+	// also note that, when using alpha flags, materials must be in sync.
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
+	void SetParticles( const int meshIdx, const float4* spheres, const int count, const int material );
+	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
+	void UpdateToplevel();
+	void SetProbePos( const int2 pos );
+	// alpha test, for CoreMesh
+	bool IsTransparent( const CoreTri& tri, const float u, const float v ) const;
+	// internal methods
+private:
+	void Resize( const int width, const int height, const uint spp );
+	void Intersect( Ray& ray ) const;
+	bool IsOccluded( Ray& ray ) const;
+	void Intersect4( RayPacket4& packet ) const;
+	float4 FetchTexel( const int texture, const float2 uv ) const;
+	float3 SkyColor( const float3& D ) const;
+	void GetShadingData( const Ray& ray, ShadingData& shadingData, float3& N, float3& iN, float3& T, float& area ) const;
+	void GetSphereShadingData( const Ray& ray, ShadingData& shadingData, float3& N, float3& iN, float3& T ) const;
+	float3 SampleLight( const float3& I, const float3& N, uint& seed, float3& L, float& dist, float& pickPdf, bool& isArea ) const;
+	float3 TracePath( Ray& ray, uint& seed, int& rays ) const;
+	void RenderTile( const int tileIdx, const ViewPyramid& view, const uint frameSeed, int& rays );
+	void Finalize( const float brightness, const float contrast );
+	// data members
+	int scrwidth = 0, scrheight = 0;				// current screen width and height
+	int scrspp = 1;									// samples to be taken per screen pixel
+	int skywidth = 0, skyheight = 0;				// size of the skydome texture
+	int targetTextureID = 0;						// ID of the target OpenGL texture, or 0 when rendering to hostTarget
+	float4* hostTarget = 0;							// headless rendering: finalize to this host buffer, see SetHostTarget
+	int2 probePos = make_int2( 0 );					// triangle picking; primary ray for this pixel copies its triid to coreStats.probedTriid
+	uint samplesTaken = 0;							// number of accumulated samples per pixel
+	uint frameIdx = 0;								// frames rendered, to seed the random number generators
+	int maxPathLength = MAXPATHLENGTH;				// path segments; see the "maxPathLength" setting
+	int rrDepth = 3;								// path length from which Russian roulette is applied; 0 disables it
+	float clampValue = 10.0f;						// max contribution of a single path sample
+	float geometryEpsilon = 0.0001f;				// ray origin offset
+	vector<float4> accumulator;						// accumulated samples
+	vector<float4> pixels;							// finalized pixels for the OpenGL target
+	vector<CoreMesh*> meshes;						// list of meshes, to be referenced by the instances
+	vector<CoreInstance*> instances;				// list of instances: model id plus transform
+	BVH4 topLevel;									// bvh over the instances; the entry point for ray queries
+	bool instancesDirty = true;						// the top-level bvh must be rebuilt
+	vector<Texture> textures;						// texel data
+	vector<Material> materials;						// decoded materials
+	vector<CoreLightTri> areaLights;				// area lights
+	vector<CorePointLight> pointLights;				// point lights
+	vector<CoreSpotLight> spotLights;				// spot lights
+	vector<CoreDirectionalLight> directionalLights;	// directional lights
+	vector<float3> skyPixels;						// skydome texture data
+public:
+	CoreStats coreStats;							// rendering statistics
+};
+
+} // namespace lh2core
+
+// EOF
@@ -0,0 +1,515 @@
+/* rendercore.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+#include "shaders.h"
+
+using namespace lh2core;
+
+// GL_ARB_bindless_texture is not part of glad; the entry points are fetched in Init
+typedef GLuint64( APIENTRY* GETTEXTUREHANDLEPROC )(GLuint texture);
+typedef void( APIENTRY* TEXTUREHANDLERESIDENCYPROC )(GLuint64 handle);
+static GETTEXTUREHANDLEPROC GetTextureHandle = 0;
+static TEXTUREHANDLERESIDENCYPROC MakeTextureHandleResident = 0;
+static TEXTUREHANDLERESIDENCYPROC MakeTextureHandleNonResident = 0;
+
+//  +-----------------------------------------------------------------------------+
+//  |  CompileShader / LinkProgram                                                |
+//  |  Helpers for the embedded shaders; the prefix holds the #version line and   |
+//  |  the defines.                                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+static GLuint CompileShader( const GLenum stage, const char* prefix, const char* source )
+{
+	const GLuint shader = glCreateShader( stage );
+	const char* text[2] = { prefix, source };
+	glShaderSource( shader, 2, text, 0 );
+	glCompileShader( shader );
+	CheckShader( shader, source, source );
+	return shader;
+}
+static GLuint LinkProgram( const GLuint* shaders, const int count )
+{
+	const GLuint program = glCreateProgram();
+	for (int i = 0; i < count; i++) glAttachShader( program, shaders[i] );
+	glLinkProgram( program );
+	CheckProgram( program, 0, 0 );
+	for (int i = 0; i < count; i++) glDetachShader( program, shaders[i] ), glDeleteShader( shaders[i] );
+	CheckGL();
+	return program;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FreeTexture                                                                |
+//  |  Release a texture and its bindless handle.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+static void FreeTexture( Texture& texture )
+{
+	if (texture.handle) MakeTextureHandleNonResident( texture.handle );
+	if (texture.ID) glDeleteTextures( 1, &texture.ID );
+	texture.handle = 0, texture.ID = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PersistentBuffer::Reserve                                                  |
+//  |  Grow the buffer to at least the requested size. Buffer storage is          |
+//  |  immutable, so a new buffer is created and the old contents are copied      |
+//  |  on the GPU.                                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+void PersistentBuffer::Reserve( const size_t bytes )
+{
+	if (bytes <= capacity) return;
+	const size_t newCapacity = max( bytes, capacity + (capacity >> 1) ); // grow by 50% to prevent frequent reallocs
+	const GLbitfield flags = access | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLuint newID;
+	glCreateBuffers( 1, &newID );
+	glNamedBufferStorage( newID, newCapacity, 0, flags );
+	uchar* newMapped = (uchar*)glMapNamedBufferRange( newID, 0, newCapacity, flags );
+	if (ID)
+	{
+		glCopyNamedBufferSubData( ID, newID, 0, 0, capacity );
+		glFinish(); // host writes to the new mapping must not be overwritten by the copy
+	}
+	Free();
+	ID = newID, mapped = newMapped, capacity = newCapacity;
+	CheckGL();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PersistentBuffer::Free                                                     |
+//  |  Unmap and delete the buffer.                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void PersistentBuffer::Free()
+{
+	if (!ID) return;
+	glUnmapNamedBuffer( ID );
+	glDeleteBuffers( 1, &ID );
+	ID = 0, mapped = 0, capacity = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetProbePos                                                    |
+//  |  Set the pixel for which the triid will be captured.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetProbePos( int2 pos )
+{
+	probePos = pos; // triangle id for this pixel will be stored in coreStats
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Init                                                           |
+//  |  Initialization.                                                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Init()
+{
+	coreStats.deviceName = _strdup( (const char*)glGetString( GL_RENDERER ) );
+	// bindless textures are an extension; without it, materials use the average color of their texture
+	GLint extensionCount = 0;
+	glGetIntegerv( GL_NUM_EXTENSIONS, &extensionCount );
+	for (int i = 0; i < extensionCount; i++)
+		if (!strcmp( (const char*)glGetStringi( GL_EXTENSIONS, i ), "GL_ARB_bindless_texture" )) bindless = true;
+	if (bindless)
+	{
+		GetTextureHandle = (GETTEXTUREHANDLEPROC)wglGetProcAddress( "glGetTextureHandleARB" );
+		MakeTextureHandleResident = (TEXTUREHANDLERESIDENCYPROC)wglGetProcAddress( "glMakeTextureHandleResidentARB" );
+		MakeTextureHandleNonResident = (TEXTUREHANDLERESIDENCYPROC)wglGetProcAddress( "glMakeTextureHandleNonResidentARB" );
+		bindless = GetTextureHandle && MakeTextureHandleResident && MakeTextureHandleNonResident;
+	}
+	// compile the shaders
+	char prefix[256];
+	sprintf_s( prefix, "#version 450\n#define CULLGROUPSIZE %i\n#define AMBIENT %f\n%s", CULLGROUPSIZE, AMBIENT, bindless ? "#define BINDLESS\n" : "" );
+	const GLuint cullShader = CompileShader( GL_COMPUTE_SHADER, prefix, cullSource );
+	cullProgram = LinkProgram( &cullShader, 1 );
+	const GLuint drawShaders[2] = { CompileShader( GL_VERTEX_SHADER, prefix, vertexSource ), CompileShader( GL_FRAGMENT_SHADER, prefix, fragmentSource ) };
+	drawProgram = LinkProgram( drawShaders, 2 );
+	// vertex format: binding 0 holds the vertices, binding 1 the instances, advanced once per instance
+	glCreateVertexArrays( 1, &vao );
+	for (int i = 0; i < 5; i++)
+	{
+		glEnableVertexArrayAttrib( vao, i );
+		glVertexArrayAttribFormat( vao, i, 4, GL_FLOAT, GL_FALSE, i < 2 ? i * 16 : (i - 2) * 16 );
+		glVertexArrayAttribBinding( vao, i, i < 2 ? 0 : 1 );
+	}
+	glEnableVertexArrayAttrib( vao, 5 );
+	glVertexArrayAttribIFormat( vao, 5, 1, GL_UNSIGNED_INT, offsetof( InstanceGL, index ) );
+	glVertexArrayAttribBinding( vao, 5, 1 );
+	glVertexArrayBindingDivisor( vao, 1, 1 );
+	// framebuffers, feedback and timing
+	glCreateFramebuffers( 1, &frameFBO );
+	glCreateFramebuffers( 1, &targetFBO );
+	feedback.Reserve( sizeof( FeedbackGL ) );
+	memset( feedback.mapped, 0, sizeof( FeedbackGL ) );
+	glCreateQueries( GL_TIME_ELAPSED, 1, &timerQuery );
+	CheckGL();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::WaitForFrame                                                   |
+//  |  Wait until the GPU is done with the last frame, so that the mapped         |
+//  |  buffers may be overwritten and the feedback of the frame be read.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::WaitForFrame()
+{
+	if (!frameFence) return;
+	while (glClientWaitSync( frameFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) == GL_TIMEOUT_EXPIRED);
+	glDeleteSync( frameFence );
+	frameFence = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ResizeFramebuffer                                              |
+//  |  (Re)create the attachments of the framebuffer that we render to.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::ResizeFramebuffer( const int width, const int height )
+{
+	if (colorTexture) glDeleteTextures( 1, &colorTexture ), glDeleteTextures( 1, &idTexture ), glDeleteTextures( 1, &depthTexture );
+	glCreateTextures( GL_TEXTURE_2D, 1, &colorTexture );
+	glCreateTextures( GL_TEXTURE_2D, 1, &idTexture );
+	glCreateTextures( GL_TEXTURE_2D, 1, &depthTexture );
+	glTextureStorage2D( colorTexture, 1, GL_RGBA8, width, height );
+	glTextureStorage2D( idTexture, 1, GL_RG32UI, width, height );
+	glTextureStorage2D( depthTexture, 1, GL_DEPTH_COMPONENT32F, width, height );
+	glNamedFramebufferTexture( frameFBO, GL_COLOR_ATTACHMENT0, colorTexture, 0 );
+	glNamedFramebufferTexture( frameFBO, GL_COLOR_ATTACHMENT1, idTexture, 0 );
+	glNamedFramebufferTexture( frameFBO, GL_DEPTH_ATTACHMENT, depthTexture, 0 );
+	const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glNamedFramebufferDrawBuffers( frameFBO, 2, drawBuffers );
+	fboWidth = width, fboHeight = height;
+	CheckGL();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTarget                                                      |
+//  |  Set the OpenGL texture that serves as the render target.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTarget( GLTexture* target, const uint spp )
+{
+	scrwidth = target->width;
+	scrheight = target->height;
+	targetTextureID = target->ID;
+	glNamedFramebufferTexture( targetFBO, GL_COLOR_ATTACHMENT0, targetTextureID, 0 );
+	if (scrwidth != fboWidth || scrheight != fboHeight) ResizeFramebuffer( scrwidth, scrheight );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetGeometry                                                    |
+//  |  Set the geometry data for a model.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags )
+{
+	// Note: for first-time setup, meshes are expected to be passed in sequential order.
+	// Subsequent mesh changes overwrite the vertex range of the mesh; a mesh that grows
+	// gets a new range at the end of the vertex buffer, and its old range is abandoned.
+	assert( vertexCount == 3 * triangleCount );
+	WaitForFrame();
+	if (meshIdx >= (int)meshes.size())
+	{
+		assert( meshIdx == meshes.size() );
+		meshes.push_back( Mesh() );
+		meshDescs.Reserve( meshes.size() * sizeof( MeshGL ) );
+	}
+	Mesh& mesh = meshes[meshIdx];
+	if (vertexCount > mesh.capacity)
+	{
+		mesh.firstVertex = vertexTop, mesh.capacity = vertexCount;
+		vertexTop += vertexCount;
+		vertices.Reserve( vertexTop * sizeof( VertexGL ) );
+		triMaterials.Reserve( vertexTop / 3 * sizeof( uint ) );
+	}
+	mesh.vertexCount = vertexCount;
+	// write the vertices straight into the mapped vertex buffer
+	VertexGL* vertex = vertices.As<VertexGL>() + mesh.firstVertex;
+	uint* material = triMaterials.As<uint>() + mesh.firstVertex / 3;
+	float3 bmin = make_float3( 1e34f ), bmax = -bmin;
+	for (int i = 0; i < triangleCount; i++)
+	{
+		const CoreTri& tri = triangles[i];
+		const float3 N[3] = { tri.vN0, tri.vN1, tri.vN2 };
+		const float u[3] = { tri.u0, tri.u1, tri.u2 }, v[3] = { tri.v0, tri.v1, tri.v2 };
+		for (int j = 0; j < 3; j++)
+		{
+			const float3 pos = make_float3( vertexData[i * 3 + j] );
+			VertexGL& target = vertex[i * 3 + j];
+			target.pos = pos, target.u = u[j], target.N = N[j], target.v = v[j];
+			bmin = fminf( bmin, pos ), bmax = fmaxf( bmax, pos );
+		}
+		material[i] = tri.material;
+	}
+	MeshGL& desc = meshDescs.As<MeshGL>()[meshIdx];
+	desc.bmin = bmin, desc.first = mesh.firstVertex;
+	desc.bmax = bmax, desc.count = vertexCount;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetInstance                                                    |
+//  |  Set instance details.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const mat4& matrix )
+{
+	// Note: for first-time setup, instances are expected to be passed in sequential order.
+	WaitForFrame();
+	if (instanceIdx >= instanceCount)
+	{
+		assert( instanceIdx == instanceCount );
+		instanceCount = instanceIdx + 1;
+		instanceData.Reserve( instanceCount * sizeof( InstanceGL ) );
+	}
+	InstanceGL& instance = instanceData.As<InstanceGL>()[instanceIdx];
+	for (int i = 0; i < 3; i++) instance.row[i] = make_float4( matrix.cell[i * 4 + 0], matrix.cell[i * 4 + 1], matrix.cell[i * 4 + 2], matrix.cell[i * 4 + 3] );
+	instance.mesh = meshIdx;
+	instance.index = instanceIdx;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTextures                                                    |
+//  |  Set the texture data. Textures get a full MIP chain; with bindless         |
+//  |  textures, each one is made resident once.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTextures( const CoreTexDesc* tex, const int textureCount )
+{
+	WaitForFrame(); // the last frame may still sample the textures we replace
+	while ((int)textures.size() > textureCount) FreeTexture( textures.back() ), textures.pop_back();
+	textures.resize( textureCount );
+	coreStats.argb32TexelCount = coreStats.argb128TexelCount = 0;
+	for (int i = 0; i < textureCount; i++)
+	{
+		Texture& t = textures[i];
+		const int w = tex[i].width, h = tex[i].height, texels = w * h;
+		const bool hdr = tex[i].storage == ARGB128;
+		if (hdr) coreStats.argb128TexelCount += texels; else coreStats.argb32TexelCount += texels;
+		if ((t.ID && !tex[i].changed) || texels == 0) continue;
+		FreeTexture( t );
+		int levels = 1;
+		while ((max( w, h ) >> levels) > 0) levels++;
+		glCreateTextures( GL_TEXTURE_2D, 1, &t.ID );
+		glTextureStorage2D( t.ID, levels, hdr ? GL_RGBA16F : GL_RGBA8, w, h );
+		glTextureSubImage2D( t.ID, 0, 0, 0, w, h, GL_RGBA, hdr ? GL_FLOAT : GL_UNSIGNED_BYTE, tex[i].idata );
+		glGenerateTextureMipmap( t.ID );
+		glTextureParameteri( t.ID, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+		glTextureParameteri( t.ID, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		if (bindless) t.handle = GetTextureHandle( t.ID ), MakeTextureHandleResident( t.handle );
+		// average color, for materials on drivers without bindless textures
+		float4 sum = make_float4( 0 );
+		if (hdr) for (int j = 0; j < texels; j++) sum += tex[i].fdata[j];
+		else for (int j = 0; j < texels; j++)
+		{
+			const uchar4 texel = tex[i].idata[j];
+			sum += make_float4( (float)texel.x, (float)texel.y, (float)texel.z, (float)texel.w ) * (1.0f / 256.0f);
+		}
+		t.average = sum * (1.0f / texels);
+		CheckGL();
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetMaterials                                                   |
+//  |  Set the material data.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount )
+{
+	WaitForFrame();
+	materialData.Reserve( max( 1, materialCount ) * sizeof( MaterialGL ) );
+	for (int i = 0; i < materialCount; i++)
+	{
+		// assemble the record on the stack; the mapped memory is write-only
+		const uint flags = mat[i].flags;
+		MaterialGL m = {};
+		m.diffuse = make_float4( (float)mat[i].diffuse_r, (float)mat[i].diffuse_g, (float)mat[i].diffuse_b, 1 );
+		m.uvTransform = make_float4( 1, 1, 0, 0 );
+	#ifndef NOTEXTURES
+		const int texID = matEx[i].texture[TEXTURE0];
+		if (MAT_HASDIFFUSEMAP && texID >= 0 && texID < (int)textures.size())
+		{
+			const Texture& t = textures[texID];
+			if (t.handle) m.texture[0] = (uint)t.handle, m.texture[1] = (uint)(t.handle >> 32);
+			else m.diffuse *= t.average;
+			m.uvTransform = make_float4( (float)mat[i].uscale0, (float)mat[i].vscale0, (float)mat[i].uoffs0, (float)mat[i].voffs0 );
+		}
+	#endif
+		materialData.As<MaterialGL>()[i] = m;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLights                                                      |
+//  |  Set the light data.                                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLights( const CoreLightTri* areaLights, const int areaLightCount,
+	const CorePointLight* pointLights, const int pointLightCount,
+	const CoreSpotLight* spotLights, const int spotLightCount,
+	const CoreDirectionalLight* directionalLights, const int directionalLightCount )
+{
+	// not used: the preview is lit by a headlight
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetSkyData                                                     |
+//  |  Set the sky dome data. Only its average is used, as the background.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetSkyData( const float3* pixels, const uint width, const uint height )
+{
+	float3 sum = make_float3( 0 );
+	for (uint i = 0; i < width * height; i++) sum += pixels[i];
+	skyAverage = sum * (1.0f / max( 1u, width * height ));
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Setting                                                        |
+//  |  Modify a render setting.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Setting( const char* name, const float value )
+{
+	if (!strcmp( name, "frustumCulling" ))
+	{
+		frustumCulling = value != 0;
+	}
+	else if (!strcmp( name, "nearPlane" ))
+	{
+		nearPlane = max( 1e-5f, value );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Render                                                         |
+//  |  Produce one image: cull the instances on the GPU, draw the survivors with  |
+//  |  one multi-draw call, and copy the result to the target texture.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast )
+{
+	// statistics and picking results of the previous frame
+	WaitForFrame();
+	FeedbackGL* results = feedback.As<FeedbackGL>();
+	coreStats.culledMeshes = results->culled;
+	coreStats.probedInstid = (int)results->probedInstid;
+	coreStats.probedTriid = (int)results->probedTriid;
+	coreStats.probedDist = results->probedDepth > 0 ? probeDistScale / results->probedDepth : 1e34f;
+	if (timerPending)
+	{
+		GLuint64 nanoseconds;
+		glGetQueryObjectui64v( timerQuery, GL_QUERY_RESULT, &nanoseconds );
+		coreStats.renderTime = nanoseconds * 1e-9f;
+	}
+	results->culled = 0;
+	// camera: reversed-z projection with an infinite far plane; depth is nearPlane over the distance along F
+	const float3 right = view.p2 - view.p1, up = view.p1 - view.p3, C = 0.5f * (view.p2 + view.p3);
+	const float3 X = normalize( right ), Y = normalize( up ), F = normalize( C - view.pos );
+	const float d = dot( C - view.pos, F ), sx = 2 * d / length( right ), sy = 2 * d / length( up );
+	mat4 viewProj = mat4::ZeroMatrix();
+	viewProj[0] = sx * X.x, viewProj[1] = sx * X.y, viewProj[2] = sx * X.z, viewProj[3] = -sx * dot( X, view.pos );
+	viewProj[4] = sy * Y.x, viewProj[5] = sy * Y.y, viewProj[6] = sy * Y.z, viewProj[7] = -sy * dot( Y, view.pos );
+	viewProj[11] = nearPlane;
+	viewProj[12] = F.x, viewProj[13] = F.y, viewProj[14] = F.z, viewProj[15] = -dot( F, view.pos );
+	glBeginQuery( GL_TIME_ELAPSED, timerQuery );
+	if (instanceCount > 0)
+	{
+		// one indirect draw command per instance
+		if (instanceCount > commandCapacity)
+		{
+			glDeleteBuffers( 1, &commandBuffer );
+			commandCapacity = instanceCount + (instanceCount >> 1);
+			glCreateBuffers( 1, &commandBuffer );
+			glNamedBufferStorage( commandBuffer, commandCapacity * 4 * sizeof( uint ), 0, 0 );
+		}
+		// frustum culling
+		glUseProgram( cullProgram );
+		glUniformMatrix4fv( glGetUniformLocation( cullProgram, "viewProj" ), 1, GL_TRUE, viewProj.cell );
+		glUniform1ui( glGetUniformLocation( cullProgram, "instanceCount" ), instanceCount );
+		glUniform1f( glGetUniformLocation( cullProgram, "nearPlane" ), nearPlane );
+		glUniform1i( glGetUniformLocation( cullProgram, "frustumCulling" ), frustumCulling ? 1 : 0 );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, instanceData.ID );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, meshDescs.ID );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 2, commandBuffer );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 3, feedback.ID );
+		glDispatchCompute( (instanceCount + CULLGROUPSIZE - 1) / CULLGROUPSIZE, 1, 1 );
+		glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT );
+	}
+	// draw into our own framebuffer; the GL state we touch is restored afterwards
+	GLint viewport[4];
+	glGetIntegerv( GL_VIEWPORT, viewport );
+	glBindFramebuffer( GL_FRAMEBUFFER, frameFBO );
+	glViewport( 0, 0, scrwidth, scrheight );
+	const float contrastFactor = (259.0f * (contrast * 256.0f + 255.0f)) / (255.0f * (259.0f - 256.0f * contrast));
+	const float3 bg = skyAverage;
+	const float background[4] = {
+		sqrtf( max( 0.0f, (bg.x - 0.5f) * contrastFactor + 0.5f + brightness ) ),
+		sqrtf( max( 0.0f, (bg.y - 0.5f) * contrastFactor + 0.5f + brightness ) ),
+		sqrtf( max( 0.0f, (bg.z - 0.5f) * contrastFactor + 0.5f + brightness ) ), 1 };
+	const GLuint noIds[4] = { ~0u, ~0u, 0, 0 };
+	const float farDepth = 0;
+	glClearNamedFramebufferfv( frameFBO, GL_COLOR, 0, background );
+	glClearNamedFramebufferuiv( frameFBO, GL_COLOR, 1, noIds );
+	glClearNamedFramebufferfv( frameFBO, GL_DEPTH, 0, &farDepth );
+	if (instanceCount > 0)
+	{
+		glEnable( GL_DEPTH_TEST );
+		glDepthFunc( GL_GREATER );
+		glClipControl( GL_LOWER_LEFT, GL_ZERO_TO_ONE );
+		glUseProgram( drawProgram );
+		glUniformMatrix4fv( glGetUniformLocation( drawProgram, "viewProj" ), 1, GL_TRUE, viewProj.cell );
+		glUniform3f( glGetUniformLocation( drawProgram, "eye" ), view.pos.x, view.pos.y, view.pos.z );
+		glUniform1f( glGetUniformLocation( drawProgram, "brightness" ), brightness );
+		glUniform1f( glGetUniformLocation( drawProgram, "contrastFactor" ), contrastFactor );
+		glVertexArrayVertexBuffer( vao, 0, vertices.ID, 0, sizeof( VertexGL ) );
+		glVertexArrayVertexBuffer( vao, 1, instanceData.ID, 0, sizeof( InstanceGL ) );
+		glBindVertexArray( vao );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 4, triMaterials.ID );
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 5, materialData.ID );
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, commandBuffer );
+		glMultiDrawArraysIndirect( GL_TRIANGLES, 0, instanceCount, 0 );
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+		glBindVertexArray( 0 );
+		glUseProgram( 0 );
+		glClipControl( GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE );
+		glDepthFunc( GL_LESS );
+		glDisable( GL_DEPTH_TEST );
+	}
+	// picking: copy the ids and depth under the probe into the feedback buffer, read in the next frame
+	const int px = clamp( probePos.x, 0, scrwidth - 1 ), py = clamp( probePos.y, 0, scrheight - 1 );
+	const float3 D = view.p1 + ((px + 0.5f) / scrwidth) * right - ((py + 0.5f) / scrheight) * up - view.pos;
+	probeDistScale = nearPlane * length( D ) / dot( D, F );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, feedback.ID );
+	glNamedFramebufferReadBuffer( frameFBO, GL_COLOR_ATTACHMENT1 );
+	glReadPixels( px, scrheight - 1 - py, 1, 1, GL_RG_INTEGER, GL_UNSIGNED_INT, (void*)offsetof( FeedbackGL, probedInstid ) );
+	glReadPixels( px, scrheight - 1 - py, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)offsetof( FeedbackGL, probedDepth ) );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	glNamedFramebufferReadBuffer( frameFBO, GL_COLOR_ATTACHMENT0 );
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+	// copy to the target texture, flipped: its first row is the top of the image
+	glBlitNamedFramebuffer( frameFBO, targetFBO, 0, 0, scrwidth, scrheight, 0, scrheight, scrwidth, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST );
+	glEndQuery( GL_TIME_ELAPSED );
+	timerPending = true;
+	frameFence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	CheckGL();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Shutdown                                                       |
+//  |  Free all resources.                                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Shutdown()
+{
+	WaitForFrame();
+	for (Texture& t : textures) FreeTexture( t );
+	textures.clear();
+	vertices.Free(), triMaterials.Free(), meshDescs.Free(), instanceData.Free(), materialData.Free(), feedback.Free();
+	glDeleteBuffers( 1, &commandBuffer );
+	glDeleteTextures( 1, &colorTexture ), glDeleteTextures( 1, &idTexture ), glDeleteTextures( 1, &depthTexture );
+	glDeleteFramebuffers( 1, &frameFBO ), glDeleteFramebuffers( 1, &targetFBO );
+	glDeleteVertexArrays( 1, &vao );
+	glDeleteProgram( cullProgram ), glDeleteProgram( drawProgram );
+	glDeleteQueries( 1, &timerQuery );
+}
+
+// EOF
@@ -0,0 +1,173 @@
+/* rendercore.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+//  +-----------------------------------------------------------------------------+
+//  |  PersistentBuffer                                                           |
+//  |  OpenGL buffer that stays mapped into host memory for its lifetime.         |
+//  |  The mapping is coherent: host writes need no flush, but the GPU must be    |
+//  |  done with the previous frame, see RenderCore::WaitForFrame.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+class PersistentBuffer
+{
+public:
+	PersistentBuffer( const GLbitfield access = GL_MAP_WRITE_BIT ) : access( access ) {}
+	~PersistentBuffer() { Free(); }
+	void Reserve( const size_t bytes );		// grow the buffer, keeping its contents
+	void Free();
+	template <class T> T* As() { return (T*)mapped; }
+	GLuint ID = 0;
+	uchar* mapped = 0;
+	size_t capacity = 0;
+	GLbitfield access;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  VertexGL, MeshGL, InstanceGL, MaterialGL, FeedbackGL                       |
+//  |  Layout of the GPU-side data; must match the std430 structs in shaders.h.   |
+//  |  Meshes are ranges of non-indexed vertices in one shared vertex buffer.     |
+//  |  An instance stores the top three rows of its transform.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct VertexGL
+{
+	float3 pos; float u;
+	float3 N; float v;
+};
+struct MeshGL
+{
+	float3 bmin; uint first;				// object space bounds; first vertex in the vertex buffer
+	float3 bmax; uint count;				// number of vertices
+};
+struct InstanceGL
+{
+	float4 row[3];							// transform, row major
+	uint mesh, index, dummy0, dummy1;		// index is for the vertex shader, as an instanced attribute
+};
+struct MaterialGL
+{
+	float4 diffuse;							// rgb: diffuse color
+	uint texture[2], dummy0, dummy1;		// bindless handle of the diffuse map, or 0
+	float4 uvTransform;						// xy: scale, zw: offset
+};
+struct FeedbackGL
+{
+	uint culled;							// instances rejected by the frustum culling shader
+	uint probedInstid, probedTriid;			// ids at the probe position
+	float probedDepth;						// depth buffer value at the probe position
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Mesh                                                                       |
+//  |  Host-side bookkeeping of the vertex range of a mesh.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct Mesh
+{
+	int firstVertex = 0;					// first vertex in RenderCore::vertices
+	int vertexCount = 0;					// vertices in use
+	int capacity = 0;						// vertices reserved for this mesh
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  Texture                                                                    |
+//  |  An OpenGL texture, with its bindless handle.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct Texture
+{
+	GLuint ID = 0;
+	GLuint64 handle = 0;					// resident bindless handle, or 0
+	float4 average = make_float4( 1 );		// average color; replaces the texture without bindless support
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore                                                                 |
+//  |  Hardware rasterizer for interactive previews. Geometry, instances and      |
+//  |  materials live in persistently mapped buffers; a compute shader culls the  |
+//  |  instances against the view frustum and writes one indirect draw per        |
+//  |  instance, so a frame is a single multi-draw call.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+class RenderCore
+{
+public:
+	// methods
+	void Init();
+	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast );
+	void Setting( const char* name, const float value );
+	void SetTarget( GLTexture* target, const uint spp );
+	void Shutdown();
+	void KeyDown( const uint key ) {}
+	void KeyUp( const uint key ) {}
+	// passing data. Note: RenderCore always copies what it needs; the passed data thus remains the
+	// property of the caller, and can be safely deleted or modified as soon as these calls return.
+	void SetTextures( const CoreTexDesc* tex, const int textureCount );
+	void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount ); // textures must be in sync when calling this
+	void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
+		const CorePointLight* pointLights, const int pointLightCount,
+		const CoreSpotLight* spotLights, const int spotLightCount,
+		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	void SetSkyData( const float3* pixels, const uint width, const uint height );
+	// geometry and instances:
+	// a scene is setup by first passing a number of meshes (geometry), then a number of instances.
+	// note that stored meshes can be used zero, one or multiple times in the scene.
+	// also note that, when using alpha flags, materials must be in sync.
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
+	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
+	void UpdateToplevel() { /* nothing here for a rasterizer */ }
+	void SetProbePos( const int2 pos );
+	// internal methods
+private:
+	void WaitForFrame();
+	void ResizeFramebuffer( const int width, const int height );
+	// data members
+	int scrwidth = 0, scrheight = 0;				// current screen width and height
+	GLuint targetTextureID = 0;						// ID of the target OpenGL texture
+	GLuint targetFBO = 0;							// framebuffer with the target texture as its color attachment
+	GLuint frameFBO = 0;							// framebuffer that is rendered to
+	GLuint colorTexture = 0, idTexture = 0, depthTexture = 0;	// attachments of frameFBO; idTexture holds instance and triangle ids
+	int fboWidth = 0, fboHeight = 0;				// size of the attachments of frameFBO
+	GLuint cullProgram = 0;							// frustum culling compute shader
+	GLuint drawProgram = 0;							// vertex and fragment shader
+	GLuint vao = 0;									// vertex format; the buffers are bound per frame
+	GLuint commandBuffer = 0;						// DrawArraysIndirectCommand per instance, written by cullProgram
+	int commandCapacity = 0;						// size of commandBuffer, in commands
+	GLsync frameFence = 0;							// signaled when the GPU is done with the last frame
+	GLuint timerQuery = 0;							// GPU time of the last frame, read after WaitForFrame
+	bool timerPending = false;						// timerQuery holds a result of an earlier frame
+	PersistentBuffer vertices;						// VertexGL records of all meshes
+	PersistentBuffer triMaterials;					// material index per triangle of the vertex buffer
+	PersistentBuffer meshDescs;						// MeshGL per mesh
+	PersistentBuffer instanceData;					// InstanceGL per instance
+	PersistentBuffer materialData;					// MaterialGL per material
+	PersistentBuffer feedback = PersistentBuffer( GL_MAP_READ_BIT | GL_MAP_WRITE_BIT ); // FeedbackGL, read after WaitForFrame
+	int vertexTop = 0;								// first unused vertex in the vertex buffer
+	int instanceCount = 0;							// number of instances
+	bool bindless = false;							// GL_ARB_bindless_texture is available
+	bool frustumCulling = true;						// see the "frustumCulling" setting
+	float nearPlane = NEARPLANE;					// see the "nearPlane" setting
+	float3 skyAverage = make_float3( 0 );			// background color
+	int2 probePos = make_int2( 0 );					// triangle picking; ids of this pixel are copied to coreStats
+	float probeDistScale = 0;						// converts the depth at the probe position to a distance
+	vector<Mesh> meshes;							// vertex ranges; the bounds are in meshDescs
+	vector<Texture> textures;						// textures and their bindless handles
+public:
+	CoreStats coreStats;							// rendering statistics
+};
+
+} // namespace lh2core
+
+// EOF
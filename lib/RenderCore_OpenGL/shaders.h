@@ -0,0 +1,115 @@
+/* shaders.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   GLSL sources of the OpenGL core. RenderCore::Init prefixes each of them
+   with the #version line and the defines (CULLGROUPSIZE, AMBIENT and, with
+   GL_ARB_bindless_texture, BINDLESS). The structs must match the ones in
+   rendercore.h; the buffer bindings are those used by RenderCore::Render.
+*/
+
+#pragma once
+
+// frustum culling: one thread per instance; culled instances get a draw with zero instances
+static const char* cullSource = R"(
+layout( local_size_x = CULLGROUPSIZE ) in;
+struct Instance { vec4 row[3]; uint mesh, index, dummy0, dummy1; };
+struct Mesh { vec3 bmin; uint first; vec3 bmax; uint count; };
+struct Command { uint count, instanceCount, first, baseInstance; };
+layout( std430, binding = 0 ) readonly buffer Instances { Instance instance[]; };
+layout( std430, binding = 1 ) readonly buffer Meshes { Mesh mesh[]; };
+layout( std430, binding = 2 ) writeonly buffer Commands { Command command[]; };
+layout( std430, binding = 3 ) buffer Feedback { uint culled; };
+uniform mat4 viewProj;
+uniform uint instanceCount;
+uniform float nearPlane;
+uniform bool frustumCulling;
+void main()
+{
+	const uint i = gl_GlobalInvocationID.x;
+	if (i >= instanceCount) return;
+	const Instance inst = instance[i];
+	const Mesh m = mesh[inst.mesh];
+	bool visible = m.count > 0u;
+	if (visible && frustumCulling)
+	{
+		// reject if all corners of the bounds are outside the same clip plane
+		const mat4 M = viewProj * transpose( mat4( inst.row[0], inst.row[1], inst.row[2], vec4( 0, 0, 0, 1 ) ) );
+		uint outside = 31u;
+		for (int c = 0; c < 8; c++)
+		{
+			const vec4 q = M * vec4( mix( m.bmin, m.bmax, vec3( c & 1, (c >> 1) & 1, c >> 2 ) ), 1 );
+			outside &= (q.x < -q.w ? 1u : 0u) | (q.x > q.w ? 2u : 0u) | (q.y < -q.w ? 4u : 0u) | (q.y > q.w ? 8u : 0u) | (q.w < nearPlane ? 16u : 0u);
+		}
+		visible = outside == 0u;
+	}
+	command[i] = Command( m.count, visible ? 1u : 0u, m.first, i );
+	if (!visible) atomicAdd( culled, 1u );
+}
+)";
+
+// vertex shader; the instance transform and index are instanced attributes, see RenderCore::Init
+static const char* vertexSource = R"(
+layout( location = 0 ) in vec4 posU;
+layout( location = 1 ) in vec4 normV;
+layout( location = 2 ) in vec4 row0;
+layout( location = 3 ) in vec4 row1;
+layout( location = 4 ) in vec4 row2;
+layout( location = 5 ) in uint instanceIdx;
+layout( std430, binding = 4 ) readonly buffer TriMaterials { uint triMaterial[]; };
+uniform mat4 viewProj;
+uniform vec3 eye;
+out vec3 N, V;
+out vec2 uv;
+flat out uint material, instid;
+void main()
+{
+	const vec4 P = vec4( posU.xyz, 1 );
+	const vec3 W = vec3( dot( row0, P ), dot( row1, P ), dot( row2, P ) );
+	N = vec3( dot( row0.xyz, normV.xyz ), dot( row1.xyz, normV.xyz ), dot( row2.xyz, normV.xyz ) );
+	V = eye - W;
+	uv = vec2( posU.w, normV.w );
+	material = triMaterial[gl_VertexID / 3]; // gl_VertexID includes the first vertex of the draw
+	instid = instanceIdx;
+	gl_Position = viewProj * vec4( W, 1 );
+}
+)";
+
+// fragment shader: headlight shading, finalized as in the path tracers
+static const char* fragmentSource = R"(
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+struct Material { vec4 diffuse; uvec2 texture; uint dummy0, dummy1; vec4 uvTransform; };
+layout( std430, binding = 5 ) readonly buffer Materials { Material materials[]; };
+uniform float brightness, contrastFactor;
+in vec3 N, V;
+in vec2 uv;
+flat in uint material, instid;
+layout( location = 0 ) out vec4 color;
+layout( location = 1 ) out uvec2 ids;
+void main()
+{
+	const Material m = materials[material];
+	vec3 albedo = m.diffuse.rgb;
+#ifdef BINDLESS
+	// the handle varies per triangle; fine on hardware that supports bindless textures at all
+	if (m.texture != uvec2( 0 )) albedo *= texture( sampler2D( m.texture ), uv * m.uvTransform.xy + m.uvTransform.zw ).rgb;
+#endif
+	const vec3 value = albedo * (AMBIENT + (1 - AMBIENT) * abs( dot( normalize( N ), normalize( V ) ) ));
+	color = vec4( sqrt( max( vec3( 0 ), (value - 0.5) * contrastFactor + 0.5 + brightness ) ), 1 );
+	ids = uvec2( instid, gl_PrimitiveID );
+}
+)";
+
+// EOF
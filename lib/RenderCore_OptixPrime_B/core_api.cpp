@@ -71,6 +71,21 @@ void CoreAPI::Render( const ViewPyramid& view, const Convergence converge, const
 	core->Render( view, converge, brightness, contrast );
 }
 
+bool CoreAPI::RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, const Convergence converge, const float brightness, const float contrast )
+{
+	return core->RenderViews( views, targets, count, converge, brightness, contrast );
+}
+
+bool CoreAPI::BakeViews( const ViewPyramid* views, const int count, const int w, const int h, const uint spp, float4* pixels )
+{
+	return core->BakeViews( views, count, w, h, spp, pixels );
+}
+
+bool CoreAPI::BakeTexels( const float4* texels, const int count, const uint spp, float4* radiance )
+{
+	return core->BakeTexels( texels, count, spp, radiance );
+}
+
 void CoreAPI::Shutdown()
 {
 	core->Shutdown();
@@ -99,12 +114,22 @@ void CoreAPI::SetLights( const CoreLightTri* areaLights, const int areaLightCoun
 		directionalLights, directionalLightCount );
 }
 
+void CoreAPI::SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount )
+{
+	core->SetLightTree( nodes, nodeCount );
+}
+
+void CoreAPI::SetLightAliasTable( const CoreLightAlias* table, const int count )
+{
+	core->SetLightAliasTable( table, count );
+}
+
 void CoreAPI::SetSkyData( const float3* pixels, const uint width, const uint height )
 {
 	core->SetSkyData( pixels, width, height );
 }
 
-void CoreAPI::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags )
+void CoreAPI::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint )
 {
 	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags );
 }
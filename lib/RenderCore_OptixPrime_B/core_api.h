@@ -36,6 +36,12 @@ public:
 	void Setting( const char* name, float value );
 	// Render: produce one frame. Convergence can be 'Converge' or 'Restart'.
 	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast );
+	// BakeViews: converge the views to host memory, without finalizing.
+	bool BakeViews( const ViewPyramid* views, const int count, const int w, const int h, const uint spp, float4* pixels );
+	// BakeTexels: converge the radiance of lightmap texels to host memory.
+	bool BakeTexels( const float4* texels, const int count, const uint spp, float4* radiance );
+	// RenderViews: produce one frame for each of the views, finalized to the target of the view.
+	bool RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, const Convergence converge, const float brightness, const float contrast );
 	// Shutdown: destroy the RenderCore and free all resources.
 	void Shutdown();
 	// SetTextures: update the texture data in the RenderCore using the supplied data.
@@ -47,10 +53,14 @@ public:
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	// SetLightTree: update the light tree over the area, point and spot lights.
+	void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount );
+	// SetLightAliasTable: update the alias table for power-proportional light selection.
+	void SetLightAliasTable( const CoreLightAlias* table, const int count );
 	// SetSkyData: specify the data required for sky dome rendering.
 	void SetSkyData( const float3* pixels, const uint width, const uint height );
 	// SetGeometry: update the geometry for a single mesh.
-	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
 	// SetInstance: update the data on a single instance.
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
 	// UpdateTopLevel: trigger a top-level BVH update.
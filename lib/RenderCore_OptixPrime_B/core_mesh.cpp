@@ -40,18 +40,27 @@ static bool ConsistentExponents( const float4& ref, const float4& A, const float
 //  +-----------------------------------------------------------------------------+
 CoreMesh::~CoreMesh()
 {
+	if (building >= 0) rtpModelFinish( models[building] );
 	delete triangles;
-	rtpBufferDescDestroy( indicesDesc );
-	rtpBufferDescDestroy( verticesDesc );
-	rtpModelDestroy( model );
+	delete[] indexData;
+	for (int i = 0; i < 2; i++)
+	{
+		delete[] vertex3Data[i];
+		if (verticesDesc[i]) rtpBufferDescDestroy( verticesDesc[i] );
+		if (models[i]) rtpModelDestroy( models[i] );
+	}
+	if (indicesDesc) rtpBufferDescDestroy( indicesDesc );
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  CoreMesh::SetGeometry                                                      |
-//  |  Set the geometry data.                                               LH2'19|
+//  |  Set the geometry data. The model is built asynchronously; the model that   |
+//  |  the top level uses stays valid until FinishUpdate.                   LH2'19|
 //  +-----------------------------------------------------------------------------+
 void CoreMesh::SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags )
 {
+	// an earlier build that was not picked up by FinishUpdate still reads the host buffers
+	if (building >= 0) CHK_PRIME( rtpModelFinish( models[building] ) );
 	// copy triangle data to GPU
 	bool reallocate = (triangles == 0);
 	if (triangles) if (triCount > triangles->GetSize()) reallocate = true;
@@ -60,27 +69,47 @@ void CoreMesh::SetGeometry( const float4* vertexData, const int vertexCount, con
 		delete triangles;
 		triangles = new CoreBuffer<CoreTri4>( triCount, ON_DEVICE, tris );
 		// create dummy index data
-		delete indexData;
+		delete[] indexData;
 		indexData = new uint3[triCount];
 		for( int i = 0; i < triCount; i++ ) indexData[i] = make_uint3( i * 3 + 0, i * 3 + 1, i * 3 + 2 );
-		// create float3 vertex data
-		delete vertex3Data;
-		vertex3Data = new float3[vertexCount];
-		// create OptiX geometry buffers
+		// create OptiX geometry buffers; the float3 vertex data is per model
+		if (indicesDesc) rtpBufferDescDestroy( indicesDesc );
 		CHK_PRIME( rtpBufferDescCreate( RenderCore::context, RTP_BUFFER_FORMAT_INDICES_INT3, RTP_BUFFER_TYPE_HOST, indexData, &indicesDesc ) );
-		CHK_PRIME( rtpBufferDescCreate( RenderCore::context, RTP_BUFFER_FORMAT_VERTEX_FLOAT3, RTP_BUFFER_TYPE_HOST, vertex3Data, &verticesDesc ) );
 		CHK_PRIME( rtpBufferDescSetRange( indicesDesc, 0, triCount ) );
-		CHK_PRIME( rtpBufferDescSetRange( verticesDesc, 0, vertexCount ) );
-		// create model
-		CHK_PRIME( rtpModelCreate( RenderCore::context, &model ) );
+		for (int i = 0; i < 2; i++)
+		{
+			delete[] vertex3Data[i];
+			vertex3Data[i] = new float3[vertexCount];
+			if (verticesDesc[i]) rtpBufferDescDestroy( verticesDesc[i] );
+			CHK_PRIME( rtpBufferDescCreate( RenderCore::context, RTP_BUFFER_FORMAT_VERTEX_FLOAT3, RTP_BUFFER_TYPE_HOST, vertex3Data[i], &verticesDesc[i] ) );
+			CHK_PRIME( rtpBufferDescSetRange( verticesDesc[i], 0, vertexCount ) );
+		}
+		// create models
+		if (!models[0]) for (int i = 0; i < 2; i++) CHK_PRIME( rtpModelCreate( RenderCore::context, &models[i] ) );
 	}
+	// build the model that the top level does not use
+	building = current == 0 ? 1 : 0;
 	// copy new vertex positions and normals
-	for( int i = 0; i < vertexCount; i++ ) vertex3Data[i] = make_float3( vertexData[i] );
+	float3* vertices = vertex3Data[building];
+	for( int i = 0; i < vertexCount; i++ ) vertices[i] = make_float3( vertexData[i] );
 	triangles->SetHostData( (CoreTri4*)tris );
 	triangles->CopyToDevice();
-	// update accstruc
-	CHK_PRIME( rtpModelSetTriangles( model, indicesDesc, verticesDesc ) );
-	CHK_PRIME( rtpModelUpdate( model, RTP_MODEL_HINT_NONE /* blocking; try RTP_MODEL_HINT_ASYNC + rtpModelFinish for async version. */ ) );
+	// update accstruc; the host continues with the next mesh while OptiX builds
+	CHK_PRIME( rtpModelSetTriangles( models[building], indicesDesc, verticesDesc[building] ) );
+	CHK_PRIME( rtpModelUpdate( models[building], RTP_MODEL_HINT_ASYNC ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::FinishUpdate                                                     |
+//  |  Wait for the asynchronous build of SetGeometry, and hand the new model to  |
+//  |  the top level. The old model is rebuilt by the next SetGeometry.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::FinishUpdate()
+{
+	if (building < 0) return;
+	CHK_PRIME( rtpModelFinish( models[building] ) );
+	current = building, building = -1;
+	model = models[current];
 }
 
 // EOF
\ No newline at end of file
@@ -22,7 +22,10 @@ namespace lh2core
 //  |  CoreMesh                                                                   |
 //  |  Container for geometry data. Actual data resides on device:                |
 //  |  - indicesDesc and verticesDesc describe on-device OptiX buffers;           |
-//  |  - triangles contains the fully equiped triangle data.                LH2'19|
+//  |  - triangles contains the fully equiped triangle data.                      |
+//  |  The OptiX model is double buffered: SetGeometry builds the model that the  |
+//  |  top level does not use, asynchronously; FinishUpdate waits for the build   |
+//  |  and swaps the models, see RenderCore::UpdateToplevel.                LH2'19|
 //  +-----------------------------------------------------------------------------+
 class RenderCore;
 class CoreMesh
@@ -33,12 +36,16 @@ public:
 	CoreMesh::~CoreMesh();
 	// methods
 	void SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags = 0 );
+	void FinishUpdate();
 	// data
 	CoreBuffer<CoreTri4>* triangles = 0;		// original triangle data, as received from RenderSystem
 	uint3* indexData = 0;					// dummy index data; simply increasing numbers
-	float3* vertex3Data = 0;				// vertex data in float3 format
-	RTPmodel model;							// model descriptor
-	RTPbufferdesc indicesDesc, verticesDesc; // OptiX buffer descriptors
+	float3* vertex3Data[2] = {};			// vertex data in float3 format, per model; read by the asynchronous build
+	RTPmodel models[2] = {};				// model descriptors; one is used by the top level, the other one is rebuilt
+	RTPmodel model = 0;						// the finished model that the top level uses
+	int current = -1;						// index of model in models, -1 before the first FinishUpdate
+	int building = -1;						// index of the model with an unfinished asynchronous build, or -1
+	RTPbufferdesc indicesDesc = 0, verticesDesc[2] = {}; // OptiX buffer descriptors
 	static RenderCore* renderCore;			// for access to material list, in case of alpha mapped triangles
 };
 
@@ -27,6 +27,7 @@
 // #define USE_MULTISCATTER_BSDF // override default microfacet model
 // #define GGXCONDUCTOR // alternative is the diffuse ggx brdf
 #define SINGLEBOUNCE		// perform only a single diffuse bounce
+#define ADAPTIVEMINFRAMES	4	// adaptive sampling: frames a pixel is sampled before it may converge
 #define CONSISTENTNORMALS	// consistent normal interpolation; don't use with filtering?
 
 // low-level settings
@@ -113,6 +114,9 @@ struct Ray { float3 O; float tmin; float3 D; float tmax; };
 struct Ray4 { float4 O4, D4; };
 struct Intersection { float t; int triid, instid; float u, v; };
 
+// camera of a single view for generateEyeRays; RenderViews passes one per view
+struct EyeView { float3 pos, right, up, p1; float aperture; };
+
 #ifndef __CUDACC__
 
 #include "core_api_base.h"
@@ -24,13 +24,16 @@ __constant__ CoreLightTri* areaLights;
 __constant__ CorePointLight* pointLights;
 __constant__ CoreSpotLight* spotLights;
 __constant__ CoreDirectionalLight* directionalLights;
+__constant__ CoreLightTreeNode* lightTree;
+__constant__ CoreLightAlias* lightAlias;
 __constant__ int4 lightCounts; // area, point, spot, directional
 __constant__ uint* argb32;
 __constant__ float4* argb128;
 __constant__ uint* nrm32;
-__constant__ float3* skyPixels;
+__constant__ uint2* skyPixels;			// half precision rgb pyramid, see SampleSkydome
 __constant__ int skywidth;
 __constant__ int skyheight;
+__constant__ int skyLevels;
 __constant__ float4* debugData;
 
 // path tracer settings
@@ -44,6 +47,8 @@ __host__ void SetAreaLights( CoreLightTri* p ) { cudaMemcpyToSymbol( areaLights,
 __host__ void SetPointLights( CorePointLight* p ) { cudaMemcpyToSymbol( pointLights, &p, sizeof( void* ) ); }
 __host__ void SetSpotLights( CoreSpotLight* p ) { cudaMemcpyToSymbol( spotLights, &p, sizeof( void* ) ); }
 __host__ void SetDirectionalLights( CoreDirectionalLight* p ) { cudaMemcpyToSymbol( directionalLights, &p, sizeof( void* ) ); }
+__host__ void SetLightTreeNodes( CoreLightTreeNode* p ) { cudaMemcpyToSymbol( lightTree, &p, sizeof( void* ) ); }
+__host__ void SetLightAliasEntries( CoreLightAlias* p ) { cudaMemcpyToSymbol( lightAlias, &p, sizeof( void* ) ); }
 __host__ void SetLightCounts( int area, int point, int spot, int directional )
 {
 	const int4 counts = make_int4( area, point, spot, directional );
@@ -52,8 +57,13 @@ __host__ void SetLightCounts( int area, int point, int spot, int directional )
 __host__ void SetARGB32Pixels( uint* p ) { cudaMemcpyToSymbol( argb32, &p, sizeof( void* ) ); }
 __host__ void SetARGB128Pixels( float4* p ) { cudaMemcpyToSymbol( argb128, &p, sizeof( void* ) ); }
 __host__ void SetNRM32Pixels( uint* p ) { cudaMemcpyToSymbol( nrm32, &p, sizeof( void* ) ); }
-__host__ void SetSkyPixels( float3* p ) { cudaMemcpyToSymbol( skyPixels, &p, sizeof( void* ) ); }
-__host__ void SetSkySize( int w, int h ) { cudaMemcpyToSymbol( skywidth, &w, sizeof( int ) ); cudaMemcpyToSymbol( skyheight, &h, sizeof( int ) ); }
+__host__ void SetSkyPixels( uint2* p ) { cudaMemcpyToSymbol( skyPixels, &p, sizeof( void* ) ); }
+__host__ void SetSkySize( int w, int h, int levels )
+{
+	cudaMemcpyToSymbol( skywidth, &w, sizeof( int ) );
+	cudaMemcpyToSymbol( skyheight, &h, sizeof( int ) );
+	cudaMemcpyToSymbol( skyLevels, &levels, sizeof( int ) );
+}
 __host__ void SetDebugData( float4* p ) { cudaMemcpyToSymbol( debugData, &p, sizeof( void* ) ); }
 
 // access
@@ -87,6 +97,7 @@ __host__ void SetCounters( Counters* p ) { cudaMemcpyToSymbol( counters, &p, siz
 #include "..\..\CUDA\shared_kernel_code\sampling_shared.h"
 #include "..\..\CUDA\shared_kernel_code\material_shared.h"
 #include "..\..\CUDA\shared_kernel_code\lights_shared.h"
+#include "..\..\CUDA\shared_kernel_code\sorting_shared.h"
 #include "bsdf.h"
 #include "pathtracer.h"
 #include "..\..\CUDA\shared_kernel_code\finalize_shared.h"
@@ -32,25 +32,40 @@ __inline __device__ float3 RandomPointOnLens( const float r0, float r1, const fl
 	return pos + aperture * (right * xr + up * yr);
 }
 
+// cameras of the views of the frame, see generateEyeRays
+__constant__ EyeView eyeViews[MAXVIEWS];
+
 //  +-----------------------------------------------------------------------------+
 //  |  generateEyeRaysKernel                                                      |
-//  |  Generate primary rays, to be traced by Optix Prime.                  LH2'19|
+//  |  Generate primary rays, to be traced by Optix Prime. The views of a frame   |
+//  |  are stacked vertically: screenParams holds the size of the stack, and row  |
+//  |  y sees the scene through eyeViews[y / viewHeight]. Pixel indices thus      |
+//  |  address one accumulator for all views.                               LH2'19|
 //  +-----------------------------------------------------------------------------+
 __global__  __launch_bounds__( 256 /* max block size */, 1 /* min blocks per sm */ )
 void generateEyeRaysKernel( Ray4* rayBuffer, float4* pathStateData,
-	const uint R0, const uint* blueNoise, const int pass,
-	const float3 pos, const float3 right, const float3 up, const float aperture,
-	const float3 p1, const int4 screenParams, const int jobCount )
+	const uint R0, const uint* blueNoise, const int pass, const int viewHeight,
+	const int4 screenParams, const uint* pixelList, const int listSize, const int jobCount )
 {
 	int jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
 	if (jobIndex >= jobCount) return;
 	// get pixel coordinate
 	const int scrhsize = screenParams.x & 0xffff;
 	const int scrvsize = screenParams.x >> 16;
-	const uint x = jobIndex % scrhsize;
-	uint y = jobIndex / scrhsize;
-	const uint sampleIndex = pass + y / scrvsize;
-	y %= scrvsize;
+	uint x, y, sampleIndex;
+	if (pixelList)
+	{
+		// adaptive sampling: the jobs cover the listed pixels, once per sample
+		const uint pixelIdx = pixelList[jobIndex % listSize];
+		x = pixelIdx % scrhsize, y = pixelIdx / scrhsize;
+		sampleIndex = pass + jobIndex / listSize;
+	}
+	else
+	{
+		x = jobIndex % scrhsize, y = jobIndex / scrhsize;
+		sampleIndex = pass + y / scrvsize;
+		y %= scrvsize;
+	}
 	// get random numbers
 	float3 posOnPixel, posOnLens;
 	// depth of field camera for no filter
@@ -68,8 +83,10 @@ void generateEyeRaysKernel( Ray4* rayBuffer, float4* pathStateData,
 		r0 = RandomFloat( seed ), r1 = RandomFloat( seed );
 		r2 = RandomFloat( seed ), r3 = RandomFloat( seed );
 	}
-	posOnPixel = p1 + ((float)x + r0) * (right / (float)scrhsize) + ((float)y + r1) * (up / (float)scrvsize);
-	posOnLens = RandomPointOnLens( r2, r3, pos, aperture, right, up );
+	const int view = y / viewHeight, viewY = y - view * viewHeight;
+	const EyeView& camera = eyeViews[view];
+	posOnPixel = camera.p1 + ((float)x + r0) * (camera.right / (float)scrhsize) + ((float)viewY + r1) * (camera.up / (float)viewHeight);
+	posOnLens = RandomPointOnLens( r2, r3, camera.pos, camera.aperture, camera.right, camera.up );
 	const float3 rayDir = normalize( posOnPixel - posOnLens );
 	// initialize path state
 	rayBuffer[jobIndex].O4 = make_float4( posOnLens, geometryEpsilon );
@@ -80,19 +97,179 @@ void generateEyeRaysKernel( Ray4* rayBuffer, float4* pathStateData,
 
 //  +-----------------------------------------------------------------------------+
 //  |  generateEyeRays                                                            |
-//  |  Entry point for the persistent generateEyeRays kernel.               LH2'19|
+//  |  Entry point for the persistent generateEyeRays kernel. With a pixel list,  |
+//  |  only the listSize pixels in it receive primary rays. The screen size in    |
+//  |  screenParams is the size of the stack of viewCount views.            LH2'19|
 //  +-----------------------------------------------------------------------------+
 __host__ void generateEyeRays( int smcount, Ray4* rayBuffer, float4* pathStateData,
-	const uint R0, const uint* blueNoise, const int pass,
-	const float aperture, const float3 camPos, const float3 right, const float3 up, const float3 p1,
-	const int4 screenParams )
+	const uint R0, const uint* blueNoise, const int pass, const EyeView* views, const int viewCount,
+	const int4 screenParams, const uint* pixelList, const int listSize )
 {
 	const int scrwidth = screenParams.x & 0xffff;
 	const int scrheight = screenParams.x >> 16;
 	const int scrspp = screenParams.y & 255;
-	const int pathCount = scrwidth * scrheight * scrspp;
+	const int pathCount = (pixelList ? listSize : (scrwidth * scrheight)) * scrspp;
+	if (pathCount == 0) return;
+	cudaMemcpyToSymbol( eyeViews, views, viewCount * sizeof( EyeView ) );
+	const dim3 gridDim( NEXTMULTIPLEOF( pathCount, 256 ) / 256, 1 ), blockDim( 256, 1 );
+	generateEyeRaysKernel << < gridDim.x, 256 >> > (rayBuffer, pathStateData, R0, blueNoise, pass, scrheight / viewCount, screenParams, pixelList, listSize, pathCount);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  generateTexelRaysKernel                                                    |
+//  |  Primary rays for a lightmap bake. The ray of a texel starts at the offset  |
+//  |  in its position.w above the surface and hits the texel itself, so the      |
+//  |  shade loop treats the texel as the first vertex of the path: it receives   |
+//  |  next event estimation and its bounce like any surface seen by a camera.    |
+//  |  texels holds a position and a normal per texel.                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__  __launch_bounds__( 256 /* max block size */, 1 /* min blocks per sm */ )
+void generateTexelRaysKernel( Ray4* rayBuffer, float4* pathStateData, const float4* texels, const int texelCount, const int jobCount )
+{
+	int jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
+	if (jobIndex >= jobCount) return;
+	const int texelIdx = jobIndex % texelCount;
+	const float4 P = texels[texelIdx * 2 + 0];
+	const float3 N = make_float3( texels[texelIdx * 2 + 1] );
+	// initialize path state; the path index assigns sample jobIndex / texelCount to the texel
+	rayBuffer[jobIndex].O4 = make_float4( make_float3( P ) + N * P.w, 0 );
+	rayBuffer[jobIndex].D4 = make_float4( N * -1.0f, 2 * P.w );
+	pathStateData[jobIndex * 2 + 0] = make_float4( 1, 1, 1, __uint_as_float( (jobIndex << 8) + 1 /* S_SPECULAR */ ) );
+	pathStateData[jobIndex * 2 + 1] = make_float4( 1, 0, 0, 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  generateTexelRays                                                          |
+//  |  Entry point for the generateTexelRays kernel: pathCount paths, spread      |
+//  |  evenly over the texels.                                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void generateTexelRays( Ray4* rayBuffer, float4* pathStateData, const float4* texels, const int texelCount, const int pathCount )
+{
+	if (pathCount == 0) return;
 	const dim3 gridDim( NEXTMULTIPLEOF( pathCount, 256 ) / 256, 1 ), blockDim( 256, 1 );
-	generateEyeRaysKernel << < gridDim.x, 256 >> > (rayBuffer, pathStateData, R0, blueNoise, pass, camPos, right, up, aperture, p1, screenParams, pathCount);
+	generateTexelRaysKernel << < gridDim.x, 256 >> > (rayBuffer, pathStateData, texels, texelCount, pathCount);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  adaptiveSamplingKernel                                                     |
+//  |  Per pixel, after all contributions of a frame arrived: updates the         |
+//  |  luminance moments over the frames in which the pixel was sampled, and      |
+//  |  lists the pixel for the next frame if the relative standard error of its   |
+//  |  mean exceeds the threshold. Pixels that were not sampled keep their mean:  |
+//  |  their accumulator is scaled to the new sample count.                       |
+//  |  moments: x = sum of frame luminance, y = sum of squares, z = accumulated   |
+//  |  luminance at the end of the previous frame, w = sampled frames, negative   |
+//  |  if the pixel was left out of the current frame.                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void adaptiveSamplingKernel( float4* accumulator, float4* moments, uint* pixelList, uint* listSize,
+	const int pixelCount, const int spp, const int samplesTaken, const float threshold, const int minFrames )
+{
+	const int pixelIdx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (pixelIdx >= pixelCount) return;
+	float4 m = moments[pixelIdx];
+	float4 acc = accumulator[pixelIdx];
+	if (m.w < 0)
+	{
+		// skipped: extrapolate the converged mean
+		if (samplesTaken > 0) acc *= (float)(samplesTaken + spp) / (float)samplesTaken;
+		accumulator[pixelIdx] = acc;
+		m.w = -m.w;
+	}
+	else
+	{
+		const float frameLum = (Luminance( make_float3( acc ) ) - m.z) * (1.0f / spp);
+		m.x += frameLum, m.y += frameLum * frameLum, m.w += 1;
+	}
+	m.z = Luminance( make_float3( acc ) );
+	const float mean = m.x / m.w, variance = max( 0.0f, m.y / m.w - mean * mean );
+	const float relativeError = sqrtf( variance / m.w ) / max( mean, 1e-3f );
+	if (m.w < minFrames || relativeError > threshold) pixelList[atomicAdd( listSize, 1 )] = pixelIdx; else m.w = -m.w;
+	moments[pixelIdx] = m;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  selectAdaptivePixels                                                       |
+//  |  Host-side access point for the adaptiveSamplingKernel code. samplesTaken   |
+//  |  excludes the samples of the current frame.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void selectAdaptivePixels( float4* accumulator, float4* moments, uint* pixelList, uint* listSize,
+	const int pixelCount, const int spp, const int samplesTaken, const float threshold, const int minFrames )
+{
+	cudaMemset( listSize, 0, sizeof( uint ) );
+	const dim3 gridDim( NEXTMULTIPLEOF( pixelCount, 256 ) / 256, 1 ), blockDim( 256, 1 );
+	adaptiveSamplingKernel << < gridDim.x, 256 >> > (accumulator, moments, pixelList, listSize, pixelCount, spp, samplesTaken, threshold, minFrames);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  foveatedPixelsKernel                                                       |
+//  |  Lists the pixels that receive primary rays this frame. The sampling rate   |
+//  |  is 1 inside the fovea (x, y, radius, min rate) and drops linearly to the   |
+//  |  minimum rate over one radius; a pixel is listed with that probability.     |
+//  |  sampleCounts keeps the samples each pixel received. Each of the stacked    |
+//  |  views of a frame has its own fovea, at the same position.            LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void foveatedPixelsKernel( uint* pixelList, uint* listSize, uint* sampleCounts,
+	const int w, const int h, const int views, const int spp, const float4 fovea, const uint R0 )
+{
+	const int pixelIdx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (pixelIdx >= w * h * views) return;
+	// distance to the fovea center, relative to the screen width
+	const float dx = ((pixelIdx % w) + 0.5f) / w - fovea.x;
+	const float dy = ((((pixelIdx / w) % h) + 0.5f) / h - fovea.y) * h / w;
+	const float d = sqrtf( dx * dx + dy * dy );
+	const float rate = d < fovea.z ? 1 : max( fovea.w, 1 - (d - fovea.z) / fovea.z * (1 - fovea.w) );
+	uint seed = WangHash( pixelIdx + R0 );
+	if (rate < 1 && RandomFloat( seed ) >= rate) return;
+	pixelList[atomicAdd( listSize, 1 )] = pixelIdx;
+	sampleCounts[pixelIdx] += spp;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  foveatedResolveKernel                                                      |
+//  |  Normalizes the accumulator to the per-pixel sample count, and scales it    |
+//  |  to samplesTaken, so that finalizeRender can be used as is. Pixels without  |
+//  |  samples take the average of their nearest sampled neighbours in the same   |
+//  |  view.                                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void foveatedResolveKernel( const float4* accumulator, const uint* sampleCounts, float4* resolved,
+	const int w, const int h, const int views, const int samplesTaken )
+{
+	const int pixelIdx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (pixelIdx >= w * h * views) return;
+	const uint count = sampleCounts[pixelIdx];
+	if (count > 0)
+	{
+		resolved[pixelIdx] = accumulator[pixelIdx] * ((float)samplesTaken / count);
+		return;
+	}
+	const int x = pixelIdx % w, y = pixelIdx / w, y0 = y - y % h;
+	float4 sum = make_float4( 0 );
+	int found = 0;
+	for (int r = 1; r <= 3 && found == 0; r++) for (int v = max( y0, y - r ); v <= min( y0 + h - 1, y + r ); v++)
+		for (int u = max( 0, x - r ); u <= min( w - 1, x + r ); u++)
+		{
+			const uint c = sampleCounts[u + v * w];
+			if (c > 0) sum += accumulator[u + v * w] * (1.0f / c), found++;
+		}
+	resolved[pixelIdx] = found > 0 ? sum * ((float)samplesTaken / found) : make_float4( 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  selectFoveatedPixels / resolveFoveated                                     |
+//  |  Host-side access points for the foveated rendering kernels.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void selectFoveatedPixels( uint* pixelList, uint* listSize, uint* sampleCounts,
+	const int w, const int h, const int views, const int spp, const float4 fovea, const uint R0 )
+{
+	cudaMemset( listSize, 0, sizeof( uint ) );
+	const dim3 gridDim( NEXTMULTIPLEOF( w * h * views, 256 ) / 256, 1 ), blockDim( 256, 1 );
+	foveatedPixelsKernel << < gridDim.x, 256 >> > (pixelList, listSize, sampleCounts, w, h, views, spp, fovea, R0);
+}
+__host__ void resolveFoveated( const float4* accumulator, const uint* sampleCounts, float4* resolved,
+	const int w, const int h, const int views, const int samplesTaken )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w * h * views, 256 ) / 256, 1 ), blockDim( 256, 1 );
+	foveatedResolveKernel << < gridDim.x, 256 >> > (accumulator, sampleCounts, resolved, w, h, views, samplesTaken);
 }
 
 // EOF
\ No newline at end of file
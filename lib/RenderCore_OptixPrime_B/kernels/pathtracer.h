@@ -84,7 +84,9 @@ void shadeKernel( float4* accumulator, const uint stride,
 	// use skydome if we didn't hit any geometry
 	if (PRIMIDX == NOHIT)
 	{
-		float3 contribution = throughput * make_float3( SampleSkydome( D, pathLength ) ) * (1.0f / bsdfPdf);
+		// a ray that left a diffuse vertex sees a filtered sky; others only the extent of the pixel
+		const float skySpread = (pathLength > 1 && !(FLAGS & S_SPECULAR)) ? SKYDIFFUSESPREAD : spreadAngle;
+		float3 contribution = throughput * make_float3( SampleSkydome( D, pathLength, skySpread ) ) * (1.0f / bsdfPdf);
 		CLAMPINTENSITY; // limit magnitude of thoughput vector to combat fireflies
 		FIXNAN_FLOAT3( contribution );
 		accumulator[pixelIdx] += make_float4( contribution, 0 );
@@ -109,7 +111,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 	{
 		if (pathLength < MAXPATHLENGTH)
 		{
-			const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 );
+			const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays );
 			extensionRaysOut[extensionRayIdx].O4 = make_float4( I, EPSILON );
 			extensionRaysOut[extensionRayIdx].D4 = make_float4( D, 1e34f );
 			FIXNAN_FLOAT3( throughput );
@@ -181,7 +183,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 				FIXNAN_FLOAT3( contribution );
 				CLAMPINTENSITY;
 				// add fire-and-forget shadow ray to the connections buffer
-				const uint shadowRayIdx = atomicAdd( &counters->shadowRays, 1 ); // compaction
+				const uint shadowRayIdx = AtomicAggInc( &counters->shadowRays ); // compaction
 				connections[shadowRayIdx].O4 = make_float4( SafeOrigin( I, L, N, geometryEpsilon ), 0 );
 				connections[shadowRayIdx].D4 = make_float4( L, dist - 2 * geometryEpsilon );
 				potentials[shadowRayIdx] = make_float4( contribution, __int_as_float( pixelIdx ) );
@@ -213,7 +215,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 	if (newBsdfPdf < EPSILON || isnan( newBsdfPdf )) return;
 
 	// write extension ray
-	const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 ); // compact
+	const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays ); // compact
 	const uint packedNormal = PackNormal( fN );
 	if (!(FLAGS & S_SPECULAR)) FLAGS |= S_BOUNCED; else FLAGS |= S_VIASPECULAR;
 	extensionRaysOut[extensionRayIdx].O4 = make_float4( SafeOrigin( I, R, N, geometryEpsilon ), 0 );
@@ -223,6 +225,36 @@ void shadeKernel( float4* accumulator, const uint stride,
 	pathStateDataOut[extensionRayIdx * 2 + 1] = make_float4( newBsdfPdf, packedNormal, 0, 0 );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  sortGatherKernel                                                           |
+//  |  Copies the rays, path state data and hits of the paths to their position   |
+//  |  in material order.                                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void sortGatherKernel( const Ray4* extensionRays, const float4* pathStateData, const Intersection* hits,
+	const uint* keys, uint* bins, Ray4* sortedRays, float4* sortedStateData, Intersection* sortedHits, const int pathCount )
+{
+	const int jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
+	if (jobIndex >= pathCount) return;
+	const uint target = atomicAdd( &bins[keys[jobIndex]], 1 );
+	sortedRays[target] = extensionRays[jobIndex];
+	sortedStateData[target * 2 + 0] = pathStateData[jobIndex * 2 + 0];
+	sortedStateData[target * 2 + 1] = pathStateData[jobIndex * 2 + 1];
+	sortedHits[target] = hits[jobIndex];
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  sortPaths                                                                  |
+//  |  Host-side access point for material-coherent path sorting.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void sortPaths( const int pathCount, const Ray4* extensionRays, const float4* pathStateData, const Intersection* hits,
+	uint* keys, uint* bins, Ray4* sortedRays, float4* sortedStateData, Intersection* sortedHits )
+{
+	// Intersection: t, triid, instid, u, v
+	sortPathKeys( hits, 5, 2, 1, keys, bins, pathCount, 0 );
+	const dim3 gridDim( NEXTMULTIPLEOF( pathCount, 128 ) / 128, 1 ), blockDim( 128, 1 );
+	sortGatherKernel << < gridDim.x, 128 >> > (extensionRays, pathStateData, hits, keys, bins, sortedRays, sortedStateData, sortedHits, pathCount);
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  shadeKernel                                                                |
 //  |  Host-side access point for the shadeKernel code.                     LH2'19|
@@ -36,6 +36,8 @@ void shade( const int pathCount, float4* accumulator, const uint stride,
 	const int probePixelIdx, const int pathLength, const int w, const int h, const float spreadAngle,
 	const float3 p1, const float3 p2, const float3 p3, const float3 pos );
 void finalizeConnections( int rayCount, float4* accumulator, uint* hitBuffer, float4* contributions );
+void sortPaths( const int pathCount, const Ray4* extensionRays, const float4* pathStateData, const Intersection* hits,
+	uint* keys, uint* bins, Ray4* sortedRays, float4* sortedStateData, Intersection* sortedHits );
 void InitCountersForExtend( int pathCount );
 void InitCountersSubsequent();
 
@@ -46,20 +48,28 @@ void SetAreaLights( CoreLightTri* p );
 void SetPointLights( CorePointLight* p );
 void SetSpotLights( CoreSpotLight* p );
 void SetDirectionalLights( CoreDirectionalLight* p );
+void SetLightTreeNodes( CoreLightTreeNode* p );
+void SetLightAliasEntries( CoreLightAlias* p );
 void SetLightCounts( int area, int point, int spot, int directional );
 void SetARGB32Pixels( uint* p );
 void SetARGB128Pixels( float4* p );
 void SetNRM32Pixels( uint* p );
-void SetSkyPixels( float3* p );
-void SetSkySize( int w, int h );
+void SetSkyPixels( uint2* p );
+void SetSkySize( int w, int h, int levels );
 void SetDebugData( float4* p );
 void SetGeometryEpsilon( float e );
 void SetClampValue( float c );
 void SetCounters( Counters* p );
 void generateEyeRays( int pathCount, Ray4* rayBuffer, float4* extensionRayExBuffer,
-	const uint R0, const uint* blueNoise, const int pass /* multiple of SPP */,
-	const float lensSize, const float3 camPos, const float3 right, const float3 up, const float3 p1,
-	const int4 screenParams );
+	const uint R0, const uint* blueNoise, const int pass /* multiple of SPP */, const EyeView* views, const int viewCount,
+	const int4 screenParams, const uint* pixelList, const int listSize );
+void generateTexelRays( Ray4* rayBuffer, float4* pathStateData, const float4* texels, const int texelCount, const int pathCount );
+void selectAdaptivePixels( float4* accumulator, float4* moments, uint* pixelList, uint* listSize,
+	const int pixelCount, const int spp, const int samplesTaken, const float threshold, const int minFrames );
+void selectFoveatedPixels( uint* pixelList, uint* listSize, uint* sampleCounts,
+	const int w, const int h, const int views, const int spp, const float4 fovea, const uint R0 );
+void resolveFoveated( const float4* accumulator, const uint* sampleCounts, float4* resolved,
+	const int w, const int h, const int views, const int samplesTaken );
 
 } // namespace lh2core
 
@@ -71,12 +81,12 @@ RTPcontext RenderCore::context = 0;
 //  |  RenderCore::GetScreenParams                                                |
 //  |  Helper function - fills an int4 with values related to screen size.  LH2'19|
 //  +-----------------------------------------------------------------------------+
-int4 RenderCore::GetScreenParams()
+int4 RenderCore::GetScreenParams( const int w, const int h )
 {
 	float e = 0.0001f; // RenderSettings::geoEpsilon;
-	return make_int4( scrwidth + (scrheight << 16),					// .x : SCRHSIZE, SCRVSIZE
+	return make_int4( w + (h << 16),								// .x : SCRHSIZE, SCRVSIZE
 		scrspp + (1 /* RenderSettings::pathDepth */ << 8),			// .y : SPP, MAXDEPTH
-		scrwidth * scrheight * scrspp,								// .z : PIXELCOUNT
+		w * h * scrspp,												// .z : PIXELCOUNT
 		*((int*)&e) );												// .w : RenderSettings::geoEpsilon
 }
 
@@ -139,7 +149,13 @@ void RenderCore::Init()
 	{
 		cudaEventCreate( &shadeStart[i] );
 		cudaEventCreate( &shadeEnd[i] );
+		cudaEventCreate( &sortStart[i] );
+		cudaEventCreate( &sortEnd[i] );
+		cudaEventCreate( &traceStart[i] );
+		cudaEventCreate( &traceEnd[i] );
 	}
+	cudaEventCreate( &shadowStart );
+	cudaEventCreate( &shadowEnd );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -153,23 +169,39 @@ void RenderCore::SetTarget( GLTexture* target, const uint spp )
 	scrheight = target->height;
 	scrspp = spp;
 	renderTarget.SetTexture( target );
-	bool firstFrame = (maxPixels == 0);
 	// notify CUDA about the texture
 	renderTarget.LinkToSurface( renderTargetRef() );
+	ReserveBuffers( scrwidth * scrheight, spp );
+	// clear the accumulator
+	accumulator->Clear( ON_DEVICE );
+	samplesTaken = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ReserveBuffers                                                 |
+//  |  Make sure that the path state buffers can hold the paths of pixelCount     |
+//  |  pixels at spp samples. This is the screen size, or the size of all views   |
+//  |  of a frame, see RenderViews.                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::ReserveBuffers( const int pixelCount, const uint spp )
+{
+	bool firstFrame = (maxPixels == 0);
 	// see if we need to reallocate our buffers
 	bool reallocate = false;
-	if (scrwidth * scrheight > maxPixels || spp != currentSPP)
+	if (pixelCount > maxPixels || spp != currentSPP)
 	{
-		maxPixels = scrwidth * scrheight;
+		maxPixels = pixelCount;
 		maxPixels += maxPixels >> 4; // reserve a bit extra to prevent frequent reallocs
 		currentSPP = spp;
 		reallocate = true;
 	}
 	if (reallocate)
 	{
-		// destroy previously created OptiX buffers
+		// destroy previously created OptiX buffers, and the queries that use them
 		if (!firstFrame)
 		{
+			if (extensionQuery) rtpQueryDestroy( extensionQuery ), extensionQuery = 0;
+			if (shadowQuery) rtpQueryDestroy( shadowQuery ), shadowQuery = 0;
 			rtpBufferDescDestroy( extensionRaysDesc[0] );
 			rtpBufferDescDestroy( extensionRaysDesc[1] );
 			rtpBufferDescDestroy( extensionHitsDesc );
@@ -186,6 +218,14 @@ void RenderCore::SetTarget( GLTexture* target, const uint spp )
 		delete shadowRayPotential;
 		delete shadowHitBuffer;
 		delete accumulator;
+		delete sortedRayBuffer, sortedRayBuffer = 0; // sort buffers are allocated on first use
+		delete sortedRayExBuffer, sortedRayExBuffer = 0;
+		delete sortedHitBuffer, sortedHitBuffer = 0;
+		delete sortKeyBuffer, sortKeyBuffer = 0;
+		delete pixelMoments, pixelMoments = 0; // adaptive sampling buffers are allocated on first use
+		delete pixelList, pixelList = 0;
+		delete sampleCountBuffer, sampleCountBuffer = 0;
+		delete resolvedBuffer, resolvedBuffer = 0;
 		const uint maxShadowRays = maxPixels * spp * MAXPATHLENGTH; // upper limit; safe but wasteful
 		extensionHitBuffer = new CoreBuffer<Intersection>( maxPixels * spp, ON_DEVICE );
 		shadowRayBuffer = new CoreBuffer<Ray4>( maxShadowRays, ON_DEVICE );
@@ -203,9 +243,6 @@ void RenderCore::SetTarget( GLTexture* target, const uint spp )
 		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_HIT_BITMASK, RTP_BUFFER_TYPE_CUDA_LINEAR, shadowHitBuffer->DevPtr(), &shadowHitsDesc ) );
 		printf( "buffers resized for %i pixels @ %i samples.\n", maxPixels, spp );
 	}
-	// clear the accumulator
-	accumulator->Clear( ON_DEVICE );
-	samplesTaken = 0;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -234,32 +271,52 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 	if (instanceIdx >= instances.size()) instances.push_back( new CoreInstance() );
 	instances[instanceIdx]->mesh = meshIdx;
 	instances[instanceIdx]->transform = matrix;
+	firstDirtyInstance = min( firstDirtyInstance, instanceIdx );
+	lastDirtyInstance = max( lastDirtyInstance, instanceIdx );
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::UpdateToplevel                                                 |
 //  |  After changing meshes, instances or instance transforms, we need to        |
-//  |  rebuild the top-level structure.                                     LH2'19|
+//  |  rebuild the top-level structure. The instance buffers persist between      |
+//  |  updates; only the transforms of instances passed to SetInstance since the  |
+//  |  previous update are sent to the device.                              LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderCore::UpdateToplevel()
 {
-	// this creates the top-level BVH over the supplied models.
-	RTPbufferdesc instancesBuffer, transformBuffer;
-	vector<RTPmodel> modelList;
-	vector<mat4> transformList;
-	for (auto instance : instances)
+	const int instanceCount = (int)instances.size();
+	if (instanceCount == 0) return;
+	// the previous asynchronous update may still read the transforms
+	if (topLevelBuilding) CHK_PRIME( rtpModelFinish( *topLevel ) ), topLevelBuilding = false;
+	// the top-level build needs the finished mesh models; these were built while the host prepared the other meshes
+	for (CoreMesh* mesh : meshes) mesh->FinishUpdate();
+	if (!instanceTransforms || instanceTransforms->GetSize() < instanceCount)
+	{
+		// grow the buffers with some slack, to prevent excessive reallocs
+		if (instanceModelsDesc) rtpBufferDescDestroy( instanceModelsDesc ), rtpBufferDescDestroy( instanceTransformsDesc );
+		delete instanceTransforms;
+		instanceTransforms = new CoreBuffer<mat4>( instanceCount * 2, ON_HOST | ON_DEVICE );
+		instanceModels.resize( instanceCount * 2 );
+		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_INSTANCE_MODEL, RTP_BUFFER_TYPE_HOST, instanceModels.data(), &instanceModelsDesc ) );
+		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_TRANSFORM_FLOAT4x4, RTP_BUFFER_TYPE_CUDA_LINEAR, instanceTransforms->DevPtr(), &instanceTransformsDesc ) );
+		firstDirtyInstance = 0, lastDirtyInstance = instanceCount - 1;
+	}
+	// models may have been replaced by SetGeometry, so these are refreshed for all instances; host only
+	for (int i = 0; i < instanceCount; i++) instanceModels[i] = meshes[instances[i]->mesh]->model;
+	if (lastDirtyInstance >= firstDirtyInstance)
 	{
-		modelList.push_back( meshes[instance->mesh]->model );
-		transformList.push_back( instance->transform );
+		mat4* transforms = instanceTransforms->HostPtr();
+		lastDirtyInstance = min( lastDirtyInstance, instanceCount - 1 );
+		for (int i = firstDirtyInstance; i <= lastDirtyInstance; i++) transforms[i] = instances[i]->transform;
+		instanceTransforms->CopyToDevice( firstDirtyInstance, lastDirtyInstance - firstDirtyInstance + 1 );
+		firstDirtyInstance = INT_MAX, lastDirtyInstance = -1;
 	}
-	CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_INSTANCE_MODEL, RTP_BUFFER_TYPE_HOST, modelList.data(), &instancesBuffer ) );
-	CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_TRANSFORM_FLOAT4x4, RTP_BUFFER_TYPE_HOST, transformList.data(), &transformBuffer ) );
-	CHK_PRIME( rtpBufferDescSetRange( instancesBuffer, 0, instances.size() ) );
-	CHK_PRIME( rtpBufferDescSetRange( transformBuffer, 0, instances.size() ) );
-	CHK_PRIME( rtpModelSetInstances( *topLevel, instancesBuffer, transformBuffer ) );
-	CHK_PRIME( rtpModelUpdate( *topLevel, RTP_MODEL_HINT_ASYNC /* blocking; try RTP_MODEL_HINT_ASYNC + rtpModelFinish for async version. */ ) );
-	CHK_PRIME( rtpBufferDescDestroy( instancesBuffer ) /* no idea if this does anything relevant */ );
-	CHK_PRIME( rtpBufferDescDestroy( transformBuffer ) /* no idea if this does anything relevant */ );
+	// this creates the top-level BVH over the supplied models.
+	CHK_PRIME( rtpBufferDescSetRange( instanceModelsDesc, 0, instanceCount ) );
+	CHK_PRIME( rtpBufferDescSetRange( instanceTransformsDesc, 0, instanceCount ) );
+	CHK_PRIME( rtpModelSetInstances( *topLevel, instanceModelsDesc, instanceTransformsDesc ) );
+	CHK_PRIME( rtpModelUpdate( *topLevel, RTP_MODEL_HINT_ASYNC ) );
+	topLevelBuilding = true; // finished right before the first query, see Render
 	instancesDirty = true; // sync instance list to device prior to next ray query
 }
 
@@ -393,16 +450,39 @@ void RenderCore::SetLights( const CoreLightTri* areaLights, const int areaLightC
 	SetLightCounts( areaLightCount, pointLightCount, spotLightCount, directionalLightCount );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLightTree                                                   |
+//  |  Set the light tree, used for light selection with LIGHTTREE.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount )
+{
+	delete lightTreeBuffer;
+	SetLightTreeNodes( (lightTreeBuffer = new CoreBuffer<CoreLightTreeNode>( nodeCount, ON_DEVICE, nodes ))->DevPtr() );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLightAliasTable                                             |
+//  |  Set the alias table, used for light selection with ALIASLIGHTS.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLightAliasTable( const CoreLightAlias* table, const int count )
+{
+	delete lightAliasBuffer;
+	SetLightAliasEntries( (lightAliasBuffer = new CoreBuffer<CoreLightAlias>( count, ON_DEVICE, table ))->DevPtr() );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::SetSkyData                                                     |
-//  |  Set the sky dome data.                                               LH2'19|
+//  |  Set the sky dome data. It is stored as a pyramid of half precision         |
+//  |  texels; SampleSkydome picks the level from the ray cone.             LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetSkyData( const float3* pixels, const uint width, const uint height )
 {
+	vector<uint2> pyramid;
+	const int levels = CUDATools::BuildSkyPyramid( pixels, width, height, pyramid );
 	delete skyPixelBuffer;
-	skyPixelBuffer = new CoreBuffer<float3>( width * height, ON_DEVICE, pixels );
+	skyPixelBuffer = new CoreBuffer<uint2>( pyramid.size(), ON_DEVICE, pyramid.data() );
 	SetSkyPixels( skyPixelBuffer->DevPtr() );
-	SetSkySize( width, height );
+	SetSkySize( width, height, levels );
 	skywidth = width;
 	skyheight = height;
 }
@@ -429,6 +509,31 @@ void RenderCore::Setting( const char* name, const float value )
 			SetClampValue( value );
 		}
 	}
+	else if (!strcmp( name, "materialSort" ))
+	{
+		// sort paths by material before shading; see CoreStats::sortTime and sortShadeSaved for the trade-off
+		materialSort = value != 0;
+	}
+	else if (!strcmp( name, "adaptiveSampling" ))
+	{
+		// spend primary rays only on pixels that did not converge yet; restarts accumulation
+		adaptiveSampling = value != 0;
+		firstConvergingFrame = true;
+	}
+	else if (!strcmp( name, "adaptiveThreshold" ))
+	{
+		// adaptive sampling: relative standard error of a pixel below which it receives no more samples
+		adaptiveThreshold = value;
+	}
+	else if (!strcmp( name, "foveaX" )) fovea.x = value;
+	else if (!strcmp( name, "foveaY" )) fovea.y = value;
+	else if (!strcmp( name, "foveaRadius" ))
+	{
+		// foveated rendering is enabled with a radius above zero; switching restarts accumulation
+		if ((value > 0) != (fovea.z > 0)) firstConvergingFrame = true;
+		fovea.z = value;
+	}
+	else if (!strcmp( name, "foveaMinRate" )) fovea.w = max( 0.01f, min( 1.0f, value ) );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -437,14 +542,111 @@ void RenderCore::Setting( const char* name, const float value )
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast )
 {
-	// wait for OpenGL
-	glFinish();
+	RenderFrame( &view, 1, scrwidth, scrheight, &renderTarget, converge, brightness, contrast );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::RenderViews                                                    |
+//  |  Produce one image for each of the views. The paths of all views share the  |
+//  |  path state buffers, and are traced and shaded in the same launches.        |
+//  |  Returns false if the views do not fit in a single stack.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, const Convergence converge, const float brightness, const float contrast )
+{
+	if (count < 1 || count > MAXVIEWS) return false;
+	const int w = targets[0]->width, h = targets[0]->height;
+	if (h * count > 0xffff) return false; // the stack height must fit in 16 bits, see GetScreenParams
+	for (int i = 1; i < count; i++) if (targets[i]->width != w || targets[i]->height != h) return false;
+	for (int i = 0; i < count; i++) if (viewTextures[i] != targets[i])
+	{
+		// bind the new target of the view; all views finalize through the same surface reference
+		viewTargets[i].SetTexture( targets[i] );
+		viewTargets[i].LinkToSurface( renderTargetRef() );
+		viewTextures[i] = targets[i];
+	}
+	ReserveBuffers( w * h * count, scrspp );
+	RenderFrame( views, count, w, h, viewTargets, converge, brightness, contrast );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::BakeViews                                                      |
+//  |  Converge the views to at least spp samples per pixel, in frames of scrspp  |
+//  |  samples, and copy the average of the samples to host memory. Nothing is    |
+//  |  finalized: rgb is linear radiance, w the distance to the first hit.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::BakeViews( const ViewPyramid* views, const int count, const int w, const int h, const uint spp, float4* pixels )
+{
+	if (count < 1 || count > MAXVIEWS || w < 1 || h < 1) return false;
+	if (h * count > 0xffff) return false;
+	const int pixelCount = w * h * count;
+	ReserveBuffers( pixelCount, scrspp );
+	firstConvergingFrame = true; // the first frame of the bake clears the accumulator
+	for (uint taken = 0; taken < max( 1u, spp ); taken += scrspp) RenderFrame( views, count, w, h, 0, Converge, 1, 0 );
+	const CoreBuffer<float4>* frame = fovea.z > 0 ? resolvedBuffer : accumulator;
+	CUDACHECK( "cudaMemcpy", cudaMemcpy( pixels, frame->DevPtr(), pixelCount * sizeof( float4 ), cudaMemcpyDeviceToHost ) );
+	const float scale = 1.0f / samplesTaken;
+	for (int i = 0; i < pixelCount; i++) pixels[i] *= scale;
+	frameLayout = make_int3( 0 ); // the next frame restarts converging
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::BakeTexels                                                     |
+//  |  Converge the radiance leaving count lightmap texels along their normals,   |
+//  |  see generateTexelRaysKernel. The texels are laid out as rows of a screen   |
+//  |  for the shade loop; the last row is padded with copies of the last texel.  |
+//  |  Adaptive sampling and foveation do not apply to texels.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::BakeTexels( const float4* texels, const int count, const uint spp, float4* radiance )
+{
+	if (count < 1) return false;
+	const int w = min( count, 4096 ), rows = (count + w - 1) / w, pixelCount = w * rows;
+	if (rows > 0xffff) return false;
+	if (!texelBuffer || texelBuffer->GetSize() < pixelCount * 2)
+	{
+		delete texelBuffer;
+		texelBuffer = new CoreBuffer<float4>( pixelCount * 2, ON_HOST | ON_DEVICE );
+	}
+	float4* padded = texelBuffer->HostPtr();
+	memcpy( padded, texels, count * 2 * sizeof( float4 ) );
+	for (int i = count; i < pixelCount; i++) padded[i * 2 + 0] = texels[count * 2 - 2], padded[i * 2 + 1] = texels[count * 2 - 1];
+	texelBuffer->CopyToDevice();
+	ReserveBuffers( pixelCount, scrspp );
+	firstConvergingFrame = true;
+	for (uint taken = 0; taken < max( 1u, spp ); taken += scrspp) RenderFrame( 0, 1, w, rows, 0, Converge, 1, 0, texelBuffer->DevPtr() );
+	CUDACHECK( "cudaMemcpy", cudaMemcpy( radiance, accumulator->DevPtr(), count * sizeof( float4 ), cudaMemcpyDeviceToHost ) );
+	const float scale = 1.0f / samplesTaken;
+	for (int i = 0; i < count; i++) radiance[i] *= scale;
+	frameLayout = make_int3( 0 );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::RenderFrame                                                    |
+//  |  Path trace count views of w x h pixels, stacked vertically in the path     |
+//  |  state buffers and the accumulator, and finalize view i to targets[i], if   |
+//  |  targets is not null. A different stack than the one of the previous frame  |
+//  |  restarts converging. The probe position refers to the first view.          |
+//  |  With texels, the primary rays start at lightmap texels instead, one per    |
+//  |  pixel of the w x h screen, and views is not used; see BakeTexels.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::RenderFrame( const ViewPyramid* views, const int count, const int w, const int h, InteropTexture* targets,
+	Convergence converge, const float brightness, const float contrast, const float4* texels )
+{
+	// Note: no glFinish here. Mapping the render target in InteropTexture::BindSurface orders
+	// the OpenGL work on it before finalizeRender; the wavefront loop does not touch GL resources.
 	Timer timer;
+	const int rows = h * count, pixelCount = w * rows;
+	if (frameLayout.x != w || frameLayout.y != h || frameLayout.z != count) converge = Restart;
+	frameLayout = make_int3( w, h, count );
 	// clean accumulator, if requested
 	if (converge == Restart || firstConvergingFrame)
 	{
 		accumulator->Clear( ON_DEVICE );
 		samplesTaken = 0;
+		listedPixels = -1; // sample all pixels until the moments say otherwise
+		if (sampleCountBuffer) sampleCountBuffer->Clear( ON_DEVICE );
 		firstConvergingFrame = true; // if we switch to converging, it will be the first converging frame.
 		camRNGseed = 0x12345678; // same seed means same noise.
 	}
@@ -462,8 +664,10 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 		{
 			CoreInstanceDesc id;
 			id.triangles = meshes[instance->mesh]->triangles->DevPtr();
+			id.packed = 0;
 			mat4 T = instance->transform.Inverted();
 			id.invTransform = *(float4x4*)&T;
+			id.prevTransform = *(float4x4*)&instance->transform; // no motion vectors in this core
 			instDescArray.push_back( id );
 		}
 		if (instDescBuffer == 0 || instDescBuffer->GetSize() < (int)instances.size())
@@ -480,37 +684,104 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 	}
 	// render image
 	coreStats.totalExtensionRays = 0;
-	// setup primary rays
-	float3 right = view.p2 - view.p1, up = view.p3 - view.p1;
-	InitCountersForExtend( scrwidth * scrheight * scrspp );
-	generateEyeRays( SMcount, extensionRayBuffer[inBuffer]->DevPtr(), extensionRayExBuffer[inBuffer]->DevPtr(),
-		RandomUInt( camRNGseed ), blueNoise->DevPtr(), samplesTaken,
-		view.aperture, view.pos, right, up, view.p1, GetScreenParams() );
+	// setup primary rays; with adaptive sampling, only for the pixels listed at the end of the previous frame,
+	// with foveated rendering, for the pixels selected for this frame
+	const bool foveated = fovea.z > 0 && !texels, adaptive = adaptiveSampling && !foveated && !texels;
+	if ((adaptive || foveated) && !pixelList) pixelList = new CoreBuffer<uint>( maxPixels + 1 /* last entry: list size */, ON_DEVICE );
+	if (adaptive && !pixelMoments) pixelMoments = new CoreBuffer<float4>( maxPixels, ON_DEVICE ), listedPixels = -1;
+	if (!adaptive) listedPixels = -1;
+	if (listedPixels < 0 && pixelMoments) pixelMoments->Clear( ON_DEVICE );
+	if (foveated)
+	{
+		if (!sampleCountBuffer)
+		{
+			sampleCountBuffer = new CoreBuffer<uint>( maxPixels, ON_DEVICE );
+			resolvedBuffer = new CoreBuffer<float4>( maxPixels, ON_DEVICE );
+			sampleCountBuffer->Clear( ON_DEVICE );
+		}
+		uint* listSize = pixelList->DevPtr() + maxPixels;
+		selectFoveatedPixels( pixelList->DevPtr(), listSize, sampleCountBuffer->DevPtr(), w, h, count, scrspp, fovea, RandomUInt( seed ) );
+		uint listed = 0;
+		CUDACHECK( "cudaMemcpy", cudaMemcpy( &listed, listSize, sizeof( uint ), cudaMemcpyDeviceToHost ) );
+		listedPixels = listed;
+	}
+	const bool listed = listedPixels >= 0;
+	uint pathCount = (listed ? listedPixels : pixelCount) * scrspp;
+	InitCountersForExtend( pathCount );
+	if (texels) generateTexelRays( extensionRayBuffer[inBuffer]->DevPtr(), extensionRayExBuffer[inBuffer]->DevPtr(), texels, pixelCount, pathCount );
+	else
+	{
+		EyeView cameras[MAXVIEWS];
+		for (int i = 0; i < count; i++)
+		{
+			const ViewPyramid& view = views[i];
+			cameras[i] = { view.pos, view.p2 - view.p1, view.p3 - view.p1, view.p1, view.aperture };
+		}
+		generateEyeRays( SMcount, extensionRayBuffer[inBuffer]->DevPtr(), extensionRayExBuffer[inBuffer]->DevPtr(),
+			RandomUInt( camRNGseed ), blueNoise->DevPtr(), samplesTaken, cameras, count,
+			GetScreenParams( w, rows ), listed ? pixelList->DevPtr() : 0, listedPixels );
+	}
+	// texels have no camera: full resolution textures, and no probe pixel
+	ViewPyramid view0 = texels ? ViewPyramid() : views[0];
+	if (texels) view0.spreadAngle = 0;
+	// the top-level build overlapped with the host work of this frame so far
+	if (topLevelBuilding) CHK_PRIME( rtpModelFinish( *topLevel ) ), topLevelBuilding = false;
+	// queries are created once per buffer configuration; they run asynchronously on the
+	// default stream, so they are ordered with the CUDA kernels without blocking the host
+	if (!extensionQuery)
+	{
+		CHK_PRIME( rtpQueryCreate( *topLevel, RTP_QUERY_TYPE_CLOSEST, &extensionQuery ) );
+		CHK_PRIME( rtpQueryCreate( *topLevel, RTP_QUERY_TYPE_ANY, &shadowQuery ) );
+		CHK_PRIME( rtpQuerySetCudaStream( extensionQuery, 0 ) );
+		CHK_PRIME( rtpQuerySetCudaStream( shadowQuery, 0 ) );
+	}
+	if (materialSort && !sortKeyBuffer)
+	{
+		// copies of the path data in material order
+		sortedRayBuffer = new CoreBuffer<Ray4>( extensionHitBuffer->GetSize(), ON_DEVICE );
+		sortedRayExBuffer = new CoreBuffer<float4>( extensionHitBuffer->GetSize() * 2, ON_DEVICE );
+		sortedHitBuffer = new CoreBuffer<Intersection>( extensionHitBuffer->GetSize(), ON_DEVICE );
+		sortKeyBuffer = new CoreBuffer<uint>( extensionHitBuffer->GetSize(), ON_DEVICE );
+		if (!sortBinBuffer) sortBinBuffer = new CoreBuffer<uint>( SORTBINS, ON_DEVICE );
+	}
 	// start wavefront loop
-	RTPquery query;
-	CHK_PRIME( rtpQueryCreate( *topLevel, RTP_QUERY_TYPE_CLOSEST, &query ) );
-	uint pathCount = scrwidth * scrheight * scrspp;
-	for (int pathLength = 1; pathLength <= MAXPATHLENGTH; pathLength++)
+	int bounces = 0; // wavefront iterations executed for this frame
+	coreStats.deepRayCount = 0;
+	for (int pathLength = 1; pathLength <= MAXPATHLENGTH && pathCount > 0; pathLength++)
 	{
-		// extend
-		Timer t;
+		// extend; the query of the previous bounce has completed at the counter readback below
 		CHK_PRIME( rtpBufferDescSetRange( extensionRaysDesc[inBuffer], 0, pathCount ) );
 		CHK_PRIME( rtpBufferDescSetRange( extensionHitsDesc, 0, pathCount ) );
-		CHK_PRIME( rtpQuerySetRays( query, extensionRaysDesc[inBuffer] ) );
-		CHK_PRIME( rtpQuerySetHits( query, extensionHitsDesc ) );
-		CHK_PRIME( rtpQueryExecute( query, RTP_QUERY_HINT_NONE ) );
-		if (pathLength == 1) coreStats.traceTime0 = t.elapsed(), coreStats.primaryRayCount = pathCount;
-		else if (pathLength == 2)  coreStats.traceTime1 = t.elapsed(), coreStats.bounce1RayCount = pathCount;
-		else coreStats.traceTimeX = t.elapsed(), coreStats.deepRayCount = pathCount;
+		CHK_PRIME( rtpQuerySetRays( extensionQuery, extensionRaysDesc[inBuffer] ) );
+		CHK_PRIME( rtpQuerySetHits( extensionQuery, extensionHitsDesc ) );
+		cudaEventRecord( traceStart[pathLength - 1] );
+		CHK_PRIME( rtpQueryExecute( extensionQuery, RTP_QUERY_HINT_ASYNC ) );
+		cudaEventRecord( traceEnd[pathLength - 1] );
+		if (pathLength == 1) coreStats.primaryRayCount = pathCount;
+		else if (pathLength == 2) coreStats.bounce1RayCount = pathCount;
+		else coreStats.deepRayCount += pathCount;
+		bounces = pathLength;
+		// optionally sort the paths by material, so that shading is more coherent
+		const Ray4* shadeRays = extensionRayBuffer[inBuffer]->DevPtr();
+		const float4* shadeRayEx = extensionRayExBuffer[inBuffer]->DevPtr();
+		const Intersection* shadeHits = extensionHitBuffer->DevPtr();
+		if (materialSort)
+		{
+			cudaEventRecord( sortStart[pathLength - 1] );
+			sortPaths( pathCount, shadeRays, shadeRayEx, shadeHits, sortKeyBuffer->DevPtr(), sortBinBuffer->DevPtr(),
+				sortedRayBuffer->DevPtr(), sortedRayExBuffer->DevPtr(), sortedHitBuffer->DevPtr() );
+			cudaEventRecord( sortEnd[pathLength - 1] );
+			shadeRays = sortedRayBuffer->DevPtr(), shadeRayEx = sortedRayExBuffer->DevPtr(), shadeHits = sortedHitBuffer->DevPtr();
+		}
 		// shade
 		cudaEventRecord( shadeStart[pathLength - 1] );
-		shade( pathCount, accumulator->DevPtr(), scrwidth * scrheight,
-			extensionRayBuffer[inBuffer]->DevPtr(), extensionRayExBuffer[inBuffer]->DevPtr(), extensionHitBuffer->DevPtr(),
+		shade( pathCount, accumulator->DevPtr(), pixelCount,
+			shadeRays, shadeRayEx, shadeHits,
 			extensionRayBuffer[outBuffer]->DevPtr(), extensionRayExBuffer[outBuffer]->DevPtr(),
 			shadowRayBuffer->DevPtr(), shadowRayPotential->DevPtr(),
 			samplesTaken * 7907 + pathLength * 91771, blueNoise->DevPtr(), samplesTaken,
-			probePos.x + scrwidth * probePos.y, pathLength, scrwidth, scrheight, view.spreadAngle,
-			view.p1, view.p2, view.p3, view.pos );
+			texels ? -1 : (probePos.x + w * probePos.y), pathLength, w, rows, view0.spreadAngle,
+			view0.p1, view0.p2, view0.p3, view0.pos );
 		if (pathLength == MAXPATHLENGTH) 
 		{
 			// prevent the CopyToHost in the last iteration; it's expensive
@@ -524,38 +795,62 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 		swap( inBuffer, outBuffer );
 		InitCountersSubsequent();
 	}
-	CHK_PRIME( rtpQueryDestroy( query ) );
 	// loop completed; handle gathered shadow rays
 	counterBuffer->CopyToHost();
 	Counters& counters = counterBuffer->HostPtr()[0];
 	if (counters.shadowRays > 0)
 	{
 		// trace the shadow rays using OptiX Prime
-		Timer t;
-		RTPquery query;
-		CHK_PRIME( rtpQueryCreate( *topLevel, RTP_QUERY_TYPE_ANY, &query ) );
 		CHK_PRIME( rtpBufferDescSetRange( shadowRaysDesc, 0, counters.shadowRays ) );
 		CHK_PRIME( rtpBufferDescSetRange( shadowHitsDesc, 0, counters.shadowRays ) );
-		CHK_PRIME( rtpQuerySetRays( query, shadowRaysDesc ) );
-		CHK_PRIME( rtpQuerySetHits( query, shadowHitsDesc ) );
-		CHK_PRIME( rtpQueryExecute( query, RTP_QUERY_HINT_NONE ) );
-		CHK_PRIME( rtpQueryDestroy( query ) );
-		coreStats.shadowTraceTime = t.elapsed();
+		CHK_PRIME( rtpQuerySetRays( shadowQuery, shadowRaysDesc ) );
+		CHK_PRIME( rtpQuerySetHits( shadowQuery, shadowHitsDesc ) );
+		cudaEventRecord( shadowStart );
+		CHK_PRIME( rtpQueryExecute( shadowQuery, RTP_QUERY_HINT_ASYNC ) );
+		cudaEventRecord( shadowEnd );
 		// process intersection results
 		finalizeConnections( counters.shadowRays, accumulator->DevPtr(), shadowHitBuffer->DevPtr(), shadowRayPotential->DevPtr() );
 	}
 	// gather ray tracing statistics
 	coreStats.totalShadowRays = counters.shadowRays;
 	coreStats.totalExtensionRays = counters.totalExtensionRays;
-	// present accumulator to final buffer
-	renderTarget.BindSurface();
+	// adaptive sampling: update the per-pixel moments and list the pixels that need more samples
+	if (adaptive)
+	{
+		uint* listSize = pixelList->DevPtr() + maxPixels;
+		selectAdaptivePixels( accumulator->DevPtr(), pixelMoments->DevPtr(), pixelList->DevPtr(), listSize,
+			pixelCount, scrspp, samplesTaken, adaptiveThreshold, ADAPTIVEMINFRAMES );
+		uint listed = 0;
+		CUDACHECK( "cudaMemcpy", cudaMemcpy( &listed, listSize, sizeof( uint ), cudaMemcpyDeviceToHost ) );
+		listedPixels = listed;
+	}
+	// present accumulator to final buffer; pixels received different sample counts when foveated, normalize first
 	samplesTaken += scrspp;
-	finalizeRender( accumulator->DevPtr(), scrwidth, scrheight, samplesTaken, brightness, contrast );
-	renderTarget.UnbindSurface();
+	const float4* frame = accumulator->DevPtr();
+	if (foveated) resolveFoveated( frame, sampleCountBuffer->DevPtr(), resolvedBuffer->DevPtr(), w, h, count, samplesTaken ), frame = resolvedBuffer->DevPtr();
+	if (targets) for (int i = 0; i < count; i++)
+	{
+		targets[i].BindSurface();
+		finalizeRender( frame + i * w * h, w, h, samplesTaken, brightness, contrast );
+		targets[i].UnbindSurface();
+	}
 	// finalize statistics
 	coreStats.renderTime = timer.elapsed();
+	coreStats.traceTime0 = CUDATools::Elapsed( traceStart[0], traceEnd[0] );
+	coreStats.traceTime1 = bounces > 1 ? CUDATools::Elapsed( traceStart[1], traceEnd[1] ) : 0;
+	coreStats.traceTimeX = 0;
+	for (int i = 2; i < bounces; i++) coreStats.traceTimeX += CUDATools::Elapsed( traceStart[i], traceEnd[i] );
+	coreStats.shadowTraceTime = 0;
+	if (counters.shadowRays > 0) cudaEventSynchronize( shadowEnd ), coreStats.shadowTraceTime = CUDATools::Elapsed( shadowStart, shadowEnd );
 	coreStats.shadeTime = 0;
 	for( int i = 0; i < MAXPATHLENGTH; i++ ) coreStats.shadeTime += CUDATools::Elapsed( shadeStart[i], shadeEnd[i] );
+	coreStats.sortTime = coreStats.sortShadeSaved = 0;
+	if (materialSort) for (int i = 0; i < bounces; i++) coreStats.sortTime += CUDATools::Elapsed( sortStart[i], sortEnd[i] );
+	// running average of the shade time per path, with and without sorting, to estimate what sorting saves
+	const float perPath = coreStats.shadeTime / (float)max( 1u, coreStats.totalExtensionRays );
+	float& average = shadeTimePerPath[materialSort ? 1 : 0];
+	average = average == 0 ? perPath : (0.9f * average + 0.1f * perPath);
+	if (materialSort && shadeTimePerPath[0] > 0) coreStats.sortShadeSaved = (shadeTimePerPath[0] - shadeTimePerPath[1]) * coreStats.totalExtensionRays;
 	coreStats.totalRays = coreStats.totalExtensionRays + coreStats.totalShadowRays;
 	coreStats.probedInstid = counters.probedInstid;
 	coreStats.probedTriid = counters.probedTriid;
@@ -568,6 +863,8 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Shutdown()
 {
+	// an unfinished top-level update still reads the instance transforms
+	if (topLevelBuilding) rtpModelFinish( *topLevel );
 	// delete ray buffers
 	delete extensionRayBuffer[0];
 	delete extensionRayBuffer[1];
@@ -576,6 +873,16 @@ void RenderCore::Shutdown()
 	delete extensionHitBuffer;
 	delete shadowRayBuffer;
 	delete shadowRayPotential;
+	delete sortedRayBuffer;
+	delete sortedRayExBuffer;
+	delete sortedHitBuffer;
+	delete sortKeyBuffer;
+	delete sortBinBuffer;
+	delete pixelMoments;
+	delete pixelList;
+	delete sampleCountBuffer;
+	delete resolvedBuffer;
+	delete texelBuffer;
 	delete shadowHitBuffer;
 	// delete internal data
 	delete accumulator;
@@ -588,15 +895,21 @@ void RenderCore::Shutdown()
 	delete hostMaterialBuffer;
 	delete skyPixelBuffer;
 	delete instDescBuffer;
+	delete instanceTransforms;
 	// delete light data
 	delete areaLightBuffer;
 	delete pointLightBuffer;
 	delete spotLightBuffer;
 	delete directionalLightBuffer;
+	delete lightTreeBuffer;
+	delete lightAliasBuffer;
 	// delete core scene representation
 	for (auto mesh : meshes) delete mesh;
 	for (auto instance : instances) delete instance;
+	if (extensionQuery) rtpQueryDestroy( extensionQuery );
+	if (shadowQuery) rtpQueryDestroy( shadowQuery );
 	delete topLevel;
+	if (instanceModelsDesc) rtpBufferDescDestroy( instanceModelsDesc ), rtpBufferDescDestroy( instanceTransformsDesc );
 	rtpBufferDescDestroy( extensionRaysDesc[0] );
 	rtpBufferDescDestroy( extensionRaysDesc[1] );
 	rtpBufferDescDestroy( extensionHitsDesc );
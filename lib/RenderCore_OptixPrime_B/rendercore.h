@@ -43,6 +43,9 @@ public:
 	// methods
 	void Init();
 	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast );
+	bool RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, const Convergence converge, const float brightness, const float contrast );
+	bool BakeViews( const ViewPyramid* views, const int count, const int w, const int h, const uint spp, float4* pixels );
+	bool BakeTexels( const float4* texels, const int count, const uint spp, float4* radiance );
 	void Setting( const char* name, const float value );
 	void SetTarget( GLTexture* target, const uint spp );
 	void Shutdown();
@@ -56,6 +59,8 @@ public:
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount );
+	void SetLightAliasTable( const CoreLightAlias* table, const int count );
 	void SetSkyData( const float3* pixels, const uint width, const uint height );
 	// geometry and instances:
 	// a scene is setup by first passing a number of meshes (geometry), then a number of instances.
@@ -64,12 +69,15 @@ public:
 	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
 	void UpdateToplevel();
-	int4 GetScreenParams();
+	int4 GetScreenParams( const int w, const int h );
 	void SetProbePos( const int2 pos );
 	CoreMaterial& GetCoreMaterial( int materialIdx ) { return materialBuffer->HostPtr()[materialIdx]; }
 	// internal methods
 private:
 	void SyncStorageType( const TexelStorage storage );
+	void ReserveBuffers( const int pixelCount, const uint spp );
+	void RenderFrame( const ViewPyramid* views, const int count, const int w, const int h, InteropTexture* targets,
+		Convergence converge, const float brightness, const float contrast, const float4* texels = 0 );
 	// data members
 	int scrwidth = 0, scrheight = 0;				// current screen width and height
 	int scrspp = 1;									// samples to be taken per screen pixel
@@ -80,17 +88,28 @@ private:
 	vector<CoreMesh*> meshes;						// list of meshes, to be referenced by the instances
 	vector<CoreInstance*> instances;					// list of instances: model id plus transform
 	bool instancesDirty = true;						// we need to sync the instance array to the device
+	vector<RTPmodel> instanceModels;				// model per instance for the top-level model; Prime reads these from host memory
+	CoreBuffer<mat4>* instanceTransforms = 0;		// instance transforms for the top-level model, persistent on the device
+	RTPbufferdesc instanceModelsDesc = 0;			// buffer descriptors for the above; recreated when the buffers grow
+	RTPbufferdesc instanceTransformsDesc = 0;
+	int firstDirtyInstance = INT_MAX, lastDirtyInstance = -1;	// range of instanceTransforms to sync to the device
 	InteropTexture renderTarget;					// CUDA will render to this texture
+	InteropTexture viewTargets[MAXVIEWS];			// targets of the views passed to RenderViews
+	GLTexture* viewTextures[MAXVIEWS] = {};			// textures linked to viewTargets
+	int3 frameLayout = make_int3( 0 );				// width, height and view count of the last frame, see RenderFrame
 	CoreBuffer<CoreMaterial>* materialBuffer = 0;	// material array
 	CoreMaterial* hostMaterialBuffer = 0;			// core-managed host-side copy of the materials for alpha tris
 	CoreBuffer<CoreLightTri>* areaLightBuffer;		// area lights
 	CoreBuffer<CorePointLight>* pointLightBuffer;	// point lights
 	CoreBuffer<CoreSpotLight>* spotLightBuffer;		// spot lights
 	CoreBuffer<CoreDirectionalLight>* directionalLightBuffer;	// directional lights
+	CoreBuffer<CoreLightTreeNode>* lightTreeBuffer = 0;	// light tree over area, point and spot lights
+	CoreBuffer<CoreLightAlias>* lightAliasBuffer = 0;	// alias table for power-proportional light selection
 	CoreBuffer<float4>* texel128Buffer = 0;			// texel buffer 1: hdr ARGB128 texture data
 	CoreBuffer<uint>* normal32Buffer = 0;			// texel buffer 2: integer-encoded normals
-	CoreBuffer<float3>* skyPixelBuffer = 0;			// skydome texture data
+	CoreBuffer<uint2>* skyPixelBuffer = 0;			// skydome texture pyramid, half precision; see SampleSkydome
 	RTPmodel* topLevel = 0;							// the top-level node; combines all instances and is the entry point for ray queries
+	bool topLevelBuilding = false;					// the asynchronous update of topLevel has not been finished yet
 	CoreBuffer<float4>* accumulator = 0;			// accumulator buffer for the path tracer
 	CoreBuffer<Counters>* counterBuffer = 0;		// counters for persistent threads
 	CoreBuffer<CoreInstanceDesc>* instDescBuffer = 0; // instance descriptor array
@@ -101,10 +120,28 @@ private:
 	CoreBuffer<Ray4>* shadowRayBuffer = 0;			// buffer for OptiX shadow ray data
 	CoreBuffer<float4>* shadowRayPotential = 0;		// potential throughput for shadow rays
 	CoreBuffer<uint>* shadowHitBuffer = 0;			// buffer for OptiX intersection results, 1 bit per shadow ray
+	bool materialSort = false;						// sort paths by material before shading, see sorting_shared.h
+	CoreBuffer<Ray4>* sortedRayBuffer = 0;			// extension rays in material order
+	CoreBuffer<float4>* sortedRayExBuffer = 0;		// additional path state data in material order
+	CoreBuffer<Intersection>* sortedHitBuffer = 0;	// intersection results in material order
+	CoreBuffer<uint>* sortKeyBuffer = 0;			// sort key per path
+	CoreBuffer<uint>* sortBinBuffer = 0;			// path count, then first index, per sort bin
+	bool adaptiveSampling = false;					// sample only pixels with a high variance, see adaptiveSamplingKernel
+	float adaptiveThreshold = 0.02f;				// relative standard error at which a pixel is considered converged
+	CoreBuffer<float4>* pixelMoments = 0;			// per-pixel luminance moments for adaptive sampling
+	CoreBuffer<uint>* pixelList = 0;				// pixels to be sampled in the next frame, followed by their count
+	int listedPixels = -1;							// size of the pixel list; -1: sample all pixels
+	float4 fovea = make_float4( 0.5f, 0.5f, 0, 0.25f );	// foveated rendering: center, radius and peripheral rate
+	CoreBuffer<uint>* sampleCountBuffer = 0;		// foveated rendering: samples per pixel
+	CoreBuffer<float4>* resolvedBuffer = 0;			// foveated rendering: accumulator normalized to samplesTaken
+	CoreBuffer<float4>* texelBuffer = 0;			// lightmap bakes: position and normal per texel, see BakeTexels
+	float shadeTimePerPath[2] = { 0, 0 };			// running average of shade time per path, without and with sorting
 	RTPbufferdesc extensionRaysDesc[2];				// buffer descriptor for extension rays
 	RTPbufferdesc extensionHitsDesc;				// buffer descriptor for extension ray hits
 	RTPbufferdesc shadowRaysDesc;					// buffer descriptor for shadow rays
 	RTPbufferdesc shadowHitsDesc;					// buffer descriptor for shadow ray hits
+	RTPquery extensionQuery = 0;					// closest hit query, reused for all bounces; 0 after a buffer resize
+	RTPquery shadowQuery = 0;						// any hit query for the shadow rays
 	CoreTexDesc* texDescs = 0;						// array of texture descriptors
 	int textureCount = 0;							// size of texture descriptor array
 	int SMcount = 0;								// multiprocessor count, used for persistent threads
@@ -122,6 +159,9 @@ private:
 	CoreBuffer<uint>* blueNoise = 0;
 	// timing
 	cudaEvent_t shadeStart[MAXPATHLENGTH], shadeEnd[MAXPATHLENGTH];	// events for timing CUDA code
+	cudaEvent_t sortStart[MAXPATHLENGTH], sortEnd[MAXPATHLENGTH];
+	cudaEvent_t traceStart[MAXPATHLENGTH], traceEnd[MAXPATHLENGTH];	// asynchronous queries are timed on the stream
+	cudaEvent_t shadowStart, shadowEnd;
 public:
 	static RTPcontext context;						// the OptiX prime context
 	CoreStats coreStats;							// rendering statistics
@@ -27,6 +27,7 @@ CoreMesh::~CoreMesh()
 	delete triangles;
 	buffers.positions4->destroy();
 	geometryTriangles->destroy();
+	if (acceleration) acceleration->destroy();
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -52,6 +53,8 @@ void CoreMesh::SetGeometry( const float4* vertexData, const int vertexCount, con
 	geometryTriangles->setBuildFlags( RTgeometrybuildflags( 0 ) );
 	if (attribProgram) geometryTriangles->setAttributeProgram( attribProgram );
 	geometryTriangles->validate();
+	// one bvh for all instances of this mesh; rebuilt when the geometry changes
+	if (!acceleration) acceleration = RenderCore::context->createAcceleration( "Trbvh" ); else acceleration->markDirty();
 }
 
 // EOF
\ No newline at end of file
@@ -42,6 +42,7 @@ public:
 	CoreBuffer<CoreTri4>* triangles = 0;		// original triangle data, as received from RenderSystem
 	MeshBuffers buffers;					// OptiX geometry data buffers
 	optix::GeometryTriangles geometryTriangles = 0; // OptiX geometryTriangles descriptor
+	optix::Acceleration acceleration = 0;	// bvh over the triangles, shared by the geometry groups of all instances
 	// context, for global access
 	static optix::Program attribProgram;	// Optix triangle attribute program
 	static RenderCore* renderCore;			// for access to material list, in case of alpha mapped triangles
@@ -61,6 +62,7 @@ public:
 	optix::GeometryGroup geometryGroup = 0;			// minimum OptiX scene: GeometryGroup, referencing
 	optix::Transform transform = 0;					// a Transform, which has as a child a
 	optix::GeometryInstance geometryInstance = 0;	// GeometryInstance, which in turn references Geometry.
+													// The GeometryGroup uses the Acceleration of the CoreMesh.
 };
 
 } // namespace lh2core
@@ -149,8 +149,9 @@ template <class T> class InteropBuffer
 	// The InteropBuffer facilitates this method. An InteropBuffer is constructed much like a 
 	// CoreBuffer, but it can now also be conveniently used to feed an rtBuffer object in OptiX
 	// code.
-	// Additionally, we can now create rtBuffers, and access the related device pointer for use
-	// in CUDA. This behavior is assumed whenever bufferType is not RT_BUFFER_INPUT.
+	// 1D buffers are always allocated by CUDA, also the ones that OptiX programs write to: the
+	// OptiX programs and the shade kernels then use the same memory on a single device, and
+	// OptiX has nothing to synchronize at launch. Only 2D buffers are created by OptiX.
 public:
 	InteropBuffer( __int64 elementCount, __int64 loc, uint bufferType, RTformat rtFormat, const char* name, void* source = 0 )
 	{
@@ -158,28 +159,17 @@ public:
 		// If this is as efficient as the built-in types, we can use RT_FORMAT_USER for
 		// all buffers, which reduces the argument count of the constructor by 1.
 		// Let's check impact on performance in OptiX 5.2 before doing this.
-		if (bufferType == RT_BUFFER_INPUT)
-		{
-			// this buffer is for OptiX to read from; CUDA creates it
-			// Note: RT_BUFFER_COPY_ON_DIRTY supposedly limits buffer syncs to those occasions where we explicitly 
-			// marked the buffer as dirty. The idea is that this never happens, and the flag is intended to prevent 
-			// smart behavior from OptiX. These assumptions are not carefully verified though.
-			cudaBuffer = new CoreBuffer<T>( max( 1, elementCount /* OptiX buffers may not be nullptrs */ ), loc, source );
-			optixBuffer = RenderCore::context->createBufferForCUDA( bufferType | RT_BUFFER_COPY_ON_DIRTY, rtFormat );
-			if (rtFormat == RT_FORMAT_USER) optixBuffer->setElementSize( sizeof( T ) );
-			optixBuffer->setDevicePointer( 0, cudaBuffer->DevPtr() );
-			RenderCore::context[name]->setBuffer( optixBuffer );
-			cudaOwned = true;
-		}
-		else // RT_BUFFER_INPUT or RT_BUFFER_INPUT_OUTPUT
-		{
-			// this buffer is for OptiX to write to; OptiX creates it
-			assert( source == 0 /* no host-side init data for OptiX buffers */ );
-			optixBuffer = RenderCore::context->createBuffer( bufferType | RT_BUFFER_COPY_ON_DIRTY, rtFormat, elementCount );
-			if (rtFormat == RT_FORMAT_USER) optixBuffer->setElementSize( sizeof( T ) );
-			RenderCore::context[name]->setBuffer( optixBuffer );
-			cudaOwned = false;
-		}
+		// CUDA creates the buffer, for reading and writing alike; OptiX gets its device pointer.
+		// Note: RT_BUFFER_COPY_ON_DIRTY supposedly limits buffer syncs to those occasions where we explicitly 
+		// marked the buffer as dirty. The idea is that this never happens, and the flag is intended to prevent 
+		// smart behavior from OptiX. These assumptions are not carefully verified though.
+		cudaBuffer = new CoreBuffer<T>( max( 1, elementCount /* OptiX buffers may not be nullptrs */ ), loc, source );
+		optixBuffer = RenderCore::context->createBufferForCUDA( bufferType | RT_BUFFER_COPY_ON_DIRTY, rtFormat );
+		if (rtFormat == RT_FORMAT_USER) optixBuffer->setElementSize( sizeof( T ) );
+		optixBuffer->setSize( cudaBuffer->GetSize() );
+		optixBuffer->setDevicePointer( 0 /* not considering multi-GPU */, cudaBuffer->DevPtr() );
+		RenderCore::context[name]->setBuffer( optixBuffer );
+		cudaOwned = true;
 	}
 	InteropBuffer( __int64 width, __int64 height, __int64 loc, uint bufferType, RTformat rtFormat, const char* name, void* source = 0 )
 	{
@@ -103,7 +103,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 	{
 		if (pathLength < MAXPATHLENGTH)
 		{
-			const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 );
+			const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays );
 			pathStates[extensionRayIdx] = make_float4( I + D * geometryEpsilon, O4.w );
 			pathStates[extensionRayIdx + stride] = D4;
 			if (!(isfinite( T4.x + T4.y + T4.z ))) T4 = make_float4( 0, 0, 0, T4.w );
@@ -190,7 +190,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 				FIXNAN_FLOAT3( contribution );
 				CLAMPINTENSITY;
 				// add fire-and-forget shadow ray to the connections buffer
-				const uint shadowRayIdx = atomicAdd( &counters->shadowRays, 1 ); // compaction
+				const uint shadowRayIdx = AtomicAggInc( &counters->shadowRays ); // compaction
 				connections[shadowRayIdx] = make_float4( SafeOrigin( I, L, N, geometryEpsilon ), 0 ); // O4
 				connections[shadowRayIdx + stride * MAXPATHLENGTH] = make_float4( L, dist - 2 * geometryEpsilon ); // D4
 				connections[shadowRayIdx + stride * 2 * MAXPATHLENGTH] = make_float4( contribution, __int_as_float( pixelIdx ) ); // E4
@@ -222,7 +222,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 	if (newBsdfPdf < EPSILON || isnan( newBsdfPdf )) return;
 
 	// write extension ray
-	const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 ); // compact
+	const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays ); // compact
 	const uint packedNormal = PackNormal( fN );
 	if (!(FLAGS & S_SPECULAR)) FLAGS |= S_BOUNCED; else FLAGS |= S_VIASPECULAR;
 	((float4*)pathStates)[extensionRayIdx] = make_float4( SafeOrigin( I, R, N, geometryEpsilon ), __uint_as_float( FLAGS ) );
@@ -227,6 +227,9 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 	// Note: for first-time setup, meshes are expected to be passed in sequential order.
 	// This will result in new CoreInstance pointers being pushed into the instances vector.
 	// Subsequent instance changes (typically: transforms) will be applied to existing CoreInstances.
+	// The geometry instance is per instance, as it holds the instanceIndex for the closest hit program. The
+	// acceleration is per mesh: OptiX shares a bvh between geometry groups whose children reference the same
+	// geometry, so a mesh that is instanced many times is built and stored once.
 	if (instanceIdx >= instances.size())
 	{
 		instances.push_back( new CoreInstance() );
@@ -237,11 +240,17 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 		// put the geometry instance in a geometry group
 		instances[instanceIdx]->geometryGroup = context->createGeometryGroup();
 		instances[instanceIdx]->geometryGroup->addChild( instances[instanceIdx]->geometryInstance );
-		instances[instanceIdx]->geometryGroup->setAcceleration( context->createAcceleration( "Trbvh" ) );
+		instances[instanceIdx]->geometryGroup->setAcceleration( meshes[meshIdx]->acceleration );
 		// set a transform for the geometry group
 		instances[instanceIdx]->transform = context->createTransform();
 		instances[instanceIdx]->transform->setChild( instances[instanceIdx]->geometryGroup );
 	}
+	else if (instances[instanceIdx]->mesh != meshIdx)
+	{
+		// the instance now references a different mesh: switch the geometry and the shared bvh
+		instances[instanceIdx]->geometryInstance->setGeometryTriangles( meshes[meshIdx]->geometryTriangles );
+		instances[instanceIdx]->geometryGroup->setAcceleration( meshes[meshIdx]->acceleration );
+	}
 	// update the matrices for the transform
 	mat4 inverted = matrix;
 	inverted.Inverted();
@@ -469,9 +478,10 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 			}
 			else
 			{
-				invT = mat4::Identity();
+				T = invT = mat4::Identity();
 			}
 			id.invTransform = *(float4x4*)&invT;
+			id.prevTransform = *(float4x4*)&T; // no motion vectors in this core
 			instDescArray.push_back( id );
 		}
 		if (instDescBuffer == 0 || instDescBuffer->GetSize() < (int)instances.size())
@@ -61,6 +61,11 @@ void CoreAPI::SetTarget( GLTexture* target, const uint spp )
 	core->SetTarget( target, spp );
 }
 
+bool CoreAPI::SetHostTarget( float4* pixels, const int width, const int height, const uint spp )
+{
+	return core->SetHostTarget( pixels, width, height, spp );
+}
+
 void CoreAPI::Setting( const char* name, float value )
 {
 	core->Setting( name, value );
@@ -99,12 +104,22 @@ void CoreAPI::SetLights( const CoreLightTri* areaLights, const int areaLightCoun
 		directionalLights, directionalLightCount );
 }
 
+void CoreAPI::SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount )
+{
+	core->SetLightTree( nodes, nodeCount );
+}
+
+void CoreAPI::SetLightAliasTable( const CoreLightAlias* table, const int count )
+{
+	core->SetLightAliasTable( table, count );
+}
+
 void CoreAPI::SetSkyData( const float3* pixels, const uint width, const uint height )
 {
 	core->SetSkyData( pixels, width, height );
 }
 
-void CoreAPI::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags )
+void CoreAPI::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint )
 {
 	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags );
 }
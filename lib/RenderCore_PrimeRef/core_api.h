@@ -32,6 +32,8 @@ public:
 	void SetProbePos( const int2 pos );
 	// SetTarget: specify an OpenGL texture as a render target for the path tracer.
 	void SetTarget( GLTexture* target, const uint spp );
+	// SetHostTarget: render to host memory, without OpenGL.
+	bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
 	// Setting: modify a render setting
 	void Setting( const char* name, float value );
 	// Render: produce one frame. Convergence can be 'Converge' or 'Restart'.
@@ -47,10 +49,14 @@ public:
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	// SetLightTree: update the light tree over the area, point and spot lights.
+	void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount );
+	// SetLightAliasTable: update the alias table for power-proportional light selection.
+	void SetLightAliasTable( const CoreLightAlias* table, const int count );
 	// SetSkyData: specify the data required for sky dome rendering.
 	void SetSkyData( const float3* pixels, const uint width, const uint height );
 	// SetGeometry: update the geometry for a single mesh.
-	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
 	// SetInstance: update the data on a single instance.
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
 	// UpdateTopLevel: trigger a top-level BVH update.
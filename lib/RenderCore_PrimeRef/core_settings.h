@@ -28,6 +28,7 @@
 // #define GGXCONDUCTOR // alternative is the diffuse ggx brdf
 #define SINGLEBOUNCE		// perform only a single diffuse bounce
 #define CONSISTENTNORMALS	// consistent normal interpolation; don't use with filtering?
+// #define CPUTRAVERSAL		// trace with Prime's CPU context, e.g. to validate GPU traversal
 
 // low-level settings
 #define SCATTERSTEPS 1		// max bounces in microfacet evaluation (multiscatter bsdf)
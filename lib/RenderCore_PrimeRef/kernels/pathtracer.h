@@ -76,7 +76,8 @@ void shadeKernel( float4* accumulator, const uint stride,
 	// use skydome if we didn't hit any geometry
 	if (PRIMIDX == NOHIT)
 	{
-		float3 contribution = throughput * make_float3( SampleSkydome( D, pathLength ) );
+		// reference: only primary rays use a filtered level, for the extent of the pixel
+		float3 contribution = throughput * make_float3( SampleSkydome( D, pathLength, pathLength == 1 ? spreadAngle : 0 ) );
 		FIXNAN_FLOAT3( contribution );
 		accumulator[pixelIdx] += make_float4( contribution, 0 );
 		return;
@@ -126,7 +127,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 		float3 contribution = throughput * sampledBSDF * lightColor * (NdotL / (pickProb * lightPdf));
 		FIXNAN_FLOAT3( contribution );
 		// add fire-and-forget shadow ray to the connections buffer
-		const uint shadowRayIdx = atomicAdd( &counters->shadowRays, 1 ); // compaction
+		const uint shadowRayIdx = AtomicAggInc( &counters->shadowRays ); // compaction
 		connections[shadowRayIdx].O4 = make_float4( SafeOrigin( I, L, N, geometryEpsilon ), 0 );
 		connections[shadowRayIdx].D4 = make_float4( L, dist - 2 * geometryEpsilon );
 		potentials[shadowRayIdx] = make_float4( contribution, __int_as_float( pixelIdx ) );
@@ -145,7 +146,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 	throughput *= (max( 0.0f, dot( fN, R )) / (p * newBsdfPdf)) * bsdf;
 
 	// write extension ray
-	const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 ); // compact
+	const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays ); // compact
 	FIXNAN_FLOAT3( throughput );
 	extensionRaysOut[extensionRayIdx].O4 = make_float4( SafeOrigin( I, R, N, geometryEpsilon ), 0 );
 	extensionRaysOut[extensionRayIdx].D4 = make_float4( R, 1e34f );
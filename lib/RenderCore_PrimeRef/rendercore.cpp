@@ -29,6 +29,7 @@ namespace lh2core
 // forward declaration of cuda code
 const surfaceReference* renderTargetRef();
 void finalizeRender( const float4* accumulator, const int w, const int h, const int spp, const float brightness, const float contrast );
+void SetFinalizeTarget( float4* p, const int firstRow );
 void shade( const int pathCount, float4* accumulator, const uint stride,
 	const Ray4* extensionRays, const float4* extensionData, const Intersection* hits,
 	Ray4* extensionRaysOut, float4* extensionDataOut, Ray4* shadowRays, float4* connectionT4,
@@ -46,12 +47,14 @@ void SetAreaLights( CoreLightTri* p );
 void SetPointLights( CorePointLight* p );
 void SetSpotLights( CoreSpotLight* p );
 void SetDirectionalLights( CoreDirectionalLight* p );
+void SetLightTreeNodes( CoreLightTreeNode* p );
+void SetLightAliasEntries( CoreLightAlias* p );
 void SetLightCounts( int area, int point, int spot, int directional );
 void SetARGB32Pixels( uint* p );
 void SetARGB128Pixels( float4* p );
 void SetNRM32Pixels( uint* p );
-void SetSkyPixels( float3* p );
-void SetSkySize( int w, int h );
+void SetSkyPixels( uint2* p );
+void SetSkySize( int w, int h, int levels );
 void SetDebugData( float4* p );
 void SetGeometryEpsilon( float e );
 void SetClampValue( float c );
@@ -67,6 +70,37 @@ using namespace lh2core;
 
 RTPcontext RenderCore::context = 0;
 
+// ray and hit buffers: device memory for the CUDA context, staged on the host for the CPU context
+#ifdef CPUTRAVERSAL
+#define RAYBUFFER			(ON_HOST | ON_DEVICE)
+#define PRIMEBUFFER( b )	RTP_BUFFER_TYPE_HOST, (b)->HostPtr()
+#else
+#define RAYBUFFER			ON_DEVICE
+#define PRIMEBUFFER( b )	RTP_BUFFER_TYPE_CUDA_LINEAR, (b)->DevPtr()
+#endif
+
+//  +-----------------------------------------------------------------------------+
+//  |  TraceQuery                                                                 |
+//  |  Execute a Prime query for a range of rays. With CPUTRAVERSAL, the rays     |
+//  |  produced by the kernels are fetched first, and the hits are sent back to   |
+//  |  the device afterwards, so shading code sees the same buffers.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <class T> static void TraceQuery( RTPquery query, RTPbufferdesc raysDesc, RTPbufferdesc hitsDesc,
+	CoreBuffer<Ray4>* rays, CoreBuffer<T>* hits, const int rayCount, const int hitCount )
+{
+#ifdef CPUTRAVERSAL
+	rays->CopyToHost( 0, rayCount );
+#endif
+	CHK_PRIME( rtpBufferDescSetRange( raysDesc, 0, rayCount ) );
+	CHK_PRIME( rtpBufferDescSetRange( hitsDesc, 0, rayCount ) );
+	CHK_PRIME( rtpQuerySetRays( query, raysDesc ) );
+	CHK_PRIME( rtpQuerySetHits( query, hitsDesc ) );
+	CHK_PRIME( rtpQueryExecute( query, RTP_QUERY_HINT_NONE ) );
+#ifdef CPUTRAVERSAL
+	hits->CopyToDevice( 0, hitCount );
+#endif
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::GetScreenParams                                                |
 //  |  Helper function - fills an int4 with values related to screen size.  LH2'19|
@@ -109,11 +143,18 @@ void RenderCore::Init()
 	memcpy( coreStats.deviceName, properties.name, strlen( properties.name ) + 1 );
 	printf( "running on GPU: %s (%i SMs, %iGB VRAM)\n", coreStats.deviceName, coreStats.SMcount, (int)(coreStats.VRAM >> 10) );
 	// setup OptiX Prime
+#ifdef CPUTRAVERSAL
+	CHK_PRIME( rtpContextCreate( RTP_CONTEXT_TYPE_CPU, &context ) );
+	printf( "tracing rays on the CPU; shading stays on the GPU.\n" );
+#else
 	CHK_PRIME( rtpContextCreate( RTP_CONTEXT_TYPE_CUDA, &context ) );
+#endif
 	const char* versionString;
 	CHK_PRIME( rtpGetVersionString( &versionString ) );
 	printf( "%s\n", versionString );
+#ifndef CPUTRAVERSAL
 	CHK_PRIME( rtpContextSetCudaDeviceNumbers( context, 1, &device ) );
+#endif
 	// prepare the top-level 'model' node; instances will be added to this.
 	topLevel = new RTPmodel();
 	CHK_PRIME( rtpModelCreate( context, topLevel ) );
@@ -138,14 +179,47 @@ void RenderCore::Init()
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetTarget( GLTexture* target, const uint spp )
 {
-	// synchronize OpenGL viewport
-	scrwidth = target->width;
-	scrheight = target->height;
-	scrspp = spp;
+	ReleaseHostTarget();
 	renderTarget.SetTexture( target );
-	bool firstFrame = (maxPixels == 0);
 	// notify CUDA about the texture
 	renderTarget.LinkToSurface( renderTargetRef() );
+	// synchronize OpenGL viewport
+	ResizeTarget( target->width, target->height, spp );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetHostTarget                                                  |
+//  |  Headless rendering: finalize each frame into host memory, registered as    |
+//  |  mapped pinned memory, so no OpenGL context is needed; for tools that       |
+//  |  compare against this core. Returns false if registration fails.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::SetHostTarget( float4* pixels, const int width, const int height, const uint spp )
+{
+	ReleaseHostTarget();
+	if (cudaHostRegister( pixels, width * height * sizeof( float4 ), cudaHostRegisterMapped ) != cudaSuccess) return false;
+	cudaHostGetDevicePointer( (void**)&hostTargetDevPtr, pixels, 0 );
+	hostTarget = pixels;
+	ResizeTarget( width, height, spp );
+	return true;
+}
+void RenderCore::ReleaseHostTarget()
+{
+	if (!hostTarget) return;
+	cudaDeviceSynchronize(); // the last frame may still be writing to it
+	cudaHostUnregister( hostTarget );
+	hostTarget = hostTargetDevPtr = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ResizeTarget                                                   |
+//  |  Size the buffers for the target of SetTarget or SetHostTarget.       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::ResizeTarget( const int width, const int height, const uint spp )
+{
+	scrwidth = width;
+	scrheight = height;
+	scrspp = spp;
+	bool firstFrame = (maxPixels == 0);
 	// see if we need to reallocate our buffers
 	bool reallocate = false;
 	if (scrwidth * scrheight > maxPixels || spp != currentSPP)
@@ -177,20 +251,20 @@ void RenderCore::SetTarget( GLTexture* target, const uint spp )
 		delete shadowHitBuffer;
 		delete accumulator;
 		const uint maxShadowRays = maxPixels * spp; // we will trace shadow rays per pass to save memory
-		extensionHitBuffer = new CoreBuffer<Intersection>( maxPixels * spp, ON_DEVICE );
-		shadowRayBuffer = new CoreBuffer<Ray4>( maxShadowRays, ON_DEVICE );
+		extensionHitBuffer = new CoreBuffer<Intersection>( maxPixels * spp, RAYBUFFER );
+		shadowRayBuffer = new CoreBuffer<Ray4>( maxShadowRays, RAYBUFFER );
 		shadowRayPotential = new CoreBuffer<float4>( maxShadowRays, ON_DEVICE ); // .w holds pixel index
-		shadowHitBuffer = new CoreBuffer<uint>( (maxShadowRays + 31) >> 5 /* one bit per ray */, ON_DEVICE );
+		shadowHitBuffer = new CoreBuffer<uint>( (maxShadowRays + 31) >> 5 /* one bit per ray */, RAYBUFFER );
 		accumulator = new CoreBuffer<float4>( maxPixels * 2, ON_DEVICE );
 		for (int i = 0; i < 2; i++)
 		{
-			extensionRayBuffer[i] = new CoreBuffer<Ray4>( maxPixels * spp, ON_DEVICE ),
+			extensionRayBuffer[i] = new CoreBuffer<Ray4>( maxPixels * spp, RAYBUFFER ),
 				extensionRayExBuffer[i] = new CoreBuffer<float4>( maxPixels * 2 * spp, ON_DEVICE );
-			CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_RAY_ORIGIN_TMIN_DIRECTION_TMAX, RTP_BUFFER_TYPE_CUDA_LINEAR, extensionRayBuffer[i]->DevPtr(), &extensionRaysDesc[i] ) );
+			CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_RAY_ORIGIN_TMIN_DIRECTION_TMAX, PRIMEBUFFER( extensionRayBuffer[i] ), &extensionRaysDesc[i] ) );
 		}
-		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_HIT_T_TRIID_INSTID_U_V, RTP_BUFFER_TYPE_CUDA_LINEAR, extensionHitBuffer->DevPtr(), &extensionHitsDesc ) );
-		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_RAY_ORIGIN_TMIN_DIRECTION_TMAX, RTP_BUFFER_TYPE_CUDA_LINEAR, shadowRayBuffer->DevPtr(), &shadowRaysDesc ) );
-		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_HIT_BITMASK, RTP_BUFFER_TYPE_CUDA_LINEAR, shadowHitBuffer->DevPtr(), &shadowHitsDesc ) );
+		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_HIT_T_TRIID_INSTID_U_V, PRIMEBUFFER( extensionHitBuffer ), &extensionHitsDesc ) );
+		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_RAY_ORIGIN_TMIN_DIRECTION_TMAX, PRIMEBUFFER( shadowRayBuffer ), &shadowRaysDesc ) );
+		CHK_PRIME( rtpBufferDescCreate( context, RTP_BUFFER_FORMAT_HIT_BITMASK, PRIMEBUFFER( shadowHitBuffer ), &shadowHitsDesc ) );
 		printf( "buffers resized for %i pixels @ %i samples.\n", maxPixels, spp );
 	}
 	// clear the accumulator
@@ -383,16 +457,39 @@ void RenderCore::SetLights( const CoreLightTri* areaLights, const int areaLightC
 	SetLightCounts( areaLightCount, pointLightCount, spotLightCount, directionalLightCount );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLightTree                                                   |
+//  |  Set the light tree, used for light selection with LIGHTTREE.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount )
+{
+	delete lightTreeBuffer;
+	SetLightTreeNodes( (lightTreeBuffer = new CoreBuffer<CoreLightTreeNode>( nodeCount, ON_DEVICE, nodes ))->DevPtr() );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLightAliasTable                                             |
+//  |  Set the alias table, used for light selection with ALIASLIGHTS.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLightAliasTable( const CoreLightAlias* table, const int count )
+{
+	delete lightAliasBuffer;
+	SetLightAliasEntries( (lightAliasBuffer = new CoreBuffer<CoreLightAlias>( count, ON_DEVICE, table ))->DevPtr() );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::SetSkyData                                                     |
-//  |  Set the sky dome data.                                               LH2'19|
+//  |  Set the sky dome data. It is stored as a pyramid of half precision         |
+//  |  texels; SampleSkydome picks the level from the ray cone.             LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetSkyData( const float3* pixels, const uint width, const uint height )
 {
+	vector<uint2> pyramid;
+	const int levels = CUDATools::BuildSkyPyramid( pixels, width, height, pyramid );
 	delete skyPixelBuffer;
-	skyPixelBuffer = new CoreBuffer<float3>( width * height, ON_DEVICE, pixels );
+	skyPixelBuffer = new CoreBuffer<uint2>( pyramid.size(), ON_DEVICE, pyramid.data() );
 	SetSkyPixels( skyPixelBuffer->DevPtr() );
-	SetSkySize( width, height );
+	SetSkySize( width, height, levels );
 	skywidth = width;
 	skyheight = height;
 }
@@ -454,6 +551,7 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 			id.triangles = meshes[instance->mesh]->triangles->DevPtr();
 			mat4 T = instance->transform.Inverted();
 			id.invTransform = *(float4x4*)&T;
+			id.prevTransform = *(float4x4*)&instance->transform; // no motion vectors in this core
 			instDescArray.push_back( id );
 		}
 		if (instDescBuffer == 0 || instDescBuffer->GetSize() < (int)instances.size())
@@ -484,11 +582,7 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 	{
 		// extend
 		Timer t;
-		CHK_PRIME( rtpBufferDescSetRange( extensionRaysDesc[inBuffer], 0, pathCount ) );
-		CHK_PRIME( rtpBufferDescSetRange( extensionHitsDesc, 0, pathCount ) );
-		CHK_PRIME( rtpQuerySetRays( query, extensionRaysDesc[inBuffer] ) );
-		CHK_PRIME( rtpQuerySetHits( query, extensionHitsDesc ) );
-		CHK_PRIME( rtpQueryExecute( query, RTP_QUERY_HINT_NONE ) );
+		TraceQuery( query, extensionRaysDesc[inBuffer], extensionHitsDesc, extensionRayBuffer[inBuffer], extensionHitBuffer, pathCount, pathCount );
 		if (pathLength == 1) coreStats.traceTime0 = t.elapsed(), coreStats.primaryRayCount = pathCount;
 		else if (pathLength == 2)  coreStats.traceTime1 = t.elapsed(), coreStats.bounce1RayCount = pathCount;
 		else coreStats.traceTimeX = t.elapsed(), coreStats.deepRayCount = pathCount;
@@ -516,11 +610,7 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 		if (counters.shadowRays > 0)
 		{
 			t.reset();
-			CHK_PRIME( rtpBufferDescSetRange( shadowRaysDesc, 0, counters.shadowRays ) );
-			CHK_PRIME( rtpBufferDescSetRange( shadowHitsDesc, 0, counters.shadowRays ) );
-			CHK_PRIME( rtpQuerySetRays( squery, shadowRaysDesc ) );
-			CHK_PRIME( rtpQuerySetHits( squery, shadowHitsDesc ) );
-			CHK_PRIME( rtpQueryExecute( squery, RTP_QUERY_HINT_NONE ) );
+			TraceQuery( squery, shadowRaysDesc, shadowHitsDesc, shadowRayBuffer, shadowHitBuffer, counters.shadowRays, (counters.shadowRays + 31) >> 5 );
 			coreStats.shadowTraceTime += t.elapsed();
 			finalizeConnections( counters.shadowRays, accumulator->DevPtr(), shadowHitBuffer->DevPtr(), shadowRayPotential->DevPtr() );
 		}
@@ -535,10 +625,12 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 	coreStats.totalExtensionRays = counters.totalExtensionRays;
 	coreStats.totalShadowRays = counters.totalShadowRays;
 	// present accumulator to final buffer
-	renderTarget.BindSurface();
+	SetFinalizeTarget( hostTargetDevPtr, 0 ); // 0 finalizes to the bound surface
+	if (!hostTarget) renderTarget.BindSurface();
 	samplesTaken += scrspp;
 	finalizeRender( accumulator->DevPtr(), scrwidth, scrheight, samplesTaken, brightness, contrast );
-	renderTarget.UnbindSurface();
+	if (!hostTarget) renderTarget.UnbindSurface();
+	else cudaDeviceSynchronize(); // the caller reads the frame as soon as Render returns
 	// finalize statistics
 	coreStats.renderTime = timer.elapsed();
 	coreStats.shadeTime = 0;
@@ -555,6 +647,7 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Shutdown()
 {
+	ReleaseHostTarget();
 	// delete ray buffers
 	delete extensionRayBuffer[0];
 	delete extensionRayBuffer[1];
@@ -580,6 +673,8 @@ void RenderCore::Shutdown()
 	delete pointLightBuffer;
 	delete spotLightBuffer;
 	delete directionalLightBuffer;
+	delete lightTreeBuffer;
+	delete lightAliasBuffer;
 	// delete core scene representation
 	for (auto mesh : meshes) delete mesh;
 	for (auto instance : instances) delete instance;
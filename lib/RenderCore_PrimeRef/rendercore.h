@@ -45,6 +45,7 @@ public:
 	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast );
 	void Setting( const char* name, const float value );
 	void SetTarget( GLTexture* target, const uint spp );
+	bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
 	void Shutdown();
 	void KeyDown( const uint key ) {}
 	void KeyUp( const uint key ) {}
@@ -56,6 +57,8 @@ public:
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount );
+	void SetLightAliasTable( const CoreLightAlias* table, const int count );
 	void SetSkyData( const float3* pixels, const uint width, const uint height );
 	// geometry and instances:
 	// a scene is setup by first passing a number of meshes (geometry), then a number of instances.
@@ -70,6 +73,8 @@ public:
 	// internal methods
 private:
 	void SyncStorageType( const TexelStorage storage );
+	void ResizeTarget( const int width, const int height, const uint spp );
+	void ReleaseHostTarget();
 	// data members
 	int scrwidth = 0, scrheight = 0;				// current screen width and height
 	int scrspp = 1;									// samples to be taken per screen pixel
@@ -81,15 +86,19 @@ private:
 	vector<CoreInstance*> instances;					// list of instances: model id plus transform
 	bool instancesDirty = true;						// we need to sync the instance array to the device
 	InteropTexture renderTarget;					// CUDA will render to this texture
+	float4* hostTarget = 0;							// headless rendering: registered host memory that receives the frame
+	float4* hostTargetDevPtr = 0;					// device side mapping of hostTarget
 	CoreBuffer<CoreMaterial>* materialBuffer = 0;	// material array
 	CoreMaterial* hostMaterialBuffer = 0;			// core-managed host-side copy of the materials for alpha tris
 	CoreBuffer<CoreLightTri>* areaLightBuffer;		// area lights
 	CoreBuffer<CorePointLight>* pointLightBuffer;	// point lights
 	CoreBuffer<CoreSpotLight>* spotLightBuffer;		// spot lights
 	CoreBuffer<CoreDirectionalLight>* directionalLightBuffer;	// directional lights
+	CoreBuffer<CoreLightTreeNode>* lightTreeBuffer = 0;	// light tree over area, point and spot lights
+	CoreBuffer<CoreLightAlias>* lightAliasBuffer = 0;	// alias table for power-proportional light selection
 	CoreBuffer<float4>* texel128Buffer = 0;			// texel buffer 1: hdr ARGB128 texture data
 	CoreBuffer<uint>* normal32Buffer = 0;			// texel buffer 2: integer-encoded normals
-	CoreBuffer<float3>* skyPixelBuffer = 0;			// skydome texture data
+	CoreBuffer<uint2>* skyPixelBuffer = 0;			// skydome texture pyramid, half precision; see SampleSkydome
 	RTPmodel* topLevel = 0;							// the top-level node; combines all instances and is the entry point for ray queries
 	CoreBuffer<float4>* accumulator = 0;			// accumulator buffer for the path tracer
 	CoreBuffer<Counters>* counterBuffer = 0;		// counters for persistent threads
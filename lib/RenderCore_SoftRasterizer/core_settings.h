@@ -22,6 +22,10 @@
 
 // core-specific settings
 // #define NOTEXTURES		// all texture reads will be white
+#define TILESIZE	64		// screen tiles are rasterized in parallel, each with its own z-buffer
+#define SETUPBATCH	4096	// triangles per triangle setup job
+#define HIZBLOCK	8		// hierarchical z-buffer block size; a tile may hold at most 64 blocks
+#define HIZTRIAREA	1024	// triangles with larger screen bounds are tested against the hierarchical z-buffer
 
 #include "platform.h"
 #include "system.h"			// for vector types
@@ -17,6 +17,7 @@
 */
 
 #include "core_settings.h"
+#include <immintrin.h>
 
 uint ScaleColor( uint c, int scale )
 {
@@ -29,10 +30,7 @@ uint ScaleColor( uint c, int scale )
 // static data for the rasterizer
 // -----------------------------------------------------------
 Surface* Mesh::screen = 0;
-float* Mesh::xleft, *Mesh::xright, *Mesh::uleft, *Mesh::uright;
-float* Mesh::vleft, *Mesh::vright, *Mesh::zleft, *Mesh::zright;
 Scene Rasterizer::scene;
-float* Rasterizer::zbuffer;
 float4 Rasterizer::frustum[5];
 static float3 raxis[3] = { make_float3( 1, 0, 0 ), make_float3( 0, 1, 0 ), make_float3( 0, 0, 1 ) };
 
@@ -57,51 +55,69 @@ Mesh::Mesh( int vcount, int tcount ) : verts( vcount ), tris( tcount )
 }
 
 // -----------------------------------------------------------
-// Mesh render function
-// input: final matrix for scene graph node
-// renders a mesh using software rasterization.
-// stages:
-// 1. mesh culling: checks the mesh against the view frustum
-// 2. vertex transform: calculates world space coordinates
-// 3. triangle rendering loop. substages:
-//    a) backface culling
-//    b) clipping (Sutherland-Hodgeman)
-//    c) shading (using pre-scaled palettes for speed)
-//    d) projection: world-space to 2D screen-space
-//    e) span construction
-//    f) span filling
+// Mesh visibility test
+// input: mesh instance
+// checks the mesh bounds against the view frustum, and
+// stores the screen bounds and nearest depth of the
+// instance for the hierarchical z test
 // -----------------------------------------------------------
-void Mesh::Render( mat4& T )
+bool Mesh::Visible( MeshInstance& instance ) const
 {
-	// cull mesh
+	const mat4& T = instance.transform;
 	float3 c[8];
 	for (int i = 0; i < 8; i++) c[i] = make_float3( T * make_float4( bounds[i & 1].x, bounds[(i >> 1) & 1].y, bounds[i >> 2].z, 1 ) );
 	for (int i, p = 0; p < 5; p++)
 	{
 		for (i = 0; i < 8; i++) if ((dot( make_float3( Rasterizer::frustum[p] ), c[i] ) - Rasterizer::frustum[p].w) > 0) break;
-		if (i == 8) return;
+		if (i == 8) return false;
 	}
-	// transform vertices
-	for (int i = 0; i < verts; i++) tpos[i] = make_float3( make_float4( pos[i], 1 ) * T );
-	// draw triangles
-	for (int i = 0; i < tris; i++)
+	// project the bounds; bounds that cross the near plane are never occluded
+	instance.bmin = make_float2( 0 ), instance.bmax = make_float2( (float)screen->width, (float)screen->height );
+	instance.znear = -1e34f;
+	for (int i = 0; i < 8; i++) if (c[i].z > -Rasterizer::frustum[0].w) return true;
+	instance.bmin = make_float2( 1e34f ), instance.bmax = make_float2( -1e34f ), instance.znear = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		const float2 P = make_float2( ((c[i].x * screen->width) / -c[i].z) + screen->width / 2,
+			((c[i].y * screen->width) / c[i].z) + screen->height / 2 );
+		instance.bmin = fminf( instance.bmin, P ), instance.bmax = fmaxf( instance.bmax, P );
+		instance.znear = min( instance.znear, 1.0f / c[i].z );
+	}
+	return true;
+}
+
+// -----------------------------------------------------------
+// Mesh triangle setup
+// input: final matrix for scene graph node, instance index,
+//        triangle range
+// prepares triangles [first,last) for rasterization.
+// stages:
+// 1. vertex transform: calculates world space coordinates
+// 2. triangle loop. substages:
+//    a) backface culling
+//    b) clipping (Sutherland-Hodgeman)
+//    c) shading (using pre-scaled palettes for speed)
+//    d) projection: world-space to 2D screen-space
+// the resulting polygons are binned into screen tiles and
+// drawn by Rasterizer::DrawTile. Setup jobs for different
+// triangle ranges run in parallel, so nothing is written
+// to the mesh.
+// -----------------------------------------------------------
+void Mesh::Setup( const mat4& T, const int instanceIdx, const int first, const int last, vector<ScreenPoly>& polys ) const
+{
+	for (int i = first; i < last; i++)
 	{
-		Material* mat = Rasterizer::scene.matList[material[i]];
-		static uint p;
-		uint* src = mat->texture ? mat->texture->pixels : &p;
-		if (!mat->texture) p = mat->diffuse;
-		float* zbuffer = Rasterizer::zbuffer, f;
-		const float tw = mat->texture ? (float)mat->texture->width : 1;
-		const float th = mat->texture ? (float)mat->texture->height : 1;
-		const int umask = (int)tw - 1, vmask = (int)th - 1;
-		// cull triangle
+		// transform vertices and cull triangle
+		float3 tp[3];
+		for (int v = 0; v < 3; v++) tp[v] = make_float3( make_float4( pos[tri[i * 3 + v]], 1 ) * T );
 		float3 Nt = make_float3( make_float4( N[i], 0 ) * T );
-		if (dot( tpos[tri[i * 3 + 0]], Nt ) > 0) continue;
+		if (dot( tp[0], Nt ) > 0) continue;
 		// clip
 		float3 cpos[2][8], *pos;
 		float2 cuv[2][8], *tuv;
-		int nin = 3, nout = 0, from = 0, to = 1, miny = screen->height - 1, maxy = 0, h;
-		for (int v = 0; v < 3; v++) cpos[0][v] = tpos[tri[i * 3 + v]], cuv[0][v] = uv[tri[i * 3 + v]];
+		int nin = 3, nout = 0, from = 0, to = 1;
+		float f;
+		for (int v = 0; v < 3; v++) cpos[0][v] = tp[v], cuv[0][v] = uv[tri[i * 3 + v]];
 		for (int p = 0; p < 2; p++, from = 1 - from, to = 1 - to, nin = nout, nout = 0) for (int v = 0; v < nin; v++)
 		{
 			const float3 A = cpos[from][v], B = cpos[from][(v + 1) % nin];
@@ -120,54 +136,231 @@ void Mesh::Render( mat4& T )
 		if (nin == 0) continue;
 		// project
 		pos = cpos[from], tuv = cuv[from];
+		polys.push_back( ScreenPoly() );
+		ScreenPoly& poly = polys.back();
+		poly.bmin = make_float2( 1e34f ), poly.bmax = make_float2( -1e34f ), poly.znear = 0;
 		for (int v = 0; v < nin; v++)
-			pos[v].x = ((pos[v].x * screen->width) / -pos[v].z) + screen->width / 2,
-			pos[v].y = ((pos[v].y * screen->width) / pos[v].z) + screen->height / 2;
-		// draw
-		uint shade = (uint)((N[i].z + 1) * 64.0f + 127.9f);
-		for (int j = 0; j < nin; j++)
 		{
-			int vert0 = j, vert1 = (j + 1) % nin;
-			if (pos[vert0].y > pos[vert1].y) h = vert0, vert0 = vert1, vert1 = h;
-			const float y0 = pos[vert0].y, y1 = pos[vert1].y, rydiff = 1.0f / (y1 - y0);
-			if ((y0 == y1) || (y0 >= screen->height) || (y1 < 1)) continue;
-			const int iy0 = max( 1, (int)y0 + 1 ), iy1 = min( screen->height - 2, (int)y1 );
-			float x0 = pos[vert0].x, dx = (pos[vert1].x - x0) * rydiff;
-			float z0 = 1.0f / pos[vert0].z, z1 = 1.0f / pos[vert1].z, dz = (z1 - z0) * rydiff;
-			float u0 = tuv[vert0].x * z0, du = (tuv[vert1].x * z1 - u0) * rydiff;
-			float v0 = tuv[vert0].y * z0, dv = (tuv[vert1].y * z1 - v0) * rydiff;
-			const float f = (float)iy0 - y0;
-			x0 += dx * f, u0 += du * f, v0 += dv * f, z0 += dz * f;
-			for (int y = iy0; y <= iy1; y++)
-			{
-				if (x0 < xleft[y]) xleft[y] = x0, uleft[y] = u0, vleft[y] = v0, zleft[y] = z0;
-				if (x0 > xright[y]) xright[y] = x0, uright[y] = u0, vright[y] = v0, zright[y] = z0;
-				x0 += dx, u0 += du, v0 += dv, z0 += dz;
-			}
-			miny = min( miny, iy0 ), maxy = max( maxy, iy1 );
+			const float2 P = make_float2( ((pos[v].x * screen->width) / -pos[v].z) + screen->width / 2,
+				((pos[v].y * screen->width) / pos[v].z) + screen->height / 2 );
+			const float z = 1.0f / pos[v].z;
+			poly.pos[v] = P, poly.attr[v] = make_float3( z, tuv[v].x * z, tuv[v].y * z );
+			poly.bmin = fminf( poly.bmin, P ), poly.bmax = fmaxf( poly.bmax, P ), poly.znear = min( poly.znear, z );
 		}
-		for (int y = miny; y <= maxy; xleft[y] = screen->width - 1, xright[y++] = 0)
+		poly.count = nin, poly.instance = instanceIdx;
+		poly.material = Rasterizer::scene.matList[material[i]];
+		poly.shade = (uint)((N[i].z + 1) * 64.0f + 127.9f);
+	}
+}
+
+// -----------------------------------------------------------
+// SIMD span filling
+// input: span destination, z-buffer and range, attributes at
+// the first pixel and their per-pixel steps, texture data
+// plots SPANWIDTH pixels at a time: z-test, perspective
+// divide, texel fetch and shading for a group of pixels are
+// done in SIMD registers, and only pixels that pass the
+// z-test are written. the groups never extend past ix1;
+// returns the first pixel that still needs to be plotted.
+// -----------------------------------------------------------
+#ifdef __AVX2__
+static __inline __m256i ScaleColor8( const __m256i c, const __m256i scale )
+{
+	// ScaleColor for 8 pixels; per channel products fit in 16 bits
+	const __m256i rb = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_and_si256( c, _mm256_set1_epi32( 0xff00ff ) ), scale ), 8 );
+	const __m256i g = _mm256_mullo_epi16( _mm256_and_si256( _mm256_srli_epi32( c, 8 ), _mm256_set1_epi32( 0xff ) ), scale );
+	return _mm256_or_si256( rb, _mm256_and_si256( g, _mm256_set1_epi32( 0xff00 ) ) );
+}
+#else
+static __inline __m128i ScaleColor4( const __m128i c, const __m128i scale )
+{
+	// ScaleColor for 4 pixels; per channel products fit in 16 bits
+	const __m128i rb = _mm_srli_epi16( _mm_mullo_epi16( _mm_and_si128( c, _mm_set1_epi32( 0xff00ff ) ), scale ), 8 );
+	const __m128i g = _mm_mullo_epi16( _mm_and_si128( _mm_srli_epi32( c, 8 ), _mm_set1_epi32( 0xff ) ), scale );
+	return _mm_or_si128( rb, _mm_and_si128( g, _mm_set1_epi32( 0xff00 ) ) );
+}
+#endif
+static int DrawSpan( uint* dest, float* zbuf, const int ix0, const int ix1, const float u0, const float v0, const float z0,
+	const float du, const float dv, const float dz, const uint* src, const float tw, const float th, const int umask, const int vmask, const uint shade )
+{
+	int x = ix0;
+#ifdef __AVX2__
+	const __m256 lane8 = _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 ), one8 = _mm256_set1_ps( 1 );
+	const __m256 du8 = _mm256_set1_ps( du * 8 ), dv8 = _mm256_set1_ps( dv * 8 ), dz8 = _mm256_set1_ps( dz * 8 );
+	const __m256 tw8 = _mm256_set1_ps( tw ), th8 = _mm256_set1_ps( th );
+	const __m256i umask8 = _mm256_set1_epi32( umask ), vmask8 = _mm256_set1_epi32( vmask ), pitch8 = _mm256_set1_epi32( umask + 1 );
+	const __m256i shade8 = _mm256_set1_epi16( (short)shade );
+	__m256 u8 = _mm256_add_ps( _mm256_set1_ps( u0 ), _mm256_mul_ps( lane8, _mm256_set1_ps( du ) ) );
+	__m256 v8 = _mm256_add_ps( _mm256_set1_ps( v0 ), _mm256_mul_ps( lane8, _mm256_set1_ps( dv ) ) );
+	__m256 z8 = _mm256_add_ps( _mm256_set1_ps( z0 ), _mm256_mul_ps( lane8, _mm256_set1_ps( dz ) ) );
+	for (; x + 7 <= ix1; x += 8, u8 = _mm256_add_ps( u8, du8 ), v8 = _mm256_add_ps( v8, dv8 ), z8 = _mm256_add_ps( z8, dz8 ))
+	{
+		const __m256 pass = _mm256_cmp_ps( z8, _mm256_loadu_ps( zbuf + x ), _CMP_LT_OQ );
+		if (_mm256_movemask_ps( pass ) == 0) continue;
+		const __m256i mask = _mm256_castps_si256( pass );
+		const __m256 z = _mm256_div_ps( one8, z8 );
+		const __m256i u = _mm256_and_si256( _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_mul_ps( u8, z ), tw8 ) ), umask8 );
+		const __m256i v = _mm256_and_si256( _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_mul_ps( v8, z ), th8 ) ), vmask8 );
+		const __m256i texel = _mm256_mask_i32gather_epi32( _mm256_setzero_si256(), (const int*)src, _mm256_add_epi32( u, _mm256_mullo_epi32( v, pitch8 ) ), mask, 4 );
+		_mm256_maskstore_epi32( (int*)(dest + x), mask, ScaleColor8( texel, shade8 ) );
+		_mm256_maskstore_ps( zbuf + x, mask, z8 );
+	}
+#else
+	const __m128 lane4 = _mm_setr_ps( 0, 1, 2, 3 ), one4 = _mm_set_ps1( 1 );
+	const __m128 du4 = _mm_set_ps1( du * 4 ), dv4 = _mm_set_ps1( dv * 4 ), dz4 = _mm_set_ps1( dz * 4 );
+	const __m128 tw4 = _mm_set_ps1( tw ), th4 = _mm_set_ps1( th );
+	const __m128i umask4 = _mm_set1_epi32( umask ), vmask4 = _mm_set1_epi32( vmask ), shade4 = _mm_set1_epi16( (short)shade );
+	__m128 u4 = _mm_add_ps( _mm_set_ps1( u0 ), _mm_mul_ps( lane4, _mm_set_ps1( du ) ) );
+	__m128 v4 = _mm_add_ps( _mm_set_ps1( v0 ), _mm_mul_ps( lane4, _mm_set_ps1( dv ) ) );
+	__m128 z4 = _mm_add_ps( _mm_set_ps1( z0 ), _mm_mul_ps( lane4, _mm_set_ps1( dz ) ) );
+	const int pitch = umask + 1;
+	for (; x + 3 <= ix1; x += 4, u4 = _mm_add_ps( u4, du4 ), v4 = _mm_add_ps( v4, dv4 ), z4 = _mm_add_ps( z4, dz4 ))
+	{
+		const __m128 zb = _mm_loadu_ps( zbuf + x );
+		const __m128 pass = _mm_cmplt_ps( z4, zb );
+		if (_mm_movemask_ps( pass ) == 0) continue;
+		const __m128i mask = _mm_castps_si128( pass );
+		const __m128 z = _mm_div_ps( one4, z4 );
+		union { __m128i iu4; int iu[4]; };
+		union { __m128i iv4; int iv[4]; };
+		iu4 = _mm_and_si128( _mm_cvttps_epi32( _mm_mul_ps( _mm_mul_ps( u4, z ), tw4 ) ), umask4 );
+		iv4 = _mm_and_si128( _mm_cvttps_epi32( _mm_mul_ps( _mm_mul_ps( v4, z ), th4 ) ), vmask4 );
+		const __m128i texel = _mm_setr_epi32( src[iu[0] + iv[0] * pitch], src[iu[1] + iv[1] * pitch], src[iu[2] + iv[2] * pitch], src[iu[3] + iv[3] * pitch] );
+		const __m128i color = ScaleColor4( texel, shade4 ), old = _mm_loadu_si128( (__m128i*)(dest + x) );
+		_mm_storeu_si128( (__m128i*)(dest + x), _mm_or_si128( _mm_and_si128( mask, color ), _mm_andnot_si128( mask, old ) ) );
+		_mm_storeu_ps( zbuf + x, _mm_or_ps( _mm_and_ps( pass, z4 ), _mm_andnot_ps( pass, zb ) ) );
+	}
+#endif
+	return x;
+}
+
+// -----------------------------------------------------------
+// Polygon drawing
+// input: polygon, tile bounds (inclusive), tile z-buffer and
+//        tile color buffer
+// draws the part of a polygon that overlaps a tile.
+// stages:
+// 1. span construction, using outline tables for the rows
+//    of the tile
+// 2. span filling, using DrawSpan for groups of pixels and
+//    the scalar loop for the remainder
+// -----------------------------------------------------------
+static void DrawPolygon( const ScreenPoly& poly, const int tx0, const int ty0, const int tx1, const int ty1, float* zbuffer, uint* pixels )
+{
+	Surface* screen = Mesh::screen;
+	const Material* mat = poly.material;
+	const uint* src = mat->texture ? mat->texture->pixels : &mat->diffuse;
+	const float tw = mat->texture ? (float)mat->texture->width : 1;
+	const float th = mat->texture ? (float)mat->texture->height : 1;
+	const int umask = (int)tw - 1, vmask = (int)th - 1;
+	const uint shade = poly.shade;
+	float xleft[TILESIZE], xright[TILESIZE], uleft[TILESIZE], uright[TILESIZE];
+	float vleft[TILESIZE], vright[TILESIZE], zleft[TILESIZE], zright[TILESIZE];
+	const int ry0 = max( 0, (int)poly.bmin.y + 1 - ty0 ), ry1 = min( ty1 - ty0, (int)poly.bmax.y - ty0 );
+	for (int y = ry0; y <= ry1; y++) xleft[y] = screen->width - 1, xright[y] = 0;
+	int miny = ty1, maxy = ty0, h;
+	const float2* pos = poly.pos;
+	const float3* attr = poly.attr;
+	for (int j = 0; j < poly.count; j++)
+	{
+		int vert0 = j, vert1 = (j + 1) % poly.count;
+		if (pos[vert0].y > pos[vert1].y) h = vert0, vert0 = vert1, vert1 = h;
+		const float y0 = pos[vert0].y, y1 = pos[vert1].y, rydiff = 1.0f / (y1 - y0);
+		if ((y0 == y1) || (y0 >= screen->height) || (y1 < 1)) continue;
+		const int iy0 = max( ty0, max( 1, (int)y0 + 1 ) ), iy1 = min( ty1, min( screen->height - 2, (int)y1 ) );
+		if (iy0 > iy1) continue;
+		float x0 = pos[vert0].x, dx = (pos[vert1].x - x0) * rydiff;
+		float z0 = attr[vert0].x, dz = (attr[vert1].x - z0) * rydiff;
+		float u0 = attr[vert0].y, du = (attr[vert1].y - u0) * rydiff;
+		float v0 = attr[vert0].z, dv = (attr[vert1].z - v0) * rydiff;
+		const float f = (float)iy0 - y0;
+		x0 += dx * f, u0 += du * f, v0 += dv * f, z0 += dz * f;
+		for (int y = iy0 - ty0; y <= iy1 - ty0; y++)
 		{
-			float x0 = xleft[y], x1 = xright[y], rxdiff = 1.0f / (x1 - x0);
-			float u0 = uleft[y], du = (uright[y] - u0) * rxdiff;
-			float v0 = vleft[y], dv = (vright[y] - v0) * rxdiff;
-			float z0 = zleft[y], dz = (zright[y] - z0) * rxdiff;
-			const int ix0 = (int)x0 + 1, ix1 = min( screen->width - 2, (int)x1 );
-			const float f = (float)ix0 - x0;
-			u0 += f * du, v0 += f * dv, z0 += f * dz;
-			uint* dest = screen->pixels + y * screen->width;
-			float* zbuf = zbuffer + y * screen->width;
-			for (int x = ix0; x <= ix1; x++, u0 += du, v0 += dv, z0 += dz) // plot span
-			{
-				if (z0 >= zbuf[x]) continue;
-				const float z = 1.0f / z0;
-				const int u = (int)(u0 * z * tw) & umask, v = (int)(v0 * z * th) & vmask;
-				dest[x] = ScaleColor( src[u + v * (umask + 1)], shade ), zbuf[x] = z0;
-			}
+			if (x0 < xleft[y]) xleft[y] = x0, uleft[y] = u0, vleft[y] = v0, zleft[y] = z0;
+			if (x0 > xright[y]) xright[y] = x0, uright[y] = u0, vright[y] = v0, zright[y] = z0;
+			x0 += dx, u0 += du, v0 += dv, z0 += dz;
+		}
+		miny = min( miny, iy0 ), maxy = max( maxy, iy1 );
+	}
+	for (int y = miny; y <= maxy; y++)
+	{
+		const int ty = y - ty0;
+		float x0 = xleft[ty], x1 = xright[ty], rxdiff = 1.0f / (x1 - x0);
+		float u0 = uleft[ty], du = (uright[ty] - u0) * rxdiff;
+		float v0 = vleft[ty], dv = (vright[ty] - v0) * rxdiff;
+		float z0 = zleft[ty], dz = (zright[ty] - z0) * rxdiff;
+		const int ix0 = max( tx0, (int)x0 + 1 ), ix1 = min( tx1, min( screen->width - 2, (int)x1 ) );
+		const float f = (float)ix0 - x0;
+		u0 += f * du, v0 += f * dv, z0 += f * dz;
+		uint* dest = pixels + ty * TILESIZE - tx0;
+		float* zbuf = zbuffer + ty * TILESIZE - tx0;
+		int x = DrawSpan( dest, zbuf, ix0, ix1, u0, v0, z0, du, dv, dz, src, tw, th, umask, vmask, shade );
+		const float g = (float)(x - ix0);
+		u0 += g * du, v0 += g * dv, z0 += g * dz;
+		for (; x <= ix1; x++, u0 += du, v0 += dv, z0 += dz) // plot remainder of span
+		{
+			if (z0 >= zbuf[x]) continue;
+			const float z = 1.0f / z0;
+			const int u = (int)(u0 * z * tw) & umask, v = (int)(v0 * z * th) & vmask;
+			dest[x] = ScaleColor( src[u + v * (umask + 1)], shade ), zbuf[x] = z0;
 		}
 	}
 }
 
+// -----------------------------------------------------------
+// Hierarchical z-buffer
+// the farthest 1/z of each HIZBLOCK x HIZBLOCK block of a
+// tile z-buffer. a mesh or polygon whose nearest 1/z is not
+// nearer than the farthest 1/z of every block it overlaps
+// cannot pass the z-test anywhere, and is skipped. blocks
+// that are drawn to are marked dirty and only brought up to
+// date when they are tested.
+// -----------------------------------------------------------
+#define HIZBLOCKS (TILESIZE / HIZBLOCK)
+struct TileHiZ
+{
+	float zfar[HIZBLOCKS * HIZBLOCKS];	// 0 for blocks that are not fully covered yet
+	uint64 dirty;						// one bit per block
+};
+static void HiZBlockRange( const float2 bmin, const float2 bmax, const int tx0, const int ty0, const int tx1, const int ty1, int4& r )
+{
+	r.x = (max( tx0, (int)bmin.x ) - tx0) / HIZBLOCK, r.z = (min( tx1, (int)bmax.x + 1 ) - tx0) / HIZBLOCK;
+	r.y = (max( ty0, (int)bmin.y ) - ty0) / HIZBLOCK, r.w = (min( ty1, (int)bmax.y + 1 ) - ty0) / HIZBLOCK;
+}
+static void MarkHiZ( TileHiZ& hiz, const float2 bmin, const float2 bmax, const int tx0, const int ty0, const int tx1, const int ty1 )
+{
+	int4 r;
+	HiZBlockRange( bmin, bmax, tx0, ty0, tx1, ty1, r );
+	if (r.x > r.z) return;
+	const uint64 row = ((2ull << (r.z - r.x)) - 1) << r.x;
+	for (int by = r.y; by <= r.w; by++) hiz.dirty |= row << (by * HIZBLOCKS);
+}
+static bool Occluded( TileHiZ& hiz, const float* zbuffer, const float2 bmin, const float2 bmax, const float znear,
+	const int tx0, const int ty0, const int tx1, const int ty1 )
+{
+	int4 r;
+	HiZBlockRange( bmin, bmax, tx0, ty0, tx1, ty1, r );
+	if (r.x > r.z || r.y > r.w) return false;
+	for (int by = r.y; by <= r.w; by++) for (int bx = r.x; bx <= r.z; bx++)
+	{
+		const int b = by * HIZBLOCKS + bx;
+		if (hiz.dirty & (1ull << b))
+		{
+			// update the block
+			const float* z = zbuffer + by * HIZBLOCK * TILESIZE + bx * HIZBLOCK;
+			__m128 zfar4 = _mm_set_ps1( -1e34f );
+			for (int y = 0; y < HIZBLOCK; y++) for (int x = 0; x < HIZBLOCK; x += 4) zfar4 = _mm_max_ps( zfar4, _mm_loadu_ps( z + y * TILESIZE + x ) );
+			zfar4 = _mm_max_ps( zfar4, _mm_shuffle_ps( zfar4, zfar4, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+			zfar4 = _mm_max_ps( zfar4, _mm_shuffle_ps( zfar4, zfar4, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+			hiz.zfar[b] = _mm_cvtss_f32( zfar4 );
+			hiz.dirty &= ~(1ull << b);
+		}
+		if (znear < hiz.zfar[b]) return false;
+	}
+	return true;
+}
+
 // -----------------------------------------------------------
 // Scene destructor
 // -----------------------------------------------------------
@@ -179,37 +372,30 @@ Scene::~Scene()
 }
 
 // -----------------------------------------------------------
-// SGNode::Render
-// recursive rendering of a scene graph node and its child nodes
-// input: (inverse) camera transform
+// SGNode::Collect
+// recursive traversal of a scene graph node and its child
+// nodes, to obtain the final matrix for each mesh
+// input: (inverse) camera transform, list to append to
 // -----------------------------------------------------------
-void SGNode::Render( mat4& transform )
+void SGNode::Collect( mat4& transform, vector<MeshInstance>& instances )
 {
 	mat4 M = transform * localTransform;
-	if (GetType() == SG_MESH) ((Mesh*)this)->Render( M );
-	for (uint s = (uint)child.size(), i = 0; i < s; i++) child[i]->Render( M );
+	if (GetType() == SG_MESH) instances.push_back( { (Mesh*)this, M } );
+	for (uint s = (uint)child.size(), i = 0; i < s; i++) child[i]->Collect( M, instances );
 }
 
 // -----------------------------------------------------------
-// Rasterizer::Init
-// initialization of the rasterizer
-// input: surface to draw to
+// Rasterizer::Reinit
+// initialization that depends on screen size
+// input: screen size, surface to draw to
 // -----------------------------------------------------------
-void Rasterizer::Init()
-{
-	// setup outline tables & zbuffer
-	Mesh::xleft = new float[8192], Mesh::xright = new float[8192]; // that should do for pretty much any resolution
-	Mesh::uleft = new float[8192], Mesh::uright = new float[8192];
-	Mesh::vleft = new float[8192], Mesh::vright = new float[8192];
-	Mesh::zleft = new float[8192], Mesh::zright = new float[8192];
-}
-
 void Rasterizer::Reinit( int w, int h, Surface* screen )
 {
-	// initialization that depends on screen size
-	for (int y = 0; y < h; y++) Mesh::xleft[y] = w - 1, Mesh::xright[y] = 0;
-	delete zbuffer;
-	zbuffer = new float[w * h];
+	// setup tiles
+	tilesX = (w + TILESIZE - 1) / TILESIZE;
+	tilesY = (h + TILESIZE - 1) / TILESIZE;
+	bins.resize( tilesX * tilesY );
+	tileCulled.resize( tilesX * tilesY );
 	// calculate view frustum planes
 	float C = -1.0f, x1 = 0.5f, x2 = w - 1.5f, y1 = 0.5f, y2 = h - 1.5f;
 	float3 p0 = { 0, 0, 0 };
@@ -226,17 +412,90 @@ void Rasterizer::Reinit( int w, int h, Surface* screen )
 	Mesh::screen = screen;
 }
 
+// -----------------------------------------------------------
+// Rasterizer::DrawTile
+// clears a tile and draws the polygons binned to it, using
+// a z-buffer and color buffer that are local to the tile;
+// the finished tile is copied to the screen. mesh instances
+// and large polygons are tested against the hierarchical
+// z-buffer of the tile before they are drawn.
+// input: tile index
+// -----------------------------------------------------------
+void Rasterizer::DrawTile( const int tileIdx )
+{
+	Surface* screen = Mesh::screen;
+	const int x0 = (tileIdx % tilesX) * TILESIZE, y0 = (tileIdx / tilesX) * TILESIZE;
+	const int x1 = min( screen->width, x0 + TILESIZE ) - 1, y1 = min( screen->height, y0 + TILESIZE ) - 1;
+	float zbuffer[TILESIZE * TILESIZE];
+	memset( zbuffer, 0, sizeof( zbuffer ) );
+	uint pixels[TILESIZE * TILESIZE];
+	memset( pixels, 0, sizeof( pixels ) );
+	TileHiZ hiz;
+	memset( &hiz, 0, sizeof( hiz ) );
+	int2 culled = make_int2( 0 );
+	int instance = -1;
+	bool instanceOccluded = false;
+	for (const ScreenPoly* poly : bins[tileIdx])
+	{
+		if (poly->instance != instance)
+		{
+			// first polygon of the next mesh instance in this tile
+			const MeshInstance& inst = instances[instance = poly->instance];
+			instanceOccluded = Occluded( hiz, zbuffer, inst.bmin, inst.bmax, inst.znear, x0, y0, x1, y1 );
+			if (instanceOccluded) culled.x++;
+		}
+		if (instanceOccluded) continue;
+		const float2 extent = poly->bmax - poly->bmin;
+		if (extent.x * extent.y >= HIZTRIAREA && Occluded( hiz, zbuffer, poly->bmin, poly->bmax, poly->znear, x0, y0, x1, y1 )) { culled.y++; continue; }
+		DrawPolygon( *poly, x0, y0, x1, y1, zbuffer, pixels );
+		MarkHiZ( hiz, poly->bmin, poly->bmax, x0, y0, x1, y1 );
+	}
+	tileCulled[tileIdx] = culled;
+	for (int y = y0; y <= y1; y++) memcpy( screen->pixels + y * screen->width + x0, pixels + (y - y0) * TILESIZE, (x1 - x0 + 1) * sizeof( uint ) );
+}
+
 // -----------------------------------------------------------
 // Rasterizer::Render
 // render the scene
 // input: camera to render with
+// stages, each of which runs on the job system:
+// 1. triangle setup, in batches of SETUPBATCH triangles
+// 2. binning of the resulting polygons, per row of tiles
+// 3. rasterization, per tile, with hierarchical z culling
 // -----------------------------------------------------------
 void Rasterizer::Render( mat4& transform )
 {
-	memset( Mesh::screen->pixels, 0, Mesh::screen->width * Mesh::screen->height * sizeof( uint ) );
-	memset( zbuffer, 0, Mesh::screen->width * Mesh::screen->height * sizeof( float ) );
 	transform.Inverted();
-	scene.root->Render( transform );
+	// find the visible mesh instances and split them into setup jobs
+	instances.clear();
+	setupJobs.clear();
+	scene.root->Collect( transform, instances );
+	int visibleCount = 0;
+	for (int s = (int)instances.size(), i = 0; i < s; i++) if (instances[i].mesh->Visible( instances[i] )) instances[visibleCount++] = instances[i];
+	instances.resize( visibleCount );
+	// front to back, so occluders are drawn before the meshes they hide
+	stable_sort( instances.begin(), instances.end(), []( const MeshInstance& a, const MeshInstance& b ) { return a.znear < b.znear; } );
+	for (int i = 0; i < visibleCount; i++) for (int first = 0; first < instances[i].mesh->tris; first += SETUPBATCH)
+		setupJobs.push_back( make_int4( i, first, min( instances[i].mesh->tris, first + SETUPBATCH ), 0 ) );
+	const int jobCount = (int)setupJobs.size();
+	if (setupPolys.size() < jobCount) setupPolys.resize( jobCount );
+	RunJobs( jobCount, [&]( const int i ) {
+		const int4 job = setupJobs[i];
+		setupPolys[i].clear();
+		instances[job.x].mesh->Setup( instances[job.x].transform, job.x, job.y, job.z, setupPolys[i] );
+	} );
+	// bin the polygons; each row of tiles scans all polygons, so bins keep the submission order
+	RunJobs( tilesY, [&]( const int ty ) {
+		for (int tx = 0; tx < tilesX; tx++) bins[ty * tilesX + tx].clear();
+		for (int i = 0; i < jobCount; i++) for (const ScreenPoly& poly : setupPolys[i])
+		{
+			if ((int)poly.bmin.y / TILESIZE > ty || (int)poly.bmax.y / TILESIZE < ty) continue;
+			const int tx0 = max( 0, (int)poly.bmin.x / TILESIZE ), tx1 = min( tilesX - 1, (int)poly.bmax.x / TILESIZE );
+			for (int tx = tx0; tx <= tx1; tx++) bins[ty * tilesX + tx].push_back( &poly );
+		}
+	} );
+	// draw the tiles
+	RunJobs( tilesX * tilesY, [&]( const int i ) { DrawTile( i ); } );
+	culledMeshes = culledTris = 0;
+	for (const int2& culled : tileCulled) culledMeshes += culled.x, culledTris += culled.y;
 }
-
-// EOF
\ No newline at end of file
@@ -64,6 +64,32 @@ public:
 	Texture* texture = 0;			// texture
 };
 
+// -----------------------------------------------------------
+// ScreenPoly struct
+// clipped and projected triangle, produced by Mesh::Setup
+// and drawn per screen tile by the rasterizer
+// -----------------------------------------------------------
+struct ScreenPoly
+{
+	float2 pos[8];					// screen positions
+	float3 attr[8];					// 1/z, u/z and v/z per vertex
+	float2 bmin, bmax;				// screen bounds, for binning
+	const Material* material;
+	uint shade;						// flat shading scale for ScaleColor
+	int count;						// vertex count
+	float znear;					// nearest 1/z, for the hierarchical z test
+	int instance;					// index of the mesh instance in Rasterizer::instances
+};
+
+class Mesh;
+struct MeshInstance
+{
+	Mesh* mesh;
+	mat4 transform;					// final matrix for the mesh
+	float2 bmin, bmax;				// screen bounds, for the hierarchical z test
+	float znear;					// nearest 1/z; -1e34f if the bounds cross the near plane
+};
+
 // -----------------------------------------------------------
 // SGNode class
 // scene graph node, with convenience functions for translate
@@ -85,7 +111,7 @@ public:
 	// methods
 	void SetPosition( float3& pos ) { mat4& M = localTransform; M[3] = pos.x, M[7] = pos.y, M[11] = pos.z; }
 	float3 GetPosition() { mat4& M = localTransform; return make_float3( M[3], M[7], M[11] ); }
-	void Render( mat4& transform );
+	void Collect( mat4& transform, vector<MeshInstance>& instances );
 	virtual int GetType() { return SG_TRANSFORM; }
 	// data members
 	mat4 localTransform;
@@ -104,7 +130,8 @@ public:
 	Mesh( int vcount, int tcount );
 	~Mesh() { delete pos; delete N; delete spos; delete tri; }
 	// methods
-	void Render( mat4& transform );
+	bool Visible( MeshInstance& instance ) const;
+	void Setup( const mat4& transform, const int instanceIdx, const int first, const int last, vector<ScreenPoly>& polys ) const;
 	virtual int GetType() { return SG_MESH; }
 	// data members
 	float3* pos = 0;				// object-space vertex positions
@@ -118,10 +145,6 @@ public:
 	int* material = 0;				// per-face material ID
 	float3 bounds[2];				// mesh bounds
 	static Surface* screen;
-	static float* xleft, *xright;	// outline tables for rasterization
-	static float* uleft, *uright;
-	static float* vleft, *vright;
-	static float* zleft, *zright;
 };
 
 // -----------------------------------------------------------
@@ -153,13 +176,23 @@ public:
 	// constructor / destructor
 	Rasterizer() = default;
 	// methods
-	void Init();
 	void Reinit( int w, int h, Surface* screen );
 	void Render( mat4& transform );
+private:
+	void DrawTile( const int tileIdx );
+public:
 	// data members
 	static Scene scene;
-	static float* zbuffer;
 	static float4 frustum[5];
+	uint culledMeshes = 0;			// mesh instances rejected by the hierarchical z test in the last frame, per tile
+	uint culledTris = 0;			// large triangles rejected by the hierarchical z test in the last frame, per tile
+private:
+	int tilesX = 0, tilesY = 0;		// screen size in tiles
+	vector<MeshInstance> instances;	// visible mesh instances for the current frame
+	vector<int4> setupJobs;			// instance, first triangle, last triangle
+	vector<vector<ScreenPoly>> setupPolys;	// output of each setup job
+	vector<vector<const ScreenPoly*>> bins;	// polygons overlapping each tile, in submission order
+	vector<int2> tileCulled;		// culled mesh instances and triangles per tile
 };
 
 } // namespace lh2core
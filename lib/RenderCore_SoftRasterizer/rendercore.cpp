@@ -33,7 +33,6 @@ void RenderCore::SetProbePos( int2 pos )
 void RenderCore::Init()
 {
 	// initialize scene
-	rasterizer.Init();
 	rasterizer.scene.root = new SGNode();
 }
 
@@ -202,6 +201,8 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 	transform[4] = Y.x, transform[5] = Y.y, transform[6] = Y.z;
 	transform[8] = Z.x, transform[9] = Z.y, transform[10] = Z.z;
 	rasterizer.Render( transform * mat4::Translate( view.pos * -1.0f /* dont' ask */ ) );
+	coreStats.culledMeshes = rasterizer.culledMeshes;
+	coreStats.culledTris = rasterizer.culledTris;
 	// copy cpu surface to OpenGL render target texture
 	glBindTexture( GL_TEXTURE_2D, targetTextureID );
 	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, scrwidth, scrheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, renderTarget->pixels );
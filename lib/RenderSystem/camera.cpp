@@ -134,7 +134,7 @@ void Camera::Deserialize( const char* xmlFileName )
 {
 	xmlFile = xmlFileName;
 	XMLDocument doc;
-	XMLError result = doc.LoadFile( "camera.xml" );
+	XMLError result = doc.LoadFile( xmlFileName );
 	if (result != XML_SUCCESS) return;
 	XMLNode* root = doc.FirstChild();
 	if (root == nullptr) return;
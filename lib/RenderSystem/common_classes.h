@@ -40,6 +40,28 @@ enum Convergence
 	Restart = 1
 };
 
+// expected behavior of a mesh; cores use this to select acceleration structure build options
+enum GeometryHint
+{
+	DefaultGeometry = 0,	// core decides; typically: static until the mesh changes
+	StaticGeometry = 1,		// built once: compact, optimize for trace speed
+	DeformingGeometry = 2,	// vertices change, topology does not: refit
+	DynamicGeometry = 3		// rebuilt every frame: optimize for build speed
+};
+
+// device memory categories; cores tag their buffers with these for the VRAM tally in CoreStats
+enum VRAMCategory
+{
+	VRAMOther = 0,			// untagged buffers
+	VRAMBVH,				// acceleration structures and their build scratch memory
+	VRAMGeometry,			// triangle, vertex and animation data
+	VRAMPathStates,			// wavefront buffers: path states, hits, connections, sorting
+	VRAMFrameBuffers,		// accumulator, upscaling and denoiser buffers
+	VRAMTextures,			// texel pools and texture descriptors
+	VRAMScene,				// materials, lights, instances and sky
+	VRAMCategories
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  CoreTri - see HostTri for the host-side version.                           |
 //  |  Complete data for a single triangle with:                                  |
@@ -156,6 +178,20 @@ struct CoreTri4
 #define TRI_LOD			vertexAlpha.w
 };
 
+//  +-----------------------------------------------------------------------------+
+//  |  CoreTriPacked                                                              |
+//  |  Compact shading record, 48 instead of 176 bytes: normals, tangent and      |
+//  |  bitangent are octahedral encoded, texture coordinates and alpha are halfs. |
+//  |  Vertex positions, area and light index are omitted; shading does not       |
+//  |  need them. Unpacked to a CoreTri4 by UnpackTriangle.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CoreTriPacked
+{
+	uint4 uv;				// x..z: half2 uv per vertex; w: material
+	uint4 normals;			// x..z: vertex normals; w: face normal
+	uint4 frame;			// x: tangent, y: bitangent; z: half2 alpha0, alpha1; w: half2 alpha2, triLOD
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  CoreInstanceDesc                                                           |
 //  |  Instance descriptor. We will pass an array of these to the shading code,   |
@@ -167,9 +203,10 @@ struct float4x4 { float4 A, B, C, D; };
 #ifndef __OPENCLCC__ // OpenCL host and GPU instance descriptor structure is different and is defined inside OpenCL's core settings.
 struct CoreInstanceDesc
 {
-	CoreTri4* triangles;					// device pointer to model triangle array
-	int dummy1, dummy2;					// padding; 80 byte object
+	CoreTri4* triangles;					// device pointer to model triangle array; CoreTriPacked if packed is set
+	int packed, dummy2;					// padding; 144 byte object
 	float4x4 invTransform;				// inverse transform for the instance
+	float4x4 prevTransform;				// transform of the previous frame, for motion vectors; see SetInstanceMotion
 };
 #endif
 
@@ -237,16 +274,24 @@ struct CoreTexDesc
 	uint pixelCount;					// width and height are irrelevant; already stored with material
 	uint firstPixel;					// start in continuous storage of the texture
 	uint MIPlevels;						// number of MIP levels
+	uint width, height;					// size of the first MIP level; used by cores that re-encode texels
 #ifdef __CUDACC__
 	TexelStorage storage;
 #else
 	enum TexelStorage storage;
 #endif
+	const void* blocks;					// BC1 or BC5 blocks of all MIP levels from the file, or 0
+	uint blockCount;					// number of blocks
+	bool changed;						// texel data changed since the previous SetTextures call
 #else
 	uint pixelCount = 0;				// width and height are irrelevant; already stored with material
 	uint firstPixel = 0;				// start in continuous storage of the texture
 	uint MIPlevels = 1;					// number of MIP levels
+	uint width = 0, height = 0;			// size of the first MIP level; used by cores that re-encode texels
 	TexelStorage storage = ARGB32;
+	const void* blocks = 0;				// BC1 or BC5 blocks of all MIP levels from the file, or 0
+	uint blockCount = 0;				// number of blocks
+	bool changed = true;				// texel data changed since the previous SetTextures call
 #endif
 };
 
@@ -373,6 +418,57 @@ struct CoreDirectionalLight
 };
 struct CoreDirectionalLight4 { float4 data0, data1; };
 
+//  +-----------------------------------------------------------------------------+
+//  |  CoreLightTreeNode                                                          |
+//  |  Node of the light tree, built over the area, point and spot lights, in     |
+//  |  that order. For N lights, nodes 0..N-2 are interior nodes, and light i is  |
+//  |  stored in leaf N-1+i, so MIS can find its leaf without a lookup.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CoreLightTreeNode
+{
+#ifndef __OPENCLCC__
+	float3 bmin; int left;				// data0: bounds of the emitters; left child, -1 for a leaf
+	float3 bmax; int right;				// data1: right child, -1 for a leaf
+	float3 axis; float cosTheta;		// data2: emission cone; cosTheta = -1 for emission in all directions
+	float energy; int parent;			// data3: summed light energy; parent node, -1 for the root
+	int dummy0, dummy1;
+#else
+	// OpenCL float3 has 4-byte padding
+	float4 bmin;						// w: int left;			// data0
+	float4 bmax;						// w: int right;		// data1
+	float4 axis;						// w: float cosTheta;	// data2
+	float4 energy;						// y: int parent;		// data3
+#endif
+};
+struct CoreLightTreeNode4 { float4 data0, data1, data2, data3; };
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreLightAlias                                                             |
+//  |  Entry of the alias table for power-proportional light selection, over the  |
+//  |  area, point, spot and directional lights, in that order.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CoreLightAlias
+{
+	float threshold;					// pick this entry if the fractional random number is below threshold
+	int alias;							// otherwise, pick this light
+	float pickProb;						// probability that this light is selected; used for MIS
+	int dummy;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMaterialCost                                                           |
+//  |  Shading cost of a material, measured by instrumentation builds of the      |
+//  |  shade kernels: SM clock cycles spent in GetShadingData and in the BSDF,    |
+//  |  and how often each ran. See CoreAPI_Base::GetMaterialCosts.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CoreMaterialCost
+{
+	uint64 shadingCycles;				// cycles spent fetching the shading data of hits on this material
+	uint64 bsdfCycles;					// cycles spent evaluating and sampling the BSDF
+	uint invocations;					// shaded hits
+	uint bsdfCalls;						// BSDF evaluations and samples
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  ViewPyramid                                                                |
 //  |  Defines a camera view. Used for rendering and reprojection.          LH2'19|
@@ -21,8 +21,11 @@
 #pragma once
 
 // global settings
-#define CACHEIMAGES					// imported images will be saved to bin files (faster)
-// #define ZIPIMGBINS				// cached images will be zipped (slower but smaller)
+#define CACHEIMAGES					// imported images will be saved to compressed bin files (faster)
+#define CACHESCENES					// converted glTF meshes and textures will be saved to a cache file
+#define DEDUPLICATE					// imported textures and meshes with identical content are stored once
+// #define DRACOMESHES				// decode KHR_draco_mesh_compression in tinygltf; needs the Draco SDK
+// #define LAZYTEXTURES				// OBJ material textures are loaded on first use, see HostScene::UpdateTextures
 
 // default screen size
 #define SCRWIDTH			1600
@@ -31,16 +34,36 @@
 // skydome defines
 // #define IBL						// calculate pdf and cdf for ibl renderer
 // #define TESTSKY					// red/green/blue area lights for debugging
+// #define HALFSKYCACHE				// the sky cache stores half floats: half the size, radiance is clamped to 65504
 #define IBLWIDTH			512
 #define IBLHEIGHT			256
 #define IBLWBITS			9
 #define IBLHBITS			8
+#define SKYCDFSIZE			((IBLHEIGHT + 1) + IBLHEIGHT * (IBLWIDTH + 1)) // see HostSkyDome::BuildImportanceCDF
+#define SKYMIPLEVELS		8		// max levels in the half precision sky pyramid of the CUDA cores
+#define SKYDIFFUSESPREAD	0.05f	// cone angle (radians) of a ray that left a diffuse vertex, for the sky level
 
 // low discrepancy sampling
 #define LDSETS				256		// number of full low discrepancy sets
 #define LDDIMENSIONS		16		// number of dimensions per ld set
 #define LDSAMPLES			128		// number of samples per pixel before we start using random floats
 
+// material-coherent path sorting, see shared_kernel_code/sorting_shared.h
+#define SORTBINS			256		// number of sort bins; a single block of SORTBINS threads scans them
+
+// filtering, see shared_kernel_code/finalize_shared.h
+#define FILTERTILESTEP		4		// largest a-trous step for which applyFilterKernel stages its taps in shared memory
+// #define PACKEDFILTER				// 8 byte filter features, shading and moments; see FilterFeature in tools_shared.h
+
+// microfacet energy compensation, see sharedBSDFs/ggx_albedo.h
+#define GGXALBEDORES		32		// resolution of the GGX directional albedo table, per axis
+
+// multi-view rendering, see CoreAPI_Base::RenderViews
+#define MAXVIEWS			8		// max views per frame
+
+// statistics
+#define RAYSTATSEGMENTS		8		// path segments for which CoreStats holds ray counts; at least MAXPATHLENGTH of each core
+
 // low level settings
 #define PI					3.14159265358979323846264f
 #define INVPI				0.31830988618379067153777f
@@ -53,9 +76,15 @@
 #define BLACK				make_float3( 0 )
 #define WHITE				make_float3( 1 )
 #define MIPLEVELCOUNT		5
+#define PLACEHOLDERSIZE		16		// minimum size of a placeholder texture, see HostTexture::LoadPlaceholder
 
 // file format versions
-#define BINTEXFILEVERSION	0x10001001
+#define BINTEXFILEVERSION	0x10001003
+#define SCENECACHEVERSION	0x10002002
+#define SKYCACHEVERSION		0x10003001
+#define CHECKPOINTVERSION	0x10004001
+#define MATLIBVERSION		0x10005001
+#define JOURNALVERSION		0x10006001
 
 // tools
 
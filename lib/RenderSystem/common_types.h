@@ -485,6 +485,7 @@ public:
 		}
 		return retVal;
 	}
+	mat4 InvertedAffine() const; // for a 0 0 0 1 bottom row; falls back to Inverted otherwise. See system.cpp
 };
 
 class aabb
@@ -548,6 +549,9 @@ bool operator == ( const mat4& a, const mat4& b );
 bool operator != ( const mat4& a, const mat4& b );
 float4 operator * ( const mat4& a, const float4& b );
 float4 operator * ( const float4& a, const mat4& b );
+// batch transforms, identical to make_float3( M * make_float4( v, 1 or 0 ) ); in and out may be the same array
+void TransformPoints( const mat4& M, const float3* in, float3* out, const int count );
+void TransformNormals( const mat4& M, const float3* in, float3* out, const int count ); // pass the inverse transpose for normals
 
 class quat // based on https://github.com/adafruit
 {
@@ -661,20 +665,14 @@ public:
 		}
 		float halfTheta = acosf( cosHalfTheta );
 		float sinHalfTheta = sqrtf( 1.0f - cosHalfTheta * cosHalfTheta );
-		if (fabs( sinHalfTheta ) < 0.001f)
+		float ratioA = 0.5f, ratioB = 0.5f;
+		if (fabs( sinHalfTheta ) >= 0.001f)
 		{
-			qm.w = a.w * 0.5f + b.w * 0.5f;
-			qm.x = a.x * 0.5f + b.x * 0.5f;
-			qm.y = a.y * 0.5f + b.y * 0.5f;
-			qm.z = a.z * 0.5f + b.z * 0.5f;
-			return qm;
+			ratioA = sinf( (1 - t) * halfTheta ) / sinHalfTheta;
+			ratioB = sinf( t * halfTheta ) / sinHalfTheta;
 		}
-		float ratioA = sinf( (1 - t) * halfTheta ) / sinHalfTheta;
-		float ratioB = sinf( t * halfTheta ) / sinHalfTheta;
-		qm.w = (a.w * ratioA + b.w * ratioB);
-		qm.x = (a.x * ratioA + b.x * ratioB);
-		qm.y = (a.y * ratioA + b.y * ratioB);
-		qm.z = (a.z * ratioA + b.z * ratioB);
+		// w, x, y and z are consecutive floats: blend all four at once
+		_mm_storeu_ps( &qm.w, _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &a.w ), _mm_set_ps1( ratioA ) ), _mm_mul_ps( _mm_loadu_ps( &b.w ), _mm_set_ps1( ratioB ) ) ) );
 		return qm;
 	}
 	quat operator + ( const quat& q ) const { return quat( w + q.w, x + q.x, y + q.y, z + q.z ); }
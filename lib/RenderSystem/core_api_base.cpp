@@ -53,4 +53,13 @@ CoreAPI_Base* CoreAPI_Base::CreateCoreAPI( const char* dllName )
 	return api;
 }
 
+void CoreAPI_Base::DestroyCoreAPI()
+{
+	if (!api) return;
+	destroyCore = (destroyCoreFunction)GetProcAddress( module, "DestroyCore" );
+	if (destroyCore) destroyCore();
+	FreeLibrary( module );
+	api = 0, module = 0;
+}
+
 // EOF
\ No newline at end of file
@@ -22,6 +22,32 @@
 namespace lighthouse2
 {
 
+// model index for SetInstance that refers to an instance group instead of a mesh; see SetInstanceGroup
+#define INSTANCEGROUP( groupIdx )	(-2 - (groupIdx))
+
+// instance visibility per ray type, see SetInstanceVisibility; cores use these as instance and ray masks
+#define VISIBLE_PRIMARY		1			// camera rays
+#define VISIBLE_SECONDARY	2			// extension rays after the first bounce
+#define VISIBLE_SHADOW		4			// shadow rays
+#define VISIBLE_ALL			255
+
+// per triangle alpha state, in the alphaFlags passed to SetGeometry; see HostMesh::UpdateAlphaFlags
+#define ALPHA_OPAQUE		0			// no alpha test needed
+#define ALPHA_TESTED		1			// the alpha map decides per hit
+#define ALPHA_TRANSPARENT	2			// the alpha map is transparent over the whole triangle; never hit
+
+// max positions for SetProbePositions
+#define MAXPROBEPOS			16
+
+// state of a ray query, see GetRayQueryResults
+#define RAYQUERY_EXPIRED	-1			// unknown ticket, or the results were overwritten by later queries
+#define RAYQUERY_PENDING	0			// not traced yet, or the results are still on their way to the host
+#define RAYQUERY_DONE		1			// the hits were copied to the caller
+
+// codecs for VideoTargetDesc
+#define VIDEO_H264			0
+#define VIDEO_HEVC			1
+
 //  +-----------------------------------------------------------------------------+
 //  |  CoreStats                                                                  |
 //  |  Container for various statistics, filled by the core. Obtain a const ref   |
@@ -38,8 +64,31 @@ struct CoreStats
 	uint argb32TexelCount = 0;			// number of uint texels
 	uint argb128TexelCount = 0;			// number of float4 texels
 	uint nrm32TexelCount = 0;			// number of normal map texels
+	uint texturePagesStreamed = 0;		// virtual texturing: pages uploaded for the last frame
+	uint texturePagesRead = 0;			// virtual texturing: pages read from the page files for the last frame
+	uint bcBlockCount = 0;				// number of block compressed 4x4 texel blocks
+	size_t shadingDataBytes = 0;		// device memory used for triangle shading data
+	size_t fullShadingDataBytes = 0;	// the same, if all meshes stored full CoreTri4 records
+	size_t VRAMInUse[VRAMCategories] = {};	// device memory held by tagged buffers, per VRAMCategory
+	size_t VRAMPeak[VRAMCategories] = {};	// highest value of VRAMInUse per category
+	size_t VRAMPeakTotal = 0;			// highest total of VRAMInUse; not the sum of the peaks
+	size_t VRAMCached = 0;				// freed device memory kept by the buffer pool for reuse
+	size_t VRAMAliased = 0;				// device memory saved by transient buffers that share memory
+	size_t VRAMPeer = 0;				// read-only pools held in the memory of peer devices; not in VRAMInUse
+	uint meshesEvicted = 0;				// geometry streaming: meshes held in host memory, see geometryBudget
+	uint meshesStreamed = 0;			// geometry streaming: meshes reloaded for the last frame
+	uint meshesBuilding = 0;			// streamGeometry: meshes whose first BVH is still being built
 	// bvh
 	float bvhBuildTime = 0;				// overall accstruc build time
+	bool topLevelRefit = false;			// last top-level update refitted the existing structure
+	uint topLevelRebuilds = 0;			// number of full top-level builds
+	uint topLevelRefits = 0;			// number of top-level refits
+	uint gasRebuilds = 0;				// number of full mesh BVH builds
+	uint gasBackgroundRebuilds = 0;		// backgroundRebuilds: full mesh BVH builds swapped in from the build stream
+	uint topLevelBackgroundRebuilds = 0;	// backgroundRebuilds: the same, for the top-level structure
+	uint gasRefits = 0;					// number of mesh BVH refits
+	float gasRebuildTime = 0;			// time spent on full mesh BVH builds for the last frame
+	float gasRefitTime = 0;				// time spent on mesh BVH refits for the last frame
 	// rendering
 	uint totalRays = 0;					// total number of rays cast
 	uint totalExtensionRays = 0;		// total extension rays cast
@@ -53,21 +102,126 @@ struct CoreStats
 	float traceTimeX;					// time spent tracing subsequent bounces
 	float shadowTraceTime;				// time spent tracing shadow rays
 	float shadeTime;					// time spent in shading code
+	float sortTime = 0;					// time spent sorting paths by material before shading
+	float sortShadeSaved = 0;			// estimated shade time saved by sorting, relative to unsorted frames
+	float pathStateTraffic = 0;			// MB of path state reads and writes by the shade kernels, see packedPathStates
+	float renderScale = 1;				// dynamic resolution: internal resolution relative to the render target
+	float denoiseTime = 0;				// OptiX denoiser pass, including the preparation of its input layers
+	float finalizeTime = 0;				// tonemapping, upscaling or reprojection of the result into the render target
+	float encodeTime = 0;				// video target: encoding the last frame, see SetVideoTarget
+	uint graphInstantiations = 0;		// number of times the CUDA graph for a frame was instantiated
+	uint culledMeshes = 0;				// software rasterizer: mesh instances rejected by hierarchical z, per tile; OpenGL core: by the view frustum
+	uint culledTris = 0;				// software rasterizer: large triangles rejected by hierarchical z, per tile
+	// ray statistics per path segment, collected with the "rayStats" core setting; index 0 is the camera ray
+	uint segmentRays[RAYSTATSEGMENTS] = {};		// extension rays traced, i.e. paths shaded
+	uint segmentShadowRays[RAYSTATSEGMENTS] = {};	// shadow rays spawned at the hits of the segment
+	uint segmentMissed[RAYSTATSEGMENTS] = {};	// paths terminated by leaving the scene
+	uint segmentEmitter[RAYSTATSEGMENTS] = {};	// paths terminated by hitting a light
+	uint segmentRoulette[RAYSTATSEGMENTS] = {};	// paths terminated by Russian roulette
+	uint segmentAlpha[RAYSTATSEGMENTS] = {};	// alpha tested hits; continued, unless at the last segment
+	float shadeLaneEfficiency = 0;		// average fraction of active lanes in warps that shade a surface
 	// probe
 	int probedInstid;					// id of the instance at probe position
 	int probedTriid;					// id of triangle at probe position
 	float probedDist;					// distance of triangle at probe position
 };
 
+//  +-----------------------------------------------------------------------------+
+//  |  ProfileEvent                                                               |
+//  |  A timed GPU range of the last frame, for the frame profiler.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct ProfileEvent
+{
+	const char* name;					// static string, owned by the core
+	int bounce;							// path segment for wavefront stages, or -1
+	int track;							// 0: render stream, 1: scene update stream
+	float start, duration;				// in microseconds, relative to the start of the core's Render
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreRayHit                                                                 |
+//  |  The nearest intersection of a ray submitted with CoreAPI::QueryRays, or of |
+//  |  the camera ray at a probe position, see CoreAPI::SetProbePositions. For a  |
+//  |  ray that left the scene, instid and triid are -1 and t is 1e34.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CoreRayHit
+{
+	int instid;							// id of the instance that was hit, as in CoreStats::probedInstid
+	int triid;							// id of the triangle within the mesh of the instance
+	float t;							// distance along the ray; directions are normalized by the core
+};
+
+// VideoPacketCallback: receives the encoded bitstream of each frame, see CoreAPI::SetVideoTarget; called on the
+// render thread, from within Render. The data is valid only during the call.
+typedef void (*VideoPacketCallback)( const uchar* data, const int size, const int frame, const bool keyFrame, void* userData );
+
+//  +-----------------------------------------------------------------------------+
+//  |  VideoTargetDesc                                                            |
+//  |  Hardware video encoding of the rendered frames, see SetVideoTarget. The    |
+//  |  encoder runs at a constant bitrate without B-frames, for low latency.      |
+//  |  Width and height must be even.                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct VideoTargetDesc
+{
+	int width = 1280, height = 720;		// frame size; also the render target size
+	int codec = VIDEO_H264;				// VIDEO_H264 or VIDEO_HEVC
+	int bitrate = 8000000;				// in bits per second
+	int frameRate = 60;					// expected frames per second, for rate control
+	int gopLength = 60;					// frames between key frames
+	VideoPacketCallback callback = 0;	// receives the encoded frames
+	void* userData = 0;					// passed to the callback
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  CoreStats                                                                  |
 //  |  Container for various statistics, filled by the render system. Obtain a    |
 //  |  const ref to this data by calling CoreAPI::GetSystemStats().         LH2'19|
 //  +-----------------------------------------------------------------------------+
+
 struct SystemStats
 {
 	// scene
 	float sceneUpdateTime = 0;			// time spent updating the scene graph
+	// host time per phase of the last SynchronizeSceneData, in seconds
+	float skySyncTime = 0;
+	float textureSyncTime = 0;
+	float materialSyncTime = 0;
+	float meshSyncTime = 0;
+	float graphSyncTime = 0;			// UpdateSceneGraph, including the instance updates sent to the core
+	float lightSyncTime = 0;
+	float syncTime = 0;					// SynchronizeSceneData in total
+	// objects found dirty by the last SynchronizeSceneData
+	int dirtySky = 0;
+	int dirtyTextures = 0;
+	int dirtyMaterials = 0;
+	int dirtyMeshes = 0;				// including meshes that only received a new pose
+	int dirtyInstances = 0;
+	int dirtyLights = 0;
+	// data passed to the core by the last SynchronizeSceneData, in bytes
+	size_t bytesSent = 0;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreScatter                                                                |
+//  |  Procedural instances on the surface of a mesh, see ScatterInstances. The   |
+//  |  core places 'count' instances of the prototypes on the triangles, with a   |
+//  |  density proportional to their area, optionally modulated by a mask. The    |
+//  |  transforms are relative to the surface mesh. Pointers are valid only       |
+//  |  during the call.                                                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CoreScatter
+{
+	const float4* vertices = 0;			// surface: three vertices per triangle, in object space
+	const float2* uvs = 0;				// surface: three texture coordinates per triangle, for the mask; or 0
+	int triangleCount = 0;
+	const float* mask = 0;				// density in [0..1] over the uv square, row by row; 0: uniform
+	int2 maskSize = make_int2( 0 );
+	const int* prototypes = 0;			// mesh IDs; each instance picks one at random
+	int prototypeCount = 0;
+	int count = 0;						// placement attempts; the mask rejects some of them
+	float2 scale = make_float2( 1 );	// range of the uniform scale of an instance
+	bool alignToSurface = true;			// rotate the up axis of the prototypes to the triangle normal
+	uint seed = 0x12345678;				// the same seed yields the same placement
 };
 
 //  +-----------------------------------------------------------------------------+
@@ -79,35 +233,162 @@ class CoreAPI_Base
 public:
 	// CreateCoreAPI: instantiate and initialize a RenderCore object and obtain an interface to it.
 	static CoreAPI_Base* CreateCoreAPI( const char* dllName );
+	// DestroyCoreAPI: delete the core created by CreateCoreAPI and unload its dll, so that another core can be created.
+	// The core must have been shut down.
+	static void DestroyCoreAPI();
 	// GetCoreStats: obtain a const ref to the CoreStats object, which provides statistics on the rendering process.
 	virtual CoreStats GetCoreStats() = 0;
 	// Init: initialize the core
 	virtual void Init() = 0;
 	// SetProbePos: set a pixel for which the triangle and instance id will be captured, e.g. for object picking.
 	virtual void SetProbePos( const int2 pos ) = 0;
+	// SetProbePositions: set up to MAXPROBEPOS pixels whose instance, triangle and distance are captured each frame,
+	// e.g. for picking and hover highlighting, until the next call. Unlike SetProbePos, the results do not pass through
+	// the frame's statistics. Cores that do not support this ignore it.
+	virtual void SetProbePositions( const int2* pos, const int count ) {}
+	// GetProbeResults: copy the hits at the probe positions of the most recent frame whose results arrived on the host,
+	// in the order of the positions set for that frame; pass MAXPROBEPOS entries. Does not wait for the device.
+	// Returns the number of hits, or 0 if no results arrived yet.
+	virtual int GetProbeResults( CoreRayHit* hits ) { return 0; }
+	// QueryRays: submit 'count' rays for intersection with the scene, e.g. for line of sight, picking or placement.
+	// The rays are traced against the scene of the next Render call, before its frame. Returns a ticket for
+	// GetRayQueryResults, or -1 if the core does not support ray queries.
+	virtual int QueryRays( const float3* origins, const float3* directions, const int count ) { return -1; }
+	// GetRayQueryResults: copy the hits of the rays of a ticket to 'hits', one per ray, once they arrived on the host.
+	// Does not wait for the device. Returns RAYQUERY_DONE, _PENDING or _EXPIRED.
+	virtual int GetRayQueryResults( const int ticket, CoreRayHit* hits ) { return RAYQUERY_EXPIRED; }
 	// SetTarget: specify an OpenGL texture as a render target for the path tracer.
 	virtual void SetTarget( GLTexture* target, const uint spp ) = 0;
+	// SetTargets: specify a ring of OpenGL textures; each frame is rendered to the next one. Cores that do not
+	// support this render to the first texture only.
+	virtual void SetTargets( GLTexture** targets, const int count, const uint spp ) { SetTarget( targets[0], spp ); }
+	// GetPresentTarget: obtain the index of the most recently completed render target.
+	virtual int GetPresentTarget() { return 0; }
+	// GetProfileEvents: obtain the GPU ranges of the last frame; the core records them while the 'profile' setting is on.
+	virtual int GetProfileEvents( const ProfileEvent** events ) { return 0; }
+	// GetMaterialCosts: copy the shading cost of up to 'count' materials, accumulated since the previous call, and
+	// reset them. Only instrumentation builds of a core measure this; others return 0. Returns the materials written.
+	virtual int GetMaterialCosts( CoreMaterialCost* costs, const int count ) { return 0; }
+	// SetHostTarget: headless rendering; each frame is finalized into width * height float4s of host memory,
+	// which must remain valid until the next call. Cores that need an OpenGL target return false.
+	virtual bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp ) { return false; }
+	// SetVideoTarget: render without OpenGL, and encode each frame on the GPU; the bitstream is passed to desc.callback.
+	// The frame does not pass through host memory. Returns false if the core or the device cannot encode video.
+	virtual bool SetVideoTarget( const VideoTargetDesc& desc, const uint spp ) { return false; }
+	// SetVisibilityBuffer: hybrid rendering; take the primary hits from a GL_RGBA32UI texture that the application
+	// rasterized, instead of tracing primary rays. Per pixel: barycentrics u and v as 16-bit fixed point (u in the low
+	// bits), instance index, triangle index (NOHIT for the sky) and the distance to the camera as float bits, for the
+	// pixel center and with rows in the order of the render target. Pass 0 to trace primary rays again.
+	virtual bool SetVisibilityBuffer( GLTexture* visibility ) { return false; }
+	// SetFrameReadback: from the next frame on, copy each finished frame to host memory without waiting for the copy,
+	// until called with false. Returns false if the core does not support this.
+	virtual bool SetFrameReadback( const bool enable ) { return false; }
+	// GetReadbackFrame: obtain the oldest frame that arrived on the host and was not obtained before: width * height
+	// float4s, top row first, valid until the next Render. Waits for the copy only if 'wait' is set. A frame that is not
+	// obtained within a few frames is dropped. Returns the number of the frame, or -1 if no frame is available.
+	virtual int GetReadbackFrame( const float4** pixels, int& width, int& height, const bool wait = false ) { return -1; }
+	// SaveCheckpoint: snapshot the accumulation state of the render target (accumulator, sample count, RNG state) to a
+	// file without stalling rendering: the copy is queued behind the last frame, and the file is written in the background.
+	// Returns false if not supported, or while the previous checkpoint is being written.
+	virtual bool SaveCheckpoint( const char* file ) { return false; }
+	// LoadCheckpoint: restore the state saved by SaveCheckpoint; the next converging frame continues from it. The render
+	// target must have the size of the saved one. Returns false if not supported, or if the file does not match.
+	virtual bool LoadCheckpoint( const char* file ) { return false; }
 	// Setting: modify a render setting
 	virtual void Setting( const char* name, float value ) = 0;
 	// Render: produce one frame. Convergence can be 'Converge' or 'Restart'.
 	virtual void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast ) = 0;
+	// RenderViews: produce one frame for each of 'count' views of the scene, up to MAXVIEWS, and finalize view i to
+	// targets[i]. The targets must have the same size. The paths of all views are traced and shaded in the same launches;
+	// the views converge together. Returns false if the core does not support this; the RenderSystem then renders and
+	// finalizes the views one at a time.
+	virtual bool RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, const Convergence converge, const float brightness, const float contrast ) { return false; }
+	// BakeViews: converge 'count' views of w x h pixels, up to MAXVIEWS, to at least spp samples per pixel and store view i
+	// at pixels + i * w * h, top row first. Nothing is finalized: rgb is the average linear radiance, w the average distance
+	// to the first hit. The accumulation of the render target restarts afterwards. Returns false if not supported.
+	virtual bool BakeViews( const ViewPyramid* views, const int count, const int w, const int h, const uint spp, float4* pixels ) { return false; }
+	// BakeTexels: converge the radiance that leaves 'count' lightmap texels along their normals to at least spp samples per
+	// texel and store it in radiance[i]. texels holds two float4s per texel: the world space position, with in w the height
+	// above the surface at which its rays start, and the normal. The accumulation of the render target restarts afterwards.
+	// Returns false if not supported.
+	virtual bool BakeTexels( const float4* texels, const int count, const uint spp, float4* radiance ) { return false; }
 	// Shutdown: destroy the RenderCore and free all resources.
 	virtual void Shutdown() = 0;
 	// SetTextures: update the texture data in the RenderCore using the supplied data.
 	virtual void SetTextures( const CoreTexDesc* tex, const int textureCount ) = 0;
 	// SetMaterials: update the material list used by the RenderCore. Textures referenced by the materials must be set in advance.
 	virtual void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount ) = 0;
+	// UpdateMaterials: overwrite count materials, starting at first, in the list passed to the last SetMaterials call.
+	// The material count does not change. Returns false if the core does not support this; the RenderSystem then
+	// sends all materials using SetMaterials.
+	virtual bool UpdateMaterials( const CoreMaterial* mat, const CoreMaterialEx* matEx, const int first, const int count ) { return false; }
 	// SetLights: update the point lights, spot lights and directional lights.
 	virtual void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount ) = 0;
+	// UpdateAreaLights: overwrite count area lights, starting at first, in the list passed to the last SetLights call.
+	// The light counts do not change. Returns false if the core does not support this; the RenderSystem then
+	// sends all lights using SetLights.
+	virtual bool UpdateAreaLights( const CoreLightTri* areaLights, const int first, const int count ) { return false; }
+	// SetLightTree: update the light tree over the area, point and spot lights; called after SetLights.
+	// Cores that do not importance sample lights with a light tree can ignore this.
+	virtual void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount ) {}
+	// SetLightAliasTable: update the alias table for power-proportional light selection; called after SetLights.
+	virtual void SetLightAliasTable( const CoreLightAlias* table, const int count ) {}
 	// SetSkyData: specify the data required for sky dome rendering.
 	virtual void SetSkyData( const float3* pixels, const uint width, const uint height ) = 0;
+	// SetSkyImportance: specify the cdf for importance sampling of the sky dome (see HostSkyDome::BuildImportanceCDF),
+	// or null if the sky should not be sampled explicitly. Called after SetSkyData.
+	virtual void SetSkyImportance( const float* cdf, const uint width, const uint height ) {}
 	// SetGeometry: update the geometry for a single mesh.
-	virtual void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 ) = 0;
+	// The hint describes how the mesh is expected to change; cores may ignore it.
+	virtual void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry ) = 0;
+	// SetIndexedGeometry: update the geometry for a single mesh, using unique vertices and three indices per triangle for
+	// intersection. The triangles still provide all shading data. Returns false if the core does not support this.
+	virtual bool SetIndexedGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const uint* indexData, const int triangleCount,
+		const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry ) { return false; }
+	// SetCurves: update the geometry for a single mesh to hair or fur: round linear segments between control points
+	// (xyz: position, w: radius), each given by the index of its first point. Returns false if the core does not
+	// support curves; the RenderSystem then sends the tessellated triangles of the mesh using SetGeometry.
+	virtual bool SetCurves( const int meshIdx, const float4* points, const int pointCount, const uint* segments, const int segmentCount,
+		const int material, const GeometryHint hint = DefaultGeometry ) { return false; }
+	// SetParticles: update the geometry for a single mesh to a set of spheres (xyz: centre, w: radius), all with the
+	// same material. Returns false if the core does not support spheres; the RenderSystem then sends a tessellation.
+	virtual bool SetParticles( const int meshIdx, const float4* spheres, const int count, const int material, const GeometryHint hint = DefaultGeometry ) { return false; }
+	// SetAnimationData: store bind pose, skin and morph target data for a mesh, once, after its first SetGeometry call.
+	// Morph deltas are stored per target, vertexCount entries each. Returns false if the core does not animate meshes;
+	// the RenderSystem then animates on the host and sends the results using SetGeometry.
+	virtual bool SetAnimationData( const int meshIdx, const float4* vertexData, const float3* normalData, const int vertexCount,
+		const uint4* joints, const float4* weights, const float3* morphPositions, const float3* morphNormals, const int morphTargets ) { return false; }
+	// SetPose: animate a mesh for which SetAnimationData returned true, using joint matrices and / or morph weights.
+	virtual void SetPose( const int meshIdx, const mat4* jointMat, const int jointCount, const float* morphWeights, const int weightCount ) {}
 	// SetInstance: update the data on a single instance.
 	virtual void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform ) = 0;
+	// SetInstances: update 'count' consecutive instances, starting at slot 'first'. Cores that store their instances
+	// as arrays override this to avoid per-instance overhead for large batches.
+	virtual void SetInstances( const int first, const int count, const int* modelIdx, const mat4* transforms )
+	{
+		for (int i = 0; i < count; i++) SetInstance( first + i, modelIdx[i], transforms[i] );
+	}
+	// SetInstanceGroup: store a sub-assembly of 'count' mesh instances, with transforms relative to the group. An
+	// instance refers to the group using INSTANCEGROUP( groupIdx ) as its model index, so that a repeated assembly is
+	// built once. Returns false if the core does not support nested instancing.
+	virtual bool SetInstanceGroup( const int groupIdx, const int count, const int* modelIdx, const mat4* transforms ) { return false; }
+	// ScatterInstances: fill instance group 'groupIdx' with instances generated by the core itself, on the surface
+	// described by 'scatter'. Unlike SetInstanceGroup, the members never exist on the host. Returns false if the core
+	// cannot generate instances; the prototype meshes must have been sent before.
+	virtual bool ScatterInstances( const int groupIdx, const CoreScatter& scatter ) { return false; }
+	// SetInstanceVisibility: limit the ray types that see an instance, using VISIBLE_* flags. SetInstance resets this
+	// to VISIBLE_ALL. Cores that ignore it render the instance for all rays.
+	virtual void SetInstanceVisibility( const int instanceIdx, const uint visibility ) {}
+	// SetInstanceMotion: the transform of an instance at shutter open, i.e. in the previous frame, for motion blur
+	// and motion vectors; the transform passed to SetInstance applies at shutter close. SetInstance makes the
+	// instance static again. Cores without motion blur or motion vectors ignore this.
+	virtual void SetInstanceMotion( const int instanceIdx, const mat4& openTransform ) {}
+	// RemoveInstance: the instance slot is no longer in use; the instance must not be rendered until a SetInstance
+	// call reuses the slot. Instance slots are stable: the other instances keep their index.
+	virtual void RemoveInstance( const int instanceIdx ) {}
 	// UpdateTopLevel: trigger a top-level BVH update.
 	virtual void UpdateToplevel() = 0;
 };
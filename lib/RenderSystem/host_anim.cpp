@@ -36,17 +36,17 @@ void HostAnimation::Sampler::ConvertFromGLTFSampler( const tinygltfAnimationSamp
 	else if (gltfSampler.interpolation == "CUBICSPLINE") interpolation = SPLINE;
 	else /* if (gltfSampler.interpolation == "LINEAR" ) */ interpolation = LINEAR;
 	// extract animation times
-	auto inputAccessor = gltfModel.accessors[gltfSampler.input];
+	const auto& inputAccessor = gltfModel.accessors[gltfSampler.input];
 	assert( inputAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT );
-	auto bufferView = gltfModel.bufferViews[inputAccessor.bufferView];
-	auto buffer = gltfModel.buffers[bufferView.buffer];
-	const float* a = (const float*)(buffer.data.data() + bufferView.byteOffset + inputAccessor.byteOffset);
+	const auto& inputView = gltfModel.bufferViews[inputAccessor.bufferView];
+	const auto& inputBuffer = gltfModel.buffers[inputView.buffer]; // by reference: buffers can be the size of the file
+	const float* a = (const float*)(inputBuffer.data.data() + inputView.byteOffset + inputAccessor.byteOffset);
 	size_t count = inputAccessor.count;
 	for (int i = 0; i < count; i++) t.push_back( a[i] );
 	// extract animation keys
-	auto outputAccessor = gltfModel.accessors[gltfSampler.output];
-	bufferView = gltfModel.bufferViews[outputAccessor.bufferView];
-	buffer = gltfModel.buffers[bufferView.buffer];
+	const auto& outputAccessor = gltfModel.accessors[gltfSampler.output];
+	const auto& bufferView = gltfModel.bufferViews[outputAccessor.bufferView];
+	const auto& buffer = gltfModel.buffers[bufferView.buffer];
 	const uchar* b = (const uchar*)(buffer.data.data() + bufferView.byteOffset + outputAccessor.byteOffset);
 	if (outputAccessor.type == TINYGLTF_TYPE_VEC3)
 	{
@@ -86,6 +86,12 @@ void HostAnimation::Sampler::ConvertFromGLTFSampler( const tinygltfAnimationSamp
 		for (int i = 0; i < outputAccessor.count; i++) vec4Key.push_back( quat( fdata[i * 4 + 3], fdata[i * 4], fdata[i * 4 + 1], fdata[i * 4 + 2] ) );
 	}
 	else assert( false );
+	// store linear vec3 and vec4 keys per component, so four channels can be sampled at once
+	if (interpolation == LINEAR)
+	{
+		for (const float3& key : vec3Key) soaKey[0].push_back( key.x ), soaKey[1].push_back( key.y ), soaKey[2].push_back( key.z );
+		for (const quat& key : vec4Key) soaKey[0].push_back( key.x ), soaKey[1].push_back( key.y ), soaKey[2].push_back( key.z ), soaKey[3].push_back( key.w );
+	}
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -199,36 +205,46 @@ void HostAnimation::Channel::ConvertFromGLTFChannel( const tinygltfAnimationChan
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  HostAnimation::Channel::Update                                             |
-//  |  Advance channel animation time.                                      LH2'19|
+//  |  HostAnimation::Channel::Advance                                            |
+//  |  Advance channel animation time. The search for the current keyframe        |
+//  |  continues from the previous one.                                     LH2'19|
 //  +-----------------------------------------------------------------------------+
-void HostAnimation::Channel::Update( const float dt, const Sampler* sampler )
+void HostAnimation::Channel::Advance( const float dt, const Sampler* sampler )
 {
-	// advance animation timer
 	t += dt;
 	int keyCount = (int)sampler->t.size();
 	float animDuration = sampler->t[keyCount - 1];
 	while (t > animDuration) t -= animDuration, k = 0;
 	while (t > sampler->t[(k + 1) % keyCount]) k++;
-	// determine interpolation parameters
-	float t0 = sampler->t[k % keyCount];
-	float t1 = sampler->t[(k + 1) % keyCount];
-	float f = (t - t0) / (t1 - t0);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostAnimation::Channel::Update                                             |
+//  |  Advance channel animation time and apply the key to the target node.       |
+//  |                                                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostAnimation::Channel::Update( const float dt, const Sampler* sampler )
+{
+	// advance animation timer
+	Advance( dt, sampler );
 	// apply anination key
 	if (target == 0) // translation
 	{
 		HostScene::nodes[nodeIdx]->translation = sampler->SampleVec3( t, k );
 		HostScene::nodes[nodeIdx]->transformed = true;
+		HostScene::nodes[nodeIdx]->MarkAsDirty();
 	}
 	else if (target == 1) // rotation
 	{
 		HostScene::nodes[nodeIdx]->rotation = sampler->SampleQuat( t, k );
 		HostScene::nodes[nodeIdx]->transformed = true;
+		HostScene::nodes[nodeIdx]->MarkAsDirty();
 	}
 	else if (target == 2) // scale
 	{
 		HostScene::nodes[nodeIdx]->scale = sampler->SampleVec3( t, k );
 		HostScene::nodes[nodeIdx]->transformed = true;
+		HostScene::nodes[nodeIdx]->MarkAsDirty();
 	}
 	else // target == 3, weight
 	{
@@ -247,6 +263,7 @@ void HostAnimation::Channel::Update( const float dt, const Sampler* sampler )
 		#endif
 		}
 		HostScene::nodes[nodeIdx]->morphed = true;
+		HostScene::nodes[nodeIdx]->MarkAsDirty();
 	}
 }
 
@@ -267,6 +284,14 @@ void HostAnimation::ConvertFromGLTFAnim( tinygltfAnimation& gltfAnim, tinygltfMo
 {
 	for (int i = 0; i < gltfAnim.samplers.size(); i++) sampler.push_back( new Sampler( gltfAnim.samplers[i], gltfModel ) );
 	for (int i = 0; i < gltfAnim.channels.size(); i++) channel.push_back( new Channel( gltfAnim.channels[i], gltfModel, nodeBase ) );
+	// linear translation, rotation and scale channels are sampled in batches; the others use Channel::Update
+	for (int i = 0; i < channel.size(); i++)
+	{
+		const Sampler* s = sampler[channel[i]->samplerIdx];
+		if (s->interpolation != Sampler::LINEAR || s->t.size() < 2 || channel[i]->target == 3) otherChannels.push_back( i );
+		else if (channel[i]->target == 1) quatBatch.push_back( i );
+		else vec3Batch.push_back( i );
+	}
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -284,7 +309,63 @@ void HostAnimation::Reset()
 //  +-----------------------------------------------------------------------------+
 void HostAnimation::Update( const float dt )
 {
-	for (int i = 0; i < channel.size(); i++) channel[i]->Update( dt, sampler[channel[i]->samplerIdx] );
+	for (int i : vec3Batch) channel[i]->Advance( dt, sampler[channel[i]->samplerIdx] );
+	for (int i : quatBatch) channel[i]->Advance( dt, sampler[channel[i]->samplerIdx] );
+	UpdateBatch( vec3Batch, 3 );
+	UpdateBatch( quatBatch, 4 );
+	for (int i : otherChannels) channel[i]->Update( dt, sampler[channel[i]->samplerIdx] );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostAnimation::UpdateBatch                                                 |
+//  |  Sample four linear channels at once, using the per-component keys of the   |
+//  |  samplers, and write the results to the target nodes. Rotations are         |
+//  |  interpolated linearly and normalized, like in Sampler::SampleQuat.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostAnimation::UpdateBatch( const vector<int>& batch, const int components )
+{
+	for (int s = (int)batch.size(), i = 0; i < s; i += 4)
+	{
+		// gather the keys around the current time; unused lanes interpolate ones
+		const int lanes = min( 4, s - i );
+		union { __m128 f4; float f[4]; };
+		union { __m128 a4[4]; float a[4][4]; };
+		union { __m128 b4[4]; float b[4][4]; };
+		f4 = _mm_setzero_ps();
+		for (int j = 0; j < 4; j++) a4[j] = b4[j] = _mm_set_ps1( 1 );
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			const Channel* c = channel[batch[i + lane]];
+			const Sampler* smp = sampler[c->samplerIdx];
+			const float t0 = smp->t[c->k], t1 = smp->t[c->k + 1];
+			const float fk = (c->t - t0) / (t1 - t0);
+			// before the first key, the first key is used
+			const int k0 = fk <= 0 ? 0 : c->k, k1 = fk <= 0 ? 0 : (c->k + 1);
+			f[lane] = fk <= 0 ? 0 : fk;
+			for (int j = 0; j < components; j++) a[j][lane] = smp->soaKey[j][k0], b[j][lane] = smp->soaKey[j][k1];
+		}
+		// interpolate: (1 - f) * a + f * b
+		const __m128 g4 = _mm_sub_ps( _mm_set_ps1( 1 ), f4 );
+		for (int j = 0; j < components; j++) a4[j] = _mm_add_ps( _mm_mul_ps( g4, a4[j] ), _mm_mul_ps( f4, b4[j] ) );
+		if (components == 4)
+		{
+			const __m128 len4 = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( a4[0], a4[0] ), _mm_mul_ps( a4[1], a4[1] ) ),
+				_mm_add_ps( _mm_mul_ps( a4[2], a4[2] ), _mm_mul_ps( a4[3], a4[3] ) ) ) );
+			for (int j = 0; j < 4; j++) a4[j] = _mm_div_ps( a4[j], len4 );
+		}
+		// scatter to the nodes
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			const Channel* c = channel[batch[i + lane]];
+			HostNode* node = HostScene::nodes[c->nodeIdx];
+			const float3 v = make_float3( a[0][lane], a[1][lane], a[2][lane] );
+			if (c->target == 0) node->translation = v;
+			else if (c->target == 1) node->rotation = quat( a[3][lane], v );
+			else node->scale = v;
+			node->transformed = true;
+			node->MarkAsDirty();
+		}
+	}
 }
 
 // EOF
\ No newline at end of file
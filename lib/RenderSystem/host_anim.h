@@ -39,6 +39,7 @@ public:
 	vector<float3> vec3Key;			// vec3 key frames (location or scale)
 	vector<quat> vec4Key;			// vec4 key frames (rotation)
 	vector<float> floatKey;			// float key frames (weight)
+	vector<float> soaKey[4];		// linear vec3 / vec4 keys as separate x, y, z, w arrays, for batched sampling
 	int interpolation;				// interpolation type: linear, spline, step
 };
 class Channel
@@ -49,7 +50,8 @@ public:
 	int nodeIdx;					// index of the node this channel affects
 	int target;						// 0: translation, 1: rotation, 2: scale, 3: weights
 	void Reset() { t = 0, k = 0; }
-	void Update( const float t, const Sampler* sampler );	// apply this channel to the target nde for time t
+	void Advance( const float dt, const Sampler* sampler );	// advance the timer and the current keyframe
+	void Update( const float dt, const Sampler* sampler );	// advance and apply this channel to the target node
 	void ConvertFromGLTFChannel( const tinygltfAnimationChannel& gltfChannel, const tinygltfModel& gltfModel, const int nodeBase );
 	// data
 	float t = 0;					// animation timer
@@ -62,6 +64,11 @@ public:
 	void Reset();					// reset all channels
 	void Update( const float dt );	// advance and apply all channels
 	void ConvertFromGLTFAnim( tinygltfAnimation& gltfAnim, tinygltfModel& gltfModel, const int nodeBase );
+private:
+	void UpdateBatch( const vector<int>& batch, const int components );	// apply linear channels, four at a time
+	vector<int> vec3Batch;			// linear translation and scale channels
+	vector<int> quatBatch;			// linear rotation channels
+	vector<int> otherChannels;		// channels that are applied one by one, using Channel::Update
 };
 
 } // namespace lighthouse2
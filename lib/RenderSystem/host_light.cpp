@@ -15,14 +15,20 @@
 
 #include "rendersystem.h"
 
+#define EMISSIONTEXELS	65536	// texels sampled per emissive triangle by AverageTexel; larger footprints are subsampled
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostAreaLight::HostAreaLight                                               |
 //  |  Constructor. An area light is just a regular triangle in LH2, but we do    |
 //  |  store some additional data:                                                |
 //  |  - For efficient sampling, we store the vertices, normal and radiace;       |
-//  |  - For MIS, we store the original triangle (idx and instance idx).    LH2'19|
+//  |  - For MIS, we store the original triangle (idx and instance idx).          |
+//  |  The cores shade an emissive triangle with its material color, modulated    |
+//  |  by the map; texel is the average of the map over the triangle, so that the |
+//  |  radiance and energy of the light match the surface on average, for light   |
+//  |  selection and for the light samples.                                 LH2'19|
 //  +-----------------------------------------------------------------------------+
-HostAreaLight::HostAreaLight( HostTri* origTri, int origIdx, int origInstance )
+HostAreaLight::HostAreaLight( HostTri* origTri, int origIdx, int origInstance, const float3& texel ) : texel( texel )
 {
 	triIdx = origIdx;
 	instIdx = origInstance;
@@ -36,11 +42,60 @@ HostAreaLight::HostAreaLight( HostTri* origTri, int origIdx, int origInstance )
 	const float c = length( vertex0 - vertex2 );
 	const float s = (a + b + c) * 0.5f;
 	area = sqrtf( s * (s - a) * (s - b) * (s - c) ); // Heron's formula
-	radiance = HostScene::materials[origTri->material]->color;
+	radiance = HostScene::materials[origTri->material]->color * texel;
 	const float3 E = radiance * area;
 	energy = E.x + E.y + E.z;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostAreaLight::AverageTexel                                                |
+//  |  Average color of the map of an emissive triangle, over the texels whose    |
+//  |  centres lie inside its uv footprint; the texel at the centroid for         |
+//  |  triangles smaller than a texel. At most EMISSIONTEXELS are visited, on a   |
+//  |  regular grid. Without a map, or while the map is a placeholder, the        |
+//  |  result is 1, the behavior for untextured emitters.                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+float3 HostAreaLight::AverageTexel( const HostTri& tri )
+{
+	const HostMaterial::MapProps& map = HostScene::materials[tri.material]->map[TEXTURE0];
+	if (map.textureID < 0 || map.textureID >= (int)HostScene::textures.size()) return make_float3( 1 );
+	const HostTexture* texture = HostScene::textures[map.textureID];
+	if ((texture->flags & HostTexture::PLACEHOLDER) || (!texture->idata && !texture->fdata)) return make_float3( 1 );
+	const int w = (int)texture->width, h = (int)texture->height;
+	auto fetch = [&]( const int x, const int y ) {
+		const int idx = ((x % w) + w) % w + (((y % h) + h) % h) * w;
+		if (texture->fdata) return make_float3( texture->fdata[idx] );
+		const uchar4 p = texture->idata[idx];
+		return make_float3( p.x, p.y, p.z ) * (1.0f / 256.0f); // as the cores decode ARGB32 texels
+	};
+	// footprint in texel space
+	const float2 t0 = map.uvscale * (map.uvoffset + make_float2( tri.u0, tri.v0 )) * make_float2( (float)w, (float)h );
+	const float2 t1 = map.uvscale * (map.uvoffset + make_float2( tri.u1, tri.v1 )) * make_float2( (float)w, (float)h );
+	const float2 t2 = map.uvscale * (map.uvoffset + make_float2( tri.u2, tri.v2 )) * make_float2( (float)w, (float)h );
+	const float2 tmin = fminf( t0, fminf( t1, t2 ) ), tmax = fmaxf( t0, fmaxf( t1, t2 ) );
+	const int x0 = (int)floorf( tmin.x ), x1 = (int)ceilf( tmax.x ), y0 = (int)floorf( tmin.y ), y1 = (int)ceilf( tmax.y );
+	const float texels = (float)(x1 - x0 + 1) * (float)(y1 - y0 + 1);
+	const int step = texels > EMISSIONTEXELS ? (int)ceilf( sqrtf( texels / EMISSIONTEXELS ) ) : 1;
+	// edge functions of the footprint; the sign of the area makes them positive inside
+	const float2 e0 = t1 - t0, e1 = t2 - t1, e2 = t0 - t2;
+	const float area = e0.x * (t2.y - t0.y) - e0.y * (t2.x - t0.x);
+	if (area == 0) return fetch( (int)floorf( t0.x ), (int)floorf( t0.y ) );
+	const float s = area > 0 ? 1.0f : -1.0f;
+	float3 sum = make_float3( 0 );
+	int count = 0;
+	for (int y = y0; y <= y1; y += step) for (int x = x0; x <= x1; x += step)
+	{
+		const float2 p = make_float2( x + 0.5f, y + 0.5f );
+		if (s * (e0.x * (p.y - t0.y) - e0.y * (p.x - t0.x)) < 0) continue;
+		if (s * (e1.x * (p.y - t1.y) - e1.y * (p.x - t1.x)) < 0) continue;
+		if (s * (e2.x * (p.y - t2.y) - e2.y * (p.x - t2.x)) < 0) continue;
+		sum += fetch( x, y ), count++;
+	}
+	if (count > 0) return sum * (1.0f / count);
+	const float2 c = (t0 + t1 + t2) * (1.0f / 3);
+	return fetch( (int)floorf( c.x ), (int)floorf( c.y ) );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostAreaLight::ConvertToCoreLightTri                                       |
 //  |  Prepare an area light for the core.                                  LH2'19|
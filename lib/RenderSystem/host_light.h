@@ -26,9 +26,10 @@ class HostAreaLight
 public:
 	// constructor / destructor
 	HostAreaLight() = default;
-	HostAreaLight( HostTri* origTri, int origIdx, int origInstance );
+	HostAreaLight( HostTri* origTri, int origIdx, int origInstance, const float3& texel = make_float3( 1 ) );
 	// methods
 	CoreLightTri ConvertToCoreLightTri();
+	static float3 AverageTexel( const HostTri& tri );
 	// data members
 	int triIdx = 0;								// the index of the triangle this ltri is based on
 	int instIdx = 0;							// the instance to which this triangle belongs
@@ -37,6 +38,7 @@ public:
 	float3 vertex2 = make_float3( 0 );
 	float3 centre = make_float3( 0 );
 	float3 radiance = make_float3( 0 );
+	float3 texel = make_float3( 1 );			// average texel of the emissive map under the triangle, see AverageTexel
 	float3 N = make_float3( 0, -1, 0 );
 	float area = 0;
 	float energy = 0;
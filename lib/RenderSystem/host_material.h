@@ -73,18 +73,20 @@ public:
 	float custom2 = 0.0f;
 	float custom3 = 0.0f;
 	MapProps map[11];							// bitmap data
-	// field for the BuildMaterialList method of HostMesh
-	bool visited = false;						// last mesh that checked this material
+	bool IsEmissive() const { return color.x > 1 || color.y > 1 || color.z > 1; }
 	bool AlphaChanged()
 	{
 		// A change to the alpha flag should trigger a change to any mesh using this flag as
-		// well. This method allows us to track this.
-		const bool changed = (flags & HASALPHA) != (prevFlags & HASALPHA);
-		prevFlags = flags;
+		// well. This method allows us to track this. The alpha states of the triangles also
+		// depend on the texture of an alpha mapped material, see HostMesh::UpdateAlphaFlags.
+		const bool changed = (flags & HASALPHA) != (prevFlags & HASALPHA) ||
+			((flags & HASALPHA) && map[TEXTURE0].textureID != prevAlphaMap);
+		prevFlags = flags, prevAlphaMap = map[TEXTURE0].textureID;
 		return changed;
 	}
 private:
 	uint prevFlags = SMOOTH;					// initially identical to flags
+	int prevAlphaMap = -1;						// map[TEXTURE0].textureID at the last AlphaChanged
 	TRACKCHANGES;								// add Changed(), MarkAsDirty() methods, see system.h
 };
 
@@ -15,6 +15,15 @@
 
 #include "rendersystem.h"
 #include "direct.h"
+#include <fstream>
+#include <sstream>
+
+#define OBJCHUNKSIZE	(1 << 22)	// bytes of obj text per parsing job
+#define OBJMAXCHUNKS	1024		// upper bound for the number of obj parsing jobs
+#define OBJTRIBLOCKSIZE	65536		// triangles per obj triangle setup job
+#define SKINBLOCKSIZE	4096	// triangles per skinning job; smaller meshes are skinned on the calling thread
+#define ALPHABLOCKSIZE	1024	// triangles per alpha flag job; each one scans the alpha map under the triangle
+#define ALPHABAKETEXELS	65536	// larger alpha map footprints are not scanned; the triangle stays ALPHA_TESTED
 
 using namespace tinygltf;
 
@@ -79,6 +88,8 @@ HostMesh::HostMesh( const tinygltfMesh& gltfMesh, const tinygltfModel& gltfModel
 //  +-----------------------------------------------------------------------------+
 HostMesh::~HostMesh()
 {
+	delete curves;
+	delete particles;
 	// TODO: warn if instances using this mesh still exist?
 	// And in general, do we want a two-way link between related objects?
 	// - Materials and meshes;
@@ -112,181 +123,633 @@ void HostMesh::LoadGeometry( const char* file, const char* dir, const float scal
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  OBJ parsing helpers                                                        |
+//  |  The obj file is memory mapped and split in chunks at line boundaries. A    |
+//  |  first parallel pass counts the vertex attributes and triangles per chunk;  |
+//  |  a prefix sum then gives each chunk its place in the final streams, so the  |
+//  |  second pass parses straight into them, including relative indices.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct ObjChunk
+{
+	const char* first, *last;					// text range; starts at a line
+	int positions = 0, normals = 0, uvs = 0, tris = 0;	// counts, then the first index in each stream
+	vector<string> mtllibs;						// material libraries referenced in this chunk
+	vector<pair<int, string>> usemtl;			// material switches: chunk-local triangle index, material name
+};
+struct ObjStreams
+{
+	float3* positions, *normals;
+	float2* uvs;
+	int3* corners;								// three per triangle: position, uv and normal index, -1 if absent
+};
+static bool ObjSpace( const char c ) { return c == ' ' || c == '\t'; }
+static const char* ObjSkipSpace( const char* p, const char* end ) { while (p < end && ObjSpace( *p )) p++; return p; }
+static bool ObjToken( const char* p, const char* end, const char* token, const int length )
+{
+	return p + length < end && !strncmp( p, token, length ) && ObjSpace( p[length] );
+}
+static string ObjName( const char* p, const char* end )
+{
+	p = ObjSkipSpace( p, end );
+	const char* e = p;
+	while (e < end && *e != '\n') e++;
+	while (e > p && (ObjSpace( e[-1] ) || e[-1] == '\r')) e--;
+	return string( p, e - p );
+}
+static float ObjParseFloat( const char*& p, const char* end )
+{
+	p = ObjSkipSpace( p, end );
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+	double value = 0;
+	while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+	if (p < end && *p == '.')
+	{
+		double scale = 0.1;
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, scale *= 0.1) value += (*p - '0') * scale;
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		bool negativeExponent = false;
+		if (++p < end && (*p == '-' || *p == '+')) negativeExponent = *p++ == '-';
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9') exponent = exponent * 10 + (*p++ - '0');
+		value *= pow( 10.0, negativeExponent ? -exponent : exponent );
+	}
+	return (float)(negative ? -value : value);
+}
+static int ObjParseInt( const char*& p, const char* end )
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+	int value = 0;
+	while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+	return negative ? -value : value;
+}
+static bool ObjParseCorner( const char*& p, const char* end, int3& corner )
+{
+	// v, v/vt, v//vn or v/vt/vn; zero for absent indices. Returns false at the end of the line.
+	p = ObjSkipSpace( p, end );
+	if (p == end || *p == '\n' || *p == '\r' || *p == '#') return false;
+	corner = make_int3( ObjParseInt( p, end ), 0, 0 );
+	if (p < end && *p == '/')
+	{
+		if (++p < end && *p != '/') corner.y = ObjParseInt( p, end );
+		if (p < end && *p == '/') p++, corner.z = ObjParseInt( p, end );
+	}
+	while (p < end && !ObjSpace( *p ) && *p != '\n' && *p != '\r') p++; // skip anything we do not understand
+	return true;
+}
+static int ObjIndex( const int idx, const int count ) { return idx > 0 ? (idx - 1) : idx < 0 ? (count + idx) : -1; }
+static void ObjParseChunk( ObjChunk& chunk, const ObjStreams* out )
+{
+	// without streams, this only counts; otherwise chunk holds the first index in each stream
+	int positions = 0, normals = 0, uvs = 0, tris = 0;
+	const char* end = chunk.last;
+	for (const char* line = chunk.first; line < end; )
+	{
+		const char* p = ObjSkipSpace( line, end );
+		while (line < end && *line != '\n') line++;
+		line++; // start of the next line
+		if (p + 1 >= end) continue;
+		if (ObjToken( p, end, "v", 1 ))
+		{
+			if (out)
+			{
+				p++;
+				const float x = ObjParseFloat( p, end ), y = ObjParseFloat( p, end ), z = ObjParseFloat( p, end );
+				out->positions[chunk.positions + positions] = make_float3( x, y, z );
+			}
+			positions++;
+		}
+		else if (ObjToken( p, end, "vn", 2 ))
+		{
+			if (out)
+			{
+				p += 2;
+				const float x = ObjParseFloat( p, end ), y = ObjParseFloat( p, end ), z = ObjParseFloat( p, end );
+				out->normals[chunk.normals + normals] = make_float3( x, y, z );
+			}
+			normals++;
+		}
+		else if (ObjToken( p, end, "vt", 2 ))
+		{
+			if (out)
+			{
+				p += 2;
+				const float u = ObjParseFloat( p, end ), v = ObjParseFloat( p, end );
+				out->uvs[chunk.uvs + uvs] = make_float2( u, v );
+			}
+			uvs++;
+		}
+		else if (ObjToken( p, end, "f", 1 ))
+		{
+			// polygons are triangulated as a fan, like tinyobj does
+			p++;
+			int3 c, first = make_int3( -1 ), previous = make_int3( -1 );
+			int cornerCount = 0;
+			while (ObjParseCorner( p, end, c ))
+			{
+				if (out)
+				{
+					// resolve relative indices against the attributes read so far
+					c = make_int3( ObjIndex( c.x, chunk.positions + positions ), ObjIndex( c.y, chunk.uvs + uvs ), ObjIndex( c.z, chunk.normals + normals ) );
+					if (cornerCount >= 2)
+					{
+						int3* corners = out->corners + (chunk.tris + tris) * 3;
+						corners[0] = first, corners[1] = previous, corners[2] = c;
+					}
+				}
+				if (cornerCount == 0) first = c;
+				if (cornerCount++ >= 2) tris++;
+				previous = c;
+			}
+		}
+		else if (ObjToken( p, end, "usemtl", 6 ))
+		{
+			if (out) chunk.usemtl.push_back( make_pair( tris, ObjName( p + 6, end ) ) );
+		}
+		else if (ObjToken( p, end, "mtllib", 6 ))
+		{
+			if (!out) chunk.mtllibs.push_back( ObjName( p + 6, end ) );
+		}
+	}
+	if (!out) chunk.positions = positions, chunk.normals = normals, chunk.uvs = uvs, chunk.tris = tris;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostMesh::LoadGeometryFromObj                                              |
-//  |  Load an obj file using tinyobj.                                      LH2'19|
+//  |  Load an obj file. Geometry is parsed in parallel from a memory mapped      |
+//  |  file, straight into the vertex and triangle arrays; tinyobj only parses    |
+//  |  the material libraries.                                              LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostMesh::LoadGeometryFromOBJ( const string& fileName, const char* directory, const mat4& transform )
 {
-	// load obj file
-	tinyobj::attrib_t attrib;
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	map<string, GLuint> textures;
-	string err;
+	// map the obj file and split it in chunks at line boundaries
 	Timer timer;
 	timer.reset();
-	tinyobj::LoadObj( &attrib, &shapes, &materials, &err, fileName.c_str(), directory );
-	if (err.size() > 0) FatalError( __FILE__, __LINE__, err.c_str(), fileName.c_str() );
-	printf( "loaded mesh in %5.3fs\n", timer.elapsed() );
+	MappedFile file( fileName.c_str() );
+	if (!file.data) FatalError( __FILE__, __LINE__, "could not open obj file", fileName.c_str() );
+	const char* text = (const char*)file.data, *textEnd = text + file.size;
+	const size_t chunksNeeded = file.size / OBJCHUNKSIZE + 1;
+	const int chunkCount = chunksNeeded > OBJMAXCHUNKS ? OBJMAXCHUNKS : (int)chunksNeeded;
+	vector<ObjChunk> chunks( chunkCount );
+	for (int i = 0; i < chunkCount; i++)
+	{
+		const char* p = text + file.size * i / chunkCount;
+		if (i > 0) { while (p < textEnd && p[-1] != '\n') p++; }
+		chunks[i].first = p;
+		if (i > 0) chunks[i - 1].last = p;
+	}
+	chunks[chunkCount - 1].last = textEnd;
+	// pass 1: count, then turn the counts into the first index per chunk
+	JobSystem::ParallelFor( chunkCount, [&]( const int first, const int last ) { for (int i = first; i < last; i++) ObjParseChunk( chunks[i], 0 ); } );
+	int positionCount = 0, normalCount = 0, uvCount = 0, triCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		int counts[4] = { chunk.positions, chunk.normals, chunk.uvs, chunk.tris };
+		chunk.positions = positionCount, chunk.normals = normalCount, chunk.uvs = uvCount, chunk.tris = triCount;
+		positionCount += counts[0], normalCount += counts[1], uvCount += counts[2], triCount += counts[3];
+	}
+	// pass 2: parse into the final streams
+	vector<float3> positions( positionCount ), normals( normalCount );
+	vector<float2> uvs( uvCount );
+	vector<int3> corners( triCount * 3 );
+	const ObjStreams streams = { positions.data(), normals.data(), uvs.data(), corners.data() };
+	JobSystem::ParallelFor( chunkCount, [&]( const int first, const int last ) { for (int i = first; i < last; i++) ObjParseChunk( chunks[i], &streams ); } );
+	printf( "loaded mesh in %5.3fs (%i chunks)\n", timer.elapsed(), chunkCount );
+	// load the material libraries
+	vector<tinyobj::material_t> materials;
+	map<string, int> materialMap;
+	for (const ObjChunk& chunk : chunks) for (const string& lib : chunk.mtllibs)
+	{
+		std::ifstream stream( string( directory ) + lib );
+		if (stream) tinyobj::LoadMtl( &materialMap, &materials, &stream );
+	}
 	// material offset: if we loaded an object before this one, material indices should not start at 0.
 	int matIdxOffset = (int)HostScene::materials.size();
+	// faces without a known material get a default one, as tinyobjs default material would
+	int firstSwitch = triCount;
+	for (const ObjChunk& chunk : chunks) if (chunk.usemtl.size() > 0) { firstSwitch = chunk.tris + chunk.usemtl[0].first; break; }
+	bool needsDefault = firstSwitch > 0;
+	for (const ObjChunk& chunk : chunks) for (const auto& s : chunk.usemtl) if (materialMap.find( s.second ) == materialMap.end()) needsDefault = true;
+	if (needsDefault)
+	{
+		std::istringstream defaultMtl( "newmtl default\n" );
+		tinyobj::LoadMtl( &materialMap, &materials, &defaultMtl );
+	}
+	const int defaultMaterial = needsDefault ? (int)materials.size() - 1 : 0;
 	// process materials
 	timer.reset();
 	char currDir[1024];
 	_getcwd( currDir, 1024 ); // GetCurrentDirectory( 1024, currDir );
 	_chdir( directory ); // SetCurrentDirectory( directory );
-	materialList.clear();
-	materialList.reserve( materials.size() );
+	// decode the textures in parallel before the materials look them up; flags match HostMaterial::ConvertFrom
+	vector<string> textureFiles;
+	vector<uint> textureFlags;
+	for (auto& mtl : materials)
+	{
+		if (mtl.diffuse_texname != "") textureFiles.push_back( mtl.diffuse_texname ), textureFlags.push_back( HostTexture::LINEARIZED | HostTexture::FLIPPED );
+		if (mtl.normal_texname != "") textureFiles.push_back( mtl.normal_texname ), textureFlags.push_back( HostTexture::FLIPPED );
+		if (mtl.specular_texname != "") textureFiles.push_back( mtl.specular_texname ), textureFlags.push_back( HostTexture::FLIPPED );
+	}
+	HostScene::PreloadTextures( textureFiles, textureFlags );
+	HostScene::materialPool.Reserve( materials.size() );
 	for (auto &mtl : materials)
 	{
 		// initialize
-		HostMaterial* material = new HostMaterial();
+		HostMaterial* material = HostScene::materialPool.New();
 		material->ID = (int)HostScene::materials.size();
 		material->origin = fileName;
 		material->ConvertFrom( mtl );
 		material->flags |= HostMaterial::FROM_MTL;
 		HostScene::materials.push_back( material );
-		materialList.push_back( material->ID );
 	}
 	_chdir( currDir ); // SetCurrentDirectory( currDir );
 	printf( "materials finalized in %5.3fs\n", timer.elapsed() );
+	// assign materials to triangles; a usemtl applies until the next one, across chunk boundaries
+	triangles.resize( triCount );
+	int currentMaterial = defaultMaterial;
+	for (int k = 0; k < chunkCount; k++)
+	{
+		const ObjChunk& chunk = chunks[k];
+		const int chunkTris = (k + 1 < chunkCount ? chunks[k + 1].tris : triCount) - chunk.tris;
+		for (int s = (int)chunk.usemtl.size(), j = -1; j < s; j++)
+		{
+			if (j >= 0)
+			{
+				auto m = materialMap.find( chunk.usemtl[j].second );
+				currentMaterial = m == materialMap.end() ? defaultMaterial : m->second;
+			}
+			const int first = j >= 0 ? chunk.usemtl[j].first : 0, last = j + 1 < s ? chunk.usemtl[j + 1].first : chunkTris;
+			for (int i = first; i < last; i++) triangles[chunk.tris + i].material = currentMaterial + matIdxOffset;
+		}
+	}
 	// calculate values for consistent normal interpolation
-	const uint verts = (uint)attrib.normals.size() / 3;
 	vector<float> alphas;
 	timer.reset();
-	alphas.resize( verts, 1.0f ); // we will have one alpha value per unique vertex normal
-	for (uint s = (uint)shapes.size(), i = 0; i < s; i++)
-	{
-		vector<tinyobj::index_t>& indices = shapes[i].mesh.indices;
-		for (uint s = (uint)indices.size(), f = 0; f < s; f += 3)
-		{
-			const int idx0 = indices[f + 0].vertex_index, nidx0 = indices[f + 0].normal_index;
-			const int idx1 = indices[f + 1].vertex_index, nidx1 = indices[f + 1].normal_index;
-			const int idx2 = indices[f + 2].vertex_index, nidx2 = indices[f + 2].normal_index;
-			const float3 vert0 = make_float3( attrib.vertices[idx0 * 3 + 0], attrib.vertices[idx0 * 3 + 1], attrib.vertices[idx0 * 3 + 2] );
-			const float3 vert1 = make_float3( attrib.vertices[idx1 * 3 + 0], attrib.vertices[idx1 * 3 + 1], attrib.vertices[idx1 * 3 + 2] );
-			const float3 vert2 = make_float3( attrib.vertices[idx2 * 3 + 0], attrib.vertices[idx2 * 3 + 1], attrib.vertices[idx2 * 3 + 2] );
-			const float3 vN0 = make_float3( attrib.normals[nidx0 * 3 + 0], attrib.normals[nidx0 * 3 + 1], attrib.normals[nidx0 * 3 + 2] );
-			const float3 vN1 = make_float3( attrib.normals[nidx1 * 3 + 0], attrib.normals[nidx1 * 3 + 1], attrib.normals[nidx1 * 3 + 2] );
-			const float3 vN2 = make_float3( attrib.normals[nidx2 * 3 + 0], attrib.normals[nidx2 * 3 + 1], attrib.normals[nidx2 * 3 + 2] );
-			float3 N = normalize( cross( vert1 - vert0, vert2 - vert0 ) );
-			if (dot( N, vN0 ) < 0 && dot( N, vN1 ) < 0 && dot( N, vN2 ) < 0) N *= -1.0f; // flip if not consistent with vertex normals
-			// loop over vertices
-			// Note: we clamp at approx. 45 degree angles; beyond this the approach fails.
-			alphas[nidx0] = min( alphas[nidx0], max( 0.7f, dot( vN0, N ) ) );
-			alphas[nidx1] = min( alphas[nidx1], max( 0.7f, dot( vN1, N ) ) );
-			alphas[nidx2] = min( alphas[nidx2], max( 0.7f, dot( vN2, N ) ) );
-		}
+	alphas.resize( normalCount, 1.0f ); // we will have one alpha value per unique vertex normal
+	for (int i = 0; i < triCount; i++)
+	{
+		const int3* c = &corners[i * 3];
+		if (c[0].x < 0 || c[1].x < 0 || c[2].x < 0 || c[0].z < 0 || c[1].z < 0 || c[2].z < 0) continue;
+		const float3 vN0 = normals[c[0].z], vN1 = normals[c[1].z], vN2 = normals[c[2].z];
+		float3 N = normalize( cross( positions[c[1].x] - positions[c[0].x], positions[c[2].x] - positions[c[0].x] ) );
+		if (dot( N, vN0 ) < 0 && dot( N, vN1 ) < 0 && dot( N, vN2 ) < 0) N *= -1.0f; // flip if not consistent with vertex normals
+		// loop over vertices
+		// Note: we clamp at approx. 45 degree angles; beyond this the approach fails.
+		alphas[c[0].z] = min( alphas[c[0].z], max( 0.7f, dot( vN0, N ) ) );
+		alphas[c[1].z] = min( alphas[c[1].z], max( 0.7f, dot( vN1, N ) ) );
+		alphas[c[2].z] = min( alphas[c[2].z], max( 0.7f, dot( vN2, N ) ) );
 	}
 	// finalize alpha values based on max dots
 	const float w = 0.03632f;
-	for (uint i = 0; i < verts; i++)
+	for (int i = 0; i < normalCount; i++)
 	{
 		const float nnv = alphas[i]; // temporarily stored there
 		alphas[i] = acosf( nnv ) * (1 + w * (1 - nnv) * (1 - nnv));
 	}
 	printf( "calculated vertex alphas in %5.3fs\n", timer.elapsed() );
-	// extract data for ray tracing: raw vertex and index data
+	// extract data for ray tracing: indexed vertex data, and the polygon soup
 	aabb sceneBounds;
-	int toReserve = 0;
 	timer.reset();
-	for (int s = (int)shapes.size(), i = 0; i < s; i++) toReserve += (int)shapes[i].mesh.indices.size();
-	vertices.reserve( toReserve );
-	for (int s = (int)shapes.size(), i = 0; i < s; i++) for (int f = 0; f < shapes[i].mesh.indices.size(); f += 3)
-	{
-		const uint idx0 = shapes[i].mesh.indices[f + 0].vertex_index;
-		const uint idx1 = shapes[i].mesh.indices[f + 1].vertex_index;
-		const uint idx2 = shapes[i].mesh.indices[f + 2].vertex_index;
-		const float3 v0 = make_float3( attrib.vertices[idx0 * 3 + 0], attrib.vertices[idx0 * 3 + 1], attrib.vertices[idx0 * 3 + 2] );
-		const float3 v1 = make_float3( attrib.vertices[idx1 * 3 + 0], attrib.vertices[idx1 * 3 + 1], attrib.vertices[idx1 * 3 + 2] );
-		const float3 v2 = make_float3( attrib.vertices[idx2 * 3 + 0], attrib.vertices[idx2 * 3 + 1], attrib.vertices[idx2 * 3 + 2] );
-		const float4 tv0 = make_float4( v0, 1 ) * transform;
-		const float4 tv1 = make_float4( v1, 1 ) * transform;
-		const float4 tv2 = make_float4( v2, 1 ) * transform;
-		vertices.push_back( tv0 );
-		vertices.push_back( tv1 );
-		vertices.push_back( tv2 );
-		sceneBounds.Grow( make_float3( tv0 ) );
-		sceneBounds.Grow( make_float3( tv1 ) );
-		sceneBounds.Grow( make_float3( tv2 ) );
+	sharedVertices.resize( positionCount );
+	for (int i = 0; i < positionCount; i++)
+	{
+		sharedVertices[i] = make_float4( positions[i], 1 ) * transform;
+		sceneBounds.Grow( make_float3( sharedVertices[i] ) );
 	}
+	indices.resize( triCount * 3 );
+	vertices.resize( triCount * 3 );
+	JobSystem::ParallelFor( triCount * 3, [&]( const int first, const int last )
+	{
+		for (int i = first; i < last; i++)
+		{
+			const int idx = corners[i].x;
+			indices[i] = (uint)max( 0, idx );
+			vertices[i] = idx < 0 ? make_float4( 0, 0, 0, 1 ) : sharedVertices[idx];
+		}
+	}, OBJTRIBLOCKSIZE * 3 );
 	printf( "created polygon soup in %5.3fs\n", timer.elapsed() );
 	printf( "scene bounds: (%5.2f,%5.2f,%5.2f)-(%5.2f,%5.2f,%5.2f)\n",
 		sceneBounds.bmin3.x, sceneBounds.bmin3.y, sceneBounds.bmin3.z,
 		sceneBounds.bmax3.x, sceneBounds.bmax3.y, sceneBounds.bmax3.z );
-	// extract full model data and materials
+	// extract full model data
 	timer.reset();
-	triangles.resize( vertices.size() / 3 );
-	for (int s = (int)shapes.size(), face = 0, i = 0; i < s; i++)
-	{
-		vector<tinyobj::index_t>& indices = shapes[i].mesh.indices;
-		for (int s = (int)shapes[i].mesh.indices.size(), f = 0; f < s; f += 3, face++)
-		{
-			HostTri& tri = triangles[face];
-			tri.vertex0 = make_float3( vertices[face * 3 + 0] );
-			tri.vertex1 = make_float3( vertices[face * 3 + 1] );
-			tri.vertex2 = make_float3( vertices[face * 3 + 2] );
-			const int tidx0 = indices[f + 0].texcoord_index, nidx0 = indices[f + 0].normal_index, idx0 = indices[f + 0].vertex_index;
-			const int tidx1 = indices[f + 1].texcoord_index, nidx1 = indices[f + 1].normal_index, idx1 = indices[f + 1].vertex_index;
-			const int tidx2 = indices[f + 2].texcoord_index, nidx2 = indices[f + 2].normal_index, idx2 = indices[f + 2].vertex_index;
-			tri.vN0 = make_float3( attrib.normals[nidx0 * 3 + 0], attrib.normals[nidx0 * 3 + 1], attrib.normals[nidx0 * 3 + 2] );
-			tri.vN1 = make_float3( attrib.normals[nidx1 * 3 + 0], attrib.normals[nidx1 * 3 + 1], attrib.normals[nidx1 * 3 + 2] );
-			tri.vN2 = make_float3( attrib.normals[nidx2 * 3 + 0], attrib.normals[nidx2 * 3 + 1], attrib.normals[nidx2 * 3 + 2] );
-			const float3 e1 = tri.vertex1 - tri.vertex0;
-			const float3 e2 = tri.vertex2 - tri.vertex0;
-			float3 N = normalize( cross( e1, e2 ) );
+	JobSystem::ParallelFor( triCount, [&]( const int firstTri, const int lastTri ) { for (int face = firstTri; face < lastTri; face++)
+	{
+		HostTri& tri = triangles[face];
+		const int3* c = &corners[face * 3];
+		tri.vertex0 = make_float3( vertices[face * 3 + 0] );
+		tri.vertex1 = make_float3( vertices[face * 3 + 1] );
+		tri.vertex2 = make_float3( vertices[face * 3 + 2] );
+		const float3 e1 = tri.vertex1 - tri.vertex0;
+		const float3 e2 = tri.vertex2 - tri.vertex0;
+		float3 N = normalize( cross( e1, e2 ) );
+		const bool hasNormals = c[0].z > -1 && c[1].z > -1 && c[2].z > -1;
+		if (hasNormals)
+		{
+			tri.vN0 = normals[c[0].z], tri.vN1 = normals[c[1].z], tri.vN2 = normals[c[2].z];
 			if (dot( N, tri.vN0 ) < 0) N *= -1.0f; // flip face normal if not consistent with vertex normal
-			if (tidx0 > -1)
+		}
+		else tri.vN0 = tri.vN1 = tri.vN2 = N; // faceted; alpha 0 below
+		if (c[0].y > -1 && c[1].y > -1 && c[2].y > -1)
+		{
+			tri.u0 = uvs[c[0].y].x, tri.v0 = uvs[c[0].y].y;
+			tri.u1 = uvs[c[1].y].x, tri.v1 = uvs[c[1].y].y;
+			tri.u2 = uvs[c[2].y].x, tri.v2 = uvs[c[2].y].y;
+			// calculate tangent vectors
+			float2 uv01 = make_float2( tri.u1 - tri.u0, tri.v1 - tri.v0 );
+			float2 uv02 = make_float2( tri.u2 - tri.u0, tri.v2 - tri.v0 );
+			if (dot( uv01, uv01 ) == 0 || dot( uv02, uv02 ) == 0)
 			{
-				tri.u0 = attrib.texcoords[tidx0 * 2 + 0], tri.v0 = attrib.texcoords[tidx0 * 2 + 1];
-				tri.u1 = attrib.texcoords[tidx1 * 2 + 0], tri.v1 = attrib.texcoords[tidx1 * 2 + 1];
-				tri.u2 = attrib.texcoords[tidx2 * 2 + 0], tri.v2 = attrib.texcoords[tidx2 * 2 + 1];
-				// calculate tangent vectors
-				float2 uv01 = make_float2( tri.u1 - tri.u0, tri.v1 - tri.v0 );
-				float2 uv02 = make_float2( tri.u2 - tri.u0, tri.v2 - tri.v0 );
-				if (dot( uv01, uv01 ) == 0 || dot( uv02, uv02 ) == 0)
-				{
-					tri.T = normalize( tri.vertex1 - tri.vertex0 );
-					tri.B = normalize( cross( N, tri.T ) );
-				}
-				else
-				{
-					tri.T = normalize( e1 * uv02.y - e2 * uv01.y );
-					tri.B = normalize( e2 * uv01.x - e1 * uv02.x );
-				}
+				tri.T = normalize( tri.vertex1 - tri.vertex0 );
+				tri.B = normalize( cross( N, tri.T ) );
 			}
 			else
 			{
-				tri.T = normalize( e1 );
-				tri.B = normalize( cross( N, tri.T ) );
+				tri.T = normalize( e1 * uv02.y - e2 * uv01.y );
+				tri.B = normalize( e2 * uv01.x - e1 * uv02.x );
+			}
+		}
+		else
+		{
+			tri.T = normalize( e1 );
+			tri.B = normalize( cross( N, tri.T ) );
+		}
+		tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
+		tri.area = 0; // we don't actually use it, except for lights, where it is also calculated
+		tri.invArea = 0; // todo
+		tri.alpha = hasNormals ? make_float3( alphas[c[0].z], alphas[c[1].z], alphas[c[2].z] ) : make_float3( 0 );
+		// calculate triangle LOD data
+		HostMaterial* mat = HostScene::materials[tri.material];
+		int textureID = mat->map[TEXTURE0].textureID;
+		if (textureID > -1)
+		{
+			HostTexture* texture = HostScene::textures[textureID];
+			float Ta = (float)(texture->width * texture->height) * fabs( (tri.u1 - tri.u0) * (tri.v2 - tri.v0) - (tri.u2 - tri.u0) * (tri.v1 - tri.v0) );
+			float Pa = length( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
+			tri.LOD = 0.5f * log2f( Ta / Pa );
+		}
+	} }, OBJTRIBLOCKSIZE );
+	printf( "verbose triangle data in %5.3fs\n", timer.elapsed() );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  EXT_meshopt_compression decoding helpers                                   |
+//  |  Decoders for the three meshoptimizer bitstreams (vertex attributes,        |
+//  |  triangle lists, index sequences) and the filters that may be applied to    |
+//  |  decoded attributes. All return 0 for malformed data.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+#define MESHOPTGROUP	16		// bytes per group in the vertex codec
+#define MESHOPTBLOCK	256		// upper bound for the number of vertices per block
+#define MESHOPTTAIL		32		// minimum size of the vertex stream tail, which holds the first vertex
+static const uchar* MeshoptDecodeBytes( const uchar* data, const uchar* end, uchar* buffer, const size_t size )
+{
+	// 'size' bytes in groups of 16; two header bits per group select 0, 2, 4 or 8 bits per byte
+	const uchar* header = data;
+	data += (size / MESHOPTGROUP + 3) / 4;
+	if (data > end) return 0;
+	for (size_t i = 0; i < size; i += MESHOPTGROUP)
+	{
+		const size_t group = i / MESHOPTGROUP;
+		const int bits = (header[group / 4] >> ((group % 4) * 2)) & 3;
+		uchar* out = buffer + i;
+		if (bits == 0) { memset( out, 0, MESHOPTGROUP ); continue; }
+		if (bits == 3)
+		{
+			if (data + MESHOPTGROUP > end) return 0;
+			memcpy( out, data, MESHOPTGROUP ), data += MESHOPTGROUP;
+			continue;
+		}
+		// packed values, most significant bits first; the all-ones value escapes to a full byte after the group
+		const int width = bits == 1 ? 2 : 4, escape = (1 << width) - 1;
+		const uchar* packed = data, *extra = data + width * 2;
+		if (extra > end) return 0;
+		for (int k = 0; k < MESHOPTGROUP; k++)
+		{
+			const int v = (packed[(k * width) >> 3] >> (8 - width - ((k * width) & 7))) & escape;
+			if (v != escape) { out[k] = (uchar)v; continue; }
+			if (extra >= end) return 0;
+			out[k] = *extra++;
+		}
+		data = extra;
+	}
+	return data;
+}
+static bool MeshoptDecodeVertices( uchar* out, const size_t count, const size_t stride, const uchar* data, const size_t size )
+{
+	if (stride == 0 || stride > 256 || (stride & 3) || size < 1 + MESHOPTTAIL || size < 1 + stride) return false;
+	if (data[0] != 0xa0) return false; // header and version 0
+	const uchar* end = data + size;
+	uchar last[256], buffer[MESHOPTBLOCK], block[8192];
+	memcpy( last, end - stride, stride );
+	const size_t blockSize = min( (size_t)MESHOPTBLOCK, (8192 / stride) & ~(size_t)(MESHOPTGROUP - 1) );
+	data++;
+	for (size_t first = 0; first < count; first += blockSize)
+	{
+		// per byte of the vertex: zigzag encoded deltas to the previous vertex
+		const size_t n = min( blockSize, count - first ), aligned = (n + MESHOPTGROUP - 1) & ~(size_t)(MESHOPTGROUP - 1);
+		for (size_t k = 0; k < stride; k++)
+		{
+			if (!(data = MeshoptDecodeBytes( data, end, buffer, aligned ))) return false;
+			uchar p = last[k];
+			for (size_t i = 0; i < n; i++) p = block[i * stride + k] = (uchar)(((buffer[i] >> 1) ^ -(buffer[i] & 1)) + p);
+		}
+		memcpy( out + first * stride, block, n * stride );
+		memcpy( last, block + (n - 1) * stride, stride );
+	}
+	return (size_t)(end - data) == max( (size_t)MESHOPTTAIL, stride );
+}
+static uint MeshoptVByte( const uchar*& data )
+{
+	uint lead = *data++;
+	if (lead < 128) return lead;
+	uint result = lead & 127;
+	for (int i = 0, shift = 7; i < 4; i++, shift += 7)
+	{
+		const uint group = *data++;
+		result |= (group & 127) << shift;
+		if (group < 128) break;
+	}
+	return result;
+}
+static uint MeshoptIndex( const uchar*& data, const uint last )
+{
+	const uint v = MeshoptVByte( data );
+	return last + ((v >> 1) ^ (0 - (v & 1)));
+}
+static void MeshoptStore( uchar* out, const size_t stride, const size_t i, const uint v )
+{
+	if (stride == 2) ((ushort*)out)[i] = (ushort)v; else ((uint*)out)[i] = v;
+}
+static bool MeshoptDecodeTriangles( uchar* out, const size_t count, const size_t stride, const uchar* data, const size_t size )
+{
+	// edge and vertex FIFOs of recently used indices; the last 16 bytes of the stream hold the code table
+	if ((count % 3) || (stride != 2 && stride != 4) || size < 1 + count / 3 + 16) return false;
+	const int version = data[0] & 15;
+	if ((data[0] & 0xf0) != 0xe0 || version > 1) return false;
+	uint edges[16][2], vertices[16], next = 0, last = 0;
+	memset( edges, -1, sizeof( edges ) ), memset( vertices, -1, sizeof( vertices ) );
+	size_t edgeHead = 0, vertexHead = 0;
+	const int fecmax = version >= 1 ? 13 : 15;
+	const uchar* code = data + 1, *p = code + count / 3, *safeEnd = data + size - 16, *table = safeEnd;
+	auto pushEdge = [&]( const uint a, const uint b ) { edges[edgeHead][0] = a, edges[edgeHead][1] = b, edgeHead = (edgeHead + 1) & 15; };
+	auto pushVertex = [&]( const uint v, const bool advance ) { vertices[vertexHead] = v, vertexHead = (vertexHead + (advance ? 1 : 0)) & 15; };
+	for (size_t i = 0; i < count; i += 3)
+	{
+		// a triangle reads at most 16 bytes, which the code table guarantees to exist
+		if (p > safeEnd) return false;
+		const uchar codetri = *code++;
+		uint a, b, c;
+		if (codetri < 0xf0)
+		{
+			// the triangle shares an edge from the FIFO; the third vertex is next, from the FIFO, or free
+			const int fe = codetri >> 4, fec = codetri & 15;
+			a = edges[(edgeHead - 1 - fe) & 15][0], b = edges[(edgeHead - 1 - fe) & 15][1];
+			if (fec < fecmax)
+			{
+				c = fec == 0 ? next++ : vertices[(vertexHead - 1 - fec) & 15];
+				pushVertex( c, fec == 0 );
+			}
+			else
+			{
+				last = c = fec != 15 ? last + (fec - (fec ^ 3)) : MeshoptIndex( p, last );
+				pushVertex( c, true );
+			}
+			pushEdge( c, b ), pushEdge( a, c );
+		}
+		else
+		{
+			// no shared edge: the first vertex is next or free, the others next or from the vertex FIFO
+			int fea = 0, feb, fec;
+			if (codetri < 0xfe)
+			{
+				const uchar codeaux = table[codetri & 15];
+				feb = codeaux >> 4, fec = codeaux & 15;
 			}
-			tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
-			tri.material = shapes[i].mesh.material_ids[f / 3] + matIdxOffset;
-		#if 0
-			const float a = (tri.vertex1 - tri.vertex0).length();
-			const float b = (tri.vertex2 - tri.vertex1).length();
-			const float c = (tri.vertex0 - tri.vertex2).length();
-			const float s = (a + b + c) * 0.5f;
-			tri.area = sqrtf( s * (s - a) * (s - b) * (s - c) ); // Heron's formula
-		#else
-			tri.area = 0; // we don't actually use it, except for lights, where it is also calculated
-		#endif
-			tri.invArea = 0; // todo
-			tri.alpha = make_float3( alphas[nidx0], tri.alpha.y = alphas[nidx1], tri.alpha.z = alphas[nidx2] );
-			// calculate triangle LOD data
-			HostMaterial* mat = HostScene::materials[tri.material];
-			int textureID = mat->map[TEXTURE0].textureID;
-			if (textureID > -1)
+			else
 			{
-				HostTexture* texture = HostScene::textures[textureID];
-				float Ta = (float)(texture->width * texture->height) * fabs( (tri.u1 - tri.u0) * (tri.v2 - tri.v0) - (tri.u2 - tri.u0) * (tri.v1 - tri.v0) );
-				float Pa = length( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
-				tri.LOD = 0.5f * log2f( Ta / Pa );
+				const uchar codeaux = *p++;
+				fea = codetri == 0xfe ? 0 : 15, feb = codeaux >> 4, fec = codeaux & 15;
+				if (codeaux == 0) next = 0; // reset
 			}
+			a = fea == 0 ? next++ : 0;
+			b = feb == 0 ? next++ : vertices[(vertexHead - feb) & 15];
+			c = fec == 0 ? next++ : vertices[(vertexHead - fec) & 15];
+			if (fea == 15) last = a = MeshoptIndex( p, last );
+			if (feb == 15) last = b = MeshoptIndex( p, last );
+			if (fec == 15) last = c = MeshoptIndex( p, last );
+			pushVertex( a, true ), pushVertex( b, feb == 0 || feb == 15 ), pushVertex( c, fec == 0 || fec == 15 );
+			pushEdge( b, a ), pushEdge( c, b ), pushEdge( a, c );
 		}
+		MeshoptStore( out, stride, i, a ), MeshoptStore( out, stride, i + 1, b ), MeshoptStore( out, stride, i + 2, c );
 	}
-	printf( "verbose triangle data in %5.3fs\n", timer.elapsed() );
+	return p == safeEnd;
+}
+static bool MeshoptDecodeSequence( uchar* out, const size_t count, const size_t stride, const uchar* data, const size_t size )
+{
+	// zigzag deltas to one of two baselines, selected by the lowest bit; a 4 byte tail keeps reads in bounds
+	if ((stride != 2 && stride != 4) || size < 1 + count + 4 || (data[0] & 0xf0) != 0xd0 || (data[0] & 15) > 1) return false;
+	const uchar* p = data + 1, *safeEnd = data + size - 4;
+	uint last[2] = { 0, 0 };
+	for (size_t i = 0; i < count; i++)
+	{
+		if (p >= safeEnd) return false;
+		uint v = MeshoptVByte( p );
+		const uint baseline = v & 1;
+		v >>= 1;
+		last[baseline] += (v >> 1) ^ (0 - (v & 1));
+		MeshoptStore( out, stride, i, last[baseline] );
+	}
+	return p == safeEnd;
+}
+template <class T> static void MeshoptFilterOctahedral( T* data, const size_t count )
+{
+	const float maxValue = (float)((1 << (sizeof( T ) * 8 - 1)) - 1);
+	for (size_t i = 0; i < count; i++, data += 4)
+	{
+		float x = (float)data[0], y = (float)data[1], z = (float)data[2] - fabsf( x ) - fabsf( y );
+		const float t = z >= 0 ? 0 : z;
+		x += x >= 0 ? t : -t, y += y >= 0 ? t : -t;
+		const float s = maxValue / sqrtf( x * x + y * y + z * z );
+		data[0] = (T)(int)(x * s + (x >= 0 ? 0.5f : -0.5f));
+		data[1] = (T)(int)(y * s + (y >= 0 ? 0.5f : -0.5f));
+		data[2] = (T)(int)(z * s + (z >= 0 ? 0.5f : -0.5f));
+	}
+}
+static void MeshoptFilterQuaternion( short* data, const size_t count )
+{
+	for (size_t i = 0; i < count; i++, data += 4)
+	{
+		// three components scaled by 1/sqrt(2), the fourth reconstructed; its position is in the low bits of w
+		const float scale = 0.70710678f / (float)(data[3] | 3);
+		const float x = data[0] * scale, y = data[1] * scale, z = data[2] * scale, ww = 1 - x * x - y * y - z * z;
+		const float w = sqrtf( ww >= 0 ? ww : 0 );
+		const int qc = data[3] & 3;
+		data[(qc + 1) & 3] = (short)(int)(x * 32767 + (x >= 0 ? 0.5f : -0.5f));
+		data[(qc + 2) & 3] = (short)(int)(y * 32767 + (y >= 0 ? 0.5f : -0.5f));
+		data[(qc + 3) & 3] = (short)(int)(z * 32767 + (z >= 0 ? 0.5f : -0.5f));
+		data[qc] = (short)(int)(w * 32767 + 0.5f);
+	}
+}
+static void MeshoptFilterExponential( uint* data, const size_t count )
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		// 24-bit signed mantissa, 8-bit signed exponent
+		const int m = (int)(data[i] << 8) >> 8, e = (int)data[i] >> 24;
+		union { float f; uint u; } v;
+		v.u = (uint)(e + 127) << 23;
+		v.f *= (float)m;
+		data[i] = v.u;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostMesh::DecodeCompressedViews                                            |
+//  |  Decode the buffer views of a glTF model that use EXT_meshopt_compression   |
+//  |  into their fallback buffers, one job per view, so that the accessors can   |
+//  |  be read as usual afterwards. Draco compressed primitives are decoded by    |
+//  |  tinygltf itself, see DRACOMESHES in common_settings.h.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostMesh::DecodeCompressedViews( tinygltfModel& gltfModel )
+{
+	vector<int> compressed;
+	for (int s = (int)gltfModel.bufferViews.size(), i = 0; i < s; i++)
+		if (gltfModel.bufferViews[i].extensions.count( "EXT_meshopt_compression" )) compressed.push_back( i );
+	if (compressed.size() == 0) return;
+	vector<char> failed( compressed.size(), 0 );
+	RunJobs( (int)compressed.size(), [&]( const int i ) {
+		const BufferView& view = gltfModel.bufferViews[compressed[i]];
+		const Value& ext = view.extensions.at( "EXT_meshopt_compression" );
+		const int source = ext.Get( "buffer" ).IsNumber() ? (int)ext.Get( "buffer" ).GetNumberAsInt() : -1;
+		const size_t offset = ext.Get( "byteOffset" ).IsNumber() ? (size_t)ext.Get( "byteOffset" ).GetNumberAsDouble() : 0;
+		const size_t length = (size_t)ext.Get( "byteLength" ).GetNumberAsDouble();
+		const size_t stride = (size_t)ext.Get( "byteStride" ).GetNumberAsDouble();
+		const size_t count = (size_t)ext.Get( "count" ).GetNumberAsDouble();
+		const string mode = ext.Get( "mode" ).IsString() ? ext.Get( "mode" ).Get<string>() : "";
+		const string filter = ext.Get( "filter" ).IsString() ? ext.Get( "filter" ).Get<string>() : "NONE";
+		if (source < 0 || source >= (int)gltfModel.buffers.size() || view.buffer < 0 || view.buffer >= (int)gltfModel.buffers.size()) { failed[i] = 1; return; }
+		const vector<uchar>& in = gltfModel.buffers[source].data;
+		vector<uchar>& out = gltfModel.buffers[view.buffer].data;
+		if (offset + length > in.size() || view.byteOffset + count * stride > out.size() || count * stride > view.byteLength) { failed[i] = 1; return; }
+		const uchar* src = in.data() + offset;
+		uchar* dst = out.data() + view.byteOffset;
+		bool valid = false;
+		if (mode == "ATTRIBUTES") valid = MeshoptDecodeVertices( dst, count, stride, src, length );
+		else if (mode == "TRIANGLES") valid = MeshoptDecodeTriangles( dst, count, stride, src, length );
+		else if (mode == "INDICES") valid = MeshoptDecodeSequence( dst, count, stride, src, length );
+		if (!valid) { failed[i] = 1; return; }
+		if (filter == "OCTAHEDRAL" && stride == 4) MeshoptFilterOctahedral( (signed char*)dst, count );
+		else if (filter == "OCTAHEDRAL" && stride == 8) MeshoptFilterOctahedral( (short*)dst, count );
+		else if (filter == "QUATERNION" && stride == 8) MeshoptFilterQuaternion( (short*)dst, count );
+		else if (filter == "EXPONENTIAL") MeshoptFilterExponential( (uint*)dst, count * stride / 4 );
+		else if (filter != "NONE") failed[i] = 1;
+	} );
+	for (int s = (int)compressed.size(), i = 0; i < s; i++) if (failed[i])
+		FatalError( __FILE__, __LINE__, "could not decode meshopt compressed buffer view", gltfModel.bufferViews[compressed[i]].name.c_str() );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -306,13 +769,17 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 		const uchar* a /* brevity */ = buffer.data.data() + view.byteOffset + accessor.byteOffset;
 		const int byteStride = accessor.ByteStride( view );
 		const size_t count = accessor.count;
-		// allocate the index array in the pointer-to-base declared in the parent scope
+		// vertex data is read in place from the glTF buffers; only data that needs conversion is copied
 		vector<int> tmpIndices;
-		vector<float3> tmpNormals, tmpVertices;
-		vector<float2> tmpUvs;
+		DataView<int> indexView;
+		DataView<float3> normalView, vertexView;
+		DataView<float2> uvView, lightmapUvView;
 		vector<uint4> tmpJoints;
 		vector<float4> tmpWeights;
-		switch (accessor.componentType)
+		const bool indexList = prim.mode == TINYGLTF_MODE_TRIANGLES;
+		if (indexList && (accessor.componentType == TINYGLTF_COMPONENT_TYPE_INT || accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT))
+			indexView = DataView<int>( a, byteStride, count );
+		else switch (accessor.componentType)
 		{
 		case TINYGLTF_COMPONENT_TYPE_BYTE: for (int k = 0; k < count; k++, a += byteStride) tmpIndices.push_back( *((char*)a) ); break;
 		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: for (int k = 0; k < count; k++, a += byteStride) tmpIndices.push_back( *((uchar*)a) ); break;
@@ -346,10 +813,11 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 			}
 		}
 		else if (prim.mode != TINYGLTF_MODE_TRIANGLES) /* skipping non-triangle primitive. */ continue;
+		if (!indexView.data) indexView = tmpIndices;
 		// we now have a simple list of vertex indices, 3 per triangle (TINYGLTF_MODE_TRIANGLES)
 		for (const auto& attribute : prim.attributes)
 		{
-			const Accessor attribAccessor = gltfModel.accessors[attribute.second];
+			const Accessor& attribAccessor = gltfModel.accessors[attribute.second];
 			const BufferView& bufferView = gltfModel.bufferViews[attribAccessor.bufferView];
 			const Buffer& buffer = gltfModel.buffers[bufferView.buffer];
 			const uchar* a = buffer.data.data() + bufferView.byteOffset + attribAccessor.byteOffset;
@@ -361,7 +829,7 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 				float3 boundsMax = make_float3( attribAccessor.maxValues[0], attribAccessor.maxValues[1], attribAccessor.maxValues[2] );
 				if (attribAccessor.type == TINYGLTF_TYPE_VEC3)
 					if (attribAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-						for (size_t i = 0; i < count; i++, a += byte_stride) tmpVertices.push_back( *((float3*)a) );
+						vertexView = DataView<float3>( a, byte_stride, count );
 					else FatalError( __FILE__, __LINE__, "double precision positions not supported in gltf file" );
 				else FatalError( __FILE__, __LINE__, "unsupported position definition in gltf file" );
 			}
@@ -369,7 +837,7 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 			{
 				if (attribAccessor.type == TINYGLTF_TYPE_VEC3)
 					if (attribAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-						for (size_t i = 0; i < count; i++, a += byte_stride) tmpNormals.push_back( *((float3*)a) );
+						normalView = DataView<float3>( a, byte_stride, count );
 					else FatalError( __FILE__, __LINE__, "double precision normals not supported in gltf file", "" );
 				else FatalError( __FILE__, __LINE__, "expected vec3 normals in gltf file", "" );
 			}
@@ -378,13 +846,18 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 			{
 				if (attribAccessor.type == TINYGLTF_TYPE_VEC2)
 					if (attribAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-						for (size_t i = 0; i < count; i++, a += byte_stride) tmpUvs.push_back( *((float2*)a) );
+						uvView = DataView<float2>( a, byte_stride, count );
 					else FatalError( __FILE__, __LINE__, "double precision uvs not supported in gltf file", "" );
 				else FatalError( __FILE__, __LINE__, "expected vec2 uvs in gltf file", "" );
 			}
 			else if (attribute.first == "TEXCOORD_1")
 			{
-				// TODO; ignored for now.
+				// second uv set: lightmap coordinates
+				if (attribAccessor.type == TINYGLTF_TYPE_VEC2)
+					if (attribAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
+						lightmapUvView = DataView<float2>( a, byte_stride, count );
+					else FatalError( __FILE__, __LINE__, "double precision uvs not supported in gltf file", "" );
+				else FatalError( __FILE__, __LINE__, "expected vec2 uvs in gltf file", "" );
 			}
 			else if (attribute.first == "COLOR_0")
 			{
@@ -424,10 +897,10 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 		{
 			// store base pose
 			tmpPoses.push_back( Pose() );
-			for (int s = (int)tmpVertices.size(), i = 0; i < s; i++)
+			for (int s = (int)vertexView.size(), i = 0; i < s; i++)
 			{
-				tmpPoses[0].positions.push_back( tmpVertices[i] );
-				tmpPoses[0].normals.push_back( tmpNormals[i] );
+				tmpPoses[0].positions.push_back( vertexView[i] );
+				tmpPoses[0].normals.push_back( normalView[i] );
 				tmpPoses[0].tangents.push_back( make_float3( 0 ) /* TODO */ );
 			}
 		}
@@ -436,7 +909,7 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 			tmpPoses.push_back( Pose() );
 			for (const auto& target : prim.targets[i])
 			{
-				const Accessor accessor = gltfModel.accessors[target.second];
+				const Accessor& accessor = gltfModel.accessors[target.second];
 				const BufferView& view = gltfModel.bufferViews[accessor.bufferView];
 				const float* a = (const float*)(gltfModel.buffers[view.buffer].data.data() + view.byteOffset + accessor.byteOffset);
 				for (int j = 0; j < accessor.count; j++)
@@ -449,8 +922,8 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 			}
 		}
 		// all data has been read; add triangles to the HostMesh
-		BuildFromIndexedData( tmpIndices, tmpVertices, tmpNormals, tmpUvs, tmpPoses,
-			tmpJoints, tmpWeights, materialOverride == -1 ? (prim.material + matIdxOffset) : materialOverride );
+		BuildFromIndexedData( indexView, vertexView, normalView, uvView, tmpPoses,
+			tmpJoints, tmpWeights, materialOverride == -1 ? (prim.material + matIdxOffset) : materialOverride, lightmapUvView );
 	}
 }
 
@@ -458,11 +931,13 @@ void HostMesh::ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltf
 //  |  HostMesh::BuildFromIndexedData                                             |
 //  |  We use non-indexed triangles, so three subsequent vertices form a tri,     |
 //  |  to skip one indirection during intersection. glTF and obj store indexed    |
-//  |  data, which we now convert to the final representation.              LH2'19|
+//  |  data, which we now convert to the final representation. The views may      |
+//  |  point straight into the buffers of a glTF model. Lightmap uvs are stored   |
+//  |  once any part of the mesh has them; other triangles then get zeros.  LH2'19|
 //  +-----------------------------------------------------------------------------+
-void HostMesh::BuildFromIndexedData( const vector<int>& tmpIndices, const vector<float3>& tmpVertices,
-	const vector<float3>& tmpNormals, const vector<float2>& tmpUvs, const vector<Pose>& tmpPoses,
-	const vector<uint4>& tmpJoints, const vector<float4>& tmpWeights, const int materialIdx )
+void HostMesh::BuildFromIndexedData( const DataView<int>& tmpIndices, const DataView<float3>& tmpVertices,
+	const DataView<float3>& tmpNormals, const DataView<float2>& tmpUvs, const vector<Pose>& tmpPoses,
+	const DataView<uint4>& tmpJoints, const DataView<float4>& tmpWeights, const int materialIdx )
 {
 	// calculate values for consistent normal interpolation
 	vector<float> tmpAlphas;
@@ -493,12 +968,21 @@ void HostMesh::BuildFromIndexedData( const vector<int>& tmpIndices, const vector
 		const float nnv = tmpAlphas[i]; // temporarily stored there
 		tmpAlphas[i] = acosf( nnv ) * (1 + 0.03632f * (1 - nnv) * (1 - nnv));
 	}
+	// keep the indexed data for cores that intersect shared vertices
+	const uint indexBase = (uint)sharedVertices.size();
+	sharedVertices.reserve( indexBase + tmpVertices.size() );
+	for (size_t s = tmpVertices.size(), i = 0; i < s; i++) sharedVertices.push_back( make_float4( tmpVertices[i], 1 ) );
+	indices.reserve( indices.size() + tmpIndices.size() );
+	for (size_t s = tmpIndices.size(), i = 0; i < s; i++) indices.push_back( indexBase + tmpIndices[i] );
 	// prepare poses
 	if (tmpPoses.size() > 0) for (int s = (int)tmpPoses.size(), i = 0; i < s; i++) poses.push_back( Pose() );
 	// build final mesh structures
 	const size_t newTriangleCount = tmpIndices.size() / 3;
 	size_t triIdx = triangles.size();
+	const bool lightmapped = tmpLightmapUvs.size() > 0 || lightmapUVs.size() > 0;
+	if (lightmapped) lightmapUVs.resize( triIdx * 3, make_float2( 0 ) ); // earlier parts may have had none
 	triangles.resize( triIdx + newTriangleCount );
+	vertices.reserve( vertices.size() + newTriangleCount * 3 );
 	for (size_t i = 0; i < newTriangleCount; i++, triIdx++)
 	{
 		HostTri& tri = triangles[triIdx];
@@ -550,6 +1034,13 @@ void HostMesh::BuildFromIndexedData( const vector<int>& tmpIndices, const vector
 			tri.B = normalize( cross( N, tri.T ) );
 		}
 		tri.material = materialIdx;
+		if (lightmapped)
+		{
+			const float2 none = make_float2( 0 );
+			lightmapUVs.push_back( tmpLightmapUvs.size() > 0 ? tmpLightmapUvs[v0idx] : none );
+			lightmapUVs.push_back( tmpLightmapUvs.size() > 0 ? tmpLightmapUvs[v1idx] : none );
+			lightmapUVs.push_back( tmpLightmapUvs.size() > 0 ? tmpLightmapUvs[v2idx] : none );
+		}
 		// process joints / weights
 		if (tmpJoints.size() > 0)
 		{
@@ -578,42 +1069,166 @@ void HostMesh::BuildFromIndexedData( const vector<int>& tmpIndices, const vector
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostMesh::BuildMaterialList                                                |
-//  |  Update the list of materials used by this mesh. We will use this list to   |
-//  |  efficiently find meshes using a specific material, which in turn is useful |
-//  |  when a material becomes emissive or non-emissive.                    LH2'19|
+//  |  Update the list of materials used by this mesh, and the reverse index in   |
+//  |  HostScene::materialMeshes. We use the latter to efficiently find meshes    |
+//  |  using a specific material, e.g. when its alpha flag changes. Call this     |
+//  |  when the mesh has its ID, and after changing triangle materials.           |
+//  |  Also copies the triangle materials to triangleMaterials: passes over all   |
+//  |  triangles that only need the material read 4 bytes per triangle instead    |
+//  |  of a full HostTri.                                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostMesh::BuildMaterialList()
 {
-	// mark all materials as 'not seen yet'
-	for (auto material : HostScene::materials) material->visited = false;
-	// add each material
+	if (hostDataReleased) return; // the materials of a released mesh do not change
+	triangleMaterials.resize( triangles.size() );
+	for (size_t s = triangles.size(), i = 0; i < s; i++) triangleMaterials[i] = triangles[i].material;
+	alphaBaked = false; // the alpha states depend on the triangle materials
+	vector<vector<int>>& materialMeshes = HostScene::materialMeshes;
+	if (materialMeshes.size() < HostScene::materials.size()) materialMeshes.resize( HostScene::materials.size() );
+	// remove this mesh from the reverse index
+	for (int matID : materialList)
+	{
+		vector<int>& users = materialMeshes[matID];
+		users.erase( remove( users.begin(), users.end(), ID ), users.end() );
+	}
+	// add each material; a material was seen already for this mesh if its last user is this mesh
 	materialList.clear();
-	for (auto tri : triangles)
+	for (const int matID : triangleMaterials)
 	{
-		HostMaterial* material = HostScene::materials[tri.material];
-		if (!material->visited)
-		{
-			material->visited = true;
-			materialList.push_back( material->ID );
-		}
+		vector<int>& users = materialMeshes[matID];
+		if (users.size() > 0 && users.back() == ID) continue;
+		users.push_back( ID );
+		materialList.push_back( matID );
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostMesh::ReleaseHostData                                                  |
+//  |  Free the geometry of a device-only mesh, once the core has a copy. Only    |
+//  |  static meshes without emissive materials qualify, as animation and light   |
+//  |  triangles use the host data, and only meshes that can be read back from    |
+//  |  the scene cache. The triangleMaterials stream is kept, for picking.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostMesh::ReleaseHostData()
+{
+	if (!deviceOnly || hostDataReleased || cacheFile.empty()) return;
+	if (joints.size() > 0 || poses.size() > 1 || materialList.size() == 0) return;
+	for (int matID : materialList) if (HostScene::materials[matID]->IsEmissive()) return;
+	if (bounds.w == 0) UpdateBounds(); // for level-of-detail selection
+	vector<HostTri>().swap( triangles ), vector<float2>().swap( lightmapUVs );
+	vector<float4>().swap( vertices ), vector<float4>().swap( sharedVertices ), vector<float4>().swap( original );
+	vector<float3>().swap( vertexNormals ), vector<float3>().swap( origNormal );
+	vector<uint>().swap( indices ), vector<uint>().swap( alphaFlags );
+	vector<uint4>().swap( joints ), vector<float4>().swap( weights ), vector<Pose>().swap( poses );
+	hostDataReleased = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostMesh::RestoreHostData                                                  |
+//  |  Read the geometry of a released mesh back from the scene cache, e.g. when  |
+//  |  the mesh must be sent to the core again. Returns false if the cache no     |
+//  |  longer holds this mesh; the mesh then stays released.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool HostMesh::RestoreHostData()
+{
+	if (!hostDataReleased) return true;
+	if (!HostScene::ReloadMeshFromCache( this ) || triangles.size() != triangleMaterials.size())
+	{
+		vector<HostTri>().swap( triangles );
+		return false;
+	}
+	// the cache has the triangle materials of the original scene
+	for (size_t s = triangles.size(), i = 0; i < s; i++) triangles[i].material = triangleMaterials[i];
+	hostDataReleased = false;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostMesh::UpdateBounds                                                     |
+//  |  Calculate the bounding sphere of the mesh, for level-of-detail selection.  |
+//  |  The sphere is centred on the bounding box; good enough for this.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostMesh::UpdateBounds()
+{
+	if (hostDataReleased) return; // bounds were calculated before the release
+	if (vertices.size() == 0 && particles && particles->spheres.size() > 0)
+	{
+		// untessellated particles: bounds of the spheres
+		float3 bmin = make_float3( 1e34f ), bmax = make_float3( -1e34f );
+		for (const float4& s : particles->spheres) bmin = fminf( bmin, make_float3( s ) - s.w ), bmax = fmaxf( bmax, make_float3( s ) + s.w );
+		bounds = make_float4( (bmin + bmax) * 0.5f, length( bmax - bmin ) * 0.5f );
+		return;
+	}
+	if (vertices.size() == 0) { bounds = make_float4( 0 ); return; }
+	float3 bmin = make_float3( 1e34f ), bmax = make_float3( -1e34f );
+	for (const float4& v : vertices) bmin = fminf( bmin, make_float3( v ) ), bmax = fmaxf( bmax, make_float3( v ) );
+	const float3 centre = (bmin + bmax) * 0.5f;
+	float radius2 = 0;
+	for (const float4& v : vertices) radius2 = max( radius2, dot( make_float3( v ) - centre, make_float3( v ) - centre ) );
+	bounds = make_float4( centre, sqrtf( radius2 ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BakeAlphaState                                                             |
+//  |  Helper for HostMesh::UpdateAlphaFlags: classify an alpha mapped triangle   |
+//  |  by the texels under its uv footprint, with a border of one texel for       |
+//  |  bilinear filtering. The test matches the alpha test of the cores: a texel  |
+//  |  is transparent below 0.5. Triangles whose texels disagree, or whose map    |
+//  |  is not available yet, remain ALPHA_TESTED.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+static uint BakeAlphaState( const HostTri& tri, const HostMaterial* material )
+{
+	const HostMaterial::MapProps& map = material->map[TEXTURE0];
+	if (map.textureID < 0 || map.textureID >= (int)HostScene::textures.size()) return ALPHA_TESTED;
+	const HostTexture* texture = HostScene::textures[map.textureID];
+	if ((texture->flags & HostTexture::PLACEHOLDER) || (!texture->idata && !texture->fdata)) return ALPHA_TESTED;
+	const int w = (int)texture->width, h = (int)texture->height;
+	const float2 t0 = map.uvscale * (map.uvoffset + make_float2( tri.u0, tri.v0 ));
+	const float2 t1 = map.uvscale * (map.uvoffset + make_float2( tri.u1, tri.v1 ));
+	const float2 t2 = map.uvscale * (map.uvoffset + make_float2( tri.u2, tri.v2 ));
+	const float2 tmin = fminf( t0, fminf( t1, t2 ) ), tmax = fmaxf( t0, fmaxf( t1, t2 ) );
+	const int x0 = (int)floorf( tmin.x * w ) - 1, x1 = (int)ceilf( tmax.x * w ) + 1;
+	const int y0 = (int)floorf( tmin.y * h ) - 1, y1 = (int)ceilf( tmax.y * h ) + 1;
+	if ((size_t)(x1 - x0 + 1) * (y1 - y0 + 1) > ALPHABAKETEXELS) return ALPHA_TESTED;
+	bool opaque = false, transparent = false;
+	for (int y = y0; y <= y1; y++) for (int x = x0; x <= x1; x++)
+	{
+		const int idx = ((x % w) + w) % w + (((y % h) + h) % h) * w;
+		const bool texelOpaque = texture->idata ? texture->idata[idx].w >= 128 : texture->fdata[idx].w >= 0.5f;
+		if (texelOpaque) opaque = true; else transparent = true;
+		if (opaque && transparent) return ALPHA_TESTED;
+	}
+	return opaque ? ALPHA_OPAQUE : ALPHA_TRANSPARENT;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostMesh::UpdateAlphaFlags                                                 |
-//  |  Create or update the list of alpha flags; one is set to true or fale for   |
-//  |  each triangle in the mesh. This will later be used to mark triangles in    |
-//  |  the core in a core-specific way, and ultimately, to detect triangles that  |
-//  |  may have alpha transparency as efficiently as possible during              |
-//  |  traversal.                                                           LH2'19|
+//  |  Create or update the list of alpha flags: the alpha state of each          |
+//  |  triangle in the mesh. Alpha mapped triangles are baked against their map   |
+//  |  once, so that cores test only the triangles that are partially             |
+//  |  transparent during traversal, skip the fully transparent ones, and treat   |
+//  |  the others as opaque. The bake depends on uvs, materials and maps only,    |
+//  |  so a new pose keeps it. The material list is checked first: a mesh         |
+//  |  without alpha materials gets an empty list, which cores treat as 'all      |
+//  |  opaque'.                                                             LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostMesh::UpdateAlphaFlags()
 {
-	const uint triCount = (uint)triangles.size();
-	if (alphaFlags.size() != triCount) alphaFlags.resize( triCount, 0 );
-	for (uint i = 0; i < triCount; i++)
-		if (HostScene::materials[triangles[i].material]->flags & HostMaterial::HASALPHA)
-			alphaFlags[i] = 1;
+	const int triCount = (int)triangles.size();
+	if (triangleMaterials.size() != triangles.size()) BuildMaterialList();
+	bool hasAlpha = materialList.size() == 0; // unknown; scan the triangles
+	for (int matID : materialList) if (HostScene::materials[matID]->flags & HostMaterial::HASALPHA) hasAlpha = true;
+	if (!hasAlpha) { alphaFlags.clear(), alphaBaked = false; return; }
+	if (alphaBaked && alphaFlags.size() == triangles.size()) return;
+	alphaFlags.resize( triCount );
+	JobSystem::ParallelFor( triCount, [this]( const int first, const int last ) {
+		for (int i = first; i < last; i++)
+		{
+			const HostMaterial* material = HostScene::materials[triangleMaterials[i]];
+			alphaFlags[i] = (material->flags & HostMaterial::HASALPHA) ? BakeAlphaState( triangles[i], material ) : ALPHA_OPAQUE;
+		}
+	}, ALPHABLOCKSIZE );
+	alphaBaked = true;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -624,6 +1239,13 @@ void HostMesh::UpdateAlphaFlags()
 void HostMesh::SetPose( const vector<float>& weights )
 {
 	assert( weights.size() == poses.size() - 1 /* first pose is base pose */ );
+	if (deviceAnimation)
+	{
+		// the core applies the weights; see RenderSystem::SynchronizeMeshes
+		poseWeights = weights;
+		poseChanged = true;
+		return;
+	}
 	const int weightCount = (int)weights.size();
 	// adjust intersection geometry data
 	for (int s = (int)vertices.size(), i = 0; i < s; i++)
@@ -659,6 +1281,13 @@ void HostMesh::SetPose( const vector<float>& weights )
 //  +-----------------------------------------------------------------------------+
 void HostMesh::SetPose( const HostSkin* skin, const mat4& meshTransform )
 {
+	if (deviceAnimation)
+	{
+		// the core applies the skin; see RenderSystem::SynchronizeMeshes
+		poseSkin = skin;
+		poseChanged = true;
+		return;
+	}
 	// ensure that we have a backup of the original vertex positions
 	if (original.size() == 0)
 	{
@@ -672,34 +1301,181 @@ void HostMesh::SetPose( const HostSkin* skin, const mat4& meshTransform )
 		}
 		vertexNormals.resize( vertices.size() );
 	}
-	// transform original into vertex vector using skin matrices
-	for (int s = (int)vertices.size(), i = 0; i < s; i++)
+	// skin vertices and rebuild triangles in a single pass; large meshes are split over threads
+	const int triCount = (int)triangles.size();
+	if (triCount <= SKINBLOCKSIZE) SetPoseRange( skin, 0, triCount ); else
+		JobSystem::ParallelFor( triCount, [=]( const int first, const int last ) { SetPoseRange( skin, first, last ); }, SKINBLOCKSIZE );
+	// mark as dirty; changing vector contents doesn't trigger this
+	MarkAsDirty();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostMesh::SetPoseRange                                                     |
+//  |  Skin the vertices of triangles [first,last) and rebuild those triangles.   |
+//  |  The four joint matrices are blended and transposed in SSE registers, so    |
+//  |  a position or normal is transformed using four multiply-adds.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostMesh::SetPoseRange( const HostSkin* skin, const int first, const int last )
+{
+	const mat4* jointMat = skin->jointMat.data();
+	for (int i = first; i < last; i++)
 	{
-		uint4 j4 = joints[i];
-		float4 w4 = weights[i];
-		mat4 skinMatrix = w4.x * skin->jointMat[j4.x];
-		skinMatrix += w4.y * skin->jointMat[j4.y];
-		skinMatrix += w4.z * skin->jointMat[j4.z];
-		skinMatrix += w4.w * skin->jointMat[j4.w];
-		vertices[i] = skinMatrix * original[i];
-		vertexNormals[i] = normalize( make_float3( make_float4( origNormal[i], 0 ) * skinMatrix ) );
+		for (int v = i * 3; v < i * 3 + 3; v++)
+		{
+			// blend the rows of the joint matrices
+			const uint4 j4 = joints[v];
+			const float4 w4 = weights[v];
+			const __m128 wx = _mm_set_ps1( w4.x ), wy = _mm_set_ps1( w4.y ), wz = _mm_set_ps1( w4.z ), ww = _mm_set_ps1( w4.w );
+			const float* m0 = jointMat[j4.x].cell, *m1 = jointMat[j4.y].cell, *m2 = jointMat[j4.z].cell, *m3 = jointMat[j4.w].cell;
+			__m128 row[4];
+			for (int r = 0; r < 4; r++)
+				row[r] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( wx, _mm_loadu_ps( m0 + r * 4 ) ), _mm_mul_ps( wy, _mm_loadu_ps( m1 + r * 4 ) ) ),
+					_mm_add_ps( _mm_mul_ps( wz, _mm_loadu_ps( m2 + r * 4 ) ), _mm_mul_ps( ww, _mm_loadu_ps( m3 + r * 4 ) ) ) );
+			// transpose to columns, so that matrix * vector is a sum of scaled columns
+			_MM_TRANSPOSE4_PS( row[0], row[1], row[2], row[3] );
+			const float4& P = original[v];
+			const float3& N = origNormal[v];
+			union { __m128 p4; float4 p; };
+			union { __m128 n4; float4 n; };
+			p4 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( row[0], _mm_set_ps1( P.x ) ), _mm_mul_ps( row[1], _mm_set_ps1( P.y ) ) ),
+				_mm_add_ps( _mm_mul_ps( row[2], _mm_set_ps1( P.z ) ), _mm_mul_ps( row[3], _mm_set_ps1( P.w ) ) ) );
+			n4 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( row[0], _mm_set_ps1( N.x ) ), _mm_mul_ps( row[1], _mm_set_ps1( N.y ) ) ),
+				_mm_mul_ps( row[2], _mm_set_ps1( N.z ) ) );
+			vertices[v] = p;
+			vertexNormals[v] = normalize( make_float3( n ) );
+		}
+		// adjust full triangle
+		HostTri& tri = triangles[i];
+		tri.vertex0 = make_float3( vertices[i * 3 + 0] );
+		tri.vertex1 = make_float3( vertices[i * 3 + 1] );
+		tri.vertex2 = make_float3( vertices[i * 3 + 2] );
+		const float3 N = normalize( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
+		tri.vN0 = vertexNormals[i * 3 + 0];
+		tri.vN1 = vertexNormals[i * 3 + 1];
+		tri.vN2 = vertexNormals[i * 3 + 2];
+		tri.Nx = N.x;
+		tri.Ny = N.y;
+		tri.Nz = N.z;
 	}
-	// adjust full triangles
-	for (int s = (int)triangles.size(), i = 0; i < s; i++)
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostCurves::AddStrand                                                      |
+//  |  Append a strand of count control points, i.e. count - 1 segments.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostCurves::AddStrand( const float3* positions, const float* radii, const int count )
+{
+	if (count < 2) return;
+	const uint first = (uint)points.size();
+	for (int i = 0; i < count; i++) points.push_back( make_float4( positions[i], radii[i] ) );
+	for (int i = 0; i < count - 1; i++) segments.push_back( first + i );
+	strands++;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostCurves::Tessellate                                                     |
+//  |  Replace the geometry of mesh by tubes around the strands: a ring of sides  |
+//  |  vertices around each control point, and two triangles per segment and      |
+//  |  side. The rings of a strand share a frame that is transported along it,    |
+//  |  so tubes do not twist. u runs around the tube, v along the strand.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostCurves::Tessellate( HostMesh* mesh, const int sides ) const
+{
+	mesh->vertices.clear();
+	mesh->triangles.clear();
+	vector<float3> ringA( sides ), ringB( sides ), normalA( sides ), normalB( sides );
+	float3 frame = make_float3( 0 );
+	auto Direction = []( const float3& d ) { const float l = length( d ); return l > 0 ? d / l : make_float3( 0, 0, 1 ); };
+	auto Ring = [&]( const float4& p, const float3& t, vector<float3>& ring, vector<float3>& normal )
 	{
-		triangles[i].vertex0 = make_float3( vertices[i * 3 + 0] );
-		triangles[i].vertex1 = make_float3( vertices[i * 3 + 1] );
-		triangles[i].vertex2 = make_float3( vertices[i * 3 + 2] );
-		float3 N = normalize( cross( triangles[i].vertex1 - triangles[i].vertex0, triangles[i].vertex2- triangles[i].vertex0 ) );
-		triangles[i].vN0 = vertexNormals[i * 3 + 0];
-		triangles[i].vN1 = vertexNormals[i * 3 + 1];
-		triangles[i].vN2 = vertexNormals[i * 3 + 2];
-		triangles[i].Nx = N.x;
-		triangles[i].Ny = N.y;
-		triangles[i].Nz = N.z;
+		// transport the frame: remove its component along the new tangent
+		float3 f = frame - dot( frame, t ) * t;
+		if (dot( f, f ) < 1e-12f) f = cross( t, fabs( t.x ) > 0.9f ? make_float3( 0, 1, 0 ) : make_float3( 1, 0, 0 ) );
+		frame = normalize( f );
+		const float3 g = cross( t, frame );
+		for (int j = 0; j < sides; j++)
+		{
+			const float phi = j * 2 * PI / sides;
+			normal[j] = cosf( phi ) * frame + sinf( phi ) * g;
+			ring[j] = make_float3( p ) + normal[j] * p.w;
+		}
+	};
+	mesh->vertices.reserve( segments.size() * sides * 6 );
+	mesh->triangles.reserve( segments.size() * sides * 2 );
+	float along = 0;
+	for (size_t s = segments.size(), k = 0; k < s; k++)
+	{
+		const uint i = segments[k];
+		const bool first = k == 0 || segments[k - 1] != i - 1;
+		const bool last = k + 1 == s || segments[k + 1] != i + 1;
+		const float4& a = points[i], & b = points[i + 1];
+		if (first) frame = make_float3( 0 ), along = 0, Ring( a, Direction( make_float3( b - a ) ), ringA, normalA );
+		else swap( ringA, ringB ), swap( normalA, normalB );
+		// the ring at the end of the segment is shared with the next one, so it uses the averaged tangent
+		Ring( b, Direction( make_float3( (last ? b : points[i + 2]) - a ) ), ringB, normalB );
+		const float3 T = Direction( make_float3( b - a ) );
+		for (int j = 0; j < sides; j++)
+		{
+			const int j2 = (j + 1) % sides;
+			const float u0 = (float)j / sides, u1 = (float)(j + 1) / sides;
+			const float3 P[4] = { ringA[j], ringA[j2], ringB[j2], ringB[j] };
+			const float3 N[4] = { normalA[j], normalA[j2], normalB[j2], normalB[j] };
+			const float2 uv[4] = { make_float2( u0, along ), make_float2( u1, along ), make_float2( u1, along + 1 ), make_float2( u0, along + 1 ) };
+			static const int corners[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+			for (int h = 0; h < 2; h++)
+			{
+				const int c0 = corners[h][0], c1 = corners[h][1], c2 = corners[h][2];
+				HostTri tri;
+				tri.material = material;
+				tri.vertex0 = P[c0], tri.vertex1 = P[c1], tri.vertex2 = P[c2];
+				tri.vN0 = N[c0], tri.vN1 = N[c1], tri.vN2 = N[c2];
+				const float3 F = Direction( cross( P[c1] - P[c0], P[c2] - P[c0] ) );
+				tri.Nx = F.x, tri.Ny = F.y, tri.Nz = F.z;
+				tri.u0 = uv[c0].x, tri.u1 = uv[c1].x, tri.u2 = uv[c2].x;
+				tri.v0 = uv[c0].y, tri.v1 = uv[c1].y, tri.v2 = uv[c2].y;
+				tri.T = T, tri.B = cross( F, T );
+				tri.UpdateArea();
+				tri.invArea = tri.area > 0 ? 1 / tri.area : 0;
+				mesh->triangles.push_back( tri );
+				for (int c = 0; c < 3; c++) mesh->vertices.push_back( make_float4( P[corners[h][c]], 1 ) );
+			}
+		}
+		along++;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostParticles::Tessellate                                                  |
+//  |  Replace the geometry of mesh by an octahedron per sphere, with the normals |
+//  |  of the sphere at its vertices. Eight triangles per particle: the fallback  |
+//  |  for cores that do not intersect spheres themselves.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostParticles::Tessellate( HostMesh* mesh ) const
+{
+	static const float3 axis[6] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, -1 } };
+	static const int faces[8][3] = { { 0, 1, 2 }, { 1, 3, 2 }, { 3, 4, 2 }, { 4, 0, 2 }, { 1, 0, 5 }, { 3, 1, 5 }, { 4, 3, 5 }, { 0, 4, 5 } };
+	mesh->vertices.resize( spheres.size() * 24 );
+	mesh->triangles.resize( spheres.size() * 8 );
+	for (size_t s = spheres.size(), i = 0; i < s; i++)
+	{
+		const float3 C = make_float3( spheres[i] );
+		const float r = spheres[i].w;
+		for (int f = 0; f < 8; f++)
+		{
+			const float3 N0 = axis[faces[f][0]], N1 = axis[faces[f][1]], N2 = axis[faces[f][2]];
+			HostTri& tri = mesh->triangles[i * 8 + f];
+			tri.material = material;
+			tri.vertex0 = C + r * N0, tri.vertex1 = C + r * N1, tri.vertex2 = C + r * N2;
+			tri.vN0 = N0, tri.vN1 = N1, tri.vN2 = N2;
+			const float3 F = normalize( N0 + N1 + N2 );
+			tri.Nx = F.x, tri.Ny = F.y, tri.Nz = F.z;
+			tri.T = normalize( N1 - N0 ), tri.B = cross( F, tri.T );
+			tri.UpdateArea();
+			tri.invArea = tri.area > 0 ? 1 / tri.area : 0;
+			float4* v = &mesh->vertices[(i * 8 + f) * 3];
+			v[0] = make_float4( tri.vertex0, 1 ), v[1] = make_float4( tri.vertex1, 1 ), v[2] = make_float4( tri.vertex2, 1 );
+		}
 	}
-	// mark as dirty; changing vector contents doesn't trigger this
-	MarkAsDirty();
 }
 
 // EOF
\ No newline at end of file
@@ -25,6 +25,7 @@ namespace lighthouse2
 class HostSkin
 {
 public:
+	HostSkin() = default;
 	HostSkin( const tinygltfSkin& gltfSkin, const tinygltfModel& gltfModel, const int nodeBase );
 	void ConvertFromGLTFSkin( const tinygltfSkin& gltfSkin, const tinygltfModel& gltfModel, const int nodeBase );
 	string name;
@@ -34,6 +35,39 @@ public:
 	vector<int> joints; // node indices of the joints
 };
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostCurves                                                                 |
+//  |  Hair and fur: strands of linear segments with a radius per control point,  |
+//  |  in the layout of OptiX' round linear curves. Cores that take curves get    |
+//  |  these through CoreAPI_Base::SetCurves; for the others, Tessellate turns    |
+//  |  the strands into tubes of triangles.                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+class HostMesh;
+class HostCurves
+{
+public:
+	void AddStrand( const float3* positions, const float* radii, const int count );
+	void Tessellate( HostMesh* mesh, const int sides ) const;
+	vector<float4> points;						// control points: position and radius
+	vector<uint> segments;						// per segment: index of its first point; the second one follows it
+	int material = 0;							// material of all strands
+	int strands = 0;							// number of strands added
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostParticles                                                              |
+//  |  Point clouds: spheres, stored as centre and radius. Cores that take them   |
+//  |  get these through CoreAPI_Base::SetParticles; for the others, Tessellate   |
+//  |  turns each sphere into an octahedron, when the mesh is first sent.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+class HostParticles
+{
+public:
+	void Tessellate( HostMesh* mesh ) const;
+	vector<float4> spheres;						// centre and radius per particle
+	int material = 0;							// material of all particles
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostMesh                                                                   |
 //  |  Host-side mesh data storage.                                         LH2'19|
@@ -47,6 +81,26 @@ public:
 		vector<float3> normals;
 		vector<float3> tangents;
 	};
+	// strided read-only view of vertex data, e.g. a glTF accessor in its buffer, or a vector
+	template <class T> struct DataView
+	{
+		DataView() = default;
+		DataView( const uchar* d, const int s, const size_t n ) : data( d ), stride( s ), count( n ) {}
+		DataView( const vector<T>& v ) : data( (const uchar*)v.data() ), stride( sizeof( T ) ), count( v.size() ) {}
+		const T& operator[]( const size_t i ) const { return *(const T*)(data + i * stride); }
+		size_t size() const { return count; }
+		const uchar* data = 0;
+		int stride = sizeof( T );
+		size_t count = 0;
+	};
+	// static batching: a node that was merged into this mesh, see HostScene::BatchStaticNodes
+	struct BatchSource
+	{
+		string name;							// name of the merged node
+		int meshID;								// its mesh
+		mat4 transform;							// its local transform, which is baked into the vertices of the batch
+		int firstTriangle;						// its first triangle in the batch
+	};
 	// constructor / destructor
 	HostMesh() = default;
 	HostMesh( const char* name, const char* dir, const float scale = 1.0f );
@@ -56,13 +110,20 @@ public:
 	void LoadGeometry( const char* file, const char* dir, const float scale = 1.0f );
 	void LoadGeometryFromOBJ( const string& fileName, const char* directory, const mat4& transform );
 	void ConvertFromGTLFMesh( const tinygltfMesh& gltfMesh, const tinygltfModel& gltfModel, const int matIdxOffset, const int materialOverride );
-	void BuildFromIndexedData( const vector<int>& tmpIndices, const vector<float3>& tmpVertices,
-		const vector<float3>& tmpNormals, const vector<float2>& tmpUvs, const vector<Pose>& tmpPoses,
-		const vector<uint4>& tmpJoints, const vector<float4>& tmpWeights,  const int materialIdx );
+	static void DecodeCompressedViews( tinygltfModel& gltfModel );
+	void BuildFromIndexedData( const DataView<int>& tmpIndices, const DataView<float3>& tmpVertices,
+		const DataView<float3>& tmpNormals, const DataView<float2>& tmpUvs, const vector<Pose>& tmpPoses,
+		const DataView<uint4>& tmpJoints, const DataView<float4>& tmpWeights, const int materialIdx,
+		const DataView<float2>& tmpLightmapUvs = DataView<float2>() );
 	void BuildMaterialList();
+	void ReleaseHostData();
+	bool RestoreHostData();
+	void UpdateBounds();
 	void UpdateAlphaFlags();
+	bool HasIndexedData() const { return indices.size() == triangles.size() * 3 && joints.size() == 0 && poses.size() < 2; }
 	void SetPose( const vector<float>& weights );
 	void SetPose( const HostSkin* skin, const mat4& meshTransform );
+	void SetPoseRange( const HostSkin* skin, const int first, const int last );
 	// data members
 	string name = "unnamed";					// name for the mesh						
 	int ID = -1;								// unique ID for the mesh: position in mesh array
@@ -70,13 +131,35 @@ public:
 	vector<float3> vertexNormals;				// vertex normals
 	vector<float4> original;					// skinning: base pose; will be transformed into vector vertices
 	vector<float3> origNormal;					// skinning: base pose normals
-	vector<HostTri> triangles;					// full triangles
+	vector<HostTri> triangles;					// full triangles, in the layout of CoreTri, so they are sent as they are
+	vector<float2> lightmapUVs;					// second uv set (glTF TEXCOORD_1), three per triangle; empty if the mesh has none
+	vector<float4> sharedVertices;				// unique vertices, for indexed intersection geometry
+	vector<uint> indices;						// three indices into sharedVertices per triangle
 	vector<int> materialList;					// list of materials used by the mesh; used to efficiently track light changes
-	vector<uint> alphaFlags;					// list containing 1 for each triangle that is flagged as HASALPHA, 0 otherwise 
+	vector<uint> alphaFlags;					// per triangle: ALPHA_OPAQUE, ALPHA_TESTED or ALPHA_TRANSPARENT; see UpdateAlphaFlags
+	bool alphaBaked = false;					// alphaFlags hold the states baked from the alpha maps; reset when these change
 	vector<uint4> joints;						// skinning: joints
 	vector<float4> weights;						// skinning: joint weights
 	vector<Pose> poses;							// morph target data
 	bool isAnimated;							// true when this mesh has animation data
+	GeometryHint geometryHint = DefaultGeometry;	// expected behavior of the mesh; passed to the core
+	bool animationOffered = false;				// animation data has been offered to the core
+	bool deviceAnimation = false;				// the core animates this mesh; vertices and triangles keep the bind pose
+	bool poseChanged = false;					// device animation: pose must be sent to the core
+	const HostSkin* poseSkin = 0;				// device animation: skin for the pending pose
+	vector<float> poseWeights;					// device animation: morph weights for the pending pose
+	float4 bounds = make_float4( 0 );			// object space bounding sphere: centre and radius; see UpdateBounds
+	vector<int> lodMeshes;						// coarser versions of this mesh, finest first; see HostScene::SetMeshLOD
+	vector<float> lodSizes;						// per LOD mesh: projected size below which it replaces the previous level
+	bool deviceOnly = false;					// residency: free the geometry once the core has it; see ReleaseHostData
+	bool hostDataReleased = false;				// the geometry arrays are empty; RestoreHostData reads them back
+	vector<int> triangleMaterials;				// material per triangle, a compact stream for the host passes; see BuildMaterialList
+	string cacheFile;							// scene cache that holds this mesh, or empty
+	size_t cacheOffset = 0;						// start of the mesh data in cacheFile
+	uint64 contentHash = 0;						// hash of the geometry, 0 until needed; see HostScene::DeduplicateImports
+	HostCurves* curves = 0;						// hair and fur: the curves this mesh tessellates, see HostScene::AddCurves
+	HostParticles* particles = 0;				// point clouds: the spheres of this mesh, see HostScene::AddParticles
+	vector<BatchSource> batchSources;			// static batching: merged nodes, by first triangle; see HostScene::GetBatchSource
 	TRACKCHANGES;								// add Changed(), MarkAsDirty() methods, see system.h
 	// Note: design decision:
 	// Vertices and indices can be deduced from the list of HostTris, obviously. However, efficient intersection
@@ -25,6 +25,9 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STBI_MSC_SECURE_CRT
 #define TINYGLTF_NOEXCEPTION // optional. disable exception handling.
+#ifdef DRACOMESHES
+#define TINYGLTF_ENABLE_DRACO // see common_settings.h
+#endif
 #include "tiny_gltf.h"
 
 // EOF
@@ -33,9 +33,9 @@ static HostTri TransformedHostTri( HostTri* tri, mat4 T )
 //  |  HostNode::HostNode                                                         |
 //  |  Constructors.                                                        LH2'19|
 //  +-----------------------------------------------------------------------------+
-HostNode::HostNode( const tinygltfNode& gltfNode, const int nodeBase, const int meshBase, const int skinBase )
+HostNode::HostNode( const tinygltfNode& gltfNode, const int nodeBase, const int* meshIDs, const int skinBase )
 {
-	ConvertFromGLTFNode( gltfNode, nodeBase, meshBase, skinBase );
+	ConvertFromGLTFNode( gltfNode, nodeBase, meshIDs, skinBase );
 }
 
 HostNode::HostNode( const int meshIdx, const mat4& transform )
@@ -57,18 +57,9 @@ HostNode::~HostNode()
 	{
 		// this node is an instance and has emissive materials;
 		// remove the relevant area lights.
-		HostMesh* mesh = HostScene::meshes[meshID];
-		for (auto materialIdx : mesh->materialList)
-		{
-			HostMaterial* material = HostScene::materials[materialIdx];
-			if (material->color.x > 1 || material->color.y > 1 || material->color.z > 1)
-			{
-				// mesh contains an emissive material; remove related area lights
-				vector<HostAreaLight*>& lightList = HostScene::areaLights;
-				for (int s = (int)lightList.size(), i = 0; i < s; i++)
-					if (lightList[i]->instIdx == ID) lightList.erase( lightList.begin() + i-- );
-			}
-		}
+		vector<HostAreaLight*>& lightList = HostScene::areaLights;
+		lightList.erase( remove_if( lightList.begin(), lightList.end(), [this]( HostAreaLight* light ) { return light->instIdx == ID; } ), lightList.end() );
+		for (HostAreaLight* light : areaLights) HostScene::lightPool.Delete( light );
 	}
 }
 
@@ -76,12 +67,12 @@ HostNode::~HostNode()
 //  |  HostNode::ConvertFromGLTFNode                                              |
 //  |  Create a node from a GLTF node.                                      LH2'19|
 //  +-----------------------------------------------------------------------------+
-void HostNode::ConvertFromGLTFNode( const tinygltfNode& gltfNode, const int nodeBase, const int meshBase, const int skinBase )
+void HostNode::ConvertFromGLTFNode( const tinygltfNode& gltfNode, const int nodeBase, const int* meshIDs, const int skinBase )
 {
 	// copy node name
 	name = gltfNode.name;
 	// set mesh / skin ID
-	meshID = gltfNode.mesh == -1 ? -1 : (gltfNode.mesh + meshBase);
+	meshID = gltfNode.mesh == -1 ? -1 : meshIDs[gltfNode.mesh]; // see HostScene::DeduplicateImports
 	skinID = gltfNode.skin == -1 ? -1 : (gltfNode.skin + skinBase);
 	// if the mesh has morph targets, the node should have weights for them
 	if (meshID != -1)
@@ -136,86 +127,104 @@ void HostNode::UpdateTransformFromTRS()
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  HostNode::Update                                                           |
-//  |  Calculates the combined transform for this node and recurses into the      |
-//  |  child nodes. If a change is detected, the light triangles are updated      |
-//  |  as well.                                                             LH2'19|
+//  |  HostNode::UpdateTransform                                                  |
+//  |  Calculates the combined transform for this node. This is skipped if        |
+//  |  neither the node nor one of its ancestors changed. Children must be        |
+//  |  updated after their parent; see RenderSystem::UpdateSceneGraph.      LH2'19|
 //  +-----------------------------------------------------------------------------+
-bool HostNode::Update( mat4& T, int& posInInstanceArray )
+void HostNode::UpdateTransform( const mat4& T, const bool parentMoved )
 {
-	// update the combined transform for this node
-	bool thisWasModified = Changed();
-	bool instancesChanged = thisWasModified;
-	treeChanged = thisWasModified;
+	const bool thisWasModified = Changed();
+	// motion blur: a node that moved is resent once it stops, so the core no longer blurs it
+	if (moved && instanceID > -1) instanceDirty = true;
+	moved = false;
+	shutterTransform = combinedTransform;
+	if (!thisWasModified && !parentMoved) return;
 	if (transformed)
 	{
 		UpdateTransformFromTRS();
 		transformed = false;
 	}
-	combinedTransform = T * localTransform;
-	// update the combined transforms of the children
-	for (int s = (int)childIdx.size(), i = 0; i < s; i++)
+	const mat4 newTransform = T * localTransform;
+	if (instanceID == -1) shutterTransform = newTransform; // not synced yet: no motion
+	if (!(combinedTransform == newTransform)) combinedTransform = newTransform, instanceDirty = moved = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostNode::UpdateMesh                                                       |
+//  |  Applies morph targets and skins, fixes the light triangles and claims a    |
+//  |  slot in the instance array if the node has none. Called for mesh nodes,    |
+//  |  once the combined transforms of all nodes are up to date. Pose changes     |
+//  |  wait until poseInterval frames passed since the last pose update.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool HostNode::UpdateMesh()
+{
+	// a node that was never synced placed its lights and skin using the local transform only
+	const bool firstUpdate = instanceID == -1;
+	const bool poseDue = firstUpdate || ++poseAge >= poseInterval;
+	bool posed = false;
+	bool instancesChanged = moved || instanceDirty;
+	if (morphed && poseDue)
 	{
-		HostNode* child = HostScene::nodes[childIdx[i]];
-		bool childChanged = child->Update( combinedTransform, posInInstanceArray );
-		instancesChanged |= childChanged;
-		treeChanged |= childChanged;
+		HostScene::meshes[meshID]->SetPose( weights );
+		morphed = false, posed = true;
 	}
-	// update animations
-	if (meshID > -1)
+	if ((moved || firstUpdate) && hasLTris) UpdateLights();
+	if (instanceID == -1)
 	{
-		if (morphed)
-		{
-			HostScene::meshes[meshID]->SetPose( weights );
-			morphed = false;
-		}
-		if (thisWasModified && hasLTris) UpdateLights();
-		if (instanceID != posInInstanceArray)
-		{
-			instancesChanged = true;
-			if (posInInstanceArray < HostScene::instances.size())
-				HostScene::instances[posInInstanceArray] = ID;
-			else
-				HostScene::instances.push_back( ID );
-		}
-		if (skinID > -1)
+		instanceID = HostScene::ClaimInstanceSlot( ID );
+		instancesChanged = instanceDirty = true;
+	}
+	if (skinID > -1)
+	{
+		// only recalculate the joint matrices if the mesh or one of the joints moved
+		HostSkin* skin = HostScene::skins[skinID];
+		bool skinChanged = skinPending || moved || firstUpdate || posed;
+		for (int s = (int)skin->joints.size(), j = 0; j < s && !skinChanged; j++) skinChanged = HostScene::nodes[skin->joints[j]]->moved;
+		if (skinChanged && !poseDue) skinPending = true; else if (skinChanged)
 		{
-			HostSkin* skin = HostScene::skins[skinID];
 			mat4 meshTransform = combinedTransform;
-			mat4 meshTransformInverted = meshTransform.Inverted();
+			mat4 meshTransformInverted = meshTransform.InvertedAffine();
 			for (int s = (int)skin->joints.size(), j = 0; j < s; j++)
 			{
 				HostNode* jointNode = HostScene::nodes[skin->joints[j]];
 				skin->jointMat[j] = meshTransformInverted * jointNode->combinedTransform * skin->inverseBindMatrices[j];
 			}
 			HostScene::meshes[meshID]->SetPose( skin, meshTransform );
+			skinPending = false, posed = true;
 		}
-		posInInstanceArray++;
 	}
-	// all done.
+	if (posed) poseAge = 0;
 	return instancesChanged;
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostNode::PrepareLights                                                    |
-//  |  Detects emissive triangles and creates light triangles for them.     LH2'19|
+//  |  Detects emissive triangles and creates light triangles for them. Meshes    |
+//  |  without emissive materials in their material list are skipped.       LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostNode::PrepareLights()
 {
 	if (meshID > -1)
 	{
 		HostMesh* mesh = HostScene::meshes[meshID];
-		for (int s = (int)mesh->triangles.size(), i = 0; i < s; i++)
+		if (mesh->triangleMaterials.size() != mesh->triangles.size()) mesh->BuildMaterialList();
+		bool hasEmissive = mesh->materialList.size() == 0; // unknown; scan the triangles
+		for (int matID : mesh->materialList) if (HostScene::materials[matID]->IsEmissive()) hasEmissive = true;
+		if (!hasEmissive) return;
+		// scan the compact material stream; only emissive triangles are visited
+		for (int s = (int)mesh->triangleMaterials.size(), i = 0; i < s; i++)
 		{
-			HostTri* tri = &mesh->triangles[i];
-			HostMaterial* mat = HostScene::materials[tri->material];
-			if (mat->color.x > 1 || mat->color.y > 1 || mat->color.z > 1)
+			HostMaterial* mat = HostScene::materials[mesh->triangleMaterials[i]];
+			if (mat->IsEmissive())
 			{
+				HostTri* tri = &mesh->triangles[i];
 				tri->UpdateArea();
 				HostTri transformedTri = TransformedHostTri( tri, localTransform );
-				HostAreaLight* light = new HostAreaLight( &transformedTri, i, ID );
+				HostAreaLight* light = HostScene::lightPool.New( &transformedTri, i, ID, HostAreaLight::AverageTexel( *tri ) );
 				tri->ltriIdx = (int)HostScene::areaLights.size(); // TODO: can't duplicate a light due to this.
 				HostScene::areaLights.push_back( light );
+				areaLights.push_back( light );
 				hasLTris = true;
 				// Note: TODO: 
 				// 1. if a mesh is deleted it should scan the list of area lights
@@ -235,19 +244,23 @@ void HostNode::PrepareLights()
 //  +-----------------------------------------------------------------------------+
 //  |  HostNode::UpdateLights                                                     |
 //  |  Update light triangles belonging to this instance after the tansform for   |
-//  |  the node changed.                                                    LH2'19|
+//  |  the node changed. Only the emissive triangles of this instance are         |
+//  |  visited, so SynchronizeLights can send just the modified range.      LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostNode::UpdateLights()
 {
 	if (!hasLTris) return;
 	HostMesh* mesh = HostScene::meshes[meshID];
-	for (int s = (int)mesh->triangles.size(), i = 0; i < s; i++)
+	for (HostAreaLight* light : areaLights)
 	{
-		HostTri* tri = &mesh->triangles[i];
-		if (tri->ltriIdx == -1) continue;
+		const int triIdx = light->triIdx;
+		const bool enabled = light->enabled;
+		HostTri* tri = &mesh->triangles[triIdx];
 		tri->UpdateArea();
 		HostTri transformedTri = TransformedHostTri( tri, combinedTransform );
-		*HostScene::areaLights[tri->ltriIdx] = HostAreaLight( &transformedTri, i, ID );
+		*light = HostAreaLight( &transformedTri, triIdx, ID, light->texel ); // the map was averaged by PrepareLights
+		light->enabled = enabled;
+		light->MarkAsDirty();
 	}
 }
 
@@ -30,11 +30,12 @@ public:
 	// constructor / destructor
 	HostNode() = default;
 	HostNode( const int meshIdx, const mat4& transform );
-	HostNode( const tinygltfNode& gltfNode, const int nodeBase, const int meshBase, const int skinBase );
+	HostNode( const tinygltfNode& gltfNode, const int nodeBase, const int* meshIDs, const int skinBase );
 	~HostNode();
 	// methods
-	void ConvertFromGLTFNode( const tinygltfNode& gltfNode, const int nodeBase, const int meshBase, const int skinBase );
-	bool Update( mat4& T, int& instanceIdx );	// recursively update the transform of this node and its children
+	void ConvertFromGLTFNode( const tinygltfNode& gltfNode, const int nodeBase, const int* meshIDs, const int skinBase );
+	void UpdateTransform( const mat4& T, const bool parentMoved );	// update combinedTransform; T is the parent transform
+	bool UpdateMesh();					// update lights, pose and instance slot after all transforms are up to date
 	void UpdateTransformFromTRS();		// process T, R, S data to localTransform
 	void PrepareLights();				// detects emissive triangles and creates light triangles for them
 	void UpdateLights();				// when the transform changes, this fixes the light triangles
@@ -42,19 +43,29 @@ public:
 	string name;						// node name as specified in the GLTF file
 	mat4 combinedTransform;				// transform combined with ancestor transforms
 	mat4 localTransform;				// = matrix * T * R * S, in case of animation.
+	mat4 shutterTransform;				// combined transform before the last scene graph update, see SetInstanceMotion
 	float3 translation = make_float3( 0 );
 	quat rotation;
 	float3 scale = make_float3( 1 );
 	mat4 matrix;
 	int ID = -1;						// unique ID for the node: position in node array
-	int instanceID = -1;				// for mesh nodes: location in the instance array
+	int instanceID = -1;				// for mesh nodes: slot in the instance array, see HostScene::ClaimInstanceSlot
+	int rootIdx = -1;					// for root nodes: position in HostScene::scene
+	uint visibility = VISIBLE_ALL;		// ray types that see the mesh of this node, see HostScene::SetNodeVisibility
 	int meshID = -1;					// id of the mesh this node refers to (if any, -1 otherwise)
+	int lodMeshID = -1;					// mesh sent to the core: meshID, or one of its LOD meshes if lodLevel > 0
+	int lodLevel = 0;					// current level of detail, see RenderSystem::SelectLODs
 	int skinID = -1;					// id of the skin this node refers to (if any, -1 otherwise)
 	vector<float> weights;				// morph target weights
+	int poseInterval = 1;				// frames between pose updates, see RenderSystem::SchedulePoses
+	int poseAge = 0;					// frames since the last pose update
+	bool skinPending = false;			// a joint moved, but the skin waits for its next pose update
 	bool hasLTris = false;				// true if this instance uses an emissive material
+	vector<HostAreaLight*> areaLights;	// light triangles of this instance; triIdx refers to the mesh triangle
 	bool morphed = false;				// node mesh should update pose
 	bool transformed = false;			// local transform of node should be updated
-	bool treeChanged = false;			// this node or one of its children got updated
+	bool moved = true;					// combined transform changed in the last scene graph update
+	bool instanceDirty = true;			// combined transform or instance slot changed since last sync with the core
 	vector<int> childIdx;				// child nodes of this node
 	TRACKCHANGES;
 };
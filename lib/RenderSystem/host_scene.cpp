@@ -14,6 +14,8 @@
 */
 
 #include "rendersystem.h"
+#include <unordered_map>
+#include <map>
 
 // static scene data
 HostSkyDome* HostScene::sky = 0;
@@ -22,15 +24,28 @@ vector<HostNode*> HostScene::nodes;
 vector<HostMesh*> HostScene::meshes;
 vector<HostSkin*> HostScene::skins;
 vector<HostAnimation*> HostScene::animations;
+HostPool<HostNode> HostScene::nodePool;
+HostPool<HostMaterial> HostScene::materialPool;
+HostPool<HostAreaLight> HostScene::lightPool;
 vector<int> HostScene::instances;
 vector<HostMaterial*> HostScene::materials;
+vector<vector<int>> HostScene::materialMeshes;
 vector<HostTexture*> HostScene::textures;
 vector<HostAreaLight*> HostScene::areaLights;
 vector<HostPointLight*> HostScene::pointLights;
 vector<HostSpotLight*> HostScene::spotLights;
 vector<HostDirectionalLight*> HostScene::directionalLights;
 Camera* HostScene::camera = 0;
-int HostScene::nodeListHoles = 0;
+vector<int> HostScene::removedInstances;
+vector<int> HostScene::freeNodes;
+vector<int> HostScene::freeInstances;
+vector<HostScene::TextureLoad*> HostScene::textureLoads;
+int HostScene::deferredTextures = 0;
+vector<int> HostScene::materialNameIndex;
+bool HostScene::graphChanged = true;
+SceneJournal HostScene::journal;
+HostScene* HostScene::active = 0;
+vector<HostScene*> HostScene::allScenes;
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::HostScene                                                       |
@@ -38,6 +53,7 @@ int HostScene::nodeListHoles = 0;
 //  +-----------------------------------------------------------------------------+
 HostScene::HostScene()
 {
+	allScenes.push_back( this );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -46,20 +62,67 @@ HostScene::HostScene()
 //  +-----------------------------------------------------------------------------+
 HostScene::~HostScene()
 {
+	Activate();
+	// finish background work
+	for (auto load : textureLoads) load->done.Wait(), delete load->texture, delete load;
 	// clean up allocated objects
 	for (auto mesh : meshes) delete mesh;
-	for (auto material : materials) delete material;
+	for (auto material : materials) materialPool.Delete( material );
 	for (auto texture : textures) delete texture;
+	areaLights.clear(); // the nodes delete their own light triangles
+	for (auto node : nodes) nodePool.Delete( node );
 	delete sky;
 	delete camera;
+	// leave empty statics for the next scene that is activated
+	parked = Parked();
+	Swap();
+	active = 0;
+	allScenes.erase( find( allScenes.begin(), allScenes.end(), this ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::Activate                                                        |
+//  |  Make this the active scene: the data of the active scene moves to its      |
+//  |  HostScene object, and the data of this one to the static members. Only     |
+//  |  vectors and pointers are exchanged, so this is cheap. Scenes are not       |
+//  |  thread safe: use one scene at a time.                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::Activate()
+{
+	if (active == this) return;
+	if (active) active->Swap();
+	Swap();
+	active = this;
+}
+
+void HostScene::Swap()
+{
+	std::swap( sky, parked.sky ), std::swap( camera, parked.camera );
+	scene.swap( parked.scene ), instances.swap( parked.instances ), removedInstances.swap( parked.removedInstances );
+	freeNodes.swap( parked.freeNodes ), freeInstances.swap( parked.freeInstances );
+	nodes.swap( parked.nodes ), meshes.swap( parked.meshes ), skins.swap( parked.skins ), animations.swap( parked.animations );
+	materials.swap( parked.materials ), materialMeshes.swap( parked.materialMeshes ), textures.swap( parked.textures );
+	areaLights.swap( parked.areaLights ), pointLights.swap( parked.pointLights );
+	nodePool.Swap( parked.nodePool ), materialPool.Swap( parked.materialPool ), lightPool.Swap( parked.lightPool );
+	spotLights.swap( parked.spotLights ), directionalLights.swap( parked.directionalLights );
+	std::swap( graphChanged, parked.graphChanged );
+	textureLoads.swap( parked.textureLoads ), std::swap( deferredTextures, parked.deferredTextures );
+	materialNameIndex.swap( parked.materialNameIndex ), std::swap( journal, parked.journal );
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::SerializeMaterials                                              |
-//  |  Write the list of materials to a file.                               LH2'19|
+//  |  Write the list of materials to a file. XML is meant for interchange; other |
+//  |  extensions get the binary material library, see SaveMaterialLibrary. LH2'19|
 //  +-----------------------------------------------------------------------------+
+static bool IsXMLFile( const char* file )
+{
+	const size_t length = strlen( file );
+	return length >= 4 && _stricmp( file + length - 4, ".xml" ) == 0;
+}
 void HostScene::SerializeMaterials( const char* xmlFile )
 {
+	if (!IsXMLFile( xmlFile )) { SaveMaterialLibrary( xmlFile ); return; }
 	XMLDocument doc;
 	XMLNode* root = doc.NewElement( "materials" );
 	doc.InsertFirstChild( root );
@@ -113,6 +176,7 @@ void HostScene::SerializeMaterials( const char* xmlFile )
 //  +-----------------------------------------------------------------------------+
 void HostScene::DeserializeMaterials( const char* xmlFile )
 {
+	if (!IsXMLFile( xmlFile )) { LoadMaterialLibrary( xmlFile ); return; }
 	XMLDocument doc;
 	XMLError result = doc.LoadFile( xmlFile );
 	if (result != XML_SUCCESS) return;
@@ -164,7 +228,287 @@ void HostScene::DeserializeMaterials( const char* xmlFile )
 		if (entry->FirstChildElement( "custom1" )) entry->FirstChildElement( "custom1" )->QueryFloatText( &m->custom1 );
 		if (entry->FirstChildElement( "custom2" )) entry->FirstChildElement( "custom2" )->QueryFloatText( &m->custom2 );
 		if (entry->FirstChildElement( "custom3" )) entry->FirstChildElement( "custom3" )->QueryFloatText( &m->custom3 );
+		m->MarkAsDirty();
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Material library: a header, one MaterialRecord per persistent material, a  |
+//  |  string table with the names and origins, and the record indices sorted     |
+//  |  by name, which LoadMaterialLibrary uses as the name index.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct MaterialLibraryHeader
+{
+	uint version;								// MATLIBVERSION
+	uint materialCount;							// materials in the scene when the library was saved
+	uint recordCount;							// persistent (FROM_MTL) materials stored in the library
+	uint stringBytes;							// size of the string table
+};
+struct MaterialRecord
+{
+	uint index;									// index in HostScene::materials
+	int ID;
+	uint flags;
+	uint name, origin;							// offsets in the string table
+	float3 color, absorption;
+	float params[16];							// metallic .. custom3, in the order of MaterialParams
+};
+static void MaterialParams( HostMaterial* m, float* params[16] )
+{
+	float* p[16] = { &m->metallic, &m->subsurface, &m->specular, &m->roughness, &m->specularTint, &m->anisotropic, &m->sheen, &m->sheenTint,
+		&m->clearcoat, &m->clearcoatGloss, &m->transmission, &m->eta, &m->custom0, &m->custom1, &m->custom2, &m->custom3 };
+	memcpy( params, p, sizeof( p ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::SaveMaterialLibrary                                             |
+//  |  Write the persistent materials to a binary material library. Like the XML  |
+//  |  file, it only applies to a scene with the same list of materials.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool HostScene::SaveMaterialLibrary( const char* libFile )
+{
+	vector<MaterialRecord> records;
+	string strings;
+	for (uint s = (uint)materials.size(), i = 0; i < s; i++)
+	{
+		HostMaterial* m = materials[i];
+		if ((m->flags & HostMaterial::FROM_MTL) == 0) continue;
+		MaterialRecord r = {};
+		r.index = i, r.ID = m->ID, r.flags = m->flags, r.color = m->color, r.absorption = m->absorption;
+		r.name = (uint)strings.size(), strings.append( m->name.c_str(), m->name.size() + 1 );
+		r.origin = (uint)strings.size(), strings.append( m->origin.c_str(), m->origin.size() + 1 );
+		float* params[16];
+		MaterialParams( m, params );
+		for (int j = 0; j < 16; j++) r.params[j] = *params[j];
+		records.push_back( r );
+	}
+	// name index: stable, so the first material with a name comes first, as in FindMaterialID
+	vector<uint> sorted( records.size() );
+	for (uint i = 0; i < (uint)sorted.size(); i++) sorted[i] = i;
+	stable_sort( sorted.begin(), sorted.end(), [&]( const uint a, const uint b ) { return strcmp( strings.c_str() + records[a].name, strings.c_str() + records[b].name ) < 0; } );
+	FILE* f;
+	fopen_s( &f, libFile, "wb" );
+	if (!f) return false;
+	const MaterialLibraryHeader header = { MATLIBVERSION, (uint)materials.size(), (uint)records.size(), (uint)strings.size() };
+	fwrite( &header, sizeof( header ), 1, f );
+	fwrite( records.data(), sizeof( MaterialRecord ), records.size(), f );
+	fwrite( strings.data(), 1, strings.size(), f );
+	fwrite( sorted.data(), sizeof( uint ), sorted.size(), f );
+	fclose( f );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::LoadMaterialLibrary                                             |
+//  |  Restore the materials from a binary material library, mapped into memory.  |
+//  |  Returns false, without changing the materials, if the file is missing,     |
+//  |  damaged, has a different version or was saved for other materials.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool HostScene::LoadMaterialLibrary( const char* libFile )
+{
+	MappedFile file( libFile );
+	if (!file.data || file.size < sizeof( MaterialLibraryHeader )) return false;
+	MaterialLibraryHeader header;
+	memcpy( &header, file.data, sizeof( header ) );
+	if (header.version != MATLIBVERSION || header.materialCount != materials.size()) return false;
+	const size_t size = sizeof( header ) + (size_t)header.recordCount * (sizeof( MaterialRecord ) + sizeof( uint )) + header.stringBytes;
+	if (size != file.size || header.recordCount > header.materialCount) return false;
+	vector<MaterialRecord> records( header.recordCount );
+	vector<uint> sorted( header.recordCount );
+	const uchar* pos = file.data + sizeof( header );
+	memcpy( records.data(), pos, records.size() * sizeof( MaterialRecord ) ), pos += records.size() * sizeof( MaterialRecord );
+	const char* strings = (const char*)pos;
+	pos += header.stringBytes;
+	memcpy( sorted.data(), pos, sorted.size() * sizeof( uint ) );
+	// validate everything before touching the materials
+	if (header.stringBytes > 0 && strings[header.stringBytes - 1] != 0) return false;
+	for (const MaterialRecord& r : records)
+		if (r.index >= header.materialCount || r.name >= header.stringBytes || r.origin >= header.stringBytes) return false;
+	for (const uint i : sorted) if (i >= header.recordCount) return false;
+	for (const MaterialRecord& r : records)
+	{
+		HostMaterial* m = materials[r.index];
+		m->name = string( strings + r.name ), m->origin = string( strings + r.origin );
+		m->ID = r.ID, m->flags = r.flags, m->color = r.color, m->absorption = r.absorption;
+		float* params[16];
+		MaterialParams( m, params );
+		for (int j = 0; j < 16; j++) *params[j] = r.params[j];
+		m->MarkAsDirty();
 	}
+	// the name index of the file covers the persistent materials; the others are merged in
+	if (header.recordCount == header.materialCount)
+	{
+		materialNameIndex.resize( sorted.size() );
+		for (size_t i = 0; i < sorted.size(); i++) materialNameIndex[i] = records[sorted[i]].index;
+	}
+	else BuildMaterialNameIndex();
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SceneJournal::Add                                                          |
+//  |  Append an entry. Entries are stored the way Serialize sends them.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void SceneJournal::Add( const ushort type, const int id, const void* payload, const size_t bytes )
+{
+	const Entry entry = { type, (ushort)bytes, id };
+	const uchar* e = (const uchar*)&entry;
+	data.insert( data.end(), e, e + sizeof( Entry ) );
+	if (bytes > 0) data.insert( data.end(), (const uchar*)payload, (const uchar*)payload + bytes );
+	offsets.push_back( data.size() );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SceneJournal::AddInstance / Material                                       |
+//  |  Entries with more than one field. A material is journaled as a whole: its  |
+//  |  parameters and texture ids, but not its name and origin.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct JournalInstance { int meshId; mat4 transform; };
+struct JournalMaterial
+{
+	int ID;
+	uint flags;
+	float3 color, absorption;
+	float params[16];							// in the order of MaterialParams
+	int textureID[11];
+};
+void SceneJournal::AddInstance( const int nodeId, const int meshId, const mat4& transform )
+{
+	if (!enabled) return;
+	const JournalInstance instance = { meshId, transform };
+	Add( ADDINSTANCE, nodeId, &instance, sizeof( instance ) );
+}
+void SceneJournal::Material( const int matIdx, const HostMaterial* material )
+{
+	if (!enabled) return;
+	HostMaterial* m = (HostMaterial*)material;
+	JournalMaterial r;
+	r.ID = m->ID, r.flags = m->flags, r.color = m->color, r.absorption = m->absorption;
+	float* params[16];
+	MaterialParams( m, params );
+	for (int i = 0; i < 16; i++) r.params[i] = *params[i];
+	for (int i = 0; i < 11; i++) r.textureID[i] = m->map[i].textureID;
+	Add( MATERIAL, matIdx, &r, sizeof( r ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SceneJournal::Trim                                                         |
+//  |  Forget the entries that all copies of the scene applied.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void SceneJournal::Trim( const uint64_t upTo )
+{
+	if (upTo < first) return;
+	const size_t count = (size_t)min( upTo - first + 1, (uint64_t)offsets.size() - 1 );
+	const size_t bytes = offsets[count];
+	data.erase( data.begin(), data.begin() + bytes );
+	offsets.erase( offsets.begin(), offsets.begin() + count );
+	for (auto& offset : offsets) offset -= bytes;
+	first += count;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SceneJournal::Serialize                                                    |
+//  |  Write the entries after sequence number since: a header with the version,  |
+//  |  the entry count and the sequence number of the first entry, followed by    |
+//  |  the entries. Fails if some of these entries were trimmed already.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool SceneJournal::Serialize( const uint64_t since, vector<uchar>& stream ) const
+{
+	if (since + 1 < first) return false;
+	const size_t skip = (size_t)min( since + 1 - first, (uint64_t)offsets.size() - 1 );
+	const uint header[4] = { JOURNALVERSION, (uint)(offsets.size() - 1 - skip), (uint)(since + 1), (uint)((since + 1) >> 32) };
+	stream.resize( sizeof( header ) + data.size() - offsets[skip] );
+	memcpy( stream.data(), header, sizeof( header ) );
+	memcpy( stream.data() + sizeof( header ), data.data() + offsets[skip], data.size() - offsets[skip] );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  SceneJournal::Apply                                                        |
+//  |  Replay a stream written by Serialize on the active scene. On success, the  |
+//  |  sequence number of its last entry is stored in sequence. Returns false for |
+//  |  a damaged stream, or when the ids of this scene differ from those of the   |
+//  |  scene that wrote it; entries before the failing one were applied.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool SceneJournal::Apply( const uchar* stream, const size_t size, uint64_t* sequence )
+{
+	uint header[4];
+	if (size < sizeof( header )) return false;
+	memcpy( header, stream, sizeof( header ) );
+	if (header[0] != JOURNALVERSION) return false;
+	const uchar* pos = stream + sizeof( header ), *end = stream + size;
+	for (uint i = 0; i < header[1]; i++)
+	{
+		Entry entry;
+		if ((size_t)(end - pos) < sizeof( Entry )) return false;
+		memcpy( &entry, pos, sizeof( Entry ) ), pos += sizeof( Entry );
+		if ((size_t)(end - pos) < entry.bytes) return false;
+		const uchar* payload = pos;
+		pos += entry.bytes;
+		const int id = entry.id;
+		switch (entry.type)
+		{
+		case NODETRANSFORM:
+		{
+			if (entry.bytes != sizeof( mat4 ) || id < 0 || id >= HostScene::nodes.size() || !HostScene::nodes[id]) return false;
+			mat4 transform;
+			memcpy( &transform, payload, sizeof( mat4 ) );
+			HostScene::SetNodeTransform( id, transform );
+			break;
+		}
+		case NODEVISIBILITY:
+		{
+			if (entry.bytes != 4 || id < 0 || id >= HostScene::nodes.size() || !HostScene::nodes[id]) return false;
+			uint visibility;
+			memcpy( &visibility, payload, 4 );
+			HostScene::SetNodeVisibility( id, visibility );
+			break;
+		}
+		case ADDINSTANCE:
+		{
+			JournalInstance instance;
+			if (entry.bytes != sizeof( instance )) return false;
+			memcpy( &instance, payload, sizeof( instance ) );
+			if (instance.meshId < 0 || instance.meshId >= HostScene::meshes.size()) return false;
+			if (HostScene::AddInstance( instance.meshId, instance.transform ) != id) return false;
+			break;
+		}
+		case REMOVEINSTANCE:
+			if (id < 0 || id >= HostScene::nodes.size() || !HostScene::nodes[id]) return false;
+			HostScene::RemoveInstance( id );
+			break;
+		case MATERIAL:
+		{
+			JournalMaterial r;
+			if (entry.bytes != sizeof( r ) || id < 0 || id >= HostScene::materials.size()) return false;
+			memcpy( &r, payload, sizeof( r ) );
+			HostMaterial* m = HostScene::materials[id];
+			if (m->ID != r.ID) return false;
+			m->flags = r.flags, m->color = r.color, m->absorption = r.absorption;
+			float* params[16];
+			MaterialParams( m, params );
+			for (int j = 0; j < 16; j++) *params[j] = r.params[j];
+			for (int j = 0; j < 11; j++) m->map[j].textureID = r.textureID[j] < (int)HostScene::textures.size() ? r.textureID[j] : -1;
+			m->MarkAsDirty();
+			break;
+		}
+		case RESETANIMATION:
+			if (id < 0 || id >= HostScene::animations.size()) return false;
+			HostScene::ResetAnimation( id );
+			break;
+		case UPDATEANIMATION:
+		{
+			if (entry.bytes != 4 || id < 0 || id >= HostScene::animations.size()) return false;
+			float dt;
+			memcpy( &dt, payload, 4 );
+			HostScene::UpdateAnimation( id, dt );
+			break;
+		}
+		default: return false;
+		}
+	}
+	if (sequence) *sequence = (header[2] | ((uint64_t)header[3] << 32)) + header[1] - 1;
+	return true;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -190,9 +534,22 @@ int HostScene::AddMesh( const char* objFile, const char* dir, const float scale
 	HostMesh* newMesh = new HostMesh( objFile, dir, scale );
 	newMesh->ID = (int)meshes.size();
 	meshes.push_back( newMesh );
+	newMesh->BuildMaterialList();
 	return newMesh->ID;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  DeferImageData                                                             |
+//  |  Image loader for tinygltf that keeps the encoded image data, so that       |
+//  |  AddScene can decode all images in parallel afterwards.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+static bool DeferImageData( tinygltf::Image* image, const int, string*, string*, int, int, const uchar* bytes, int size, void* )
+{
+	image->image.assign( bytes, bytes + size );
+	image->width = image->height = 0; // still encoded
+	return true;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::AddScene                                                        |
 //  |  Loads a collection of meshes from a gltf file. An instance and a scene     |
@@ -212,61 +569,118 @@ void HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tr
 	string cleanFileName = LowerCase( dir + string( sceneFile ) );
 	tinygltf::Model gltfModel;
 	tinygltf::TinyGLTF loader;
+	loader.SetImageLoader( DeferImageData, 0 );
 	string err, warn;
 	bool ret = false;
 	if (cleanFileName.size() > 4)
 	{
+		// parse from a memory mapped file, so that tinygltf does not read the whole file into a copy first
 		string extension4 = cleanFileName.substr( cleanFileName.size() - 5, 5 );
 		string extension3 = cleanFileName.substr( cleanFileName.size() - 4, 4 );
+		const size_t slash = cleanFileName.find_last_of( "/\\" );
+		const string gltfDir = slash == string::npos ? "" : cleanFileName.substr( 0, slash ); // as tinygltf's GetBaseDir
+		MappedFile file( cleanFileName.c_str() );
+		const bool mapped = file.data != 0 && file.size < 0xffffffff; // tinygltf takes a 32-bit length
 		if (extension4.compare( ".gltf" ) == 0)
-			ret = loader.LoadASCIIFromFile( &gltfModel, &err, &warn, cleanFileName.c_str() );
+			ret = mapped ? loader.LoadASCIIFromString( &gltfModel, &err, &warn, (const char*)file.data, (uint)file.size, gltfDir ) :
+			loader.LoadASCIIFromFile( &gltfModel, &err, &warn, cleanFileName.c_str() );
 		if (extension3.compare( ".bin" ) == 0 || extension3.compare( ".glb" ) == 0)
-			ret = loader.LoadBinaryFromFile( &gltfModel, &err, &warn, cleanFileName.c_str() );
+			ret = mapped ? loader.LoadBinaryFromMemory( &gltfModel, &err, &warn, file.data, (uint)file.size, gltfDir ) :
+			loader.LoadBinaryFromFile( &gltfModel, &err, &warn, cleanFileName.c_str() );
 	}
 	if (!warn.empty()) printf( "Warn: %s\n", warn.c_str() );
 	if (!err.empty()) printf( "Err: %s\n", err.c_str() );
 	if (!ret) FatalError( "could not load glTF file:\n%s", cleanFileName.c_str() );
-	// convert textures
-	for (size_t s = gltfModel.textures.size(), i = 0; i < s; i++)
+	HostMesh::DecodeCompressedViews( gltfModel ); // EXT_meshopt_compression; animations read these views as well
+	// textures and meshes come from the scene cache if it is newer than the scene and the files it references
+	const string cacheFile = cleanFileName + ".cache";
+	bool cached = false;
+#ifdef CACHESCENES
+	cached = !FileIsNewer( cleanFileName.c_str(), cacheFile.c_str() );
+	const string baseDir = cleanFileName.substr( 0, cleanFileName.find_last_of( "/\\" ) + 1 );
+	for (const auto& buffer : gltfModel.buffers) if (!buffer.uri.empty() && buffer.uri.compare( 0, 5, "data:" ))
+		if (!FileExists( (baseDir + buffer.uri).c_str() ) || FileIsNewer( (baseDir + buffer.uri).c_str(), cacheFile.c_str() )) cached = false;
+	for (const auto& image : gltfModel.images) if (!image.uri.empty() && image.uri.compare( 0, 5, "data:" ))
+		if (!FileExists( (baseDir + image.uri).c_str() ) || FileIsNewer( (baseDir + image.uri).c_str(), cacheFile.c_str() )) cached = false;
+	if (cached) cached = LoadSceneCache( cacheFile.c_str(), (int)gltfModel.textures.size(), (int)gltfModel.meshes.size() );
+#endif
+	if (!cached)
 	{
-		tinygltf::Texture& gltfTexture = gltfModel.textures[i];
-		HostTexture* texture = new HostTexture();
-		const tinygltf::Image& image = gltfModel.images[gltfTexture.source];
-		const size_t size = image.component * image.width * image.height;
-		texture->width = image.width;
-		texture->height = image.height;
-		texture->idata = (uchar4*)MALLOC64( texture->PixelsNeeded( image.width, image.height, MIPLEVELCOUNT ) * sizeof( uint ) );
-		texture->ID = (int)i + textureBase;
-		texture->flags |= HostTexture::LDR;
-		memcpy( texture->idata, image.image.data(), size );
-		texture->ConstructMIPmaps();
-		textures.push_back( texture );
+		// convert textures; one job per image decodes it, fills the textures that use it, and frees it
+		// right away, so that decoded images do not pile up next to the final texel data
+		vector<vector<int>> imageTextures( gltfModel.images.size() );
+		for (size_t s = gltfModel.textures.size(), i = 0; i < s; i++)
+		{
+			HostTexture* texture = new HostTexture();
+			texture->ID = (int)i + textureBase;
+			texture->flags |= HostTexture::LDR;
+			textures.push_back( texture );
+			imageTextures[gltfModel.textures[i].source].push_back( (int)i + textureBase );
+		}
+		vector<string> imageErrors( gltfModel.images.size() );
+		RunJobs( (int)gltfModel.images.size(), [&]( const int i ) {
+			tinygltf::Image& image = gltfModel.images[i];
+			if (imageTextures[i].size() == 0) { vector<uchar>().swap( image.image ); return; } // unused
+			if (image.width == 0 && !image.image.empty())
+			{
+				// still encoded, see DeferImageData
+				const vector<uchar> encoded( std::move( image.image ) );
+				string imageWarning;
+				tinygltf::LoadImageData( &image, i, &imageErrors[i], &imageWarning, 0, 0, encoded.data(), (int)encoded.size(), 0 );
+			}
+			for (const int textureID : imageTextures[i])
+			{
+				HostTexture* texture = textures[textureID];
+				texture->width = image.width;
+				texture->height = image.height;
+				texture->idata = (uchar4*)MALLOC64( texture->PixelsNeeded( image.width, image.height, MIPLEVELCOUNT ) * sizeof( uint ) );
+				memcpy( texture->idata, image.image.data(), image.component * image.width * image.height );
+				texture->ConstructMIPmaps();
+			}
+			vector<uchar>().swap( image.image );
+		} );
+		for (const string& imageError : imageErrors) if (!imageError.empty()) FatalError( "could not decode glTF image:\n%s", imageError.c_str() );
 	}
+	vector<tinygltf::Image>().swap( gltfModel.images ); // texel data now lives in the textures, or in the cache
 	// convert materials
+	materialPool.Reserve( gltfModel.materials.size() );
 	for (size_t s = gltfModel.materials.size(), i = 0; i < s; i++)
 	{
 		tinygltf::Material& gltfMaterial = gltfModel.materials[i];
-		HostMaterial* material = new HostMaterial();
+		HostMaterial* material = materialPool.New();
 		material->ID = (int)i + materialBase;
 		material->origin = cleanFileName;
 		material->ConvertFrom( gltfMaterial, gltfModel, textureBase );
 		material->flags |= HostMaterial::FROM_MTL;
 		materials.push_back( material );
-		// materialList.push_back( material->ID ); // can't do that, need something smarter.
 	}
-	// convert meshes
-	for (size_t s = gltfModel.meshes.size(), i = 0; i < s; i++)
+	// convert meshes, in parallel; conversion only reads the glTF model
+	if (!cached)
 	{
-		tinygltf::Mesh& gltfMesh = gltfModel.meshes[i];
-		HostMesh* newMesh = new HostMesh( gltfMesh, gltfModel, materialBase, gltfModel.materials.size() == 0 ? 0 : -1 );
-		newMesh->ID = (int)i + meshBase;
-		meshes.push_back( newMesh );
+		vector<HostMesh*> newMeshes( gltfModel.meshes.size() );
+		RunJobs( (int)newMeshes.size(), [&]( const int i ) {
+			newMeshes[i] = new HostMesh( gltfModel.meshes[i], gltfModel, materialBase, gltfModel.materials.size() == 0 ? 0 : -1 );
+		} );
+		for (size_t s = newMeshes.size(), i = 0; i < s; i++)
+		{
+			newMeshes[i]->ID = (int)i + meshBase;
+			meshes.push_back( newMeshes[i] );
+		}
+	#ifdef CACHESCENES
+		SaveSceneCache( cacheFile.c_str(), textureBase, meshBase );
+	#endif
 	}
+	// store identical textures and meshes once; the cache above keeps the layout of the file
+	vector<int> meshIDs;
+	DeduplicateImports( textureBase, materialBase, meshBase, meshIDs );
+	// now that the materials exist, index the materials of the new (possibly cached) meshes
+	for (int s = (int)meshes.size(), i = meshBase; i < s; i++) meshes[i]->BuildMaterialList();
 	// convert nodes
+	nodePool.Reserve( gltfModel.nodes.size() + (hasTransform ? 1 : 0) );
 	if (hasTransform)
 	{
 		// push an extra node that holds a transform for the gltf scene
-		HostNode* newNode = new HostNode();
+		HostNode* newNode = nodePool.New();
 		newNode->localTransform = transform;
 		newNode->ID = nodeBase - 1;
 		nodes.push_back( newNode );
@@ -274,7 +688,7 @@ void HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tr
 	for (size_t s = gltfModel.nodes.size(), i = 0; i < s; i++)
 	{
 		tinygltf::Node& gltfNode = gltfModel.nodes[i];
-		HostNode* newNode = new HostNode( gltfNode, nodeBase, meshBase, skinBase );
+		HostNode* newNode = nodePool.New( gltfNode, nodeBase, meshIDs.data(), skinBase );
 		newNode->ID = (int)i + nodeBase;
 		nodes.push_back( newNode );
 	}
@@ -289,6 +703,7 @@ void HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tr
 		HostSkin* newSkin = new HostSkin( source, gltfModel, nodeBase );
 		skins.push_back( newSkin );
 	}
+	vector<tinygltf::Buffer>().swap( gltfModel.buffers ); // all vertex and animation data has been converted
 	// construct a scene graph for scene 0, assuming the GLTF file has one scene
 	tinygltf::Scene& glftScene = gltfModel.scenes[0];
 	if (hasTransform)
@@ -296,13 +711,19 @@ void HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tr
 		// add the root nodes to the scene transform node
 		for (size_t i = 0; i < glftScene.nodes.size(); i++) nodes[nodeBase - 1]->childIdx.push_back( glftScene.nodes[i] + nodeBase );
 		// add the root transform to the scene
+		nodes[nodeBase - 1]->rootIdx = (int)scene.size();
 		scene.push_back( nodeBase - 1 );
 	}
 	else
 	{
 		// add the root nodes to the scene
-		for (size_t i = 0; i < glftScene.nodes.size(); i++) scene.push_back( glftScene.nodes[i] + nodeBase );
+		for (size_t i = 0; i < glftScene.nodes.size(); i++)
+		{
+			nodes[glftScene.nodes[i] + nodeBase]->rootIdx = (int)scene.size();
+			scene.push_back( glftScene.nodes[i] + nodeBase );
+		}
 	}
+	graphChanged = true;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -314,6 +735,7 @@ void HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tr
 int HostScene::AddQuad( float3 N, const float3 pos, const float width, const float height, const int material, const int meshID )
 {
 	HostMesh* newMesh = meshID > -1 ? meshes[meshID] : new HostMesh();
+	newMesh->contentHash = 0; // the geometry changes
 	N = normalize( N ); // let's not assume the normal is normalized.
 #if 1
 	const float3 tmp = N.x > 0.9f ? make_float3( 0, 1, 0 ) : make_float3( 1, 0, 0 );
@@ -354,60 +776,618 @@ int HostScene::AddQuad( float3 N, const float3 pos, const float width, const flo
 	if (meshID == -1)
 	{
 		newMesh->ID = (int)meshes.size();
-		newMesh->materialList.push_back( material );
 		meshes.push_back( newMesh );
 	}
+	newMesh->BuildMaterialList();
 	return newMesh->ID;
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  HostScene::AddInstance                                                     |
-//  |  Add an instance of an existing mesh to the scene.                    LH2'19|
+//  |  HostScene::AddCurves                                                       |
+//  |  Create a mesh for a set of hair or fur strands, which the scene takes      |
+//  |  ownership of. The mesh holds a tessellation with the given number of sides |
+//  |  per tube, which is used by cores without curve support, and for picking.   |
+//  |  Instance it using AddInstance, like any other mesh.                  LH2'19|
 //  +-----------------------------------------------------------------------------+
-int HostScene::AddInstance( const int meshId, const mat4& transform )
+int HostScene::AddCurves( HostCurves* curves, const int sides )
+{
+	HostMesh* newMesh = new HostMesh();
+	newMesh->name = "curves";
+	newMesh->curves = curves;
+	curves->Tessellate( newMesh, max( 3, sides ) );
+	newMesh->ID = (int)meshes.size();
+	meshes.push_back( newMesh );
+	newMesh->BuildMaterialList();
+	newMesh->UpdateBounds();
+	return newMesh->ID;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::AddParticles                                                    |
+//  |  Create a mesh for a point cloud, which the scene takes ownership of. The   |
+//  |  mesh has no triangles until a core declines the spheres; see               |
+//  |  RenderSystem::SynchronizeMeshes. Instance it using AddInstance.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+int HostScene::AddParticles( HostParticles* particles )
+{
+	HostMesh* newMesh = new HostMesh();
+	newMesh->name = "particles";
+	newMesh->particles = particles;
+	newMesh->ID = (int)meshes.size();
+	meshes.push_back( newMesh );
+	newMesh->UpdateBounds();
+	return newMesh->ID;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Scene cache helpers: vectors are stored as a 64-bit element count followed |
+//  |  by the raw elements. Reads past the end of the mapped file fail.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct CacheReader
+{
+	const uchar* pos;
+	const uchar* end;
+	bool Read( void* dst, const size_t bytes )
+	{
+		if (bytes > (size_t)(end - pos)) return false;
+		memcpy( dst, pos, bytes );
+		pos += bytes;
+		return true;
+	}
+	template <class T> bool Read( vector<T>& v )
+	{
+		uint64_t count;
+		if (!Read( &count, 8 ) || count > (size_t)(end - pos) / sizeof( T )) return false;
+		v.resize( count );
+		return Read( v.data(), count * sizeof( T ) );
+	}
+};
+template <class T> static void WriteCache( const vector<T>& v, FILE* f )
+{
+	const uint64_t count = v.size();
+	fwrite( &count, 8, 1, f );
+	fwrite( v.data(), sizeof( T ), count, f );
+}
+static bool ReadCachedMesh( CacheReader& cache, HostMesh* mesh )
 {
-	HostNode* newNode = new HostNode( meshId, transform );
-	if (nodeListHoles > 0) 
+	bool valid = cache.Read( mesh->triangles ) && cache.Read( mesh->vertices ) && cache.Read( mesh->sharedVertices ) &&
+		cache.Read( mesh->indices ) && cache.Read( mesh->joints ) && cache.Read( mesh->weights ) && cache.Read( mesh->lightmapUVs );
+	uint poseCount = 0;
+	if (valid) valid = cache.Read( &poseCount, 4 );
+	if (valid) mesh->poses.resize( poseCount );
+	for (auto& pose : mesh->poses) if (valid) valid = cache.Read( pose.positions ) && cache.Read( pose.normals ) && cache.Read( pose.tangents );
+	return valid;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::LoadSceneCache                                                  |
+//  |  Add the textures and meshes of a glTF scene from its cache file, which is  |
+//  |  mapped into memory. Returns false, without changing the scene, if the      |
+//  |  cache is missing, has a different version or does not match the scene.     |
+//  |  Materials, nodes, animations and skins are still converted by AddScene.    |
+//  |                                                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool HostScene::LoadSceneCache( const char* cacheFile, const int textureCount, const int meshCount )
+{
+	MappedFile file( cacheFile );
+	if (!file.data) return false;
+	CacheReader cache = { file.data, file.data + file.size };
+	uint header[3];
+	if (!cache.Read( header, sizeof( header ) )) return false;
+	if (header[0] != SCENECACHEVERSION || header[1] != (uint)textureCount || header[2] != (uint)meshCount) return false;
+	// read everything before adding it to the scene, so that a damaged file changes nothing
+	vector<HostTexture*> newTextures;
+	vector<HostMesh*> newMeshes;
+	bool valid = true;
+	for (int i = 0; i < textureCount && valid; i++)
+	{
+		HostTexture* texture = new HostTexture();
+		newTextures.push_back( texture );
+		uint fields[5];
+		valid = cache.Read( fields, sizeof( fields ) );
+		if (!valid) break;
+		texture->width = fields[0], texture->height = fields[1], texture->flags = fields[2], texture->mods = fields[3], texture->MIPlevels = fields[4];
+		const size_t pixelCount = texture->PixelsNeeded( texture->width, texture->height, MIPLEVELCOUNT );
+		texture->idata = (uchar4*)MALLOC64( pixelCount * sizeof( uint ) );
+		valid = cache.Read( texture->idata, pixelCount * sizeof( uint ) );
+	}
+	for (int i = 0; i < meshCount && valid; i++)
 	{
-		// we have holes in the nodes vector due to instance deletions; search from the
-		// end of the list to speed up frequent additions / deletions in complex scenes.
-		for( int i = (int)nodes.size() - 1; i >= 0; i-- ) if (!nodes[i])
+		HostMesh* mesh = new HostMesh();
+		newMeshes.push_back( mesh );
+		mesh->cacheFile = cacheFile, mesh->cacheOffset = (size_t)(cache.pos - file.data);
+		valid = ReadCachedMesh( cache, mesh );
+	}
+	if (!valid)
+	{
+		for (auto texture : newTextures) delete texture;
+		for (auto mesh : newMeshes) delete mesh;
+		return false;
+	}
+	for (auto texture : newTextures) texture->ID = (int)textures.size(), textures.push_back( texture );
+	for (auto mesh : newMeshes) mesh->ID = (int)meshes.size(), meshes.push_back( mesh );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::SaveSceneCache                                                  |
+//  |  Write the textures and meshes added by AddScene, starting at the supplied  |
+//  |  offsets, to a cache file for LoadSceneCache.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::SaveSceneCache( const char* cacheFile, const int textureBase, const int meshBase )
+{
+	FILE* f;
+	fopen_s( &f, cacheFile, "wb" );
+	if (!f) return;
+	const uint header[3] = { SCENECACHEVERSION, (uint)(textures.size() - textureBase), (uint)(meshes.size() - meshBase) };
+	fwrite( header, sizeof( header ), 1, f );
+	for (size_t s = textures.size(), i = textureBase; i < s; i++)
+	{
+		HostTexture* texture = textures[i];
+		const uint fields[5] = { texture->width, texture->height, texture->flags, texture->mods, texture->MIPlevels };
+		fwrite( fields, sizeof( fields ), 1, f );
+		fwrite( texture->idata, sizeof( uint ), texture->PixelsNeeded( texture->width, texture->height, MIPLEVELCOUNT ), f );
+	}
+	for (size_t s = meshes.size(), i = meshBase; i < s; i++)
+	{
+		HostMesh* mesh = meshes[i];
+		mesh->cacheFile = cacheFile, mesh->cacheOffset = (size_t)_ftelli64( f );
+		WriteCache( mesh->triangles, f ), WriteCache( mesh->vertices, f ), WriteCache( mesh->sharedVertices, f );
+		WriteCache( mesh->indices, f ), WriteCache( mesh->joints, f ), WriteCache( mesh->weights, f ), WriteCache( mesh->lightmapUVs, f );
+		const uint poseCount = (uint)mesh->poses.size();
+		fwrite( &poseCount, 4, 1, f );
+		for (const auto& pose : mesh->poses) WriteCache( pose.positions, f ), WriteCache( pose.normals, f ), WriteCache( pose.tangents, f );
+	}
+	fclose( f );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::ReloadMeshFromCache                                             |
+//  |  Read the geometry of a mesh back from the scene cache it was loaded from   |
+//  |  or saved to, after HostMesh::ReleaseHostData. Returns false if the mesh    |
+//  |  has no cache, or if the cache can no longer be read.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool HostScene::ReloadMeshFromCache( HostMesh* mesh )
+{
+	if (mesh->cacheFile.empty()) return false;
+	MappedFile file( mesh->cacheFile.c_str() );
+	if (!file.data || mesh->cacheOffset >= file.size) return false;
+	CacheReader cache = { file.data + mesh->cacheOffset, file.data + file.size };
+	uint header;
+	memcpy( &header, file.data, 4 );
+	if (header != SCENECACHEVERSION || !ReadCachedMesh( cache, mesh ))
+	{
+		mesh->triangles.clear(), mesh->vertices.clear(), mesh->sharedVertices.clear();
+		mesh->indices.clear(), mesh->joints.clear(), mesh->weights.clear(), mesh->poses.clear(), mesh->lightmapUVs.clear();
+		return false;
+	}
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Content hashing for DeduplicateImports                                     |
+//  |  FNV-1a over eight bytes per step. Hashes are cached in the objects; 0      |
+//  |  means 'not computed yet'.                                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+static uint64 HashBytes( const void* data, const size_t bytes, uint64 hash )
+{
+	const uchar* p = (const uchar*)data;
+	size_t i = 0;
+	for (; i + 8 <= bytes; i += 8)
+	{
+		uint64 word;
+		memcpy( &word, p + i, 8 );
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; i < bytes; i++) hash = (hash ^ p[i]) * 1099511628211ull;
+	return hash;
+}
+template <class T> static uint64 HashVector( const vector<T>& v, const uint64 hash )
+{
+	return HashBytes( v.data(), v.size() * sizeof( T ), (hash ^ v.size()) * 1099511628211ull );
+}
+template <class T> static bool SameVector( const vector<T>& a, const vector<T>& b )
+{
+	return a.size() == b.size() && (a.size() == 0 || memcmp( a.data(), b.data(), a.size() * sizeof( T ) ) == 0);
+}
+static size_t TexelBytes( const HostTexture* texture )
+{
+	// the top MIP level; the other levels are derived from it
+	return (size_t)texture->width * texture->height * (texture->fdata ? sizeof( float4 ) : sizeof( uint ));
+}
+static uint64 ContentHash( HostTexture* texture )
+{
+	if (texture->contentHash) return texture->contentHash;
+	const uint fields[5] = { texture->width, texture->height, texture->flags, texture->mods, texture->fdata ? 1u : 0u };
+	uint64 hash = HashBytes( fields, sizeof( fields ), 14695981039346656037ull );
+	hash = HashBytes( texture->fdata ? (void*)texture->fdata : (void*)texture->idata, TexelBytes( texture ), hash );
+	return texture->contentHash = hash ? hash : 1;
+}
+static bool SameContent( const HostTexture* a, const HostTexture* b )
+{
+	if (a->width != b->width || a->height != b->height || a->flags != b->flags || a->mods != b->mods) return false;
+	if ((a->fdata == 0) != (b->fdata == 0) || a->MIPlevels != b->MIPlevels) return false;
+	return memcmp( a->fdata ? (void*)a->fdata : (void*)a->idata, b->fdata ? (void*)b->fdata : (void*)b->idata, TexelBytes( a ) ) == 0;
+}
+static uint64 ContentHash( HostMesh* mesh )
+{
+	if (mesh->contentHash) return mesh->contentHash;
+	uint64 hash = HashBytes( &mesh->geometryHint, sizeof( mesh->geometryHint ), 14695981039346656037ull );
+	hash = HashVector( mesh->vertices, hash ), hash = HashVector( mesh->vertexNormals, hash );
+	hash = HashVector( mesh->triangles, hash ), hash = HashVector( mesh->lightmapUVs, hash );
+	hash = HashVector( mesh->sharedVertices, hash ), hash = HashVector( mesh->indices, hash );
+	hash = HashVector( mesh->alphaFlags, hash );
+	return mesh->contentHash = hash ? hash : 1;
+}
+static bool SameContent( const HostMesh* a, const HostMesh* b )
+{
+	return a->geometryHint == b->geometryHint && SameVector( a->vertices, b->vertices ) && SameVector( a->vertexNormals, b->vertexNormals ) &&
+		SameVector( a->triangles, b->triangles ) && SameVector( a->lightmapUVs, b->lightmapUVs ) && SameVector( a->sharedVertices, b->sharedVertices ) &&
+		SameVector( a->indices, b->indices ) && SameVector( a->alphaFlags, b->alphaFlags );
+}
+static bool Shareable( const HostTexture* texture )
+{
+	// placeholders and textures that are still loading get their final pixels later
+	return (texture->idata || texture->fdata) && !(texture->flags & (HostTexture::PLACEHOLDER | HostTexture::LOADING));
+}
+static bool Shareable( const HostMesh* mesh )
+{
+	// animated meshes get their own pose per instance; LOD chains and released data can not be compared
+	return mesh->joints.size() == 0 && mesh->poses.size() < 2 && mesh->lodMeshes.size() == 0 && !mesh->hostDataReleased && mesh->triangles.size() > 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::DeduplicateImports                                              |
+//  |  Textures and meshes that were just imported from a glTF file, starting at  |
+//  |  textureBase and meshBase, are compared by content with the existing ones   |
+//  |  and with each other. A duplicate is deleted and its users are redirected   |
+//  |  to the first copy; the remaining new objects are renumbered without gaps.  |
+//  |  meshIDs receives the final ID for each glTF mesh index. Materials are      |
+//  |  kept: they can be edited one by one, so sharing them would be visible.     |
+//  |  Meshes can still be shared, as long as their triangles use the same        |
+//  |  material IDs, which is the case for meshes repeated within one file. LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::DeduplicateImports( const int textureBase, const int materialBase, const int meshBase, vector<int>& meshIDs )
+{
+	meshIDs.resize( meshes.size() - meshBase );
+	for (int s = (int)meshIDs.size(), i = 0; i < s; i++) meshIDs[i] = meshBase + i;
+#ifdef DEDUPLICATE
+	// textures
+	const int textureEnd = (int)textures.size();
+	vector<int> textureIDs( textureEnd - textureBase );
+	std::unordered_multimap<uint64, int> knownTextures;
+	for (int i = 0; i < textureBase; i++) if (Shareable( textures[i] )) knownTextures.insert( { ContentHash( textures[i] ), i } );
+	int keptTextures = textureBase;
+	for (int i = textureBase; i < textureEnd; i++)
+	{
+		HostTexture* texture = textures[i];
+		int match = -1;
+		if (Shareable( texture ))
+		{
+			const uint64 hash = ContentHash( texture );
+			for (auto range = knownTextures.equal_range( hash ); range.first != range.second && match == -1; range.first++)
+				if (SameContent( textures[range.first->second], texture )) match = range.first->second;
+			if (match == -1) knownTextures.insert( { hash, keptTextures } );
+		}
+		if (match > -1)
 		{
-			// overwrite an empty slot, created by deleting an instance
-			nodes[i] = newNode;
-			newNode->ID = i;
-			scene.push_back( i );
-			nodeListHoles--; // plugged one hole.
-			return i;
+			textures[match]->refCount += texture->refCount;
+			FREE64( texture->idata );
+			FREE64( texture->fdata );
+			delete texture;
+			textureIDs[i - textureBase] = match;
+			continue;
 		}
+		texture->ID = keptTextures;
+		textures[keptTextures] = texture;
+		textureIDs[i - textureBase] = keptTextures++;
 	}
-	// no empty slots available or found; make sure we don't look for them again.
-	nodeListHoles = 0;
-	// insert the new node at the end of the list
-	newNode->ID = (int)nodes.size();
-	nodes.push_back( newNode );
+	textures.resize( keptTextures );
+	for (int s = (int)materials.size(), i = materialBase; i < s; i++) for (auto& map : materials[i]->map)
+		if (map.textureID >= textureBase && map.textureID < textureEnd) map.textureID = textureIDs[map.textureID - textureBase];
+	// meshes
+	std::unordered_multimap<uint64, int> knownMeshes;
+	for (int i = 0; i < meshBase; i++) if (Shareable( meshes[i] )) knownMeshes.insert( { ContentHash( meshes[i] ), i } );
+	int keptMeshes = meshBase;
+	for (int s = (int)meshes.size(), i = meshBase; i < s; i++)
+	{
+		HostMesh* mesh = meshes[i];
+		int match = -1;
+		if (Shareable( mesh ))
+		{
+			const uint64 hash = ContentHash( mesh );
+			for (auto range = knownMeshes.equal_range( hash ); range.first != range.second && match == -1; range.first++)
+				if (SameContent( meshes[range.first->second], mesh )) match = range.first->second;
+			if (match == -1) knownMeshes.insert( { hash, keptMeshes } );
+		}
+		if (match > -1)
+		{
+			delete mesh;
+			meshIDs[i - meshBase] = match;
+			continue;
+		}
+		mesh->ID = keptMeshes;
+		meshes[keptMeshes] = mesh;
+		meshIDs[i - meshBase] = keptMeshes++;
+	}
+	const int sharedTextures = textureEnd - (int)textures.size(), sharedMeshes = (int)meshes.size() - keptMeshes;
+	meshes.resize( keptMeshes );
+	if (sharedTextures + sharedMeshes > 0) printf( "shared %i duplicate textures and %i duplicate meshes.\n", sharedTextures, sharedMeshes );
+#endif
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::AddInstance                                                     |
+//  |  Add an instance of an existing mesh to the scene. Slots of removed nodes   |
+//  |  are reused first.                                                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+int HostScene::AddInstance( const int meshId, const mat4& transform )
+{
+	HostNode* newNode = nodePool.New( meshId, transform );
+	if (freeNodes.size() > 0)
+	{
+		// overwrite an empty slot, created by deleting an instance
+		newNode->ID = freeNodes.back();
+		freeNodes.pop_back();
+		nodes[newNode->ID] = newNode;
+	}
+	else
+	{
+		// insert the new node at the end of the list
+		newNode->ID = (int)nodes.size();
+		nodes.push_back( newNode );
+	}
+	newNode->rootIdx = (int)scene.size();
 	scene.push_back( newNode->ID );
+	graphChanged = true;
+	journal.AddInstance( newNode->ID, meshId, transform );
 	return newNode->ID;
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::RemoveInstance                                                  |
-//  |  Remove an instance from the scene.                                   LH2'19|
+//  |  Remove an instance from the scene. Constant time: the node knows its       |
+//  |  position in the root list, and its node and instance slots go to the       |
+//  |  free lists.                                                          LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostScene::RemoveInstance( const int instId )
 {
-	// remove the instance from the scene graph
-	for( int s = (int)scene.size(), i = 0; i < s; i++ ) if (scene[i] == instId)
+	if (instId < 0 || instId >= nodes.size() || !nodes[instId]) return;
+	HostNode* node = nodes[instId];
+	// remove the instance from the scene graph; the last root takes its place
+	if (node->rootIdx > -1)
 	{
-		scene[i] = scene[s - 1];
+		const int lastRoot = scene.back();
+		scene[node->rootIdx] = lastRoot;
+		nodes[lastRoot]->rootIdx = node->rootIdx;
 		scene.pop_back();
-		break;
 	}
+	// the core hides the instance; other instances keep their slot
+	if (node->instanceID > -1) ReleaseInstanceSlot( node->instanceID );
 	// delete the instance
-	HostNode* node = nodes[instId];
 	nodes[instId] = 0; // safe; we only access the nodes vector indirectly.
-	delete node;
-	nodeListHoles++; // HostScene::AddInstance will fill up holes first.
+	nodePool.Delete( node );
+	freeNodes.push_back( instId ); // HostScene::AddInstance will fill up holes first.
+	graphChanged = true;
+	journal.RemoveInstance( instId );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::DetachNode                                                      |
+//  |  Remove a node from the list of roots, or from the children of its parent.  |
+//  |  The node itself stays, e.g. to be attached elsewhere.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::DetachNode( const int nodeId, const int parentId )
+{
+	HostNode* node = nodes[nodeId];
+	if (node->rootIdx > -1)
+	{
+		// the last root takes its place, as in RemoveInstance
+		const int lastRoot = scene.back();
+		scene[node->rootIdx] = lastRoot;
+		nodes[lastRoot]->rootIdx = node->rootIdx;
+		scene.pop_back();
+		node->rootIdx = -1;
+	}
+	else if (parentId > -1)
+	{
+		vector<int>& children = nodes[parentId]->childIdx;
+		children.erase( find( children.begin(), children.end(), nodeId ) );
+	}
+	graphChanged = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::BatchStaticNodes                                                |
+//  |  Static batching: merge small static mesh nodes into combined meshes, to    |
+//  |  reduce the number of instances in the top-level BVH. A node qualifies if   |
+//  |  it is a leaf, its mesh has at most maxNodeTriangles triangles, and it has  |
+//  |  no animation, skin, morph targets, LODs, curves, particles, emissive       |
+//  |  triangles or special visibility. Nodes are grouped by parent, by the cell  |
+//  |  of size cellSize that their bounds centre falls in, in parent space, and   |
+//  |  by the set of materials they use. Groups of two or more nodes become one   |
+//  |  node per maxBatchTriangles, under the same parent, with the geometry in    |
+//  |  parent space; batches thus follow a moving parent. The merged nodes are    |
+//  |  removed; GetBatchSource maps a picked triangle of a batch back to them.    |
+//  |  Meant to be called after import. Returns the number of nodes merged. LH2'19|
+//  +-----------------------------------------------------------------------------+
+int HostScene::BatchStaticNodes( const float cellSize, const int maxNodeTriangles, const int maxBatchTriangles )
+{
+	if (cellSize <= 0) return 0;
+	// parents, and nodes that are animated or used as joints
+	vector<int> parent( nodes.size(), -1 );
+	vector<bool> animated( nodes.size(), false );
+	for (auto node : nodes) if (node) for (int child : node->childIdx) parent[child] = node->ID;
+	for (auto anim : animations) for (auto channel : anim->channel) animated[channel->nodeIdx] = true;
+	for (auto skin : skins) for (int joint : skin->joints) animated[joint] = true;
+	// group the qualifying nodes
+	std::map<vector<int>, vector<int>> groups; // key: parent, cell x, y, z, then the sorted material list
+	for (auto node : nodes)
+	{
+		if (!node || node->meshID < 0 || animated[node->ID] || node->childIdx.size() > 0) continue;
+		if (node->skinID > -1 || node->weights.size() > 0 || node->hasLTris || node->visibility != VISIBLE_ALL) continue;
+		HostMesh* mesh = meshes[node->meshID];
+		if (mesh->isAnimated || mesh->joints.size() > 0 || mesh->poses.size() > 1 || mesh->lodMeshes.size() > 0) continue;
+		if (mesh->curves || mesh->particles || mesh->hostDataReleased || mesh->triangles.size() == 0) continue;
+		if ((int)mesh->triangles.size() > maxNodeTriangles) continue;
+		if (node->transformed) node->UpdateTransformFromTRS(), node->transformed = false;
+		if (mesh->bounds.w == 0) mesh->UpdateBounds();
+		const float3 centre = make_float3( node->localTransform * make_float4( make_float3( mesh->bounds ), 1 ) );
+		vector<int> key = { parent[node->ID], (int)floorf( centre.x / cellSize ), (int)floorf( centre.y / cellSize ), (int)floorf( centre.z / cellSize ) };
+		vector<int> materialSet = mesh->materialList;
+		sort( materialSet.begin(), materialSet.end() );
+		key.insert( key.end(), materialSet.begin(), materialSet.end() );
+		groups[key].push_back( node->ID );
+	}
+	// merge each group into one or more batches
+	int merged = 0;
+	for (auto& group : groups)
+	{
+		const vector<int>& members = group.second;
+		const int parentId = group.first[0];
+		for (int s = (int)members.size(), first = 0; first < s; )
+		{
+			// take nodes until the batch is full; a single node is left alone
+			int last = first, triCount = 0;
+			while (last < s && (last == first || triCount + (int)meshes[nodes[members[last]]->meshID]->triangles.size() <= maxBatchTriangles))
+				triCount += (int)meshes[nodes[members[last++]]->meshID]->triangles.size();
+			if (last - first < 2) { first = last; continue; }
+			HostMesh* batch = new HostMesh();
+			batch->name = "static batch";
+			batch->isAnimated = false;
+			bool indexed = true, lightmapped = true;
+			for (int i = first; i < last; i++)
+			{
+				const HostMesh* mesh = meshes[nodes[members[i]]->meshID];
+				indexed &= mesh->HasIndexedData(), lightmapped &= mesh->lightmapUVs.size() == mesh->triangles.size() * 3;
+			}
+			batch->triangles.reserve( triCount ), batch->vertices.reserve( triCount * 3 );
+			for (int i = first; i < last; i++)
+			{
+				HostNode* node = nodes[members[i]];
+				const HostMesh* mesh = meshes[node->meshID];
+				const mat4 T = node->localTransform;
+				mat4 N = T.Inverted().Transposed(); // normals use the inverse transpose
+				batch->batchSources.push_back( { node->name, node->meshID, T, (int)batch->triangles.size() } );
+				for (const HostTri& source : mesh->triangles)
+				{
+					HostTri tri = source;
+					tri.vertex0 = make_float3( T * make_float4( source.vertex0, 1 ) );
+					tri.vertex1 = make_float3( T * make_float4( source.vertex1, 1 ) );
+					tri.vertex2 = make_float3( T * make_float4( source.vertex2, 1 ) );
+					tri.vN0 = normalize( make_float3( N * make_float4( source.vN0, 0 ) ) );
+					tri.vN1 = normalize( make_float3( N * make_float4( source.vN1, 0 ) ) );
+					tri.vN2 = normalize( make_float3( N * make_float4( source.vN2, 0 ) ) );
+					const float3 Nf = normalize( make_float3( N * make_float4( source.Nx, source.Ny, source.Nz, 0 ) ) );
+					tri.Nx = Nf.x, tri.Ny = Nf.y, tri.Nz = Nf.z;
+					tri.T = normalize( make_float3( T * make_float4( source.T, 0 ) ) );
+					tri.B = normalize( make_float3( T * make_float4( source.B, 0 ) ) );
+					// texel density changes with the area of the triangle
+					const float oldArea = length( cross( source.vertex1 - source.vertex0, source.vertex2 - source.vertex0 ) );
+					const float newArea = length( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
+					if (oldArea > 0 && newArea > 0) tri.LOD += 0.5f * log2f( oldArea / newArea );
+					tri.ltriIdx = -1;
+					batch->triangles.push_back( tri );
+					batch->vertices.push_back( make_float4( tri.vertex0, 1 ) );
+					batch->vertices.push_back( make_float4( tri.vertex1, 1 ) );
+					batch->vertices.push_back( make_float4( tri.vertex2, 1 ) );
+				}
+				if (indexed)
+				{
+					const uint base = (uint)batch->sharedVertices.size();
+					for (const float4& v : mesh->sharedVertices) batch->sharedVertices.push_back( make_float4( make_float3( T * make_float4( make_float3( v ), 1 ) ), v.w ) );
+					for (uint index : mesh->indices) batch->indices.push_back( base + index );
+				}
+				if (lightmapped) batch->lightmapUVs.insert( batch->lightmapUVs.end(), mesh->lightmapUVs.begin(), mesh->lightmapUVs.end() );
+			}
+			batch->ID = (int)meshes.size();
+			meshes.push_back( batch );
+			batch->BuildMaterialList();
+			batch->UpdateBounds();
+			// replace the nodes by a single one
+			for (int i = first; i < last; i++)
+			{
+				DetachNode( members[i], parentId );
+				RemoveInstance( members[i] );
+			}
+			const int batchNode = AddInstance( batch->ID, mat4() );
+			nodes[batchNode]->name = "static batch";
+			if (parentId > -1)
+			{
+				DetachNode( batchNode, -1 );
+				nodes[parentId]->childIdx.push_back( batchNode );
+			}
+			merged += last - first;
+			first = last;
+		}
+	}
+	if (merged > 0) printf( "merged %i static nodes into batches.\n", merged );
+	return merged;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::GetBatchSource                                                  |
+//  |  For a triangle of a static batch: the merged node it came from, and its    |
+//  |  index in the mesh of that node. Returns 0 if the node is no batch.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+const HostMesh::BatchSource* HostScene::GetBatchSource( const int nodeId, const int triId, int* sourceTriId )
+{
+	if (nodeId < 0 || nodeId >= nodes.size() || !nodes[nodeId] || nodes[nodeId]->meshID < 0 || triId < 0) return 0;
+	const vector<HostMesh::BatchSource>& sources = meshes[nodes[nodeId]->meshID]->batchSources;
+	if (sources.size() == 0) return 0;
+	// last source that starts at or before the triangle
+	auto source = upper_bound( sources.begin(), sources.end(), triId, []( const int t, const HostMesh::BatchSource& b ) { return t < b.firstTriangle; } ) - 1;
+	if (sourceTriId) *sourceTriId = triId - source->firstTriangle;
+	return &*source;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::SetMeshLOD                                                      |
+//  |  Register lodMeshId as a coarser version of meshId, to be used for nodes    |
+//  |  whose bounding sphere covers less than projectedSize of the screen         |
+//  |  height. The LOD mesh is a regular mesh (e.g. from AddMesh) that is not     |
+//  |  instanced itself. Animated meshes always use the full mesh.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::SetMeshLOD( const int meshId, const int lodMeshId, const float projectedSize )
+{
+	if (meshId < 0 || meshId >= meshes.size() || lodMeshId < 0 || lodMeshId >= meshes.size() || meshId == lodMeshId) return;
+	HostMesh* mesh = meshes[meshId];
+	// keep the levels sorted from fine to coarse, i.e. by decreasing projected size
+	int pos = 0;
+	while (pos < mesh->lodSizes.size() && mesh->lodSizes[pos] > projectedSize) pos++;
+	mesh->lodMeshes.insert( mesh->lodMeshes.begin() + pos, lodMeshId );
+	mesh->lodSizes.insert( mesh->lodSizes.begin() + pos, projectedSize );
+	if (mesh->bounds.w == 0) mesh->UpdateBounds();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::ClaimInstanceSlot                                               |
+//  |  Obtain a slot in the instance array for a mesh node. A node keeps its      |
+//  |  slot until it leaves the scene graph, so the core receives updates for     |
+//  |  the changed instances only.                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+int HostScene::ClaimInstanceSlot( const int nodeIdx )
+{
+	if (freeInstances.size() == 0)
+	{
+		instances.push_back( nodeIdx );
+		return (int)instances.size() - 1;
+	}
+	const int slot = freeInstances.back();
+	freeInstances.pop_back();
+	instances[slot] = nodeIdx;
+	return slot;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::ReleaseInstanceSlot                                             |
+//  |  Return a slot to the free list; the core is told at the next sync.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::ReleaseInstanceSlot( const int slot )
+{
+	instances[slot] = -1;
+	freeInstances.push_back( slot );
+	removedInstances.push_back( slot );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -424,8 +1404,36 @@ int HostScene::FindOrCreateTexture( const string& origin, const uint modFlags )
 		texture->refCount++;
 		return texture->ID;
 	}
+	// another scene may have loaded it; share its pixels, as textures do not free them
+	for (HostScene* other : allScenes) if (other != active) for (auto texture : other->parked.textures)
+		if (texture->Equals( origin, modFlags ) && !(texture->flags & (HostTexture::PLACEHOLDER | HostTexture::LOADING)))
+		{
+			HostTexture* shared = new HostTexture( *texture );
+			shared->ID = (int)textures.size(), shared->refCount = 1;
+			shared->MarkAsDirty(); // the core of this scene does not have it yet
+			textures.push_back( shared );
+			return shared->ID;
+		}
+#ifdef LAZYTEXTURES
+	// nothing found, add a placeholder; UpdateTextures loads the texture once it is used
+	if (!FileExists( origin.c_str() ))
+	{
+		char error[1024];
+		sprintf_s( error, "File not found: %s", origin.c_str() );
+		FatalError( __FILE__, __LINE__, error );
+	}
+	HostTexture* newTexture = new HostTexture();
+	newTexture->origin = origin;
+	newTexture->mods = modFlags;
+	newTexture->flags = HostTexture::PLACEHOLDER;
+	newTexture->ID = (int)textures.size();
+	textures.push_back( newTexture );
+	deferredTextures++;
+	return newTexture->ID;
+#else
 	// nothing found, create a new texture
 	return CreateTexture( origin, modFlags );
+#endif
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -455,16 +1463,32 @@ int HostScene::FindOrCreateMaterial( const string& name )
 int HostScene::GetTriangleMaterial( const int nodeid, const int triid )
 {
 	if (triid == -1) return -1;
-	return meshes[nodes[nodeid]->meshID]->triangles[triid].material;
+	return meshes[nodes[nodeid]->meshID]->triangleMaterials[triid];
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  HostScene::GetTriangleMaterial                                             |
-//  |  Find the ID of a material with the specified name.                   LH2'19|
+//  |  HostScene::BuildMaterialNameIndex                                          |
+//  |  Sort the material indices by name, for FindMaterialID.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::BuildMaterialNameIndex()
+{
+	materialNameIndex.resize( materials.size() );
+	for (int s = (int)materials.size(), i = 0; i < s; i++) materialNameIndex[i] = i;
+	stable_sort( materialNameIndex.begin(), materialNameIndex.end(), []( const int a, const int b ) { return materials[a]->name < materials[b]->name; } );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::FindMaterialID                                                  |
+//  |  Find the ID of a material with the specified name. Materials can be        |
+//  |  renamed at any time, so a name that the index misses is searched for the   |
+//  |  old way; if that finds it, the index is stale and gets rebuilt.      LH2'19|
 //  +-----------------------------------------------------------------------------+
 int HostScene::FindMaterialID( const char* name )
 {
-	for (auto material : materials) if (material->name.compare( name ) == 0) return material->ID;
+	if (materialNameIndex.size() != materials.size()) BuildMaterialNameIndex();
+	auto first = lower_bound( materialNameIndex.begin(), materialNameIndex.end(), name, []( const int i, const char* n ) { return materials[i]->name.compare( n ) < 0; } );
+	if (first != materialNameIndex.end() && materials[*first]->name.compare( name ) == 0) return materials[*first]->ID;
+	for (auto material : materials) if (material->name.compare( name ) == 0) { BuildMaterialNameIndex(); return material->ID; }
 	return -1;
 }
 
@@ -474,7 +1498,7 @@ int HostScene::FindMaterialID( const char* name )
 //  +-----------------------------------------------------------------------------+
 int HostScene::FindNode( const char* name )
 {
-	for (auto node : nodes) if (node->name.compare( name ) == 0) return node->ID;
+	for (auto node : nodes) if (node && node->name.compare( name ) == 0) return node->ID;
 	return -1;
 }
 
@@ -486,6 +1510,23 @@ void HostScene::SetNodeTransform( const int nodeId, const mat4& transform )
 {
 	if (nodeId < 0 || nodeId >= nodes.size()) return;
 	nodes[nodeId]->localTransform = transform;
+	nodes[nodeId]->MarkAsDirty();
+	journal.NodeTransform( nodeId, transform );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::SetNodeVisibility                                               |
+//  |  Set the ray types that see the mesh of the specified node, as VISIBLE_*    |
+//  |  flags; e.g. VISIBLE_PRIMARY | VISIBLE_SECONDARY for geometry that casts    |
+//  |  no shadows. Children are not affected.                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::SetNodeVisibility( const int nodeId, const uint visibility )
+{
+	if (nodeId < 0 || nodeId >= nodes.size() || !nodes[nodeId]) return;
+	if (nodes[nodeId]->visibility == visibility) return;
+	nodes[nodeId]->visibility = visibility;
+	nodes[nodeId]->instanceDirty = true;
+	journal.NodeVisibility( nodeId, visibility );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -496,6 +1537,7 @@ void HostScene::ResetAnimation( const int animId )
 {
 	if (animId < 0 || animId >= animations.size()) return;
 	animations[animId]->Reset();
+	journal.ResetAnimation( animId );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -506,6 +1548,7 @@ void HostScene::UpdateAnimation( const int animId, const float dt )
 {
 	if (animId < 0 || animId >= animations.size()) return;
 	animations[animId]->Update( dt );
+	journal.UpdateAnimation( animId, dt );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -521,13 +1564,99 @@ int HostScene::CreateTexture( const string& origin, const uint modFlags )
 	return (int)textures.size() - 1;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::PreloadTextures                                                 |
+//  |  Load the requested textures that do not exist yet in parallel, and add     |
+//  |  them to the list in the order of the request. Their refCount starts at     |
+//  |  zero: the FindOrCreateTexture call that picks them up counts as the first  |
+//  |  use.                                                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::PreloadTextures( const vector<string>& origins, const vector<uint>& modFlags )
+{
+#ifdef LAZYTEXTURES
+	return; // textures are loaded on first use instead, see UpdateTextures
+#endif
+	// find unique requests that are not yet in the scene
+	vector<int> todo;
+	for (int s = (int)origins.size(), i = 0; i < s; i++)
+	{
+		bool found = false;
+		for (auto texture : textures) if (texture->Equals( origins[i], modFlags[i] )) { found = true; break; }
+		for (int j : todo) if (origins[j] == origins[i] && modFlags[j] == modFlags[i]) found = true;
+		if (!found) todo.push_back( i );
+	}
+	// load
+	vector<HostTexture*> loaded( todo.size() );
+	RunJobs( (int)todo.size(), [&]( const int i ) { loaded[i] = new HostTexture( origins[todo[i]].c_str(), modFlags[todo[i]] ); } );
+	for (auto texture : loaded)
+	{
+		texture->ID = (int)textures.size();
+		texture->refCount = 0;
+		textures.push_back( texture );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::UpdateTextures                                                  |
+//  |  Replace placeholders by the actual textures. Textures are loaded in the    |
+//  |  background once a material of a mesh that is in the scene graph uses       |
+//  |  them; finished loads are swapped in, so the next texture synchronization   |
+//  |  uploads them. Placeholders only exist with LAZYTEXTURES.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostScene::UpdateTextures()
+{
+	if (deferredTextures == 0 && textureLoads.size() == 0) return;
+	// placeholders get their pixels here: the NORMALMAP flag is set after FindOrCreateTexture
+	for (auto texture : textures) if ((texture->flags & HostTexture::PLACEHOLDER) && !texture->idata) texture->LoadPlaceholder();
+	// start loading the textures used by materials of meshes in the scene graph
+	if (deferredTextures > 0)
+	{
+		vector<bool> used( materials.size(), false );
+		for (auto node : nodes) if (node && node->meshID > -1) for (int m : meshes[node->meshID]->materialList) used[m] = true;
+		for (int s = (int)materials.size(), i = 0; i < s; i++) if (used[i]) for (int j = 0; j < 11; j++)
+		{
+			const int textureID = materials[i]->map[j].textureID;
+			if (textureID < 0) continue;
+			HostTexture* texture = textures[textureID];
+			if ((texture->flags & (HostTexture::PLACEHOLDER | HostTexture::LOADING)) != HostTexture::PLACEHOLDER) continue;
+			texture->flags |= HostTexture::LOADING;
+			deferredTextures--;
+			TextureLoad* load = new TextureLoad();
+			load->textureID = textureID;
+			const string origin = texture->origin;
+			const uint mods = texture->mods;
+			JobSystem::Submit( [load, origin, mods]() { load->texture = new HostTexture( origin.c_str(), mods ); }, &load->done );
+			textureLoads.push_back( load );
+		}
+	}
+	// swap in the textures that finished loading
+	for (int i = 0; i < (int)textureLoads.size(); i++) if (textureLoads[i]->done.Finished())
+	{
+		TextureLoad* load = textureLoads[i];
+		HostTexture* texture = textures[load->textureID];
+		HostTexture* loaded = load->texture;
+		FREE64( texture->idata );
+		texture->width = loaded->width, texture->height = loaded->height;
+		texture->idata = loaded->idata, texture->fdata = loaded->fdata;
+		texture->flags = loaded->flags | (texture->flags & HostTexture::NORMALMAP);
+		texture->MarkAsDirty();
+		loaded->idata = 0, loaded->fdata = 0;
+		delete loaded;
+		// materials check for alpha when they are created; the placeholder had none
+		if (texture->flags & HostTexture::HASALPHA) for (auto material : materials)
+			if (material->map[TEXTURE0].textureID == load->textureID) material->flags |= HostMaterial::HASALPHA, material->MarkAsDirty();
+		delete load;
+		textureLoads.erase( textureLoads.begin() + i-- );
+	}
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::AddMaterial                                                     |
 //  |  Create a material, with a limited set of parameters.                 LH2'19|
 //  +-----------------------------------------------------------------------------+
 int HostScene::AddMaterial( const float3 color )
 {
-	HostMaterial* material = new HostMaterial();
+	HostMaterial* material = materialPool.New();
 	material->color = color;
 	material->ID = (int)materials.size();
 	materials.push_back( material );
@@ -19,10 +19,97 @@
 
 namespace lighthouse2 {
 
+#define POOLBLOCKSIZE	256		// objects per block of a HostPool
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostPool                                                                   |
+//  |  Typed arena for the nodes, materials and light triangles of a scene.       |
+//  |  Objects are constructed in blocks of contiguous memory, in creation        |
+//  |  order, so a pass over e.g. all nodes touches few cache lines and pages.    |
+//  |  Blocks never move: the scene vectors keep pointers into them. Slots of     |
+//  |  deleted objects are reused first. Live objects are not destructed with     |
+//  |  the pool; the scene deletes those.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <class T> class HostPool
+{
+public:
+	HostPool() = default;
+	HostPool( HostPool&& other ) { Swap( other ); }
+	HostPool& operator=( HostPool&& other ) { Swap( other ); return *this; }
+	~HostPool() { for (void* block : blocks) FREE64( block ); }
+	template <class... A> T* New( A&&... args ) { return new (Slot()) T( std::forward<A>( args )... ); }
+	void Delete( T* object ) { if (object) object->~T(), freeSlots.push_back( object ); }
+	// Reserve: the next count objects that do not reuse a slot are allocated contiguously, e.g. during import
+	void Reserve( const size_t count ) { if (count > (size_t)(last - next)) NewBlock( max( (size_t)POOLBLOCKSIZE, count ) ); }
+	void Swap( HostPool& other ) { blocks.swap( other.blocks ), freeSlots.swap( other.freeSlots ), std::swap( next, other.next ), std::swap( last, other.last ); }
+private:
+	T* Slot()
+	{
+		if (freeSlots.size() > 0) { T* slot = freeSlots.back(); freeSlots.pop_back(); return slot; }
+		if (next == last) NewBlock( POOLBLOCKSIZE );
+		return next++;
+	}
+	void NewBlock( const size_t count ) { next = (T*)MALLOC64( count * sizeof( T ) ), last = next + count, blocks.push_back( next ); }
+	vector<void*> blocks;					// 64-byte aligned storage; the tail of a block may be unused
+	vector<T*> freeSlots;					// slots of deleted objects
+	T* next = 0, *last = 0;					// unused part of the last block
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  SceneJournal                                                               |
+//  |  Record of the scene edits since a sequence number, for processes that      |
+//  |  hold a copy of the same scene: node transforms and visibility, instances   |
+//  |  that were added or removed, material parameters and animation time steps.  |
+//  |  Serialize writes the entries after a sequence number to a binary stream;   |
+//  |  Apply replays such a stream on the active scene of another process. Node   |
+//  |  and material ids must match on both sides; Apply fails when they do not,   |
+//  |  and the copy then needs the full scene again.                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+class HostMaterial;
+class SceneJournal
+{
+public:
+	enum
+	{
+		NODETRANSFORM = 1,						// node id, mat4
+		NODEVISIBILITY,							// node id, VISIBLE_* flags
+		ADDINSTANCE,							// node id returned by AddInstance, mesh id, mat4
+		REMOVEINSTANCE,							// node id
+		MATERIAL,								// material index, parameters; names and origins are not journaled
+		RESETANIMATION,							// animation id
+		UPDATEANIMATION							// animation id, time step
+	};
+	void Enable( const bool on ) { enabled = on; }
+	bool Enabled() const { return enabled; }
+	uint64_t Sequence() const { return first + offsets.size() - 2; } // sequence number of the last entry; 0 if there is none
+	void Trim( const uint64_t upTo );			// forget the entries up to and including a sequence number
+	// recording; ignored unless the journal is enabled
+	void NodeTransform( const int nodeId, const mat4& transform ) { if (enabled) Add( NODETRANSFORM, nodeId, &transform, sizeof( mat4 ) ); }
+	void NodeVisibility( const int nodeId, const uint visibility ) { if (enabled) Add( NODEVISIBILITY, nodeId, &visibility, 4 ); }
+	void AddInstance( const int nodeId, const int meshId, const mat4& transform );
+	void RemoveInstance( const int nodeId ) { if (enabled) Add( REMOVEINSTANCE, nodeId, 0, 0 ); }
+	void Material( const int matIdx, const HostMaterial* material );
+	void ResetAnimation( const int animId ) { if (enabled) Add( RESETANIMATION, animId, 0, 0 ); }
+	void UpdateAnimation( const int animId, const float dt ) { if (enabled) Add( UPDATEANIMATION, animId, &dt, 4 ); }
+	// transfer
+	bool Serialize( const uint64_t since, vector<uchar>& stream ) const; // false if entries after since were trimmed
+	static bool Apply( const uchar* stream, const size_t size, uint64_t* sequence = 0 );
+private:
+	struct Entry { ushort type, bytes; int id; };	// followed by bytes of payload
+	void Add( const ushort type, const int id, const void* payload, const size_t bytes );
+	vector<uchar> data;							// the entries, in order
+	vector<size_t> offsets = { 0 };				// per entry: its offset in data, plus the end of data
+	uint64_t first = 1;							// sequence number of the first entry in data
+	bool enabled = false;
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene                                                                  |
 //  |  Module for scene I/O and host-side management.                             |
-//  |  This is a pure static class; we will not have more than one scene.   LH2'19|
+//  |  The static members hold the active scene, which the rest of the system     |
+//  |  works on. Each HostScene object is a scene; Activate makes it the active   |
+//  |  one, parking the data of the previous one in that object. Scenes share     |
+//  |  the pixels of textures that they load from the same file.            LH2'19|
 //  +-----------------------------------------------------------------------------+
 class HostNode;
 class HostScene
@@ -31,27 +118,46 @@ public:
 	// constructor / destructor
 	HostScene();
 	~HostScene();
-	// serialization / deserialization
+	// serialization / deserialization; files with the .xml extension use XML, others the binary material library
 	static void SerializeMaterials( const char* xmlFile );
 	static void DeserializeMaterials( const char* xmlFile );
+	static bool SaveMaterialLibrary( const char* libFile );
+	static bool LoadMaterialLibrary( const char* libFile );
 	// methods
+	void Activate();
+	static HostScene* Active() { return active; }
 	static void Init();
 	static int FindOrCreateTexture( const string& origin, const uint modFlags = 0 );
 	static int CreateTexture( const string& origin, const uint modFlags = 0 );
+	static void PreloadTextures( const vector<string>& origins, const vector<uint>& modFlags );
+	static void UpdateTextures();
 	static int FindOrCreateMaterial( const string& name );
 	static int GetTriangleMaterial( const int nodeid, const int triid );
 	static int FindMaterialID( const char* name );
 	static int FindNode( const char* name );
 	static void SetNodeTransform( const int nodeId, const mat4& transform );
+	static void SetNodeVisibility( const int nodeId, const uint visibility );
 	static void ResetAnimation( const int animId );
 	static void UpdateAnimation( const int animId, const float dt );
 	static int AnimationCount() { return (int)animations.size(); }
 	// scene construction / maintenance
 	static int AddMesh( const char* objFile, const char* dir, const float scale = 1.0f );
 	static void AddScene( const char* sceneFile, const char* dir, const mat4& transform );
+	static bool LoadSceneCache( const char* cacheFile, const int textureCount, const int meshCount );
+	static void SaveSceneCache( const char* cacheFile, const int textureBase, const int meshBase );
+	static bool ReloadMeshFromCache( HostMesh* mesh );
+	static void DeduplicateImports( const int textureBase, const int materialBase, const int meshBase, vector<int>& meshIDs );
 	static int AddInstance( const int meshId, const mat4& transform );
+	static void SetMeshLOD( const int meshId, const int lodMeshId, const float projectedSize );
 	static void RemoveInstance( const int instId );
+	static int BatchStaticNodes( const float cellSize, const int maxNodeTriangles = 1024, const int maxBatchTriangles = 65536 );
+	static const HostMesh::BatchSource* GetBatchSource( const int nodeId, const int triId, int* sourceTriId = 0 );
+	static const vector<int>& FreeNodes() { return freeNodes; } // slots that AddInstance fills, last one first
+	static int ClaimInstanceSlot( const int nodeIdx );
+	static void ReleaseInstanceSlot( const int slot );
 	static int AddQuad( const float3 N, const float3 pos, const float width, const float height, const int material, const int meshID = -1 );
+	static int AddCurves( HostCurves* curves, const int sides = 4 );
+	static int AddParticles( HostParticles* particles );
 	static int AddMaterial( const float3 color );
 	static int AddPointLight( const float3 pos, const float3 radiance, bool enabled = true );
 	static int AddSpotLight( const float3 pos, const float3 direction, const float inner, const float outer, const float3 radiance, bool enabled = true );
@@ -63,16 +169,59 @@ public:
 	static vector<HostMesh*> meshes;
 	static vector<HostSkin*> skins;
 	static vector<HostAnimation*> animations;
-	static vector<int> instances; // list of indices of nodes that point to a mesh
+	static vector<int> instances; // per instance slot: index of the node that owns it, or -1 for a free slot
+	static vector<int> removedInstances; // slots released since the last sync; see RenderSystem::UpdateSceneGraph
 	static vector<HostMaterial*> materials;
+	static vector<vector<int>> materialMeshes; // per material: IDs of the meshes that use it, see HostMesh::BuildMaterialList
 	static vector<HostTexture*> textures;
 	static vector<HostAreaLight*> areaLights;
 	static vector<HostPointLight*> pointLights;
 	static vector<HostSpotLight*> spotLights;
 	static vector<HostDirectionalLight*> directionalLights;
+	static HostPool<HostNode> nodePool; // storage of the objects in nodes, materials and areaLights; use New and Delete
+	static HostPool<HostMaterial> materialPool;
+	static HostPool<HostAreaLight> lightPool;
 	static Camera* camera;
+	static bool graphChanged; // nodes were added to or removed from the scene graph; see RenderSystem::UpdateSceneGraph
+	static SceneJournal journal; // edits for remote copies of the scene; disabled by default
 private:
-	static int nodeListHoles; // zero if no instance deletions occurred; adding instances will be faster.
+	struct TextureLoad { int textureID; HostTexture* texture = 0; WaitGroup done; }; // see UpdateTextures
+	static vector<int> freeNodes; // empty entries in nodes, left by RemoveInstance; reused by AddInstance
+	static vector<int> freeInstances; // free entries in instances, reused by ClaimInstanceSlot
+	static vector<TextureLoad*> textureLoads; // background loads of textures that replace placeholders
+	static int deferredTextures; // number of placeholder textures for which loading did not start yet
+	static vector<int> materialNameIndex; // indices in materials, sorted by name; see FindMaterialID
+	static void BuildMaterialNameIndex();
+	static void DetachNode( const int nodeId, const int parentId );
+	// multiple scenes: the data of an inactive scene, see Activate
+	void Swap();
+	struct Parked
+	{
+		HostSkyDome* sky = 0;
+		vector<int> scene, instances, removedInstances, freeNodes, freeInstances;
+		vector<HostNode*> nodes;
+		vector<HostMesh*> meshes;
+		vector<HostSkin*> skins;
+		vector<HostAnimation*> animations;
+		vector<HostMaterial*> materials;
+		vector<vector<int>> materialMeshes;
+		vector<HostTexture*> textures;
+		vector<HostAreaLight*> areaLights;
+		vector<HostPointLight*> pointLights;
+		vector<HostSpotLight*> spotLights;
+		vector<HostDirectionalLight*> directionalLights;
+		HostPool<HostNode> nodePool;
+		HostPool<HostMaterial> materialPool;
+		HostPool<HostAreaLight> lightPool;
+		Camera* camera = 0;
+		bool graphChanged = true;
+		vector<TextureLoad*> textureLoads;
+		int deferredTextures = 0;
+		vector<int> materialNameIndex;
+		SceneJournal journal;
+	} parked;
+	static HostScene* active; // the scene whose data is in the static members
+	static vector<HostScene*> allScenes; // all scene objects, active or not
 };
 
 } // namespace lighthouse2
@@ -54,6 +54,59 @@ HostSkyDome::~HostSkyDome()
 	FREE64( pdf );
 	FREE64( cdf );
 	FREE64( columncdf );
+	FREE64( importanceCDF );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostSkyDome::BuildImportanceCDF                                            |
+//  |  Build the marginal and conditional CDFs that the cores use to sample the   |
+//  |  sky in proportion to its luminance. The sky is divided in IBLWIDTH by      |
+//  |  IBLHEIGHT cells; the weight of a cell is the average luminance of its      |
+//  |  pixels, scaled by sin(theta) to account for the equirectangular mapping.   |
+//  |  Layout: IBLHEIGHT + 1 marginal values, then for each row IBLWIDTH + 1      |
+//  |  conditional values. All CDFs are normalized.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostSkyDome::BuildImportanceCDF()
+{
+	FREE64( importanceCDF );
+	importanceCDF = (float*)MALLOC64( SKYCDFSIZE * sizeof( float ) );
+	float* marginal = importanceCDF, *conditional = importanceCDF + IBLHEIGHT + 1;
+	double total = 0;
+	marginal[0] = 0;
+	for (int y = 0; y < IBLHEIGHT; y++)
+	{
+		const float sinTheta = sinf( ((float)y + 0.5f) * (PI / IBLHEIGHT) );
+		const int y0 = (y * height) / IBLHEIGHT, y1 = max( y0 + 1, ((y + 1) * height) / IBLHEIGHT );
+		float* row = conditional + y * (IBLWIDTH + 1);
+		double rowSum = 0;
+		row[0] = 0;
+		for (int x = 0; x < IBLWIDTH; x++)
+		{
+			const int x0 = (x * width) / IBLWIDTH, x1 = max( x0 + 1, ((x + 1) * width) / IBLWIDTH );
+			double sum = 0;
+			for (int v = y0; v < y1; v++) for (int u = x0; u < x1; u++)
+			{
+				const float3 texel = pixels[u + v * width];
+				sum += texel.x * 0.2126f + texel.y * 0.7152f + texel.z * 0.0722f;
+			}
+			rowSum += max( 0.0, sum / ((x1 - x0) * (y1 - y0)) ) * sinTheta;
+			row[x + 1] = (float)rowSum;
+		}
+		// normalize the row; a black row gets a uniform cdf, but is never selected
+		for (int x = 1; x <= IBLWIDTH; x++) row[x] = rowSum > 0 ? (float)(row[x] / rowSum) : ((float)x / IBLWIDTH);
+		total += rowSum;
+		marginal[y + 1] = (float)total;
+	}
+	if (total <= 0)
+	{
+		// a black sky will not be sampled
+		FREE64( importanceCDF );
+		importanceCDF = 0;
+		return;
+	}
+	for (int y = 1; y <= IBLHEIGHT; y++) marginal[y] = (float)(marginal[y] / total);
+	marginal[IBLHEIGHT] = 1;
+	for (int y = 0; y < IBLHEIGHT; y++) conditional[y * (IBLWIDTH + 1) + IBLWIDTH] = 1;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -65,7 +118,9 @@ void HostSkyDome::Load()
 	Timer timer;
 	timer.reset();
 	FREE64( pixels ); // just in case we're reloading
-	pixels = 0;
+	FREE64( importanceCDF );
+	pixels = 0, importanceCDF = 0;
+	bool cdfCached = false;
 	char t[] = "data/sky_15.hdr" /* skyBoxPath */, *p;
 #ifdef TESTSKY
 	// red / green / blue test environment
@@ -85,12 +140,38 @@ void HostSkyDome::Load()
 		fopen_s( &f, t, "rb" );
 		if (f)
 		{
-			printf( "loading cached hdr data... " );
-			fread( &width, 4, 1, f );
-			fread( &height, 4, 1, f );
-			pixels = (float3*)MALLOC64( width * height * sizeof( float3 ) );
-			fread( pixels, sizeof( float ), width * height * 3, f );
+			// version, width, height, format (0: float, 1: half), the compressed pixels, cdf size, the compressed cdf
+			uint header[4] = {};
+			if (fread( header, 4, 4, f ) == 4 && header[0] == SKYCACHEVERSION && header[3] < 2)
+			{
+				printf( "loading cached hdr data... " );
+				width = header[1], height = header[2];
+				const size_t count = (size_t)width * height * 3;
+				pixels = (float3*)MALLOC64( count * sizeof( float ) );
+				bool valid;
+				if (header[3] == 1)
+				{
+					vector<half> packed( count );
+					valid = ReadCompressedBlocks( f, packed.data(), count * sizeof( half ) );
+					float* dst = (float*)pixels;
+					if (valid) JobSystem::ParallelFor( (int)count, [&]( const int first, const int last ) {
+						for (int i = first; i < last; i++) dst[i] = (float)packed[i];
+					}, 65536 );
+				}
+				else valid = ReadCompressedBlocks( f, pixels, count * sizeof( float ) );
+				// importance sampling data, if the file was written with it
+				int cdfSize = -1;
+				if (!valid) FREE64( pixels ), pixels = 0;
+				else if (fread( &cdfSize, 4, 1, f ) == 1 && cdfSize == SKYCDFSIZE)
+				{
+					importanceCDF = (float*)MALLOC64( SKYCDFSIZE * sizeof( float ) );
+					cdfCached = ReadCompressedBlocks( f, importanceCDF, SKYCDFSIZE * sizeof( float ) );
+					if (!cdfCached) FREE64( importanceCDF ), importanceCDF = 0;
+				}
+				else if (cdfSize == 0) cdfCached = true; // black sky
+			}
 			fclose( f );
+			if (!pixels) memcpy( strstr( t, ".bin" ), ".hdr", 4 ); // outdated or damaged cache
 		}
 		else memcpy( strstr( t, ".bin" ), ".hdr", 4 );
 	}
@@ -100,6 +181,7 @@ void HostSkyDome::Load()
 		return;
 	}
 #endif
+	bool writeCache = false;
 	if (!pixels)
 	{
 		// load skydome from original .hdr file
@@ -114,15 +196,41 @@ void HostSkyDome::Load()
 		pixels = (float3*)MALLOC64( width * height * sizeof( float3 ) );
 		for (int y = 0; y < height; y++) memcpy( pixels + y * width, FreeImage_GetScanLine( dib, height - 1 - y ), width * sizeof( float3 ) );
 		FreeImage_Unload( dib );
-		// save skydome to binary file, .hdr is slow to load
-		FILE* f;
 		memcpy( strstr( t, ".hdr" ), ".bin", 4 );
+		writeCache = true;
+	}
+	// importance sampling: build the cdf if the cache did not provide it
+	if (!cdfCached) BuildImportanceCDF(), writeCache = true;
+#ifndef TESTSKY
+	if (writeCache)
+	{
+		// save skydome and its cdf to binary file, .hdr is slow to load
+		FILE* f;
 		fopen_s( &f, t, "wb" );
-		fwrite( &width, 4, 1, f );
-		fwrite( &height, 4, 1, f );
-		fwrite( pixels, 4, width * height * 3, f );
-		fclose( f );
+		if (f)
+		{
+			const size_t count = (size_t)width * height * 3;
+#ifdef HALFSKYCACHE
+			const uint header[4] = { SKYCACHEVERSION, (uint)width, (uint)height, 1 };
+			vector<half> packed( count );
+			const float* src = (const float*)pixels;
+			JobSystem::ParallelFor( (int)count, [&]( const int first, const int last ) {
+				for (int i = first; i < last; i++) packed[i] = half( min( src[i], 65504.0f ) );
+			}, 65536 );
+			fwrite( header, 4, 4, f );
+			WriteCompressedBlocks( f, packed.data(), count * sizeof( half ) );
+#else
+			const uint header[4] = { SKYCACHEVERSION, (uint)width, (uint)height, 0 };
+			fwrite( header, 4, 4, f );
+			WriteCompressedBlocks( f, pixels, count * sizeof( float ) );
+#endif
+			const int cdfSize = importanceCDF ? SKYCDFSIZE : 0;
+			fwrite( &cdfSize, 4, 1, f );
+			if (importanceCDF) WriteCompressedBlocks( f, importanceCDF, SKYCDFSIZE * sizeof( float ) );
+			fclose( f );
+		}
 	}
+#endif
 #ifdef IBL
 	// convert to pdf
 	// see: https://www.scribd.com/document/134001376/Importance-Sampling-with-Infinite-Area-Light-Source
@@ -157,7 +265,7 @@ void HostSkyDome::Load()
 	}
 #endif
 	// done
-	dirty = true;
+	MarkAsDirty();
 	printf( "sky ready in %5.3fs.\n", timer.elapsed() );
 }
 
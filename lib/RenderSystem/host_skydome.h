@@ -29,6 +29,7 @@ public:
 	HostSkyDome();
 	~HostSkyDome();
 	void Load();
+	void BuildImportanceCDF();
 	// public data members
 	float3* pixels = nullptr;			// HDR texture data for sky dome
 	int width = 0;						// width of the sky texture
@@ -36,6 +37,7 @@ public:
 	float* cdf = nullptr;				// cdf for importance sampling
 	float* pdf = nullptr;				// pdf for importance sampling
 	float* columncdf = nullptr;			// column cdf for importance sampling
+	float* importanceCDF = nullptr;		// marginal cdf over IBLHEIGHT rows, followed by the conditional cdf per row; 0 for a black sky
 	TRACKCHANGES;						// add Changed(), MarkAsDirty() methods, see system.h
 };
 
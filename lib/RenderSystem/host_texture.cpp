@@ -14,6 +14,11 @@
 */
 
 #include "rendersystem.h"
+#include "zlib.h"
+
+#define PARALLELMIPSIZE		65536	// pixels; smaller MIP levels are reduced on the calling thread
+#define MIPBANDROWS			32		// rows per job for larger levels
+#define CONVERTCHUNK		65536	// pixels per job for sRGBtoLinear; smaller images are converted on the calling thread
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostTexture::HostTexture                                                   |
@@ -38,6 +43,7 @@ CoreTexDesc HostTexture::ConvertToCoreTexDesc()
 {
 	CoreTexDesc gpuTex;
 	assert( (fdata != 0) | (idata != 0) );
+	gpuTex.width = width, gpuTex.height = height;
 	if (fdata)
 	{
 		gpuTex.fdata = fdata;
@@ -53,17 +59,33 @@ CoreTexDesc HostTexture::ConvertToCoreTexDesc()
 		/* else gpuTex.storage = TexelStorage::ARGB32; default */
 		gpuTex.pixelCount = PixelsNeeded( width, height, MIPLEVELCOUNT );
 		gpuTex.MIPlevels = MIPLEVELCOUNT;
+		gpuTex.blocks = bcdata, gpuTex.blockCount = bcBlocks;
 	}
 	return gpuTex;
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  HostTexture::sRGBtoLinear                                                  |
-//  |  Convert sRGB data to linear color space.                             LH2'19|
+//  |  LinearizePixels                                                            |
+//  |  Square the color channels of pixels [first..last), leaving every fourth    |
+//  |  channel alone. Packed RGBA pixels are converted four at a time in SSE      |
+//  |  registers, with 16-bit products; the result is identical to the scalar     |
+//  |  loop, which handles other strides and the tail.                      LH2'19|
 //  +-----------------------------------------------------------------------------+
-void HostTexture::sRGBtoLinear( uchar* pixels, const uint size, const uint stride )
+static void LinearizePixels( uchar* pixels, uint first, const uint last, const uint stride )
 {
-	for (uint j = 0; j < size; j++)
+	if (stride == 4)
+	{
+		const __m128i zero = _mm_setzero_si128(), alphaMask = _mm_set1_epi32( 0xff000000 );
+		for (; first + 4 <= last; first += 4)
+		{
+			__m128i* p = (__m128i*)(pixels + first * 4);
+			const __m128i v = _mm_loadu_si128( p );
+			const __m128i lo = _mm_unpacklo_epi8( v, zero ), hi = _mm_unpackhi_epi8( v, zero );
+			const __m128i squared = _mm_packus_epi16( _mm_srli_epi16( _mm_mullo_epi16( lo, lo ), 8 ), _mm_srli_epi16( _mm_mullo_epi16( hi, hi ), 8 ) );
+			_mm_storeu_si128( p, _mm_or_si128( _mm_and_si128( alphaMask, v ), _mm_andnot_si128( alphaMask, squared ) ) );
+		}
+	}
+	for (uint j = first; j < last; j++)
 	{
 		pixels[j * stride + 0] = (pixels[j * stride + 0] * pixels[j * stride + 0]) >> 8;
 		pixels[j * stride + 1] = (pixels[j * stride + 1] * pixels[j * stride + 1]) >> 8;
@@ -71,6 +93,18 @@ void HostTexture::sRGBtoLinear( uchar* pixels, const uint size, const uint strid
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostTexture::sRGBtoLinear                                                  |
+//  |  Convert sRGB data to linear color space. Large images are converted in     |
+//  |  chunks of CONVERTCHUNK pixels on the job system.                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostTexture::sRGBtoLinear( uchar* pixels, const uint size, const uint stride )
+{
+	if (size < CONVERTCHUNK) { LinearizePixels( pixels, 0, size, stride ); return; }
+	const int chunkCount = (size + CONVERTCHUNK - 1) / CONVERTCHUNK;
+	RunJobs( chunkCount, [&]( const int chunk ) { LinearizePixels( pixels, chunk * CONVERTCHUNK, min( size, (uint)(chunk + 1) * CONVERTCHUNK ), stride ); } );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostTexture::Equals                                                        |
 //  |  Returns true if the fields that identify the texture are identical to the  |
@@ -96,34 +130,131 @@ int HostTexture::PixelsNeeded( const int width, const int height, const int MIPl
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  HostTexture::ConstructMIPmaps                                              |
-//  |  Generate MIP levels for a loaded texture.                            LH2'19|
+//  |  ReduceRows                                                                 |
+//  |  Box filter rows [y0..y1) of a MIP level from the level above it: color is  |
+//  |  the truncated average of a 2x2 block, alpha the minimum. Four pixels are   |
+//  |  reduced at a time in SSE registers, with 16-bit channels; the result is    |
+//  |  identical to the scalar tail loop.                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-void HostTexture::ConstructMIPmaps()
+static void ReduceRows( const uint* src, uint* dst, const int pw, const int w, const int y0, const int y1 )
 {
-	uint* src = (uint*)idata;
-	uint* dst = src + width * height;
-	int pw = width, w = width >> 1, ph = height, h = height >> 1;
-	for (int i = 1; i < MIPLEVELCOUNT; i++)
+	const __m128i zero = _mm_setzero_si128(), alphaMask = _mm_set_epi16( -1, 0, 0, 0, -1, 0, 0, 0 );
+	for (int y = y0; y < y1; y++)
 	{
-		// reduce
-		for (int y = 0; y < h; y++) for (int x = 0; x < w; x++)
+		const uint* row0 = src + (y * 2) * pw, *row1 = row0 + pw;
+		uint* out = dst + y * w;
+		int x = 0;
+		for (; x + 4 <= w; x += 4)
 		{
-			const uint src0 = src[x * 2 + (y * 2) * pw];
-			const uint src1 = src[x * 2 + 1 + (y * 2) * pw];
-			const uint src2 = src[x * 2 + (y * 2 + 1) * pw];
-			const uint src3 = src[x * 2 + 1 + (y * 2 + 1) * pw];
+			__m128i result[2];
+			for (int i = 0; i < 2; i++)
+			{
+				// two output pixels from 2x4 source pixels
+				const __m128i top = _mm_loadu_si128( (const __m128i*)(row0 + x * 2 + i * 4) );
+				const __m128i bottom = _mm_loadu_si128( (const __m128i*)(row1 + x * 2 + i * 4) );
+				const __m128i t0 = _mm_unpacklo_epi8( top, zero ), t1 = _mm_unpackhi_epi8( top, zero );
+				const __m128i b0 = _mm_unpacklo_epi8( bottom, zero ), b1 = _mm_unpackhi_epi8( bottom, zero );
+				const __m128i sum0 = _mm_add_epi16( t0, b0 ), sum1 = _mm_add_epi16( t1, b1 );
+				const __m128i min0 = _mm_min_epi16( t0, b0 ), min1 = _mm_min_epi16( t1, b1 );
+				// pair the left and right pixels of each block
+				const __m128i sum = _mm_add_epi16( _mm_unpacklo_epi64( sum0, sum1 ), _mm_unpackhi_epi64( sum0, sum1 ) );
+				const __m128i alpha = _mm_min_epi16( _mm_unpacklo_epi64( min0, min1 ), _mm_unpackhi_epi64( min0, min1 ) );
+				result[i] = _mm_or_si128( _mm_and_si128( alphaMask, alpha ), _mm_andnot_si128( alphaMask, _mm_srli_epi16( sum, 2 ) ) );
+			}
+			_mm_storeu_si128( (__m128i*)(out + x), _mm_packus_epi16( result[0], result[1] ) );
+		}
+		for (; x < w; x++)
+		{
+			const uint src0 = row0[x * 2], src1 = row0[x * 2 + 1];
+			const uint src2 = row1[x * 2], src3 = row1[x * 2 + 1];
 			const uint a = min( min( (src0 >> 24) & 255, (src1 >> 24) & 255 ), min( (src2 >> 24) & 255, (src3 >> 24) & 255 ) );
 			const uint r = ((src0 >> 16) & 255) + ((src1 >> 16) & 255) + ((src2 >> 16) & 255) + ((src3 >> 16) & 255);
 			const uint g = ((src0 >> 8) & 255) + ((src1 >> 8) & 255) + ((src2 >> 8) & 255) + ((src3 >> 8) & 255);
 			const uint b = (src0 & 255) + (src1 & 255) + (src2 & 255) + (src3 & 255);
-			dst[x + y * w] = (a << 24) + ((r >> 2) << 16) + ((g >> 2) << 8) + (b >> 2);
+			out[x] = (a << 24) + ((r >> 2) << 16) + ((g >> 2) << 8) + (b >> 2);
+		}
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostTexture::ConstructMIPmaps                                              |
+//  |  Generate MIP levels for a loaded texture, starting at firstLevel; the      |
+//  |  levels above it must be present. Large levels are reduced in bands of      |
+//  |  rows on the job system, also when called from a job, e.g. by               |
+//  |  HostScene::AddScene, which converts textures in parallel.            LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostTexture::ConstructMIPmaps( const int firstLevel )
+{
+	uint* src = (uint*)idata + PixelsNeeded( width, height, firstLevel - 1 );
+	int pw = width >> (firstLevel - 1), w = pw >> 1, ph = height >> (firstLevel - 1), h = ph >> 1;
+	uint* dst = src + pw * ph;
+	for (int i = firstLevel; i < MIPLEVELCOUNT; i++)
+	{
+		// reduce
+		if (w * h < PARALLELMIPSIZE) ReduceRows( src, dst, pw, w, 0, h ); else
+		{
+			const int bandCount = (h + MIPBANDROWS - 1) / MIPBANDROWS;
+			RunJobs( bandCount, [&]( const int band ) { ReduceRows( src, dst, pw, w, band * MIPBANDROWS, min( h, (band + 1) * MIPBANDROWS ) ); } );
 		}
 		// next layer
 		src = dst, dst += w * h, pw = w, ph = h, w >>= 1, h >>= 1;
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostTexture::ReadCache / HostTexture::WriteCache                           |
+//  |  Binary blobs of loaded and converted textures, stored next to the source   |
+//  |  file. The header holds the version, size, data type, mods, flags, MIP      |
+//  |  levels and the height scale of a converted bump map (0 otherwise); the     |
+//  |  pixels follow as deflated blocks that decompress in parallel, see          |
+//  |  ReadCompressedBlocks. A blob is only used if it is newer than the source   |
+//  |  and was made with the same mods and height scale, so the conversions run   |
+//  |  once per version of the source file.                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+static string CacheFile( const char* fileName, const char* suffix )
+{
+	const size_t length = strlen( fileName );
+	if (length <= 4 || fileName[length - 4] != '.') return string();
+	return string( fileName, length - 4 ) + suffix;
+}
+bool HostTexture::ReadCache( const char* fileName, const char* suffix, const uint modFlags, const float heightScale )
+{
+	const string binFile = CacheFile( fileName, suffix );
+	if (binFile.empty() || !FileExists( binFile.c_str() ) || FileIsNewer( fileName, binFile.c_str() )) return false;
+	FILE* f;
+	fopen_s( &f, binFile.c_str(), "rb" );
+	if (!f) return false;
+	uint header[8] = {};
+	float cachedScale;
+	fread( header, 4, 8, f );
+	memcpy( &cachedScale, header + 7, 4 );
+	if (header[0] != BINTEXFILEVERSION || header[4] != modFlags || cachedScale != heightScale) { fclose( f ); return false; }
+	const bool hdr = header[3] == 0;
+	const size_t bytes = (hdr ? sizeof( float4 ) : sizeof( uchar4 )) * PixelsNeeded( header[1], header[2], hdr ? 1 /* no MIPs for HDR textures */ : MIPLEVELCOUNT );
+	void* pixels = MALLOC64( bytes );
+	const bool valid = ReadCompressedBlocks( f, pixels, bytes );
+	fclose( f );
+	if (!valid) { FREE64( pixels ); return false; } // damaged cache file; convert the original image
+	FREE64( fdata ), FREE64( idata );
+	fdata = hdr ? (float4*)pixels : 0, idata = hdr ? 0 : (uchar4*)pixels;
+	width = header[1], height = header[2], mods = header[4], flags = header[5], MIPlevels = header[6];
+	return true;
+}
+void HostTexture::WriteCache( const char* fileName, const char* suffix, const float heightScale )
+{
+	const string binFile = CacheFile( fileName, suffix );
+	if (binFile.empty()) return;
+	FILE* f;
+	fopen_s( &f, binFile.c_str(), "wb" );
+	if (!f) return;
+	uint header[8] = { BINTEXFILEVERSION, width, height, fdata ? 0u : 1u, mods, flags, MIPlevels };
+	memcpy( header + 7, &heightScale, 4 );
+	fwrite( header, 4, 8, f );
+	if (fdata) WriteCompressedBlocks( f, fdata, sizeof( float4 ) * PixelsNeeded( width, height, 1 ) );
+	else WriteCompressedBlocks( f, idata, sizeof( uchar4 ) * PixelsNeeded( width, height, MIPLEVELCOUNT ) );
+	fclose( f );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostTexture::Load                                                          |
 //  |  Load texture data from disk.                                         LH2'19|
@@ -137,46 +268,20 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 		sprintf_s( error, "File not found: %s", fileName );
 		FatalError( __FILE__, __LINE__, error );
 	}
+	// KTX2 files carry their MIP levels, and are about as fast to read as the binary blobs
+	const string name = LowerCase( fileName );
+	if (name.size() > 5 && name.compare( name.size() - 5, 5, ".ktx2" ) == 0)
+	{
+		if (normalMap) flags |= NORMALMAP;
+		LoadKTX2( fileName, modFlags );
+		return;
+	}
 #ifdef CACHEIMAGES
-	// see if we can fetch a binary blob; faster than most FreeImage formats
-	if (strlen( fileName ) > 4) if (fileName[strlen( fileName ) - 4] == '.')
+	// see if we can fetch a binary blob; faster than most FreeImage formats, and already linearized
+	if (ReadCache( fileName, ".bin", modFlags, 0 ))
 	{
-		char binFile[1024];
-		memcpy( binFile, fileName, strlen( fileName ) + 1 );
-		binFile[strlen( fileName ) - 4] = 0;
-		strcat_s( binFile, ".bin" );
-		FILE* f;
-		fopen_s( &f, binFile, "rb" );
-		if (f)
-		{
-			uint version;
-			fread( &version, 1, 4, f );
-			if (version == BINTEXFILEVERSION)
-			{
-				fread( &width, 4, 1, f );
-				fread( &height, 4, 1, f );
-				int dataType;
-				fread( &dataType, 4, 1, f );
-				fread( &mods, 4, 1, f );
-				fread( &flags, 4, 1, f );
-				fread( &MIPlevels, 4, 1, f );
-				if (dataType == 0)
-				{
-					int pixelCount = PixelsNeeded( width, height, 1 /* no MIPS for HDR textures */ );
-					fdata = (float4*)MALLOC64( sizeof( float4 ) * pixelCount );
-					fread( fdata, sizeof( float4 ), pixelCount, f );
-				}
-				else
-				{
-					int pixelCount = PixelsNeeded( width, height, MIPLEVELCOUNT );
-					idata = (uchar4*)MALLOC64( sizeof( uchar4 ) * pixelCount );
-					fread( idata, 4, pixelCount, f );
-				}
-				fclose( f );
-				mods = modFlags;
-				return;
-			}
-		}
+		if (normalMap) flags |= NORMALMAP;
+		return;
 	}
 #endif
 	// get filetype
@@ -244,61 +349,278 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 	FreeImage_Unload( img ); if (bpp == 32) FreeImage_Unload( tmp );
 #ifdef CACHEIMAGES
 	// prepare binary blob to be faster next time
-	if (strlen( fileName ) > 4) if (fileName[strlen( fileName ) - 4] == '.')
+	WriteCache( fileName, ".bin", 0 );
+#endif
+	// all done, mark for sync with core
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  KTX2 block decoding helpers                                                |
+//  |  Standard BC1 / BC4 decoding to 8-bit channels, and the check whether a     |
+//  |  block only uses the modes that FetchBC1Texel and FetchBC4Value in the      |
+//  |  shared kernel code implement, so that it can be sent as it is.       LH2'19|
+//  +-----------------------------------------------------------------------------+
+static void DecodeBC1Block( const uchar* block, uint* texels, const bool fourColors, const bool punchThrough )
+{
+	const uint c0 = block[0] + (block[1] << 8), c1 = block[2] + (block[3] << 8);
+	uint palette[4];
+	int r[4], g[4], b[4];
+	r[0] = ((c0 >> 11) * 255 + 15) / 31, g[0] = (((c0 >> 5) & 63) * 255 + 31) / 63, b[0] = ((c0 & 31) * 255 + 15) / 31;
+	r[1] = ((c1 >> 11) * 255 + 15) / 31, g[1] = (((c1 >> 5) & 63) * 255 + 31) / 63, b[1] = ((c1 & 31) * 255 + 15) / 31;
+	if (c0 > c1 || fourColors)
+	{
+		r[2] = (2 * r[0] + r[1]) / 3, g[2] = (2 * g[0] + g[1]) / 3, b[2] = (2 * b[0] + b[1]) / 3;
+		r[3] = (r[0] + 2 * r[1]) / 3, g[3] = (g[0] + 2 * g[1]) / 3, b[3] = (b[0] + 2 * b[1]) / 3;
+	}
+	else r[2] = (r[0] + r[1]) / 2, g[2] = (g[0] + g[1]) / 2, b[2] = (b[0] + b[1]) / 2, r[3] = g[3] = b[3] = 0;
+	for (int i = 0; i < 4; i++) palette[i] = r[i] + (g[i] << 8) + (b[i] << 16) + (255u << 24);
+	if (c0 <= c1 && !fourColors && punchThrough) palette[3] = 0; // transparent black
+	const uint indices = block[4] + (block[5] << 8) + (block[6] << 16) + ((uint)block[7] << 24);
+	for (int t = 0; t < 16; t++) texels[t] = palette[(indices >> (t * 2)) & 3];
+}
+static void DecodeBC4Block( const uchar* block, uchar* values, const int stride )
+{
+	const int r0 = block[0], r1 = block[1];
+	int palette[8] = { r0, r1 };
+	if (r0 > r1) for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * r0 + (i - 1) * r1) / 7;
+	else
+	{
+		for (int i = 2; i < 6; i++) palette[i] = ((6 - i) * r0 + (i - 1) * r1) / 5;
+		palette[6] = 0, palette[7] = 255;
+	}
+	unsigned long long bits = 0;
+	for (int i = 0; i < 6; i++) bits += (unsigned long long)block[2 + i] << (i * 8);
+	for (int t = 0; t < 16; t++) values[t * stride] = (uchar)palette[(bits >> (t * 3)) & 7];
+}
+static bool CoreCompatibleBC1( const uchar* block )
+{
+	// the device decodes four-color mode only; the three-color mode is the same for blocks that use index 0 and 1
+	const uint c0 = block[0] + (block[1] << 8), c1 = block[2] + (block[3] << 8);
+	if (c0 > c1) return true;
+	for (int i = 4; i < 8; i++) if (block[i] & 0xaa) return false;
+	return true;
+}
+static bool CoreCompatibleBC4( const uchar* block )
+{
+	// the device decodes the eight-value mode only
+	if (block[0] > block[1]) return true;
+	unsigned long long bits = 0;
+	for (int i = 0; i < 6; i++) bits += (unsigned long long)block[2 + i] << (i * 8);
+	for (int t = 0; t < 16; t++) if (((bits >> (t * 3)) & 7) > 1) return false;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostTexture::LoadKTX2                                                      |
+//  |  Load a KTX2 container with RGBA8, BC1, BC3 or BC5 texels, uncompressed or  |
+//  |  with zlib supercompression. The MIP levels of the file are used as they    |
+//  |  are; only missing levels are constructed. BC1 and BC5 blocks are kept in   |
+//  |  bcdata, so that the cores that block compress textures skip encoding.      |
+//  |  Basis Universal and zstd supercompressed files are not supported.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostTexture::LoadKTX2( const char* fileName, const uint modFlags )
+{
+	static const uchar identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+	MappedFile file( fileName );
+	if (!file.data || file.size < 80 || memcmp( file.data, identifier, 12 ))
+		FatalError( __FILE__, __LINE__, "not a valid KTX2 file", fileName );
+	// header: format, type size, width, height, depth, layers, faces, levels, supercompression
+	uint header[9];
+	memcpy( header, file.data + 12, sizeof( header ) );
+	const uint format = header[0], levelCount = max( 1u, header[7] ), scheme = header[8];
+	enum { RGBA8 = 37, RGBA8SRGB = 43, BC1RGB = 131, BC1RGBSRGB, BC1RGBA, BC1RGBASRGB, BC3 = 137, BC3SRGB, BC5 = 141 };
+	const bool bc1 = format >= BC1RGB && format <= BC1RGBASRGB, bc3 = format == BC3 || format == BC3SRGB, bc5 = format == BC5;
+	if (format != RGBA8 && format != RGBA8SRGB && !bc1 && !bc3 && !bc5)
+		FatalError( __FILE__, __LINE__, "unsupported KTX2 texel format (RGBA8, BC1, BC3 and BC5 are supported)", fileName );
+	if (scheme != 0 && scheme != 3) FatalError( __FILE__, __LINE__, "unsupported KTX2 supercompression (none and zlib are supported)", fileName );
+	if (header[4] > 1 || header[5] > 1 || header[6] != 1) FatalError( __FILE__, __LINE__, "KTX2 arrays, cube maps and volumes are not supported", fileName );
+	if (file.size < 80 + (size_t)levelCount * 24) FatalError( __FILE__, __LINE__, "damaged KTX2 file", fileName );
+	width = header[2], height = header[3], mods = modFlags;
+	flags |= LDR;
+	const int levels = min( (int)levelCount, MIPLEVELCOUNT );
+	const size_t blockBytes = bc1 ? 8 : 16;
+	idata = (uchar4*)MALLOC64( sizeof( uchar4 ) * PixelsNeeded( width, height, MIPLEVELCOUNT ) );
+	// decode the levels in parallel; each level writes its own range of idata
+	vector<char> failed( levels, 0 ), compatible( levels, 1 ), transparent( levels, 0 );
+	vector<vector<uchar>> inflated( levels );
+	RunJobs( levels, [&]( const int l ) {
+		uint64_t index[3]; // offset, size, uncompressed size
+		memcpy( index, file.data + 80 + l * 24, sizeof( index ) );
+		if (index[0] + index[1] > file.size) { failed[l] = 1; return; }
+		const uchar* src = file.data + index[0];
+		if (scheme == 3)
+		{
+			uLongf size = (uLongf)index[2];
+			inflated[l].resize( index[2] );
+			if (uncompress( inflated[l].data(), &size, src, (uLong)index[1] ) != Z_OK || size != index[2]) { failed[l] = 1; return; }
+			src = inflated[l].data(), index[1] = index[2];
+		}
+		// KTX2 levels are at least one texel wide; ours end at zero
+		const uint w = width >> l, h = height >> l, fw = max( 1u, w ), fh = max( 1u, h );
+		const uint bw = (fw + 3) >> 2, bh = (fh + 3) >> 2;
+		uint* dst = (uint*)idata + PixelsNeeded( width, height, l );
+		if (format == RGBA8 || format == RGBA8SRGB)
+		{
+			if (index[1] < (size_t)fw * fh * 4) { failed[l] = 1; return; }
+			for (uint y = 0; y < h; y++) memcpy( dst + y * w, src + (size_t)y * fw * 4, w * 4 );
+			for (uint i = 0; i < w * h; i++) if ((dst[i] >> 24) == 0) { transparent[l] = 1; break; }
+			return;
+		}
+		if (index[1] < (size_t)bw * bh * blockBytes) { failed[l] = 1; return; }
+		uint texels[16];
+		for (uint by = 0; by < bh; by++) for (uint bx = 0; bx < bw; bx++)
+		{
+			const uchar* block = src + (by * bw + bx) * blockBytes;
+			if (bc1)
+			{
+				DecodeBC1Block( block, texels, false, format >= BC1RGBA );
+				if (!CoreCompatibleBC1( block )) compatible[l] = 0;
+			}
+			else if (bc3) DecodeBC1Block( block + 8, texels, true, false ), DecodeBC4Block( block, (uchar*)texels + 3, 4 );
+			else
+			{
+				// normal map: x and y, z reconstructed as in FetchBlockTexel
+				uchar x[16], y[16];
+				DecodeBC4Block( block, x, 1 ), DecodeBC4Block( block + 8, y, 1 );
+				for (int t = 0; t < 16; t++)
+				{
+					const float ux = x[t] * (2.0f / 255) - 1, uy = y[t] * (2.0f / 255) - 1, uz = sqrtf( max( 0.0f, 1 - ux * ux - uy * uy ) );
+					texels[t] = x[t] + (y[t] << 8) + ((uint)(uz * 127.5f + 127.5f) << 16) + (255u << 24);
+				}
+				if (!CoreCompatibleBC4( block ) || !CoreCompatibleBC4( block + 8 )) compatible[l] = 0;
+			}
+			for (int t = 0; t < 16; t++)
+			{
+				const uint x = bx * 4 + (t & 3), y = by * 4 + (t >> 2);
+				if (x >= w || y >= h) continue;
+				dst[x + y * w] = texels[t];
+				if ((texels[t] >> 24) == 0) transparent[l] = 1;
+			}
+		}
+	} );
+	for (int l = 0; l < levels; l++) if (failed[l]) FatalError( __FILE__, __LINE__, "damaged KTX2 file", fileName );
+	if (transparent[0]) flags |= HASALPHA;
+	if (levels < MIPLEVELCOUNT) ConstructMIPmaps( levels );
+	// modifications apply to the decoded texels
+	if (mods & FLIPPED) for (int l = 0, w = width, h = height; l < MIPLEVELCOUNT; l++, w >>= 1, h >>= 1)
+	{
+		uint* level = (uint*)idata + PixelsNeeded( width, height, l );
+		for (int y = 0; y < h / 2; y++) for (int x = 0; x < w; x++) std::swap( level[x + y * w], level[x + (h - 1 - y) * w] );
+	}
+	if (mods & INVERTED) for (int s = PixelsNeeded( width, height, MIPLEVELCOUNT ), i = 0; i < s; i++) ((uint*)idata)[i] ^= 0xffffff;
+	if (mods & LINEARIZED) sRGBtoLinear( (uchar*)idata, PixelsNeeded( width, height, MIPLEVELCOUNT ), 4 );
+	// keep the blocks if the cores can use them as they are: all levels present, opaque, no modifications
+	bool keepBlocks = (bc1 || bc5) && levels == MIPLEVELCOUNT && mods == 0 && (width >> (MIPLEVELCOUNT - 1)) > 0 && (height >> (MIPLEVELCOUNT - 1)) > 0;
+	keepBlocks &= bc5 == ((flags & NORMALMAP) != 0); // BC1 is used for color, BC5 for normal maps
+	for (int l = 0; l < levels; l++) keepBlocks &= compatible[l] != 0;
+	if (!keepBlocks) return;
+	size_t total = 0;
+	for (int l = 0; l < levels; l++) total += (((width >> l) + 3) >> 2) * (((height >> l) + 3) >> 2);
+	bcdata = (uchar*)MALLOC64( total * blockBytes );
+	bcBlocks = (uint)total;
+	for (int l = 0, offset = 0; l < levels; l++)
 	{
-		char binFile[1024];
-		memcpy( binFile, fileName, strlen( fileName ) + 1 );
-		binFile[strlen( fileName ) - 4] = 0;
-		strcat_s( binFile, ".bin" );
+		uint64_t index[3];
+		memcpy( index, file.data + 80 + l * 24, sizeof( index ) );
+		const size_t size = (((width >> l) + 3) >> 2) * (((height >> l) + 3) >> 2) * blockBytes;
+		memcpy( bcdata + offset, scheme == 3 ? inflated[l].data() : file.data + index[0], size );
+		offset += (int)size;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostTexture::LoadPlaceholder                                               |
+//  |  Stand-in pixels for a texture that has not been loaded yet: the smallest   |
+//  |  MIP level of the cached image that is at least PLACEHOLDERSIZE pixels      |
+//  |  wide and high, or a uniform image if there is no cached image. The size    |
+//  |  of the placeholder thus differs from the size of the texture.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void HostTexture::LoadPlaceholder()
+{
+	flags |= PLACEHOLDER | LDR;
+#ifdef CACHEIMAGES
+	if (origin.size() > 4 && origin[origin.size() - 4] == '.')
+	{
+		const string binFile = origin.substr( 0, origin.size() - 4 ) + ".bin";
 		FILE* f;
-		fopen_s( &f, binFile, "wb" );
+		fopen_s( &f, binFile.c_str(), "rb" );
 		if (f)
 		{
-			uint version = BINTEXFILEVERSION;
-			fwrite( &version, 4, 1, f );
-			fwrite( &width, 4, 1, f );
-			fwrite( &height, 4, 1, f );
-			int dataType = fdata ? 0 : 1;
-			fwrite( &dataType, 4, 1, f );
-			fwrite( &mods, 4, 1, f );
-			fwrite( &flags, 4, 1, f );
-			fwrite( &MIPlevels, 4, 1, f );
-			if (dataType == 0) fwrite( fdata, sizeof( float4 ), PixelsNeeded( width, height, 1 ), f );
-			else fwrite( idata, 4, PixelsNeeded( width, height, MIPLEVELCOUNT ), f );
-			fclose( f );
+			// version, width, height, data type, mods, flags, MIP levels, height scale; see HostTexture::ReadCache
+			uint header[8];
+			if (fread( header, 4, 8, f ) == 8 && header[0] == BINTEXFILEVERSION && header[3] == 1 /* LDR */)
+			{
+				int level = 0;
+				while (level < MIPLEVELCOUNT - 1 && (header[1] >> (level + 1)) >= PLACEHOLDERSIZE && (header[2] >> (level + 1)) >= PLACEHOLDERSIZE) level++;
+				width = header[1] >> level, height = header[2] >> level;
+				flags |= header[5] & HASALPHA;
+				idata = (uchar4*)MALLOC64( sizeof( uchar4 ) * PixelsNeeded( width, height, MIPLEVELCOUNT ) );
+				// only the blocks that hold this level are decompressed
+				const size_t levelStart = sizeof( uchar4 ) * PixelsNeeded( header[1], header[2], level );
+				const bool valid = ReadCompressedBlocks( f, idata, sizeof( uchar4 ) * width * height, levelStart );
+				fclose( f );
+				if (valid) { ConstructMIPmaps(); return; }
+				FREE64( idata );
+				idata = 0;
+			}
+			else fclose( f );
 		}
 	}
 #endif
-	// all done, mark for sync with core
+	// uniform grey, or a flat normal for normal maps
+	width = height = PLACEHOLDERSIZE;
+	const int pixelCount = PixelsNeeded( width, height, MIPLEVELCOUNT );
+	idata = (uchar4*)MALLOC64( sizeof( uchar4 ) * pixelCount );
+	const uchar4 color = (flags & NORMALMAP) ? make_uchar4( 128, 128, 255, 255 ) : make_uchar4( 128, 128, 128, 255 );
+	for (int i = 0; i < pixelCount; i++) idata[i] = color;
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  HostTexture::BumpToNormalMap                                               |
-//  |  Convert a bumpmap to a normalmap.                                    LH2'19|
+//  |  Convert a bumpmap to a normalmap, in bands of MIPBANDROWS rows on the job  |
+//  |  system, and rebuild the MIP levels from it. The result is cached next to   |
+//  |  the bumpmap, for the height scale that was used.                     LH2'19|
 //  +-----------------------------------------------------------------------------+
 void HostTexture::BumpToNormalMap( float heightScale )
 {
-	uchar* normalMap = new uchar[width * height * 4];
+	FREE64( bcdata ); // the blocks no longer match the texels
+	bcdata = 0, bcBlocks = 0;
+#ifdef CACHEIMAGES
+	if (ReadCache( origin.c_str(), ".nrm.bin", mods, heightScale )) return;
+#endif
+	uchar4* normalMap = (uchar4*)MALLOC64( sizeof( uchar4 ) * PixelsNeeded( width, height, MIPLEVELCOUNT ) );
 	const float stepZ = 1.0f / 255.0f;
-	for (uint i = 0; i < width * height; i++)
+	const int bandCount = (height + MIPBANDROWS - 1) / MIPBANDROWS;
+	RunJobs( bandCount, [&]( const int band )
 	{
-		uint xCoord = i % width, yCoord = i / width;
-		float xPrev = xCoord > 0 ? idata[i - 1].x * stepZ : idata[i].x * stepZ;
-		float xNext = xCoord < width - 1 ? idata[i + 1].x * stepZ : idata[i].x * stepZ;
-		float yPrev = yCoord < height - 1 ? idata[i + width].x * stepZ : idata[i].x * stepZ;
-		float yNext = yCoord > 0 ? idata[i - width].x * stepZ : idata[i].x * stepZ;
-		float3 normal;
-		normal.x = (xPrev - xNext) * heightScale;
-		normal.y = (yPrev - yNext) * heightScale;
-		normal.z = 1;
-		normal = normalize( normal );
-		normalMap[i * 4 + 0] = (uchar)round( (normal.x * 0.5 + 0.5) * 255 );
-		normalMap[i * 4 + 1] = (uchar)round( (normal.y * 0.5 + 0.5) * 255 );
-		normalMap[i * 4 + 2] = (uchar)round( (normal.z * 0.5 + 0.5) * 255 );
-		normalMap[i * 4 + 3] = 255;
-	}
-	if (width * height > 0) memcpy( idata, normalMap, width * height * 4 );
-	delete normalMap;
+		for (uint y = band * MIPBANDROWS, last = min( height, (uint)(band + 1) * MIPBANDROWS ); y < last; y++)
+		{
+			const uchar4* row = idata + y * width;
+			const uchar4* above = y > 0 ? row - width : row, *below = y < height - 1 ? row + width : row;
+			for (uint x = 0; x < width; x++)
+			{
+				float xPrev = row[x > 0 ? x - 1 : x].x * stepZ;
+				float xNext = row[x < width - 1 ? x + 1 : x].x * stepZ;
+				float yPrev = below[x].x * stepZ;
+				float yNext = above[x].x * stepZ;
+				float3 normal;
+				normal.x = (xPrev - xNext) * heightScale;
+				normal.y = (yPrev - yNext) * heightScale;
+				normal.z = 1;
+				normal = normalize( normal );
+				normalMap[y * width + x] = make_uchar4( (uchar)round( (normal.x * 0.5 + 0.5) * 255 ),
+					(uchar)round( (normal.y * 0.5 + 0.5) * 255 ), (uchar)round( (normal.z * 0.5 + 0.5) * 255 ), 255 );
+			}
+		}
+	} );
+	FREE64( idata );
+	idata = normalMap;
+	flags |= NORMALMAP;
+	// the MIP levels still hold the bumpmap
+	ConstructMIPmaps();
+#ifdef CACHEIMAGES
+	WriteCache( origin.c_str(), ".nrm.bin", heightScale );
+#endif
 }
 
 // EOF
\ No newline at end of file
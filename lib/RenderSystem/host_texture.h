@@ -40,7 +40,9 @@ public:
 		HASALPHA = 1,
 		NORMALMAP = 2,
 		LDR = 4,
-		HDR = 8
+		HDR = 8,
+		PLACEHOLDER = 16,				// pixels stand in for a texture that is not loaded yet
+		LOADING = 32					// the texture is being loaded in the background
 	};
 	enum
 	{
@@ -55,13 +57,17 @@ public:
 	// methods
 	bool Equals( const string& o, const uint m );
 	void Load( const char* fileName, const uint modFlags, bool normalMap = false );
+	void LoadKTX2( const char* fileName, const uint modFlags );
+	void LoadPlaceholder();
 	void sRGBtoLinear( uchar* pixels, const uint size, const uint stride );
 	void BumpToNormalMap( float heightScale );
 	uint* GetLDRPixels() { return (uint*)idata; }
 	float4* GetHDRPixels() { return fdata; }
 	// internal methods
 	int PixelsNeeded( const int width, const int height, const int MIPlevels );
-	void ConstructMIPmaps();
+	void ConstructMIPmaps( const int firstLevel = 1 );
+	bool ReadCache( const char* fileName, const char* suffix, const uint modFlags, const float heightScale );
+	void WriteCache( const char* fileName, const char* suffix, const float heightScale );
 	// public properties
 public:
 	uint width = 0;						// width in pixels
@@ -75,6 +81,9 @@ public:
 	uint refCount = 1;					// the number of materials that use this texture
 	uchar4* idata = nullptr;			// pointer to a 32-bit ARGB bitmap
 	float4* fdata = nullptr;			// pointer to a 128-bit ARGB bitmap
+	uchar* bcdata = nullptr;			// KTX2 BC1 or BC5 blocks of all MIP levels, sent instead of encoding idata
+	uint bcBlocks = 0;					// number of 8-byte (BC1) or 16-byte (BC5) blocks in bcdata
+	uint64 contentHash = 0;				// hash of the texel data, 0 until needed; see HostScene::DeduplicateImports
 	TRACKCHANGES;						// add Changed(), MarkAsDirty() methods, see system.h
 };
 
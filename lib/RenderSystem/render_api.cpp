@@ -18,173 +18,510 @@
 
 #include "rendersystem.h"
 
-static RenderSystem* renderer = nullptr;
-static RenderAPI api;
+static RenderAPI* firstSession = nullptr;
 
 RenderAPI* RenderAPI::CreateRenderAPI( const char* dllName )
 {
-	if (!renderer) 
-	{
-		renderer = new RenderSystem();
-		renderer->Init( dllName );
-	}
-	return &api;
+	if (!firstSession) firstSession = CreateSession( dllName );
+	return firstSession;
+}
+
+RenderAPI* RenderAPI::CreateSession( const char* dllName )
+{
+	RenderAPI* session = new RenderAPI();
+	session->renderer = new RenderSystem();
+	session->renderer->Init( dllName );
+	return session;
+}
+
+// each call first makes the scene of this session the active one, see HostScene::Activate;
+// with a render thread, calls that are not queued first wait for the queued ones
+void RenderAPI::Activate()
+{
+	if (thread) thread->Flush();
+	renderer->scene->Activate();
 }
 
 void RenderAPI::SerializeMaterials( const char* xmlFile )
 {
+	Activate();
 	renderer->scene->SerializeMaterials( xmlFile );
 }
 
 void RenderAPI::DeserializeMaterials( const char* xmlFile )
 {
+	Activate();
 	renderer->scene->DeserializeMaterials( xmlFile );
 }
 
 void RenderAPI::Shutdown()
 {
+	StopRenderThread();
+	Activate();
 	renderer->Shutdown();
 }
 
+bool RenderAPI::SwitchCore( const char* dllName )
+{
+	Activate();
+	return renderer->SwitchCore( dllName );
+}
+
+bool RenderAPI::StartRenderThread( const std::function<void()>& threadInit )
+{
+	if (thread) return true;
+	Activate();
+	if (!renderer->SingleSession()) return false;
+	thread = new RenderThread();
+	thread->Start( renderer, threadInit );
+	return true;
+}
+
+void RenderAPI::StopRenderThread()
+{
+	if (!thread) return;
+	thread->Stop();
+	delete thread;
+	thread = 0;
+}
+
 void RenderAPI::DeserializeCamera( const char* xmlFile )
 {
-	renderer->scene->camera->Deserialize( xmlFile );
+	Activate();
+	GetCamera()->Deserialize( xmlFile );
 }
 
 void RenderAPI::SerializeCamera( const char* xmlFile )
 {
-	renderer->scene->camera->Serialize( xmlFile );
+	Activate();
+	GetCamera()->Serialize( xmlFile );
 }
 
 int RenderAPI::AddMesh( const char* file, const char* dir, const float scale )
 {
+	Activate();
 	return renderer->scene->AddMesh( file, dir, scale );
 }
 
+void RenderAPI::SetGeometryHint( const int meshId, const GeometryHint hint )
+{
+	Activate();
+	// the new hint is applied when the mesh is sent to the core again
+	HostMesh* mesh = renderer->scene->meshes[meshId];
+	if (mesh->geometryHint != hint) mesh->geometryHint = hint, mesh->MarkAsDirty();
+}
+
+void RenderAPI::SetMeshResidency( const int meshId, const bool deviceOnly )
+{
+	Activate();
+	// a device-only mesh frees its host geometry after the next synchronization
+	HostMesh* mesh = renderer->scene->meshes[meshId];
+	mesh->deviceOnly = deviceOnly;
+	if (!deviceOnly) mesh->RestoreHostData();
+}
+
 void RenderAPI::AddScene( const char* file, const char* dir, const mat4& transform )
 {
+	Activate();
 	return renderer->scene->AddScene( file, dir, transform );
 }
 
 int RenderAPI::AddQuad( const float3 N, const float3 pos, const float width, const float height, const int material, const int meshID )
 {
+	Activate();
 	return renderer->scene->AddQuad( N, pos, width, height, material, meshID );
 }
 
+int RenderAPI::AddCurves( HostCurves* curves, const int sides )
+{
+	Activate();
+	return renderer->scene->AddCurves( curves, sides );
+}
+
+int RenderAPI::AddParticles( HostParticles* particles )
+{
+	Activate();
+	return renderer->scene->AddParticles( particles );
+}
+
 int RenderAPI::AddInstance( const int meshId, const mat4& transform )
 {
+	if (thread)
+	{
+		// the render thread adds the instances in order; the id is known in advance
+		const int nodeId = thread->ReserveNode();
+		thread->Push( [=]() { HostScene::AddInstance( meshId, transform ); } );
+		return nodeId;
+	}
+	Activate();
 	return renderer->scene->AddInstance( meshId, transform );
 }
 
 void RenderAPI::RemoveInstance( const int instId )
 {
+	if (thread)
+	{
+		thread->ReleaseNode( instId );
+		thread->Push( [=]() { HostScene::RemoveInstance( instId ); } );
+		return;
+	}
+	Activate();
 	return renderer->scene->RemoveInstance( instId );
 }
 
 void RenderAPI::SetNodeTransform( const int nodeId, const mat4& transform )
 {
+	if (thread) { thread->Push( [=]() { HostScene::SetNodeTransform( nodeId, transform ); } ); return; }
+	Activate();
 	renderer->scene->SetNodeTransform( nodeId, transform );
 }
 
+void RenderAPI::SetNodeVisibility( const int nodeId, const uint visibility )
+{
+	if (thread) { thread->Push( [=]() { HostScene::SetNodeVisibility( nodeId, visibility ); } ); return; }
+	Activate();
+	renderer->scene->SetNodeVisibility( nodeId, visibility );
+}
+
+void RenderAPI::SetMeshLOD( const int meshId, const int lodMeshId, const float projectedSize )
+{
+	Activate();
+	renderer->scene->SetMeshLOD( meshId, lodMeshId, projectedSize );
+}
+
+int RenderAPI::BatchStaticNodes( const float cellSize, const int maxNodeTriangles, const int maxBatchTriangles )
+{
+	Activate();
+	return renderer->scene->BatchStaticNodes( cellSize, maxNodeTriangles, maxBatchTriangles );
+}
+
+const HostMesh::BatchSource* RenderAPI::GetBatchSource( const int nodeId, const int triId, int* sourceTriId )
+{
+	Activate();
+	return renderer->scene->GetBatchSource( nodeId, triId, sourceTriId );
+}
+
 void RenderAPI::ResetAnimation( const int animId )
 {
+	if (thread) { thread->Push( [=]() { HostScene::ResetAnimation( animId ); } ); return; }
+	Activate();
 	renderer->scene->ResetAnimation( animId );
 }
 
 void RenderAPI::UpdateAnimation( const int animId, const float dt )
 {
+	if (thread) { thread->Push( [=]() { HostScene::UpdateAnimation( animId, dt ); } ); return; }
+	Activate();
 	renderer->scene->UpdateAnimation( animId, dt );
 }
 
 int RenderAPI::AnimationCount()
 {
+	Activate();
 	return renderer->scene->AnimationCount();
 }
 
 void RenderAPI::SynchronizeSceneData()
 {
+	if (thread) { RenderSystem* system = renderer; thread->Push( [=]() { system->SynchronizeSceneData(); } ); return; }
+	Activate();
 	renderer->SynchronizeSceneData();
 }
 
 void RenderAPI::Render( Convergence converge )
 {
+	if (thread) { thread->PushFrame( converge ); return; }
+	Activate();
 	renderer->Render( renderer->scene->camera->GetView(), converge );
 }
 
+void RenderAPI::RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, Convergence converge )
+{
+	Activate();
+	renderer->RenderViews( views, targets, count, converge );
+}
+
+bool RenderAPI::BakeProbes( const float3* positions, const int count, const int faceSize, const uint spp, float4* faces )
+{
+	Activate();
+	return renderer->BakeProbes( positions, count, faceSize, spp, faces );
+}
+
+bool RenderAPI::BakeLightmap( const int nodeId, const int width, const int height, const uint spp, float4* lightmap, const int dilation )
+{
+	Activate();
+	return renderer->BakeLightmap( nodeId, width, height, spp, lightmap, dilation );
+}
+
+int RenderAPI::ScatterInstances( const int nodeId, const int* prototypeMeshIds, const int prototypeCount, const int count,
+	const float2 scale, const int maskTexture, const uint seed )
+{
+	Activate();
+	return renderer->ScatterInstances( nodeId, prototypeMeshIds, prototypeCount, count, scale, maskTexture, seed );
+}
+
+// with a render thread: the copies that the application edits, see RenderThread::PushFrame
 Camera* RenderAPI::GetCamera()
 {
+	if (thread) return thread->camera;
+	Activate();
 	return renderer->scene->camera;
 }
 
 RenderSettings* RenderAPI::GetSettings()
 {
+	if (thread) return &thread->settings;
+	Activate();
 	return &renderer->settings;
 }
 
 int RenderAPI::GetTriangleMaterialID( const int triId, const int instId )
 {
+	Activate();
 	return renderer->scene->GetTriangleMaterial( triId, instId );
 }
 
 HostMaterial* RenderAPI::GetTriangleMaterial( const int triId, const int instId )
 {
+	Activate();
 	int matId = renderer->scene->GetTriangleMaterial( triId, instId );
 	return GetMaterial( matId );
 }
 
 HostMaterial* RenderAPI::GetMaterial( const int matId )
 {
+	Activate();
+	if (matId < 0 || matId >= renderer->scene->materials.size()) return 0;
 	return renderer->scene->materials[matId];
 }
 
+// the copy replaces the material; with a render thread, edits should use this instead of GetMaterial
+void RenderAPI::SetMaterial( const int matId, const HostMaterial& material )
+{
+	if (thread)
+	{
+		thread->Push( [=]() { if (matId >= 0 && matId < HostScene::materials.size())
+			*HostScene::materials[matId] = material, HostScene::materials[matId]->MarkAsDirty(); } );
+		return;
+	}
+	Activate();
+	if (matId < 0 || matId >= renderer->scene->materials.size()) return;
+	*renderer->scene->materials[matId] = material;
+	renderer->scene->materials[matId]->MarkAsDirty();
+}
+
 int RenderAPI::FindMaterialID( const char* name )
 {
+	Activate();
 	return renderer->scene->FindMaterialID( name );
 }
 
 int RenderAPI::FindNode( const char* name )
 {
+	Activate();
 	return renderer->scene->FindNode( name );
 }
 
 int RenderAPI::AddMaterial( const float3 color )
 {
+	Activate();
 	return renderer->scene->AddMaterial( color );
 }
 
 int RenderAPI::AddPointLight( const float3 pos, const float3 radiance, bool enabled )
 {
+	Activate();
 	return renderer->scene->AddPointLight( pos, radiance, enabled );
 }
 
 int RenderAPI::AddSpotLight( const float3 pos, const float3 direction, const float inner, const float outer, const float3 radiance, bool enabled )
 {
+	Activate();
 	return renderer->scene->AddSpotLight( pos, direction, inner, outer, radiance, enabled );
 }
 
 int RenderAPI::AddDirectionalLight( const float3 direction, const float3 radiance, bool enabled )
 {
+	Activate();
 	return renderer->scene->AddDirectionalLight( direction, radiance, enabled );
 }
 
 void RenderAPI::SetTarget( GLTexture* tex, const uint spp )
 {
+	Activate();
 	renderer->SetTarget( tex, spp );
+	if (thread) thread->SyncTarget();
+}
+
+void RenderAPI::SetTargets( GLTexture** tex, const int count, const uint spp )
+{
+	Activate();
+	renderer->SetTargets( tex, count, spp );
+	if (thread) thread->SyncTarget();
+}
+
+bool RenderAPI::SetHostTarget( float4* pixels, const int width, const int height, const uint spp )
+{
+	Activate();
+	const bool result = renderer->SetHostTarget( pixels, width, height, spp );
+	if (thread) thread->SyncTarget();
+	return result;
+}
+
+bool RenderAPI::SetVideoTarget( const VideoTargetDesc& desc, const uint spp )
+{
+	Activate();
+	const bool result = renderer->SetVideoTarget( desc, spp );
+	if (thread) thread->SyncTarget();
+	return result;
+}
+
+bool RenderAPI::SetVisibilityBuffer( GLTexture* visibility )
+{
+	Activate();
+	return renderer->SetVisibilityBuffer( visibility );
+}
+
+int RenderAPI::GetPresentTarget()
+{
+	Activate();
+	return renderer->GetPresentTarget();
 }
 
 void RenderAPI::SetProbePos( const int2 pos )
 {
+	Activate();
 	renderer->SetProbePos( pos );
 }
 
+void RenderAPI::SetProbePositions( const int2* pos, const int count )
+{
+	Activate();
+	renderer->SetProbePositions( pos, count );
+}
+
+int RenderAPI::GetProbeResults( CoreRayHit* hits )
+{
+	Activate();
+	return renderer->GetProbeResults( hits );
+}
+
+int RenderAPI::GetMaterialCosts( CoreMaterialCost* costs, const int count )
+{
+	Activate();
+	return renderer->GetMaterialCosts( costs, count );
+}
+
+int RenderAPI::QueryRays( const float3* origins, const float3* directions, const int count )
+{
+	Activate();
+	return renderer->QueryRays( origins, directions, count );
+}
+
+int RenderAPI::GetRayQueryResults( const int ticket, CoreRayHit* hits )
+{
+	Activate();
+	return renderer->GetRayQueryResults( ticket, hits );
+}
+
+bool RenderAPI::RecordFrames( const char* fileNamePattern, const FrameCallback callback, void* userData )
+{
+	Activate();
+	return renderer->RecordFrames( fileNamePattern, callback, userData );
+}
+
+int RenderAPI::StopRecording()
+{
+	Activate();
+	return renderer->StopRecording();
+}
+
+bool RenderAPI::StartTelemetry( const char* fileName, const TelemetryFormat format, const int sampleInterval, const float flushInterval )
+{
+	Activate();
+	return renderer->StartTelemetry( fileName, format, sampleInterval, flushInterval );
+}
+
+int RenderAPI::StopTelemetry()
+{
+	Activate();
+	return renderer->StopTelemetry();
+}
+
+void RenderAPI::EnableJournal( const bool enabled )
+{
+	Activate();
+	renderer->scene->journal.Enable( enabled );
+}
+
+uint64_t RenderAPI::JournalSequence()
+{
+	Activate();
+	return renderer->scene->journal.Sequence();
+}
+
+// material edits are journaled when they are synchronized, so call this after SynchronizeSceneData
+bool RenderAPI::SerializeJournal( const uint64_t since, vector<uchar>& stream )
+{
+	Activate();
+	return renderer->scene->journal.Serialize( since, stream );
+}
+
+bool RenderAPI::ApplyJournal( const uchar* stream, const size_t size, uint64_t* sequence )
+{
+	Activate();
+	return SceneJournal::Apply( stream, size, sequence );
+}
+
+void RenderAPI::TrimJournal( const uint64_t upTo )
+{
+	Activate();
+	renderer->scene->journal.Trim( upTo );
+}
+
+void RenderAPI::SetCheckpoints( const char* file, const float interval )
+{
+	Activate();
+	renderer->SetCheckpoints( file, interval );
+}
+
+bool RenderAPI::ResumeCheckpoint( const char* file )
+{
+	Activate();
+	return renderer->ResumeCheckpoint( file );
+}
+
+int RenderAPI::RecordedFrames()
+{
+	Activate();
+	return renderer->RecordedFrames();
+}
+
+// with a render thread: of the last finished frame
 CoreStats RenderAPI::GetCoreStats()
 {
+	if (thread) return thread->GetCoreStats();
+	Activate();
 	return renderer->GetCoreStats();
 }
 
 SystemStats RenderAPI::GetSystemStats()
 {
+	if (thread) return thread->GetSystemStats();
+	Activate();
 	return renderer->GetSystemStats();
 }
 
+void RenderAPI::CaptureProfile( const int frames )
+{
+	Activate();
+	renderer->CaptureProfile( frames );
+}
+
+bool RenderAPI::SaveProfile( const char* fileName )
+{
+	Activate();
+	return renderer->SaveProfile( fileName );
+}
+
 // EOF
\ No newline at end of file
@@ -20,38 +20,102 @@
 namespace lighthouse2
 {
 
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetryRecord                                                            |
+//  |  One sampled frame in a telemetry log, see StartTelemetry. A binary log is  |
+//  |  a TelemetryHeader followed by these records, as they are in memory; a CSV  |
+//  |  log has a line with the field names, then a line per record.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+enum TelemetryFormat { TelemetryCSV = 0, TelemetryBinary };
+struct TelemetryHeader
+{
+	char magic[4] = { 'L', 'H', '2', 'T' };
+	uint version = 1;
+	uint recordSize = 0;				// sizeof( TelemetryRecord ) of the writer
+};
+struct TelemetryRecord
+{
+	uint64_t frame;						// frames rendered since StartTelemetry, sampled or not
+	double time;						// seconds since StartTelemetry, at the end of the frame
+	float frameTime;					// seconds since the end of the previous frame
+	float renderCallTime;				// RenderSystem::Render, including the core's Render
+	// SystemStats of the last SynchronizeSceneData
+	float syncTime, skySyncTime, textureSyncTime, materialSyncTime, meshSyncTime, graphSyncTime, lightSyncTime;
+	float sceneUpdateTime;
+	uint dirtyTextures, dirtyMaterials, dirtyMeshes, dirtyInstances, dirtyLights;
+	uint64_t bytesSent;
+	// CoreStats of the frame
+	float renderTime, traceTime0, traceTime1, traceTimeX, shadowTraceTime, shadeTime, sortTime;
+	float denoiseTime, finalizeTime, bvhBuildTime;
+	uint totalRays, primaryRayCount, bounce1RayCount, deepRayCount, totalShadowRays;
+	uint64_t VRAMInUse;					// all categories of CoreStats::VRAMInUse
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderAPI                                                                  |
 //  |  Interface between the RenderSystem and the application.              LH2'19|
 //  +-----------------------------------------------------------------------------+
+// FrameCallback: receives the recorded frames, see RecordFrames; called on the writer thread
+typedef void (*FrameCallback)( const float4* pixels, const int width, const int height, const int frame, void* userData );
+
 struct RenderSettings;
+class RenderSystem;
+class RenderThread;
 class RenderAPI
 {
 public:
 	// CreateRenderAPI: instantiate and initialize a RenderSystem object and obtain an interface to it.
+	// Later calls return the same interface.
 	static RenderAPI* CreateRenderAPI( const char* dllName );
+	// CreateSession: an additional RenderSystem with its own scene. Sessions share the core and the
+	// pixels of textures loaded from the same file. Use one session at a time, from one thread.
+	static RenderAPI* CreateSession( const char* dllName );
 	// Methods
-	void SerializeMaterials( const char* xmlFile );
+	void SerializeMaterials( const char* xmlFile );		// without the .xml extension: binary material library
 	void DeserializeMaterials( const char* xmlFile );
 	void Shutdown();
+	bool SwitchCore( const char* dllName );
+	// StartRenderThread: from now on, SetNodeTransform, SetNodeVisibility, AddInstance, RemoveInstance,
+	// ResetAnimation, UpdateAnimation, SetMaterial, SynchronizeSceneData and Render are queued for a
+	// thread that synchronizes and renders, and return at once; other calls wait until the queue is
+	// empty. threadInit runs first on the new thread, e.g. to make a shared GL context current.
+	// GetCamera and GetSettings return copies that each queued frame takes along. Single session only.
+	bool StartRenderThread( const std::function<void()>& threadInit = 0 );
+	void StopRenderThread();
 	void DeserializeCamera( const char* camera );
 	void SerializeCamera( const char* camera );
 	int AddMesh( const char* file, const char* dir, const float scale );
+	void SetGeometryHint( const int meshId, const GeometryHint hint );
+	void SetMeshResidency( const int meshId, const bool deviceOnly );
 	void AddScene( const char* file, const char* dir, const mat4& transform = mat4::Identity() );
 	int AddQuad( const float3 N, const float3 pos, const float width, const float height, const int material, const int meshID = -1 );
+	int AddCurves( HostCurves* curves, const int sides = 4 );
+	int AddParticles( HostParticles* particles );
 	int AddInstance( const int meshId, const mat4& transform = mat4() );
 	void RemoveInstance( const int instId );
 	void SetNodeTransform( const int nodeId, const mat4& transform );
+	void SetNodeVisibility( const int nodeId, const uint visibility );
+	void SetMeshLOD( const int meshId, const int lodMeshId, const float projectedSize );
+	// BatchStaticNodes: merge small static nodes, per spatial cell of the given size, into combined meshes; call after
+	// import. Merged nodes are removed; for a triangle picked on a batch, GetBatchSource tells which node it came from.
+	int BatchStaticNodes( const float cellSize, const int maxNodeTriangles = 1024, const int maxBatchTriangles = 65536 );
+	const HostMesh::BatchSource* GetBatchSource( const int nodeId, const int triId, int* sourceTriId = 0 );
 	void ResetAnimation( int animId );
 	void UpdateAnimation( int animId, const float dt );
 	int AnimationCount();
 	void SynchronizeSceneData();
 	void Render( Convergence converge );
+	void RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, Convergence converge );
+	bool BakeProbes( const float3* positions, const int count, const int faceSize, const uint spp, float4* faces );
+	bool BakeLightmap( const int nodeId, const int width, const int height, const uint spp, float4* lightmap, const int dilation = 2 );
+	int ScatterInstances( const int nodeId, const int* prototypeMeshIds, const int prototypeCount, const int count,
+		const float2 scale = make_float2( 1 ), const int maskTexture = -1, const uint seed = 0x12345678 );
 	Camera* GetCamera();
 	RenderSettings* GetSettings();
 	int GetTriangleMaterialID( const int triId, const int instId );
 	HostMaterial* GetTriangleMaterial( const int triId, const int instId );
 	HostMaterial* GetMaterial( const int matId );
+	void SetMaterial( const int matId, const HostMaterial& material );
 	int FindNode( const char* name );
 	int FindMaterialID( const char* name );
 	int AddMaterial( const float3 color );
@@ -59,9 +123,38 @@ public:
 	int AddSpotLight( const float3 pos, const float3 direction, const float inner, const float outer, const float3 radiance, bool enabled = true );
 	int AddDirectionalLight( const float3 direction, const float3 radiance, bool enabled = true );
 	void SetTarget( GLTexture* tex, const uint spp );
+	void SetTargets( GLTexture** tex, const int count, const uint spp );
+	bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
+	bool SetVideoTarget( const VideoTargetDesc& desc, const uint spp );
+	bool SetVisibilityBuffer( GLTexture* visibility );
+	int GetPresentTarget();
 	void SetProbePos( const int2 pos );
+	void SetProbePositions( const int2* pos, const int count );
+	int GetProbeResults( CoreRayHit* hits );
+	int GetMaterialCosts( CoreMaterialCost* costs, const int count );
+	int QueryRays( const float3* origins, const float3* directions, const int count );
+	int GetRayQueryResults( const int ticket, CoreRayHit* hits );
+	bool RecordFrames( const char* fileNamePattern, const FrameCallback callback = 0, void* userData = 0 );
+	int StopRecording();
+	// scene journal: edits since a sequence number, for copies of the scene in other processes; see SceneJournal
+	void EnableJournal( const bool enabled );
+	uint64_t JournalSequence();
+	bool SerializeJournal( const uint64_t since, vector<uchar>& stream );
+	bool ApplyJournal( const uchar* stream, const size_t size, uint64_t* sequence = 0 );
+	void TrimJournal( const uint64_t upTo );
+	void SetCheckpoints( const char* file, const float interval );
+	bool ResumeCheckpoint( const char* file );
+	int RecordedFrames();
+	bool StartTelemetry( const char* fileName, const TelemetryFormat format = TelemetryCSV, const int sampleInterval = 1, const float flushInterval = 1 );
+	int StopTelemetry();
 	CoreStats GetCoreStats();
 	SystemStats GetSystemStats();
+	void CaptureProfile( const int frames );
+	bool SaveProfile( const char* fileName );
+private:
+	void Activate();
+	RenderSystem* renderer = nullptr;		// the RenderSystem of this session
+	RenderThread* thread = nullptr;			// queues the calls for the render thread, see StartRenderThread
 };
 
 } // namespace lighthouse2
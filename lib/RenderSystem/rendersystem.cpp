@@ -15,6 +15,11 @@
 
 #include "rendersystem.h"
 
+#define PARALLELGRAPHSIZE	4096	// nodes; smaller scene graphs are updated on the calling thread
+
+RenderSystem* RenderSystem::coreOwner = 0;
+int RenderSystem::sessionCount = 0;
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::Init                                                         |
 //  |  Initialize the rendering system.                                     LH2'19|
@@ -22,12 +27,76 @@
 void RenderSystem::Init( const char* dllName )
 {
 	// create core
-	core = CoreAPI_Base::CreateCoreAPI( dllName );
+	Init( CoreAPI_Base::CreateCoreAPI( dllName ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::Init                                                         |
+//  |  Initialize the rendering system for an initialized core that was not       |
+//  |  loaded from a dll, e.g. a stub core for host-side benchmarks.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::Init( CoreAPI_Base* coreAPI )
+{
+	core = coreAPI;
+	sessionCount++;
 	// create scene - load a scene using tinyobjloader
 	scene = new HostScene();
+	scene->Activate();
 	scene->Init();
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SwitchCore                                                   |
+//  |  Replace the core by the one in another dll, keeping the scene: the new     |
+//  |  core receives all of it, as when a session claims the core, from host      |
+//  |  data or, for meshes that released theirs, from the scene cache. The render |
+//  |  target of the last SetTarget* call is passed on; the application resends   |
+//  |  settings it passes to the core directly. Stops recording. Returns false if |
+//  |  other sessions share the core.                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::SwitchCore( const char* dllName )
+{
+	if (sessionCount > 1) return false;
+	StopRecording();
+	core->Shutdown();
+	CoreAPI_Base::DestroyCoreAPI();
+	core = CoreAPI_Base::CreateCoreAPI( dllName );
+	// the new core holds no scene yet; marks everything for sending and binds the target
+	coreOwner = 0, instanceSlots = 0;
+	ClaimCore();
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::ClaimCore                                                    |
+//  |  All sessions in a process share the core, which holds a single scene.      |
+//  |  When another session used it last, remove its instances, and mark all      |
+//  |  data of this scene for sending. Switching sessions thus costs a full       |
+//  |  upload; sessions that alternate every frame should use separate            |
+//  |  processes.                                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::ClaimCore()
+{
+	scene->Activate();
+	if (coreOwner == this) return;
+	if (coreOwner)
+	{
+		for (int slot = 0; slot < coreOwner->instanceSlots; slot++) core->RemoveInstance( slot );
+		coreOwner->instanceSlots = 0;
+	}
+	coreOwner = this;
+	// for a new session, all of this is dirty already
+	if (scene->sky) scene->sky->MarkAsDirty();
+	for (auto texture : scene->textures) texture->MarkAsDirty();
+	for (auto mesh : scene->meshes) mesh->MarkAsDirty(), mesh->animationOffered = false;
+	for (auto node : scene->nodes) if (node) node->instanceDirty = true;
+	for (Scatter& scatter : scatters) scatter.sent = scatter.generated = false;
+	gpuMaterials.clear(); // forces a full material update
+	HostScene::graphChanged = meshesChanged = coreClaimed = true;
+	if (bindTarget) bindTarget();
+	core->SetVisibilityBuffer( visibilityBuffer ); // also clears the buffer of the previous owner
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::SetTarget                                                    |
 //  |  Use the specified render target.                                     LH2'19|
@@ -35,12 +104,85 @@ void RenderSystem::Init( const char* dllName )
 void RenderSystem::SetTarget( GLTexture* target, const uint spp )
 {
 	// forward to core
+	ClaimCore();
+	bindTarget = [=]() { core->SetTarget( target, spp ); };
+	targetSpp = spp;
 	core->SetTarget( target, spp );
 	// update camera aspect ratio
 	scene->camera->aspectRatio = (float)target->width / (float)target->height;
 	scene->camera->pixelCount = make_int2( target->width, target->height );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SetTargets                                                   |
+//  |  Use a ring of render targets of identical size. The core renders each      |
+//  |  frame to the next target; GetPresentTarget returns the last one.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::SetTargets( GLTexture** targets, const int count, const uint spp )
+{
+	// forward to core
+	ClaimCore();
+	bindTarget = [=]() { core->SetTargets( targets, count, spp ); };
+	targetSpp = spp;
+	core->SetTargets( targets, count, spp );
+	// update camera aspect ratio
+	scene->camera->aspectRatio = (float)targets[0]->width / (float)targets[0]->height;
+	scene->camera->pixelCount = make_int2( targets[0]->width, targets[0]->height );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SetHostTarget                                                |
+//  |  Render to host memory instead of an OpenGL texture, for rendering without  |
+//  |  a window. Returns false if the core does not support this.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::SetHostTarget( float4* pixels, const int width, const int height, const uint spp )
+{
+	// forward to core
+	ClaimCore();
+	if (!core->SetHostTarget( pixels, width, height, spp )) return false;
+	bindTarget = [=]() { core->SetHostTarget( pixels, width, height, spp ); };
+	targetSpp = spp;
+	// update camera aspect ratio
+	scene->camera->aspectRatio = (float)width / (float)height;
+	scene->camera->pixelCount = make_int2( width, height );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SetVideoTarget                                               |
+//  |  Render without a window, and encode each frame to H.264 or HEVC on the     |
+//  |  GPU, e.g. for streaming. Returns false if the core does not support this.  |
+//  |  Use the "videoKeyFrame" setting to start a new group of pictures.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::SetVideoTarget( const VideoTargetDesc& desc, const uint spp )
+{
+	// forward to core
+	ClaimCore();
+	if (!core->SetVideoTarget( desc, spp )) return false;
+	bindTarget = [=]() { core->SetVideoTarget( desc, spp ); };
+	targetSpp = spp;
+	// update camera aspect ratio
+	scene->camera->aspectRatio = (float)desc.width / (float)desc.height;
+	scene->camera->pixelCount = make_int2( desc.width, desc.height );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SetVisibilityBuffer                                          |
+//  |  Hybrid rendering: let the core take the primary hits of the next frames    |
+//  |  from a visibility buffer that the application rasterized with OpenGL, for  |
+//  |  the current camera; see CoreAPI_Base::SetVisibilityBuffer for the layout.  |
+//  |  Pass nullptr to trace primary rays again. Returns false if the core does   |
+//  |  not support this.                                                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::SetVisibilityBuffer( GLTexture* visibility )
+{
+	ClaimCore();
+	if (!core->SetVisibilityBuffer( visibility )) return false;
+	visibilityBuffer = visibility;
+	return true;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::SynchronizeSky                                               |
 //  |  Detect changes to the skydome. If a change is found, send the new data to  |
@@ -54,63 +196,81 @@ void RenderSystem::SynchronizeSky()
 		// send sky data to core
 		HostSkyDome* sky = scene->sky;
 		core->SetSkyData( sky->pixels, sky->width, sky->height );
+		core->SetSkyImportance( sky->importanceCDF, IBLWIDTH, IBLHEIGHT );
+		stats.dirtySky = 1;
+		stats.bytesSent += sky->width * sky->height * sizeof( float3 ) + (sky->importanceCDF ? SKYCDFSIZE * sizeof( float ) : 0);
 	}
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::SynchronizeTextures                                          |
-//  |  Detect changes to the textures. TODO: currently, the system always sends   |
-//  |  all textures to the core whenever any of them changes.               LH2'19|
+//  |  Detect changes to the textures. The system sends all texture descriptors   |
+//  |  to the core whenever any of them changes; each descriptor is flagged so    |
+//  |  that the core can limit the upload to the modified textures.         LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeTextures()
 {
+	// swap in textures that finished loading in the background, see LAZYTEXTURES
+	HostScene::UpdateTextures();
 	bool texturesDirty = false;
-	for (auto texture : scene->textures) if (texture->Changed()) texturesDirty = true;
+	vector<bool> changed( scene->textures.size() );
+	for (int s = (int)scene->textures.size(), i = 0; i < s; i++) if (changed[i] = scene->textures[i]->Changed()) texturesDirty = true;
 	if (texturesDirty)
 	{
 		// send texture data to core
 		vector<CoreTexDesc> gpuTex;
-		for (auto texture : scene->textures) gpuTex.push_back( texture->ConvertToCoreTexDesc() );
+		for (int s = (int)scene->textures.size(), i = 0; i < s; i++)
+		{
+			CoreTexDesc desc = scene->textures[i]->ConvertToCoreTexDesc();
+			desc.changed = changed[i];
+			gpuTex.push_back( desc );
+			// the core only uploads the texels of modified textures
+			if (desc.changed) stats.dirtyTextures++, stats.bytesSent += desc.pixelCount * (desc.storage == ARGB128 ? sizeof( float4 ) : sizeof( uint ));
+		}
 		core->SetTextures( gpuTex.data(), (int)gpuTex.size() );
+		stats.bytesSent += gpuTex.size() * sizeof( CoreTexDesc );
+		// texture offsets may have moved; materials need to be patched by the core
+		texturesChanged = true;
 	}
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::SynchronizeMaterials                                         |
-//  |  Detect changes to the materials. Note: material data is small, so it is    |
-//  |  probably fine to send all materials whenever a single one changes.   LH2'19|
+//  |  Detect changes to the materials. Only the range of modified materials is   |
+//  |  converted and sent, unless materials were added or textures moved.   LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeMaterials()
 {
-	bool materialsDirty = false;
-	for (auto material : scene->materials) if (material->Changed())
+	// texture offsets may have moved; these are patched into all materials by the core
+	const bool fullUpdate = texturesChanged || gpuMaterials.size() != scene->materials.size();
+	texturesChanged = false;
+	int firstDirty = INT_MAX, lastDirty = -1;
+	for (int s = (int)scene->materials.size(), i = 0; i < s; i++)
 	{
-		materialsDirty = true;
+		HostMaterial* material = scene->materials[i];
+		if (!material->Changed()) continue;
+		firstDirty = min( firstDirty, i ), lastDirty = max( lastDirty, i );
+		stats.dirtyMaterials++;
+		scene->journal.Material( i, material );
 		// if the change is/includes a change of the material alpha flag, mark all
 		// meshes using this material as dirty as well.
-		if (material->AlphaChanged()) for (auto mesh : scene->meshes)
-		{
-			for (int s = (int)mesh->materialList.size(), i = 0; i < s; i++) if (mesh->materialList[i] == material->ID)
-			{
-				mesh->MarkAsDirty();
-				break;
-			}
-		}
+		if (material->AlphaChanged() && i < HostScene::materialMeshes.size())
+			for (int meshIdx : HostScene::materialMeshes[i]) scene->meshes[meshIdx]->MarkAsDirty(), scene->meshes[meshIdx]->alphaBaked = false;
 	}
-	if (materialsDirty)
+	if (!fullUpdate && lastDirty == -1) return;
+	// convert the modified materials; gpuMaterials holds the material data as last sent to the core
+	if (fullUpdate) firstDirty = 0, lastDirty = (int)scene->materials.size() - 1;
+	gpuMaterials.resize( scene->materials.size() );
+	gpuMaterialsEx.resize( scene->materials.size() );
+	for (int i = firstDirty; i <= lastDirty; i++) scene->materials[i]->ConvertTo( gpuMaterials[i], gpuMaterialsEx[i] );
+	// send material data to core
+	const int count = lastDirty - firstDirty + 1;
+	if (!fullUpdate && core->UpdateMaterials( gpuMaterials.data() + firstDirty, gpuMaterialsEx.data() + firstDirty, firstDirty, count ))
+		stats.bytesSent += count * sizeof( CoreMaterial );
+	else
 	{
-		// send material data to core
-		vector<CoreMaterial> gpuMaterial;
-		vector<CoreMaterialEx> gpuMaterialEx;
-		for (auto material : scene->materials)
-		{
-			CoreMaterial m;
-			CoreMaterialEx e;
-			material->ConvertTo( m, e );
-			gpuMaterial.push_back( m );
-			gpuMaterialEx.push_back( e );
-		}
-		core->SetMaterials( gpuMaterial.data(), gpuMaterialEx.data(), (int)gpuMaterial.size() );
+		core->SetMaterials( gpuMaterials.data(), gpuMaterialsEx.data(), (int)gpuMaterials.size() );
+		stats.bytesSent += gpuMaterials.size() * (sizeof( CoreMaterial ) + sizeof( CoreMaterialEx ));
 	}
 }
 
@@ -128,82 +288,552 @@ void RenderSystem::SynchronizeMeshes()
 		HostMesh* mesh = scene->meshes[modelIdx];
 		if (mesh->Changed())
 		{
+			// a device-only mesh that must be sent again reads its geometry back first
+			if (!mesh->RestoreHostData())
+			{
+				printf( "Could not restore mesh %s from the scene cache.\n", mesh->name.c_str() );
+				continue;
+			}
+			// particles go to the core as they are, if it takes them; otherwise they are tessellated, once
+			const HostParticles* particles = mesh->particles;
+			if (particles && core->SetParticles( modelIdx, particles->spheres.data(), (int)particles->spheres.size(), particles->material, mesh->geometryHint ))
+			{
+				stats.bytesSent += particles->spheres.size() * sizeof( float4 );
+				stats.dirtyMeshes++;
+				meshesChanged = true;
+				continue;
+			}
+			if (particles && mesh->triangles.size() == 0) particles->Tessellate( mesh ), mesh->BuildMaterialList();
 			mesh->UpdateAlphaFlags();
-			core->SetGeometry( modelIdx, mesh->vertices.data(), (int)mesh->vertices.size(), (int)mesh->triangles.size(), (CoreTri*)mesh->triangles.data(), mesh->alphaFlags.data() );
+			const int triCount = (int)mesh->triangles.size();
+			const size_t triBytes = triCount * (sizeof( CoreTri ) + (mesh->alphaFlags.size() ? sizeof( uint ) : 0));
+			// curves go to the core as they are, if it takes them; otherwise their tessellation is sent
+			const HostCurves* curves = mesh->curves;
+			if (curves && core->SetCurves( modelIdx, curves->points.data(), (int)curves->points.size(), curves->segments.data(),
+				(int)curves->segments.size(), curves->material, mesh->geometryHint ))
+				stats.bytesSent += curves->points.size() * sizeof( float4 ) + curves->segments.size() * sizeof( uint );
+			else if (mesh->HasIndexedData() && core->SetIndexedGeometry( modelIdx, mesh->sharedVertices.data(), (int)mesh->sharedVertices.size(),
+				mesh->indices.data(), triCount, (CoreTri*)mesh->triangles.data(), mesh->alphaFlags.data(), mesh->geometryHint ))
+				stats.bytesSent += mesh->sharedVertices.size() * sizeof( float4 ) + mesh->indices.size() * sizeof( uint ) + triBytes;
+			else
+			{
+				core->SetGeometry( modelIdx, mesh->vertices.data(), (int)mesh->vertices.size(), triCount, (CoreTri*)mesh->triangles.data(), mesh->alphaFlags.data(), mesh->geometryHint );
+				stats.bytesSent += mesh->vertices.size() * sizeof( float4 ) + triBytes;
+			}
+			stats.dirtyMeshes++;
 			meshesChanged = true; // trigger scene graph update
+			if (!mesh->animationOffered) OfferAnimationData( modelIdx );
+		}
+		if (mesh->deviceAnimation && mesh->poseChanged)
+		{
+			// send the joint matrices and morph weights; the core animates the mesh
+			const HostSkin* skin = mesh->poseSkin;
+			core->SetPose( modelIdx, skin ? skin->jointMat.data() : 0, skin ? (int)skin->jointMat.size() : 0,
+				mesh->poseWeights.data(), (int)mesh->poseWeights.size() );
+			stats.bytesSent += (skin ? skin->jointMat.size() * sizeof( mat4 ) : 0) + mesh->poseWeights.size() * sizeof( float );
+			stats.dirtyMeshes++;
+			mesh->poseChanged = false;
+			meshesChanged = true;
+		}
+		// the core has the current geometry of the mesh
+		if (mesh->deviceOnly) mesh->ReleaseHostData();
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::OfferAnimationData                                           |
+//  |  Send the bind pose, skin and morph targets of an animated mesh to the      |
+//  |  core. If the core accepts these, subsequent poses are sent as joint        |
+//  |  matrices and weights, instead of as full geometry.                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::OfferAnimationData( const int meshIdx )
+{
+	HostMesh* mesh = scene->meshes[meshIdx];
+	mesh->animationOffered = true;
+	const bool skinned = mesh->joints.size() > 0, morphed = mesh->poses.size() > 1;
+	if (!skinned && !morphed) return;
+	// bind pose; the host may already have posed the mesh
+	const int vertexCount = (int)mesh->vertices.size();
+	vector<float4> positions = mesh->original.size() > 0 ? mesh->original : mesh->vertices;
+	vector<float3> normals = mesh->origNormal;
+	if (normals.size() == 0) for (auto& tri : mesh->triangles)
+		normals.push_back( tri.vN0 ), normals.push_back( tri.vN1 ), normals.push_back( tri.vN2 );
+	if (morphed) for (int i = 0; i < vertexCount; i++)
+		positions[i] = make_float4( mesh->poses[0].positions[i], 1 ), normals[i] = mesh->poses[0].normals[i];
+	// morph target deltas, one block of vertices per target
+	vector<float3> morphPositions, morphNormals;
+	for (int s = (int)mesh->poses.size(), j = 1; j < s; j++)
+	{
+		morphPositions.insert( morphPositions.end(), mesh->poses[j].positions.begin(), mesh->poses[j].positions.end() );
+		morphNormals.insert( morphNormals.end(), mesh->poses[j].normals.begin(), mesh->poses[j].normals.end() );
+	}
+	mesh->deviceAnimation = core->SetAnimationData( meshIdx, positions.data(), normals.data(), vertexCount,
+		skinned ? mesh->joints.data() : 0, skinned ? mesh->weights.data() : 0,
+		morphPositions.data(), morphNormals.data(), (int)mesh->poses.size() - 1 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::FlattenSceneGraph                                            |
+//  |  Store the scene graph as an array in depth-first order, so that a parent   |
+//  |  always precedes its children. The array is cut into subtrees that can be   |
+//  |  updated independently; if there are fewer roots than threads, roots are    |
+//  |  placed in front of the first job and their children form the jobs.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::FlattenSceneGraph()
+{
+	graphNodes.clear();
+	graphParent.clear();
+	graphJobs.clear();
+	meshNodes.clear();
+	const vector<int>& roots = HostScene::scene;
+	const bool splitRoots = (int)roots.size() < JobSystem::WorkerCount();
+	vector<int2> stack; // node index, parent index
+	auto AddSubtree = [&]( const int nodeIdx, const int parentIdx ) {
+		graphJobs.push_back( (int)graphNodes.size() );
+		stack.push_back( make_int2( nodeIdx, parentIdx ) );
+		while (stack.size() > 0)
+		{
+			const int2 entry = stack.back();
+			stack.pop_back();
+			graphNodes.push_back( entry.x );
+			graphParent.push_back( entry.y );
+			const vector<int>& children = HostScene::nodes[entry.x]->childIdx;
+			for (int i = (int)children.size() - 1; i >= 0; i--) stack.push_back( make_int2( children[i], entry.x ) );
+		}
+	};
+	if (splitRoots) for (int root : roots) graphNodes.push_back( root ), graphParent.push_back( -1 );
+	for (int root : roots)
+	{
+		if (!splitRoots) AddSubtree( root, -1 );
+		else for (int child : HostScene::nodes[root]->childIdx) AddSubtree( child, root );
+	}
+	graphJobs.push_back( (int)graphNodes.size() );
+	for (int s = (int)graphNodes.size(), i = 0; i < s; i++) if (HostScene::nodes[graphNodes[i]]->meshID > -1) meshNodes.push_back( graphNodes[i] );
+	// mesh nodes that left the graph, e.g. children of a removed node, release their instance slot
+	vector<bool> reachable( HostScene::instances.size(), false );
+	for (int nodeIdx : meshNodes) if (HostScene::nodes[nodeIdx]->instanceID > -1) reachable[HostScene::nodes[nodeIdx]->instanceID] = true;
+	for (int s = (int)HostScene::instances.size(), i = 0; i < s; i++) if (HostScene::instances[i] > -1 && !reachable[i])
+	{
+		HostNode* node = HostScene::nodes[HostScene::instances[i]];
+		node->instanceID = -1, node->instanceDirty = true;
+		HostScene::ReleaseInstanceSlot( i );
+	}
+	HostScene::graphChanged = false;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SelectLODs                                                   |
+//  |  Pick the level of detail for each mesh node from the projected size of     |
+//  |  its bounding sphere, as a fraction of the screen height. A small margin    |
+//  |  around each threshold prevents nodes near it from switching every frame.   |
+//  |  Nodes that switch are marked dirty, so only these are resent.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+static float4 WorldBounds( const HostNode* node, const HostMesh* mesh )
+{
+	// world space bounding sphere of a mesh node
+	const mat4& T = node->combinedTransform;
+	const float3 centre = make_float3( T * make_float4( make_float3( mesh->bounds ), 1 ) );
+	const float3 X = make_float3( T.cell[0], T.cell[4], T.cell[8] ), Y = make_float3( T.cell[1], T.cell[5], T.cell[9] ), Z = make_float3( T.cell[2], T.cell[6], T.cell[10] );
+	const float scale = sqrtf( max( max( dot( X, X ), dot( Y, Y ) ), dot( Z, Z ) ) ); // largest axis scale
+	return make_float4( centre, mesh->bounds.w * scale );
+}
+
+bool RenderSystem::SelectLODs()
+{
+	bool changed = false;
+	const float3 camPos = HostScene::camera->position;
+	const float screenHeight = 2 * tanf( HostScene::camera->FOV * PI / 360.0f );
+	for (int nodeIdx : meshNodes)
+	{
+		HostNode* node = HostScene::nodes[nodeIdx];
+		const HostMesh* mesh = HostScene::meshes[node->meshID];
+		int level = 0;
+		if (mesh->lodMeshes.size() > 0 && !mesh->isAnimated)
+		{
+			const float4 sphere = WorldBounds( node, mesh );
+			const float dist = max( EPSILON, length( make_float3( sphere ) - camPos ) );
+			const float size = (2 * sphere.w) / (dist * screenHeight);
+			const int current = min( node->lodLevel, (int)mesh->lodMeshes.size() );
+			for (int s = (int)mesh->lodSizes.size(), i = 0; i < s; i++)
+				if (size < mesh->lodSizes[i] * (current > i ? 1.1f : 0.9f)) level = i + 1;
 		}
+		const int lodMeshID = level == 0 ? node->meshID : mesh->lodMeshes[level - 1];
+		node->lodLevel = level;
+		if (lodMeshID == node->lodMeshID) continue;
+		node->lodMeshID = lodMeshID, node->instanceDirty = changed = true;
+	}
+	return changed;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SchedulePoses                                                |
+//  |  Amortized animation: set the number of frames between the pose updates of  |
+//  |  each skinned or morphed node. Nodes outside the view cone get the longest  |
+//  |  interval; visible nodes smaller than settings.poseUpdateSize get one that  |
+//  |  grows as they shrink. HostNode::UpdateMesh defers changes that arrive      |
+//  |  early, so a pose lags by at most the interval, and is never lost.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::SchedulePoses()
+{
+	const Camera* camera = HostScene::camera;
+	const float3 camPos = camera->position, camDir = normalize( camera->direction );
+	const float tanHalfFOV = tanf( camera->FOV * PI / 360.0f ), screenHeight = 2 * tanHalfFOV;
+	const float halfDiagonal = atanf( tanHalfFOV * sqrtf( 1 + camera->aspectRatio * camera->aspectRatio ) );
+	const int maxInterval = max( 1, settings.maxPoseInterval );
+	for (int nodeIdx : meshNodes)
+	{
+		HostNode* node = HostScene::nodes[nodeIdx];
+		HostMesh* mesh = HostScene::meshes[node->meshID];
+		if (node->skinID == -1 && node->weights.size() == 0) continue;
+		if (settings.poseUpdateSize <= 0) { node->poseInterval = 1; continue; }
+		if (mesh->bounds.w == 0) mesh->UpdateBounds(); // bind pose; close enough for a rate decision
+		const float4 sphere = WorldBounds( node, mesh );
+		const float3 V = make_float3( sphere ) - camPos;
+		const float dist = max( EPSILON, length( V ) );
+		if (dist > sphere.w && dot( V, camDir ) < dist * cosf( min( PI, halfDiagonal + asinf( sphere.w / dist ) ) ))
+		{
+			node->poseInterval = maxInterval;
+			continue;
+		}
+		const float size = (2 * sphere.w) / (dist * screenHeight);
+		node->poseInterval = size >= settings.poseUpdateSize ? 1 : min( maxInterval, (int)(settings.poseUpdateSize / max( EPSILON, size )) );
 	}
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::UpdateSceneGraph                                             |
 //  |  Walk the scene graph:                                                      |
-//  |  - update all node matrices                                                 |
-//  |  - update the instance array (where an 'instance' is a node with            |
-//  |    a mesh)                                                            LH2'19|
+//  |  - update the node matrices; untouched subtrees are skipped, and the        |
+//  |    subtrees in graphJobs are processed in parallel for large scenes         |
+//  |  - update poses, lights and the instance array (where an 'instance' is a    |
+//  |    node with a mesh); this is done serially, as meshes may be shared  LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::UpdateSceneGraph()
 {
-	// walk the scene graph to update matrices
 	Timer timer;
-	int instanceCount = 0;
-	bool instancesChanged = false;
-	for( int s = (int)HostScene::scene.size(), i = 0; i < s; i++ ) 
-	{
-		int nodeIdx = HostScene::scene[i];
-		HostNode* node = HostScene::nodes[nodeIdx];
-		mat4 T;
-		instancesChanged |= node->Update( T /* start with an identity matrix */, instanceCount );
-	}
+	if (HostScene::graphChanged) FlattenSceneGraph();
+	// update the combined transforms; entries before the first job are roots, updated first
+	auto UpdateNodes = [&]( const int first, const int last ) {
+		for (int i = first; i < last; i++)
+		{
+			HostNode* node = HostScene::nodes[graphNodes[i]];
+			const int parentIdx = graphParent[i];
+			if (parentIdx == -1) node->UpdateTransform( mat4() /* identity */, false ); else
+			{
+				const HostNode* parent = HostScene::nodes[parentIdx];
+				node->UpdateTransform( parent->combinedTransform, parent->moved );
+			}
+		}
+	};
+	const int jobCount = (int)graphJobs.size() - 1;
+	UpdateNodes( 0, graphJobs[0] );
+	if (graphNodes.size() < PARALLELGRAPHSIZE) UpdateNodes( graphJobs[0], graphJobs[jobCount] ); else
+		RunJobs( jobCount, [&]( const int i ) { UpdateNodes( graphJobs[i], graphJobs[i + 1] ); } );
+	// update the instances
+	bool instancesChanged = HostScene::removedInstances.size() > 0;
+	SchedulePoses();
+	for (int nodeIdx : meshNodes) instancesChanged |= HostScene::nodes[nodeIdx]->UpdateMesh();
+	instancesChanged |= SelectLODs();
+	for (const Scatter& scatter : scatters) instancesChanged |= !scatter.sent;
 	stats.sceneUpdateTime = timer.elapsed();
 	// synchronize instances to device if anything changed
 	if (instancesChanged || meshesChanged)
 	{
-		// resize vector (this is free if the size didn't change)
-		HostScene::instances.resize( instanceCount );
-		// send instances to core
-		for (int instanceIdx = 0; instanceIdx < instanceCount; instanceIdx++)
+		// removals go first: a released slot may have been claimed again by a new instance
+		for (int slot : HostScene::removedInstances) core->RemoveInstance( slot ), stats.dirtyInstances++;
+		HostScene::removedInstances.clear();
+		// send modified instances to core; slots are stable, so the core only updates what it receives.
+		// Sorted by slot, so that runs of consecutive slots go in a single call, and new slots arrive in order.
+		vector<int2> dirty; // slot, node index
+		for (int nodeIdx : meshNodes)
+		{
+			HostNode* node = HostScene::nodes[nodeIdx];
+			if (!node->instanceDirty) continue;
+			node->instanceDirty = false;
+			int dummy = node->Changed(); // sync generation; prevents a superfluous update in the next frame
+			dirty.push_back( make_int2( node->instanceID, nodeIdx ) );
+		}
+		sort( dirty.begin(), dirty.end(), []( const int2& a, const int2& b ) { return a.x < b.x; } );
+		vector<int> meshIDs( dirty.size() );
+		vector<mat4> transforms( dirty.size() );
+		for (int s = (int)dirty.size(), i = 0; i < s; i++)
+			meshIDs[i] = HostScene::nodes[dirty[i].y]->lodMeshID, transforms[i] = HostScene::nodes[dirty[i].y]->combinedTransform;
+		for (int s = (int)dirty.size(), first = 0; first < s; )
+		{
+			int last = first + 1;
+			while (last < s && dirty[last].x == dirty[last - 1].x + 1) last++;
+			core->SetInstances( dirty[first].x, last - first, meshIDs.data() + first, transforms.data() + first );
+			first = last;
+		}
+		if (dirty.size() > 0) instanceSlots = max( instanceSlots, dirty.back().x + 1 );
+		// SetInstance made these visible to all rays
+		for (const int2& d : dirty) if (HostScene::nodes[d.y]->visibility != VISIBLE_ALL) core->SetInstanceVisibility( d.x, HostScene::nodes[d.y]->visibility );
+		// ...and static; moving instances get their transform of the previous update at shutter open
+		for (const int2& d : dirty)
 		{
-			// HostInstance* instance = scene->instances[instanceIdx];
-			HostNode* node = HostScene::nodes[HostScene::instances[instanceIdx]];
-			node->instanceID = instanceIdx;
-			int dummy = node->Changed(); // prevent superfluous update in the next frame
-			core->SetInstance( instanceIdx, node->meshID, node->combinedTransform );
+			const HostNode* node = HostScene::nodes[d.y];
+			if (!(node->shutterTransform == node->combinedTransform)) core->SetInstanceMotion( d.x, node->shutterTransform );
 		}
+		// scattered instances: the core generates the members once; the group follows the node of the surface
+		for (int s = (int)scatters.size(), i = 0; i < s; i++)
+		{
+			Scatter& scatter = scatters[i];
+			if (scatter.node < 0) continue;
+			const HostNode* node = HostScene::nodes[scatter.node];
+			if (!node)
+			{
+				// the surface left the scene
+				HostScene::ReleaseInstanceSlot( scatter.slot );
+				scatter.node = -1;
+				continue;
+			}
+			if (scatter.sent && (!scatter.generated || !node->moved)) continue;
+			if (!scatter.sent && !SendScatter( i )) continue;
+			core->SetInstance( scatter.slot, INSTANCEGROUP( i ), node->combinedTransform );
+			instanceSlots = max( instanceSlots, scatter.slot + 1 );
+			stats.dirtyInstances++;
+		}
+		stats.dirtyInstances += (int)dirty.size();
+		stats.bytesSent += dirty.size() * (sizeof( int ) + sizeof( mat4 ));
 		// finalize
 		core->UpdateToplevel();
 		meshesChanged = false;
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SendScatter                                                  |
+//  |  Offer a scatter to the core, with the triangles of the surface mesh in     |
+//  |  object space and the mask texture as a density. Returns false if the core  |
+//  |  cannot generate the instances; the scatter then stays empty.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::SendScatter( const int scatterIdx )
+{
+	Scatter& scatter = scatters[scatterIdx];
+	scatter.sent = true, scatter.generated = false;
+	HostMesh* mesh = HostScene::meshes[HostScene::nodes[scatter.node]->meshID];
+	if (!mesh->RestoreHostData()) return false;
+	const int triCount = (int)mesh->triangles.size();
+	vector<float4> vertices( triCount * 3 );
+	vector<float2> uvs( triCount * 3 );
+	for (int i = 0; i < triCount; i++)
+	{
+		const HostTri& tri = mesh->triangles[i];
+		vertices[i * 3 + 0] = make_float4( tri.vertex0, 1 ), uvs[i * 3 + 0] = make_float2( tri.u0, tri.v0 );
+		vertices[i * 3 + 1] = make_float4( tri.vertex1, 1 ), uvs[i * 3 + 1] = make_float2( tri.u1, tri.v1 );
+		vertices[i * 3 + 2] = make_float4( tri.vertex2, 1 ), uvs[i * 3 + 2] = make_float2( tri.u2, tri.v2 );
+	}
+	CoreScatter desc;
+	desc.vertices = vertices.data(), desc.uvs = uvs.data(), desc.triangleCount = triCount;
+	desc.prototypes = scatter.prototypes.data(), desc.prototypeCount = (int)scatter.prototypes.size();
+	desc.count = scatter.count, desc.scale = scatter.scale, desc.seed = scatter.seed;
+	// the mask: average of the colour channels, mip level 0
+	vector<float> mask;
+	if (scatter.maskTexture >= 0 && scatter.maskTexture < (int)HostScene::textures.size())
+	{
+		const HostTexture* texture = HostScene::textures[scatter.maskTexture];
+		const int pixels = texture->width * texture->height;
+		if (texture->idata) for (int i = 0; i < pixels; i++)
+		{
+			const uchar4 p = texture->idata[i];
+			mask.push_back( (p.x + p.y + p.z) * (1.0f / 765) );
+		}
+		else if (texture->fdata) for (int i = 0; i < pixels; i++)
+		{
+			const float4 p = texture->fdata[i];
+			mask.push_back( min( 1.0f, max( 0.0f, (p.x + p.y + p.z) * (1.0f / 3) ) ) );
+		}
+		if (mask.size() > 0) desc.mask = mask.data(), desc.maskSize = make_int2( texture->width, texture->height );
+	}
+	scatter.generated = core->ScatterInstances( scatterIdx, desc );
+	if (scatter.generated) stats.bytesSent += vertices.size() * sizeof( float4 ) + uvs.size() * sizeof( float2 ) + mask.size() * sizeof( float );
+	return scatter.generated;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BuildLightTreeNode                                                         |
+//  |  Helper for RenderSystem::BuildLightTree: set up the node for a range of    |
+//  |  lights, and split the range at the median of the widest axis.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+struct LightTreeInput { float3 bmin, bmax, N; float energy; bool omni; };
+static int BuildLightTreeNode( const vector<LightTreeInput>& lights, int* idx, const int count, vector<CoreLightTreeNode>& tree, int& nextNode )
+{
+	const int lightCount = (int)lights.size();
+	const int nodeIdx = count == 1 ? lightCount - 1 + idx[0] : nextNode++;
+	CoreLightTreeNode node;
+	node.bmin = make_float3( 1e34f ), node.bmax = make_float3( -1e34f ), node.energy = 0;
+	float3 axis = make_float3( 0 ), cmin = make_float3( 1e34f ), cmax = make_float3( -1e34f );
+	bool omni = false;
+	for (int i = 0; i < count; i++)
+	{
+		const LightTreeInput& l = lights[idx[i]];
+		const float3 c = 0.5f * (l.bmin + l.bmax);
+		node.bmin = fminf( node.bmin, l.bmin ), node.bmax = fmaxf( node.bmax, l.bmax );
+		cmin = fminf( cmin, c ), cmax = fmaxf( cmax, c );
+		node.energy += l.energy, axis += l.N, omni |= l.omni;
+	}
+	// emission cone: the mean normal, widened to include each normal
+	node.cosTheta = -1, node.axis = make_float3( 0, 0, 1 );
+	if (!omni && dot( axis, axis ) > 1e-12f)
+	{
+		node.axis = normalize( axis ), node.cosTheta = 1;
+		for (int i = 0; i < count; i++) node.cosTheta = min( node.cosTheta, dot( node.axis, lights[idx[i]].N ) );
+	}
+	node.left = node.right = node.parent = -1;
+	node.dummy0 = node.dummy1 = 0;
+	if (count > 1)
+	{
+		const float3 extent = cmax - cmin;
+		const int splitAxis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		const int mid = count / 2;
+		nth_element( idx, idx + mid, idx + count, [&]( const int a, const int b ) {
+			return ((float*)&lights[a].bmin)[splitAxis] + ((float*)&lights[a].bmax)[splitAxis] <
+				((float*)&lights[b].bmin)[splitAxis] + ((float*)&lights[b].bmax)[splitAxis]; } );
+		node.left = BuildLightTreeNode( lights, idx, mid, tree, nextNode );
+		node.right = BuildLightTreeNode( lights, idx + mid, count - mid, tree, nextNode );
+		tree[node.left].parent = tree[node.right].parent = nodeIdx;
+	}
+	tree[nodeIdx] = node;
+	return nodeIdx;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::BuildLightTree                                               |
+//  |  Build a light tree for the area, point and spot lights. Area lights emit   |
+//  |  in the direction of their normal; point and spot lights are treated as     |
+//  |  emitting in all directions.                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::BuildLightTree( const vector<CoreLightTri>& areaLights, const vector<CorePointLight>& pointLights,
+	const vector<CoreSpotLight>& spotLights, vector<CoreLightTreeNode>& tree )
+{
+	vector<LightTreeInput> lights;
+	for (const CoreLightTri& l : areaLights)
+		lights.push_back( { fminf( l.vertex0, fminf( l.vertex1, l.vertex2 ) ), fmaxf( l.vertex0, fmaxf( l.vertex1, l.vertex2 ) ), l.N, l.energy, false } );
+	for (const CorePointLight& l : pointLights) lights.push_back( { l.position, l.position, make_float3( 0 ), l.energy, true } );
+	for (const CoreSpotLight& l : spotLights)
+		lights.push_back( { l.position, l.position, make_float3( 0 ), l.radiance.x + l.radiance.y + l.radiance.z, true } );
+	tree.resize( max( 0, 2 * (int)lights.size() - 1 ) );
+	if (lights.size() == 0) return;
+	vector<int> idx( lights.size() );
+	for (int i = 0; i < (int)lights.size(); i++) idx[i] = i;
+	int nextNode = 0;
+	BuildLightTreeNode( lights, idx.data(), (int)lights.size(), tree, nextNode );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::BuildLightAliasTable                                         |
+//  |  Build an alias table (Vose's method) over the area, point, spot and        |
+//  |  directional lights, so that the device can select a light with a           |
+//  |  probability proportional to its power in constant time.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::BuildLightAliasTable( const vector<CoreLightTri>& areaLights, const vector<CorePointLight>& pointLights,
+	const vector<CoreSpotLight>& spotLights, const vector<CoreDirectionalLight>& directionalLights, vector<CoreLightAlias>& table )
+{
+	vector<float> power;
+	for (const CoreLightTri& l : areaLights) power.push_back( l.energy );
+	for (const CorePointLight& l : pointLights) power.push_back( l.energy );
+	for (const CoreSpotLight& l : spotLights) power.push_back( l.radiance.x + l.radiance.y + l.radiance.z );
+	for (const CoreDirectionalLight& l : directionalLights) power.push_back( l.radiance.x + l.radiance.y + l.radiance.z );
+	const int count = (int)power.size();
+	table.resize( count );
+	if (count == 0) return;
+	double total = 0;
+	for (float& p : power) total += (p = max( 0.0f, p ));
+	// without any power, fall back to uniform selection
+	if (total <= 0) for (float& p : power) p = 1, total = count;
+	// scale to an average of 1, and split in entries below and above the average
+	vector<float> scaled( count );
+	vector<int> small, large;
+	for (int i = 0; i < count; i++)
+	{
+		scaled[i] = (float)(power[i] * count / total);
+		table[i].pickProb = (float)(power[i] / total), table[i].alias = i, table[i].dummy = 0;
+		(scaled[i] < 1 ? small : large).push_back( i );
+	}
+	while (small.size() > 0 && large.size() > 0)
+	{
+		const int s = small.back(), l = large.back();
+		small.pop_back();
+		table[s].threshold = scaled[s], table[s].alias = l;
+		scaled[l] -= 1 - scaled[s];
+		if (scaled[l] < 1) large.pop_back(), small.push_back( l );
+	}
+	// the remaining entries are at the average, up to rounding
+	for (int i : small) table[i].threshold = 1, table[i].alias = i;
+	for (int i : large) table[i].threshold = 1, table[i].alias = i;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderSystem::SynchronizeLights                                            |
-//  |  Detect changes to the lights. Note: light data is small, so we can safely  |
-//  |  send all data when something changes.                                LH2'19|
+//  |  Detect changes to the lights. If only area lights moved (e.g. because an   |
+//  |  emissive instance was transformed), the modified range of the area light   |
+//  |  array is converted and sent; otherwise all light data is sent.       LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeLights()
 {
-	bool lightsDirty = false;
-	for (auto light : scene->areaLights) if (light->Changed()) lightsDirty = true;
-	for (auto light : scene->pointLights) if (light->Changed()) lightsDirty = true;
-	for (auto light : scene->spotLights) if (light->Changed()) lightsDirty = true;
-	for (auto light : scene->directionalLights) if (light->Changed()) lightsDirty = true;
-	if (lightsDirty)
-	{
-		// send delta lights to core
-		vector<CoreLightTri> gpuAreaLights;
-		vector<CorePointLight> gpuPointLights;
-		vector<CoreSpotLight> gpuSpotLights;
-		vector<CoreDirectionalLight> gpuDirectionalLights;
-		for (auto light : scene->areaLights) if (light->enabled) gpuAreaLights.push_back( light->ConvertToCoreLightTri() );
+	// area lights: check if the list itself changed, and find the modified range
+	const int areaLightCount = (int)scene->areaLights.size();
+	bool lightsDirty = coreClaimed, fullUpdate = coreClaimed || (areaLightCount != (int)syncedAreaLights.size());
+	coreClaimed = false;
+	int firstDirty = (int)gpuAreaLights.size(), lastDirty = -1;
+	for (int i = 0; i < areaLightCount; i++)
+	{
+		HostAreaLight* light = scene->areaLights[i];
+		if (!fullUpdate && light != syncedAreaLights[i]) fullUpdate = true;
+		if (!light->Changed()) continue;
+		lightsDirty = true;
+		stats.dirtyLights++;
+		if (fullUpdate) continue;
+		const int slot = areaLightSlot[i];
+		if (light->enabled != (slot > -1)) fullUpdate = true; else if (slot > -1)
+		{
+			gpuAreaLights[slot] = light->ConvertToCoreLightTri();
+			firstDirty = min( firstDirty, slot ), lastDirty = max( lastDirty, slot );
+		}
+	}
+	// other light types: light data is small, so we can safely send all data when something changes
+	for (auto light : scene->pointLights) if (light->Changed()) lightsDirty = fullUpdate = true, stats.dirtyLights++;
+	for (auto light : scene->spotLights) if (light->Changed()) lightsDirty = fullUpdate = true, stats.dirtyLights++;
+	for (auto light : scene->directionalLights) if (light->Changed()) lightsDirty = fullUpdate = true, stats.dirtyLights++;
+	if (!lightsDirty || (!fullUpdate && lastDirty == -1)) return;
+	if (fullUpdate)
+	{
+		// send all lights to core
+		gpuAreaLights.clear();
+		gpuPointLights.clear();
+		gpuSpotLights.clear();
+		gpuDirectionalLights.clear();
+		syncedAreaLights = scene->areaLights;
+		areaLightSlot.resize( areaLightCount );
+		for (int i = 0; i < areaLightCount; i++)
+		{
+			HostAreaLight* light = scene->areaLights[i];
+			areaLightSlot[i] = light->enabled ? (int)gpuAreaLights.size() : -1;
+			if (light->enabled) gpuAreaLights.push_back( light->ConvertToCoreLightTri() );
+		}
 		for (auto light : scene->pointLights) if (light->enabled) gpuPointLights.push_back( light->ConvertToCorePointLight() );
 		for (auto light : scene->spotLights) if (light->enabled) gpuSpotLights.push_back( light->ConvertToCoreSpotLight() );
 		for (auto light : scene->directionalLights) if (light->enabled) gpuDirectionalLights.push_back( light->ConvertToCoreDirectionalLight() );
+	}
+	if (!fullUpdate && core->UpdateAreaLights( gpuAreaLights.data() + firstDirty, firstDirty, lastDirty - firstDirty + 1 ))
+		stats.bytesSent += (lastDirty - firstDirty + 1) * sizeof( CoreLightTri );
+	else
+	{
 		core->SetLights( gpuAreaLights.data(), (int)gpuAreaLights.size(),
 			gpuPointLights.data(), (int)gpuPointLights.size(),
 			gpuSpotLights.data(), (int)gpuSpotLights.size(),
 			gpuDirectionalLights.data(), (int)gpuDirectionalLights.size() );
+		stats.bytesSent += gpuAreaLights.size() * sizeof( CoreLightTri ) + gpuPointLights.size() * sizeof( CorePointLight ) +
+			gpuSpotLights.size() * sizeof( CoreSpotLight ) + gpuDirectionalLights.size() * sizeof( CoreDirectionalLight );
 	}
+	// light positions changed, so the selection structures are rebuilt in both cases
+	vector<CoreLightTreeNode> lightTree;
+	BuildLightTree( gpuAreaLights, gpuPointLights, gpuSpotLights, lightTree );
+	core->SetLightTree( lightTree.data(), (int)lightTree.size() );
+	vector<CoreLightAlias> lightAlias;
+	BuildLightAliasTable( gpuAreaLights, gpuPointLights, gpuSpotLights, gpuDirectionalLights, lightAlias );
+	core->SetLightAliasTable( lightAlias.data(), (int)lightAlias.size() );
+	stats.bytesSent += lightTree.size() * sizeof( CoreLightTreeNode ) + lightAlias.size() * sizeof( CoreLightAlias );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -216,12 +846,17 @@ void RenderSystem::SynchronizeLights()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeSceneData()
 {
-	SynchronizeSky();
-	SynchronizeTextures();
-	SynchronizeMaterials();
-	SynchronizeMeshes();
-	UpdateSceneGraph();
-	SynchronizeLights();
+	// per-frame statistics; the phases below add to the dirty counts and bytesSent
+	stats.dirtySky = stats.dirtyTextures = stats.dirtyMaterials = stats.dirtyMeshes = stats.dirtyInstances = stats.dirtyLights = 0;
+	stats.bytesSent = 0;
+	ClaimCore();
+	ProfileScope scope( profiler, "SynchronizeSceneData", &stats.syncTime );
+	{ ProfileScope s( profiler, "SynchronizeSky", &stats.skySyncTime ); SynchronizeSky(); }
+	{ ProfileScope s( profiler, "SynchronizeTextures", &stats.textureSyncTime ); SynchronizeTextures(); }
+	{ ProfileScope s( profiler, "SynchronizeMaterials", &stats.materialSyncTime ); SynchronizeMaterials(); }
+	{ ProfileScope s( profiler, "SynchronizeMeshes", &stats.meshSyncTime ); SynchronizeMeshes(); }
+	{ ProfileScope s( profiler, "UpdateSceneGraph", &stats.graphSyncTime ); UpdateSceneGraph(); }
+	{ ProfileScope s( profiler, "SynchronizeLights", &stats.lightSyncTime ); SynchronizeLights(); }
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -229,6 +864,215 @@ void RenderSystem::SynchronizeSceneData()
 //  |  Produce one image.                                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::Render( ViewPyramid& view, Convergence converge )
+{
+	const Timer renderTimer;
+	// the core holds the scene of another session; its stats then do not describe our last frame
+	const bool ownCore = coreOwner == this;
+	if (!ownCore) SynchronizeSceneData();
+	SendSettings();
+	AdaptFrameSamples( ownCore );
+	// periodic checkpoint of the frames accumulated so far; retried next frame if the core is still writing the last one
+	if (checkpointInterval > 0 && converge == Converge && checkpointTimer.elapsed() >= checkpointInterval)
+		if (core->SaveCheckpoint( checkpointFile.c_str() )) checkpointTimer.reset();
+	const bool capturing = profiler.Capturing();
+	// recording: frames that arrived since the last frame; collected before the core reuses their slots
+	if (recorder.Recording()) CollectFrames( false );
+	if (!capturing)
+	{
+		core->Render( view, converge, scene->camera->brightness, scene->camera->contrast );
+		if (recorder.Recording()) CollectFrames( false );
+	}
+	else
+	{
+		// profiled frame: the core's GPU ranges are relative to the start of its Render
+		const double frameStart = profiler.Now();
+		core->Render( view, converge, scene->camera->brightness, scene->camera->contrast );
+		profiler.Add( "Render", 0, frameStart, (float)(profiler.Now() - frameStart) );
+		if (recorder.Recording()) CollectFrames( false );
+		const ProfileEvent* coreEvents = 0;
+		const int count = core->GetProfileEvents( &coreEvents );
+		profiler.AddCoreEvents( coreEvents, count, frameStart );
+		profiler.EndFrame();
+	}
+	// telemetry: the core's stats are only fetched for sampled frames
+	if (telemetry.NextFrame()) telemetry.Add( stats, core->GetCoreStats(), renderTimer.elapsed() );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::RenderViews                                                  |
+//  |  Produce one image for each of the views, e.g. for stereo or for a rig of   |
+//  |  cameras. If the core cannot render the views in a single frame, they are   |
+//  |  rendered one at a time; each view then restarts converging.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, Convergence converge )
+{
+	if (count < 1) return;
+	// the core holds the scene of another session
+	if (coreOwner != this) SynchronizeSceneData();
+	SendSettings();
+	const float brightness = scene->camera->brightness, contrast = scene->camera->contrast;
+	if (core->RenderViews( views, targets, count, converge, brightness, contrast )) return;
+	for (int i = 0; i < count; i++)
+	{
+		core->SetTarget( targets[i], targetSpp );
+		core->Render( views[i], Restart, brightness, contrast );
+	}
+	// restore the render target of the session
+	if (bindTarget) bindTarget();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::BakeProbes                                                   |
+//  |  Render a cube map for each of the probe positions, as seen from the probe, |
+//  |  to host memory: faces + (probe * 6 + face) * faceSize^2 receives a face,   |
+//  |  in the order +x, -x, +y, -y, +z, -z. A face is the image of a camera with  |
+//  |  a 90 degree field of view that looks along the axis, with +y as its up     |
+//  |  vector, or -z / +z for +y / -y. The six faces of a probe are rendered as   |
+//  |  the views of one bake. Pixels hold linear radiance and the distance to the |
+//  |  first hit, see CoreAPI_Base::BakeViews. Returns false if the core cannot   |
+//  |  bake; the render target restarts converging.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::BakeProbes( const float3* positions, const int count, const int faceSize, const uint spp, float4* faces )
+{
+	static const float3 forward[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	static const float3 up[6] = { { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 } };
+	if (count < 1 || faceSize < 1) return false;
+	// the core holds the scene of another session
+	if (coreOwner != this) SynchronizeSceneData();
+	SendSettings();
+	for (int probe = 0; probe < count; probe++)
+	{
+		ViewPyramid views[6];
+		for (int face = 0; face < 6; face++)
+		{
+			// 90 degrees: the corners of the screen plane at distance 1 are one unit off the axis
+			const float3 F = forward[face], U = up[face], R = cross( F, U ), C = positions[probe] + F;
+			ViewPyramid& view = views[face];
+			view.pos = positions[probe];
+			view.p1 = C - R + U, view.p2 = C + R + U, view.p3 = C - R - U;
+			view.aperture = 0;
+			view.spreadAngle = (PI * 0.5f) / (float)faceSize;
+		}
+		float4* probeFaces = faces + (size_t)probe * 6 * faceSize * faceSize;
+		if (!core->BakeViews( views, 6, faceSize, faceSize, spp, probeFaces )) return false;
+	}
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::BakeLightmap                                                 |
+//  |  Bake the lighting of a mesh node into a width x height lightmap in host    |
+//  |  memory, using the lightmap uvs of the mesh the core has for the node.      |
+//  |  Texel (x, y) is at uv ((x + 0.5) / width, (y + 0.5) / height); texels      |
+//  |  whose centre lies on a triangle are path traced from the surface, see      |
+//  |  CoreAPI_Base::BakeTexels: rgb receives the radiance that leaves the texel  |
+//  |  along the normal, and w is 1. Other texels have w = 0. Dilation passes     |
+//  |  fill those next to the mesh with the average of their filled neighbours,   |
+//  |  so that filtered lookups near chart borders do not blend in black.         |
+//  |  Returns false if the mesh has no lightmap uvs or if the core cannot bake.  |
+//  |  The render target restarts converging.                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::BakeLightmap( const int nodeId, const int width, const int height, const uint spp, float4* lightmap, const int dilation )
+{
+	if (nodeId < 0 || nodeId >= (int)HostScene::nodes.size() || !HostScene::nodes[nodeId] || width < 1 || height < 1) return false;
+	const HostNode* node = HostScene::nodes[nodeId];
+	const int meshID = node->lodMeshID >= 0 ? node->lodMeshID : node->meshID;
+	if (meshID < 0) return false;
+	HostMesh* mesh = HostScene::meshes[meshID];
+	if (!mesh->RestoreHostData() || mesh->lightmapUVs.size() != mesh->triangles.size() * 3) return false;
+	// the core holds the scene of another session
+	if (coreOwner != this) SynchronizeSceneData();
+	SendSettings();
+	// rasterize the triangles in lightmap space; the first triangle that covers a texel centre owns the texel
+	const mat4& T = node->combinedTransform;
+	const float2 size = make_float2( (float)width, (float)height );
+	vector<int> texelIdx( width * height, -1 );
+	vector<float4> texels; // world space position and ray start height, normal
+	for (size_t s = mesh->triangles.size(), i = 0; i < s; i++)
+	{
+		const HostTri& tri = mesh->triangles[i];
+		const float3 v0 = make_float3( T * make_float4( tri.vertex0, 1 ) );
+		const float3 v1 = make_float3( T * make_float4( tri.vertex1, 1 ) );
+		const float3 v2 = make_float3( T * make_float4( tri.vertex2, 1 ) );
+		const float2 t0 = mesh->lightmapUVs[i * 3 + 0] * size, t1 = mesh->lightmapUVs[i * 3 + 1] * size, t2 = mesh->lightmapUVs[i * 3 + 2] * size;
+		float3 N = cross( v1 - v0, v2 - v0 );
+		const float area2 = length( N ), uvArea2 = (t1.x - t0.x) * (t2.y - t0.y) - (t1.y - t0.y) * (t2.x - t0.x);
+		if (area2 == 0 || uvArea2 == 0) continue;
+		N *= 1.0f / area2;
+		if (dot( N, make_float3( T * make_float4( tri.Nx, tri.Ny, tri.Nz, 0 ) ) ) < 0) N *= -1.0f; // mirroring transform
+		// rays start half a texel above the surface
+		const float rayHeight = max( 0.5f * sqrtf( area2 / fabsf( uvArea2 ) ), 0.0001f );
+		const int x0 = max( 0, (int)floorf( min( t0.x, min( t1.x, t2.x ) ) ) ), x1 = min( width - 1, (int)ceilf( max( t0.x, max( t1.x, t2.x ) ) ) );
+		const int y0 = max( 0, (int)floorf( min( t0.y, min( t1.y, t2.y ) ) ) ), y1 = min( height - 1, (int)ceilf( max( t0.y, max( t1.y, t2.y ) ) ) );
+		for (int y = y0; y <= y1; y++) for (int x = x0; x <= x1; x++)
+		{
+			if (texelIdx[x + y * width] >= 0) continue;
+			const float2 p = make_float2( x + 0.5f, y + 0.5f );
+			const float b1 = ((p.x - t0.x) * (t2.y - t0.y) - (p.y - t0.y) * (t2.x - t0.x)) / uvArea2;
+			const float b2 = ((t1.x - t0.x) * (p.y - t0.y) - (t1.y - t0.y) * (p.x - t0.x)) / uvArea2;
+			if (b1 < 0 || b2 < 0 || b1 + b2 > 1) continue;
+			texelIdx[x + y * width] = (int)texels.size() / 2;
+			texels.push_back( make_float4( v0 * (1 - b1 - b2) + v1 * b1 + v2 * b2, rayHeight ) );
+			texels.push_back( make_float4( N, 0 ) );
+		}
+	}
+	const int count = (int)texels.size() / 2;
+	if (count == 0) return false;
+	vector<float4> radiance( count );
+	if (!core->BakeTexels( texels.data(), count, spp, radiance.data() )) return false;
+	vector<uchar> filled( width * height ), next;
+	for (int i = 0; i < width * height; i++)
+	{
+		filled[i] = texelIdx[i] >= 0;
+		lightmap[i] = filled[i] ? make_float4( make_float3( radiance[texelIdx[i]] ), 1 ) : make_float4( 0 );
+	}
+	// dilate: each pass extends the filled area by one texel
+	for (int pass = 0; pass < dilation; pass++)
+	{
+		next = filled;
+		for (int y = 0; y < height; y++) for (int x = 0; x < width; x++) if (!filled[x + y * width])
+		{
+			float3 sum = make_float3( 0 );
+			int n = 0;
+			for (int v = max( 0, y - 1 ); v <= min( height - 1, y + 1 ); v++)
+				for (int u = max( 0, x - 1 ); u <= min( width - 1, x + 1 ); u++) if (filled[u + v * width]) sum += make_float3( lightmap[u + v * width] ), n++;
+			if (n > 0) lightmap[x + y * width] = make_float4( sum * (1.0f / n), 0 ), next[x + y * width] = 1;
+		}
+		filled.swap( next );
+	}
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::ScatterInstances                                             |
+//  |  Cover the surface of a node with 'count' instances of the prototype        |
+//  |  meshes, e.g. grass or rocks on terrain, generated by the core: there is    |
+//  |  no node per instance, and the members never exist on the host. The mask    |
+//  |  texture, if any, scales the density over the uv square of the surface.     |
+//  |  The instances follow the transform of the node. The scatter is sent with   |
+//  |  the next SynchronizeSceneData; returns its ID, or -1 for invalid input.    |
+//  |  Cores that cannot scatter render the surface without the instances.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderSystem::ScatterInstances( const int nodeId, const int* prototypes, const int prototypeCount, const int count,
+	const float2 scale, const int maskTexture, const uint seed )
+{
+	if (nodeId < 0 || nodeId >= (int)HostScene::nodes.size() || !HostScene::nodes[nodeId] || HostScene::nodes[nodeId]->meshID < 0) return -1;
+	if (prototypeCount < 1 || count < 1) return -1;
+	for (int i = 0; i < prototypeCount; i++) if (prototypes[i] < 0 || prototypes[i] >= (int)HostScene::meshes.size()) return -1;
+	Scatter scatter;
+	scatter.node = nodeId, scatter.slot = HostScene::ClaimInstanceSlot( nodeId );
+	scatter.prototypes.assign( prototypes, prototypes + prototypeCount );
+	scatter.count = count, scatter.maskTexture = maskTexture, scatter.scale = scale, scatter.seed = seed;
+	scatter.sent = scatter.generated = false;
+	scatters.push_back( scatter );
+	return (int)scatters.size() - 1;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SendSettings                                                 |
+//  |  Forward the render settings to the core, before a frame.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::SendSettings()
 {
 	// forward to core; core may ignore or accept a setting
 	core->Setting( "epsilon", settings.geometryEpsilon );
@@ -237,7 +1081,670 @@ void RenderSystem::Render( ViewPyramid& view, Convergence converge )
 	core->Setting( "clampIndirect", settings.filterIndirectClamp );
 	core->Setting( "filter", settings.filterEnabled );
 	core->Setting( "TAA", settings.TAAEnabled );
-	core->Render( view, converge, scene->camera->brightness, scene->camera->contrast );
+	core->Setting( "foveaX", settings.foveaX );
+	core->Setting( "foveaY", settings.foveaY );
+	core->Setting( "foveaRadius", settings.foveaRadius );
+	core->Setting( "foveaMinRate", settings.foveaMinRate );
+	core->Setting( "bandStart", settings.bandStart );
+	core->Setting( "bandEnd", settings.bandEnd );
+	core->Setting( "tileRows", (float)settings.tileRows );
+	core->Setting( "previewMode", (float)settings.previewMode );
+	if (settings.aoDistance > 0) core->Setting( "aoDistance", settings.aoDistance );
+	if (settings.videoKeyFrame) core->Setting( "videoKeyFrame", 1 ), settings.videoKeyFrame = false;
+	core->Setting( "profile", profiler.Capturing() ? 1.0f : 0.0f );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::AdaptFrameSamples                                            |
+//  |  Frame time controller: with settings.frameTimeTarget set, pick the spp of  |
+//  |  the next frame from the render times of the last frames, so interactive    |
+//  |  views keep their frame rate, while a still view takes as many samples per  |
+//  |  frame as the budget allows. The cost of a sample is assumed to scale with  |
+//  |  the path length; with minPathLength, paths are shortened when even 1 spp   |
+//  |  is over budget. The core reallocates its path state only when spp grows    |
+//  |  beyond its capacity, see "frameSpp".                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::AdaptFrameSamples( const bool measure )
+{
+	const int fullLength = settings.maxPathLength;
+	const bool adaptLength = fullLength > 0 && settings.minPathLength > 0;
+	if (settings.frameTimeTarget <= 0)
+	{
+		sampleTime = 0, frameSpp = targetSpp, framePathLength = fullLength;
+	}
+	else
+	{
+		// smoothed cost of a sample, from the last frame
+		const float frameTime = core->GetCoreStats().renderTime * 1000.0f;
+		const float lengthScale = adaptLength ? (float)framePathLength / fullLength : 1.0f;
+		if (measure && frameSpp > 0 && frameTime > 0)
+		{
+			const float t = frameTime / (frameSpp * lengthScale);
+			sampleTime = sampleTime > 0 ? 0.8f * sampleTime + 0.2f * t : t;
+		}
+		const float samples = sampleTime > 0 ? settings.frameTimeTarget / sampleTime : 1.0f;
+		// drop at once, but only step up if the extra samples fit with 10% to spare, to prevent oscillation
+		const float maxSpp = (float)max( 1u, settings.maxFrameSpp );
+		const uint fit = (uint)max( 1.0f, min( maxSpp, samples ) );
+		const uint fitWithSlack = (uint)max( 1.0f, min( maxSpp, samples / 1.1f ) );
+		if (frameSpp == 0 || fit < frameSpp) frameSpp = fit; else if (fitWithSlack > frameSpp) frameSpp = fitWithSlack;
+		framePathLength = fullLength;
+		if (adaptLength && samples < 1) framePathLength = max( min( settings.minPathLength, fullLength ), (int)(fullLength * samples) );
+	}
+	// sent each frame: SetTarget and another session may have changed the core's spp
+	core->Setting( "frameSpp", (float)frameSpp );
+	if (framePathLength > 0) core->Setting( "maxPathLength", (float)framePathLength );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameProfiler::Add                                                         |
+//  |  Add a range to the timeline of the current frame.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void FrameProfiler::Add( const char* name, const int track, const double start, const float duration, const int bounce )
+{
+	Event e = { name, track, frame, bounce, start, duration };
+	events.push_back( e );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameProfiler::AddCoreEvents                                               |
+//  |  Add the GPU ranges that the core recorded for the last frame. The core     |
+//  |  measures these relative to the start of its Render.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void FrameProfiler::AddCoreEvents( const ProfileEvent* coreEvents, const int count, const double frameStart )
+{
+	for (int i = 0; i < count; i++)
+	{
+		const ProfileEvent& e = coreEvents[i];
+		Add( e.name, 1 + e.track, frameStart + e.start, e.duration, e.bounce );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameProfiler::SaveChromeTrace                                             |
+//  |  Write the captured timeline as a JSON trace, for chrome://tracing or       |
+//  |  Perfetto. Each track becomes a thread of a single process.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool FrameProfiler::SaveChromeTrace( const char* fileName ) const
+{
+	FILE* f = fopen( fileName, "w" );
+	if (!f) return false;
+	static const char* trackNames[3] = { "RenderSystem (CPU)", "GPU render", "GPU update" };
+	fprintf( f, "{\"traceEvents\":[\n" );
+	for (int i = 0; i < 3; i++)
+		fprintf( f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%i,\"args\":{\"name\":\"%s\"}},\n", i, trackNames[i] );
+	for (const Event& e : events)
+	{
+		fprintf( f, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%i,\"args\":{\"frame\":%i",
+			e.name, e.start, e.duration, e.track, e.frame );
+		if (e.bounce >= 0) fprintf( f, ",\"bounce\":%i", e.bounce );
+		fprintf( f, "}},\n" );
+	}
+	// the trace format does not allow a trailing comma; close with an empty metadata event
+	fprintf( f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"LightHouse2\"}}\n]}\n" );
+	fclose( f );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::RecordFrames                                                 |
+//  |  Start saving each rendered frame: to a file, if a printf-style file name   |
+//  |  pattern is specified (e.g. "frames/frame%05i.png"), and / or to callback.  |
+//  |  The extension selects the format; EXR and HDR store floats. Frames are     |
+//  |  read back by the core and written on a background thread. Returns false    |
+//  |  if the core cannot read back frames.                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::RecordFrames( const char* fileNamePattern, const FrameCallback callback, void* userData )
+{
+	if (recorder.Recording()) StopRecording();
+	if (!core->SetFrameReadback( true )) return false;
+	recorder.Start( fileNamePattern, callback, userData );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::StopRecording                                                |
+//  |  Wait for the frames still on their way, write them, and stop recording.    |
+//  |  Returns the number of frames written.                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderSystem::StopRecording()
+{
+	if (!recorder.Recording()) return recorder.FramesWritten();
+	CollectFrames( true );
+	core->SetFrameReadback( false );
+	return recorder.Stop();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::StartTelemetry                                               |
+//  |  Log the timings and counters of every sampleInterval-th frame to a file,   |
+//  |  as CSV or as binary TelemetryRecords; a background thread writes them      |
+//  |  every flushInterval seconds. Replaces a running log. Returns false if the  |
+//  |  file can't be created.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::StartTelemetry( const char* fileName, const TelemetryFormat format, const int sampleInterval, const float flushInterval )
+{
+	return telemetry.Start( fileName, format, sampleInterval, flushInterval );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SetCheckpoints                                               |
+//  |  Snapshot the accumulation state of the render target to a file every       |
+//  |  interval seconds while converging, so that a long render can be resumed    |
+//  |  with ResumeCheckpoint. The core writes the file in the background. An      |
+//  |  interval of 0 stops the snapshots.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::SetCheckpoints( const char* file, const float interval )
+{
+	checkpointFile = file ? file : "";
+	checkpointInterval = checkpointFile.empty() ? 0 : interval;
+	checkpointTimer.reset();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::ResumeCheckpoint                                             |
+//  |  Restore the accumulation state from a checkpoint; converging frames then   |
+//  |  continue where the checkpointed render stopped. Set the render target of   |
+//  |  that render, and load its scene, first. Returns false if the core cannot   |
+//  |  resume from the file.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderSystem::ResumeCheckpoint( const char* file )
+{
+	// the core holds the scene of another session
+	if (coreOwner != this) SynchronizeSceneData();
+	return core->LoadCheckpoint( file );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::CollectFrames                                                |
+//  |  Pass the frames that the core read back to the recorder, oldest first.     |
+//  |  The recorder copies them; the core may reuse its buffers in the next       |
+//  |  Render.                                                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::CollectFrames( const bool wait )
+{
+	const float4* pixels;
+	int width, height, frame;
+	while ((frame = core->GetReadbackFrame( &pixels, width, height, wait )) >= 0) recorder.Add( pixels, width, height, frame );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameRecorder::Start                                                       |
+//  |  Start the writer thread.                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void FrameRecorder::Start( const char* fileNamePattern, const FrameCallback frameCallback, void* frameUserData )
+{
+	Stop();
+	pattern = fileNamePattern ? fileNamePattern : "";
+	callback = frameCallback, userData = frameUserData;
+	written = 0, firstFrame = -1, quit = false;
+	writer = std::thread( [this]() { WriterLoop(); } );
+	running = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameRecorder::Add                                                         |
+//  |  Queue a copy of a frame. Waits while maxQueued frames are queued, so a     |
+//  |  slow encoder throttles rendering instead of dropping frames.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void FrameRecorder::Add( const float4* pixels, const int width, const int height, const int frame )
+{
+	if (!running) return;
+	if (firstFrame < 0) firstFrame = frame;
+	Frame f;
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		frameDone.wait( guard, [this]() { return queue.size() < maxQueued; } );
+		if (!spare.empty()) f.pixels.swap( spare.back() ), spare.pop_back();
+	}
+	// copy outside the lock, so the writer can take the next frame meanwhile
+	f.pixels.assign( pixels, pixels + width * height );
+	f.width = width, f.height = height, f.index = frame - firstFrame;
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		queue.push_back( std::move( f ) );
+	}
+	frameAdded.notify_one();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameRecorder::Stop                                                        |
+//  |  Let the writer finish the queue, and join it.                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+int FrameRecorder::Stop()
+{
+	if (!running) return written;
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		quit = true;
+	}
+	frameAdded.notify_one();
+	writer.join();
+	running = false;
+	spare.clear();
+	return written;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameRecorder::WriterLoop                                                  |
+//  |  Background thread: hand each queued frame to the callback and save it.     |
+//  |  Ends when Stop was called and the queue is empty.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void FrameRecorder::WriterLoop()
+{
+	while (1)
+	{
+		Frame f;
+		{
+			std::unique_lock<std::mutex> guard( lock );
+			frameAdded.wait( guard, [this]() { return quit || !queue.empty(); } );
+			if (queue.empty()) return;
+			f = std::move( queue.front() );
+			queue.pop_front();
+		}
+		if (callback) callback( f.pixels.data(), f.width, f.height, f.index, userData );
+		if (!pattern.empty() && !Save( f )) printf( "FrameRecorder: could not save frame %i\n", f.index );
+		written++;
+		{
+			std::lock_guard<std::mutex> guard( lock );
+			spare.push_back( std::move( f.pixels ) );
+		}
+		frameDone.notify_one();
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameRecorder::Save                                                        |
+//  |  Encode a frame using FreeImage. EXR and HDR files receive the float        |
+//  |  values; other formats receive 8-bit RGB. The pixels are finalized, i.e.    |
+//  |  including brightness, contrast and gamma, in both cases.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool FrameRecorder::Save( const Frame& frame ) const
+{
+	char fileName[1024];
+	snprintf( fileName, sizeof( fileName ), pattern.c_str(), frame.index );
+	const FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename( fileName );
+	if (fif == FIF_UNKNOWN) return false;
+	const bool hdr = fif == FIF_EXR || fif == FIF_HDR;
+	FIBITMAP* dib = hdr ? FreeImage_AllocateT( FIT_RGBF, frame.width, frame.height ) : FreeImage_Allocate( frame.width, frame.height, 24 );
+	if (!dib) return false;
+	for (int y = 0; y < frame.height; y++)
+	{
+		// FreeImage stores the bottom row first
+		BYTE* line = FreeImage_GetScanLine( dib, frame.height - 1 - y );
+		const float4* src = frame.pixels.data() + y * frame.width;
+		if (hdr) for (int x = 0; x < frame.width; x++)
+		{
+			FIRGBF* dst = (FIRGBF*)line + x;
+			dst->red = src[x].x, dst->green = src[x].y, dst->blue = src[x].z;
+		}
+		else for (int x = 0; x < frame.width; x++)
+		{
+			line[x * 3 + FI_RGBA_RED] = (BYTE)(min( 1.0f, max( 0.0f, src[x].x ) ) * 255.0f + 0.5f);
+			line[x * 3 + FI_RGBA_GREEN] = (BYTE)(min( 1.0f, max( 0.0f, src[x].y ) ) * 255.0f + 0.5f);
+			line[x * 3 + FI_RGBA_BLUE] = (BYTE)(min( 1.0f, max( 0.0f, src[x].z ) ) * 255.0f + 0.5f);
+		}
+	}
+	const bool saved = FreeImage_Save( fif, dib, fileName ) != 0;
+	FreeImage_Unload( dib );
+	return saved;
+}
+
+// CSV columns of the telemetry log
+#define TELEMETRYFIELD( name, type ) { #name, offsetof( TelemetryRecord, name ), type }
+static const struct { const char* name; size_t offset; char type; } telemetryFields[] = {
+	// type: 'f' float, 'd' double, 'u' uint, 'U' uint64_t; in the order of TelemetryRecord
+	TELEMETRYFIELD( frame, 'U' ), TELEMETRYFIELD( time, 'd' ), TELEMETRYFIELD( frameTime, 'f' ), TELEMETRYFIELD( renderCallTime, 'f' ),
+	TELEMETRYFIELD( syncTime, 'f' ), TELEMETRYFIELD( skySyncTime, 'f' ), TELEMETRYFIELD( textureSyncTime, 'f' ), TELEMETRYFIELD( materialSyncTime, 'f' ),
+	TELEMETRYFIELD( meshSyncTime, 'f' ), TELEMETRYFIELD( graphSyncTime, 'f' ), TELEMETRYFIELD( lightSyncTime, 'f' ), TELEMETRYFIELD( sceneUpdateTime, 'f' ),
+	TELEMETRYFIELD( dirtyTextures, 'u' ), TELEMETRYFIELD( dirtyMaterials, 'u' ), TELEMETRYFIELD( dirtyMeshes, 'u' ), TELEMETRYFIELD( dirtyInstances, 'u' ),
+	TELEMETRYFIELD( dirtyLights, 'u' ), TELEMETRYFIELD( bytesSent, 'U' ),
+	TELEMETRYFIELD( renderTime, 'f' ), TELEMETRYFIELD( traceTime0, 'f' ), TELEMETRYFIELD( traceTime1, 'f' ), TELEMETRYFIELD( traceTimeX, 'f' ),
+	TELEMETRYFIELD( shadowTraceTime, 'f' ), TELEMETRYFIELD( shadeTime, 'f' ), TELEMETRYFIELD( sortTime, 'f' ), TELEMETRYFIELD( denoiseTime, 'f' ),
+	TELEMETRYFIELD( finalizeTime, 'f' ), TELEMETRYFIELD( bvhBuildTime, 'f' ),
+	TELEMETRYFIELD( totalRays, 'u' ), TELEMETRYFIELD( primaryRayCount, 'u' ), TELEMETRYFIELD( bounce1RayCount, 'u' ), TELEMETRYFIELD( deepRayCount, 'u' ),
+	TELEMETRYFIELD( totalShadowRays, 'u' ), TELEMETRYFIELD( VRAMInUse, 'U' )
+};
+#undef TELEMETRYFIELD
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink::Start                                                       |
+//  |  Open the log and start the writer thread. Returns false if the file can't  |
+//  |  be created.                                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool TelemetrySink::Start( const char* fileName, const TelemetryFormat logFormat, const int sampleInterval, const float flushSeconds )
+{
+	Stop();
+	file = fopen( fileName, logFormat == TelemetryBinary ? "wb" : "w" );
+	if (!file) return false;
+	format = logFormat;
+	interval = (uint)max( 1, sampleInterval );
+	flushInterval = max( 0.01f, flushSeconds );
+	if (format == TelemetryBinary)
+	{
+		TelemetryHeader header;
+		header.recordSize = sizeof( TelemetryRecord );
+		fwrite( &header, sizeof( header ), 1, file );
+	}
+	else
+	{
+		for (int i = 0; i < sizeof( telemetryFields ) / sizeof( telemetryFields[0] ); i++) fprintf( file, i ? ",%s" : "%s", telemetryFields[i].name );
+		fprintf( file, "\n" );
+	}
+	head = tail = 0, written = dropped = 0;
+	frame = 0, lastFrame = 0, frameTime = 0, quit = false;
+	clock.reset();
+	writer = std::thread( [this]() { WriterLoop(); } );
+	running = true;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink::NextFrame                                                   |
+//  |  Called once per frame, sampled or not: measures the frame time.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool TelemetrySink::NextFrame()
+{
+	if (!running) return false;
+	const double now = clock.elapsed();
+	frameTime = (float)(now - lastFrame), lastFrame = now;
+	return frame++ % interval == 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink::Add                                                         |
+//  |  Store a record for the frame counted by the last NextFrame. Only the       |
+//  |  rendering thread adds records.                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TelemetrySink::Add( const SystemStats& s, const CoreStats& c, const float renderCallTime )
+{
+	const uint i = head.load( std::memory_order_relaxed );
+	if (i - tail.load( std::memory_order_acquire ) >= ringSize) { dropped++; return; }
+	TelemetryRecord& r = ring[i & (ringSize - 1)];
+	r.frame = frame - 1, r.time = clock.elapsed(), r.frameTime = frameTime, r.renderCallTime = renderCallTime;
+	r.syncTime = s.syncTime, r.skySyncTime = s.skySyncTime, r.textureSyncTime = s.textureSyncTime, r.materialSyncTime = s.materialSyncTime;
+	r.meshSyncTime = s.meshSyncTime, r.graphSyncTime = s.graphSyncTime, r.lightSyncTime = s.lightSyncTime, r.sceneUpdateTime = s.sceneUpdateTime;
+	r.dirtyTextures = s.dirtyTextures, r.dirtyMaterials = s.dirtyMaterials, r.dirtyMeshes = s.dirtyMeshes;
+	r.dirtyInstances = s.dirtyInstances, r.dirtyLights = s.dirtyLights, r.bytesSent = s.bytesSent;
+	r.renderTime = c.renderTime, r.traceTime0 = c.traceTime0, r.traceTime1 = c.traceTime1, r.traceTimeX = c.traceTimeX;
+	r.shadowTraceTime = c.shadowTraceTime, r.shadeTime = c.shadeTime, r.sortTime = c.sortTime;
+	r.denoiseTime = c.denoiseTime, r.finalizeTime = c.finalizeTime, r.bvhBuildTime = c.bvhBuildTime;
+	r.totalRays = c.totalRays, r.primaryRayCount = c.primaryRayCount, r.bounce1RayCount = c.bounce1RayCount;
+	r.deepRayCount = c.deepRayCount, r.totalShadowRays = c.totalShadowRays;
+	r.VRAMInUse = 0;
+	for (int j = 0; j < VRAMCategories; j++) r.VRAMInUse += c.VRAMInUse[j];
+	// publish the record; the writer reads slots up to head only
+	head.store( i + 1, std::memory_order_release );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink::Stop                                                        |
+//  |  Let the writer write the ring, and close the log.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+int TelemetrySink::Stop()
+{
+	if (!running) return written;
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		quit = true;
+	}
+	wakeUp.notify_one();
+	writer.join();
+	fclose( file );
+	file = 0;
+	running = false;
+	if (dropped > 0) printf( "TelemetrySink: %i records dropped\n", dropped.load() );
+	return written;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink::WriterLoop                                                  |
+//  |  Background thread: write the records added since the last pass, every      |
+//  |  flushInterval seconds. Ends after a last pass once Stop was called.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TelemetrySink::WriterLoop()
+{
+	while (1)
+	{
+		bool last;
+		{
+			std::unique_lock<std::mutex> guard( lock );
+			wakeUp.wait_for( guard, std::chrono::duration<float>( flushInterval ), [this]() { return quit; } );
+			last = quit;
+		}
+		const uint end = head.load( std::memory_order_acquire );
+		uint i = tail.load( std::memory_order_relaxed );
+		for (; i != end; i++) Write( ring[i & (ringSize - 1)] ), written++;
+		tail.store( end, std::memory_order_release ); // frees the slots for Add
+		fflush( file );
+		if (last) return;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink::Write                                                       |
+//  |  Append a record to the log.                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TelemetrySink::Write( const TelemetryRecord& record )
+{
+	if (format == TelemetryBinary) { fwrite( &record, sizeof( record ), 1, file ); return; }
+	const uchar* base = (const uchar*)&record;
+	for (int i = 0; i < sizeof( telemetryFields ) / sizeof( telemetryFields[0] ); i++)
+	{
+		const void* field = base + telemetryFields[i].offset;
+		const char* separator = i ? "," : "";
+		switch (telemetryFields[i].type)
+		{
+		case 'f': fprintf( file, "%s%.6g", separator, *(const float*)field ); break;
+		case 'd': fprintf( file, "%s%.6f", separator, *(const double*)field ); break;
+		case 'u': fprintf( file, "%s%u", separator, *(const uint*)field ); break;
+		case 'U': fprintf( file, "%s%llu", separator, (unsigned long long)*(const uint64_t*)field ); break;
+		}
+	}
+	fprintf( file, "\n" );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::Start                                                        |
+//  |  Start the render thread. From here on, the application edits copies of     |
+//  |  the camera and the settings.                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::Start( RenderSystem* system, const Command& threadInit )
+{
+	renderer = system;
+	camera = new Camera();
+	*camera = *renderer->scene->camera;
+	settings = renderer->settings;
+	quit = false, nodesSynced = false;
+	thread = std::thread( [this, threadInit]() { if (threadInit) threadInit(); ThreadLoop(); } );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::Stop                                                         |
+//  |  Execute the queued commands and end the render thread. The scene takes     |
+//  |  over the camera and the settings of the application.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::Stop()
+{
+	if (!thread.joinable()) return;
+	quit = true;
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		wakeUp.notify_one();
+	}
+	thread.join();
+	*renderer->scene->camera = *camera;
+	renderer->settings = settings;
+	delete camera;
+	camera = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::Push                                                         |
+//  |  Queue a command. Only the application thread writes head, and only the     |
+//  |  render thread writes tail, so the ring needs no lock. The mutex is only    |
+//  |  taken to wake up an idle render thread.                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::Push( const Command& command )
+{
+	const uint h = head.load( std::memory_order_relaxed );
+	// the ring is full: the render thread is ringSize commands behind
+	while (h - tail.load( std::memory_order_acquire ) == ringSize) std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+	ring[h & (ringSize - 1)] = command;
+	head.store( h + 1 );
+	if (sleeping)
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		wakeUp.notify_one();
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::PushFrame                                                    |
+//  |  Queue a frame. The frame stores the camera and the settings, so that the   |
+//  |  application can prepare the next frame while this one renders. Waits       |
+//  |  while maxFrames frames are queued, to bound the latency.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::PushFrame( const Convergence converge )
+{
+	while (queuedFrames.load() >= maxFrames) std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+	Frame frame;
+	frame.view = camera->GetView();
+	frame.position = camera->position, frame.direction = camera->direction;
+	frame.focalDistance = camera->focalDistance, frame.aperture = camera->aperture;
+	frame.brightness = camera->brightness, frame.contrast = camera->contrast;
+	frame.FOV = camera->FOV, frame.clampValue = camera->clampValue;
+	frame.settings = settings, frame.converge = converge;
+	// a key frame request applies to a single frame, as with RenderSystem::Render
+	settings.videoKeyFrame = false;
+	queuedFrames++;
+	Push( [this, frame]() { RenderFrame( frame ); } );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::RenderFrame                                                  |
+//  |  Render thread: render a queued frame and keep its stats for the            |
+//  |  application.                                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::RenderFrame( const Frame& frame )
+{
+	Camera* c = renderer->scene->camera;
+	c->position = frame.position, c->direction = frame.direction;
+	c->focalDistance = frame.focalDistance, c->aperture = frame.aperture;
+	c->brightness = frame.brightness, c->contrast = frame.contrast;
+	c->FOV = frame.FOV, c->clampValue = frame.clampValue;
+	renderer->settings = frame.settings;
+	ViewPyramid view = frame.view;
+	renderer->Render( view, frame.converge );
+	{
+		std::lock_guard<std::mutex> guard( statsLock );
+		coreStats = renderer->GetCoreStats();
+		systemStats = renderer->GetSystemStats();
+	}
+	queuedFrames--;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::ThreadLoop                                                   |
+//  |  Render thread: execute the commands in order; sleep while there are none.  |
+//  |  A slot is released after its command completed, so that an empty ring      |
+//  |  means an idle render thread. Ends when Stop was called and the ring is     |
+//  |  empty.                                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::ThreadLoop()
+{
+	while (1)
+	{
+		const uint t = tail.load( std::memory_order_relaxed );
+		if (t == head.load())
+		{
+			if (quit) return;
+			std::unique_lock<std::mutex> guard( sleepLock );
+			sleeping = true;
+			if (t == head.load() && !quit) wakeUp.wait_for( guard, std::chrono::milliseconds( 1 ) );
+			sleeping = false;
+			continue;
+		}
+		Command& command = ring[t & (ringSize - 1)];
+		command();
+		command = nullptr;
+		tail.store( t + 1, std::memory_order_release );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::Flush                                                        |
+//  |  Wait until the render thread executed all queued commands. The caller may  |
+//  |  then use the RenderSystem directly, until it queues a command.       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::Flush()
+{
+	while (tail.load( std::memory_order_acquire ) != head.load( std::memory_order_relaxed ))
+		std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+	// the caller may add or remove nodes
+	nodesSynced = false;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::SyncTarget                                                   |
+//  |  SetTarget* updated the aspect ratio of the scene camera, after a Flush.    |
+//  |  The frames of the application camera need it too.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderThread::SyncTarget()
+{
+	camera->aspectRatio = renderer->scene->camera->aspectRatio;
+	camera->pixelCount = renderer->scene->camera->pixelCount;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::ReserveNode                                                  |
+//  |  AddInstance returns the id of the new node at once. HostScene::AddInstance |
+//  |  fills the most recently freed slot first, else appends; the application    |
+//  |  keeps a copy of the slots to predict the id. The copy is taken again       |
+//  |  after calls that may have changed the scene directly.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderThread::ReserveNode()
+{
+	if (!nodesSynced) SyncNodes();
+	int nodeId;
+	if (freeNodes.size() > 0) nodeId = freeNodes.back(), freeNodes.pop_back();
+	else nodeId = (int)liveNodes.size(), liveNodes.push_back( false );
+	liveNodes[nodeId] = true;
+	return nodeId;
+}
+
+void RenderThread::ReleaseNode( const int nodeId )
+{
+	if (!nodesSynced) SyncNodes();
+	// HostScene::RemoveInstance ignores removed nodes
+	if (nodeId < 0 || nodeId >= liveNodes.size() || !liveNodes[nodeId]) return;
+	liveNodes[nodeId] = false;
+	freeNodes.push_back( nodeId );
+}
+
+void RenderThread::SyncNodes()
+{
+	Flush();
+	freeNodes = HostScene::FreeNodes();
+	liveNodes.resize( HostScene::nodes.size() );
+	for (int i = 0; i < (int)liveNodes.size(); i++) liveNodes[i] = HostScene::nodes[i] != 0;
+	nodesSynced = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread::GetCoreStats                                                 |
+//  |  Stats of the last frame that the render thread finished.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+CoreStats RenderThread::GetCoreStats()
+{
+	std::lock_guard<std::mutex> guard( statsLock );
+	return coreStats;
+}
+
+SystemStats RenderThread::GetSystemStats()
+{
+	std::lock_guard<std::mutex> guard( statsLock );
+	return systemStats;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -246,10 +1753,19 @@ void RenderSystem::Render( ViewPyramid& view, Convergence converge )
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::Shutdown()
 {
+	// write the frames that are still on their way, and the telemetry log
+	StopRecording();
+	StopTelemetry();
 	// delete scene
 	delete scene;
-	// shutdown core
-	core->Shutdown();
+	scene = 0;
+	// remove this session from the core; shut it down with the last session
+	if (coreOwner == this)
+	{
+		for (int slot = 0; slot < instanceSlots; slot++) core->RemoveInstance( slot );
+		coreOwner = 0;
+	}
+	if (--sessionCount == 0) core->Shutdown();
 }
 
 // EOF
\ No newline at end of file
@@ -73,6 +73,205 @@ struct RenderSettings
 	float filterIndirectClamp = 2.5f;
 	uint filterEnabled = 1;
 	uint TAAEnabled = 1;
+	float foveaX = 0.5f, foveaY = 0.5f;		// foveated rendering: center of the full-rate region, in screen space (0..1)
+	float foveaRadius = 0;					// radius of the full-rate region, relative to the screen width; 0 disables foveation
+	float foveaMinRate = 0.25f;				// share of the samples that pixels far outside the fovea still receive
+	float bandStart = 0, bandEnd = 1;		// image-space split: rows of the target to render, as fractions of its height
+	int tileRows = 0;						// tiled rendering: rows per band that the core's buffers must hold; 0: full target
+	bool videoKeyFrame = false;				// video target: encode the next frame as a key frame; cleared by Render
+	float frameTimeTarget = 0;				// frame time controller: ms per frame to aim for; 0: SetTarget spp, see AdaptFrameSamples
+	uint maxFrameSpp = 16;					// frame time controller: highest spp of a frame
+	int maxPathLength = 0;					// path segments; 0: the core's default
+	int minPathLength = 0;					// frame time controller: with maxPathLength, shortest paths at 1 spp; 0: fixed length
+	float poseUpdateSize = 0;				// amortized animation: projected size below which poses update less often; 0: every frame
+	int maxPoseInterval = 8;				// amortized animation: frames between pose updates of off-screen nodes
+	int previewMode = 0;					// fast core shading for layout work: 0: off; 1: albedo; 2: direct; 3: ambient occlusion; 4: one bounce
+	float aoDistance = 0;					// previewMode 3: length of the occlusion rays; 0: the core's default
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameProfiler                                                              |
+//  |  Records a timeline of a number of frames: the RenderSystem phases on the   |
+//  |  CPU and the ranges that the core reports for its GPU work. Times are in    |
+//  |  microseconds since the start of the capture. GPU ranges are aligned to the |
+//  |  call to the core's Render. Saved in the Chrome trace format.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+class FrameProfiler
+{
+public:
+	struct Event
+	{
+		const char* name;					// static string
+		int track;							// 0: CPU, 1: GPU render stream, 2: GPU update stream
+		int frame, bounce;					// frame index within the capture; path segment or -1
+		double start;						// double: a float loses microseconds after a few seconds
+		float duration;
+	};
+	void Capture( const int frames ) { framesLeft = frames, frame = 0, events.clear(), clock.reset(); }
+	bool Capturing() const { return framesLeft > 0; }
+	double Now() const { return std::chrono::duration<double, std::micro>( std::chrono::high_resolution_clock::now() - clock.start ).count(); }
+	void Add( const char* name, const int track, const double start, const float duration, const int bounce = -1 );
+	void AddCoreEvents( const ProfileEvent* coreEvents, const int count, const double frameStart );
+	void EndFrame() { if (framesLeft > 0) framesLeft--, frame++; }
+	bool SaveChromeTrace( const char* fileName ) const;
+private:
+	Timer clock;							// time base of the capture
+	vector<Event> events;
+	int framesLeft = 0, frame = 0;
+};
+
+// ProfileScope: records a CPU range for the lifetime of the object, if a capture is running
+struct ProfileScope
+{
+	// the duration is also stored in 'seconds', if specified, regardless of capturing
+	ProfileScope( FrameProfiler& p, const char* n, float* s = 0 ) : profiler( p ), name( n ), seconds( s ), start( p.Now() ) {}
+	~ProfileScope()
+	{
+		const float duration = (float)(profiler.Now() - start);
+		if (seconds) *seconds = duration * 1e-6f;
+		if (profiler.Capturing()) profiler.Add( name, 0, start, duration );
+	}
+	FrameProfiler& profiler;
+	const char* name;
+	float* seconds;
+	double start;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameRecorder                                                              |
+//  |  Saves the frames that the core reads back on a background thread, so that  |
+//  |  encoding does not stall rendering. Frames are copied into a queue; when    |
+//  |  the writer falls behind by maxQueued frames, Add waits for it. Files are   |
+//  |  numbered from the first recorded frame; a gap marks a frame that the core  |
+//  |  dropped.                                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+class FrameRecorder
+{
+public:
+	~FrameRecorder() { Stop(); }
+	void Start( const char* fileNamePattern, const FrameCallback callback, void* userData );
+	void Add( const float4* pixels, const int width, const int height, const int frame );
+	int Stop();								// write the queued frames and end the writer thread; returns frames written
+	bool Recording() const { return running; }
+	int FramesWritten() const { return written.load(); }
+private:
+	struct Frame
+	{
+		vector<float4> pixels;				// width * height, top row first
+		int width, height, index;			// index: frame number relative to the first recorded frame
+	};
+	void WriterLoop();
+	bool Save( const Frame& frame ) const;
+	static const int maxQueued = 8;			// frames the writer may lag behind
+	std::thread writer;
+	std::mutex lock;						// protects queue and spare
+	std::condition_variable frameAdded, frameDone;
+	std::deque<Frame> queue;				// frames waiting for the writer, oldest first
+	vector<vector<float4>> spare;			// pixel buffers of written frames, for reuse
+	string pattern;							// printf-style file name with an int for the frame index; empty: no files
+	FrameCallback callback = 0;
+	void* userData = 0;
+	std::atomic<int> written = { 0 };
+	int firstFrame = -1;					// core frame number of the first recorded frame
+	bool running = false, quit = false;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  TelemetrySink                                                              |
+//  |  Logs the stats of every n-th frame, for sessions that run without a HUD.   |
+//  |  Add copies a TelemetryRecord into a lock-free ring and never waits: when   |
+//  |  the writer falls behind by ringSize records, the record is dropped. The    |
+//  |  writer thread wakes every flushInterval seconds and appends the ring to    |
+//  |  the log; Add does not notify it.                                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+class TelemetrySink
+{
+public:
+	~TelemetrySink() { Stop(); }
+	bool Start( const char* fileName, const TelemetryFormat format, const int sampleInterval, const float flushInterval );
+	bool NextFrame();						// count a frame; true if it is sampled
+	void Add( const SystemStats& systemStats, const CoreStats& coreStats, const float renderCallTime );
+	int Stop();								// write the records in the ring and end the writer thread; returns records written
+	bool Active() const { return running; }
+	int RecordsDropped() const { return dropped.load(); }
+private:
+	void WriterLoop();
+	void Write( const TelemetryRecord& record );
+	static const uint ringSize = 1024;		// records; a power of 2
+	TelemetryRecord ring[ringSize];			// slot i & (ringSize - 1) holds record i
+	std::atomic<uint> head = { 0 };			// next record to add; written by the rendering thread only
+	std::atomic<uint> tail = { 0 };			// next record to write; written by the writer thread only
+	std::thread writer;
+	std::mutex lock;						// protects quit; only taken by Stop and by the writer between flushes
+	std::condition_variable wakeUp;
+	FILE* file = 0;
+	TelemetryFormat format = TelemetryCSV;
+	uint interval = 1;						// sample every interval-th frame
+	float flushInterval = 1;				// seconds between writes of the ring
+	uint64_t frame = 0;						// frames counted by NextFrame
+	Timer clock;							// time base of the records
+	double lastFrame = 0;					// clock time at the previous NextFrame
+	float frameTime = 0;					// seconds between the last two NextFrame calls
+	std::atomic<int> written = { 0 }, dropped = { 0 };
+	bool running = false, quit = false;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderThread                                                               |
+//  |  Runs the RenderSystem on a thread of its own, so that the application      |
+//  |  waits neither for scene synchronization nor for the core. Scene edits and  |
+//  |  frames go into a lock-free ring that only the application thread writes,   |
+//  |  and are executed in order. The application edits copies of the camera      |
+//  |  and the settings; each frame takes them along, so that the scene state of  |
+//  |  the frame that renders and of the frame being built are separate. At most  |
+//  |  maxFrames frames are queued; PushFrame waits for older ones.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+class RenderThread
+{
+public:
+	typedef std::function<void()> Command;
+	~RenderThread() { Stop(); }
+	void Start( RenderSystem* system, const Command& threadInit );
+	void Stop();							// execute the queued commands and end the thread
+	void Push( const Command& command );	// queue a command; waits only if the ring is full
+	void PushFrame( const Convergence converge );	// queue a frame of the camera and settings as they are now
+	void Flush();							// wait until the render thread executed all queued commands
+	void SyncTarget();						// copy the aspect ratio of a new target to the application camera
+	int ReserveNode();						// node id that the next queued HostScene::AddInstance returns
+	void ReleaseNode( const int nodeId );	// a queued HostScene::RemoveInstance frees the id
+	CoreStats GetCoreStats();				// stats of the last finished frame
+	SystemStats GetSystemStats();
+	Camera* camera = nullptr;				// application copy of the camera
+	RenderSettings settings;				// application copy of the settings
+private:
+	struct Frame
+	{
+		ViewPyramid view;
+		float3 position, direction;			// camera fields used by the RenderSystem besides the view
+		float focalDistance, aperture, brightness, contrast, FOV, clampValue;
+		RenderSettings settings;
+		Convergence converge;
+	};
+	void ThreadLoop();
+	void RenderFrame( const Frame& frame );
+	void SyncNodes();						// copy the node slots of the scene, after a Flush
+	static const uint ringSize = 1024;		// commands; a power of 2
+	static const int maxFrames = 2;			// frames the render thread may lag behind
+	RenderSystem* renderer = nullptr;
+	std::thread thread;
+	Command ring[ringSize];					// slot i & (ringSize - 1) holds command i
+	std::atomic<uint> head = { 0 };			// next command to queue; written by the application thread only
+	std::atomic<uint> tail = { 0 };			// next command to execute; written by the render thread only
+	std::atomic<int> queuedFrames = { 0 };
+	std::atomic<bool> sleeping = { false }, quit = { false };
+	std::mutex sleepLock;					// only taken when the render thread is idle
+	std::condition_variable wakeUp;
+	std::mutex statsLock;					// protects coreStats and systemStats
+	CoreStats coreStats;
+	SystemStats systemStats;
+	vector<int> freeNodes;					// the free node slots of the scene, as they will be after the queued commands
+	vector<bool> liveNodes;
+	bool nodesSynced = false;				// freeNodes and liveNodes are valid; cleared by Flush
 };
 
 //  +-----------------------------------------------------------------------------+
@@ -84,27 +283,106 @@ class RenderSystem
 public:
 	// methods
 	void Init( const char* dllName );
+	void Init( CoreAPI_Base* coreAPI );
+	bool SwitchCore( const char* dllName );
+	bool SingleSession() const { return sessionCount == 1; }
 	void SynchronizeSceneData();
 	void Render( ViewPyramid& view, Convergence converge );
+	void RenderViews( const ViewPyramid* views, GLTexture** targets, const int count, Convergence converge );
+	bool BakeProbes( const float3* positions, const int count, const int faceSize, const uint spp, float4* faces );
+	bool BakeLightmap( const int nodeId, const int width, const int height, const uint spp, float4* lightmap, const int dilation = 2 );
+	int ScatterInstances( const int nodeId, const int* prototypes, const int prototypeCount, const int count,
+		const float2 scale, const int maskTexture, const uint seed );
 	void SetTarget( GLTexture* target, const uint spp );
+	void SetTargets( GLTexture** targets, const int count, const uint spp );
+	bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
+	bool SetVideoTarget( const VideoTargetDesc& desc, const uint spp );
+	bool SetVisibilityBuffer( GLTexture* visibility );
+	int GetPresentTarget() { return core ? core->GetPresentTarget() : 0; }
 	void SetProbePos( int2 pos ) { if (core) core->SetProbePos( pos ); }
+	void SetProbePositions( const int2* pos, const int count ) { if (core) core->SetProbePositions( pos, count ); }
+	int GetProbeResults( CoreRayHit* hits ) { return core ? core->GetProbeResults( hits ) : 0; }
+	int GetMaterialCosts( CoreMaterialCost* costs, const int count ) { return core ? core->GetMaterialCosts( costs, count ) : 0; }
+	int QueryRays( const float3* origins, const float3* directions, const int count ) { return core ? core->QueryRays( origins, directions, count ) : -1; }
+	int GetRayQueryResults( const int ticket, CoreRayHit* hits ) { return core ? core->GetRayQueryResults( ticket, hits ) : RAYQUERY_EXPIRED; }
+	bool RecordFrames( const char* fileNamePattern, const FrameCallback callback, void* userData );
+	int StopRecording();
+	void SetCheckpoints( const char* file, const float interval );
+	bool ResumeCheckpoint( const char* file );
+	int RecordedFrames() { return recorder.FramesWritten(); }
+	bool StartTelemetry( const char* fileName, const TelemetryFormat format, const int sampleInterval, const float flushInterval );
+	int StopTelemetry() { return telemetry.Stop(); }
 	void Shutdown();
 	CoreStats GetCoreStats() { return core ? core->GetCoreStats() : CoreStats(); }
 	SystemStats GetSystemStats() { return stats; }
+	void CaptureProfile( const int frames ) { profiler.Capture( frames ); }
+	bool SaveProfile( const char* fileName ) { return profiler.SaveChromeTrace( fileName ); }
 private:
 	// private methods
 	void SynchronizeSky();
 	void SynchronizeTextures();
 	void SynchronizeMaterials();
 	void SynchronizeMeshes();
+	void OfferAnimationData( const int meshIdx );
 	void SynchronizeLights();
+	void BuildLightTree( const vector<CoreLightTri>& areaLights, const vector<CorePointLight>& pointLights,
+		const vector<CoreSpotLight>& spotLights, vector<CoreLightTreeNode>& tree );
+	void BuildLightAliasTable( const vector<CoreLightTri>& areaLights, const vector<CorePointLight>& pointLights,
+		const vector<CoreSpotLight>& spotLights, const vector<CoreDirectionalLight>& directionalLights, vector<CoreLightAlias>& table );
+	void FlattenSceneGraph();
 	void UpdateSceneGraph();
+	bool SelectLODs();
+	void SchedulePoses();
+	bool SendScatter( const int scatterIdx );
+	void CollectFrames( const bool wait );
+	void ClaimCore();
+	void SendSettings();
+	void AdaptFrameSamples( const bool measure );
 private:
 	// private data members
 	CoreAPI_Base* core = nullptr;			// low-level rendering functionality
 	GLTexture* renderTarget = nullptr;		// CUDA will render to this OpenGL texture
 	bool meshesChanged = false;				// rebuild scene graph if a mesh was rebuilt / refit
+	bool texturesChanged = false;			// resend materials if textures were sent to the core
 	SystemStats stats;						// performance counters
+	FrameProfiler profiler;					// timeline capture, see CaptureProfile
+	FrameRecorder recorder;					// frame export, see RecordFrames
+	TelemetrySink telemetry;				// frame stats log, see StartTelemetry
+	string checkpointFile;					// periodic checkpoints: file that receives them, see SetCheckpoints
+	float checkpointInterval = 0;			// periodic checkpoints: seconds between snapshots; 0: disabled
+	Timer checkpointTimer;					// periodic checkpoints: time since the last snapshot
+	float sampleTime = 0;					// frame time controller: smoothed ms per spp of a frame, at full path length
+	uint frameSpp = 0;						// frame time controller: spp of the last frame
+	int framePathLength = 0;				// frame time controller: path length of the last frame
+	vector<int> graphNodes;					// node indices in depth-first order; see FlattenSceneGraph
+	vector<int> graphParent;				// per entry in graphNodes: index of the parent node, -1 for roots
+	vector<int> graphJobs;					// graphNodes[graphJobs[i]..graphJobs[i+1]-1] is updated by a single thread
+	vector<int> meshNodes;					// entries of graphNodes that refer to a mesh, in the same order
+	vector<HostAreaLight*> syncedAreaLights;	// scene->areaLights at the last full light update
+	vector<int> areaLightSlot;				// per synced area light: index in gpuAreaLights, -1 if disabled
+	vector<CoreLightTri> gpuAreaLights;		// light data as last sent to the core
+	vector<CorePointLight> gpuPointLights;
+	vector<CoreSpotLight> gpuSpotLights;
+	vector<CoreDirectionalLight> gpuDirectionalLights;
+	vector<CoreMaterial> gpuMaterials;		// material data as last sent to the core
+	vector<CoreMaterialEx> gpuMaterialsEx;
+	int instanceSlots = 0;					// instance slots sent to the core, see ClaimCore
+	struct Scatter							// procedural instances, generated by the core; see ScatterInstances
+	{
+		int node, slot;						// the node with the surface mesh, and the instance slot of the group
+		vector<int> prototypes;
+		int count, maskTexture;
+		float2 scale;
+		uint seed;
+		bool sent, generated;				// sent: offered to the core; generated: the core accepted it
+	};
+	vector<Scatter> scatters;				// per instance group ID
+	bool coreClaimed = false;				// the core held the scene of another session; all lights are sent again
+	std::function<void()> bindTarget;		// repeats the last SetTarget* call when the core is claimed again
+	uint targetSpp = 1;						// samples per pixel passed with the last SetTarget* call
+	GLTexture* visibilityBuffer = nullptr;	// rasterized primary hits for the core, see SetVisibilityBuffer
+	static RenderSystem* coreOwner;			// the session whose scene the core holds
+	static int sessionCount;				// RenderSystems that share the core
 public:
 	// public data members
 	HostScene* scene = nullptr;				// scene I/O and management module
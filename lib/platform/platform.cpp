@@ -43,6 +43,155 @@ void Thread::start()
 	SetThreadPriority( thread, THREAD_PRIORITY_NORMAL );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  WaitGroup                                                                  |
+//  |  Tracks a set of jobs; Done is called by the job system when a job of the   |
+//  |  group completes. Continuations are queued once the group is empty.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void WaitGroup::Done()
+{
+	vector<std::pair<std::function<void()>, WaitGroup*>> todo;
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		if (--pending == 0) todo.swap( continuations );
+	}
+	// the group may be gone by now; only use the local copy
+	for (auto& c : todo) JobSystem::Push( c.first, c.second );
+}
+void WaitGroup::Wait()
+{
+	while (!Finished()) if (!JobSystem::RunPendingJob()) std::this_thread::yield();
+	// Done may still hold the lock after the last decrement
+	std::lock_guard<std::mutex> guard( lock );
+}
+void WaitGroup::Then( const std::function<void()>& job, WaitGroup* group )
+{
+	if (group) group->Add();
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		if (pending.load() > 0) { continuations.push_back( std::make_pair( job, group ) ); return; }
+	}
+	JobSystem::Push( job, group );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  JobSystem                                                                  |
+//  |  Work-stealing job system. The worker threads are created on first use;     |
+//  |  one thread less than there are cores, as waiting threads help out.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+static thread_local int workerIndex = -1; // index of the current worker thread, -1 for other threads
+JobSystem& JobSystem::Instance()
+{
+	static JobSystem system;
+	return system;
+}
+JobSystem::JobSystem()
+{
+	const int count = max( 1, (int)std::thread::hardware_concurrency() - 1 );
+	for (int i = 0; i < count; i++) workers.push_back( new Worker() );
+	for (int i = 0; i < count; i++) workers[i]->thread = std::thread( [this, i]() { WorkerLoop( i ); } );
+}
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		quit = true;
+	}
+	wakeUp.notify_all();
+	for (Worker* worker : workers) worker->thread.join(), delete worker;
+}
+int JobSystem::WorkerCount()
+{
+	return (int)Instance().workers.size() + 1;
+}
+void JobSystem::Submit( const std::function<void()>& job, WaitGroup* group )
+{
+	if (group) group->Add();
+	Push( job, group );
+}
+void JobSystem::Push( const std::function<void()>& job, WaitGroup* group )
+{
+	// workers push to their own deque; other threads distribute jobs over the workers
+	JobSystem& system = Instance();
+	const int count = (int)system.workers.size();
+	Worker* worker = system.workers[workerIndex > -1 ? workerIndex : (system.nextWorker++ % count)];
+	{
+		std::lock_guard<std::mutex> guard( worker->lock );
+		worker->jobs.push_back( Job{ job, group } );
+	}
+	system.queued++;
+	{
+		// taking the lock prevents a lost wakeup for a worker that is about to sleep
+		std::lock_guard<std::mutex> guard( system.sleepLock );
+	}
+	system.wakeUp.notify_one();
+}
+bool JobSystem::TakeJob( const int idx, Job& job )
+{
+	// newest job from our own deque first, for locality
+	const int count = (int)workers.size();
+	if (idx > -1)
+	{
+		Worker* own = workers[idx];
+		std::lock_guard<std::mutex> guard( own->lock );
+		if (own->jobs.size() > 0)
+		{
+			job = own->jobs.back(), own->jobs.pop_back(), queued--;
+			return true;
+		}
+	}
+	// steal the oldest job of another worker
+	for (int i = 1; i <= count; i++)
+	{
+		Worker* victim = workers[(max( idx, 0 ) + i) % count];
+		std::lock_guard<std::mutex> guard( victim->lock );
+		if (victim->jobs.size() > 0)
+		{
+			job = victim->jobs.front(), victim->jobs.pop_front(), queued--;
+			return true;
+		}
+	}
+	return false;
+}
+void JobSystem::Execute( Job& job )
+{
+	job.task();
+	if (job.group) job.group->Done();
+}
+bool JobSystem::RunPendingJob()
+{
+	JobSystem& system = Instance();
+	Job job;
+	if (!system.TakeJob( workerIndex, job )) return false;
+	system.Execute( job );
+	return true;
+}
+void JobSystem::WorkerLoop( const int idx )
+{
+	workerIndex = idx;
+	while (1)
+	{
+		Job job;
+		if (TakeJob( idx, job )) { Execute( job ); continue; }
+		std::unique_lock<std::mutex> guard( sleepLock );
+		wakeUp.wait( guard, [this]() { return quit || queued.load() > 0; } );
+		if (quit) return;
+	}
+}
+void JobSystem::ParallelFor( const int count, const std::function<void( int, int )>& job, const int grain )
+{
+	// a few jobs pull ranges from a shared counter; the calling thread takes part
+	if (count <= 0) return;
+	const int rangeCount = (count + grain - 1) / grain;
+	const int jobCount = min( rangeCount, WorkerCount() );
+	std::atomic<int> next( 0 );
+	WaitGroup group;
+	auto task = [&]() { for (int r = next++; r < rangeCount; r = next++) job( r * grain, min( count, (r + 1) * grain ) ); };
+	for (int i = 1; i < jobCount; i++) Submit( task, &group );
+	task();
+	group.Wait();
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  OpenGL helper functions.                                             LH2'19|
 //  +-----------------------------------------------------------------------------+
@@ -33,16 +33,17 @@ float RandomFloat( uint& seed ) { return RandomUInt( seed ) * 2.3283064365387e-1
 //  +-----------------------------------------------------------------------------+
 //  |  Math implementations.                                                LH2'19|
 //  +-----------------------------------------------------------------------------+
+// The SSE versions add the products in the same order as the scalar dot products they replace,
+// so their results are bit-identical.
 mat4 operator * ( const mat4& a, const mat4& b )
 {
+	// a row of the result is the sum of the rows of b, scaled by the cells of the row of a
 	mat4 r;
-	for (uint i = 0; i < 16; i += 4) for (uint j = 0; j < 4; ++j)
+	const __m128 b0 = _mm_loadu_ps( b.cell ), b1 = _mm_loadu_ps( b.cell + 4 ), b2 = _mm_loadu_ps( b.cell + 8 ), b3 = _mm_loadu_ps( b.cell + 12 );
+	for (uint i = 0; i < 16; i += 4)
 	{
-		r[i + j] =
-			(a.cell[i + 0] * b.cell[j + 0]) +
-			(a.cell[i + 1] * b.cell[j + 4]) +
-			(a.cell[i + 2] * b.cell[j + 8]) +
-			(a.cell[i + 3] * b.cell[j + 12]);
+		const __m128 t = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set_ps1( a.cell[i] ), b0 ), _mm_mul_ps( _mm_set_ps1( a.cell[i + 1] ), b1 ) ), _mm_mul_ps( _mm_set_ps1( a.cell[i + 2] ), b2 ) );
+		_mm_storeu_ps( r.cell + i, _mm_add_ps( t, _mm_mul_ps( _mm_set_ps1( a.cell[i + 3] ), b3 ) ) );
 	}
 	return r;
 }
@@ -80,6 +81,62 @@ float4 operator * ( const float4& b, const mat4& a )
 		a.cell[8] * b.x + a.cell[9] * b.y + a.cell[10] * b.z + a.cell[11] * b.w,
 		a.cell[12] * b.x + a.cell[13] * b.y + a.cell[14] * b.z + a.cell[15] * b.w );
 }
+static void LoadColumns( const mat4& M, __m128& c0, __m128& c1, __m128& c2, __m128& c3 )
+{
+	c0 = _mm_loadu_ps( M.cell ), c1 = _mm_loadu_ps( M.cell + 4 ), c2 = _mm_loadu_ps( M.cell + 8 ), c3 = _mm_loadu_ps( M.cell + 12 );
+	_MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+}
+void TransformPoints( const mat4& M, const float3* in, float3* out, const int count )
+{
+	// a point is the sum of the columns, scaled by its coordinates; the fourth column is scaled by w = 1
+	__m128 c0, c1, c2, c3;
+	LoadColumns( M, c0, c1, c2, c3 );
+	for (int i = 0; i < count; i++)
+	{
+		union { __m128 p4; float4 p; };
+		p4 = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( c0, _mm_set_ps1( in[i].x ) ), _mm_mul_ps( c1, _mm_set_ps1( in[i].y ) ) ), _mm_mul_ps( c2, _mm_set_ps1( in[i].z ) ) ), c3 );
+		out[i] = make_float3( p );
+	}
+}
+void TransformNormals( const mat4& M, const float3* in, float3* out, const int count )
+{
+	__m128 c0, c1, c2, c3;
+	LoadColumns( M, c0, c1, c2, c3 );
+	for (int i = 0; i < count; i++)
+	{
+		union { __m128 n4; float4 n; };
+		n4 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( c0, _mm_set_ps1( in[i].x ) ), _mm_mul_ps( c1, _mm_set_ps1( in[i].y ) ) ), _mm_mul_ps( c2, _mm_set_ps1( in[i].z ) ) );
+		out[i] = make_float3( n );
+	}
+}
+static __m128 Cross4( const __m128 a, const __m128 b )
+{
+	// a * b.yzx - a.yzx * b yields the cross product in zxy order
+	const __m128 a1 = _mm_shuffle_ps( a, a, _MM_SHUFFLE( 3, 0, 2, 1 ) ), b1 = _mm_shuffle_ps( b, b, _MM_SHUFFLE( 3, 0, 2, 1 ) );
+	const __m128 c = _mm_sub_ps( _mm_mul_ps( a, b1 ), _mm_mul_ps( a1, b ) );
+	return _mm_shuffle_ps( c, c, _MM_SHUFFLE( 3, 0, 2, 1 ) );
+}
+mat4 mat4::InvertedAffine() const
+{
+	if (cell[12] != 0 || cell[13] != 0 || cell[14] != 0 || cell[15] != 1) return Inverted();
+	// the columns of the inverse of the 3x3 part are the cross products of its rows, over the determinant
+	const __m128 mask = _mm_castsi128_ps( _mm_setr_epi32( -1, -1, -1, 0 ) );
+	const __m128 r0 = _mm_and_ps( _mm_loadu_ps( cell ), mask ), r1 = _mm_and_ps( _mm_loadu_ps( cell + 4 ), mask ), r2 = _mm_and_ps( _mm_loadu_ps( cell + 8 ), mask );
+	union { __m128 c4[4]; float4 c[4]; };
+	c4[0] = Cross4( r1, r2 ), c4[1] = Cross4( r2, r0 ), c4[2] = Cross4( r0, r1 ), c4[3] = _mm_setzero_ps();
+	const float det = cell[0] * c[0].x + cell[1] * c[0].y + cell[2] * c[0].z;
+	mat4 r;
+	if (det == 0) return r; // like Inverted
+	const __m128 invdet = _mm_set_ps1( 1.0f / det );
+	c4[0] = _mm_mul_ps( c4[0], invdet ), c4[1] = _mm_mul_ps( c4[1], invdet ), c4[2] = _mm_mul_ps( c4[2], invdet );
+	// translation: -inverse * t, as a sum of the scaled columns
+	union { __m128 t4; float4 t; };
+	t4 = _mm_sub_ps( _mm_setzero_ps(), _mm_add_ps( _mm_add_ps( _mm_mul_ps( c4[0], _mm_set_ps1( cell[3] ) ), _mm_mul_ps( c4[1], _mm_set_ps1( cell[7] ) ) ), _mm_mul_ps( c4[2], _mm_set_ps1( cell[11] ) ) ) );
+	_MM_TRANSPOSE4_PS( c4[0], c4[1], c4[2], c4[3] );
+	_mm_storeu_ps( r.cell, c4[0] ), _mm_storeu_ps( r.cell + 4, c4[1] ), _mm_storeu_ps( r.cell + 8, c4[2] );
+	r.cell[3] = t.x, r.cell[7] = t.y, r.cell[11] = t.z;
+	return r;
+}
 
 //  +-----------------------------------------------------------------------------+
 //  |  Helper functions.                                                    LH2'19|
@@ -103,6 +160,24 @@ bool FileIsNewer( const char* file1, const char* file2 )
 	return (result != -1);
 }
 
+MappedFile::MappedFile( const char* fileName )
+{
+	file = CreateFile( fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if (file == INVALID_HANDLE_VALUE) { file = 0; return; }
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx( file, &fileSize ) || fileSize.QuadPart == 0) return;
+	mapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if (mapping) data = (const uchar*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if (data) size = (size_t)fileSize.QuadPart;
+}
+
+MappedFile::~MappedFile()
+{
+	if (data) UnmapViewOfFile( data );
+	if (mapping) CloseHandle( mapping );
+	if (file) CloseHandle( file );
+}
+
 bool FileExists( const char* f )
 {
 	HANDLE fh = CreateFile( f, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
@@ -169,6 +244,78 @@ string DeserializeString( FILE* f )
 	return retVal;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  WriteCompressedBlocks / ReadCompressedBlocks                               |
+//  |  Store a large array as a stream of independently deflated blocks, for the  |
+//  |  binary caches. Blocks are compressed and decompressed on the job system.   |
+//  |  Layout: raw size (8 bytes), block size, block count, the compressed size   |
+//  |  of each block, then the blocks. A block that does not shrink is stored     |
+//  |  as it is; its compressed size then equals its raw size. Reading fetches    |
+//  |  bytes [first..first+size) of the raw data, inflating only the blocks that  |
+//  |  overlap it, and always leaves the file at the end of the stream.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+#define CACHEBLOCKSIZE	(1 << 20)	// raw bytes per compressed block
+bool WriteCompressedBlocks( FILE* f, const void* data, const size_t size )
+{
+	const uint blockSize = CACHEBLOCKSIZE, blockCount = (uint)((size + blockSize - 1) / blockSize);
+	vector<vector<uchar>> blocks( blockCount );
+	vector<uint> packedSize( blockCount );
+	RunJobs( blockCount, [&]( const int i ) {
+		const uchar* src = (const uchar*)data + (size_t)i * blockSize;
+		const uLong rawSize = (uLong)min( (size_t)blockSize, size - (size_t)i * blockSize );
+		uLongf dstSize = compressBound( rawSize );
+		blocks[i].resize( dstSize );
+		if (compress2( blocks[i].data(), &dstSize, src, rawSize, Z_BEST_SPEED ) != Z_OK || dstSize >= rawSize)
+			blocks[i].assign( src, src + rawSize ), dstSize = rawSize;
+		packedSize[i] = (uint)dstSize;
+	} );
+	const uint64_t rawSize = size;
+	bool ok = fwrite( &rawSize, 8, 1, f ) == 1 && fwrite( &blockSize, 4, 1, f ) == 1 && fwrite( &blockCount, 4, 1, f ) == 1;
+	if (ok && blockCount > 0) ok = fwrite( packedSize.data(), 4, blockCount, f ) == blockCount;
+	for (uint i = 0; i < blockCount && ok; i++) ok = fwrite( blocks[i].data(), 1, packedSize[i], f ) == packedSize[i];
+	return ok;
+}
+bool ReadCompressedBlocks( FILE* f, void* data, const size_t size, const size_t first )
+{
+	uint64_t rawSize;
+	uint blockSize, blockCount;
+	if (fread( &rawSize, 8, 1, f ) != 1 || fread( &blockSize, 4, 1, f ) != 1 || fread( &blockCount, 4, 1, f ) != 1) return false;
+	if (blockSize == 0 || blockCount != (rawSize + blockSize - 1) / blockSize || first + size > rawSize) return false;
+	vector<uint> packedSize( blockCount );
+	if (blockCount > 0 && fread( packedSize.data(), 4, blockCount, f ) != blockCount) return false;
+	// locate the blocks that overlap the requested range
+	const __int64 streamStart = _ftelli64( f );
+	const uint firstBlock = (uint)(first / blockSize), lastBlock = size == 0 ? firstBlock : (uint)((first + size - 1) / blockSize) + 1;
+	vector<size_t> offset( blockCount + 1, 0 );
+	for (uint i = 0; i < blockCount; i++) offset[i + 1] = offset[i] + packedSize[i];
+	bool ok = true;
+	if (size > 0)
+	{
+		vector<uchar> packed( offset[lastBlock] - offset[firstBlock] );
+		_fseeki64( f, streamStart + offset[firstBlock], SEEK_SET );
+		ok = fread( packed.data(), 1, packed.size(), f ) == packed.size();
+		std::atomic<bool> valid = { ok };
+		if (ok) RunJobs( lastBlock - firstBlock, [&]( const int j ) {
+			const uint i = firstBlock + j;
+			const size_t blockStart = (size_t)i * blockSize;
+			const uLong blockRaw = (uLong)min( (uint64_t)blockSize, rawSize - blockStart );
+			const uchar* src = packed.data() + offset[i] - offset[firstBlock];
+			// blocks that are completely inside the range are inflated in place
+			const size_t from = max( first, blockStart ), to = min( first + size, blockStart + blockRaw );
+			const bool inPlace = from == blockStart && to == blockStart + blockRaw;
+			vector<uchar> tmp( inPlace ? 0 : blockRaw );
+			uchar* dst = inPlace ? (uchar*)data + (blockStart - first) : tmp.data();
+			uLongf dstSize = blockRaw;
+			if (packedSize[i] == blockRaw) memcpy( dst, src, blockRaw );
+			else if (uncompress( dst, &dstSize, src, packedSize[i] ) != Z_OK || dstSize != blockRaw) { valid = false; return; }
+			if (!inPlace) memcpy( (uchar*)data + (from - first), tmp.data() + (from - blockStart), to - from );
+		} );
+		ok = valid;
+	}
+	_fseeki64( f, streamStart + offset[blockCount], SEEK_SET );
+	return ok;
+}
+
 bool NeedsRecompile( const char* path, const char* target, const char* s1, const char* s2, const char* s3, const char* s4 )
 {
 	string t( path );
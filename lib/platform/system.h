@@ -26,6 +26,12 @@
 #include <ctime>
 #include <ratio>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include "half.hpp"
 
 using namespace std;
@@ -35,7 +41,6 @@ using namespace half_float;
 #include "common_types.h"
 #include "common_settings.h"
 #include "common_classes.h"
-#include <GLFW/glfw3.h>		// needed for Timer class
 
 #define FATALERROR(m) FatalError( "Error on line %i of %s: %s", __LINE__, __FILE__, m )
 #define ERRORMESSAGE(m,c) FatalError( __FILE__, __LINE__, c, m )
@@ -54,6 +59,61 @@ public:
 };
 extern "C" { uint sthread_proc( void* param ); }
 
+// job system: a fixed pool of worker threads, each with its own deque of jobs. A worker takes jobs from
+// the back of its own deque, and steals from the front of the others when it runs dry. Jobs submitted by
+// other threads are spread over the workers. Waiting threads execute jobs instead of blocking.
+class WaitGroup
+{
+public:
+	void Add( const int count = 1 ) { pending += count; }
+	void Done();								// mark a job as finished; starts the continuations when all are done
+	bool Finished() const { return pending.load() == 0; }
+	void Wait();								// execute jobs until all jobs in the group are done
+	void Then( const std::function<void()>& job, WaitGroup* group = 0 ); // run job once the group is finished
+private:
+	std::atomic<int> pending = { 0 };
+	std::mutex lock;
+	vector<std::pair<std::function<void()>, WaitGroup*>> continuations;
+};
+class JobSystem
+{
+public:
+	// Submit: queue a job; if a group is specified, it is marked done when the job completes.
+	static void Submit( const std::function<void()>& job, WaitGroup* group = 0 );
+	// Submit: queue a job that should only start once all jobs in dependency are done.
+	static void Submit( const std::function<void()>& job, WaitGroup* group, WaitGroup& dependency ) { dependency.Then( job, group ); }
+	// ParallelFor: run job( first, last ) for consecutive ranges of at most grain indices covering [0..count),
+	// and return when all are done. Ranges are handed out in order.
+	static void ParallelFor( const int count, const std::function<void( int, int )>& job, const int grain = 1 );
+	// RunPendingJob: execute a single queued job, if there is one; used while waiting.
+	static bool RunPendingJob();
+	static int WorkerCount();				// number of threads that execute jobs, including the caller
+private:
+	friend class WaitGroup;
+	struct Job { std::function<void()> task; WaitGroup* group; };
+	struct Worker { std::deque<Job> jobs; std::mutex lock; std::thread thread; };
+	JobSystem();
+	~JobSystem();
+	static JobSystem& Instance();
+	static void Push( const std::function<void()>& job, WaitGroup* group );
+	bool TakeJob( const int idx, Job& job );
+	void Execute( Job& job );
+	void WorkerLoop( const int idx );
+	vector<Worker*> workers;
+	std::atomic<int> queued = { 0 }, nextWorker = { 0 };
+	std::mutex sleepLock;
+	std::condition_variable wakeUp;
+	bool quit = false;
+};
+
+// run job( i ) for 0 <= i < count on the job system and return when all jobs are done.
+// Jobs are picked up in order; a job should only write to its own slot i to keep results deterministic.
+template <class T> void RunJobs( const int count, const T& job )
+{
+	if (count < 2 || JobSystem::WorkerCount() < 2) { for (int i = 0; i < count; i++) job( i ); return; }
+	JobSystem::ParallelFor( count, [&]( const int first, const int last ) { for (int i = first; i < last; i++) job( i ); } );
+}
+
 // timer
 struct Timer
 {
@@ -71,6 +131,18 @@ struct Timer
 	std::chrono::high_resolution_clock::time_point start;
 };
 
+// read-only memory mapped file; data is 0 if the file could not be mapped
+class MappedFile
+{
+public:
+	MappedFile( const char* fileName );
+	~MappedFile();
+	const uchar* data = 0;
+	size_t size = 0;
+private:
+	void* file = 0, *mapping = 0;
+};
+
 #define wrap(x,a,b) (((x)>=(a))?((x)<=(b)?(x):((x)-((b)-(a)))):((x)+((b)-(a))))
 __inline float sqr( const float x ) { return x * x; }
 template <class T> void Swap( T& x, T& y ) { T t; t = x; x = y; y = t; }
@@ -154,11 +226,24 @@ __inline unsigned __int64 calccrc64( unsigned char* pbData, int len )
 		crc = crc64_table[t] ^ (crc << 8);
 	return crc ^ CLEARCRC64;
 }
-#define TRACKCHANGES public: bool Changed() { unsigned __int64 currentcrc = crc64; \
-crc64 = CLEARCRC64; unsigned __int64 newcrc = calccrc64( (uchar*)this, sizeof( *this ) ); \
-bool changed = newcrc != currentcrc; crc64 = newcrc; return changed; } \
+// change tracking: MarkAsDirty bumps a generation counter; Changed() reports whether the
+// generation advanced since the previous call. ContentChanged() detects changes using a
+// CRC64 over the object instead; this is slow, but it catches direct writes to public
+// fields (e.g. by UI code). Define VALIDATECHANGES to verify Changed() against the CRC.
+#ifdef VALIDATECHANGES
+#define VALIDATEGENERATION if (ContentChanged() && !changed) printf( "%s: modified without MarkAsDirty.\n", __FUNCTION__ );
+#else
+#define VALIDATEGENERATION
+#endif
+#define TRACKCHANGES public: bool Changed() { const bool changed = dirty != synced; synced = dirty; \
+VALIDATEGENERATION return changed; } \
+bool ContentChanged() { const unsigned __int64 newcrc = ContentCRC(); \
+const bool changed = newcrc != crc64; crc64 = newcrc; return changed; } \
 void MarkAsDirty() { dirty++; } \
-private: unsigned __int64 crc64 = CLEARCRC64; uint dirty = 0; \
+private: unsigned __int64 ContentCRC() { const unsigned __int64 c = crc64; const uint d = dirty, s = synced; \
+crc64 = CLEARCRC64, dirty = synced = 0; const unsigned __int64 newcrc = calccrc64( (uchar*)this, sizeof( *this ) ); \
+crc64 = c, dirty = d, synced = s; return newcrc; } \
+unsigned __int64 crc64 = CLEARCRC64; uint dirty = 1, synced = 0; \
 
 // rng
 uint RandomUInt();
@@ -179,6 +264,8 @@ void TextFileWrite( const string& text, const char* _File );
 string LowerCase( string s );
 void SerializeString( string s, FILE* f );
 string DeserializeString( FILE* f );
+bool WriteCompressedBlocks( FILE* f, const void* data, const size_t size );
+bool ReadCompressedBlocks( FILE* f, void* data, const size_t size, const size_t first = 0 );
 
 // globally accessible classes
 namespace lighthouse2 {
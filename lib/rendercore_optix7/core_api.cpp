@@ -56,11 +56,89 @@ void CoreAPI::SetProbePos( const int2 pos )
 	core->SetProbePos( pos );
 }
 
+void CoreAPI::SetProbePositions( const int2* pos, const int count )
+{
+	core->SetProbePositions( pos, count );
+}
+
+int CoreAPI::GetProbeResults( CoreRayHit* hits )
+{
+	return core->GetProbeResults( hits );
+}
+
+int CoreAPI::GetMaterialCosts( CoreMaterialCost* costs, const int count )
+{
+	return core->GetMaterialCosts( costs, count );
+}
+
+bool CoreAPI::SetFrameReadback( const bool enable )
+{
+	return core->SetFrameReadback( enable );
+}
+
+int CoreAPI::GetReadbackFrame( const float4** pixels, int& width, int& height, const bool wait )
+{
+	return core->GetReadbackFrame( pixels, width, height, wait );
+}
+
+bool CoreAPI::SaveCheckpoint( const char* file )
+{
+	return core->SaveCheckpoint( file );
+}
+
+bool CoreAPI::LoadCheckpoint( const char* file )
+{
+	return core->LoadCheckpoint( file );
+}
+
+int CoreAPI::QueryRays( const float3* origins, const float3* directions, const int count )
+{
+	return core->QueryRays( origins, directions, count );
+}
+
+int CoreAPI::GetRayQueryResults( const int ticket, CoreRayHit* hits )
+{
+	return core->GetRayQueryResults( ticket, hits );
+}
+
 void CoreAPI::SetTarget( GLTexture* target, const uint spp )
 {
 	core->SetTarget( target, spp );
 }
 
+void CoreAPI::SetTargets( GLTexture** targets, const int count, const uint spp )
+{
+	core->SetTargets( targets, count, spp );
+}
+
+int CoreAPI::GetProfileEvents( const ProfileEvent** events )
+{
+	*events = core->profileEvents.data();
+	return (int)core->profileEvents.size();
+}
+
+bool CoreAPI::SetHostTarget( float4* pixels, const int width, const int height, const uint spp )
+{
+	core->SetHostTarget( pixels, width, height, spp );
+	return true;
+}
+
+bool CoreAPI::SetVideoTarget( const VideoTargetDesc& desc, const uint spp )
+{
+	return core->SetVideoTarget( desc, spp );
+}
+
+bool CoreAPI::SetVisibilityBuffer( GLTexture* visibility )
+{
+	core->SetVisibilityBuffer( visibility );
+	return true;
+}
+
+int CoreAPI::GetPresentTarget()
+{
+	return core->GetPresentTarget();
+}
+
 void CoreAPI::Setting( const char* name, float value )
 {
 	core->Setting( name, value );
@@ -88,6 +166,11 @@ void CoreAPI::SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, cons
 	core->SetMaterials( mat, matEx, materialCount );
 }
 
+bool CoreAPI::UpdateMaterials( const CoreMaterial* mat, const CoreMaterialEx* matEx, const int first, const int count )
+{
+	return core->UpdateMaterials( mat, matEx, first, count );
+}
+
 void CoreAPI::SetLights( const CoreLightTri* areaLights, const int areaLightCount,
 	const CorePointLight* pointLights, const int pointLightCount,
 	const CoreSpotLight* spotLights, const int spotLightCount,
@@ -99,14 +182,52 @@ void CoreAPI::SetLights( const CoreLightTri* areaLights, const int areaLightCoun
 		directionalLights, directionalLightCount );
 }
 
+bool CoreAPI::UpdateAreaLights( const CoreLightTri* areaLights, const int first, const int count )
+{
+	return core->UpdateAreaLights( areaLights, first, count );
+}
+
+void CoreAPI::SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount )
+{
+	core->SetLightTree( nodes, nodeCount );
+}
+
+void CoreAPI::SetLightAliasTable( const CoreLightAlias* table, const int count )
+{
+	core->SetLightAliasTable( table, count );
+}
+
 void CoreAPI::SetSkyData( const float3* pixels, const uint width, const uint height )
 {
 	core->SetSkyData( pixels, width, height );
 }
 
-void CoreAPI::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags )
+void CoreAPI::SetSkyImportance( const float* cdf, const uint width, const uint height )
+{
+	core->SetSkyImportance( cdf, width, height );
+}
+
+void CoreAPI::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint )
+{
+	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags, hint );
+}
+
+bool CoreAPI::SetIndexedGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const uint* indexData, const int triangleCount,
+	const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint )
+{
+	core->SetIndexedGeometry( meshIdx, vertexData, vertexCount, indexData, triangleCount, triangles, alphaFlags, hint );
+	return true;
+}
+
+bool CoreAPI::SetAnimationData( const int meshIdx, const float4* vertexData, const float3* normalData, const int vertexCount,
+	const uint4* joints, const float4* weights, const float3* morphPositions, const float3* morphNormals, const int morphTargets )
 {
-	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags );
+	return core->SetAnimationData( meshIdx, vertexData, normalData, vertexCount, joints, weights, morphPositions, morphNormals, morphTargets );
+}
+
+void CoreAPI::SetPose( const int meshIdx, const mat4* jointMat, const int jointCount, const float* morphWeights, const int weightCount )
+{
+	core->SetPose( meshIdx, jointMat, jointCount, morphWeights, weightCount );
 }
 
 void CoreAPI::SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform )
@@ -114,6 +235,36 @@ void CoreAPI::SetInstance( const int instanceIdx, const int modelIdx, const mat4
 	core->SetInstance( instanceIdx, modelIdx, transform );
 }
 
+void CoreAPI::SetInstances( const int first, const int count, const int* modelIdx, const mat4* transforms )
+{
+	core->SetInstances( first, count, modelIdx, transforms );
+}
+
+void CoreAPI::SetInstanceVisibility( const int instanceIdx, const uint visibility )
+{
+	core->SetInstanceVisibility( instanceIdx, visibility );
+}
+
+void CoreAPI::SetInstanceMotion( const int instanceIdx, const mat4& openTransform )
+{
+	core->SetInstanceMotion( instanceIdx, openTransform );
+}
+
+void CoreAPI::RemoveInstance( const int instanceIdx )
+{
+	core->RemoveInstance( instanceIdx );
+}
+
+bool CoreAPI::SetInstanceGroup( const int groupIdx, const int count, const int* modelIdx, const mat4* transforms )
+{
+	return core->SetInstanceGroup( groupIdx, count, modelIdx, transforms );
+}
+
+bool CoreAPI::ScatterInstances( const int groupIdx, const CoreScatter& scatter )
+{
+	return core->ScatterInstances( groupIdx, scatter );
+}
+
 void CoreAPI::UpdateToplevel()
 {
 	core->UpdateToplevel();
@@ -30,8 +30,37 @@ public:
 	CoreStats GetCoreStats();
 	// SetProbePos: set a pixel for which the triangle and instance id will be captured, e.g. for object picking.
 	void SetProbePos( const int2 pos );
+	// SetProbePositions: set the pixels whose primary hits are captured each frame, for non-blocking picking.
+	void SetProbePositions( const int2* pos, const int count );
+	// GetProbeResults: obtain the hits at the probe positions of the most recent frame that arrived on the host.
+	int GetProbeResults( CoreRayHit* hits );
+	// GetMaterialCosts: obtain the shading cost per material; instrumentation builds (SHADECOST) only.
+	int GetMaterialCosts( CoreMaterialCost* costs, const int count );
+	// SetFrameReadback: copy each finished frame to host memory asynchronously.
+	bool SetFrameReadback( const bool enable );
+	// GetReadbackFrame: obtain the oldest frame that arrived on the host and was not obtained before.
+	int GetReadbackFrame( const float4** pixels, int& width, int& height, const bool wait = false );
+	// SaveCheckpoint / LoadCheckpoint: write the accumulation state to a file in the background, and restore it.
+	bool SaveCheckpoint( const char* file );
+	bool LoadCheckpoint( const char* file );
+	// QueryRays: submit rays for intersection with the scene; they are traced before the next frame.
+	int QueryRays( const float3* origins, const float3* directions, const int count );
+	// GetRayQueryResults: obtain the hits of a ray query, without waiting for the device.
+	int GetRayQueryResults( const int ticket, CoreRayHit* hits );
 	// SetTarget: specify an OpenGL texture as a render target for the path tracer.
 	void SetTarget( GLTexture* target, const uint spp );
+	// SetTargets: specify a ring of OpenGL textures; each frame is rendered to the next one.
+	void SetTargets( GLTexture** targets, const int count, const uint spp );
+	// GetPresentTarget: obtain the index of the most recently completed render target.
+	int GetPresentTarget();
+	// GetProfileEvents: obtain the GPU ranges of the last frame.
+	int GetProfileEvents( const ProfileEvent** events );
+	// SetHostTarget: render to host memory, without OpenGL.
+	bool SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
+	// SetVideoTarget: render without OpenGL, and encode each frame using NVENC.
+	bool SetVideoTarget( const VideoTargetDesc& desc, const uint spp );
+	// SetVisibilityBuffer: take the primary hits from a rasterized visibility buffer.
+	bool SetVisibilityBuffer( GLTexture* visibility );
 	// Setting: modify a render setting
 	void Setting( const char* name, float value );
 	// Render: produce one frame. Convergence can be 'Converge' or 'Restart'.
@@ -42,17 +71,47 @@ public:
 	void SetTextures( const CoreTexDesc* tex, const int textureCount );
 	// SetMaterials: update the material list used by the RenderCore. Textures referenced by the materials must be set in advance.
 	void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount );
+	// UpdateMaterials: overwrite a range of the materials passed to the last SetMaterials call.
+	bool UpdateMaterials( const CoreMaterial* mat, const CoreMaterialEx* matEx, const int first, const int count );
 	// SetLights: update the point lights, spot lights and directional lights.
 	void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	// UpdateAreaLights: overwrite a range of the area lights passed to the last SetLights call.
+	bool UpdateAreaLights( const CoreLightTri* areaLights, const int first, const int count );
+	// SetLightTree: update the light tree over the area, point and spot lights.
+	void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount );
+	// SetLightAliasTable: update the alias table for power-proportional light selection.
+	void SetLightAliasTable( const CoreLightAlias* table, const int count );
 	// SetSkyData: specify the data required for sky dome rendering.
 	void SetSkyData( const float3* pixels, const uint width, const uint height );
+	// SetSkyImportance: specify the cdf for importance sampling of the sky dome.
+	void SetSkyImportance( const float* cdf, const uint width, const uint height );
 	// SetGeometry: update the geometry for a single mesh.
-	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
+	// SetIndexedGeometry: update the geometry for a single mesh, using shared vertices and an index buffer.
+	bool SetIndexedGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const uint* indexData, const int triangleCount,
+		const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
+	// SetAnimationData: store bind pose, skin and morph target data for a mesh; the core will animate it.
+	bool SetAnimationData( const int meshIdx, const float4* vertexData, const float3* normalData, const int vertexCount,
+		const uint4* joints, const float4* weights, const float3* morphPositions, const float3* morphNormals, const int morphTargets );
+	// SetPose: animate a mesh on the device using joint matrices and / or morph weights.
+	void SetPose( const int meshIdx, const mat4* jointMat, const int jointCount, const float* morphWeights, const int weightCount );
 	// SetInstance: update the data on a single instance.
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
+	// SetInstances: update a range of consecutive instances.
+	void SetInstances( const int first, const int count, const int* modelIdx, const mat4* transforms );
+	// SetInstanceVisibility: set the ray types that see the instance.
+	void SetInstanceVisibility( const int instanceIdx, const uint visibility );
+	// SetInstanceMotion: set the transform of the instance at shutter open (MOTIONBLUR).
+	void SetInstanceMotion( const int instanceIdx, const mat4& openTransform );
+	// RemoveInstance: hide the instance in the specified slot.
+	void RemoveInstance( const int instanceIdx );
+	// SetInstanceGroup: build a sub-assembly that instances refer to with INSTANCEGROUP( groupIdx ).
+	bool SetInstanceGroup( const int groupIdx, const int count, const int* modelIdx, const mat4* transforms );
+	// ScatterInstances: fill a group with instances generated on the device, see kernels/scatter.h.
+	bool ScatterInstances( const int groupIdx, const CoreScatter& scatter );
 	// UpdateTopLevel: trigger a top-level BVH update.
 	void UpdateToplevel();
 };
@@ -19,117 +19,771 @@ RenderCore* CoreMesh::renderCore = 0;
 
 template<typename T> T roundUp( T x, T y ) { return ((x + y - 1) / y) * y; }
 
+// octahedral normal encoding, 16 bits per component; see UnpackNormalOct in tools_shared.h
+static uint PackNormalOct( const float3& N )
+{
+	const float l = fabs( N.x ) + fabs( N.y ) + fabs( N.z );
+	float x = l > 0 ? N.x / l : 0, y = l > 0 ? N.y / l : 0;
+	if (N.z < 0)
+	{
+		const float ox = x, oy = y;
+		x = (1 - fabs( oy )) * (ox >= 0 ? 1 : -1);
+		y = (1 - fabs( ox )) * (oy >= 0 ? 1 : -1);
+	}
+	const uint ix = (uint)clamp( (x * 0.5f + 0.5f) * 65535.0f + 0.5f, 0.0f, 65535.0f );
+	const uint iy = (uint)clamp( (y * 0.5f + 0.5f) * 65535.0f + 0.5f, 0.0f, 65535.0f );
+	return ix + (iy << 16);
+}
+
+// two floats as a pair of halfs, in the layout read by __halves2half2
+static uint PackHalf2( const float a, const float b )
+{
+	const half_float::half ha( a ), hb( b );
+	ushort sa, sb;
+	memcpy( &sa, &ha, 2 ), memcpy( &sb, &hb, 2 );
+	return sa + ((uint)sb << 16);
+}
+
+// convert a full triangle to the compact shading record
+static void PackTriangle( const CoreTri& tri, CoreTriPacked& packed )
+{
+	packed.uv = make_uint4( PackHalf2( tri.u0, tri.v0 ), PackHalf2( tri.u1, tri.v1 ), PackHalf2( tri.u2, tri.v2 ), tri.material );
+	packed.normals = make_uint4( PackNormalOct( tri.vN0 ), PackNormalOct( tri.vN1 ), PackNormalOct( tri.vN2 ),
+		PackNormalOct( make_float3( tri.Nx, tri.Ny, tri.Nz ) ) );
+	packed.frame = make_uint4( PackNormalOct( tri.T ), PackNormalOct( tri.B ),
+		PackHalf2( tri.alpha.x, tri.alpha.y ), PackHalf2( tri.alpha.z, tri.LOD ) );
+}
+
+// new device buffer holding the given data: copied synchronously, or, for a streamed build, queued in the
+// staging ring, so SetGeometry returns before the copy is done; see CoreMesh::SetGeometry
+template <class T> static CoreBuffer<T>* DeviceCopy( const __int64 count, const void* data, const bool queued )
+{
+	if (!queued) return new CoreBuffer<T>( count, ON_DEVICE, data, VRAMGeometry );
+	CoreBuffer<T>* buffer = new CoreBuffer<T>( count, ON_DEVICE, 0, VRAMGeometry );
+	CoreMesh::renderCore->stagingRing->Upload( buffer->DevPtr(), data, count * sizeof( T ) );
+	return buffer;
+}
+
+// the same for read-only shading data, which may be placed on a peer device, see RenderCore::PoolDevice
+template <class T> static CoreBuffer<T>* PoolCopy( const __int64 count, const void* data, const bool queued )
+{
+	CoreBuffer<T>* buffer = CoreMesh::renderCore->PoolBuffer<T>( count, VRAMGeometry );
+	if (queued) CoreMesh::renderCore->stagingRing->Upload( buffer->DevPtr(), data, count * sizeof( T ) );
+	else CUDACHECK( "cudaMemcpy", cudaMemcpy( buffer->DevPtr(), data, count * sizeof( T ), cudaMemcpyHostToDevice ) );
+	return buffer;
+}
+
+// forward declaration of cuda code
+void animateMesh( const float4* basePositions, const float3* baseNormals,
+	const float3* morphPositions, const float3* morphNormals, const float* morphWeights, const int morphCount,
+	const uint4* joints, const float4* weights, const float4* jointMat, const int jointCount,
+	float4* positions, CoreTri4* tris, const int triCount, const cudaStream_t stream );
+
 //  +-----------------------------------------------------------------------------+
 //  |  CoreMesh::~CoreMesh                                                        |
 //  |  Destructor.                                                          LH2'19|
 //  +-----------------------------------------------------------------------------+
 CoreMesh::~CoreMesh()
 {
+	FinishStreaming( true ); // the build may still use the buffers
 	delete triangles;
+	delete packedTriangles;
+	delete sbtIndices;
 	delete positions4;
+	delete quantized;
+	delete dequantize;
+	delete indices;
+	delete basePositions;
+	delete baseNormals;
+	delete joints;
+	delete weights;
+	delete morphPositions;
+	delete morphNormals;
+	delete jointMat;
+	delete morphWeights;
+#ifdef MOTIONBLUR
+	delete prevPositions;
+#endif
+	if (streamDone) cudaEventDestroy( streamDone );
+	if (rebuildDone) cudaEventSynchronize( rebuildDone ), cudaEventDestroy( rebuildStart ), cudaEventDestroy( rebuildDone );
+	delete rebuildVertices;
+	delete rebuildTemp;
+	delete rebuildBuffer;
+	if (buildStart) cudaEventDestroy( buildStart ), cudaEventDestroy( buildEnd );
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  CoreMesh::SetGeometry                                                      |
-//  |  Set the geometry data and build / update the OptiX BVH.              LH2'19|
+//  |  Set the geometry data and build / update the OptiX BVH. If indexData is    |
+//  |  supplied, the BVH is built over vertexCount shared vertices, with three    |
+//  |  indices per triangle; otherwise vertexData holds three vertices per        |
+//  |  triangle. Triangles with alpha flag ALPHA_TRANSPARENT enter the BVH as     |
+//  |  degenerate triangles; with ANYHITALPHA, only triangles that are not        |
+//  |  ALPHA_OPAQUE run the any-hit alpha test.                                   |
+//  |  With quantizePositions, static meshes store their vertices as SNORM16      |
+//  |  relative to the mesh bounds (8 instead of 16 bytes); the build input maps  |
+//  |  them back to object space with a preTransform. The BVH itself is unchanged |
+//  |  in size, but the vertices snap to a grid of 1/65534 of the bounds, and     |
+//  |  the mesh can no longer be animated on the device.                          |
+//  |  With RenderCore::streamGeometry, the first build of a mesh is queued: the  |
+//  |  data goes through the staging ring and the BVH is built on the build       |
+//  |  stream, in the background. Until FinishStreaming, instances of the mesh    |
+//  |  see a proxy, with a zero mask, like those of an evicted mesh.        LH2'19|
 //  +-----------------------------------------------------------------------------+
-void CoreMesh::SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags )
+void CoreMesh::SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags, const uint* indexData )
 {
-	// allocate for the first frame, reallocate when the triangle data grows
-	bool reallocate = false;
-	if (triangles == 0) reallocate = true; else if (triCount > triangles->GetSize()) reallocate = true;
+	// a background build still reads the buffers that are overwritten below
+	FinishStreaming( true );
+	// new data for an evicted mesh: the proxy BVH is replaced by the build below, the host copies are outdated
+	if (!resident) delete buildBuffer, buildBuffer = 0, resident = true;
+	ReleaseHostCopies();
 	// BVH compaction is done for the first frame only.
 	// If we get here a second time we will assume this is an animation and compaction is not worthwhile.
-	bool allowCompaction = (triangles == 0);
-	// allocate and copy triangle data to GPU
+	const bool firstBuild = (positions4 == 0 && quantized == 0);
+	bool allowCompaction = firstBuild;
+	// the existing BVH can be refitted if the topology did not change; index data is not compared, so for
+	// indexed meshes we rely on the hint
+	const bool indexed = (indexData != 0);
+	bool allowRefit = !firstBuild && triCount == triangleCount && vertexCount == verticesUsed && indexed == (indices != 0);
+	if (indexed && hint != DeformingGeometry) allowRefit = false;
+	// stream the first build of a mesh that is not animated on the device; all buffers are new
+	const bool queued = firstBuild && renderCore->streamGeometry && basePositions == 0;
+	// allocate and copy triangle data to GPU; reallocate when the triangle data grows.
+	// Meshes that are animated on the device need full triangles, which the animation kernel updates.
 	triangleCount = triCount;
-	if (reallocate)
+	verticesUsed = vertexCount;
+	boundsMin = make_float3( 1e34f ), boundsMax = make_float3( -1e34f );
+	for (int i = 0; i < vertexCount; i++)
+	{
+		const float3 v = make_float3( vertexData[i] );
+		boundsMin = fminf( boundsMin, v ), boundsMax = fmaxf( boundsMax, v );
+	}
+	// fully transparent triangles enter the BVH as degenerate triangles, so that traversal never reports them.
+	// Not for meshes animated on the device: the animation kernel rewrites their vertices.
+	vector<float4> culledVertices;
+	vector<uint> culledIndices;
+	for (int i = 0; alphaFlags && basePositions == 0 && i < triCount; i++) if (alphaFlags[i] == ALPHA_TRANSPARENT)
+	{
+		if (indexed)
+		{
+			if (culledIndices.empty()) culledIndices.assign( indexData, indexData + triCount * 3 );
+			culledIndices[i * 3 + 1] = culledIndices[i * 3 + 2] = culledIndices[i * 3];
+		}
+		else if (vertexCount >= triCount * 3)
+		{
+			if (culledVertices.empty()) culledVertices.assign( vertexData, vertexData + vertexCount );
+			culledVertices[i * 3 + 1] = culledVertices[i * 3 + 2] = culledVertices[i * 3];
+		}
+	}
+	if (culledVertices.size() > 0) vertexData = culledVertices.data();
+	if (culledIndices.size() > 0) indexData = culledIndices.data();
+	// quantize meshes that we expect to be built once; the grid spans the bounds, clamped to a non-zero extent
+	const bool quantize = renderCore->quantizePositions && basePositions == 0 && (hint == StaticGeometry || (hint == DefaultGeometry && firstBuild));
+	if (quantize != (quantized != 0)) allowRefit = false;
+	// Meshes with emissive triangles keep them too: MIS reads the area and light index at the hit.
+	bool pack = renderCore->packTriangles && basePositions == 0;
+	for (int i = 0; i < triCount && pack; i++) if (tris[i].ltriIdx >= 0) pack = false;
+	if (pack)
+	{
+		delete triangles, triangles = 0;
+		vector<CoreTriPacked> packed( triCount );
+		for (int i = 0; i < triCount; i++) PackTriangle( tris[i], packed[i] );
+		if (packedTriangles == 0 || triCount > packedTriangles->GetSize())
+		{
+			delete packedTriangles;
+			packedTriangles = PoolCopy<CoreTriPacked>( triCount, packed.data(), queued );
+		}
+		else
+		{
+			packedTriangles->SetHostData( packed.data() );
+			packedTriangles->CopyToDevice( 0, triCount ); // synchronous; packed is a temporary
+		}
+	}
+	else
+	{
+		delete packedTriangles, packedTriangles = 0;
+		if (triangles == 0 || triCount > triangles->GetSize())
+		{
+			delete triangles;
+			// the animation kernel rewrites the triangles of meshes animated on the device; those stay local
+			triangles = basePositions ? DeviceCopy<CoreTri4>( triCount, tris, queued ) : PoolCopy<CoreTri4>( triCount, tris, queued );
+		}
+		else
+		{
+			triangles->SetHostData( (CoreTri4*)tris );
+			triangles->CopyToDeviceAsync( 0, triCount, renderCore->updateStream );
+		}
+	}
+	if (quantize)
+	{
+		delete positions4, positions4 = 0;
+		const float3 center = (boundsMin + boundsMax) * 0.5f, extent = fmaxf( (boundsMax - boundsMin) * 0.5f, make_float3( 1e-20f ) );
+		const float3 scale = make_float3( 32767.0f ) / extent;
+		vector<short4> packed( vertexCount );
+		for (int i = 0; i < vertexCount; i++)
+		{
+			const float3 q = clamp( (make_float3( vertexData[i] ) - center) * scale, -32767.0f, 32767.0f );
+			packed[i] = make_short4( (short)roundf( q.x ), (short)roundf( q.y ), (short)roundf( q.z ), 0 );
+		}
+		const float4 rows[3] = { make_float4( extent.x, 0, 0, center.x ), make_float4( 0, extent.y, 0, center.y ), make_float4( 0, 0, extent.z, center.z ) };
+		if (dequantize == 0) dequantize = new CoreBuffer<float4>( 3, ON_DEVICE, 0, VRAMGeometry );
+		dequantize->SetHostData( (float4*)rows );
+		dequantize->CopyToDevice( 0, 3 ); // synchronous; rows and packed are temporaries
+		if (quantized == 0 || vertexCount > quantized->GetSize())
+		{
+			delete quantized;
+			quantized = DeviceCopy<short4>( vertexCount, packed.data(), queued );
+		}
+		else
+		{
+			quantized->SetHostData( packed.data() );
+			quantized->CopyToDevice( 0, vertexCount );
+		}
+	}
+	else
+	{
+		delete quantized, quantized = 0;
+		delete dequantize, dequantize = 0;
+		if (positions4 == 0 || vertexCount > positions4->GetSize())
+		{
+			delete positions4;
+			positions4 = DeviceCopy<float4>( vertexCount, vertexData, queued );
+		}
+		else
+		{
+			positions4->SetHostData( (float4*)vertexData );
+			if (culledVertices.size() > 0) positions4->CopyToDevice( 0, vertexCount ); // synchronous; a temporary
+			else positions4->CopyToDeviceAsync( 0, vertexCount, renderCore->updateStream );
+		}
+	}
+	if (!indexed) delete indices, indices = 0;
+	else if (indices == 0 || triCount * 3 > indices->GetSize())
 	{
-		delete triangles;
-		delete positions4;
-		triangles = new CoreBuffer<CoreTri4>( triCount, ON_DEVICE, tris );
-		positions4 = new CoreBuffer<float4>( triangleCount * 3, ON_DEVICE, vertexData );
+		delete indices;
+		indices = DeviceCopy<uint>( triCount * 3, indexData, queued );
 	}
 	else
 	{
-		triangles->SetHostData( (CoreTri4*)tris );
-		triangles->CopyToDevice();
-		positions4->SetHostData( (float4*)vertexData );
-		positions4->CopyToDevice();
+		indices->SetHostData( (uint*)indexData );
+		if (culledIndices.size() > 0) indices->CopyToDevice( 0, triCount * 3 ); // synchronous; a temporary
+		else indices->CopyToDeviceAsync( 0, triCount * 3, renderCore->updateStream );
 	}
+#ifdef ANYHITALPHA
+	// alpha tested triangles use the second SBT record, whose hit groups run the alpha test during traversal;
+	// triangles baked as ALPHA_OPAQUE skip it. Transparent ones are tested too, in case they were not culled,
+	// e.g. after device animation. A refit requires identical indices.
+	vector<uint> sbtOffsets( alphaFlags ? triCount : 0 );
+	bool hasAlpha = false;
+	for (int i = 0; alphaFlags && i < triCount; i++) sbtOffsets[i] = alphaFlags[i] != ALPHA_OPAQUE ? 1 : 0, hasAlpha |= sbtOffsets[i] != 0;
+	if (!hasAlpha)
+	{
+		if (sbtIndices) allowRefit = false;
+		delete sbtIndices, sbtIndices = 0;
+		alphaTested.clear();
+	}
+	else
+	{
+		if (!sbtIndices || alphaTested != sbtOffsets) allowRefit = false;
+		alphaTested.swap( sbtOffsets );
+		if (sbtIndices == 0 || triCount > sbtIndices->GetSize())
+		{
+			delete sbtIndices;
+			sbtIndices = DeviceCopy<uint>( triCount, alphaTested.data(), queued );
+		}
+		else
+		{
+			sbtIndices->SetHostData( alphaTested.data() );
+			sbtIndices->CopyToDeviceAsync( 0, triCount, renderCore->updateStream );
+		}
+	}
+#endif
+	if (queued)
+	{
+		// the build waits for the uploads; meanwhile, instances get a proxy, built on the update stream
+		if (streamDone == 0) cudaEventCreateWithFlags( &streamDone, cudaEventDisableTiming );
+		renderCore->stagingRing->Flush( renderCore->buildStream );
+		streaming = true;
+		gasHandle = BuildProxy( streamProxy );
+	}
+	BuildAccel( allowCompaction, allowRefit );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::SetAnimationData                                                 |
+//  |  Store the bind pose, skin and morph target data on the device, for use by  |
+//  |  SetPose. The triangle count must match the last SetGeometry call.          |
+//  |  Fails for packed meshes: the animation kernel writes full triangles, and   |
+//  |  for quantized meshes: it writes float vertices.                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool CoreMesh::SetAnimationData( const float4* vertexData, const float3* normalData, const int vertexCount,
+	const uint4* jointData, const float4* weightData, const float3* morphPositionData, const float3* morphNormalData, const int morphTargets )
+{
+	assert( vertexCount == triangleCount * 3 && indices == 0 );
+	if (packedTriangles || quantized) return false;
+	delete basePositions;
+	delete baseNormals;
+	delete joints;
+	delete weights;
+	delete morphPositions;
+	delete morphNormals;
+	basePositions = new CoreBuffer<float4>( vertexCount, ON_DEVICE, vertexData, VRAMGeometry );
+	baseNormals = new CoreBuffer<float3>( vertexCount, ON_DEVICE, normalData, VRAMGeometry );
+	joints = jointData ? new CoreBuffer<uint4>( vertexCount, ON_DEVICE, jointData, VRAMGeometry ) : 0;
+	weights = weightData ? new CoreBuffer<float4>( vertexCount, ON_DEVICE, weightData, VRAMGeometry ) : 0;
+	morphPositions = morphTargets > 0 ? new CoreBuffer<float3>( vertexCount * morphTargets, ON_DEVICE, morphPositionData, VRAMGeometry ) : 0;
+	morphNormals = morphTargets > 0 ? new CoreBuffer<float3>( vertexCount * morphTargets, ON_DEVICE, morphNormalData, VRAMGeometry ) : 0;
+	morphCount = morphTargets;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::SetPose                                                          |
+//  |  Animate the mesh on the device using the supplied joint matrices and morph |
+//  |  weights, and rebuild the BVH. Either set may be empty.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::SetPose( const mat4* jointMatData, const int jointCount, const float* morphWeightData, const int weightCount )
+{
+	assert( basePositions != 0 );
+	FinishStreaming( true );
+	const int skinJoints = joints ? jointCount : 0;
+	const int morphs = min( weightCount, morphCount );
+	if (skinJoints > 0)
+	{
+		if (jointMat == 0 || jointMat->GetSize() < skinJoints * 4)
+		{
+			delete jointMat;
+			jointMat = new CoreBuffer<float4>( skinJoints * 4, ON_HOST | ON_DEVICE, 0, VRAMGeometry );
+		}
+		memcpy( jointMat->HostPtr(), jointMatData, skinJoints * sizeof( mat4 ) );
+		jointMat->CopyToDeviceAsync( 0, skinJoints * 4, renderCore->updateStream );
+	}
+	if (morphs > 0)
+	{
+		if (morphWeights == 0) morphWeights = new CoreBuffer<float>( morphCount, ON_HOST | ON_DEVICE, 0, VRAMGeometry );
+		memcpy( morphWeights->HostPtr(), morphWeightData, morphs * sizeof( float ) );
+		morphWeights->CopyToDeviceAsync( 0, morphs, renderCore->updateStream );
+	}
+#ifdef MOTIONBLUR
+	// deformation motion: the pose of the previous frame becomes the key at shutter open
+	if (prevPositions == 0) prevPositions = new CoreBuffer<float4>( verticesUsed, ON_DEVICE, 0, VRAMGeometry );
+	cudaMemcpyAsync( prevPositions->DevPtr(), positions4->DevPtr(), verticesUsed * sizeof( float4 ), cudaMemcpyDeviceToDevice, renderCore->updateStream );
+	motionState = 1;
+#endif
+	animateMesh( basePositions->DevPtr(), baseNormals->DevPtr(),
+		morphs > 0 ? morphPositions->DevPtr() : 0, morphs > 0 ? morphNormals->DevPtr() : 0, morphs > 0 ? morphWeights->DevPtr() : 0, morphs,
+		skinJoints > 0 ? joints->DevPtr() : 0, skinJoints > 0 ? weights->DevPtr() : 0, skinJoints > 0 ? jointMat->DevPtr() : 0, skinJoints,
+		positions4->DevPtr(), triangles->DevPtr(), triangleCount, renderCore->updateStream );
+	BuildAccel( false, true );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::BuildAccel                                                       |
+//  |  Build the OptiX BVH over positions4 or quantized, on the update stream. If |
+//  |  refitting is allowed (topology unchanged since the last build), the        |
+//  |  existing BVH is updated instead, except every gasRebuildInterval refits,   |
+//  |  to limit the loss of BVH quality for deforming meshes. With                |
+//  |  backgroundRebuilds, that full build runs on the build stream instead, and  |
+//  |  the mesh keeps refitting until its result is swapped in; see StartRebuild. |
+//  |  A streamed build runs on the build stream too, and produces streamHandle;  |
+//  |  see SetGeometry.                                                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::BuildAccel( const bool allowCompaction, const bool allowRefit )
+{
 	// prepare acceleration structure build parameters
 	buildInput = {};
 	buildInput.type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
-	buildInput.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
-	buildInput.triangleArray.vertexStrideInBytes = sizeof( float4 );
-	buildInput.triangleArray.numVertices = triangleCount * 3;
-	buildInput.triangleArray.vertexBuffers = (CUdeviceptr*)positions4->DevPtrPtr();
+	buildInput.triangleArray.numVertices = verticesUsed;
+	if (quantized)
+	{
+		// the preTransform maps the SNORM16 vertices, read as [-1,1], back to object space
+		buildInput.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_SNORM16_3;
+		buildInput.triangleArray.vertexStrideInBytes = sizeof( short4 );
+		buildInput.triangleArray.vertexBuffers = (CUdeviceptr*)quantized->DevPtrPtr();
+		buildInput.triangleArray.preTransform = (CUdeviceptr)dequantize->DevPtr();
+	}
+	else
+	{
+		buildInput.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
+		buildInput.triangleArray.vertexStrideInBytes = sizeof( float4 );
+		buildInput.triangleArray.vertexBuffers = (CUdeviceptr*)positions4->DevPtrPtr();
+	}
+#ifdef MOTIONBLUR
+	if (prevPositions)
+	{
+		// two motion keys: the previous pose at shutter open, the current pose at shutter close
+		motionVertices[0] = (CUdeviceptr)prevPositions->DevPtr(), motionVertices[1] = (CUdeviceptr)positions4->DevPtr();
+		buildInput.triangleArray.vertexBuffers = motionVertices;
+	}
+#endif
+	if (indices)
+	{
+		buildInput.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_UNSIGNED_INT3;
+		buildInput.triangleArray.indexStrideInBytes = 3 * sizeof( uint );
+		buildInput.triangleArray.numIndexTriplets = triangleCount;
+		buildInput.triangleArray.indexBuffer = (CUdeviceptr)indices->DevPtr();
+	}
 	buildInput.triangleArray.flags = inputFlags;
 	buildInput.triangleArray.numSbtRecords = 1;
-	// set acceleration structure build options
+#ifdef ANYHITALPHA
+	if (sbtIndices)
+	{
+		buildInput.triangleArray.numSbtRecords = 2;
+		buildInput.triangleArray.sbtIndexOffsetBuffer = (CUdeviceptr)sbtIndices->DevPtr();
+		buildInput.triangleArray.sbtIndexOffsetSizeInBytes = sizeof( uint );
+		buildInput.triangleArray.sbtIndexOffsetStrideInBytes = sizeof( uint );
+	}
+#endif
+	// select build flags using the hint; without a hint, a compacted first build is assumed to be
+	// static, and later builds are for deforming meshes
+	uint buildFlags;
+	switch (hint)
+	{
+	case StaticGeometry: buildFlags = OPTIX_BUILD_FLAG_ALLOW_COMPACTION | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE; break;
+	case DeformingGeometry: buildFlags = OPTIX_BUILD_FLAG_ALLOW_UPDATE | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE; break;
+	case DynamicGeometry: buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_BUILD; break;
+	default: buildFlags = (allowCompaction ? OPTIX_BUILD_FLAG_ALLOW_COMPACTION : OPTIX_BUILD_FLAG_ALLOW_UPDATE) | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE; break;
+	}
+	// a refit must use the flags of the original build
+	bool refit = allowRefit && buildOptions.buildFlags == buildFlags && (buildFlags & OPTIX_BUILD_FLAG_ALLOW_UPDATE);
+#ifdef MOTIONBLUR
+	// ...and the same number of motion keys
+	if ((buildOptions.motionOptions.numKeys > 1) != (prevPositions != 0)) refit = false;
+#endif
+	// after gasRebuildInterval refits, a full build restores the BVH quality: now, or in the background
+	const bool rebuildDue = refit && refitCount >= renderCore->gasRebuildInterval;
+	if (rebuildDue && !renderCore->backgroundRebuilds) refit = false;
+	// a full build makes the BVH of a background build obsolete; a completed one replaces the refitted BVH
+	if (!refit) rebuildPending = false;
+	else FinishRebuild();
+	const bool compact = !refit && (buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION);
 	buildOptions = {};
-	buildOptions.buildFlags = (allowCompaction ? OPTIX_BUILD_FLAG_ALLOW_COMPACTION : 0) | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE;
-	buildOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
+	buildOptions.buildFlags = buildFlags;
+	buildOptions.operation = refit ? OPTIX_BUILD_OPERATION_UPDATE : OPTIX_BUILD_OPERATION_BUILD;
+#ifdef MOTIONBLUR
+	if (prevPositions) buildOptions.motionOptions.numKeys = 2, buildOptions.motionOptions.timeBegin = 0, buildOptions.motionOptions.timeEnd = 1;
+#endif
 	// determine buffer sizes for the acceleration structure
 	CHK_OPTIX( optixAccelComputeMemoryUsage( RenderCore::optixContext, &buildOptions, &buildInput, 1, &buildSizes ) );
+	const size_t tempNeeded = refit ? buildSizes.tempUpdateSizeInBytes : buildSizes.tempSizeInBytes;
 	uint compactedSizeOffset = roundUp<uint>( (uint)buildSizes.outputSizeInBytes, 8 );
 	// (re)allocate when needed
-	if (buildTemp == 0 || (size_t)buildTemp->GetSize() < buildSizes.tempSizeInBytes)
+	if (buildTemp == 0 || (size_t)buildTemp->GetSize() < tempNeeded)
 	{
 		delete buildTemp;
-		buildTemp = new CoreBuffer<uchar>( buildSizes.tempSizeInBytes, ON_DEVICE );
+		buildTemp = new CoreBuffer<uchar>( tempNeeded, ON_DEVICE, 0, VRAMBVH );
 	}
-	if (buildBuffer == 0 || buildBuffer->GetSize() < compactedSizeOffset)
+	if (!refit && (buildBuffer == 0 || buildBuffer->GetSize() < compactedSizeOffset))
 	{
 		delete buildBuffer;
-		buildBuffer = new CoreBuffer<uchar>( compactedSizeOffset + 8, ON_DEVICE );
+		buildBuffer = new CoreBuffer<uchar>( compactedSizeOffset + 8, ON_DEVICE, 0, VRAMBVH );
 	}
+	// time the build on the update stream; see RenderCore::Render. Background builds are not timed.
+	const cudaStream_t stream = streaming ? renderCore->buildStream : renderCore->updateStream;
+	OptixTraversableHandle* handle = streaming ? &streamHandle : &gasHandle;
+	if (buildStart == 0) cudaEventCreate( &buildStart ), cudaEventCreate( &buildEnd );
+	if (!streaming) cudaEventRecord( buildStart, stream );
 	// build
-	if (allowCompaction)
+	if (refit)
 	{
-		// build with compaction
+		// update the existing structure in place
+		CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, stream, &buildOptions, &buildInput, 1,
+			(CUdeviceptr)buildTemp->DevPtr(), tempNeeded, gasData, gasSize, handle, 0, 0 ) );
+		refitCount++;
+	}
+	else if (compact)
+	{
+		// build with compaction; the compacted copy is made by RenderCore::CompactMeshes, for all meshes at once
 		OptixAccelEmitDesc emitProperty = {};
 		emitProperty.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
 		emitProperty.result = (CUdeviceptr)((char*)buildBuffer->DevPtr() + compactedSizeOffset);
-		CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, 0, &buildOptions, &buildInput, 1,
+		CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, stream, &buildOptions, &buildInput, 1,
 			(CUdeviceptr)buildTemp->DevPtr(), buildSizes.tempSizeInBytes, (CUdeviceptr)buildBuffer->DevPtr(),
-			buildSizes.outputSizeInBytes, &gasHandle, &emitProperty, 1 ) );
-		size_t compacted_gas_size;
-		cudaMemcpy( &compacted_gas_size, (void*)emitProperty.result, sizeof( size_t ), cudaMemcpyDeviceToHost );
-		if (compacted_gas_size < buildSizes.outputSizeInBytes)
-		{
-			CoreBuffer<uchar>* compacted = new CoreBuffer<uchar>( compacted_gas_size, ON_DEVICE );
-			gasData = (CUdeviceptr)compacted->DevPtr();
-			CHK_OPTIX( optixAccelCompact( RenderCore::optixContext, 0, gasHandle, gasData, compacted_gas_size, &gasHandle ) );
-			delete buildBuffer;
-			buildBuffer = compacted;
-		#if 0
-			// store compacted bvh data to file
-			if (triCount > 2) // not the light
-			{
-				buildBuffer->CopyToHost();
-				uint size = (uint)compacted_gas_size;
-				char n[128];
-				sprintf( n, "bvhdata_%i-%i_compacted.txt", triCount, size );
-				FILE* f = fopen( n, "w" );
-				float* fdata = (float*)buildBuffer->HostPtr();
-				uint* idata = (uint*)buildBuffer->HostPtr();
-				size /= 4;
-				for( uint i = 0; i < size; i++ ) fprintf( f, "%04id\t%.02Xh\t%.02Xh\t%.02Xh\t%.02Xh\t%10i\t%f\n", i * 4, idata[i] & 255, (idata[i] >> 8) & 255, (idata[i] >> 16) & 255, idata[i] >> 24, idata[i], fdata[i] );
-				fclose( f );
-			}
-		#endif
-		}
-		else gasData = (CUdeviceptr)buildBuffer->DevPtr();
+			buildSizes.outputSizeInBytes, handle, &emitProperty, 1 ) );
+		gasData = (CUdeviceptr)buildBuffer->DevPtr(), gasSize = buildSizes.outputSizeInBytes;
+		compactedSize = emitProperty.result;
+		refitCount = 0;
 	}
 	else
 	{
 		// build without compaction
-		CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, 0, &buildOptions, &buildInput, 1,
+		CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, stream, &buildOptions, &buildInput, 1,
 			(CUdeviceptr)buildTemp->DevPtr(), buildSizes.tempSizeInBytes, (CUdeviceptr)buildBuffer->DevPtr(),
-			buildSizes.outputSizeInBytes, &gasHandle, 0, 0 ) );
+			buildSizes.outputSizeInBytes, handle, 0, 0 ) );
 		gasData = (CUdeviceptr)buildBuffer->DevPtr();
+		gasSize = buildSizes.outputSizeInBytes;
+		refitCount = 0;
+	}
+	if (streaming) cudaEventRecord( streamDone, stream );
+	else cudaEventRecord( buildEnd, stream ), pendingBuild = refit ? 2 : 1;
+	if (rebuildDue && !rebuildPending) StartRebuild();
+	// a new BVH lives in buildBuffer, no longer in an arena; a streamed one is compacted after FinishStreaming
+	if (!refit) compactPending = compact && !streaming, gasArena = -1;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::StartRebuild                                                     |
+//  |  Full build of a refitted BVH on the build stream, at low priority. The     |
+//  |  vertices are copied on the update stream first, so the animation of the    |
+//  |  next frames does not affect the build. If an earlier background build is   |
+//  |  still running, e.g. one that was made obsolete, nothing happens.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::StartRebuild()
+{
+	if (rebuildDone == 0) cudaEventCreateWithFlags( &rebuildStart, cudaEventDisableTiming ), cudaEventCreateWithFlags( &rebuildDone, cudaEventDisableTiming );
+	else if (cudaEventQuery( rebuildDone ) != cudaSuccess) return;
+	int keys = 1;
+#ifdef MOTIONBLUR
+	if (prevPositions) keys = 2;
+#endif
+	// snapshot of the vertices of the current build input
+	if (rebuildVertices == 0 || rebuildVertices->GetSize() < verticesUsed * keys)
+	{
+		delete rebuildVertices;
+		rebuildVertices = new CoreBuffer<float4>( verticesUsed * keys, ON_DEVICE, 0, VRAMGeometry );
+	}
+	CUdeviceptr snapshot[2];
+	for (int i = 0; i < keys; i++)
+	{
+		snapshot[i] = (CUdeviceptr)(rebuildVertices->DevPtr() + i * verticesUsed);
+		cudaMemcpyAsync( (void*)snapshot[i], (void*)buildInput.triangleArray.vertexBuffers[i], verticesUsed * sizeof( float4 ),
+			cudaMemcpyDeviceToDevice, renderCore->updateStream );
+	}
+	cudaEventRecord( rebuildStart, renderCore->updateStream );
+	cudaStreamWaitEvent( renderCore->buildStream, rebuildStart, 0 );
+	// full build with the options of the refitted BVH, so that it can be refitted in turn
+	OptixBuildInput input = buildInput;
+	input.triangleArray.vertexBuffers = snapshot;
+	OptixAccelBuildOptions options = buildOptions;
+	options.operation = OPTIX_BUILD_OPERATION_BUILD;
+	if (rebuildTemp == 0 || (size_t)rebuildTemp->GetSize() < buildSizes.tempSizeInBytes)
+	{
+		delete rebuildTemp;
+		rebuildTemp = new CoreBuffer<uchar>( buildSizes.tempSizeInBytes, ON_DEVICE, 0, VRAMBVH );
+	}
+	if (rebuildBuffer == 0 || (size_t)rebuildBuffer->GetSize() < buildSizes.outputSizeInBytes)
+	{
+		delete rebuildBuffer;
+		rebuildBuffer = new CoreBuffer<uchar>( buildSizes.outputSizeInBytes, ON_DEVICE, 0, VRAMBVH );
+	}
+	OptixTraversableHandle handle; // not used: FinishRebuild refits the new BVH, which yields the handle
+	CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, renderCore->buildStream, &options, &input, 1,
+		(CUdeviceptr)rebuildTemp->DevPtr(), buildSizes.tempSizeInBytes, (CUdeviceptr)rebuildBuffer->DevPtr(),
+		buildSizes.outputSizeInBytes, &handle, 0, 0 ) );
+	cudaEventRecord( rebuildDone, renderCore->buildStream );
+	rebuildSize = buildSizes.outputSizeInBytes;
+	rebuildPending = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::FinishRebuild                                                    |
+//  |  If the background build is done, swap its BVH with the refitted one. The   |
+//  |  caller refits the new BVH to the current vertices right away, so the swap  |
+//  |  takes effect between two frames. Returns true if it did.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool CoreMesh::FinishRebuild()
+{
+	if (!rebuildPending || cudaEventQuery( rebuildDone ) != cudaSuccess) return false;
+	std::swap( buildBuffer, rebuildBuffer );
+	gasData = (CUdeviceptr)buildBuffer->DevPtr(), gasSize = rebuildSize;
+	rebuildPending = false, refitCount = 0;
+	renderCore->coreStats.gasBackgroundRebuilds++;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::FinishStreaming                                                  |
+//  |  Replace the proxy of a streamed mesh by its BVH, once the build on the     |
+//  |  build stream is done, or right away, after waiting for it. Returns true if |
+//  |  the mesh received its BVH.                                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool CoreMesh::FinishStreaming( const bool wait )
+{
+	if (!streaming) return false;
+	if (wait) cudaEventSynchronize( streamDone );
+	else if (cudaEventQuery( streamDone ) != cudaSuccess) return false;
+	gasHandle = streamHandle;
+	delete streamProxy, streamProxy = 0;
+	compactPending = (buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+	streaming = false;
+	return true;
+}
+
+#ifdef MOTIONBLUR
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::SettleMotion                                                     |
+//  |  A posed mesh that was not posed again is at rest: both motion keys get the |
+//  |  current pose, and the BVH is refitted. Called by RenderCore::Render. LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::SettleMotion()
+{
+	cudaMemcpyAsync( prevPositions->DevPtr(), positions4->DevPtr(), verticesUsed * sizeof( float4 ), cudaMemcpyDeviceToDevice, renderCore->updateStream );
+	BuildAccel( false, true );
+	motionState = 0;
+}
+#endif
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::Evict                                                            |
+//  |  Release the device data of a static mesh. The data is kept in host memory; |
+//  |  the BVH is replaced by a proxy: a single box over the mesh bounds, so      |
+//  |  instances keep a valid traversable. Instances of an evicted mesh have a    |
+//  |  zero mask, see RenderCore::InstanceMask. The caller makes sure that the    |
+//  |  device no longer uses the data.                                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::Evict()
+{
+	if (!resident) return;
+	FinishStreaming( true );
+	residentBytes = GeometryBytes();
+	// the arrays passed to SetGeometry are not retained, so the first eviction copies the device data back
+	if (hostPositions.size() == 0 && hostQuantized.size() == 0)
+	{
+		if (quantized)
+		{
+			hostQuantized.resize( verticesUsed );
+			cudaMemcpy( hostQuantized.data(), quantized->DevPtr(), verticesUsed * sizeof( short4 ), cudaMemcpyDeviceToHost );
+		}
+		else
+		{
+			hostPositions.resize( verticesUsed );
+			cudaMemcpy( hostPositions.data(), positions4->DevPtr(), verticesUsed * sizeof( float4 ), cudaMemcpyDeviceToHost );
+		}
+		if (indices)
+		{
+			hostIndices.resize( triangleCount * 3 );
+			cudaMemcpy( hostIndices.data(), indices->DevPtr(), triangleCount * 3 * sizeof( uint ), cudaMemcpyDeviceToHost );
+		}
+		if (packedTriangles)
+		{
+			hostPacked.resize( triangleCount );
+			cudaMemcpy( hostPacked.data(), packedTriangles->DevPtr(), triangleCount * sizeof( CoreTriPacked ), cudaMemcpyDeviceToHost );
+		}
+		else
+		{
+			hostTriangles.resize( triangleCount );
+			cudaMemcpy( hostTriangles.data(), triangles->DevPtr(), triangleCount * sizeof( CoreTri4 ), cudaMemcpyDeviceToHost );
+		}
+	}
+	delete positions4, positions4 = 0;
+	delete quantized, quantized = 0; // the small dequantize buffer stays, for Reload
+	delete indices, indices = 0;
+	delete triangles, triangles = 0;
+	delete packedTriangles, packedTriangles = 0;
+	delete sbtIndices, sbtIndices = 0;
+	delete buildTemp, buildTemp = 0;
+	delete buildBuffer, buildBuffer = 0;
+	compactPending = false, gasArena = -1;
+	resident = false;
+	gasHandle = BuildProxy( buildBuffer );
+	gasData = (CUdeviceptr)buildBuffer->DevPtr();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::Reload                                                           |
+//  |  Restore the device data of an evicted mesh from the host copies, through   |
+//  |  the staging ring, and build a BVH over it on the update stream, which is   |
+//  |  compacted by the next RenderCore::CompactMeshes.                           |
+//  |  The host copies are kept, so a later eviction is free.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::Reload()
+{
+	if (resident) return;
+	StagingRing* ring = renderCore->stagingRing;
+	delete buildBuffer, buildBuffer = 0; // the proxy
+	if (hostQuantized.size() > 0)
+	{
+		quantized = new CoreBuffer<short4>( verticesUsed, ON_DEVICE, 0, VRAMGeometry );
+		ring->Upload( quantized->DevPtr(), hostQuantized.data(), verticesUsed * sizeof( short4 ) );
+	}
+	else
+	{
+		positions4 = new CoreBuffer<float4>( verticesUsed, ON_DEVICE, 0, VRAMGeometry );
+		ring->Upload( positions4->DevPtr(), hostPositions.data(), verticesUsed * sizeof( float4 ) );
+	}
+	if (hostIndices.size() > 0)
+	{
+		indices = new CoreBuffer<uint>( triangleCount * 3, ON_DEVICE, 0, VRAMGeometry );
+		ring->Upload( indices->DevPtr(), hostIndices.data(), triangleCount * 3 * sizeof( uint ) );
 	}
+	if (hostPacked.size() > 0)
+	{
+		packedTriangles = renderCore->PoolBuffer<CoreTriPacked>( triangleCount, VRAMGeometry );
+		ring->Upload( packedTriangles->DevPtr(), hostPacked.data(), triangleCount * sizeof( CoreTriPacked ) );
+	}
+	else
+	{
+		triangles = basePositions ? new CoreBuffer<CoreTri4>( triangleCount, ON_DEVICE, 0, VRAMGeometry ) : renderCore->PoolBuffer<CoreTri4>( triangleCount, VRAMGeometry );
+		ring->Upload( triangles->DevPtr(), hostTriangles.data(), triangleCount * sizeof( CoreTri4 ) );
+	}
+	if (alphaTested.size() > 0)
+	{
+		sbtIndices = new CoreBuffer<uint>( triangleCount, ON_DEVICE, 0, VRAMGeometry );
+		ring->Upload( sbtIndices->DevPtr(), alphaTested.data(), triangleCount * sizeof( uint ) );
+	}
+	ring->Flush( renderCore->updateStream );
+	resident = true;
+	BuildAccel( true, false );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::GeometryBytes                                                    |
+//  |  Device memory of the vertices, indices, shading data and BVH of the mesh,  |
+//  |  for the geometry budget. An evicted mesh reports its resident size.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+size_t CoreMesh::GeometryBytes() const
+{
+	if (!resident) return residentBytes;
+	size_t bytes = (size_t)verticesUsed * (quantized ? sizeof( short4 ) : sizeof( float4 )) + gasSize;
+	bytes += (size_t)triangleCount * (packedTriangles ? sizeof( CoreTriPacked ) : sizeof( CoreTri4 ));
+	if (indices) bytes += (size_t)triangleCount * 3 * sizeof( uint );
+	if (sbtIndices) bytes += (size_t)triangleCount * sizeof( uint );
+	return bytes;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::BuildProxy                                                       |
+//  |  Build a BVH over one custom primitive: the bounds of the mesh, in target.  |
+//  |  Rays never visit it, as the instance mask is zero; the pipeline has no     |
+//  |  intersection program for it.                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+OptixTraversableHandle CoreMesh::BuildProxy( CoreBuffer<uchar>*& target )
+{
+	const OptixAabb box = { boundsMin.x, boundsMin.y, boundsMin.z, boundsMax.x, boundsMax.y, boundsMax.z };
+	CoreBuffer<OptixAabb> boxBuffer( 1, ON_DEVICE, &box, VRAMBVH );
+	CUdeviceptr boxPtr = (CUdeviceptr)boxBuffer.DevPtr();
+	const uint32_t proxyFlags = OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
+	OptixBuildInput proxyInput = {};
+	proxyInput.type = OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES;
+	proxyInput.aabbArray.aabbBuffers = &boxPtr;
+	proxyInput.aabbArray.numPrimitives = 1;
+	proxyInput.aabbArray.flags = &proxyFlags;
+	proxyInput.aabbArray.numSbtRecords = 1;
+	OptixAccelBuildOptions options = {};
+	options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_BUILD;
+	options.operation = OPTIX_BUILD_OPERATION_BUILD;
+	OptixAccelBufferSizes sizes;
+	CHK_OPTIX( optixAccelComputeMemoryUsage( RenderCore::optixContext, &options, &proxyInput, 1, &sizes ) );
+	CoreBuffer<uchar> temp( sizes.tempSizeInBytes, ON_DEVICE, 0, VRAMBVH );
+	delete target;
+	target = new CoreBuffer<uchar>( sizes.outputSizeInBytes, ON_DEVICE, 0, VRAMBVH );
+	OptixTraversableHandle handle;
+	CHK_OPTIX( optixAccelBuild( RenderCore::optixContext, renderCore->updateStream, &options, &proxyInput, 1,
+		(CUdeviceptr)temp.DevPtr(), sizes.tempSizeInBytes, (CUdeviceptr)target->DevPtr(), sizes.outputSizeInBytes, &handle, 0, 0 ) );
+	cudaStreamSynchronize( renderCore->updateStream ); // the box and scratch buffers go out of scope
+	return handle;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoreMesh::ReleaseHostCopies                                                |
+//  |  Free the host copies made by Evict.                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void CoreMesh::ReleaseHostCopies()
+{
+	vector<float4>().swap( hostPositions );
+	vector<short4>().swap( hostQuantized );
+	vector<uint>().swap( hostIndices );
+	vector<CoreTri4>().swap( hostTriangles );
+	vector<CoreTriPacked>().swap( hostPacked );
 }
 
 // EOF
\ No newline at end of file
@@ -21,7 +21,8 @@ namespace lh2core {
 //  |  CoreMesh                                                                   |
 //  |  Container for geometry data. Actual data resides on device:                |
 //  |  - indicesDesc and verticesDesc describe on-device OptiX buffers;           |
-//  |  - triangles contains the fully equiped triangle data.                LH2'19|
+//  |  - triangles contains the fully equiped triangle data, or                   |
+//  |  - packedTriangles contains a compressed version of it.               LH2'19|
 //  +-----------------------------------------------------------------------------+
 class RenderCore;
 class CoreMesh
@@ -31,39 +32,96 @@ public:
 	CoreMesh() = default;
 	CoreMesh::~CoreMesh();
 	// methods
-	void SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags = 0 );
+	void SetGeometry( const float4* vertexData, const int vertexCount, const int triCount, const CoreTri* tris, const uint* alphaFlags = 0, const uint* indexData = 0 );
+	bool SetAnimationData( const float4* vertexData, const float3* normalData, const int vertexCount,
+		const uint4* jointData, const float4* weightData, const float3* morphPositionData, const float3* morphNormalData, const int morphTargets );
+	void SetPose( const mat4* jointMatData, const int jointCount, const float* morphWeightData, const int weightCount );
+	void BuildAccel( const bool allowCompaction, const bool allowRefit );
+	void Evict();
+	void Reload();
+	bool FinishStreaming( const bool wait );
+	size_t GeometryBytes() const;
+#ifdef MOTIONBLUR
+	void SettleMotion();
+#endif
+	CoreTri4* ShadingData() const { return packedTriangles ? (CoreTri4*)packedTriangles->DevPtr() : triangles ? triangles->DevPtr() : 0; }
+private:
+	OptixTraversableHandle BuildProxy( CoreBuffer<uchar>*& target );
+	void StartRebuild();
+	bool FinishRebuild();
+	void ReleaseHostCopies();
+public:
 	// data
 	int triangleCount = 0;					// number of triangles in the mesh
+	GeometryHint hint = DefaultGeometry;	// expected behavior of the mesh, selects BVH build options
+	int verticesUsed = 0;					// number of vertices in positions4 or quantized
 	CoreBuffer<float4>* positions4 = 0;		// vertex data for intersection
+	CoreBuffer<short4>* quantized = 0;	// replaces positions4 for quantized meshes: SNORM16 vertices in the bounds
+	CoreBuffer<float4>* dequantize = 0;		// quantized meshes: 3x4 matrix from the bounds to object space, the preTransform
+	CoreBuffer<uint>* indices = 0;			// optional: three indices into positions4 per triangle
 	CoreBuffer<CoreTri4>* triangles = 0;	// original triangle data, as received from RenderSystem, for shading
+	CoreBuffer<CoreTriPacked>* packedTriangles = 0;	// compact shading data; replaces triangles, see SetGeometry
+	CoreBuffer<uint>* sbtIndices = 0;		// ANYHITALPHA: per triangle 1 if alpha tested, else 0; selects the SBT record
+	vector<uint> alphaTested;				// ANYHITALPHA: host copy of sbtIndices, to detect changes that prevent a refit
 	CoreBuffer<uchar>* buildTemp = 0;		// reusable temporary buffer for Optix BVH construction
 	CoreBuffer<uchar>* buildBuffer = 0;		// reusable target buffer for Optix BVH construction
+	// device-side animation data, see SetAnimationData
+	CoreBuffer<float4>* basePositions = 0;	// bind pose vertices
+	CoreBuffer<float3>* baseNormals = 0;	// bind pose vertex normals
+	CoreBuffer<uint4>* joints = 0;			// skinning: joint indices per vertex
+	CoreBuffer<float4>* weights = 0;		// skinning: joint weights per vertex
+	CoreBuffer<float3>* morphPositions = 0;	// morph targets: position deltas, one block of vertices per target
+	CoreBuffer<float3>* morphNormals = 0;	// morph targets: normal deltas, same layout
+	CoreBuffer<float4>* jointMat = 0;		// skinning: current joint matrices, four rows each
+	CoreBuffer<float>* morphWeights = 0;	// morph targets: current weights
+	int morphCount = 0;						// number of morph targets
+#ifdef MOTIONBLUR
+	CoreBuffer<float4>* prevPositions = 0;	// posed meshes: vertices of the previous pose, the motion key at shutter open
+	CUdeviceptr motionVertices[2];			// vertex buffers of both motion keys, for the build input
+	int motionState = 0;					// 1: posed since the last frame; 2: posed for the last frame; 0: at rest
+#endif
+	// geometry streaming, see RenderCore::UpdateResidency
+	bool resident = true;					// device data present; if not, gasHandle is a proxy, see Evict
+	float3 boundsMin, boundsMax;			// object space bounds of the vertices, for the proxy and the priority
+	float priority = 0;						// projected size of the nearest instance, when last visible
+	int lastVisible = -1;					// last frame in which an instance of the mesh was visible
+	size_t residentBytes = 0;				// device memory of the mesh when resident; set by Evict
+	vector<float4> hostPositions;			// host copies of the device data, made by the first Evict
+	vector<short4> hostQuantized;
+	vector<uint> hostIndices;
+	vector<CoreTri4> hostTriangles;
+	vector<CoreTriPacked> hostPacked;
+	// background first builds, see RenderCore::streamGeometry
+	bool streaming = false;					// BVH build in flight on the build stream; gasHandle is a proxy meanwhile
+	cudaEvent_t streamDone = 0;				// recorded on the build stream after the build
+	OptixTraversableHandle streamHandle;	// the BVH being built, becomes gasHandle in FinishStreaming
+	CoreBuffer<uchar>* streamProxy = 0;		// proxy BVH while streaming
 	// aceleration structure
-	uint32_t inputFlags[1] = { OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT /* handled in CUDA shading code instead */ };
+	uint32_t inputFlags[2] = { OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT /* opaque, or alpha handled in CUDA shading code */,
+		OPTIX_GEOMETRY_FLAG_NONE /* ANYHITALPHA: alpha tested triangles */ };
 	OptixBuildInput buildInput;				// acceleration structure build parameters
-	OptixAccelBuildOptions buildOptions;	// acceleration structure build options
+	OptixAccelBuildOptions buildOptions = {};	// acceleration structure build options
 	OptixAccelBufferSizes buildSizes;		// buffer sizes for acceleration structure construction
 	OptixTraversableHandle gasHandle;		// handle to the mesh BVH
 	CUdeviceptr gasData;					// acceleration structure data
+	size_t gasSize = 0;						// size of the acceleration structure data, in bytes
+	bool compactPending = false;			// built for compaction; RenderCore::CompactMeshes makes the compacted copy
+	CUdeviceptr compactedSize = 0;			// device location of the emitted compacted size, while compactPending
+	int gasArena = -1;						// RenderCore::gasArenas entry that holds the compacted BVH, or -1
+	int refitCount = 0;						// number of refits since the last full build
+	int pendingBuild = 0;					// last build to be timed: 0 = none, 1 = build, 2 = refit
+	cudaEvent_t buildStart = 0, buildEnd = 0;	// timing of the last build on the update stream
+	// background rebuilds of refitted meshes, see RenderCore::backgroundRebuilds
+	bool rebuildPending = false;			// a full build over a snapshot of the vertices is in flight on the build stream
+	CoreBuffer<float4>* rebuildVertices = 0;	// the snapshot, one block of vertices per motion key
+	CoreBuffer<uchar>* rebuildTemp = 0;		// scratch memory of the background build
+	CoreBuffer<uchar>* rebuildBuffer = 0;	// target of the background build; swapped with buildBuffer by FinishRebuild
+	size_t rebuildSize = 0;					// size of the BVH in rebuildBuffer
+	cudaEvent_t rebuildStart = 0, rebuildDone = 0;	// snapshot taken on the update stream; build done on the build stream
 	// global access
 	static RenderCore* renderCore;			// for access to material list, in case of alpha mapped triangles
 };
 
-//  +-----------------------------------------------------------------------------+
-//  |  CoreInstance                                                               |
-//  |  Stores the data for a scene graph object.                            LH2'19|
-//  +-----------------------------------------------------------------------------+
-class CoreInstance
-{
-public:
-	// constructor / destructor
-	CoreInstance() = default;
-	// data
-	int mesh = 0;							// ID of the mesh used for this instance
-	OptixInstance instance;
-	float transform[12];					// rigid transform of the instance
-};
-
 } // namespace lh2core
 
 // EOF
\ No newline at end of file
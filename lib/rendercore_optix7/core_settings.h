@@ -22,11 +22,42 @@
 
 // core-specific settings
 #define CLAMPFIREFLIES		// suppress fireflies by clamping
-#define MAXPATHLENGTH		3
+#define MAXPATHLENGTH		5	// upper bound for the maxPathLength setting; sizes the connection buffer, see SizeConnections
+#define PATHLENGTH			3	// default for the maxPathLength setting
+#define AODISTANCE			1.0f	// preview modes: default length of the ambient occlusion rays, see "aoDistance"
+#define MAXTARGETS			4	// max number of render targets for SetTargets
+#define SHADEVARIANTS		5	// compiled launch configurations of shadeKernel, see kernels/pathtracer.h
+#define SORTCLASSES			2	// with materialSort and shadeClasses: shade kernel specializations, each with its own sort bins
+#define SHADE_FULL			0	// any material
+#define SHADE_BASIC			1	// no subsurface, clearcoat or transmission: those lobes compile out, see ShadePath
+#define FINALIZEVARIANTS	4	// block sizes for finalizeRenderKernel, see RenderCore::TuneLaunchConfig
+#define DENOISETILE			1024	// the OptiX denoiser processes larger frames in tiles of this size, see RenderCore::Denoise
+#define MAXPROBES			16	// picking: max probe positions per frame, MAXPROBEPOS in core_api_base.h; see SetProbePositions
+#define PROBERING			3	// picking: readback buffers for the probe results, one per frame
+#define READBACKRING		3	// frame readback: pinned host copies of finished frames, see SetFrameReadback
+#define RAYQUERYRING		4	// ray queries: batches whose results stay available, one per traced frame, see QueryRays
+#define PEERPOOLMIN			(4 << 20)	// peerPools: smaller read-only pools always stay on the render device
+#define PEERRESERVE			4	// peerPools: 1 / PEERRESERVE of the render device is kept for path states, BVHs and frame buffers
+#define STREAMGRACEFRAMES	60	// geometry streaming: frames a mesh keeps its priority after its last visible instance
+#define RCPROBES			4	// radiance cache: slots tried per cell before a sample is dropped, see kernels/radiancecache.h
+#define RCLEVELCELLS		64	// radiance cache: cells per level along the view distance; each level doubles the cell size
+#define RCMINSAMPLES		8.0f	// radiance cache: samples a cell needs before its value is used
+#define RCMAXSAMPLES		256.0f	// radiance cache: sample count from which cells decay each frame, see decayRadianceCache
+#define RESTIRRADIUS		16.0f	// light resampling: pixel radius around the reprojected pixel for spatial reuse, see kernels/restir.h
+#define RESTIRDEPTH			0.05f	// light resampling: max distance between reused surfaces, relative to the hit distance
+#define RESTIRNORMAL		0.9f	// light resampling: min cosine between the normals of reused surfaces
+#define HEATMAPCYCLES		100000.0f	// traversal heatmap: default cycles per sample at the top of the ramp
+#define HEATMAPANYHITS		16.0f	// traversal heatmap: any-hit invocations per sample at the top of the ramp
+#define REPROJECTDEPTH		0.05f	// temporal reprojection: max depth difference of a reused pixel, relative to the hit distance
+#define GUIDERES			8	// path guiding: the directional histograms have GUIDERES x GUIDERES equal-area bins
+#define GUIDEBINS			(GUIDERES * GUIDERES)
+#define GUIDEMINSAMPLES		64.0f	// path guiding: training samples a cell needs before it is used for sampling
+#define GUIDEMAXSAMPLES		4096.0f	// path guiding: sample count from which cells decay, see mergePathGuide
 // #define USE_LAMBERT_BSDF	// override default microfacet model
 // #define USE_MULTISCATTER_BSDF // override default microfacet model
 // #define GGXCONDUCTOR // alternative is the diffuse ggx brdf
-#define SINGLEBOUNCE		// perform only a single diffuse bounce
+#define GGXCOMPENSATION		// multiscatter energy compensation for the specular lobe; one texture fetch, see ggx_albedo.h
+#define SINGLEBOUNCE		// default for the singleBounce setting: perform only a single diffuse bounce
 #define CONSISTENTNORMALS	// consistent normal interpolation; don't use with filtering?
 
 // low-level settings
@@ -36,6 +67,25 @@
 #define BILINEAR			// enable bilinear interpolation
 // #define NOTEXTURES		// all texture reads will be white
 #define COMBINEDSHADING		// direct and indirect are stored together for faster access
+#define VIRTUALTEXTURES		// stream pages of the ARGB32 and NRM32 texel pools on demand, see TexelPager
+#define TEXPAGESHIFT		12	// virtual textures: 4096 texels per page
+#define TEXPAGESIZE			(1 << TEXPAGESHIFT)
+#define NOTRESIDENT			0xffffffff
+#define TEXPAGEREADS		64	// virtual textures with a page file: maximum number of page reads in flight
+#define TEXPAGECHUNK		256	// virtual textures with a page file: pages per read in TexelPager::Commit
+#define BCTEXTURES			// allow block compressed ARGB32 (BC1) and NRM32 (BC5) textures, see compressTextures
+#define BCTEXTURE			0x80000000	// block compressed textures: flag in the texel offset
+#define HWTEXTURES			// allow sampling textures through CUDA texture objects, see hardwareTextures
+#define HWTEXTURE			0x40000000	// texture objects: flag in the texel offset, which holds the texture ID
+#define SKYIMPORTANCE		// next event estimation towards the sky dome, see HostSkyDome::BuildImportanceCDF
+#define SKYNEEPROB			0.5f	// sky importance sampling: share of the connections that go to the sky if there are lights
+// #define ANYHITALPHA		// alpha test flagged triangles in an any-hit program during traversal, see CoreMesh::BuildAccel;
+							// needs __anyhit__alpha in .optix.cu, and optixTrace calls with an SBT stride of 2
+// #define MOTIONBLUR		// matrix motion transforms for moving instances and two-key GAS for posed meshes, see SetInstanceMotion;
+							// needs optixTrace calls with the ray time of RayTime( pathIdx, pass, params.shutter ) in .optix.cu
+// #define SHADECOST		// instrumentation build: clock64 cycles of the shading data and BSDF per material, see GetMaterialCosts
+// #define NVENCODER		// hardware video encoding for SetVideoTarget, see VideoEncoder;
+							// needs nvEncodeAPI.h of the NVIDIA Video Codec SDK in lib/CUDA/nvenc
 
 #define APPLYSAFENORMALS	if (dot( N, wi ) <= 0) pdf = 0;
 #define NOHIT				-1
@@ -63,6 +113,7 @@
 #include <optix.h>
 #include <optix_stubs.h>
 #include <optix_stack_size.h>
+#include <nvtx3/nvToolsExt.h>	// header-only NVTX, marks the phases of a frame for Nsight
 
 char* ParseOptixError( OptixResult r );
 #define CHK_OPTIX( c ) do { OptixResult r = c; if (r) { \
@@ -80,6 +131,7 @@ char* ParseOptixError( OptixResult r );
 using namespace lighthouse2;
 
 #include "core_mesh.h"
+#include "core_texture.h"
 
 using namespace lh2core;
 
@@ -115,6 +167,74 @@ struct PotentialContribution
 };
 struct PotentialContribution4 { float4 O4, D4, E4; };
 
+// path length and termination, passed to the shade kernel; see RenderCore::Setting
+struct PathControl
+{
+	int maxLength;		// max path length, 1..MAXPATHLENGTH
+	int rrDepth;		// path length from which Russian roulette is applied; 0 disables it
+	int singleBounce;	// terminate paths after their first diffuse bounce
+	int packedStates;	// store the throughput stream of the path states as halves, see StoreThroughput
+	int rayStats;		// collect the per-segment ray statistics of Counters, see CountLanes
+	int sampler;		// 0: blue noise tables for the first 256 samples; 1: Owen-scrambled Sobol, see SobolOwenSampler
+	uint connectStride;	// offset between the O4, D4 and E4 streams of the connection buffer, see RenderCore::SizeConnections
+	uint reorderBits;	// megakernel: bits of the coherence hint for shader execution reordering, 0 disables; see kernels/reorder.h
+	int preview;		// PREVIEW_* shading mode for layout work; PREVIEW_OFF is the full path tracer, see "previewMode"
+	float aoDistance;	// PREVIEW_AO: length of the occlusion rays
+};
+enum { PREVIEW_OFF = 0, PREVIEW_ALBEDO, PREVIEW_DIRECT, PREVIEW_AO, PREVIEW_ONEBOUNCE };
+
+// world-space radiance cache, see kernels/radiancecache.h and RenderCore::UpdateRadianceCache
+struct RadianceCache
+{
+	float4* cells;		// per slot: summed cosine-weighted incident radiance, and the sample count; 0 if disabled
+	uint* keys;			// per slot: checksum of the cell that owns it, 0 if free
+	uint mask;			// slot count - 1; the slot count is a power of two
+	float cellSize;		// world-space size of the cells of the first level
+	float updateRate;	// fraction of the path vertices that feed the cache
+};
+
+// hash grid of directional histograms for guided bounces, see kernels/pathguiding.h and RenderCore::UpdatePathGuide
+struct PathGuide
+{
+	float* bins;		// per slot: GUIDEBINS histogram weights used for sampling; 0 if disabled
+	float* training;	// per slot: GUIDEBINS weights gathered this frame, merged into bins by mergePathGuide
+	float2* stats;		// per slot: sum of the bins and sample count
+	float2* trainStats;	// per slot: sum of the training weights and sample count
+	uint* keys;			// per slot: checksum of the cell that owns it, 0 if free
+	uint mask;			// slot count - 1; the slot count is a power of two
+	float cellSize;		// world-space size of the cells of the first level
+	float fraction;		// share of the bounces that sample the histogram instead of the bsdf
+};
+
+// reservoir resampling of the light connections at the primary vertex, see kernels/restir.h
+struct ReSTIRControl
+{
+	float4* reservoirs;		// this frame, three streams: light sample, (wsum, M, W), surface; 0 if disabled
+	const float4* history;	// the reservoirs of the previous frame, or 0 if there is no usable history
+	float3 prevPos, prevP1;	// view of the previous frame: eye and top-left corner of the screen plane
+	float3 prevRight, prevUp;	// view of the previous frame: screen plane edges
+	int candidates;			// light samples drawn per reservoir
+	int reuseTaps;			// previous frame reservoirs merged per pixel: the reprojected one and neighbours
+	float maxHistory;		// cap on the sample count of a reused reservoir, in candidates
+};
+
+// motion vectors of the primary hits, written by the shade kernel; see RenderCore::UpdateHitMotion
+struct MotionControl
+{
+	float2* motion;			// per pixel: offset to the position in the previous frame, in pixels; 0 if disabled
+	float* prevDepth;		// per pixel: distance of the hit to the previous eye; 0 if not needed
+	float3 prevPos, prevP1;	// view of the previous frame: eye and top-left corner of the screen plane
+	float3 prevRight, prevUp;	// view of the previous frame: screen plane edges
+};
+
+// picking: pixels whose primary hits are recorded each frame, see RenderCore::UpdateProbes
+struct ProbeControl
+{
+	int pixels[MAXPROBES];	// pixel index in the (possibly scaled) frame, or -1 if off screen
+	int count;				// number of probes; 0 if there are none
+	float4* results;		// per probe: instance, primitive, distance; the readback slot of this frame
+};
+
 // counters and other global data, in device memory
 struct Counters
 {
@@ -130,6 +250,75 @@ struct Counters
 	int probedInstid;
 	int probedTriid;
 	float probedDist;
+	// ray statistics per path segment, reset by InitCountersForExtend
+	uint segmentRays[MAXPATHLENGTH];
+	uint segmentShadowRays[MAXPATHLENGTH];
+	uint segmentMissed[MAXPATHLENGTH];
+	uint segmentEmitter[MAXPATHLENGTH];
+	uint segmentRoulette[MAXPATHLENGTH];
+	uint segmentAlpha[MAXPATHLENGTH];
+	uint laneSlots, activeLanes;	// warps sampled at the surface shading stage, times 32, and their active lanes
+};
+
+// scene data for the megakernel; the shade kernel receives the same pointers through its constant memory.
+// Forward declared: in the cuda code, common_classes.h is included after this file.
+namespace lighthouse2 {
+struct CoreInstanceDesc; struct CoreMaterial; struct CoreLightTri;
+struct CorePointLight; struct CoreSpotLight; struct CoreDirectionalLight; struct CoreTri4;
+}
+struct MegakernelScene
+{
+	lighthouse2::CoreInstanceDesc* instanceDescriptors;
+	lighthouse2::CoreMaterial* materials;
+	lighthouse2::CoreLightTri* areaLights;
+	lighthouse2::CorePointLight* pointLights;
+	lighthouse2::CoreSpotLight* spotLights;
+	lighthouse2::CoreDirectionalLight* directionalLights;
+	int4 lightCounts;					// area, point, spot, directional
+	uint* argb32;
+	float4* argb128;
+	uint* nrm32;
+#ifdef VIRTUALTEXTURES
+	uint2* argb32Pages, *nrm32Pages;	// page tables of the texel pools, see TexelPager
+	uint* argb32Usage, *nrm32Usage;
+#endif
+	uint2* skyPixels;					// half precision pyramid, see SampleSkydome
+	int2 skySize;
+	int skyLevels;
+	float clampValue;
+};
+
+// instances generated on the device for a scattered instance group, see kernels/scatter.h and RenderCore::ScatterInstances.
+// ScatterRecord has the layout of OptixInstance, which the cuda code cannot include.
+struct ScatterRecord
+{
+	float transform[12];
+	uint instanceId, sbtOffset, visibilityMask, flags;
+	unsigned long long traversableHandle;
+	uint pad[2];
+};
+struct ScatterPrototype
+{
+	unsigned long long handle;			// BVH of the prototype mesh
+	lighthouse2::CoreTri4* triangles;	// its shading data, see CoreMesh::ShadingData
+	int packed, dummy;
+};
+struct ScatterJob
+{
+	const float4* vertices;				// surface triangles, three vertices each, in object space
+	const float2* uvs;					// per vertex, or 0
+	const float* cdf;					// per triangle: summed area of the triangles up to and including it, normalized
+	int triangleCount;
+	const float* mask;					// density over the uv square, or 0
+	int2 maskSize;
+	const ScatterPrototype* prototypes;
+	int prototypeCount;
+	int count;							// instances in the group, including the ones the mask rejected
+	float2 scale;						// range of the uniform scale
+	int align;							// up axis of the prototypes along the triangle normal
+	uint seed;
+	ScatterRecord* records;				// build input of the group BVH
+	lighthouse2::CoreInstanceDesc* members;	// per instance: prototype triangles, transform and its inverse; dummy2 is the prototype
 };
 
 // path tracer parameters
@@ -139,7 +328,11 @@ struct Params
 	float3 right, up, p1;
 	float geometryEpsilon;
 	int3 scrsize;
-	int pass, phase;
+	int pass, phase;					// phase 0: primary rays, 1: extension rays, 2: shadow rays, 3: megakernel
+	uint rayMask;						// visibilityMask for optixTrace in this launch: VISIBLE_PRIMARY, _SECONDARY or _SHADOW
+#ifdef MOTIONBLUR
+	float shutter;						// fraction of the frame interval the shutter is open, ending at the current frame
+#endif
 	Counters counters;
 	float4* accumulator;
 	float4* connectData;
@@ -147,6 +340,15 @@ struct Params
 	float4* pathStates;
 	uint* blueNoise;
 	OptixTraversableHandle bvhRoot;
+	// megakernel: all segments of a path are traced and shaded in the raygen program;
+	// shadow rays: the connections are read at path.connectStride offsets
+	PathControl path;
+	uint R0;							// per frame random seed, as passed to shade
+	int probePixelIdx;
+	float spreadAngle;
+	MegakernelScene scene;
+	uint2* traversalCost;				// traversal heatmap: per pixel, clock64 cycles from optixTrace to closest hit or miss,
+										// and any-hit invocations; summed over the paths of the pixel. 0 if disabled
 };
 
 // ------------------------------------------------------------------------------
@@ -166,6 +368,7 @@ struct Params
 #define _USE_MATH_DEFINES
 #include "core_api_base.h"
 #include "core_api.h"
+#include "shared_host_code/videoencoder.h"	// after core_api_base.h, for VideoTargetDesc
 #include "rendercore.h"
 
 // blue noise data, from https://eheitzresearch.wordpress.com/762-2
@@ -0,0 +1,357 @@
+/* core_texture.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::TexelPager                                                     |
+//  |  Constructor. Write the texels and call Commit before rendering. With a     |
+//  |  page file name, the virtual pool is stored in that file, and the host      |
+//  |  caches hostCachePages pages of it.                                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+TexelPager::TexelPager( const int texels, const int budgetPages, const char* pageFileName, const int hostCachePages )
+{
+	texelCount = texels;
+	pageCount = (texelCount + TEXPAGESIZE - 1) >> TEXPAGESHIFT;
+	slotCount = max( 1, min( pageCount, budgetPages ) );
+	if (pageFileName) fopen_s( &pageFile, pageFileName, "w+b" );
+	if (pageFile)
+	{
+		this->pageFileName = pageFileName;
+		hostPages = max( 1, min( pageCount, hostCachePages ) );
+		hostCache.resize( (size_t)hostPages * TEXPAGESIZE );
+		cachePage.resize( hostPages, -1 );
+		cacheUse.resize( hostPages, 0 );
+		pageCacheSlot.resize( pageCount, -1 );
+		pageRequested.resize( pageCount, 0 );
+	}
+	else
+	{
+		hostTexels = (uint*)MALLOC64( (size_t)pageCount * TEXPAGESIZE * sizeof( uint ) );
+		memset( hostTexels + texelCount, 0, ((size_t)pageCount * TEXPAGESIZE - texelCount) * sizeof( uint ) );
+	}
+	pool = new CoreBuffer<uint>( (size_t)slotCount * TEXPAGESIZE, ON_DEVICE, 0, VRAMTextures );
+	pageTable = new CoreBuffer<uint2>( pageCount, ON_HOST | ON_DEVICE, 0, VRAMTextures );
+	usage = new CoreBuffer<uint>( (pageCount + 31) >> 5, ON_HOST | ON_DEVICE, 0, VRAMTextures );
+	usage->Clear( ON_HOST | ON_DEVICE );
+	slotPage.resize( slotCount, -1 );
+	lastUse.resize( slotCount, 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::~TexelPager                                                    |
+//  |  Destructor.                                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+TexelPager::~TexelPager()
+{
+	reads.Wait(); // the jobs use the page file and this object
+	if (pageFile) fclose( pageFile ), remove( pageFileName.c_str() );
+	FREE64( hostTexels );
+	delete pool;
+	delete pageTable;
+	delete usage;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::PageAverage                                                    |
+//  |  Average of the texels in a page, per 8-bit channel.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+uint TexelPager::PageAverage( const uint* texel, const int page ) const
+{
+	const int count = min( TEXPAGESIZE, texelCount - page * TEXPAGESIZE );
+	uint sum[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < count; i++) for (int c = 0; c < 4; c++) sum[c] += (texel[i] >> (c * 8)) & 255;
+	uint average = 0;
+	for (int c = 0; c < 4; c++) average += (sum[c] / count) << (c * 8);
+	return average;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::ReadPages                                                      |
+//  |  Read consecutive pages from the page file. The tail of the last page was   |
+//  |  never written, and reads as zero.                                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TexelPager::ReadPages( const int first, const int count, uint* texels )
+{
+	const size_t size = (size_t)count * TEXPAGESIZE;
+	size_t read;
+	{
+		std::lock_guard<std::mutex> lock( fileLock );
+		_fseeki64( pageFile, (__int64)first * TEXPAGESIZE * sizeof( uint ), SEEK_SET );
+		read = fread( texels, sizeof( uint ), size, pageFile );
+	}
+	if (read < size) memset( texels + read, 0, (size - read) * sizeof( uint ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::Write                                                          |
+//  |  Store texels in the virtual pool. Call Invalidate after modifying texels   |
+//  |  of a committed pool. Cached copies of the pages are dropped.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TexelPager::Write( const int firstTexel, const uint* texels, const int count )
+{
+	if (count <= 0) return;
+	if (!pageFile) { memcpy( hostTexels + firstTexel, texels, count * sizeof( uint ) ); return; }
+	// a read in flight could deliver the old texels
+	reads.Wait();
+	AcceptPages();
+	{
+		std::lock_guard<std::mutex> lock( fileLock );
+		_fseeki64( pageFile, (__int64)firstTexel * sizeof( uint ), SEEK_SET );
+		fwrite( texels, sizeof( uint ), count, pageFile );
+	}
+	for (int page = firstTexel >> TEXPAGESHIFT; page <= (firstTexel + count - 1) >> TEXPAGESHIFT; page++)
+		if (pageCacheSlot[page] >= 0) cachePage[pageCacheSlot[page]] = -1, pageCacheSlot[page] = -1;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::Commit                                                         |
+//  |  Build the page table for the host texels. The first pages start out        |
+//  |  resident; when the physical pool fits the budget, this is all of them.     |
+//  |  A page file is read front to back, in chunks of TEXPAGECHUNK pages.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TexelPager::Commit()
+{
+	uint2* table = pageTable->HostPtr();
+	for (int i = 0; i < slotCount; i++) slotPage[i] = i < pageCount ? i : -1, lastUse[i] = 0;
+	if (pageFile)
+	{
+		fflush( pageFile );
+		vector<uint> chunk( (size_t)TEXPAGECHUNK * TEXPAGESIZE );
+		for (int first = 0; first < pageCount; first += TEXPAGECHUNK)
+		{
+			const int count = min( TEXPAGECHUNK, pageCount - first );
+			ReadPages( first, count, chunk.data() );
+			for (int i = 0; i < count; i++)
+				table[first + i] = make_uint2( first + i < slotCount ? first + i : NOTRESIDENT, PageAverage( chunk.data() + (size_t)i * TEXPAGESIZE, first + i ) );
+			if (first < slotCount) CHK_CUDA( cudaMemcpy( pool->DevPtr() + (size_t)first * TEXPAGESIZE, chunk.data(),
+				(size_t)min( count, slotCount - first ) * TEXPAGESIZE * sizeof( uint ), cudaMemcpyHostToDevice ) );
+		}
+	}
+	else
+	{
+		for (int i = 0; i < pageCount; i++) table[i] = make_uint2( i < slotCount ? i : NOTRESIDENT, PageAverage( hostTexels + (size_t)i * TEXPAGESIZE, i ) );
+		CHK_CUDA( cudaMemcpy( pool->DevPtr(), hostTexels, (size_t)min( slotCount, pageCount ) * TEXPAGESIZE * sizeof( uint ), cudaMemcpyHostToDevice ) );
+	}
+	pageTable->CopyToDevice();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::Invalidate                                                     |
+//  |  A range of host texels was modified: update averages and resident pages.   |
+//  |                                                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TexelPager::Invalidate( const int firstTexel, const int count )
+{
+	if (count <= 0) return;
+	uint2* table = pageTable->HostPtr();
+	vector<uint> page( pageFile ? TEXPAGESIZE : 0 );
+	for (int i = firstTexel >> TEXPAGESHIFT; i <= (firstTexel + count - 1) >> TEXPAGESHIFT; i++)
+	{
+		const uint* texels = hostTexels + (size_t)i * TEXPAGESIZE;
+		if (pageFile) ReadPages( i, 1, page.data() ), texels = page.data();
+		table[i].y = PageAverage( texels, i );
+		if (table[i].x != NOTRESIDENT) CHK_CUDA( cudaMemcpy( pool->DevPtr() + (size_t)table[i].x * TEXPAGESIZE,
+			texels, TEXPAGESIZE * sizeof( uint ), cudaMemcpyHostToDevice ) );
+	}
+	pageTable->CopyToDevice();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::HostPage / CachePage                                           |
+//  |  Host texels of a page, or 0 if the page is only in the page file. Pages    |
+//  |  that arrive from the page file replace the least recently used cached      |
+//  |  page.                                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+const uint* TexelPager::HostPage( const int page )
+{
+	if (!pageFile) return hostTexels + (size_t)page * TEXPAGESIZE;
+	const int slot = pageCacheSlot[page];
+	if (slot < 0) return 0;
+	cacheUse[slot] = frame;
+	return hostCache.data() + (size_t)slot * TEXPAGESIZE;
+}
+void TexelPager::CachePage( const int page, const uint* texels )
+{
+	int slot = 0;
+	for (int i = 1; i < hostPages; i++) if (cacheUse[i] < cacheUse[slot]) slot = i;
+	if (cachePage[slot] >= 0) pageCacheSlot[cachePage[slot]] = -1;
+	cachePage[slot] = page, pageCacheSlot[page] = slot, cacheUse[slot] = frame;
+	memcpy( hostCache.data() + (size_t)slot * TEXPAGESIZE, texels, TEXPAGESIZE * sizeof( uint ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::RequestPage / AcceptPages                                      |
+//  |  Read a page from the page file in a job, without waiting for it. At most   |
+//  |  TEXPAGEREADS reads are in flight. AcceptPages moves the pages that were    |
+//  |  read into the host cache.                                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+void TexelPager::RequestPage( const int page )
+{
+	if (pageRequested[page] || readsInFlight >= TEXPAGEREADS) return;
+	pageRequested[page] = 1, readsInFlight++;
+	JobSystem::Submit( [this, page]() {
+		PageRead read = { page, vector<uint>( TEXPAGESIZE ) };
+		ReadPages( page, 1, read.texels.data() );
+		std::lock_guard<std::mutex> lock( arrivedLock );
+		arrived.push_back( std::move( read ) );
+	}, &reads );
+}
+void TexelPager::AcceptPages()
+{
+	vector<PageRead> pages;
+	{
+		std::lock_guard<std::mutex> lock( arrivedLock );
+		pages.swap( arrived );
+	}
+	for (const PageRead& read : pages)
+	{
+		CachePage( read.page, read.texels.data() );
+		pageRequested[read.page] = 0, readsInFlight--, pagesRead++;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager::Update                                                         |
+//  |  Process the page usage of the last frame: stream in up to maxUploads       |
+//  |  missing pages, replacing the least recently used pages. Pages used in the  |
+//  |  last frame are never evicted. Missing pages that are not on the host are   |
+//  |  requested from the page file. Returns the number of uploaded pages.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+int TexelPager::Update( const int maxUploads )
+{
+	frame++;
+	pagesRead = 0;
+	if (pageFile) AcceptPages();
+	const uint* used = usage->CopyToHost();
+	uint2* table = pageTable->HostPtr();
+	vector<int> missing;
+	for (int i = 0; i < pageCount; i++) if (used[i >> 5] & (1u << (i & 31)))
+	{
+		if (table[i].x != NOTRESIDENT) lastUse[table[i].x] = frame;
+		else if (HostPage( i )) missing.push_back( i );
+		else RequestPage( i );
+	}
+	usage->Clear( ON_DEVICE );
+	if (missing.size() == 0 || maxUploads <= 0) return 0;
+	// find the least recently used slots
+	const int candidates = min( (int)missing.size(), maxUploads );
+	vector<int> slots( slotCount );
+	for (int i = 0; i < slotCount; i++) slots[i] = i;
+	partial_sort( slots.begin(), slots.begin() + min( candidates, slotCount ), slots.end(), [&]( const int a, const int b ) { return lastUse[a] < lastUse[b]; } );
+	// replace their pages
+	int uploads = 0;
+	for (; uploads < min( candidates, slotCount ) && lastUse[slots[uploads]] < frame; uploads++)
+	{
+		const int slot = slots[uploads], page = missing[uploads];
+		if (slotPage[slot] >= 0) table[slotPage[slot]].x = NOTRESIDENT;
+		slotPage[slot] = page, table[page].x = slot, lastUse[slot] = frame;
+		CHK_CUDA( cudaMemcpy( pool->DevPtr() + (size_t)slot * TEXPAGESIZE, HostPage( page ),
+			TEXPAGESIZE * sizeof( uint ), cudaMemcpyHostToDevice ) );
+	}
+	if (uploads > 0) pageTable->CopyToDevice();
+	return uploads;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ReadBlock                                                                  |
+//  |  Fetch the 4x4 texels of a block; texels outside the level are clamped.     |
+//  |                                                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+static void ReadBlock( const uint* level, const int w, const int h, const int bx, const int by, uint* block )
+{
+	for (int y = 0; y < 4; y++) for (int x = 0; x < 4; x++)
+		block[x + y * 4] = level[min( bx * 4 + x, w - 1 ) + min( by * 4 + y, h - 1 ) * w];
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  EncodeBC1Block                                                             |
+//  |  Encode the first three channels of a block: the endpoints are the corners  |
+//  |  of the inset bounding box, which always yields four-color mode.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+static uint2 EncodeBC1Block( const uint* block )
+{
+	int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+	for (int t = 0; t < 16; t++) for (int c = 0; c < 3; c++)
+	{
+		const int v = (block[t] >> (c * 8)) & 255;
+		lo[c] = min( lo[c], v ), hi[c] = max( hi[c], v );
+	}
+	for (int c = 0; c < 3; c++) { const int inset = (hi[c] - lo[c]) >> 4; lo[c] += inset, hi[c] -= inset; }
+	const uint c0 = ((hi[0] >> 3) << 11) + ((hi[1] >> 2) << 5) + (hi[2] >> 3);
+	const uint c1 = ((lo[0] >> 3) << 11) + ((lo[1] >> 2) << 5) + (lo[2] >> 3);
+	if (c0 == c1) return make_uint2( c0 + (c1 << 16), 0 );
+	// hi >= lo per channel, so c0 > c1; the palette matches the decoder in FetchBC1Texel
+	float3 palette[4];
+	palette[0] = make_float3( (c0 >> 11) * (255.0f / 31), ((c0 >> 5) & 63) * (255.0f / 63), (c0 & 31) * (255.0f / 31) );
+	palette[1] = make_float3( (c1 >> 11) * (255.0f / 31), ((c1 >> 5) & 63) * (255.0f / 63), (c1 & 31) * (255.0f / 31) );
+	palette[2] = (2 * palette[0] + palette[1]) * (1.0f / 3), palette[3] = (palette[0] + 2 * palette[1]) * (1.0f / 3);
+	uint indices = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		const float3 v = make_float3( (float)(block[t] & 255), (float)((block[t] >> 8) & 255), (float)((block[t] >> 16) & 255) );
+		int best = 0;
+		for (int i = 1; i < 4; i++) if (dot( v - palette[i], v - palette[i] ) < dot( v - palette[best], v - palette[best] )) best = i;
+		indices += best << (t * 2);
+	}
+	return make_uint2( c0 + (c1 << 16), indices );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  EncodeBC4Block                                                             |
+//  |  Encode one channel of a block, using the eight-value mode.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+static uint2 EncodeBC4Block( const uint* block, const int c )
+{
+	int lo = 255, hi = 0;
+	for (int t = 0; t < 16; t++) lo = min( lo, (int)(block[t] >> (c * 8)) & 255 ), hi = max( hi, (int)(block[t] >> (c * 8)) & 255 );
+	if (hi == lo) return make_uint2( hi + (lo << 8), 0 );
+	// palette position p (0 = hi, 7 = lo) maps to index 0 for hi, 1 for lo and p + 1 in between
+	unsigned long long bits = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		const int v = (block[t] >> (c * 8)) & 255, p = (int)((hi - v) * 7.0f / (hi - lo) + 0.5f);
+		bits += (unsigned long long)(p == 0 ? 0 : p == 7 ? 1 : p + 1) << (t * 3);
+	}
+	return make_uint2( hi + (lo << 8) + ((uint)(bits & 0xffff) << 16), (uint)(bits >> 16) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  EncodeBC1 / EncodeBC5                                                      |
+//  |  Encode all MIP levels of a texture. BC1 stores the color of an opaque      |
+//  |  texture; BC5 stores the x and y channels of a normal map.            LH2'19|
+//  +-----------------------------------------------------------------------------+
+void EncodeBC1( const uint* texels, const int width, const int height, const int MIPlevels, vector<uint2>& blocks )
+{
+	blocks.clear();
+	uint block[16];
+	for (int l = 0, w = width, h = height; l < MIPlevels; texels += w * h, l++, w >>= 1, h >>= 1)
+		for (int by = 0; by < (h + 3) >> 2; by++) for (int bx = 0; bx < (w + 3) >> 2; bx++)
+			ReadBlock( texels, w, h, bx, by, block ), blocks.push_back( EncodeBC1Block( block ) );
+}
+void EncodeBC5( const uint* texels, const int width, const int height, const int MIPlevels, vector<uint4>& blocks )
+{
+	blocks.clear();
+	uint block[16];
+	for (int l = 0, w = width, h = height; l < MIPlevels; texels += w * h, l++, w >>= 1, h >>= 1)
+		for (int by = 0; by < (h + 3) >> 2; by++) for (int bx = 0; bx < (w + 3) >> 2; bx++)
+	{
+		ReadBlock( texels, w, h, bx, by, block );
+		const uint2 x = EncodeBC4Block( block, 0 ), y = EncodeBC4Block( block, 1 );
+		blocks.push_back( make_uint4( x.x, x.y, y.x, y.y ) );
+	}
+}
+
+// EOF
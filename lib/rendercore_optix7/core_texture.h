@@ -0,0 +1,84 @@
+/* core_texture.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+namespace lh2core {
+
+//  +-----------------------------------------------------------------------------+
+//  |  TexelPager                                                                 |
+//  |  Virtual texel pool. The full pool is kept on the host; the device stores   |
+//  |  a limited number of pages of TEXPAGESIZE texels. Shading code resolves     |
+//  |  texel addresses through the page table, and marks each page it touches in  |
+//  |  the usage bitmask. Update reads this bitmask after a frame, streams in the |
+//  |  missing pages that were used, and evicts the least recently used pages.    |
+//  |  A missing page reads as the average of its texels.                         |
+//  |  With a page file, the full pool is kept on disk instead, and the host only |
+//  |  caches hostPages pages; used pages that are not cached are read by jobs,   |
+//  |  and uploaded by a later Update.                                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+class TexelPager
+{
+public:
+	// constructor / destructor
+	TexelPager( const int texels, const int budgetPages, const char* pageFileName = 0, const int hostCachePages = 0 );
+	~TexelPager();
+	// methods
+	void Write( const int firstTexel, const uint* texels, const int count );
+	void Commit();
+	void Invalidate( const int firstTexel, const int count );
+	int Update( const int maxUploads );
+	// data
+	int texelCount = 0;						// size of the virtual pool, in texels
+	int pageCount = 0;						// size of the virtual pool, in pages
+	int slotCount = 0;						// number of pages that fit in the physical pool
+	uint* hostTexels = 0;					// full virtual pool, padded to a whole number of pages; 0 with a page file
+	CoreBuffer<uint>* pool = 0;				// physical pool on the device
+	CoreBuffer<uint2>* pageTable = 0;		// per virtual page: slot in the physical pool or NOTRESIDENT, average texel
+	CoreBuffer<uint>* usage = 0;			// one bit per virtual page, set by the device when the page is read
+	vector<int> slotPage;					// per slot: the virtual page it holds, or -1
+	vector<uint> lastUse;					// per slot: last frame in which its page was used
+	uint frame = 0;							// number of Update calls
+	int pagesRead = 0;						// page file: pages read from disk by the last Update
+private:
+	uint PageAverage( const uint* texel, const int page ) const;
+	void ReadPages( const int first, const int count, uint* texels );
+	const uint* HostPage( const int page );
+	void RequestPage( const int page );
+	void AcceptPages();
+	void CachePage( const int page, const uint* texels );
+	// page file: the host residency tier
+	struct PageRead { int page; vector<uint> texels; };
+	FILE* pageFile = 0;
+	string pageFileName;
+	int hostPages = 0;						// capacity of the host page cache
+	vector<uint> hostCache;					// hostPages pages of TEXPAGESIZE texels
+	vector<int> cachePage;					// per cache slot: the virtual page it holds, or -1
+	vector<uint> cacheUse;					// per cache slot: last frame in which its page was used
+	vector<int> pageCacheSlot;				// per virtual page: its cache slot, or -1
+	vector<char> pageRequested;				// per virtual page: a read job is in flight
+	int readsInFlight = 0;
+	vector<PageRead> arrived;				// pages read by the jobs since the last Update
+	std::mutex fileLock, arrivedLock;
+	WaitGroup reads;						// the read jobs in flight
+};
+
+// block compression of MIP-mapped 32-bit texel data; blocks are stored per MIP level, in scanline order.
+void EncodeBC1( const uint* texels, const int width, const int height, const int MIPlevels, vector<uint2>& blocks );
+void EncodeBC5( const uint* texels, const int width, const int height, const int MIPlevels, vector<uint4>& blocks );
+
+} // namespace lh2core
+
+// EOF
@@ -20,19 +20,50 @@ namespace lh2core {
 // path tracing buffers and global variables
 __constant__ CoreInstanceDesc* instanceDescriptors;
 __constant__ CoreMaterial* materials;
+__constant__ uint* materialClasses;	// SHADE_FULL or SHADE_BASIC per material, or 0; see RenderCore::UpdateShadeClasses
+#ifdef SHADECOST
+__constant__ CoreMaterialCost* materialCosts;	// instrumentation build: shading cost per material, see RenderCore::GetMaterialCosts
+#endif
 __constant__ CoreLightTri* areaLights;
 __constant__ CorePointLight* pointLights;
 __constant__ CoreSpotLight* spotLights;
 __constant__ CoreDirectionalLight* directionalLights;
+__constant__ CoreLightTreeNode* lightTree;
+__constant__ CoreLightAlias* lightAlias;
 __constant__ int4 lightCounts; // area, point, spot, directional
 __constant__ uint* argb32;
 __constant__ float4* argb128;
 __constant__ uint* nrm32;
-__constant__ float3* skyPixels;
+#ifdef VIRTUALTEXTURES
+__constant__ uint2* argb32Pages;	// page tables and usage bits for the virtual texel pools
+__constant__ uint* argb32Usage;
+__constant__ uint2* nrm32Pages;
+__constant__ uint* nrm32Usage;
+#endif
+#ifdef BCTEXTURES
+__constant__ uint2* bc1;			// block compressed texel pools
+__constant__ uint4* bc5;
+#endif
+#ifdef HWTEXTURES
+__constant__ cudaTextureObject_t* texObjects;	// per texture ID, for textures with HWTEXTURE in their offset
+#endif
+__constant__ uint2* skyPixels;			// half precision rgb pyramid, see SampleSkydome
 __constant__ int skywidth;
+__constant__ float* skyCDF;			// sky importance sampling: marginal and conditional cdfs, or 0
+__constant__ int2 skyCDFSize;
 __constant__ int skyheight;
+__constant__ int skyLevels;
 __constant__ PathState* pathStates;
 __constant__ float4* debugData;
+__constant__ float4* denoiseGuides;	// albedo and normal of the primary hits, or 0; see RenderCore::Denoise
+__constant__ RadianceCache radianceCache;	// world-space radiance cache, cells is 0 if disabled; see RenderCore::UpdateRadianceCache
+__constant__ ReSTIRControl restir;	// light resampling at the primary vertex, reservoirs is 0 if disabled; see RenderCore::UpdateReservoirs
+__constant__ ProbeControl probes;	// probe pixels for picking, see RenderCore::UpdateProbes
+__constant__ MotionControl hitMotion;	// motion vectors of the primary hits, motion is 0 if disabled; see RenderCore::UpdateHitMotion
+__constant__ PathGuide pathGuide;	// guiding grid for the bounces, bins is 0 if disabled; see RenderCore::UpdatePathGuide
+#ifdef GGXCOMPENSATION
+__constant__ cudaTextureObject_t ggxAlbedo;	// directional albedo of the specular lobe, see RenderCore::CreateGGXAlbedo
+#endif
 
 // path tracer settings
 __constant__ __device__ float geometryEpsilon;
@@ -41,10 +72,16 @@ __constant__ __device__ float clampValue;
 // access
 __host__ void SetInstanceDescriptors( CoreInstanceDesc* p ) { cudaMemcpyToSymbol( instanceDescriptors, &p, sizeof( void* ) ); }
 __host__ void SetMaterialList( CoreMaterial* p ) { cudaMemcpyToSymbol( materials, &p, sizeof( void* ) ); }
+__host__ void SetMaterialClasses( uint* p ) { cudaMemcpyToSymbol( materialClasses, &p, sizeof( void* ) ); }
+#ifdef SHADECOST
+__host__ void SetMaterialCosts( CoreMaterialCost* p ) { cudaMemcpyToSymbol( materialCosts, &p, sizeof( void* ) ); }
+#endif
 __host__ void SetAreaLights( CoreLightTri* p ) { cudaMemcpyToSymbol( areaLights, &p, sizeof( void* ) ); }
 __host__ void SetPointLights( CorePointLight* p ) { cudaMemcpyToSymbol( pointLights, &p, sizeof( void* ) ); }
 __host__ void SetSpotLights( CoreSpotLight* p ) { cudaMemcpyToSymbol( spotLights, &p, sizeof( void* ) ); }
 __host__ void SetDirectionalLights( CoreDirectionalLight* p ) { cudaMemcpyToSymbol( directionalLights, &p, sizeof( void* ) ); }
+__host__ void SetLightTreeNodes( CoreLightTreeNode* p ) { cudaMemcpyToSymbol( lightTree, &p, sizeof( void* ) ); }
+__host__ void SetLightAliasEntries( CoreLightAlias* p ) { cudaMemcpyToSymbol( lightAlias, &p, sizeof( void* ) ); }
 __host__ void SetLightCounts( int area, int point, int spot, int directional )
 {
 	const int4 counts = make_int4( area, point, spot, directional );
@@ -53,10 +90,35 @@ __host__ void SetLightCounts( int area, int point, int spot, int directional )
 __host__ void SetARGB32Pixels( uint* p ) { cudaMemcpyToSymbol( argb32, &p, sizeof( void* ) ); }
 __host__ void SetARGB128Pixels( float4* p ) { cudaMemcpyToSymbol( argb128, &p, sizeof( void* ) ); }
 __host__ void SetNRM32Pixels( uint* p ) { cudaMemcpyToSymbol( nrm32, &p, sizeof( void* ) ); }
-__host__ void SetSkyPixels( float3* p ) { cudaMemcpyToSymbol( skyPixels, &p, sizeof( void* ) ); }
-__host__ void SetSkySize( int w, int h ) { cudaMemcpyToSymbol( skywidth, &w, sizeof( int ) ); cudaMemcpyToSymbol( skyheight, &h, sizeof( int ) ); }
+#ifdef VIRTUALTEXTURES
+__host__ void SetARGB32Pages( uint2* p, uint* u ) { cudaMemcpyToSymbol( argb32Pages, &p, sizeof( void* ) ); cudaMemcpyToSymbol( argb32Usage, &u, sizeof( void* ) ); }
+__host__ void SetNRM32Pages( uint2* p, uint* u ) { cudaMemcpyToSymbol( nrm32Pages, &p, sizeof( void* ) ); cudaMemcpyToSymbol( nrm32Usage, &u, sizeof( void* ) ); }
+#endif
+#ifdef BCTEXTURES
+__host__ void SetBCPixels( uint2* p1, uint4* p5 ) { cudaMemcpyToSymbol( bc1, &p1, sizeof( void* ) ); cudaMemcpyToSymbol( bc5, &p5, sizeof( void* ) ); }
+#endif
+#ifdef HWTEXTURES
+__host__ void SetTextureObjects( cudaTextureObject_t* p ) { cudaMemcpyToSymbol( texObjects, &p, sizeof( void* ) ); }
+#endif
+__host__ void SetSkyPixels( uint2* p ) { cudaMemcpyToSymbol( skyPixels, &p, sizeof( void* ) ); }
+__host__ void SetSkySize( int w, int h, int levels )
+{
+	cudaMemcpyToSymbol( skywidth, &w, sizeof( int ) );
+	cudaMemcpyToSymbol( skyheight, &h, sizeof( int ) );
+	cudaMemcpyToSymbol( skyLevels, &levels, sizeof( int ) );
+}
+__host__ void SetSkyCDF( float* p, int w, int h ) { const int2 s = make_int2( w, h ); cudaMemcpyToSymbol( skyCDF, &p, sizeof( void* ) ); cudaMemcpyToSymbol( skyCDFSize, &s, sizeof( int2 ) ); }
 __host__ void SetPathStates( PathState* p ) { cudaMemcpyToSymbol( pathStates, &p, sizeof( void* ) ); }
 __host__ void SetDebugData( float4* p ) { cudaMemcpyToSymbol( debugData, &p, sizeof( void* ) ); }
+__host__ void SetDenoiseGuides( float4* p ) { cudaMemcpyToSymbol( denoiseGuides, &p, sizeof( void* ) ); }
+__host__ void SetRadianceCache( const RadianceCache& c ) { cudaMemcpyToSymbol( radianceCache, &c, sizeof( RadianceCache ) ); }
+__host__ void SetReSTIR( const ReSTIRControl& c, const cudaStream_t stream ) { cudaMemcpyToSymbolAsync( restir, &c, sizeof( ReSTIRControl ), 0, cudaMemcpyHostToDevice, stream ); }
+__host__ void SetHitMotion( const MotionControl& c, const cudaStream_t stream ) { cudaMemcpyToSymbolAsync( hitMotion, &c, sizeof( MotionControl ), 0, cudaMemcpyHostToDevice, stream ); }
+__host__ void SetPathGuide( const PathGuide& g ) { cudaMemcpyToSymbol( pathGuide, &g, sizeof( PathGuide ) ); }
+#ifdef GGXCOMPENSATION
+__host__ void SetGGXAlbedo( const cudaTextureObject_t t ) { cudaMemcpyToSymbol( ggxAlbedo, &t, sizeof( cudaTextureObject_t ) ); }
+#endif
+__host__ void SetProbes( const ProbeControl& p, const cudaStream_t stream ) { cudaMemcpyToSymbolAsync( probes, &p, sizeof( ProbeControl ), 0, cudaMemcpyHostToDevice, stream ); }
 
 // access
 __host__ void SetGeometryEpsilon( float e ) { cudaMemcpyToSymbol( geometryEpsilon, &e, sizeof( float ) ); }
@@ -75,8 +137,12 @@ __global__ void InitCountersForExtend_Kernel( int pathCount )
 	counters->connected = 0;
 	counters->totalExtensionRays = pathCount;
 	counters->totalShadowRays = 0;
+	for (int i = 0; i < MAXPATHLENGTH; i++)
+		counters->segmentRays[i] = counters->segmentShadowRays[i] = counters->segmentMissed[i] =
+		counters->segmentEmitter[i] = counters->segmentRoulette[i] = counters->segmentAlpha[i] = 0;
+	counters->laneSlots = counters->activeLanes = 0;
 }
-__host__ void InitCountersForExtend( int pathCount ) { InitCountersForExtend_Kernel << <1, 32 >> > (pathCount); }
+__host__ void InitCountersForExtend( int pathCount, const cudaStream_t stream ) { InitCountersForExtend_Kernel << <1, 32, 0, stream >> > (pathCount); }
 __global__ void InitCountersSubsequent_Kernel()
 {
 	if (threadIdx.x != 0) return;
@@ -86,7 +152,13 @@ __global__ void InitCountersSubsequent_Kernel()
 	counters->shaded = 0;				// persistent thread atomic for shade kernel
 	counters->extensionRays = 0;		// compaction counter for extension rays
 }
-__host__ void InitCountersSubsequent() { InitCountersSubsequent_Kernel << <1, 32 >> > (); }
+__host__ void InitCountersSubsequent( const cudaStream_t stream ) { InitCountersSubsequent_Kernel << <1, 32, 0, stream >> > (); }
+__global__ void ResetShadowRays_Kernel()
+{
+	if (threadIdx.x != 0) return;
+	counters->shadowRays = 0;			// connections of the previous bounce have been traced
+}
+__host__ void ResetShadowRays( const cudaStream_t stream ) { ResetShadowRays_Kernel << <1, 32, 0, stream >> > (); }
 __host__ void SetCounters( Counters* p ) { cudaMemcpyToSymbol( counters, &p, sizeof( void* ) ); }
 
 // functional blocks
@@ -94,8 +166,15 @@ __host__ void SetCounters( Counters* p ) { cudaMemcpyToSymbol( counters, &p, siz
 #include "..\..\CUDA\shared_kernel_code\sampling_shared.h"
 #include "..\..\CUDA\shared_kernel_code\material_shared.h"
 #include "..\..\CUDA\shared_kernel_code\lights_shared.h"
+LH2_DEVFUNC uint MaterialShadeClass( const uint material ) { return materialClasses ? materialClasses[material] : SHADE_FULL; }
+#include "..\..\CUDA\shared_kernel_code\sorting_shared.h"
 #include "bsdf.h"
+#include "radiancecache.h"
+#include "restir.h"
+#include "pathguiding.h"
 #include "pathtracer.h"
+#include "animation.h"
+#include "scatter.h"
 #include "..\..\CUDA\shared_kernel_code\finalize_shared.h"
 
 } // namespace lh2core
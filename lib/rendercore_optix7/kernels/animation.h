@@ -0,0 +1,90 @@
+/* animation.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements device-side mesh animation: morph targets and
+   skinning are applied to the bind pose, which is uploaded once, and
+   the result is written to the intersection vertices and the shading
+   triangles of the mesh. Per frame, only the joint matrices and the
+   morph weights are sent to the device. The results match
+   HostMesh::SetPose.
+*/
+
+#include "noerrors.h"
+
+//  +-----------------------------------------------------------------------------+
+//  |  animateKernel                                                              |
+//  |  One thread per triangle; each thread animates three vertices.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void animateKernel( const float4* basePositions, const float3* baseNormals,
+	const float3* morphPositions, const float3* morphNormals, const float* morphWeights, const int morphCount,
+	const uint4* joints, const float4* weights, const float4* jointMat, const int jointCount,
+	float4* positions, CoreTri4* tris, const int triCount )
+{
+	const int triIdx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (triIdx >= triCount) return;
+	const int vertexCount = triCount * 3;
+	float3 P[3], N[3];
+	for (int i = 0; i < 3; i++)
+	{
+		const int v = triIdx * 3 + i;
+		float4 p = basePositions[v];
+		float3 n = baseNormals[v];
+		// apply morph targets
+		for (int j = 0; j < morphCount; j++)
+		{
+			const float w = morphWeights[j];
+			p += w * make_float4( morphPositions[j * vertexCount + v], 0 );
+			n += w * morphNormals[j * vertexCount + v];
+		}
+		// apply skin; jointMat holds four rows per matrix
+		if (jointCount > 0)
+		{
+			const uint4 j4 = joints[v];
+			const float4 w4 = weights[v];
+			float4 row[3];
+			for (int r = 0; r < 3; r++)
+				row[r] = w4.x * jointMat[j4.x * 4 + r] + w4.y * jointMat[j4.y * 4 + r] +
+				w4.z * jointMat[j4.z * 4 + r] + w4.w * jointMat[j4.w * 4 + r];
+			const float4 n4 = make_float4( n, 0 );
+			p = make_float4( dot( row[0], p ), dot( row[1], p ), dot( row[2], p ), 1 );
+			n = make_float3( dot( row[0], n4 ), dot( row[1], n4 ), dot( row[2], n4 ) );
+		}
+		positions[v] = p;
+		P[i] = make_float3( p );
+		N[i] = normalize( n );
+	}
+	// adjust full triangle; the geometric normal changes only when skinned, like on the host
+	CoreTri4& tri = tris[triIdx];
+	const float3 F = jointCount > 0 ? normalize( cross( P[1] - P[0], P[2] - P[0] ) ) : make_float3( tri.vN0.w, tri.vN1.w, tri.vN2.w );
+	tri.vN0 = make_float4( N[0], F.x );
+	tri.vN1 = make_float4( N[1], F.y );
+	tri.vN2 = make_float4( N[2], F.z );
+	for (int i = 0; i < 3; i++) tri.vertex[i] = make_float4( P[i], tri.vertex[i].w );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  animateMesh                                                                |
+//  |  Host-side access point for the animateKernel code.                   LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void animateMesh( const float4* basePositions, const float3* baseNormals,
+	const float3* morphPositions, const float3* morphNormals, const float* morphWeights, const int morphCount,
+	const uint4* joints, const float4* weights, const float4* jointMat, const int jointCount,
+	float4* positions, CoreTri4* tris, const int triCount, const cudaStream_t stream )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( triCount, 128 ) / 128, 1 ), blockDim( 128, 1 );
+	animateKernel<<<gridDim.x, 128, 0, stream>>>( basePositions, baseNormals, morphPositions, morphNormals, morphWeights,
+		morphCount, joints, weights, jointMat, jointCount, positions, tris, triCount );
+}
+
+// EOF
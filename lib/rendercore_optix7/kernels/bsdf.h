@@ -31,6 +31,11 @@
 // It returns the BSDF itself, and also the sampled direction and probability density for this direction.
 // ----------------------------------------------------------------
 
+// multiscatter energy compensation: linear filtering interpolates the table, see ggx_albedo.h
+#ifdef GGXCOMPENSATION
+#define GGXALBEDO( cosTheta, alpha ) tex2D<float>( ggxAlbedo, cosTheta, alpha )
+#endif
+
 // forward to Meir's API-agnostic sharedBRDFs folder.
 #include "sharedbsdf.h"
 
@@ -0,0 +1,144 @@
+/* pathguiding.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements online path guiding with a hash grid of
+   directional histograms. The grid uses the cells of the radiance
+   cache (see HashGridSlot); each cell holds GUIDEBINS equal-area bins
+   over the sphere of world space directions. Paths train the grid:
+   a path that arrives at a vertex adds the luminance of the radiance
+   it found there, over the pdf of its direction, to the bin of that
+   direction in the cell of the vertex it came from. Shading samples a
+   share of the bounces from the histogram and the rest from the bsdf,
+   and weights both with the pdf of the mixture, so the estimate stays
+   unbiased however poorly the histogram is trained. Training goes to
+   a separate buffer, which is merged once per frame; shading thus
+   sees histograms that do not change during the frame.
+*/
+
+#include "noerrors.h"
+
+//  +-----------------------------------------------------------------------------+
+//  |  GuideBin / GuideDirection                                                  |
+//  |  Equal-area mapping between world space directions and histogram bins:      |
+//  |  rows are uniform in z, columns are uniform in the azimuth. Each bin thus   |
+//  |  covers 4 * pi / GUIDEBINS steradians.                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC uint GuideBin( const float3 D )
+{
+	const float u = (D.z + 1) * 0.5f, v = atan2f( D.y, D.x ) * (0.5f * INVPI) + 0.5f;
+	const int row = clamp( (int)(u * GUIDERES), 0, GUIDERES - 1 ), column = clamp( (int)(v * GUIDERES), 0, GUIDERES - 1 );
+	return row * GUIDERES + column;
+}
+LH2_DEVFUNC float3 GuideDirection( const uint bin, const float r0, const float r1 )
+{
+	const float z = ((bin / GUIDERES) + r0) * (2.0f / GUIDERES) - 1;
+	const float phi = (((bin % GUIDERES) + r1) * (1.0f / GUIDERES) - 0.5f) * 2 * PI;
+	const float s = sqrtf( max( 0.0f, 1 - z * z ) );
+	return make_float3( s * cosf( phi ), s * sinf( phi ), z );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  GuideCell                                                                  |
+//  |  Slot of the guiding cell of a surface point, or RCNOSLOT if the cell has   |
+//  |  fewer than GUIDEMINSAMPLES training samples.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC uint GuideCell( const float3 P, const float3 N, const float3 camPos )
+{
+	const uint slot = HashGridSlot( pathGuide.keys, pathGuide.mask, pathGuide.cellSize, P, N, camPos, false );
+	if (slot == RCNOSLOT) return RCNOSLOT;
+	const float2 stats = pathGuide.stats[slot];
+	return (stats.y >= GUIDEMINSAMPLES && stats.x > 0) ? slot : RCNOSLOT;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  GuidePdf / SampleGuide                                                     |
+//  |  Solid angle pdf of direction D in the histogram of a cell, and sampling    |
+//  |  of that histogram: r0 selects the bin, r1 and r2 the spot in it.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float GuidePdf( const uint slot, const float3 D )
+{
+	return pathGuide.bins[slot * GUIDEBINS + GuideBin( D )] * (GUIDEBINS * 0.25f * INVPI) / pathGuide.stats[slot].x;
+}
+LH2_DEVFUNC float3 SampleGuide( const uint slot, const float r0, const float r1, const float r2, float& pdf )
+{
+	const float* bins = pathGuide.bins + slot * GUIDEBINS;
+	const float total = pathGuide.stats[slot].x, target = r0 * total;
+	float sum = 0;
+	uint bin = 0;
+	for (int i = 0; i < GUIDEBINS; i++)
+	{
+		if (bins[i] > 0) bin = i; // if rounding keeps sum below target, the last non-empty bin is taken
+		sum += bins[i];
+		if (sum > target) break;
+	}
+	pdf = bins[bin] * (GUIDEBINS * 0.25f * INVPI) / total;
+	return GuideDirection( bin, r1, r2 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PathGuideLearn                                                             |
+//  |  Trains the cell of the previous path vertex, O4, with luminance lum of the |
+//  |  radiance that arrived there along the direction in D4. D4.w holds the      |
+//  |  normal at that vertex, bsdfPdf the pdf with which the direction was        |
+//  |  sampled.                                                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC void PathGuideLearn( const float4 O4, const float4 D4, const float bsdfPdf, const float lum, const float3 camPos )
+{
+	if (!(bsdfPdf > 0) || !isfinite( lum )) return;
+	const float3 lastN = UnpackNormal( __float_as_uint( D4.w ) );
+	const uint slot = HashGridSlot( pathGuide.keys, pathGuide.mask, pathGuide.cellSize, make_float3( O4 ), lastN, camPos, true );
+	if (slot == RCNOSLOT) return;
+	const float weight = min( lum, clampValue ) / bsdfPdf;
+	if (weight > 0) atomicAdd( pathGuide.training + slot * GUIDEBINS + GuideBin( make_float3( D4 ) ), weight );
+	atomicAdd( &pathGuide.trainStats[slot].x, weight );
+	atomicAdd( &pathGuide.trainStats[slot].y, 1.0f );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  mergePathGuideKernel                                                       |
+//  |  Adds the training weights of the last frame to the histograms and clears   |
+//  |  them. Cells with more than GUIDEMAXSAMPLES samples are scaled back to that |
+//  |  count, so the histograms follow changes in the scene.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void mergePathGuideKernel( const uint slots )
+{
+	const uint slot = threadIdx.x + blockIdx.x * blockDim.x;
+	if (slot >= slots) return;
+	const float2 trained = pathGuide.trainStats[slot];
+	if (trained.y == 0) return;
+	const float2 stats = pathGuide.stats[slot];
+	const float scale = min( 1.0f, GUIDEMAXSAMPLES / (stats.y + trained.y) );
+	float* bins = pathGuide.bins + slot * GUIDEBINS;
+	float* training = pathGuide.training + slot * GUIDEBINS;
+	float total = 0;
+	for (int i = 0; i < GUIDEBINS; i++)
+	{
+		const float weight = (bins[i] + training[i]) * scale;
+		bins[i] = weight, training[i] = 0, total += weight;
+	}
+	pathGuide.stats[slot] = make_float2( total, (stats.y + trained.y) * scale );
+	pathGuide.trainStats[slot] = make_float2( 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  mergePathGuide                                                             |
+//  |  Host-side access point for the mergePathGuideKernel code.            LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void mergePathGuide( const uint slots, const cudaStream_t stream )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( slots, 256 ) / 256, 1 ), blockDim( 256, 1 );
+	mergePathGuideKernel<<<gridDim.x, 256, 0, stream>>>( slots );
+}
+
+// EOF
@@ -29,6 +29,7 @@
 #define S_SPECULAR		1	// previous path vertex was specular
 #define S_BOUNCED		2	// path encountered a diffuse vertex
 #define S_VIASPECULAR	4	// path has seen at least one specular vertex
+#define S_RESAMPLED		8	// previous path vertex connected to a light through its reservoir, see ResampleLights
 
 // readability defines; data layout is optimized for 128-bit accesses
 #define PRIMIDX __float_as_int( hitData.z )
@@ -41,28 +42,99 @@
 #define PATHIDX (data >> 8)
 
 //  +-----------------------------------------------------------------------------+
-//  |  shadeKernel                                                                |
-//  |  Implements the shade phase of the wavefront path tracer.             LH2'19|
+//  |  LoadThroughput / StoreThroughput                                           |
+//  |  Access to the third path state stream: throughput rgb and the postponed    |
+//  |  bsdf pdf. With PathControl::packedStates, the stream holds a uint2 per     |
+//  |  path instead of a float4: rgb as halves, and the pdf as the upper 16 bits  |
+//  |  of its float, which keeps the full exponent range.                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-#if __CUDA_ARCH__ > 700 // Volta deliberately excluded
-__global__  __launch_bounds__( 128 /* max block size */, 4 /* min blocks per sm TURING */ )
-#else
-__global__  __launch_bounds__( 128 /* max block size */, 8 /* min blocks per sm, PASCAL, VOLTA */ )
-#endif
-void shadeKernel( float4* accumulator, const uint stride,
-	float4* pathStates, const float4* hits, float4* connections,
+LH2_DEVFUNC float4 LoadThroughput( const float4* pathStates, const uint stride, const uint idx, const int packed )
+{
+	if (!packed) return pathStates[idx + stride * 2];
+	const uint2 p = ((const uint2*)(pathStates + stride * 2))[idx];
+	const float2 rg = __half22float2( __halves2half2( __ushort_as_half( p.x & 0xffff ), __ushort_as_half( p.x >> 16 ) ) );
+	return make_float4( rg.x, rg.y, __half2float( __ushort_as_half( p.y & 0xffff ) ), __uint_as_float( p.y & 0xffff0000 ) );
+}
+LH2_DEVFUNC void StoreThroughput( float4* pathStates, const uint stride, const uint idx, const float4 T4, const int packed )
+{
+	if (!packed) { pathStates[idx + stride * 2] = T4; return; }
+	const float3 t = fminf( make_float3( T4 ), make_float3( 65504.0f ) ); // largest half
+	const uint r = __half_as_ushort( __float2half_rn( t.x ) ), g = __half_as_ushort( __float2half_rn( t.y ) );
+	const uint b = __half_as_ushort( __float2half_rn( t.z ) ), pdf = (__float_as_uint( T4.w ) + 0x8000) & 0xffff0000;
+	((uint2*)(pathStates + stride * 2))[idx] = make_uint2( r + (g << 16), b + pdf );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  CountLanes                                                                 |
+//  |  Warp-aggregated increment of a ray statistics counter: the first active    |
+//  |  lane adds the number of active lanes, so a warp issues a single atomic.    |
+//  |  If slots is specified, 32 is added to it as well; the ratio of the two     |
+//  |  counters is then the SIMT efficiency at the call site.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC void CountLanes( uint* counter, uint* slots = 0 )
+{
+	const uint mask = __activemask();
+	if ((threadIdx.x & 31) != __ffs( mask ) - 1) return;
+	atomicAdd( counter, __popc( mask ) );
+	if (slots) atomicAdd( slots, 32 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PreviousHitPosition                                                        |
+//  |  Motion vectors: the world space position that point P on an instance had   |
+//  |  in the previous frame. P goes to object space with the current transform,  |
+//  |  and back with the previous one; static instances thus return P.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float3 PreviousHitPosition( const float3 P, const int instIdx )
+{
+	const float4x4& inv = instanceDescriptors[instIdx].invTransform;
+	const float4x4& prev = instanceDescriptors[instIdx].prevTransform;
+	const float4 O = make_float4( dot( make_float3( inv.A ), P ) + inv.A.w,
+		dot( make_float3( inv.B ), P ) + inv.B.w, dot( make_float3( inv.C ), P ) + inv.C.w, 1 );
+	return make_float3( dot( prev.A, O ), dot( prev.B, O ), dot( prev.C, O ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ScreenMotion                                                               |
+//  |  Motion vector of a primary hit, in pixels: from its position on the        |
+//  |  current screen to that on the screen of the previous frame. d and prevD    |
+//  |  point from the eye to the hit, now and in the previous frame; p1, right    |
+//  |  and up give the current screen, relative to the eye. -1e30 if the hit was  |
+//  |  behind the previous eye. Same projection as upscaleKernel.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float2 ScreenPosition( const float3 d, const float3 p1, const float3 right, const float3 up, const int w, const int h )
+{
+	const float3 N = cross( right, up );
+	const float t = dot( p1, N ) / dot( d, N );
+	if (!(t > 0)) return make_float2( -1e30f );
+	const float3 Q = d * t - p1;
+	return make_float2( dot( Q, right ) / dot( right, right ) * w, dot( Q, up ) / dot( up, up ) * h );
+}
+LH2_DEVFUNC float2 ScreenMotion( const float3 d, const float3 prevD, const float3 p1, const float3 right, const float3 up, const int w, const int h )
+{
+	const float2 prev = ScreenPosition( prevD, hitMotion.prevP1 - hitMotion.prevPos, hitMotion.prevRight, hitMotion.prevUp, w, h );
+	if (prev.x < -1e29f) return prev;
+	return prev - ScreenPosition( d, p1, right, up, w, h );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ShadePath                                                                  |
+//  |  Implements the shade phase of the wavefront path tracer, for one path.     |
+//  |  Called by shadeKernel and shadePersistentKernel. SHADECLASS is the shade   |
+//  |  class of the hit material, or SHADE_FULL if it is not known.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <int SHADECLASS>
+LH2_DEVFUNC void ShadePath( const int jobIndex, float4* accumulator, const uint stride,
+	const float4* pathStatesIn, float4* pathStates, const float4* hits, float4* connections,
 	const uint R0, const uint* blueNoise, const int pass,
 	const int probePixelIdx, const int pathLength, const int w, const int h, const float spreadAngle,
-	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const uint pathCount )
+	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const PathControl path )
 {
-	// respect boundaries
-	int jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
-	if (jobIndex >= pathCount) return;
-
 	// gather data by reading sets of four floats for optimal throughput
-	const float4 O4 = pathStates[jobIndex];				// ray origin xyz, w can be ignored
-	const float4 D4 = pathStates[jobIndex + stride];	// ray direction xyz
-	float4 T4 = pathLength == 1 ? make_float4( 1 ) /* faster */ : pathStates[jobIndex + stride * 2]; // path thoughput rgb 
+	// pathStatesIn is pathStates, or a copy in material order, see sortPaths
+	const float4 O4 = pathStatesIn[jobIndex];			// ray origin xyz, w can be ignored
+	const float4 D4 = pathStatesIn[jobIndex + stride];	// ray direction xyz
+	float4 T4 = pathLength == 1 ? make_float4( 1 ) /* faster */ : LoadThroughput( pathStatesIn, stride, jobIndex, path.packedStates ); // path thoughput rgb 
 	const float4 hitData = hits[jobIndex];
 	const float bsdfPdf = T4.w;
 
@@ -74,17 +146,50 @@ void shadeKernel( float4* accumulator, const uint stride,
 	const uint pathIdx = PATHIDX;
 	const uint pixelIdx = pathIdx % (w * h);
 	const uint sampleIdx = pathIdx / (w * h) + pass;
+	if (path.rayStats) CountLanes( &counters->segmentRays[pathLength - 1] );
+
+	// radiance cache: a fraction of the paths that left a diffuse vertex report what they find, see RadianceCacheLearn
+	const bool learn = radianceCache.cells && pathLength > 1 && !(FLAGS & S_SPECULAR) &&
+		WangHash( pathIdx * 3 + R0 ) * 2.3283064365387e-10f < radianceCache.updateRate;
+
+	// path guiding: paths that left a diffuse vertex train its cell with what they find, see PathGuideLearn
+	const bool guideLearn = pathGuide.bins && pathLength > 1 && !(FLAGS & S_SPECULAR);
 
 	// initialize depth in accumulator for DOF shader
 	if (pathLength == 1) accumulator[pixelIdx].w += PRIMIDX == NOHIT ? 10000 : HIT_T;
 
+	// picking: the first sample of each probe pixel records its primary hit, misses included
+	if (pathLength == 1 && pathIdx < w * h) for (int i = 0; i < probes.count; i++) if (pixelIdx == probes.pixels[i])
+		probes.results[i] = make_float4( __int_as_float( INSTANCEIDX ), __int_as_float( PRIMIDX ), HIT_T, 0 );
+
 	// use skydome if we didn't hit any geometry
 	if (PRIMIDX == NOHIT)
 	{
-		float3 contribution = throughput * make_float3( SampleSkydome( D, pathLength ) ) * (1.0f / bsdfPdf);
+		// a ray that left a diffuse vertex sees a filtered sky; others only the extent of the pixel
+		const float skySpread = (pathLength > 1 && !(FLAGS & S_SPECULAR)) ? SKYDIFFUSESPREAD : spreadAngle;
+		const float3 skyColor = make_float3( SampleSkydome( D, pathLength, skySpread ) );
+	#ifdef SKYIMPORTANCE
+		// last vertex was not specular: the sky could also have been sampled explicitly, apply MIS;
+		// a resampled light connection is not combined with bsdf sampling, so it covers the sky on its own
+		const float skyPdf = (pathLength > 1 && !(FLAGS & S_SPECULAR) && skyCDF != 0) ? SkyNEEProb() * SkyPdf( D ) : 0;
+		float3 contribution = throughput * skyColor * (1.0f / (bsdfPdf + skyPdf));
+		if ((FLAGS & S_RESAMPLED) && skyPdf > 0) contribution = make_float3( 0 );
+	#else
+		float3 contribution = throughput * skyColor * (1.0f / bsdfPdf);
+	#endif
 		CLAMPINTENSITY; // limit magnitude of thoughput vector to combat fireflies
 		FIXNAN_FLOAT3( contribution );
 		accumulator[pixelIdx] += make_float4( contribution, 0 );
+		if (learn) RadianceCacheLearn( O4, D4, bsdfPdf, skyColor, pos );
+		if (guideLearn) PathGuideLearn( O4, D4, bsdfPdf, Luminance( skyColor ), pos );
+		if (pathLength == 1 && denoiseGuides) denoiseGuides[pixelIdx] += make_float4( fminf( contribution, make_float3( 1 ) ), 0 );
+		// the sky only moves with the camera orientation
+		if (pathLength == 1 && pathIdx < w * h && hitMotion.motion)
+		{
+			hitMotion.motion[pixelIdx] = ScreenMotion( D, D, p1 - pos, p2 - p1, p3 - p1, w, h );
+			if (hitMotion.prevDepth) hitMotion.prevDepth[pixelIdx] = 10000; // as in the accumulator
+		}
+		if (path.rayStats) CountLanes( &counters->segmentMissed[pathLength - 1] );
 		return;
 	}
 
@@ -99,18 +204,55 @@ void shadeKernel( float4* accumulator, const uint stride,
 	float3 N, iN, fN, T;
 	const float3 I = RAY_O + HIT_T * D;
 	const float coneWidth = spreadAngle * HIT_T;
-	GetShadingData( D, HIT_U, HIT_V, coneWidth, instanceTriangles[PRIMIDX], INSTANCEIDX, shadingData, N, iN, fN, T );
+#ifdef SHADECOST
+	const long long shadingStart = clock64();
+#endif
+	if (instanceDescriptors[INSTANCEIDX].packed)
+	{
+		// compact shading record; meshes with emissive triangles are never packed, see CoreMesh::SetGeometry
+		CoreTri4 tri;
+		UnpackTriangle( ((const CoreTriPacked*)instanceTriangles)[PRIMIDX], tri );
+		GetShadingData( D, HIT_U, HIT_V, coneWidth, tri, INSTANCEIDX, shadingData, N, iN, fN, T );
+	}
+	else GetShadingData( D, HIT_U, HIT_V, coneWidth, instanceTriangles[PRIMIDX], INSTANCEIDX, shadingData, N, iN, fN, T );
+#ifdef SHADECOST
+	// instrumentation build: charge the cycles to the material of the hit, see RenderCore::GetMaterialCosts
+	const long long shadingCycles = clock64() - shadingStart;
+	CoreMaterialCost* cost = materialCosts + (instanceDescriptors[INSTANCEIDX].packed ?
+		((const CoreTriPacked*)instanceTriangles)[PRIMIDX].uv.w : __float_as_uint( instanceTriangles[PRIMIDX].v4.w ));
+	atomicAdd( &cost->shadingCycles, (uint64)shadingCycles );
+	atomicAdd( &cost->invocations, 1 );
+#endif
+
+	// basic materials: zero subsurface, clearcoat and transmission at compile time, so the BSDF loses these lobes
+	if (SHADECLASS == SHADE_BASIC) shadingData.parameters.x &= 0xffff00ff, shadingData.parameters.z &= 0xff00ff00;
 
-	// we need to detect alpha in the shading code.
+	// guide layers for the denoiser: albedo and normal at the primary hit
+	if (pathLength == 1 && denoiseGuides)
+		denoiseGuides[pixelIdx] += make_float4( fminf( shadingData.color, make_float3( 1 ) ), 0 ),
+		denoiseGuides[pixelIdx + w * h] += make_float4( fN, 0 );
+
+	// primary hit: where the surface was in the previous frame, for the motion vectors and reservoir reuse
+	float3 prevI = I;
+	if (pathLength == 1 && (hitMotion.motion || restir.history)) prevI = PreviousHitPosition( I, INSTANCEIDX );
+	if (pathLength == 1 && pathIdx < w * h && hitMotion.motion)
+	{
+		hitMotion.motion[pixelIdx] = ScreenMotion( I - pos, prevI - hitMotion.prevPos, p1 - pos, p2 - p1, p3 - p1, w, h );
+		if (hitMotion.prevDepth) hitMotion.prevDepth[pixelIdx] = length( prevI - hitMotion.prevPos );
+	}
+
+	// we need to detect alpha in the shading code. With ANYHITALPHA, traversal already skipped transparent
+	// texels of flagged triangles; this remains for hits where the any-hit and shading lookups disagree.
 	if (shadingData.flags & 1)
 	{
-		if (pathLength < MAXPATHLENGTH)
+		if (path.rayStats) CountLanes( &counters->segmentAlpha[pathLength - 1] );
+		if (pathLength < path.maxLength)
 		{
-			const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 );
+			const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays );
 			pathStates[extensionRayIdx] = make_float4( I + D * geometryEpsilon, O4.w );
 			pathStates[extensionRayIdx + stride] = D4;
 			if (!(isfinite( T4.x + T4.y + T4.z ))) T4 = make_float4( 0, 0, 0, T4.w );
-			pathStates[extensionRayIdx + stride * 2] = T4;
+			StoreThroughput( pathStates, stride, extensionRayIdx, T4, path.packedStates );
 		}
 		return;
 	}
@@ -121,6 +263,7 @@ void shadeKernel( float4* accumulator, const uint stride,
 	// stop on light
 	if (shadingData.IsEmissive() /* r, g or b exceeds 1 */)
 	{
+		if (path.rayStats) CountLanes( &counters->segmentEmitter[pathLength - 1] );
 		const float DdotNL = -dot( D, N );
 		float3 contribution = make_float3( 0 ); // initialization required.
 		if (DdotNL > 0 /* lights are not double sided */)
@@ -130,6 +273,10 @@ void shadeKernel( float4* accumulator, const uint stride,
 				// only camera rays will be treated special
 				contribution = shadingData.color;
 			}
+			else if (FLAGS & S_RESAMPLED)
+			{
+				// last vertex had a resampled light connection, which is not combined with bsdf sampling
+			}
 			else
 			{
 				// last vertex was not specular: apply MIS
@@ -143,10 +290,15 @@ void shadeKernel( float4* accumulator, const uint stride,
 			CLAMPINTENSITY;
 			FIXNAN_FLOAT3( contribution );
 			accumulator[pixelIdx] += make_float4( contribution, 0 );
+			if (learn) RadianceCacheLearn( O4, D4, bsdfPdf, shadingData.color, pos );
+			if (guideLearn) PathGuideLearn( O4, D4, bsdfPdf, Luminance( shadingData.color ), pos );
 		}
 		return;
 	}
 
+	// sample the warp occupancy of the surface shading code that follows
+	if (path.rayStats) CountLanes( &counters->activeLanes, &counters->laneSlots );
+
 	// detect specular surfaces
 	if (ROUGHNESS < 0.01f) FLAGS |= S_SPECULAR; else FLAGS &= ~S_SPECULAR;
 
@@ -162,55 +314,146 @@ void shadeKernel( float4* accumulator, const uint stride,
 	// apply postponed bsdf pdf
 	throughput *= 1.0f / bsdfPdf;
 
+	// preview modes: albedo and ambient occlusion end the path here, see RenderCore::FramePathControl
+	if (path.preview == PREVIEW_ALBEDO)
+	{
+		float3 contribution = throughput * shadingData.color;
+		FIXNAN_FLOAT3( contribution );
+		accumulator[pixelIdx] += make_float4( contribution, 0 );
+		return;
+	}
+	if (path.preview == PREVIEW_AO)
+	{
+		// a cosine weighted occlusion ray; the shadow ray phase adds the throughput if it reaches aoDistance
+		const float3 R = normalize( Tangent2World( DiffuseReflectionCosWeighted( RandomFloat( seed ), RandomFloat( seed ) ), fN ) );
+		if (dot( R, N ) <= 0) return;
+		const uint shadowRayIdx = AtomicAggInc( &counters->shadowRays );
+		connections[shadowRayIdx] = make_float4( SafeOrigin( I, R, N, geometryEpsilon ), 0 ); // O4
+		connections[shadowRayIdx + path.connectStride] = make_float4( R, path.aoDistance ); // D4
+		connections[shadowRayIdx + path.connectStride * 2] = make_float4( throughput, __int_as_float( pixelIdx ) ); // E4
+		return;
+	}
+
+	// radiance cache: the diffuse radiance leaving this vertex is the albedo times the cached value. That is what
+	// reports to the previous vertex, and at the terminating vertex of a path it replaces the light connection.
+	const bool terminal = (path.singleBounce && (FLAGS & S_BOUNCED)) || pathLength >= path.maxLength;
+	float3 cached;
+	const bool hasCached = radianceCache.cells && !(FLAGS & S_SPECULAR) && (learn || guideLearn || (terminal && pathLength > 1)) &&
+		RadianceCacheLookup( I, fN, pos, cached );
+	if (hasCached)
+	{
+		if (learn) RadianceCacheLearn( O4, D4, bsdfPdf, shadingData.color * cached, pos );
+		if (terminal && pathLength > 1)
+		{
+			float3 contribution = throughput * shadingData.color * cached;
+			CLAMPINTENSITY;
+			FIXNAN_FLOAT3( contribution );
+			accumulator[pixelIdx] += make_float4( contribution, 0 );
+			if (guideLearn) PathGuideLearn( O4, D4, bsdfPdf, Luminance( shadingData.color * cached ), pos );
+			return;
+		}
+	}
+
 	// next event estimation: connect eye path to light
+	float directLum = 0; // unshadowed estimate of the direct light leaving this vertex, for path guiding
 	if (!(FLAGS & S_SPECULAR)) // skip for specular vertices
 	{
-		float3 lightColor;
-		float r0, r1, pickProb, lightPdf = 0;
-		if (sampleIdx < 256)
+		float3 L, contribution = make_float3( 0 );
+		float dist;
+		if (pathLength == 1 && restir.reservoirs)
 		{
-			const uint x = (pixelIdx % w) & 127, y = (pixelIdx / w) & 127;
-			r0 = blueNoiseSampler( blueNoise, x, y, sampleIdx, 4 );
-			r1 = blueNoiseSampler( blueNoise, x, y, sampleIdx, 5 );
+			// primary vertex: connect to the light sample selected by the reservoir of the path
+			if (ResampleLights( pathIdx, stride, w, h, HIT_T, shadingData, I, prevI, fN, T, D * -1.0f, seed, L, dist, contribution ))
+				contribution *= throughput;
 		}
 		else
 		{
-			r0 = RandomFloat( seed );
-			r1 = RandomFloat( seed );
-		}
-		float3 L = RandomPointOnLight( r0, r1, I, fN, pickProb, lightPdf, lightColor ) - I;
-		const float dist = length( L );
-		L *= 1.0f / dist;
-		const float NdotL = dot( L, fN );
-		if (NdotL > 0 && dot( fN, L ) > 0 && lightPdf > 0)
-		{
-			float bsdfPdf;
-			const float3 sampledBSDF = EvaluateBSDF( shadingData, fN, T, D * -1.0f, L, bsdfPdf );
-			if (bsdfPdf > 0)
+			float3 lightColor;
+			float r0, r1, pickProb, lightPdf = 0;
+			if (path.sampler)
+			{
+				// dimensions 0..3 are used by the camera; then four per bounce: two for the light, two for the bsdf
+				const uint x = pixelIdx % w, y = pixelIdx / w, dim = pathLength * 4;
+				r0 = SobolOwenSampler( x, y, sampleIdx, dim );
+				r1 = SobolOwenSampler( x, y, sampleIdx, dim + 1 );
+			}
+			else if (sampleIdx < 256)
+			{
+				const uint x = (pixelIdx % w) & 127, y = (pixelIdx / w) & 127;
+				r0 = blueNoiseSampler( blueNoise, x, y, sampleIdx, 4 );
+				r1 = blueNoiseSampler( blueNoise, x, y, sampleIdx, 5 );
+			}
+			else
+			{
+				r0 = RandomFloat( seed );
+				r1 = RandomFloat( seed );
+			}
+		#ifdef SKYIMPORTANCE
+			// r0 decides between a connection to the sky and to one of the lights
+			const float skyProb = SkyNEEProb();
+			if (r0 < skyProb)
+			{
+				L = SampleSkyDirection( r0 / skyProb, r1, lightPdf );
+				lightColor = make_float3( SampleSkydome( L, pathLength + 1 ) );
+				pickProb = skyProb, dist = 1e34f;
+			}
+			else
+			{
+				L = RandomPointOnLight( (r0 - skyProb) / (1 - skyProb), r1, I, fN, pickProb, lightPdf, lightColor ) - I;
+				pickProb *= 1 - skyProb, dist = length( L );
+				L *= 1.0f / dist;
+			}
+		#else
+			L = RandomPointOnLight( r0, r1, I, fN, pickProb, lightPdf, lightColor ) - I;
+			dist = length( L );
+			L *= 1.0f / dist;
+		#endif
+			const float NdotL = dot( L, fN );
+			if (NdotL > 0 && dot( fN, L ) > 0 && lightPdf > 0)
 			{
+				float bsdfPdf;
+			#ifdef SHADECOST
+				const long long bsdfStart = clock64();
+			#endif
+				const float3 sampledBSDF = EvaluateBSDF( shadingData, fN, T, D * -1.0f, L, bsdfPdf );
+			#ifdef SHADECOST
+				atomicAdd( &cost->bsdfCycles, (uint64)(clock64() - bsdfStart) );
+				atomicAdd( &cost->bsdfCalls, 1 );
+			#endif
 				// calculate potential contribution
-				float3 contribution = throughput * sampledBSDF * lightColor * (NdotL / (pickProb * lightPdf + bsdfPdf));
-				FIXNAN_FLOAT3( contribution );
-				CLAMPINTENSITY;
-				// add fire-and-forget shadow ray to the connections buffer
-				const uint shadowRayIdx = atomicAdd( &counters->shadowRays, 1 ); // compaction
-				connections[shadowRayIdx] = make_float4( SafeOrigin( I, L, N, geometryEpsilon ), 0 ); // O4
-				connections[shadowRayIdx + stride * MAXPATHLENGTH] = make_float4( L, dist - 2 * geometryEpsilon ); // D4
-				connections[shadowRayIdx + stride * 2 * MAXPATHLENGTH] = make_float4( contribution, __int_as_float( pixelIdx ) ); // E4
+				if (bsdfPdf > 0) contribution = throughput * sampledBSDF * lightColor * (NdotL / (pickProb * lightPdf + bsdfPdf));
 			}
 		}
+		FIXNAN_FLOAT3( contribution );
+		directLum = Luminance( contribution ) / max( EPSILON, Luminance( throughput ) );
+		if (contribution.x + contribution.y + contribution.z > 0)
+		{
+			CLAMPINTENSITY;
+			// add fire-and-forget shadow ray to the connections buffer
+			const uint shadowRayIdx = AtomicAggInc( &counters->shadowRays ); // compaction
+			connections[shadowRayIdx] = make_float4( SafeOrigin( I, L, N, geometryEpsilon ), 0 ); // O4
+			connections[shadowRayIdx + path.connectStride] = make_float4( L, dist - 2 * geometryEpsilon ); // D4
+			connections[shadowRayIdx + path.connectStride * 2] = make_float4( contribution, __int_as_float( pixelIdx ) ); // E4
+			if (path.rayStats) CountLanes( &counters->segmentShadowRays[pathLength - 1] );
+		}
 	}
 
-	// cap at one diffuse bounce (because of this we also don't need Russian roulette)
-	if (FLAGS & S_BOUNCED) return;
+	// path guiding: without a cached value, the direct light is the best estimate of what leaves this vertex
+	if (guideLearn && !(FLAGS & S_SPECULAR)) PathGuideLearn( O4, D4, bsdfPdf, hasCached ? Luminance( shadingData.color * cached ) : directLum, pos );
 
-	// depth cap
-	if (pathLength == MAXPATHLENGTH /* don't fill arrays with rays we won't trace */) return;
+	// optionally cap at one diffuse bounce; depth cap: don't fill arrays with rays we won't trace
+	if (terminal) return;
 
 	// evaluate bsdf to obtain direction for next path segment
-	float3 R;
+	float3 R, bsdf;
 	float newBsdfPdf, r3, r4;
-	if (sampleIdx < 256)
+	if (path.sampler)
+	{
+		const uint x = pixelIdx % w, y = pixelIdx / w, dim = pathLength * 4 + 2;
+		r3 = SobolOwenSampler( x, y, sampleIdx, dim );
+		r4 = SobolOwenSampler( x, y, sampleIdx, dim + 1 );
+	}
+	else if (sampleIdx < 256)
 	{
 		const uint x = (pixelIdx % w) & 127, y = (pixelIdx / w) & 127;
 		r3 = blueNoiseSampler( blueNoise, x, y, sampleIdx, 4 );
@@ -221,17 +464,216 @@ void shadeKernel( float4* accumulator, const uint stride,
 		r3 = RandomFloat( seed );
 		r4 = RandomFloat( seed );
 	}
-	const float3 bsdf = SampleBSDF( shadingData, fN, N, T, D * -1.0f, r3, r4, R, newBsdfPdf );
+#ifdef SHADECOST
+	const long long bsdfStart = clock64(); // includes sampling the path guide, if enabled
+#endif
+	const uint guideSlot = (pathGuide.bins && !(FLAGS & S_SPECULAR) && TRANSMISSION == 0) ? GuideCell( I, fN, pos ) : RCNOSLOT;
+	if (guideSlot != RCNOSLOT)
+	{
+		// path guiding: sample the histogram of the cell or the bsdf, and use the pdf of the mixture
+		float guidePdf;
+		if (RandomFloat( seed ) < pathGuide.fraction)
+		{
+			R = SampleGuide( guideSlot, RandomFloat( seed ), r3, r4, guidePdf );
+			if (dot( R, N ) <= 0 || dot( R, fN ) <= 0) return; // reflection only; the bsdf is zero here
+			bsdf = EvaluateBSDF( shadingData, fN, T, D * -1.0f, R, newBsdfPdf );
+		}
+		else
+		{
+			bsdf = SampleBSDF( shadingData, fN, N, T, D * -1.0f, r3, r4, R, newBsdfPdf );
+			guidePdf = GuidePdf( guideSlot, R );
+		}
+		newBsdfPdf = pathGuide.fraction * guidePdf + (1 - pathGuide.fraction) * newBsdfPdf;
+	}
+	else bsdf = SampleBSDF( shadingData, fN, N, T, D * -1.0f, r3, r4, R, newBsdfPdf );
+#ifdef SHADECOST
+	atomicAdd( &cost->bsdfCycles, (uint64)(clock64() - bsdfStart) );
+	atomicAdd( &cost->bsdfCalls, 1 );
+#endif
 	if (newBsdfPdf < EPSILON || isnan( newBsdfPdf )) return;
+	FIXNAN_FLOAT3( throughput );
+	float3 newThroughput = throughput * bsdf * abs( dot( fN, R ) );
+
+	// Russian roulette: survival probability follows the throughput of the new segment (the pdf is still postponed)
+	if (path.rrDepth > 0 && pathLength >= path.rrDepth)
+	{
+		const float survive = min( 1.0f, max( newThroughput.x, max( newThroughput.y, newThroughput.z ) ) / newBsdfPdf );
+		if (!(RandomFloat( seed ) < survive))
+		{
+			if (path.rayStats) CountLanes( &counters->segmentRoulette[pathLength - 1] );
+			return;
+		}
+		newThroughput *= 1.0f / survive;
+	}
 
 	// write extension ray
-	const uint extensionRayIdx = atomicAdd( &counters->extensionRays, 1 ); // compact
+	const uint extensionRayIdx = AtomicAggInc( &counters->extensionRays ); // compact
 	const uint packedNormal = PackNormal( fN );
 	if (!(FLAGS & S_SPECULAR)) FLAGS |= S_BOUNCED; else FLAGS |= S_VIASPECULAR;
+	if (pathLength == 1 && restir.reservoirs && !(FLAGS & S_SPECULAR)) FLAGS |= S_RESAMPLED; else FLAGS &= ~S_RESAMPLED;
 	pathStates[extensionRayIdx] = make_float4( SafeOrigin( I, R, N, geometryEpsilon ), __uint_as_float( FLAGS ) );
 	pathStates[extensionRayIdx + stride] = make_float4( R, __uint_as_float( packedNormal ) );
-	FIXNAN_FLOAT3( throughput );
-	pathStates[extensionRayIdx + stride * 2] = make_float4( throughput * bsdf * abs( dot( fN, R ) ), newBsdfPdf );
+	StoreThroughput( pathStates, stride, extensionRayIdx, make_float4( newThroughput, newBsdfPdf ), path.packedStates );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  shadeKernel                                                                |
+//  |  One thread per path. Compiled for each of the SHADEVARIANTS launch         |
+//  |  configurations; the core selects one per GPU, see                          |
+//  |  RenderCore::TuneLaunchConfig. With classBins, paths are in material order  |
+//  |  and the kernel shades the range of its SHADECLASS only.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <int BLOCKSIZE, int MINBLOCKS, int SHADECLASS>
+__global__  __launch_bounds__( BLOCKSIZE /* max block size */, MINBLOCKS /* min blocks per sm */ )
+void shadeKernel( float4* accumulator, const uint stride,
+	const float4* pathStatesIn, float4* pathStates, const float4* hits, float4* connections,
+	const uint R0, const uint* blueNoise, const int pass,
+	const int probePixelIdx, const int pathLength, const int w, const int h, const float spreadAngle,
+	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const PathControl path, const uint pathCount, const uint* classBins )
+{
+	// respect boundaries
+	int jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
+	if (classBins)
+	{
+		// after sortGatherKernel, each bin holds the end of its range; class 0 also owns the misses in bin 0
+		jobIndex += SHADECLASS == 0 ? 0 : classBins[SHADECLASS * CLASSBINS];
+		if (jobIndex >= classBins[(SHADECLASS + 1) * CLASSBINS]) return;
+	}
+	else if (jobIndex >= pathCount || jobIndex >= counters->activePaths) return;
+	ShadePath<SHADECLASS>( jobIndex, accumulator, stride, pathStatesIn, pathStates, hits, connections, R0, blueNoise, pass,
+		probePixelIdx, pathLength, w, h, spreadAngle, p1, p2, p3, pos, path );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  shadePersistentKernel                                                      |
+//  |  Persistent threads: the grid fills the device once, and each warp fetches  |
+//  |  32 paths at a time from counters->shaded until all active paths are done.  |
+//  |  The launch size thus no longer depends on the path count, which avoids     |
+//  |  the launch tail and, in async mode, the many threads of a full-screen      |
+//  |  launch that exit right away on deep bounces.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <int BLOCKSIZE, int MINBLOCKS>
+__global__  __launch_bounds__( BLOCKSIZE /* max block size */, MINBLOCKS /* min blocks per sm */ )
+void shadePersistentKernel( float4* accumulator, const uint stride,
+	const float4* pathStatesIn, float4* pathStates, const float4* hits, float4* connections,
+	const uint R0, const uint* blueNoise, const int pass,
+	const int probePixelIdx, const int pathLength, const int w, const int h, const float spreadAngle,
+	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const PathControl path, const uint pathCount )
+{
+	const uint activePaths = min( pathCount, counters->activePaths );
+	const uint lane = threadIdx.x & 31;
+	while (1)
+	{
+		// all lanes of a warp arrive here together; the exit below is warp-uniform
+		uint base;
+		if (lane == 0) base = atomicAdd( &counters->shaded, 32 );
+		base = __shfl_sync( 0xffffffff, base, 0 );
+		if (base >= activePaths) return;
+		if (base + lane < activePaths) ShadePath<SHADE_FULL>( base + lane, accumulator, stride, pathStatesIn, pathStates, hits, connections,
+			R0, blueNoise, pass, probePixelIdx, pathLength, w, h, spreadAngle, p1, p2, p3, pos, path );
+		__syncwarp();
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  sortGatherKernel                                                           |
+//  |  Copies the path states and hits of the active paths to their position in   |
+//  |  material order. Shading reads from the copy, so it may write extension     |
+//  |  rays to pathStates in any order.                                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void sortGatherKernel( const float4* pathStates, const float4* hits, const uint* keys, uint* bins,
+	float4* sortedStates, float4* sortedHits, const uint stride, const int pathLength, const int packedStates, const uint pathCount )
+{
+	const uint jobIndex = threadIdx.x + blockIdx.x * blockDim.x;
+	if (jobIndex >= pathCount || jobIndex >= counters->activePaths) return;
+	const uint target = atomicAdd( &bins[keys[jobIndex]], 1 );
+	sortedStates[target] = pathStates[jobIndex];
+	sortedStates[target + stride] = pathStates[jobIndex + stride];
+	if (pathLength > 1) // throughput is implicit for primary rays
+	{
+		if (packedStates) ((uint2*)(sortedStates + stride * 2))[target] = ((const uint2*)(pathStates + stride * 2))[jobIndex];
+		else sortedStates[target + stride * 2] = pathStates[jobIndex + stride * 2];
+	}
+	sortedHits[target] = hits[jobIndex];
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  sortPaths                                                                  |
+//  |  Host-side access point for material-coherent path sorting.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void sortPaths( const int pathCount, const float4* pathStates, const float4* hits, uint* keys, uint* bins,
+	float4* sortedStates, float4* sortedHits, const uint stride, const int pathLength, const int packedStates, const cudaStream_t stream )
+{
+	// hits: x = barycentrics, y = instance, z = primitive, w = distance
+	sortPathKeys( hits, 4, 1, 2, keys, bins, pathCount, stream );
+	const dim3 gridDim( NEXTMULTIPLEOF( pathCount, 128 ) / 128, 1 ), blockDim( 128, 1 );
+	sortGatherKernel<<<gridDim.x, 128, 0, stream>>>( pathStates, hits, keys, bins, sortedStates, sortedHits, stride, pathLength, packedStates, pathCount );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  primaryFromVisibilityKernel                                                |
+//  |  Hybrid rendering: turns a rasterized visibility buffer into the path       |
+//  |  states and hits of the primary rays, in the layout of the primary trace.   |
+//  |  A visibility texel holds the hit data as the primary trace would store it: |
+//  |  x = barycentrics, y = instance, z = primitive, w = distance. The ray goes  |
+//  |  through the pixel center, as the rasterizer sampled it.              LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void primaryFromVisibilityKernel( const uint4* visibility, float4* pathStates, float4* hits, const int w, const int h,
+	const float3 pos, const float3 p1, const float3 right, const float3 up )
+{
+	const int x = threadIdx.x + blockIdx.x * blockDim.x, y = threadIdx.y + blockIdx.y * blockDim.y;
+	if (x >= w || y >= h) return;
+	const uint jobIndex = x + y * w;
+	const uint4 v = visibility[jobIndex];
+	const float3 D = normalize( p1 + right * ((x + 0.5f) / w) + up * ((y + 0.5f) / h) - pos );
+	pathStates[jobIndex] = make_float4( pos, __uint_as_float( (jobIndex << 8) + S_SPECULAR ) );
+	pathStates[jobIndex + w * h] = make_float4( D, 0 );
+	hits[jobIndex] = make_float4( __uint_as_float( v.x ), __uint_as_float( v.y ), __uint_as_float( v.z ), __uint_as_float( v.w ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  primaryFromVisibility                                                      |
+//  |  Host-side access point for the primaryFromVisibilityKernel.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void primaryFromVisibility( const uint4* visibility, float4* pathStates, float4* hits, const int w, const int h,
+	const float3 pos, const float3 p1, const float3 right, const float3 up, const cudaStream_t stream )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( w, 16 ) / 16, NEXTMULTIPLEOF( h, 16 ) / 16 ), blockDim( 16, 16 );
+	primaryFromVisibilityKernel<<<gridDim, blockDim, 0, stream>>>( visibility, pathStates, hits, w, h, pos, p1, right, up );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  launchShade                                                                |
+//  |  Launches one of the shade kernel variants. With persistentSMs > 0, the     |
+//  |  persistent kernel is used, with as many blocks as fit on that many SMs.    |
+//  |  Otherwise, with classBins, one specialized kernel is launched per shade    |
+//  |  class; the class ranges are only known on the device, so each launch is    |
+//  |  sized for all paths, and threads beyond their range exit right away. LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <int BLOCKSIZE, int MINBLOCKS>
+__host__ void launchShade( const int pathCount, const int persistentSMs, const cudaStream_t stream, float4* accumulator, const uint stride,
+	const float4* pathStatesIn, float4* pathStates, const float4* hits, float4* connections,
+	const uint R0, const uint* blueNoise, const int pass,
+	const int probePixelIdx, const int pathLength, const int w, const int h, const float spreadAngle,
+	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const PathControl path, const uint* classBins )
+{
+	const int blocks = NEXTMULTIPLEOF( pathCount, BLOCKSIZE ) / BLOCKSIZE;
+	if (persistentSMs > 0)
+	{
+		static int blocksPerSM = 0; // per variant; occupancy does not change at runtime
+		if (blocksPerSM == 0) cudaOccupancyMaxActiveBlocksPerMultiprocessor( &blocksPerSM, shadePersistentKernel<BLOCKSIZE, MINBLOCKS>, BLOCKSIZE, 0 );
+		shadePersistentKernel<BLOCKSIZE, MINBLOCKS><<<min( blocks, persistentSMs * max( 1, blocksPerSM ) ), BLOCKSIZE, 0, stream>>>( accumulator, stride,
+			pathStatesIn, pathStates, hits, connections, R0, blueNoise, pass, probePixelIdx, pathLength, w, h, spreadAngle, p1, p2, p3, pos, path, pathCount );
+	}
+	else if (classBins)
+	{
+		shadeKernel<BLOCKSIZE, MINBLOCKS, SHADE_FULL><<<blocks, BLOCKSIZE, 0, stream>>>( accumulator, stride,
+			pathStatesIn, pathStates, hits, connections, R0, blueNoise, pass, probePixelIdx, pathLength, w, h, spreadAngle, p1, p2, p3, pos, path, pathCount, classBins );
+		shadeKernel<BLOCKSIZE, MINBLOCKS, SHADE_BASIC><<<blocks, BLOCKSIZE, 0, stream>>>( accumulator, stride,
+			pathStatesIn, pathStates, hits, connections, R0, blueNoise, pass, probePixelIdx, pathLength, w, h, spreadAngle, p1, p2, p3, pos, path, pathCount, classBins );
+	}
+	else shadeKernel<BLOCKSIZE, MINBLOCKS, SHADE_FULL><<<blocks, BLOCKSIZE, 0, stream>>>( accumulator, stride,
+		pathStatesIn, pathStates, hits, connections, R0, blueNoise, pass, probePixelIdx, pathLength, w, h, spreadAngle, p1, p2, p3, pos, path, pathCount, 0 );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -239,14 +681,23 @@ void shadeKernel( float4* accumulator, const uint stride,
 //  |  Host-side access point for the shadeKernel code.                     LH2'19|
 //  +-----------------------------------------------------------------------------+
 __host__ void shade( const int pathCount, float4* accumulator, const uint stride,
-	float4* pathStates, const float4* hits, float4* connections,
+	const float4* pathStatesIn, float4* pathStates, const float4* hits, float4* connections,
 	const uint R0, const uint* blueNoise, const int pass,
 	const int probePixelIdx, const int pathLength, const int scrwidth, const int scrheight, const float spreadAngle,
-	const float3 p1, const float3 p2, const float3 p3, const float3 pos )
+	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const PathControl path, const int variant, const int persistentSMs,
+	const uint* classBins, const cudaStream_t stream )
 {
-	const dim3 gridDim( NEXTMULTIPLEOF( pathCount, 128 ) / 128, 1 ), blockDim( 128, 1 );
-	shadeKernel<<<gridDim.x, 128>>>( accumulator, stride, pathStates, hits, connections, R0, blueNoise, 
-		pass, probePixelIdx, pathLength, scrwidth, scrheight, spreadAngle, p1, p2, p3, pos, pathCount );
+#define SHADE_VARIANT(b,m) launchShade<b, m>( pathCount, persistentSMs, stream, accumulator, stride, pathStatesIn, pathStates, \
+	hits, connections, R0, blueNoise, pass, probePixelIdx, pathLength, scrwidth, scrheight, spreadAngle, p1, p2, p3, pos, path, classBins )
+	switch (variant)
+	{
+	case 0: SHADE_VARIANT( 64, 8 ); break;
+	case 1: SHADE_VARIANT( 128, 4 ); break; // former default for Turing
+	case 2: SHADE_VARIANT( 128, 8 ); break; // former default for Pascal, Volta
+	case 3: SHADE_VARIANT( 256, 2 ); break;
+	default: SHADE_VARIANT( 256, 4 ); break;
+	}
+#undef SHADE_VARIANT
 }
 
 // EOF
\ No newline at end of file
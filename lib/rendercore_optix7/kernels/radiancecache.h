@@ -0,0 +1,126 @@
+/* radiancecache.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements a world-space radiance cache: a hash grid of
+   cells, keyed by position and normal octant, that stores the average
+   cosine-weighted incident radiance (irradiance / pi) at surfaces.
+   Cells grow with the distance to the camera. The cache is fed by the
+   path vertices themselves: a path that arrives at a vertex reports
+   the radiance it found there to the cell of the vertex it came from.
+   For a surface, that radiance is again taken from the cache, so the
+   cells converge to multi-bounce lighting over a number of frames.
+   See ShadePath for the lookup at the terminating vertex.
+*/
+
+#include "noerrors.h"
+
+#define RCNOSLOT	0xffffffff
+
+//  +-----------------------------------------------------------------------------+
+//  |  HashGridSlot                                                               |
+//  |  Finds the hash table slot of the cell that contains P, for surfaces with   |
+//  |  normal N. Cells double in size per RCLEVELCELLS cells of distance to the   |
+//  |  camera. Collisions are resolved by linear probing over RCPROBES slots;     |
+//  |  with insert, a free slot is claimed for the cell. Returns RCNOSLOT if the  |
+//  |  cell is not in the table, or if there was no room for it. Shared with the  |
+//  |  path guiding grid, see kernels/pathguiding.h.                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC uint HashGridSlot( uint* keys, const uint mask, const float cellSize, const float3 P, const float3 N, const float3 camPos, const bool insert )
+{
+	const float dist = length( P - camPos );
+	const int level = min( 15, (int)log2f( 1 + dist / (cellSize * RCLEVELCELLS) ) );
+	const float scale = 1.0f / (cellSize * (1 << level));
+	const uint3 c = make_uint3( (int)floorf( P.x * scale ), (int)floorf( P.y * scale ), (int)floorf( P.z * scale ) );
+	const uint cell = (level << 3) + (N.x > 0 ? 1 : 0) + (N.y > 0 ? 2 : 0) + (N.z > 0 ? 4 : 0);
+	const uint hash = WangHash( (c.x * 73856093u) ^ (c.y * 19349663u) ^ (c.z * 83492791u) ^ cell );
+	const uint check = WangHash( (c.x * 19349663u) ^ (c.y * 83492791u) ^ (c.z * 73856093u) ^ (cell << 8) ) | 1;
+	for (int i = 0; i < RCPROBES; i++)
+	{
+		const uint slot = (hash + i) & mask;
+		const uint owner = insert ? atomicCAS( keys + slot, 0, check ) : keys[slot];
+		if (owner == check || (insert && owner == 0)) return slot;
+		if (owner == 0) break; // slots are claimed in probe order, so the cell is not further down
+	}
+	return RCNOSLOT;
+}
+LH2_DEVFUNC uint RadianceCacheSlot( const float3 P, const float3 N, const float3 camPos, const bool insert )
+{
+	return HashGridSlot( radianceCache.keys, radianceCache.mask, radianceCache.cellSize, P, N, camPos, insert );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RadianceCacheLookup                                                        |
+//  |  Average cosine-weighted incident radiance at P; multiplied by the albedo,  |
+//  |  this approximates the diffuse radiance leaving P. Returns false if the     |
+//  |  cell has fewer than RCMINSAMPLES samples.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC bool RadianceCacheLookup( const float3 P, const float3 N, const float3 camPos, float3& L )
+{
+	const uint slot = RadianceCacheSlot( P, N, camPos, false );
+	if (slot == RCNOSLOT) return false;
+	const float4 c = radianceCache.cells[slot];
+	if (c.w < RCMINSAMPLES) return false;
+	L = make_float3( c ) * (1.0f / c.w);
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RadianceCacheLearn                                                         |
+//  |  Feeds the cache with radiance L, which arrived along the direction in D4   |
+//  |  at the previous path vertex, O4. D4.w holds the normal at that vertex and  |
+//  |  bsdfPdf is the pdf of the direction, so L * cos / (pi * pdf) is an         |
+//  |  estimate of the value stored in the cell of O4.                      LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC void RadianceCacheLearn( const float4 O4, const float4 D4, const float bsdfPdf, const float3 L, const float3 camPos )
+{
+	const float3 lastN = UnpackNormal( __float_as_uint( D4.w ) );
+	const float cosTheta = dot( lastN, make_float3( D4 ) );
+	if (cosTheta <= 0 || !(bsdfPdf > 0)) return;
+	float3 contribution = L * (cosTheta * INVPI / bsdfPdf);
+	CLAMPINTENSITY; // a single firefly would otherwise stay in the cell for many frames
+	FIXNAN_FLOAT3( contribution );
+	const uint slot = RadianceCacheSlot( make_float3( O4 ), lastN, camPos, true );
+	if (slot == RCNOSLOT) return;
+	float* cell = (float*)(radianceCache.cells + slot);
+	atomicAdd( cell + 0, contribution.x );
+	atomicAdd( cell + 1, contribution.y );
+	atomicAdd( cell + 2, contribution.z );
+	atomicAdd( cell + 3, 1.0f );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  decayRadianceCacheKernel                                                   |
+//  |  Cells with more than RCMAXSAMPLES samples are scaled back to that count,   |
+//  |  which turns the running average into an exponential moving average, so     |
+//  |  the cache follows changes in the lighting.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void decayRadianceCacheKernel( const uint slots )
+{
+	const uint slot = threadIdx.x + blockIdx.x * blockDim.x;
+	if (slot >= slots) return;
+	const float4 c = radianceCache.cells[slot];
+	if (c.w > RCMAXSAMPLES) radianceCache.cells[slot] = c * (RCMAXSAMPLES / c.w);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  decayRadianceCache                                                         |
+//  |  Host-side access point for the decayRadianceCacheKernel code.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void decayRadianceCache( const uint slots, const cudaStream_t stream )
+{
+	const dim3 gridDim( NEXTMULTIPLEOF( slots, 256 ) / 256, 1 ), blockDim( 256, 1 );
+	decayRadianceCacheKernel<<<gridDim.x, 256, 0, stream>>>( slots );
+}
+
+// EOF
@@ -0,0 +1,68 @@
+/* reorder.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements shader execution reordering for the megakernel,
+   for use in .optix.cu. Instead of optixTrace, the raygen program calls
+   TraceReordered: traversal yields a hit object, the threads of the
+   launch are regrouped on a coherence hint, and only then the hit or
+   miss program runs, followed by shading in the raygen program. The
+   hint is the key of the wavefront material sort (sorting_shared.h):
+   0 for paths that leave the scene, otherwise derived from the
+   material. The number of hint bits is PathControl::reorderBits; with
+   0, or with an OptiX SDK older than 8.0, TraceReordered is optixTrace.
+*/
+
+#include "noerrors.h"
+
+#if OPTIX_VERSION >= 80000
+
+//  +-----------------------------------------------------------------------------+
+//  |  CoherenceHint                                                              |
+//  |  Coherence hint for the hit object of the last traversal: 0 for a miss,     |
+//  |  otherwise 1 + the material, wrapped to the available bits.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+static __forceinline__ __device__ uint CoherenceHint( const MegakernelScene& scene, const uint bits )
+{
+	if (!optixHitObjectIsHit()) return 0;
+	const CoreInstanceDesc& desc = scene.instanceDescriptors[optixHitObjectGetInstanceId()];
+	const uint primIdx = optixHitObjectGetPrimitiveIndex();
+	const uint material = desc.packed ? ((const CoreTriPacked*)desc.triangles)[primIdx].uv.w : __float_as_uint( desc.triangles[primIdx].v4.w );
+	return 1 + material % ((1u << bits) - 1);
+}
+
+#endif
+
+//  +-----------------------------------------------------------------------------+
+//  |  TraceReordered                                                             |
+//  |  optixTrace, with the threads reordered between traversal and the hit or    |
+//  |  miss program. Arguments as for optixTrace; the payload is passed on to     |
+//  |  the programs unchanged.                                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+template <typename... Payload>
+static __forceinline__ __device__ void TraceReordered( const Params& params, const OptixTraversableHandle handle, const float3 O, const float3 D,
+	const float tmin, const float tmax, const uint mask, const uint sbtOffset, const uint sbtStride, const uint missIdx, Payload&... payload )
+{
+#if OPTIX_VERSION >= 80000
+	if (params.path.reorderBits > 0)
+	{
+		optixTraverse( handle, O, D, tmin, tmax, 0, mask, OPTIX_RAY_FLAG_NONE, sbtOffset, sbtStride, missIdx, payload... );
+		optixReorder( CoherenceHint( params.scene, params.path.reorderBits ), params.path.reorderBits );
+		optixInvoke( payload... );
+		return;
+	}
+#endif
+	optixTrace( handle, O, D, tmin, tmax, 0, mask, OPTIX_RAY_FLAG_NONE, sbtOffset, sbtStride, missIdx, payload... );
+}
+
+// EOF
@@ -0,0 +1,173 @@
+/* restir.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements spatiotemporal reservoir resampling of the light
+   connection at the primary path vertex, after Bitterli et al., 2020.
+   Each path draws a number of light samples, keeps one in a reservoir
+   using weighted reservoir sampling, and merges the reservoirs of the
+   previous frame at and around its reprojected pixel. The single shadow
+   ray then goes to a sample that was picked from many, in proportion to
+   its unshadowed contribution. The spatial neighbours are taken from the
+   previous frame, so a single pass suffices. Visibility is not part of
+   the target function, so reuse is biased near shadow boundaries.
+*/
+
+#include "noerrors.h"
+
+#define RESTIRSKY	-1		// light index of sky dome samples, which hold a direction
+
+//  +-----------------------------------------------------------------------------+
+//  |  ResampleTarget                                                             |
+//  |  Unshadowed contribution of light sample y at shading point I, not divided  |
+//  |  by its selection probability: the bsdf times the radiance and the cosine,  |
+//  |  over the light pdf for lights. y holds the point on the light (or the      |
+//  |  direction, for the sky dome) and the light index in w. The luminance of    |
+//  |  the result is the target function of the resampling.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC float3 ResampleTarget( const float4 y, const ShadingData& shadingData, const float3 I, const float3 fN, const float3 T,
+	const float3 wo, float3& L, float& dist )
+{
+	const int lightIdx = __float_as_int( y.w );
+	float3 lightColor;
+	float lightPdf = 1;
+	if (lightIdx == RESTIRSKY)
+	{
+		L = make_float3( y ), dist = 1e34f;
+		lightColor = make_float3( SampleSkydome( L, 2 ) );
+	}
+	else
+	{
+		L = LightSamplePoint( lightIdx, make_float3( y ), I, fN, lightPdf, lightColor ) - I;
+		dist = length( L );
+		L *= 1.0f / dist;
+		if (!(lightPdf > 0)) return make_float3( 0 );
+	}
+	const float NdotL = dot( L, fN );
+	if (NdotL <= 0) return make_float3( 0 );
+	float bsdfPdf;
+	const float3 sampledBSDF = EvaluateBSDF( shadingData, fN, T, wo, L, bsdfPdf );
+	if (!(bsdfPdf > 0)) return make_float3( 0 );
+	return sampledBSDF * lightColor * (NdotL / lightPdf);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ReprojectPixel                                                             |
+//  |  Pixel of world space position P in the previous view, or -1 if P was not   |
+//  |  on screen. Same projection as upscaleKernel.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC int2 ReprojectPixel( const float3 P, const int w, const int h )
+{
+	const float3 d = P - restir.prevPos, N = cross( restir.prevRight, restir.prevUp );
+	const float t = dot( restir.prevP1 - restir.prevPos, N ) / dot( d, N );
+	if (!(t > 0)) return make_int2( -1 );
+	const float3 Q = restir.prevPos + d * t - restir.prevP1;
+	const int x = (int)floorf( dot( Q, restir.prevRight ) / dot( restir.prevRight, restir.prevRight ) * w );
+	const int y = (int)floorf( dot( Q, restir.prevUp ) / dot( restir.prevUp, restir.prevUp ) * h );
+	return (x >= 0 && y >= 0 && x < w && y < h) ? make_int2( x, y ) : make_int2( -1 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ResampleLights                                                             |
+//  |  Builds the reservoir of a primary path vertex: restir.candidates fresh     |
+//  |  light samples, merged with up to restir.reuseTaps reservoirs of the        |
+//  |  previous frame that saw a similar surface. The reservoir is stored for the |
+//  |  next frame. Yields the connection to the selected sample, with its         |
+//  |  unshadowed contribution; returns false if there is nothing to connect to.  |
+//  |  depth is the primary hit distance, for the surface similarity test; prevI  |
+//  |  is where the hit point was in the previous frame.                    LH2'19|
+//  +-----------------------------------------------------------------------------+
+LH2_DEVFUNC bool ResampleLights( const uint pathIdx, const uint stride, const int w, const int h, const float depth,
+	const ShadingData& shadingData, const float3 I, const float3 prevI, const float3 fN, const float3 T, const float3 wo,
+	uint& seed, float3& L, float& dist, float3& contribution )
+{
+	float4 y = make_float4( 0, 0, 0, __int_as_float( RESTIRSKY ) );
+	float wSum = 0, M = 0, selected = 0;
+	contribution = make_float3( 0 );
+	// fresh candidates, drawn like a regular light connection
+#ifdef SKYIMPORTANCE
+	const float skyProb = SkyNEEProb();
+#endif
+	for (int i = 0; i < restir.candidates; i++)
+	{
+		float4 candidate;
+		float pickProb, lightPdf = 0, cDist;
+		float3 lightColor, cL;
+		float r0 = RandomFloat( seed );
+		const float r1 = RandomFloat( seed );
+		M++;
+	#ifdef SKYIMPORTANCE
+		if (r0 < skyProb)
+		{
+			candidate = make_float4( SampleSkyDirection( r0 / skyProb, r1, lightPdf ), __int_as_float( RESTIRSKY ) );
+			pickProb = skyProb * lightPdf; // sky samples are directions: their pdf is a solid angle pdf
+		}
+		else
+		{
+			int lightIdx;
+			const float3 P = RandomPointOnLight( (r0 - skyProb) / (1 - skyProb), r1, I, fN, pickProb, lightPdf, lightColor, &lightIdx );
+			candidate = make_float4( P, __int_as_float( lightIdx ) );
+			pickProb *= 1 - skyProb;
+		}
+	#else
+		int lightIdx;
+		const float3 P = RandomPointOnLight( r0, r1, I, fN, pickProb, lightPdf, lightColor, &lightIdx );
+		candidate = make_float4( P, __int_as_float( lightIdx ) );
+	#endif
+		if (!(lightPdf > 0) || !(pickProb > 0)) continue;
+		const float3 q = ResampleTarget( candidate, shadingData, I, fN, T, wo, cL, cDist );
+		const float weight = Luminance( q ) / pickProb;
+		if (!(weight > 0)) continue;
+		wSum += weight;
+		if (RandomFloat( seed ) * wSum < weight) y = candidate, selected = Luminance( q ), contribution = q, L = cL, dist = cDist;
+	}
+	// merge reservoirs of the previous frame, found by reprojecting the hit point as it was then
+	const uint pixels = w * h, layer = pathIdx / pixels;
+	const int2 pixel = restir.history ? ReprojectPixel( prevI, w, h ) : make_int2( -1 );
+	if (pixel.x >= 0) for (int i = 0; i < restir.reuseTaps; i++)
+	{
+		int2 tap = pixel;
+		if (i > 0)
+		{
+			// spatial neighbours, uniformly distributed over a disc
+			const float a = RandomFloat( seed ) * 2 * PI, r = RESTIRRADIUS * sqrtf( RandomFloat( seed ) );
+			tap = make_int2( pixel.x + (int)(r * cosf( a )), pixel.y + (int)(r * sinf( a )) );
+			if (tap.x < 0 || tap.y < 0 || tap.x >= w || tap.y >= h) continue;
+		}
+		const uint idx = tap.x + tap.y * w + layer * pixels;
+		const float4 state = restir.history[idx + stride];	// wsum, M, W
+		if (!(state.y > 0) || !(state.z > 0)) continue;
+		const float4 surface = restir.history[idx + stride * 2];
+		if (dot( UnpackNormal( __float_as_uint( surface.w ) ), fN ) < RESTIRNORMAL) continue;
+		if (length( make_float3( surface ) - prevI ) > RESTIRDEPTH * depth) continue;
+		const float4 candidate = restir.history[idx];
+		float3 cL;
+		float cDist;
+		const float3 q = ResampleTarget( candidate, shadingData, I, fN, T, wo, cL, cDist );
+		const float reusedM = min( state.y, restir.maxHistory * restir.candidates );
+		const float weight = Luminance( q ) * state.z * reusedM;
+		M += reusedM;
+		if (!(weight > 0)) continue;
+		wSum += weight;
+		if (RandomFloat( seed ) * wSum < weight) y = candidate, selected = Luminance( q ), contribution = q, L = cL, dist = cDist;
+	}
+	// store the reservoir for the next frame; W is the reciprocal pdf estimate of the selected sample
+	const float W = selected > 0 ? wSum / (M * selected) : 0;
+	restir.reservoirs[pathIdx] = y;
+	restir.reservoirs[pathIdx + stride] = make_float4( wSum, M, W, 0 );
+	restir.reservoirs[pathIdx + stride * 2] = make_float4( I, __uint_as_float( PackNormal( fN ) ) );
+	contribution *= W;
+	return W > 0;
+}
+
+// EOF
@@ -0,0 +1,156 @@
+/* scatter.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   This file implements procedural instancing: the members of a
+   scattered instance group are placed on the triangles of a surface
+   mesh on the device, and written directly to the build input of the
+   group BVH and to a per-member descriptor. Nothing is sent back to
+   the host; the same seed yields the same placement.
+*/
+
+#include "noerrors.h"
+
+// product of two affine transforms, stored as rows
+__device__ static float4x4 AffineProduct( const float4x4& a, const float4x4& b )
+{
+	float4x4 r;
+	r.A = a.A.x * b.A + a.A.y * b.B + a.A.z * b.C + a.A.w * b.D;
+	r.B = a.B.x * b.A + a.B.y * b.B + a.B.z * b.C + a.B.w * b.D;
+	r.C = a.C.x * b.A + a.C.y * b.B + a.C.z * b.C + a.C.w * b.D;
+	r.D = make_float4( 0, 0, 0, 1 );
+	return r;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  scatterKernel                                                              |
+//  |  One thread per member: pick a triangle proportional to its area, a point   |
+//  |  on it, a prototype, a scale and a rotation around the normal. Members      |
+//  |  rejected by the mask keep their slot, but are invisible and degenerate,    |
+//  |  so the member count is known on the host without a readback.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void scatterKernel( const ScatterJob job )
+{
+	const int idx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (idx >= job.count) return;
+	uint seed = WangHash( job.seed + idx * 9781 + 1 );
+	// triangle: binary search of the area cdf
+	const float r0 = RandomFloat( seed );
+	int lo = 0, hi = job.triangleCount - 1;
+	while (lo < hi)
+	{
+		const int mid = (lo + hi) >> 1;
+		if (job.cdf[mid] < r0) lo = mid + 1; else hi = mid;
+	}
+	// uniform point on the triangle
+	float u = RandomFloat( seed ), v = RandomFloat( seed );
+	if (u + v > 1) u = 1 - u, v = 1 - v;
+	const float3 v0 = make_float3( job.vertices[lo * 3 + 0] );
+	const float3 v1 = make_float3( job.vertices[lo * 3 + 1] );
+	const float3 v2 = make_float3( job.vertices[lo * 3 + 2] );
+	const float3 P = v0 + u * (v1 - v0) + v * (v2 - v0);
+	// density mask, sampled with the interpolated texture coordinates
+	bool keep = true;
+	if (job.mask)
+	{
+		const float2 t0 = job.uvs[lo * 3 + 0], t1 = job.uvs[lo * 3 + 1], t2 = job.uvs[lo * 3 + 2];
+		const float tu = t0.x + u * (t1.x - t0.x) + v * (t2.x - t0.x), tv = t0.y + u * (t1.y - t0.y) + v * (t2.y - t0.y);
+		const int x = min( job.maskSize.x - 1, (int)((tu - floorf( tu )) * job.maskSize.x) );
+		const int y = min( job.maskSize.y - 1, (int)((tv - floorf( tv )) * job.maskSize.y) );
+		keep = RandomFloat( seed ) < job.mask[x + y * job.maskSize.x];
+	}
+	const int proto = min( job.prototypeCount - 1, (int)(RandomFloat( seed ) * job.prototypeCount) );
+	const float s = keep ? (job.scale.x + RandomFloat( seed ) * (job.scale.y - job.scale.x)) : 0;
+	// frame: Y along the normal, X and Z rotated randomly around it
+	const float3 N = cross( v1 - v0, v2 - v0 );
+	const float3 Y = (job.align && dot( N, N ) > 0) ? normalize( N ) : make_float3( 0, 1, 0 );
+	const float3 T = normalize( cross( fabs( Y.x ) > 0.99f ? make_float3( 0, 0, 1 ) : make_float3( 1, 0, 0 ), Y ) );
+	const float3 B = cross( Y, T );
+	const float phi = TWOPI * RandomFloat( seed );
+	const float3 X = cosf( phi ) * T + sinf( phi ) * B, Z = cross( X, Y );
+	float4x4 M;
+	M.A = make_float4( s * X.x, s * Y.x, s * Z.x, P.x );
+	M.B = make_float4( s * X.y, s * Y.y, s * Z.y, P.y );
+	M.C = make_float4( s * X.z, s * Y.z, s * Z.z, P.z );
+	M.D = make_float4( 0, 0, 0, 1 );
+	// build input of the group BVH; instanceId is the offset of the member in the descriptors of a group instance
+	ScatterRecord& record = job.records[idx];
+	const float* m = (const float*)&M;
+	for (int i = 0; i < 12; i++) record.transform[i] = m[i];
+	record.instanceId = idx, record.sbtOffset = 0, record.flags = 0;
+	record.visibilityMask = keep ? 255 : 0;
+	record.traversableHandle = job.prototypes[proto].handle;
+	// member descriptor, combined with the transform of each group instance by layoutScatterKernel
+	CoreInstanceDesc& member = job.members[idx];
+	member.triangles = job.prototypes[proto].triangles;
+	member.packed = job.prototypes[proto].packed;
+	member.dummy2 = proto;
+	member.prevTransform = M;
+	const float is = keep ? 1 / s : 0;
+	member.invTransform.A = make_float4( is * X, -is * dot( X, P ) );
+	member.invTransform.B = make_float4( is * Y, -is * dot( Y, P ) );
+	member.invTransform.C = make_float4( is * Z, -is * dot( Z, P ) );
+	member.invTransform.D = make_float4( 0, 0, 0, 1 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  refreshScatterKernel                                                       |
+//  |  A prototype received a new BVH or new triangle buffers: point the members  |
+//  |  that use it at the current ones.                                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void refreshScatterKernel( ScatterRecord* records, CoreInstanceDesc* members, const ScatterPrototype* prototypes, const int count )
+{
+	const int idx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (idx >= count) return;
+	const ScatterPrototype& proto = prototypes[members[idx].dummy2];
+	records[idx].traversableHandle = proto.handle;
+	members[idx].triangles = proto.triangles;
+	members[idx].packed = proto.packed;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  layoutScatterKernel                                                        |
+//  |  Shading descriptors of the members of one instance of a scattered group,   |
+//  |  like RenderCore::LayoutGroupDescriptors does on the host for the other     |
+//  |  groups: the member transforms combined with the one of the instance. LH2'19|
+//  +-----------------------------------------------------------------------------+
+__global__ void layoutScatterKernel( const CoreInstanceDesc* members, const int count, const float4x4 T, const float4x4 invT, CoreInstanceDesc* descs )
+{
+	const int idx = threadIdx.x + blockIdx.x * blockDim.x;
+	if (idx >= count) return;
+	const CoreInstanceDesc& member = members[idx];
+	CoreInstanceDesc& desc = descs[idx];
+	desc.triangles = member.triangles;
+	desc.packed = member.packed;
+	desc.invTransform = AffineProduct( member.invTransform, invT );
+	desc.prevTransform = AffineProduct( T, member.prevTransform ); // group members have no motion vectors
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  scatterInstances / refreshScatter / layoutScatter                          |
+//  |  Host-side access points for the scatter kernels.                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+__host__ void scatterInstances( const ScatterJob& job, const cudaStream_t stream )
+{
+	scatterKernel<<<NEXTMULTIPLEOF( job.count, 128 ) / 128, 128, 0, stream>>>( job );
+}
+__host__ void refreshScatter( ScatterRecord* records, CoreInstanceDesc* members, const ScatterPrototype* prototypes, const int count, const cudaStream_t stream )
+{
+	refreshScatterKernel<<<NEXTMULTIPLEOF( count, 128 ) / 128, 128, 0, stream>>>( records, members, prototypes, count );
+}
+__host__ void layoutScatter( const CoreInstanceDesc* members, const int count, const float4x4& T, const float4x4& invT, CoreInstanceDesc* descs, const cudaStream_t stream )
+{
+	layoutScatterKernel<<<NEXTMULTIPLEOF( count, 128 ) / 128, 128, 0, stream>>>( members, count, T, invT, descs );
+}
+
+// EOF
@@ -15,6 +15,9 @@
 
 #include "core_settings.h"
 #include <optix_function_table_definition.h>
+#ifdef GGXCOMPENSATION
+#include "ggx_albedo.h"
+#endif
 
 namespace lh2core {
 
@@ -22,28 +25,80 @@ namespace lh2core {
 const surfaceReference* renderTargetRef();
 void finalizeRender( const float4* accumulator, const int w, const int h, const int spp, const float brightness, const float contrast );
 void shade( const int pathCount, float4* accumulator, const uint stride,
-	float4* pathStates, const float4* hits, float4* connections,
+	const float4* pathStatesIn, float4* pathStates, const float4* hits, float4* connections,
 	const uint R0, const uint* blueNoise, const int pass,
 	const int probePixelIdx, const int pathLength, const int w, const int h, const float spreadAngle,
-	const float3 p1, const float3 p2, const float3 p3, const float3 pos );
-void InitCountersForExtend( int pathCount );
-void InitCountersSubsequent();
+	const float3 p1, const float3 p2, const float3 p3, const float3 pos, const PathControl path, const int variant, const int persistentSMs,
+	const uint* classBins, const cudaStream_t stream );
+void SetFinalizeBlockSize( const int x, const int y );
+void SetFinalizeTarget( float4* p, const int firstRow );
+void finalizeHeatmap( const uint2* cost, const int rw, const int rh, const int w, const int h, const int component, const float scale );
+void packVideoFrame( const float4* pixels, uint* frame, const int pitch, const int w, const int h );
+void reprojectAccumulator( const float4* accumulator, const int spp, const float2* motion, const float* prevDepth,
+	const float4* prevFrame, const float4* prevHistory, const int prevSpp, float4* history, float4* frame,
+	const int w, const int h, const float maxHistory, const float depthTolerance );
+void upscale( const float4* accumulator, const int rw, const int rh, const int spp,
+	float4* pixels, float2* motion, const float2* hitMotion, const int w, const int h,
+	const float3 pos, const float3 p1, const float3 right, const float3 up,
+	const float3 prevPos, const float3 prevP1, const float3 prevRight, const float3 prevUp );
+void finalizeTAA( const float4* pixels, const float4* prevPixels, float4* history, const float2* motion,
+	const int w, const int h, const float brightness, const float contrast );
+void prepareDenoise( const float4* accumulator, const float4* guides, float4* layers,
+	const int w, const int h, const int spp, const float3 right, const float3 up, const float3 forward );
+void sortPaths( const int pathCount, const float4* pathStates, const float4* hits, uint* keys, uint* bins,
+	float4* sortedStates, float4* sortedHits, const uint stride, const int pathLength, const int packedStates, const cudaStream_t stream );
+void primaryFromVisibility( const uint4* visibility, float4* pathStates, float4* hits, const int w, const int h,
+	const float3 pos, const float3 p1, const float3 right, const float3 up, const cudaStream_t stream );
+void InitCountersForExtend( int pathCount, const cudaStream_t stream );
+void InitCountersSubsequent( const cudaStream_t stream );
+void ResetShadowRays( const cudaStream_t stream );
 
 // setters / getters
 void SetInstanceDescriptors( CoreInstanceDesc* p );
 void SetMaterialList( CoreMaterial* p );
+void SetMaterialClasses( uint* p );
+#ifdef SHADECOST
+void SetMaterialCosts( CoreMaterialCost* p );
+#endif
 void SetAreaLights( CoreLightTri* p );
 void SetPointLights( CorePointLight* p );
 void SetSpotLights( CoreSpotLight* p );
 void SetDirectionalLights( CoreDirectionalLight* p );
+void SetLightTreeNodes( CoreLightTreeNode* p );
+void SetLightAliasEntries( CoreLightAlias* p );
 void SetLightCounts( int area, int point, int spot, int directional );
 void SetARGB32Pixels( uint* p );
 void SetARGB128Pixels( float4* p );
 void SetNRM32Pixels( uint* p );
-void SetSkyPixels( float3* p );
-void SetSkySize( int w, int h );
+#ifdef VIRTUALTEXTURES
+void SetARGB32Pages( uint2* p, uint* u );
+void SetNRM32Pages( uint2* p, uint* u );
+#endif
+#ifdef BCTEXTURES
+void SetBCPixels( uint2* p1, uint4* p5 );
+#endif
+#ifdef HWTEXTURES
+void SetTextureObjects( cudaTextureObject_t* p );
+#endif
+void SetSkyPixels( uint2* p );
+void SetSkySize( int w, int h, int levels );
+void SetSkyCDF( float* p, int w, int h );
 void SetPathStates( PathState* p );
 void SetDebugData( float4* p );
+void SetDenoiseGuides( float4* p );
+void SetRadianceCache( const RadianceCache& c );
+void decayRadianceCache( const uint slots, const cudaStream_t stream );
+void scatterInstances( const ScatterJob& job, const cudaStream_t stream );
+void refreshScatter( ScatterRecord* records, CoreInstanceDesc* members, const ScatterPrototype* prototypes, const int count, const cudaStream_t stream );
+void layoutScatter( const CoreInstanceDesc* members, const int count, const float4x4& T, const float4x4& invT, CoreInstanceDesc* descs, const cudaStream_t stream );
+void SetReSTIR( const ReSTIRControl& c, const cudaStream_t stream );
+void SetHitMotion( const MotionControl& c, const cudaStream_t stream );
+void SetPathGuide( const PathGuide& g );
+void SetProbes( const ProbeControl& p, const cudaStream_t stream );
+#ifdef GGXCOMPENSATION
+void SetGGXAlbedo( const cudaTextureObject_t t );
+#endif
+void mergePathGuide( const uint slots, const cudaStream_t stream );
 void SetGeometryEpsilon( float e );
 void SetClampValue( float c );
 void SetCounters( Counters* p );
@@ -108,6 +163,297 @@ void RenderCore::SetProbePos( int2 pos )
 	probePos = pos; // triangle id for this pixel will be stored in coreStats
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetProbePositions                                              |
+//  |  Set the pixels for which the primary hits are captured each frame.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetProbePositions( const int2* pos, const int count )
+{
+	probePositions.assign( pos, pos + min( count, MAXPROBES ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::GetProbeResults                                                |
+//  |  Converts the newest probe results that arrived on the host. Polls the      |
+//  |  events of the readback ring; never blocks.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderCore::GetProbeResults( CoreRayHit* hits )
+{
+	const ProbeReadback* newest = 0;
+	for (int i = 0; i < PROBERING; i++)
+	{
+		const ProbeReadback& slot = probeRing[i];
+		if (slot.frame < 0 || (newest && slot.frame < newest->frame)) continue;
+		if (cudaEventQuery( slot.done ) == cudaSuccess) newest = &slot;
+	}
+	if (!newest) return 0;
+	const float4* hitData = newest->results->HostPtr();
+	for (int i = 0; i < newest->count; i++)
+	{
+		// instance in x, primitive in y, distance in z; all bits set for probes outside the rendered band
+		const int instid = *(const int*)&hitData[i].x, triid = *(const int*)&hitData[i].y;
+		if (triid == NOHIT) hits[i].instid = hits[i].triid = -1, hits[i].t = 1e34f;
+		else hits[i].instid = instid, hits[i].triid = triid, hits[i].t = hitData[i].z;
+	}
+	return newest->count;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::GetMaterialCosts                                               |
+//  |  Instrumentation builds (SHADECOST): copies the shading cost per material   |
+//  |  that the shade kernels accumulated since the previous call, and resets     |
+//  |  it. Waits for the device. Returns 0 in regular builds.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderCore::GetMaterialCosts( CoreMaterialCost* costs, const int count )
+{
+#ifdef SHADECOST
+	if (!materialCostBuffer) return 0;
+	CHK_CUDA( cudaDeviceSynchronize() );
+	const int n = min( count, (int)materialCostBuffer->GetSize() );
+	memcpy( costs, materialCostBuffer->CopyToHost(), n * sizeof( CoreMaterialCost ) );
+	materialCostBuffer->Clear( ON_DEVICE );
+	return n;
+#else
+	return 0;
+#endif
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetFrameReadback                                               |
+//  |  Enable or disable the copy of finished frames to host memory. Disabling    |
+//  |  waits for copies in flight and frees the pinned buffers.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::SetFrameReadback( const bool enable )
+{
+	readbackEnabled = enable;
+	if (!enable)
+	{
+		cudaStreamSynchronize( readbackStream );
+		for (int i = 0; i < READBACKRING; i++)
+		{
+			FrameReadback& slot = readbackRing[i];
+			if (slot.pixels) cudaFreeHost( slot.pixels );
+			slot.pixels = 0, slot.capacity = 0, slot.frame = -1;
+		}
+	}
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::GetReadbackFrame                                               |
+//  |  Hands out the oldest frame in the readback ring. Slots are filled in frame |
+//  |  order, so the oldest frame arrives first. Polls its event, unless wait is  |
+//  |  set. The slot is free afterwards; its pixels stay valid until the next     |
+//  |  frame is read back into it.                                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderCore::GetReadbackFrame( const float4** pixels, int& width, int& height, const bool wait )
+{
+	FrameReadback* oldest = 0;
+	for (int i = 0; i < READBACKRING; i++)
+	{
+		FrameReadback& slot = readbackRing[i];
+		if (slot.frame >= 0 && (!oldest || slot.frame < oldest->frame)) oldest = &slot;
+	}
+	if (!oldest) return -1;
+	if (wait) cudaEventSynchronize( oldest->done );
+	else if (cudaEventQuery( oldest->done ) != cudaSuccess) return -1;
+	*pixels = oldest->pixels, width = oldest->width, height = oldest->height;
+	const int frame = oldest->frame;
+	oldest->frame = -1;
+	return frame;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ReadbackFrame                                                  |
+//  |  Copies the finished frame to the next slot of the readback ring, on the    |
+//  |  readback stream, once the render stream passed finalize: from the mapped   |
+//  |  array of the render target, or from the host or video target. The frame    |
+//  |  that last used the slot is dropped if it was not obtained yet. Call while  |
+//  |  the render target is bound; it must be unbound on readbackStream.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::ReadbackFrame( InteropTexture& target )
+{
+	FrameReadback& slot = readbackRing[readbackFrame % READBACKRING];
+	cudaEventSynchronize( slot.done ); // READBACKRING - 1 frames old: normally complete
+	const size_t pixelCount = (size_t)scrwidth * scrheight, pitch = scrwidth * sizeof( float4 );
+	if (pixelCount > slot.capacity)
+	{
+		if (slot.pixels) cudaFreeHost( slot.pixels );
+		CHK_CUDA( cudaMallocHost( (void**)&slot.pixels, pixelCount * sizeof( float4 ) ) );
+		slot.capacity = pixelCount;
+	}
+	slot.width = scrwidth, slot.height = scrheight;
+	cudaEventRecord( readbackReady, 0 );
+	cudaStreamWaitEvent( readbackStream, readbackReady, 0 );
+	if (HeadlessTarget()) cudaMemcpyAsync( slot.pixels, HeadlessTarget(), pixelCount * sizeof( float4 ), cudaMemcpyDeviceToHost, readbackStream );
+	else cudaMemcpy2DFromArrayAsync( slot.pixels, pitch, target.GetArray(), 0, 0, pitch, scrheight, cudaMemcpyDeviceToHost, readbackStream );
+	cudaEventRecord( slot.done, readbackStream );
+	slot.frame = readbackFrame++;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SaveCheckpoint                                                 |
+//  |  Snapshot the accumulation state to a file, for LoadCheckpoint. The copy of |
+//  |  the accumulator, and of the denoiser guides, is queued on the readback     |
+//  |  stream behind the last frame; a job writes the file once it arrived. The   |
+//  |  render stream and the caller do not wait. Returns false while the previous |
+//  |  checkpoint is being written, or if the accumulator holds no full frame.    |
+//  |                                                                       LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::SaveCheckpoint( const char* file )
+{
+	if (!checkpointWritten.Finished() || samplesTaken == 0) return false;
+	// bands and dynamic resolution accumulate less than the full target
+	const bool banded = tileRows > 0 || renderBand.x > 0 || renderBand.y < 1;
+	if (banded || renderWidth != scrwidth || renderHeight != scrheight) return false;
+	const size_t pixelCount = (size_t)scrwidth * scrheight, size = pixelCount * (guideBuffer ? 3 : 1);
+	if (size > checkpointCapacity)
+	{
+		if (checkpointPixels) cudaFreeHost( checkpointPixels );
+		CHK_CUDA( cudaMallocHost( (void**)&checkpointPixels, size * sizeof( float4 ) ) );
+		checkpointCapacity = size;
+	}
+	const CheckpointHeader header = { CHECKPOINTVERSION, scrwidth, scrheight, scrspp, samplesTaken, camRNGseed, guideBuffer ? 1 : 0 };
+	cudaEventRecord( readbackReady, 0 );
+	cudaStreamWaitEvent( readbackStream, readbackReady, 0 );
+	cudaMemcpyAsync( checkpointPixels, accumulator->DevPtr(), pixelCount * sizeof( float4 ), cudaMemcpyDeviceToHost, readbackStream );
+	if (guideBuffer) cudaMemcpyAsync( checkpointPixels + pixelCount, guideBuffer->DevPtr(), pixelCount * 2 * sizeof( float4 ), cudaMemcpyDeviceToHost, readbackStream );
+	cudaEventRecord( checkpointCopied, readbackStream );
+	const string fileName = file;
+	const int device = cudaDevice;
+	JobSystem::Submit( [this, header, fileName, size, device]() {
+		cudaSetDevice( device ); // device selection is per thread
+		cudaEventSynchronize( checkpointCopied );
+		FILE* f;
+		fopen_s( &f, fileName.c_str(), "wb" );
+		if (!f) { printf( "optix7: could not write checkpoint %s\n", fileName.c_str() ); return; }
+		fwrite( &header, sizeof( header ), 1, f );
+		fwrite( checkpointPixels, sizeof( float4 ), size, f );
+		fclose( f );
+	}, &checkpointWritten );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::LoadCheckpoint                                                 |
+//  |  Restore the accumulation state of SaveCheckpoint. The next frame continues |
+//  |  from it if it converges; the scene and view must be those of the saved     |
+//  |  frames. Returns false if the file was saved for a different target size    |
+//  |  or denoiser setting; the spp of the frames may differ.               LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::LoadCheckpoint( const char* file )
+{
+	checkpointWritten.Wait(); // the file may be the one that is being written
+	FILE* f;
+	fopen_s( &f, file, "rb" );
+	if (!f) return false;
+	CheckpointHeader header;
+	bool valid = fread( &header, sizeof( header ), 1, f ) == 1 && header.version == CHECKPOINTVERSION &&
+		header.width == scrwidth && header.height == scrheight && header.guides == (useDenoiser ? 1 : 0);
+	const size_t pixelCount = (size_t)scrwidth * scrheight;
+	vector<float4> data;
+	if (valid)
+	{
+		data.resize( pixelCount * (header.guides ? 3 : 1) );
+		valid = fread( data.data(), sizeof( float4 ), data.size(), f ) == data.size();
+	}
+	fclose( f );
+	if (!valid || !accumulator || pixelCount > (size_t)maxPixels) return false;
+	if (header.guides && !guideBuffer) CreateDenoiseGuides();
+	accumulator->Clear( ON_DEVICE );
+	CHK_CUDA( cudaMemcpy( accumulator->DevPtr(), data.data(), pixelCount * sizeof( float4 ), cudaMemcpyHostToDevice ) );
+	if (header.guides) CHK_CUDA( cudaMemcpy( guideBuffer->DevPtr(), data.data() + pixelCount, pixelCount * 2 * sizeof( float4 ), cudaMemcpyHostToDevice ) );
+	samplesTaken = header.samplesTaken;
+	camRNGseed = header.camRNGseed;
+	renderWidth = scrwidth, renderHeight = scrheight; // so the next frame does not count as resized
+	firstConvergingFrame = false;
+	return true;
+}
+
+#ifdef GGXCOMPENSATION
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::CreateGGXAlbedo                                                |
+//  |  Uploads the directional albedo of the GGX specular lobe to a linear        |
+//  |  filtered texture, for multiscatter energy compensation in the BSDF. Done   |
+//  |  once; the table does not depend on the scene.                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::CreateGGXAlbedo()
+{
+	const cudaChannelFormatDesc format = cudaCreateChannelDesc<float>();
+	CHK_CUDA( cudaMallocArray( &ggxAlbedoArray, &format, GGXALBEDORES, GGXALBEDORES ) );
+	const size_t pitch = GGXALBEDORES * sizeof( float );
+	CHK_CUDA( cudaMemcpy2DToArray( ggxAlbedoArray, 0, 0, ggxAlbedoTable, pitch, pitch, GGXALBEDORES, cudaMemcpyHostToDevice ) );
+	cudaResourceDesc resource;
+	memset( &resource, 0, sizeof( resource ) );
+	resource.resType = cudaResourceTypeArray;
+	resource.res.array.array = ggxAlbedoArray;
+	cudaTextureDesc desc;
+	memset( &desc, 0, sizeof( desc ) );
+	desc.addressMode[0] = desc.addressMode[1] = cudaAddressModeClamp;
+	desc.filterMode = cudaFilterModeLinear;
+	desc.readMode = cudaReadModeElementType;
+	desc.normalizedCoords = 1; // (cos theta, alpha) in [0..1]
+	CHK_CUDA( cudaCreateTextureObject( &ggxAlbedoTexture, &resource, &desc, 0 ) );
+	SetGGXAlbedo( ggxAlbedoTexture );
+}
+#endif
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::CreateDenoiseGuides                                            |
+//  |  Allocate the guide layers that the shade kernel accumulates for the        |
+//  |  denoiser, and the denoiser in- and output.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::CreateDenoiseGuides()
+{
+	guideBuffer = new CoreBuffer<float4>( maxPixels * 2, ON_DEVICE, 0, VRAMFrameBuffers );
+	transients.Declare( denoiseLayers, maxPixels * 4, POSTPROCESS, POSTPROCESS );
+	PlaceTransients();
+	SetDenoiseGuides( guideBuffer->DevPtr() );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::QueryRays                                                      |
+//  |  Queues rays for TraceRayQueries; the rays of all queries submitted before  |
+//  |  a frame are traced in a single launch.                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderCore::QueryRays( const float3* origins, const float3* directions, const int count )
+{
+	for (int i = 0; i < count; i++)
+	{
+		queryOrigins.push_back( make_float4( origins[i], 0 ) );
+		queryDirections.push_back( make_float4( normalize( directions[i] ), 0 ) );
+	}
+	queryEnds.push_back( (int)queryOrigins.size() );
+	return nextQueryTicket++;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::GetRayQueryResults                                             |
+//  |  Converts the hit data of a traced query to CoreRayHits, if its batch has   |
+//  |  arrived on the host. Polls the event of the batch; never blocks.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderCore::GetRayQueryResults( const int ticket, CoreRayHit* hits )
+{
+	for (int i = 0; i < RAYQUERYRING; i++)
+	{
+		const RayQueryBatch& batch = queryBatches[i];
+		if (batch.firstTicket < 0 || ticket < batch.firstTicket || ticket >= batch.firstTicket + (int)batch.ends.size()) continue;
+		if (cudaEventQuery( batch.done ) != cudaSuccess) return RAYQUERY_PENDING;
+		const int query = ticket - batch.firstTicket, first = query > 0 ? batch.ends[query - 1] : 0;
+		const float4* hitData = batch.hits->HostPtr();
+		for (int j = first; j < batch.ends[query]; j++)
+		{
+			// same layout as the hits of extension rays: instance in y, primitive in z, distance in w
+			const int instid = *(const int*)&hitData[j].y, triid = *(const int*)&hitData[j].z;
+			if (triid == NOHIT) hits[j - first].instid = hits[j - first].triid = -1, hits[j - first].t = 1e34f;
+			else hits[j - first].instid = instid, hits[j - first].triid = triid, hits[j - first].t = hitData[j].w;
+		}
+		return RAYQUERY_DONE;
+	}
+	// not in a traced batch: queued for the next frame, or overwritten
+	return (ticket < nextQueryTicket && ticket >= nextQueryTicket - (int)queryEnds.size()) ? RAYQUERY_PENDING : RAYQUERY_EXPIRED;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::CreateOptixContext                                             |
 //  |  Optix 7 initialization.                                              LH2'19|
@@ -118,6 +464,7 @@ static void context_log_cb( unsigned int level, const char* tag, const char* mes
 }
 void RenderCore::CreateOptixContext( int cc )
 {
+	Timer timer;
 	// prepare the optix context
 	cudaFree( 0 );
 	CUcontext cu_ctx = 0; // zero means take the current context
@@ -127,6 +474,31 @@ void RenderCore::CreateOptixContext( int cc )
 	contextOptions.logCallbackLevel = 4;
 	CHK_OPTIX( optixDeviceContextCreate( cu_ctx, &contextOptions, &optixContext ) );
 	cudaMalloc( (void**)(&d_params), sizeof( Params ) );
+	cudaMallocHost( (void**)(&pinnedParams), (MAXPATHLENGTH + 2) * sizeof( Params ) );
+
+	// compiled modules are cached on disk; OptiX keys the cache on the PTX and the compile options
+	if (optixDeviceContextSetCacheLocation( optixContext, "../../lib/RenderCore_Optix7/optix/cache" ) != OPTIX_SUCCESS)
+		printf( "optix7: could not use the module cache folder; using the default location.\n" );
+	CHK_OPTIX( optixDeviceContextSetCacheEnabled( optixContext, 1 ) );
+	printf( "optix7 startup: context %.1fms\n", timer.elapsed() * 1000 );
+
+	// compile the module and build the pipeline in the background; the application loads its scene
+	// meanwhile. Render waits for pipelineReady.
+	const int device = cudaDevice;
+	JobSystem::Submit( [this, cc, device]() {
+		cudaSetDevice( device ); // device selection is per thread
+		CreatePipeline( cc );
+	}, &pipelineReady );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::CreatePipeline                                                 |
+//  |  Load or compile the PTX, and create the module, program groups, pipeline   |
+//  |  and shader binding table. Runs as a job, see CreateOptixContext.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::CreatePipeline( int cc )
+{
+	Timer timer;
 
 	// load and compile PTX
 	string ptx;
@@ -152,6 +524,7 @@ void RenderCore::CreateOptixContext( int cc )
 		ptx = string( t );
 		delete t;
 	}
+	const float ptxTime = timer.elapsed();
 
 	// create the optix module
 	OptixModuleCompileOptions module_compile_options = {};
@@ -159,8 +532,12 @@ void RenderCore::CreateOptixContext( int cc )
 	module_compile_options.optLevel = OPTIX_COMPILE_OPTIMIZATION_DEFAULT;
 	module_compile_options.debugLevel = OPTIX_COMPILE_DEBUG_LEVEL_LINEINFO;
 	OptixPipelineCompileOptions pipeCompileOptions = {};
+#ifdef MOTIONBLUR
+	pipeCompileOptions.usesMotionBlur = true;
+#else
 	pipeCompileOptions.usesMotionBlur = false;
-	pipeCompileOptions.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING;
+#endif
+	pipeCompileOptions.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_ANY; // instance groups nest an IAS
 	pipeCompileOptions.numPayloadValues = 4;
 	pipeCompileOptions.numAttributeValues = 2;
 	pipeCompileOptions.exceptionFlags = OPTIX_EXCEPTION_FLAG_NONE;
@@ -169,6 +546,7 @@ void RenderCore::CreateOptixContext( int cc )
 	size_t logSize = sizeof( log );
 	CHK_OPTIX_LOG( optixModuleCreateFromPTX( optixContext, &module_compile_options, &pipeCompileOptions,
 		ptx.c_str(), ptx.size(), log, &logSize, &ptxModule ) );
+	const float moduleTime = timer.elapsed();
 
 	// create program groups
 	OptixProgramGroupOptions groupOptions = {};
@@ -198,6 +576,19 @@ void RenderCore::CreateOptixContext( int cc )
 	group.hitgroup.entryFunctionNameCH = nullptr; // NULL hit program for shadow rays
 	logSize = sizeof( log );
 	CHK_OPTIX_LOG( optixProgramGroupCreate( optixContext, &group, 1, &groupOptions, log, &logSize, &progGroup[OCC_HIT] ) );
+#ifdef ANYHITALPHA
+	// hit groups for the second SBT record of meshes with alpha tested triangles, see CoreMesh::BuildAccel
+	group.hitgroup.moduleAH = ptxModule;
+	group.hitgroup.entryFunctionNameAH = "__anyhit__alpha";
+	group.hitgroup.moduleCH = ptxModule;
+	group.hitgroup.entryFunctionNameCH = "__closesthit__radiance";
+	logSize = sizeof( log );
+	CHK_OPTIX_LOG( optixProgramGroupCreate( optixContext, &group, 1, &groupOptions, log, &logSize, &progGroup[RAD_HIT_ALPHA] ) );
+	group.hitgroup.moduleCH = nullptr;
+	group.hitgroup.entryFunctionNameCH = nullptr;
+	logSize = sizeof( log );
+	CHK_OPTIX_LOG( optixProgramGroupCreate( optixContext, &group, 1, &groupOptions, log, &logSize, &progGroup[OCC_HIT_ALPHA] ) );
+#endif
 
 	// create the pipeline
 	OptixPipelineLinkOptions linkOptions = {};
@@ -205,22 +596,52 @@ void RenderCore::CreateOptixContext( int cc )
 	linkOptions.debugLevel = OPTIX_COMPILE_DEBUG_LEVEL_NONE;
 	linkOptions.overrideUsesMotionBlur = false;
 	logSize = sizeof( log );
-	CHK_OPTIX_LOG( optixPipelineCreate( optixContext, &pipeCompileOptions, &linkOptions, progGroup, 5, log, &logSize, &pipeline ) );
+	CHK_OPTIX_LOG( optixPipelineCreate( optixContext, &pipeCompileOptions, &linkOptions, progGroup, PROGRAMGROUPS, log, &logSize, &pipeline ) );
 	// calculate the stack sizes, so we can specify all parameters to optixPipelineSetStackSize
 	OptixStackSizes stack_sizes = {};
-	for (int i = 0; i < 5; i++) optixUtilAccumulateStackSizes( progGroup[i], &stack_sizes );
+	for (int i = 0; i < PROGRAMGROUPS; i++) optixUtilAccumulateStackSizes( progGroup[i], &stack_sizes );
 	uint32_t ss0, ss1, ss2;
 	CHK_OPTIX( optixUtilComputeStackSizes( &stack_sizes, 1, 0, 0, &ss0, &ss1, &ss2 ) );
-	CHK_OPTIX( optixPipelineSetStackSize( pipeline, ss0, ss1, ss2, 2 ) );
+	CHK_OPTIX( optixPipelineSetStackSize( pipeline, ss0, ss1, ss2, 3 /* IAS, group IAS, GAS */ ) );
 
 	// create the shader binding table
-	SBTRecord rsbt[5] = {}; // , ms_sbt[2], hg_sbt[2];
-	for( int i = 0; i < 5; i++ ) optixSbtRecordPackHeader( progGroup[i], &rsbt[i] );
+	SBTRecord rsbt[PROGRAMGROUPS] = {}; // raygen, two miss records, hit groups
+	for( int i = 0; i < PROGRAMGROUPS; i++ ) optixSbtRecordPackHeader( progGroup[i], &rsbt[i] );
 	sbt.raygenRecord = (CUdeviceptr)(new CoreBuffer<SBTRecord>( 1, ON_DEVICE, &rsbt[0] ))->DevPtr();
 	sbt.missRecordBase = (CUdeviceptr)(new CoreBuffer<SBTRecord>( 2, ON_DEVICE, &rsbt[1] ))->DevPtr();
-	sbt.hitgroupRecordBase = (CUdeviceptr)(new CoreBuffer<SBTRecord>( 2, ON_DEVICE, &rsbt[3] ))->DevPtr();
+	// hit groups: radiance and occlusion per SBT record of a mesh; rays select one with SBT offset 0 or 1
+	sbt.hitgroupRecordBase = (CUdeviceptr)(new CoreBuffer<SBTRecord>( PROGRAMGROUPS - RAD_HIT, ON_DEVICE, &rsbt[RAD_HIT] ))->DevPtr();
 	sbt.missRecordStrideInBytes = sbt.hitgroupRecordStrideInBytes = sizeof( SBTRecord );
-	sbt.missRecordCount = sbt.hitgroupRecordCount = 2;
+	sbt.missRecordCount = 2;
+	sbt.hitgroupRecordCount = PROGRAMGROUPS - RAD_HIT;
+
+	// optional second pipeline: a raygen program that traces and shades all segments of a path itself,
+	// sharing the hit and miss programs. Only created if the module provides it; see the "megakernel" setting.
+	if (ptx.find( "__raygen__megakernel" ) != string::npos)
+	{
+		group = {};
+		group.kind = OPTIX_PROGRAM_GROUP_KIND_RAYGEN;
+		group.raygen.module = ptxModule;
+		group.raygen.entryFunctionName = "__raygen__megakernel";
+		logSize = sizeof( log );
+		CHK_OPTIX_LOG( optixProgramGroupCreate( optixContext, &group, 1, &groupOptions, log, &logSize, &megaRaygen ) );
+		OptixProgramGroup megaGroups[PROGRAMGROUPS];
+		memcpy( megaGroups, progGroup, sizeof( progGroup ) );
+		megaGroups[RAYGEN] = megaRaygen;
+		logSize = sizeof( log );
+		CHK_OPTIX_LOG( optixPipelineCreate( optixContext, &pipeCompileOptions, &linkOptions, megaGroups, PROGRAMGROUPS, log, &logSize, &megaPipeline ) );
+		stack_sizes = {};
+		for (int i = 0; i < PROGRAMGROUPS; i++) optixUtilAccumulateStackSizes( megaGroups[i], &stack_sizes );
+		CHK_OPTIX( optixUtilComputeStackSizes( &stack_sizes, 1, 0, 0, &ss0, &ss1, &ss2 ) );
+		CHK_OPTIX( optixPipelineSetStackSize( megaPipeline, ss0, ss1, ss2, 3 ) );
+		SBTRecord megaRecord = {};
+		optixSbtRecordPackHeader( megaRaygen, &megaRecord );
+		megaSbt = sbt;
+		megaSbt.raygenRecord = (CUdeviceptr)(new CoreBuffer<SBTRecord>( 1, ON_DEVICE, &megaRecord ))->DevPtr();
+		// shader execution reordering compiles to a call of this intrinsic; see TraceReordered
+		reorderSupported = ptx.find( "_optix_reorder" ) != string::npos;
+	}
+	printf( "optix7 startup: ptx %.1fms, module %.1fms, pipeline %.1fms\n", ptxTime * 1000, (moduleTime - ptxTime) * 1000, (timer.elapsed() - moduleTime) * 1000 );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -230,7 +651,8 @@ void RenderCore::CreateOptixContext( int cc )
 void RenderCore::Init()
 {
 	// select the fastest device
-	uint device = CUDATools::FastestDevice();
+	Timer timer;
+	uint device = cudaDevice = CUDATools::FastestDevice();
 	cudaSetDevice( device );
 	cudaDeviceProp properties;
 	cudaGetDeviceProperties( &properties, device );
@@ -260,8 +682,12 @@ void RenderCore::Init()
 	blueNoise = new CoreBuffer<uint>( 65536 * 5, ON_DEVICE, data32 );
 	params.blueNoise = blueNoise->DevPtr();
 	delete data32;
+#ifdef GGXCOMPENSATION
+	// upload the energy compensation table for the specular lobe
+	CreateGGXAlbedo();
+#endif
 	// preallocate optix instance descriptor array
-	instanceArray = new CoreBuffer<OptixInstance>( 16 /* will grow if needed */, ON_HOST | ON_DEVICE );
+	instanceArray = new CoreBuffer<OptixInstance>( 16 /* will grow if needed */, ON_HOST | ON_DEVICE, 0, VRAMScene );
 	// allow CoreMeshes to access the core
 	CoreMesh::renderCore = this;
 	// prepare timing events
@@ -271,9 +697,43 @@ void RenderCore::Init()
 		cudaEventCreate( &shadeEnd[i] );
 		cudaEventCreate( &traceStart[i] );
 		cudaEventCreate( &traceEnd[i] );
+		cudaEventCreate( &sortStart[i] );
+		cudaEventCreate( &sortEnd[i] );
 	}
 	cudaEventCreate( &shadowStart );
 	cudaEventCreate( &shadowEnd );
+	cudaEventCreate( &finalizeStart );
+	cudaEventCreate( &finalizeEnd );
+	cudaEventCreate( &denoiseStart );
+	cudaEventCreate( &denoiseEnd );
+	cudaEventCreate( &frameStart );
+	cudaEventCreate( &topStart );
+	// kernel launch configurations for this GPU
+	LoadLaunchConfig();
+	// stream for the wavefront loop; a blocking stream, so it synchronizes with the legacy stream
+	cudaStreamCreate( &renderStream );
+	// stream for scene updates. This is a blocking stream so that builds are ordered after
+	// synchronous uploads on the legacy stream; rendering waits for the updateDone event.
+	cudaStreamCreate( &updateStream );
+	cudaEventCreateWithFlags( &updateDone, cudaEventDisableTiming );
+	for (int i = 0; i < RAYQUERYRING; i++) cudaEventCreateWithFlags( &queryBatches[i].done, cudaEventDisableTiming );
+	for (int i = 0; i < PROBERING; i++) cudaEventCreateWithFlags( &probeRing[i].done, cudaEventDisableTiming );
+	// frame readback copies run on a non-blocking stream, so the next frame does not wait for them
+	cudaStreamCreateWithFlags( &readbackStream, cudaStreamNonBlocking );
+	cudaEventCreateWithFlags( &readbackReady, cudaEventDisableTiming );
+	for (int i = 0; i < READBACKRING; i++) cudaEventCreateWithFlags( &readbackRing[i].done, cudaEventDisableTiming );
+	cudaEventCreateWithFlags( &checkpointCopied, cudaEventDisableTiming );
+	// background mesh builds: a non-blocking stream, so synchronous uploads do not wait for them, at the
+	// lowest priority, so they yield to the frame
+	int leastPriority, greatestPriority;
+	cudaDeviceGetStreamPriorityRange( &leastPriority, &greatestPriority );
+	cudaStreamCreateWithPriority( &buildStream, cudaStreamNonBlocking, leastPriority );
+	cudaEventCreateWithFlags( &topRebuildStart, cudaEventDisableTiming );
+	cudaEventCreateWithFlags( &topRebuildDone, cudaEventDisableTiming );
+	// scene data uploads go through a pinned staging ring on their own copy stream
+	cudaStreamCreate( &copyStream );
+	stagingRing = new StagingRing( 32 << 20, copyStream );
+	printf( "optix7 startup: Init %.1fms (pipeline creation continues in the background)\n", timer.elapsed() * 1000 );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -281,60 +741,322 @@ void RenderCore::Init()
 //  |  Set the OpenGL texture that serves as the render target.             LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetTarget( GLTexture* target, const uint spp )
+{
+	SetTargets( &target, 1, spp );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTargets                                                     |
+//  |  Set a ring of OpenGL textures that serve as render targets. Each frame is  |
+//  |  finalized into the next texture, so the application can present the last   |
+//  |  completed one while the core renders. All targets must have the same       |
+//  |  size.                                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTargets( GLTexture** targets, const int count, const uint spp )
 {
 	// synchronize OpenGL viewport
-	scrwidth = target->width;
-	scrheight = target->height;
+	assert( count > 0 && count <= MAXTARGETS );
+	ReleaseHostTarget();
+	ReleaseVideoTarget();
+	targetCount = min( count, MAXTARGETS );
+	currentTarget = presentTarget = 0;
+	// notify CUDA about the textures
+	for (int i = 0; i < targetCount; i++)
+	{
+		renderTargets[i].SetTexture( targets[i] );
+		renderTargets[i].LinkToSurface( renderTargetRef() );
+	}
+	ResizeTarget( targets[0]->width, targets[0]->height, spp );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetHostTarget                                                  |
+//  |  Headless rendering: finalize each frame into host memory. The memory is    |
+//  |  registered as mapped pinned memory, so finalizeRenderKernel writes it      |
+//  |  directly; no OpenGL context is needed.                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetHostTarget( float4* pixels, const int width, const int height, const uint spp )
+{
+	ReleaseHostTarget();
+	ReleaseVideoTarget();
+	CHK_CUDA( cudaHostRegister( pixels, width * height * sizeof( float4 ), cudaHostRegisterMapped ) );
+	CHK_CUDA( cudaHostGetDevicePointer( (void**)&hostTargetDevPtr, pixels, 0 ) );
+	hostTarget = pixels;
+	targetCount = 1;
+	currentTarget = presentTarget = 0;
+	ResizeTarget( width, height, spp );
+}
+void RenderCore::ReleaseHostTarget()
+{
+	if (!hostTarget) return;
+	cudaDeviceSynchronize(); // the last frame may still be writing to it
+	cudaHostUnregister( hostTarget );
+	hostTarget = hostTargetDevPtr = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetVideoTarget                                                 |
+//  |  Headless rendering for streaming: frames are finalized into device memory, |
+//  |  packed to RGBA8 and encoded by NVENC, which reads them in place. Returns   |
+//  |  false if NVENC is not available; the previous target is released anyway.   |
+//  |  Frames have the size in desc.                                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::SetVideoTarget( const VideoTargetDesc& desc, const uint spp )
+{
+	ReleaseHostTarget();
+	ReleaseVideoTarget();
+	videoEncoder = new VideoEncoder();
+	if (!videoEncoder->Init( desc ))
+	{
+		delete videoEncoder;
+		videoEncoder = 0;
+		return false;
+	}
+	videoFrame = new CoreBuffer<float4>( desc.width * desc.height, ON_DEVICE );
+	videoKeyFrame = false;
+	targetCount = 1;
+	currentTarget = presentTarget = 0;
+	ResizeTarget( desc.width, desc.height, spp );
+	return true;
+}
+void RenderCore::ReleaseVideoTarget()
+{
+	if (!videoEncoder) return;
+	cudaDeviceSynchronize(); // the readback of the last frame may still be reading videoFrame
+	delete videoEncoder;
+	delete videoFrame;
+	videoEncoder = 0, videoFrame = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetVisibilityBuffer                                            |
+//  |  Hybrid rendering: from the next frame on, the first wavefront iteration    |
+//  |  takes its hits from a visibility buffer that the application rasterized,   |
+//  |  see primaryFromVisibilityKernel, instead of tracing primary rays. Only     |
+//  |  frames that match the buffer use it: 1 spp, a pinhole camera, no band,     |
+//  |  and an internal resolution of the size of the buffer. Other frames trace   |
+//  |  their primary rays as usual.                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetVisibilityBuffer( GLTexture* visibility )
+{
+	if (visibilityResource)
+	{
+		CHK_CUDA( cudaGraphicsUnregisterResource( visibilityResource ) );
+		visibilityResource = 0;
+	}
+	if (!visibility)
+	{
+		delete visibilityBuffer, visibilityBuffer = 0;
+		return;
+	}
+	// read-only registration: CUDA never writes to the texture, so OpenGL keeps its contents when mapping
+	CHK_CUDA( cudaGraphicsGLRegisterImage( &visibilityResource, visibility->ID, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsReadOnly ) );
+	visibilitySize = make_int2( visibility->width, visibility->height );
+	const int pixels = visibility->width * visibility->height;
+	if (!visibilityBuffer || visibilityBuffer->GetSize() < pixels)
+	{
+		delete visibilityBuffer;
+		visibilityBuffer = new CoreBuffer<uint4>( pixels, ON_DEVICE, 0, VRAMFrameBuffers );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ResizeTarget                                                   |
+//  |  Adapt the buffers to a new target size or sample count. The path state     |
+//  |  buffers keep their sample capacity when spp drops; when it grows beyond    |
+//  |  it, the capacity at least doubles, so a frame time controller that steps   |
+//  |  spp up (see "frameSpp") reallocates only a few times.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::ResizeTarget( const int width, const int height, const uint spp )
+{
+	scrwidth = width;
+	scrheight = height;
 	scrspp = spp;
-	renderTarget.SetTexture( target );
-	bool firstFrame = (maxPixels == 0);
-	// notify CUDA about the texture
-	renderTarget.LinkToSurface( renderTargetRef() );
-	// see if we need to reallocate our buffers
+	// see if we need to reallocate our buffers; in tiled mode, they only need to hold one tile
+	const int rows = tileRows > 0 ? min( tileRows, scrheight ) : scrheight;
 	bool reallocate = false;
-	if (scrwidth * scrheight > maxPixels || spp != currentSPP)
+	if (scrwidth * rows > maxPixels || scrspp > currentSPP)
 	{
-		maxPixels = scrwidth * scrheight;
+		maxPixels = scrwidth * rows;
 		maxPixels += maxPixels >> 4; // reserve a bit extra to prevent frequent reallocs
-		currentSPP = spp;
+		if (scrspp > currentSPP) currentSPP = max( scrspp, currentSPP * 2 );
 		reallocate = true;
 	}
-	// notify OptiX about the new screen size
+	// a captured frame refers to the old buffers and launch sizes
+	if (graphExec) cudaGraphExecDestroy( graphExec ), graphExec = 0;
+	// notify OptiX about the new screen size; with dynamic resolution, Render overrides it per frame
 	params.scrsize = make_int3( scrwidth, scrheight, scrspp );
+	renderWidth = scrwidth, renderHeight = scrheight;
+	historyValid = false;
 	if (reallocate)
 	{
-		// reallocate buffers
-		delete connectionBuffer;
+		// reallocate buffers; the transients that are not declared here are declared again on first use
+		transients.Clear();
 		delete accumulator;
-		delete hitBuffer;
-		delete pathStateBuffer;
-		connectionBuffer = new CoreBuffer<float4>( maxPixels * scrspp * 3 * MAXPATHLENGTH, ON_DEVICE );
-		accumulator = new CoreBuffer<float4>( maxPixels * 2 /* to split direct / indirect */, ON_DEVICE );
-		hitBuffer = new CoreBuffer<float4>( maxPixels * scrspp, ON_DEVICE );
-		pathStateBuffer = new CoreBuffer<float4>( maxPixels * scrspp * 3, ON_DEVICE );
-		params.connectData = connectionBuffer->DevPtr();
+		delete upscaleBuffer[1], upscaleBuffer[1] = 0; // dynamic resolution buffers are allocated on first use
+		delete upscaleBuffer[2], upscaleBuffer[2] = 0;
+		delete motionBuffer, motionBuffer = 0;
+		delete hitMotionBuffer, hitMotionBuffer = 0;
+		delete hitDepthBuffer, hitDepthBuffer = 0;
+		delete traversalCostBuffer, traversalCostBuffer = 0;
+		SetHitMotion( MotionControl(), 0 );
+		for (int i = 0; i < 2; i++) delete reprojectFrame[i], delete reprojectHistory[i], reprojectFrame[i] = reprojectHistory[i] = 0;
+		delete reservoirBuffer[0], reservoirBuffer[0] = 0; // light resampling buffers are allocated on first use
+		delete reservoirBuffer[1], reservoirBuffer[1] = 0;
+		delete guideBuffer, guideBuffer = 0; // denoiser buffers are allocated on first use
+		SetDenoiseGuides( 0 );
+		accumulator = new CoreBuffer<float4>( maxPixels * 2 /* to split direct / indirect */, ON_DEVICE, 0, VRAMFrameBuffers );
+		transients.Declare( hitBuffer, maxPixels * currentSPP, WAVEFRONT, WAVEFRONT );
+		transients.Declare( pathStateBuffer, maxPixels * currentSPP * 3, WAVEFRONT, WAVEFRONT );
+		SizeConnections(); // places the transients
 		params.accumulator = accumulator->DevPtr();
-		params.hitData = hitBuffer->DevPtr();
-		params.pathStates = pathStateBuffer->DevPtr();
-		printf( "buffers resized for %i pixels @ %i samples.\n", maxPixels, scrspp );
+		printf( "buffers resized for %i pixels @ %i samples.\n", maxPixels, currentSPP );
 	}
 	// clear the accumulator
 	accumulator->Clear( ON_DEVICE );
 	samplesTaken = 0;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SizeConnections                                                |
+//  |  The connection buffer holds a shadow ray per path for each bounce until    |
+//  |  the end of the frame. With interleaveShadows, the connections of a bounce  |
+//  |  are traced before the next bounce, so the buffer only needs to hold those  |
+//  |  of a single bounce: at 4K, that saves well over a GB. Async wavefront      |
+//  |  mode does not interleave, and needs the full buffer.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SizeConnections()
+{
+	const int bounces = (interleaveShadows && !asyncWavefront) ? 1 : MAXPATHLENGTH;
+	const uint capacity = maxPixels * currentSPP * bounces;
+	if (connectionBuffer && pathControl.connectStride == capacity) return;
+	transients.Declare( connectionBuffer, capacity * 3 /* O4, D4, E4 */, WAVEFRONT, WAVEFRONT );
+	pathControl.connectStride = capacity;
+	PlaceTransients();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::PlaceTransients                                                |
+//  |  Lays out the transient buffers after a declaration changed. The path       |
+//  |  states, hits, connections and sort buffers are dead once the shadow rays   |
+//  |  are traced; the denoiser layers and scratch and the upscaled frame are     |
+//  |  only used after that, so they share the same device memory. All stages     |
+//  |  run in order on the legacy stream, or on renderStream, which synchronizes  |
+//  |  with it. Buffers may move; the launch parameters are updated here, and     |
+//  |  the captured wavefront graph is dropped.                             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::PlaceTransients()
+{
+	if (!transients.Commit( aliasTransients )) return;
+	params.hitData = hitBuffer ? hitBuffer->DevPtr() : 0;
+	params.pathStates = pathStateBuffer ? pathStateBuffer->DevPtr() : 0;
+	params.connectData = connectionBuffer ? connectionBuffer->DevPtr() : 0;
+	if (graphExec) cudaGraphExecDestroy( graphExec ), graphExec = 0; // captured with the old buffers
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::EnablePeerPools                                                |
+//  |  Finds the GPUs that the render device can read from directly, and enables  |
+//  |  peer access to them. Mode 1 accepts NVLink peers only; CUDA tells them     |
+//  |  apart from PCIe peers by their native atomics. Mode 2 accepts any peer,    |
+//  |  mode 0 none. Pools that exist already stay where they are.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::EnablePeerPools( const int mode )
+{
+	peerDevices.clear();
+	int count = 0;
+	cudaGetDeviceCount( &count );
+	for (int device = 0; device < count && mode > 0; device++) if (device != cudaDevice)
+	{
+		int canAccess = 0, atomics = 0;
+		cudaDeviceCanAccessPeer( &canAccess, cudaDevice, device );
+		cudaDeviceGetP2PAttribute( &atomics, cudaDevP2PAttrNativeAtomicSupported, cudaDevice, device );
+		if (!canAccess || (mode == 1 && !atomics)) continue;
+		const cudaError_t result = cudaDeviceEnablePeerAccess( device, 0 );
+		if (result != cudaSuccess) cudaGetLastError(); // clear the error
+		if (result != cudaSuccess && result != cudaErrorPeerAccessAlreadyEnabled) continue;
+		peerDevices.push_back( device );
+		printf( "peer pools: device %i, over %s\n", device, atomics ? "NVLink" : "PCIe" );
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::PoolDevice                                                     |
+//  |  Picks the device for a new read-only pool: the one with the most free      |
+//  |  memory, where the render device keeps 1 / PEERRESERVE of its memory for    |
+//  |  the buffers that must be local. A pool is not split over devices; a scene  |
+//  |  is partitioned at the granularity of texel pools and meshes. Returns -1    |
+//  |  for the render device.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+int RenderCore::PoolDevice( const size_t bytes )
+{
+	if (peerDevices.empty() || bytes < PEERPOOLMIN) return -1;
+	size_t free, total;
+	cudaMemGetInfo( &free, &total );
+	const size_t reserve = total / PEERRESERVE;
+	size_t most = free > reserve ? free - reserve : 0;
+	int device = -1;
+	for (const int peer : peerDevices)
+	{
+		cudaSetDevice( peer );
+		cudaMemGetInfo( &free, &total );
+		if (free > bytes && free > most) most = free, device = peer;
+	}
+	cudaSetDevice( cudaDevice );
+	return device;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::SetGeometry                                                    |
 //  |  Set the geometry data for a model.                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags )
+void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint )
 {
 	// Note: for first-time setup, meshes are expected to be passed in sequential order.
 	// This will result in new CoreMesh pointers being pushed into the meshes vector.
 	// Subsequent mesh changes will be applied to existing CoreMeshes. This is deliberately
 	// minimalistic; RenderSystem is responsible for a proper (fault-tolerant) interface.
 	if (meshIdx >= meshes.size()) meshes.push_back( new CoreMesh() );
+	meshes[meshIdx]->hint = hint;
 	meshes[meshIdx]->SetGeometry( vertexData, vertexCount, triangleCount, triangles, alphaFlags );
+	meshesChanged = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetIndexedGeometry                                             |
+//  |  Set the geometry data for a model, with shared vertices.             LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetIndexedGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const uint* indexData, const int triangleCount,
+	const CoreTri* triangles, const uint* alphaFlags, const GeometryHint hint )
+{
+	if (meshIdx >= meshes.size()) meshes.push_back( new CoreMesh() );
+	meshes[meshIdx]->hint = hint;
+	meshes[meshIdx]->SetGeometry( vertexData, vertexCount, triangleCount, triangles, alphaFlags, indexData );
+	meshesChanged = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetAnimationData                                               |
+//  |  Store the data needed to animate a mesh on the device. Returns false if    |
+//  |  the mesh cannot be animated on the device.                           LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::SetAnimationData( const int meshIdx, const float4* vertexData, const float3* normalData, const int vertexCount,
+	const uint4* joints, const float4* weights, const float3* morphPositions, const float3* morphNormals, const int morphTargets )
+{
+	CoreMesh* mesh = meshes[meshIdx];
+	if (!mesh->resident) mesh->Reload(), meshesChanged = true; // animated meshes are not streamed
+	return mesh->SetAnimationData( vertexData, normalData, vertexCount, joints, weights, morphPositions, morphNormals, morphTargets );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetPose                                                        |
+//  |  Animate a mesh on the device. The new BVH is picked up by the next         |
+//  |  UpdateToplevel call.                                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetPose( const int meshIdx, const mat4* jointMat, const int jointCount, const float* morphWeights, const int weightCount )
+{
+	meshes[meshIdx]->SetPose( jointMat, jointCount, morphWeights, weightCount );
+	meshesChanged = true;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -343,222 +1065,1530 @@ void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const mat4& matrix )
 {
-	// Note: for first-time setup, meshes are expected to be passed in sequential order.
-	// This will result in new CoreInstance pointers being pushed into the instances vector.
-	// Subsequent instance changes (typically: transforms) will be applied to existing CoreInstances.
-	if (instanceIdx >= instances.size())
-	{
-		// create a geometry instance
-		CoreInstance* newInstance = new CoreInstance();
-		memset( &newInstance->instance, 0, sizeof( OptixInstance ) );
-		newInstance->instance.flags = OPTIX_INSTANCE_FLAG_NONE;
-		newInstance->instance.instanceId = instanceIdx;
-		newInstance->instance.sbtOffset = 0;
-		newInstance->instance.visibilityMask = 255;
-		newInstance->instance.traversableHandle = meshes[meshIdx]->gasHandle;
-		memcpy( newInstance->transform, &matrix, 12 * sizeof( float ) );
-		memcpy( newInstance->instance.transform, &matrix, 12 * sizeof( float ) );
-		instances.push_back( newInstance );
-	}
-	// update the matrices for the transform
-	memcpy( instances[instanceIdx]->transform, &matrix, 12 * sizeof( float ) );
-	memcpy( instances[instanceIdx]->instance.transform, &matrix, 12 * sizeof( float ) );
-	// set/update the mesh for this instance
-	instances[instanceIdx]->mesh = meshIdx;
+	SetInstances( instanceIdx, 1, &meshIdx, &matrix );
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  RenderCore::UpdateToplevel                                                 |
-//  |  After changing meshes, instances or instance transforms, we need to        |
-//  |  rebuild the top-level structure.                                     LH2'19|
+//  |  RenderCore::SetInstances                                                   |
+//  |  Set the details of 'count' consecutive instances. Instances are stored as  |
+//  |  arrays: the OptixInstance records in the host side of instanceArray, which |
+//  |  is uploaded as-is for the top-level build, the shading descriptors in      |
+//  |  instDescBuffer, and the mesh IDs in instanceMesh. New instances are        |
+//  |  expected at the end of the arrays.                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::UpdateToplevel()
+void RenderCore::SetInstances( const int first, const int count, const int* meshIdx, const mat4* matrices )
 {
-	// resize instance array if more space is needed
-	if (instances.size() > (size_t)instanceArray->GetSize())
+	const int needed = first + count;
+	if (needed > instanceArray->GetSize())
 	{
+		// grow with some slack, to prevent excessive reallocs
+		CoreBuffer<OptixInstance>* newArray = new CoreBuffer<OptixInstance>( needed * 2, ON_HOST | ON_DEVICE, 0, VRAMScene );
+		memcpy( newArray->HostPtr(), instanceArray->HostPtr(), instanceMesh.size() * sizeof( OptixInstance ) );
 		delete instanceArray;
-		instanceArray = new CoreBuffer<OptixInstance>( instances.size() + 4, ON_HOST | ON_DEVICE );
-	}
-	// copy instance descriptors to the array, sync with device
-	for (int s = (int)instances.size(), i = 0; i < s; i++) 
-	{
-		instances[i]->instance.traversableHandle = meshes[instances[i]->mesh]->gasHandle;
-		instanceArray->HostPtr()[i] = instances[i]->instance;
+		instanceArray = newArray;
+		firstDirtyInstance = 0; // new device buffer: upload everything
 	}
-	instanceArray->CopyToDevice();
-	// build the top-level tree
-	OptixBuildInput buildInput = {};
-	buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
-	buildInput.instanceArray.instances = (CUdeviceptr)instanceArray->DevPtr();
-	buildInput.instanceArray.numInstances = (uint)instances.size();
-	OptixAccelBuildOptions options = {};
-	options.buildFlags = OPTIX_BUILD_FLAG_NONE;
-	options.operation = OPTIX_BUILD_OPERATION_BUILD;
-	static size_t reservedTemp = 0, reservedTop = 0;
-	static CoreBuffer<uchar> *temp, *topBuffer = 0;
-	OptixAccelBufferSizes sizes;
-	CHK_OPTIX( optixAccelComputeMemoryUsage( optixContext, &options, &buildInput, 1, &sizes ) );
-	if (sizes.tempSizeInBytes > reservedTemp)
+	if (instDescBuffer == 0 || instDescBuffer->GetSize() < needed)
 	{
-		reservedTemp = sizes.tempSizeInBytes + 1024;
-		delete temp;
-		temp = new CoreBuffer<uchar>( reservedTemp, ON_DEVICE );
+		CoreBuffer<CoreInstanceDesc>* newBuffer = new CoreBuffer<CoreInstanceDesc>( needed * 2, ON_HOST | ON_DEVICE, 0, VRAMScene );
+		if (instDescBuffer) memcpy( newBuffer->HostPtr(), instDescBuffer->HostPtr(), instDescBuffer->GetSizeInBytes() );
+		delete instDescBuffer;
+		instDescBuffer = newBuffer;
+		SetInstanceDescriptors( instDescBuffer->DevPtr() );
+		firstDirtyDesc = 0; // new device buffer: upload everything
 	}
-	if (sizes.outputSizeInBytes > reservedTop)
+	// group members get their shading descriptors in LayoutGroupDescriptors
+	for (int i = 0; i < count && !groupDescsDirty; i++)
+		if (meshIdx[i] < -1 || (first + i < (int)instanceMesh.size() && instanceMesh[first + i] < -1)) groupDescsDirty = true;
+	if (needed > (int)instanceMesh.size())
 	{
-		reservedTop = sizes.outputSizeInBytes + 1024;
-		delete topBuffer;
-		topBuffer = new CoreBuffer<uchar>( reservedTop, ON_DEVICE );
+		// slots that are skipped by the caller stay hidden
+		memset( instanceArray->HostPtr() + instanceMesh.size(), 0, (needed - instanceMesh.size()) * sizeof( OptixInstance ) );
+		instanceMesh.resize( needed, meshIdx[0] );
+		instanceMask.resize( needed, 0 );
 	}
-	CHK_OPTIX( optixAccelBuild( optixContext, 0, &options, &buildInput, 1, (CUdeviceptr)temp->DevPtr(),
-		reservedTemp, (CUdeviceptr)topBuffer->DevPtr(), reservedTop, &bvhRoot, 0, 0 ) );
+#ifdef MOTIONBLUR
+	// SetInstance makes an instance static again, see SetInstanceMotion
+	if (needed > (int)instanceMotion.size()) instanceMotion.resize( needed, -1 );
+	if (motionSlots > (int)freeMotionSlots.size()) for (int i = first; i < needed; i++)
+		if (instanceMotion[i] >= 0) freeMotionSlots.push_back( instanceMotion[i] ), instanceMotion[i] = -1;
+#endif
+	// fill in the records; the inverse transforms make this worthwhile to spread over the workers for large batches
+	std::atomic<bool> handlesChanged( false );
+	JobSystem::ParallelFor( count, [&]( const int firstInRange, const int lastInRange ) {
+		bool changed = false;
+		for (int i = firstInRange; i < lastInRange; i++)
+		{
+			const int idx = first + i;
+			OptixInstance& record = instanceArray->HostPtr()[idx];
+			const OptixTraversableHandle handle = InstanceHandle( meshIdx[i] );
+			changed |= record.traversableHandle != handle;
+			memcpy( record.transform, &matrices[i], 12 * sizeof( float ) );
+			record.instanceId = idx; // for groups: set by LayoutGroupDescriptors
+			record.sbtOffset = 0;
+			record.flags = OPTIX_INSTANCE_FLAG_NONE;
+			record.traversableHandle = handle;
+			instanceMesh[idx] = meshIdx[i];
+			instanceMask[idx] = VISIBLE_ALL; // the slot may have been hidden by RemoveInstance
+			record.visibilityMask = InstanceMask( idx );
+			if (meshIdx[i] < -1) continue;
+			const CoreMesh* mesh = meshes[meshIdx[i]];
+			CoreInstanceDesc& desc = instDescBuffer->HostPtr()[idx];
+			desc.packed = mesh->packedTriangles != 0;
+			desc.triangles = mesh->ShadingData();
+			mat4 T = mat4::Identity();
+			memcpy( &T, matrices[i].cell, 12 * sizeof( float ) );
+			const mat4 invT = T.InvertedAffine();
+			desc.invTransform = *(float4x4*)&invT;
+			desc.prevTransform = *(float4x4*)&T; // static until SetInstanceMotion
+		}
+		if (changed) handlesChanged = true;
+	}, 4096 );
+	if (handlesChanged) instanceHandlesChanged = true;
+	firstDirtyInstance = min( firstDirtyInstance, first ), lastDirtyInstance = max( lastDirtyInstance, needed - 1 );
+	firstDirtyDesc = min( firstDirtyDesc, first ), lastDirtyDesc = max( lastDirtyDesc, needed - 1 );
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  RenderCore::SetTextures                                                    |
-//  |  Set the texture data.                                                LH2'19|
+//  |  RenderCore::SetInstanceVisibility                                          |
+//  |  Use VISIBLE_* flags as the instance mask. Each launch traces with a        |
+//  |  single ray mask, see Params::rayMask, so an instance without e.g.          |
+//  |  VISIBLE_SHADOW is skipped entirely by shadow rays.                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::SetTextures( const CoreTexDesc* tex, const int textures )
+void RenderCore::SetInstanceVisibility( const int instanceIdx, const uint visibility )
 {
-	// copy the supplied array of texture descriptors
-	delete texDescs; texDescs = 0;
-	textureCount = textures;
-	if (textureCount == 0) return; // scene has no textures
-	texDescs = new CoreTexDesc[textureCount];
-	memcpy( texDescs, tex, textureCount * sizeof( CoreTexDesc ) );
-	// copy texels for each type to the device
-	SyncStorageType( TexelStorage::ARGB32 );
-	SyncStorageType( TexelStorage::ARGB128 );
-	SyncStorageType( TexelStorage::NRM32 );
-	// Notes: 
-	// - the three types are copied from the original HostTexture pixel data (to which the
-	//   descriptors point) straight to the GPU. There is no pixel storage on the host
-	//   in the RenderCore.
-	// - the types are copied one by one. Copying involves creating a temporary host-side
-	//   buffer; doing this one by one allows us to delete host-side data for one type
-	//   before allocating space for the next, thus reducing storage requirements.
+	if (instanceIdx >= instanceMesh.size()) return;
+	instanceMask[instanceIdx] = visibility & 255;
+	instanceArray->HostPtr()[instanceIdx].visibilityMask = InstanceMask( instanceIdx );
+	firstDirtyInstance = min( firstDirtyInstance, instanceIdx ), lastDirtyInstance = max( lastDirtyInstance, instanceIdx );
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  RenderCore::SyncStorageType                                                |
-//  |  Copies texel data for one storage type (argb32, argb128 or nrm32) to the   |
-//  |  device. Note that this data is obtained from the original HostTexture      |
-//  |  texel arrays.                                                        LH2'19|
+//  |  RenderCore::SetInstanceMotion                                              |
+//  |  Motion blur: the instance moves from openTransform at shutter open to the  |
+//  |  transform of its SetInstance call at shutter close. The record then refers |
+//  |  to a matrix motion transform over the mesh BVH, with the two transforms as |
+//  |  keys, and has the identity as its own transform. Static instances refer to |
+//  |  their BVH directly, so they pay nothing for motion blur.             LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::SyncStorageType( const TexelStorage storage )
+void RenderCore::SetInstanceMotion( const int instanceIdx, const mat4& openTransform )
 {
-	uint texelTotal = 0;
-	for (int i = 0; i < textureCount; i++) if (texDescs[i].storage == storage) texelTotal += texDescs[i].pixelCount;
-	texelTotal = max( 16, texelTotal ); // OptiX does not tolerate empty buffers...
-	// construct the continuous arrays
-	switch (storage)
+	// motion vectors: the transform at shutter open is that of the previous frame
+	if (instanceIdx < instanceMesh.size() && instanceMesh[instanceIdx] >= 0)
 	{
-	case TexelStorage::ARGB32:
-		delete texel32Buffer;
-		texel32Buffer = new CoreBuffer<uint>( texelTotal, ON_HOST | ON_DEVICE );
-		SetARGB32Pixels( texel32Buffer->DevPtr() );
-		coreStats.argb32TexelCount = texelTotal;
-		break;
-	case TexelStorage::ARGB128:
-		delete texel128Buffer;
-		SetARGB128Pixels( (texel128Buffer = new CoreBuffer<float4>( texelTotal, ON_HOST | ON_DEVICE ))->DevPtr() );
-		coreStats.argb128TexelCount = texelTotal;
-		break;
-	case TexelStorage::NRM32:
-		delete normal32Buffer;
-		SetNRM32Pixels( (normal32Buffer = new CoreBuffer<uint>( texelTotal, ON_HOST | ON_DEVICE ))->DevPtr() );
-		coreStats.nrm32TexelCount = texelTotal;
-		break;
+		instDescBuffer->HostPtr()[instanceIdx].prevTransform = *(float4x4*)&openTransform;
+		firstDirtyDesc = min( firstDirtyDesc, instanceIdx ), lastDirtyDesc = max( lastDirtyDesc, instanceIdx );
 	}
-	// copy texel data to arrays
-	texelTotal = 0;
-	for (int i = 0; i < textureCount; i++) if (texDescs[i].storage == storage)
+#ifdef MOTIONBLUR
+	if (instanceIdx >= instanceMesh.size()) return;
+	OptixInstance& record = instanceArray->HostPtr()[instanceIdx];
+	int slot = instanceMotion[instanceIdx];
+	if (slot < 0)
 	{
-		void* destination = 0;
-		switch (storage)
+		if (freeMotionSlots.size() > 0) slot = freeMotionSlots.back(), freeMotionSlots.pop_back(); else slot = motionSlots++;
+		if (!motionTransforms || motionSlots > motionTransforms->GetSize())
 		{
-		case TexelStorage::ARGB32:  destination = texel32Buffer->HostPtr() + texelTotal; break;
-		case TexelStorage::ARGB128: destination = texel128Buffer->HostPtr() + texelTotal; break;
-		case TexelStorage::NRM32:   destination = normal32Buffer->HostPtr() + texelTotal; break;
+			// grow with some slack; the handles are device addresses, so all moving instances get new ones
+			CoreBuffer<OptixMatrixMotionTransform>* newBuffer = new CoreBuffer<OptixMatrixMotionTransform>( motionSlots * 2, ON_HOST | ON_DEVICE, 0, VRAMScene );
+			if (motionTransforms) memcpy( newBuffer->HostPtr(), motionTransforms->HostPtr(), motionTransforms->GetSizeInBytes() );
+			delete motionTransforms;
+			motionTransforms = newBuffer;
+			motionHandles.resize( motionSlots * 2 );
+			for (int i = 0; i < motionSlots * 2; i++) CHK_OPTIX( optixConvertPointerToTraversableHandle( optixContext,
+				(CUdeviceptr)(motionTransforms->DevPtr() + i), OPTIX_TRAVERSABLE_TYPE_MATRIX_MOTION_TRANSFORM, &motionHandles[i] ) );
+			for (int s = (int)instanceMesh.size(), i = 0; i < s; i++) if (instanceMotion[i] >= 0)
+			{
+				instanceArray->HostPtr()[i].traversableHandle = motionHandles[instanceMotion[i]];
+				firstDirtyInstance = min( firstDirtyInstance, i ), lastDirtyInstance = max( lastDirtyInstance, i );
+			}
+			firstDirtyMotion = 0, lastDirtyMotion = max( lastDirtyMotion, motionSlots - 1 );
 		}
-		memcpy( destination, texDescs[i].idata, texDescs[i].pixelCount * sizeof( uint ) );
-		texDescs[i].firstPixel = texelTotal;
-		texelTotal += texDescs[i].pixelCount;
+		instanceMotion[instanceIdx] = slot;
+		OptixMatrixMotionTransform& motion = motionTransforms->HostPtr()[slot];
+		memset( &motion, 0, sizeof( OptixMatrixMotionTransform ) );
+		motion.child = InstanceHandle( instanceMesh[instanceIdx] );
+		motion.motionOptions.numKeys = 2;
+		motion.motionOptions.flags = OPTIX_MOTION_FLAG_NONE;
+		motion.motionOptions.timeBegin = 0, motion.motionOptions.timeEnd = 1;
+		// the transform of the record becomes the key at shutter close
+		static const float identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+		memcpy( motion.transform[1], record.transform, 12 * sizeof( float ) );
+		memcpy( record.transform, identity, 12 * sizeof( float ) );
+		record.traversableHandle = motionHandles[slot], instanceHandlesChanged = true;
+		firstDirtyInstance = min( firstDirtyInstance, instanceIdx ), lastDirtyInstance = max( lastDirtyInstance, instanceIdx );
 	}
-	// move to device
-	if (storage == TexelStorage::ARGB32) if (texel32Buffer) texel32Buffer->MoveToDevice();
-	if (storage == TexelStorage::ARGB128) if (texel128Buffer) texel128Buffer->MoveToDevice();
-	if (storage == TexelStorage::NRM32) if (normal32Buffer) normal32Buffer->MoveToDevice();
+	memcpy( motionTransforms->HostPtr()[slot].transform[0], openTransform.cell, 12 * sizeof( float ) );
+	firstDirtyMotion = min( firstDirtyMotion, slot ), lastDirtyMotion = max( lastDirtyMotion, slot );
+#endif
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  RenderCore::SetMaterials                                                   |
-//  |  Set the material data.                                               LH2'19|
+//  |  RenderCore::RemoveInstance                                                 |
+//  |  Hide an instance. The slot stays in the top-level structure, so the other  |
+//  |  instances keep their index; with a zero visibility mask, no ray hits it.   |
+//  |  A later SetInstance for the slot makes it visible again.             LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount )
+void RenderCore::RemoveInstance( const int instanceIdx )
 {
-	// Notes:
-	// Call this after the textures have been set; CoreMaterials store the offset of each texture
-	// in the continuous arrays; this data is valid only when textures are in sync.
-	delete materialBuffer;
-	delete hostMaterialBuffer;
-	hostMaterialBuffer = new CoreMaterial[materialCount];
-	memcpy( hostMaterialBuffer, mat, materialCount * sizeof( CoreMaterial ) );
-	for (int i = 0; i < materialCount; i++)
-	{
-		CoreMaterial& m = hostMaterialBuffer[i];
-		const CoreMaterialEx& e = matEx[i];
-		if (e.texture[0] != -1) m.texaddr0 = texDescs[e.texture[0]].firstPixel;
-		if (e.texture[1] != -1) m.texaddr1 = texDescs[e.texture[1]].firstPixel;
-		if (e.texture[2] != -1) m.texaddr2 = texDescs[e.texture[2]].firstPixel;
-		if (e.texture[3] != -1) m.nmapaddr0 = texDescs[e.texture[3]].firstPixel;
-		if (e.texture[4] != -1) m.nmapaddr1 = texDescs[e.texture[4]].firstPixel;
-		if (e.texture[5] != -1) m.nmapaddr2 = texDescs[e.texture[5]].firstPixel;
-		if (e.texture[6] != -1) m.smapaddr = texDescs[e.texture[6]].firstPixel;
-		if (e.texture[7] != -1) m.rmapaddr = texDescs[e.texture[7]].firstPixel;
-		// if (e.texture[ 8] != -1) m.texaddr0 = texDescs[e.texture[ 8]].firstPixel; second roughness map is not used
-		if (e.texture[9] != -1) m.cmapaddr = texDescs[e.texture[9]].firstPixel;
-		if (e.texture[10] != -1) m.amapaddr = texDescs[e.texture[10]].firstPixel;
-	}
-	materialBuffer = new CoreBuffer<CoreMaterial>( materialCount, ON_DEVICE | ON_HOST /* on_host: for alpha mapped tris */, hostMaterialBuffer );
-	SetMaterialList( materialBuffer->DevPtr() );
+	if (instanceIdx >= instanceMesh.size()) return;
+	instanceMask[instanceIdx] = 0;
+	instanceArray->HostPtr()[instanceIdx].visibilityMask = 0;
+	firstDirtyInstance = min( firstDirtyInstance, instanceIdx ), lastDirtyInstance = max( lastDirtyInstance, instanceIdx );
 }
 
 //  +-----------------------------------------------------------------------------+
-//  |  RenderCore::SetLights                                                      |
-//  |  Set the light data.                                                  LH2'19|
+//  |  RenderCore::SetInstanceGroup                                               |
+//  |  Store a sub-assembly of mesh instances and build its BVH once. Instances   |
+//  |  refer to it with INSTANCEGROUP( groupIdx ) as their mesh; the top-level    |
+//  |  tree then holds one instance per assembly, not one per member.       LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::SetLights( const CoreLightTri* areaLights, const int areaLightCount,
-	const CorePointLight* pointLights, const int pointLightCount,
-	const CoreSpotLight* spotLights, const int spotLightCount,
-	const CoreDirectionalLight* directionalLights, const int directionalLightCount )
+bool RenderCore::SetInstanceGroup( const int groupIdx, const int count, const int* meshIdx, const mat4* transforms )
 {
-	delete areaLightBuffer;
+	if (groupIdx >= (int)instanceGroups.size()) instanceGroups.resize( groupIdx + 1, 0 );
+	if (!instanceGroups[groupIdx]) instanceGroups[groupIdx] = new InstanceGroup();
+	InstanceGroup* group = instanceGroups[groupIdx];
+	// a scattered group had no host copy of its build input
+	if (group->scattered > 0)
+	{
+		delete group->instances, delete group->members, delete group->prototypeData;
+		group->instances = 0, group->members = 0, group->prototypeData = 0, group->scattered = 0;
+		group->prototypes.clear();
+	}
+	group->mesh.assign( meshIdx, meshIdx + count );
+	group->transform.assign( transforms, transforms + count );
+	// group members are not streamed: the group BVH refers to their BVHs directly
+	for (int i = 0; i < count; i++)
+	{
+		CoreMesh* mesh = meshes[meshIdx[i]];
+		mesh->FinishStreaming( true );
+		if (!mesh->resident) mesh->Reload();
+	}
+	BuildInstanceGroup( group );
+	// instances of the group pick up the new handle and member descriptors in UpdateToplevel
+	meshesChanged = groupDescsDirty = true;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ScatterInstances                                               |
+//  |  Fill a group with procedural instances of the prototypes, placed on the    |
+//  |  surface by scatterKernel. The members are written to the build input of    |
+//  |  the group BVH on the device; per group instance, layoutScatter derives     |
+//  |  their shading descriptors. Millions of members thus cost no host memory    |
+//  |  and no uploads, except for the surface itself, once.                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::ScatterInstances( const int groupIdx, const CoreScatter& scatter )
+{
+	if (scatter.triangleCount < 1 || scatter.prototypeCount < 1 || scatter.count < 1) return false;
+	for (int i = 0; i < scatter.prototypeCount; i++) if (scatter.prototypes[i] < 0 || scatter.prototypes[i] >= (int)meshes.size()) return false;
+	// area cdf of the surface triangles
+	vector<float> cdf( scatter.triangleCount );
+	double area = 0;
+	for (int i = 0; i < scatter.triangleCount; i++)
+	{
+		const float3 v0 = make_float3( scatter.vertices[i * 3] ), v1 = make_float3( scatter.vertices[i * 3 + 1] );
+		const float3 v2 = make_float3( scatter.vertices[i * 3 + 2] );
+		area += 0.5f * length( cross( v1 - v0, v2 - v0 ) ), cdf[i] = (float)area;
+	}
+	if (area <= 0) return false;
+	for (float& c : cdf) c = (float)(c / area);
+	cdf.back() = 1;
+	if (groupIdx >= (int)instanceGroups.size()) instanceGroups.resize( groupIdx + 1, 0 );
+	if (!instanceGroups[groupIdx]) instanceGroups[groupIdx] = new InstanceGroup();
+	InstanceGroup* group = instanceGroups[groupIdx];
+	group->mesh.clear();
+	group->transform.clear();
+	group->prototypes.assign( scatter.prototypes, scatter.prototypes + scatter.prototypeCount );
+	group->scattered = scatter.count;
+	// prototypes are not streamed, like the members of the other groups
+	delete group->prototypeData;
+	group->prototypeData = new CoreBuffer<ScatterPrototype>( scatter.prototypeCount, ON_HOST | ON_DEVICE, 0, VRAMScene );
+	for (int i = 0; i < scatter.prototypeCount; i++)
+	{
+		CoreMesh* mesh = meshes[scatter.prototypes[i]];
+		mesh->FinishStreaming( true );
+		if (!mesh->resident) mesh->Reload();
+		ScatterPrototype& proto = group->prototypeData->HostPtr()[i];
+		proto.handle = mesh->gasHandle, proto.triangles = mesh->ShadingData(), proto.packed = mesh->packedTriangles != 0;
+	}
+	group->prototypeData->CopyToDeviceAsync( updateStream );
+	// the surface is only needed for the placement; the mask requires texture coordinates
+	const bool masked = scatter.mask != 0 && scatter.uvs != 0 && scatter.maskSize.x > 0 && scatter.maskSize.y > 0;
+	CoreBuffer<float4> vertices( scatter.triangleCount * 3, ON_HOST | ON_DEVICE, scatter.vertices );
+	CoreBuffer<float> cdfBuffer( scatter.triangleCount, ON_HOST | ON_DEVICE, cdf.data() );
+	CoreBuffer<float2> uvs( masked ? scatter.triangleCount * 3 : 0, ON_HOST | ON_DEVICE, scatter.uvs );
+	CoreBuffer<float> mask( masked ? scatter.maskSize.x * scatter.maskSize.y : 0, ON_HOST | ON_DEVICE, scatter.mask );
+	if (!group->members || group->members->GetSize() < scatter.count)
+	{
+		delete group->instances, delete group->members;
+		group->instances = new CoreBuffer<OptixInstance>( scatter.count, ON_DEVICE, 0, VRAMScene );
+		group->members = new CoreBuffer<CoreInstanceDesc>( scatter.count, ON_DEVICE, 0, VRAMScene );
+	}
+	static_assert(sizeof( ScatterRecord ) == sizeof( OptixInstance ), "ScatterRecord must match OptixInstance");
+	ScatterJob job;
+	job.vertices = vertices.DevPtr(), job.uvs = masked ? uvs.DevPtr() : 0;
+	job.cdf = cdfBuffer.DevPtr(), job.triangleCount = scatter.triangleCount;
+	job.mask = masked ? mask.DevPtr() : 0, job.maskSize = scatter.maskSize;
+	job.prototypes = group->prototypeData->DevPtr(), job.prototypeCount = scatter.prototypeCount;
+	job.count = scatter.count, job.scale = scatter.scale, job.align = scatter.alignToSurface ? 1 : 0, job.seed = scatter.seed;
+	job.records = (ScatterRecord*)group->instances->DevPtr(), job.members = group->members->DevPtr();
+	scatterInstances( job, updateStream );
+	BuildInstanceGroup( group );
+	// the input buffers go back to the pool, which may hand them out again before the kernel ran
+	cudaStreamSynchronize( updateStream );
+	meshesChanged = groupDescsDirty = true;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::BuildInstanceGroup                                             |
+//  |  Build the BVH over the members of a group, on the update stream. Groups    |
+//  |  are static: a full build with a preference for fast traversal.       LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::BuildInstanceGroup( InstanceGroup* group )
+{
+	const int count = group->Members();
+	// the records of scattered groups are written on the device, see ScatterInstances
+	if (group->scattered == 0 && (!group->instances || group->instances->GetSize() < count))
+	{
+		delete group->instances;
+		group->instances = new CoreBuffer<OptixInstance>( max( count, 1 ), ON_HOST | ON_DEVICE, 0, VRAMScene );
+	}
+	if (group->scattered == 0) for (int i = 0; i < count; i++)
+	{
+		OptixInstance& record = group->instances->HostPtr()[i];
+		memset( &record, 0, sizeof( OptixInstance ) );
+		memcpy( record.transform, &group->transform[i], 12 * sizeof( float ) );
+		record.instanceId = i; // offset into the descriptors of the instance of the group, see LayoutGroupDescriptors
+		record.visibilityMask = 255;
+		record.flags = OPTIX_INSTANCE_FLAG_NONE;
+		record.traversableHandle = meshes[group->mesh[i]]->gasHandle;
+	}
+	if (group->scattered == 0) group->instances->CopyToDeviceAsync( updateStream );
+	OptixBuildInput buildInput = {};
+	buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+	buildInput.instanceArray.instances = (CUdeviceptr)group->instances->DevPtr();
+	buildInput.instanceArray.numInstances = (uint)count;
+	OptixAccelBuildOptions options = {};
+	options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_TRACE;
+	options.operation = OPTIX_BUILD_OPERATION_BUILD;
+	OptixAccelBufferSizes sizes;
+	CHK_OPTIX( optixAccelComputeMemoryUsage( optixContext, &options, &buildInput, 1, &sizes ) );
+	if (sizes.tempSizeInBytes > reservedGroupTemp)
+	{
+		reservedGroupTemp = sizes.tempSizeInBytes + 1024;
+		delete groupTemp;
+		groupTemp = new CoreBuffer<uchar>( reservedGroupTemp, ON_DEVICE, 0, VRAMBVH );
+	}
+	if (sizes.outputSizeInBytes > group->reservedBVH)
+	{
+		group->reservedBVH = sizes.outputSizeInBytes + 1024;
+		delete group->bvh;
+		group->bvh = new CoreBuffer<uchar>( group->reservedBVH, ON_DEVICE, 0, VRAMBVH );
+	}
+	CHK_OPTIX( optixAccelBuild( optixContext, updateStream, &options, &buildInput, 1, (CUdeviceptr)groupTemp->DevPtr(),
+		reservedGroupTemp, (CUdeviceptr)group->bvh->DevPtr(), group->reservedBVH, &group->handle, 0, 0 ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::LayoutGroupDescriptors                                         |
+//  |  Shading needs a descriptor per member of each instance of a group, with    |
+//  |  the combined inverse transform. These follow the regular descriptors in    |
+//  |  instDescBuffer; the instanceId of a group instance is the index of its     |
+//  |  first member, so a hit two levels deep uses the descriptor at the sum of   |
+//  |  both instance IDs:                                                         |
+//  |    optixGetInstanceIdFromHandle( optixGetTransformListHandle( 0 ) ) +       |
+//  |    optixGetInstanceId()                                                     |
+//  |  rather than optixGetInstanceId() alone.                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::LayoutGroupDescriptors( const int instanceCount )
+{
+	// count the descriptors
+	int descCount = instanceCount;
+	for (int i = 0; i < instanceCount; i++) if (instanceMesh[i] < -1) descCount += instanceGroups[-2 - instanceMesh[i]]->Members();
+	if (instDescBuffer->GetSize() < descCount)
+	{
+		CoreBuffer<CoreInstanceDesc>* newBuffer = new CoreBuffer<CoreInstanceDesc>( descCount * 2, ON_HOST | ON_DEVICE, 0, VRAMScene );
+		memcpy( newBuffer->HostPtr(), instDescBuffer->HostPtr(), instDescBuffer->GetSizeInBytes() );
+		delete instDescBuffer;
+		instDescBuffer = newBuffer;
+		SetInstanceDescriptors( instDescBuffer->DevPtr() );
+		firstDirtyDesc = 0; // new device buffer: upload everything
+	}
+	// fill them in, per instance of a group; those of scattered groups are written on the device
+	scatterLayouts.clear();
+	for (int base = instanceCount, i = 0; i < instanceCount; i++) if (instanceMesh[i] < -1)
+	{
+		const InstanceGroup* group = instanceGroups[-2 - instanceMesh[i]];
+		OptixInstance& record = instanceArray->HostPtr()[i];
+		if (record.instanceId != base)
+		{
+			record.instanceId = base;
+			firstDirtyInstance = min( firstDirtyInstance, i ), lastDirtyInstance = max( lastDirtyInstance, i );
+		}
+		mat4 T = mat4::Identity();
+		memcpy( &T, InstanceTransform( i ), 12 * sizeof( float ) );
+		if (group->scattered > 0)
+		{
+			ScatterLayout layout;
+			const mat4 invT = T.InvertedAffine();
+			layout.base = base, layout.group = -2 - instanceMesh[i];
+			layout.T = *(float4x4*)&T, layout.invT = *(float4x4*)&invT;
+			scatterLayouts.push_back( layout );
+			base += group->scattered;
+			continue;
+		}
+		for (int s = (int)group->mesh.size(), j = 0; j < s; j++)
+		{
+			const CoreMesh* mesh = meshes[group->mesh[j]];
+			CoreInstanceDesc& desc = instDescBuffer->HostPtr()[base + j];
+			desc.packed = mesh->packedTriangles != 0;
+			desc.triangles = mesh->ShadingData();
+			const mat4 M = T * group->transform[j], invT = M.InvertedAffine();
+			desc.invTransform = *(float4x4*)&invT;
+			desc.prevTransform = *(float4x4*)&M; // group members have no motion vectors
+		}
+		base += (int)group->mesh.size();
+	}
+	if (descCount > instanceCount) firstDirtyDesc = min( firstDirtyDesc, instanceCount ), lastDirtyDesc = max( lastDirtyDesc, descCount - 1 );
+	groupLayoutBase = instanceCount;
+	groupDescsDirty = false;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::InstanceHandle                                                 |
+//  |  The traversable that an instance with the specified mesh index refers to:  |
+//  |  the BVH of a mesh, or of an instance group.                          LH2'19|
+//  +-----------------------------------------------------------------------------+
+OptixTraversableHandle RenderCore::InstanceHandle( const int meshIdx ) const
+{
+	return meshIdx < -1 ? instanceGroups[-2 - meshIdx]->handle : meshes[meshIdx]->gasHandle;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::RecordHandle                                                   |
+//  |  The traversable that the top-level record of an instance refers to: the    |
+//  |  motion transform of a moving instance, else that of InstanceHandle.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+OptixTraversableHandle RenderCore::RecordHandle( const int instanceIdx ) const
+{
+#ifdef MOTIONBLUR
+	if (instanceMotion[instanceIdx] >= 0) return motionHandles[instanceMotion[instanceIdx]];
+#endif
+	return InstanceHandle( instanceMesh[instanceIdx] );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::InstanceTransform                                              |
+//  |  The transform of an instance, as passed to SetInstance: for a moving       |
+//  |  instance, the key of its motion transform at shutter close.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+const float* RenderCore::InstanceTransform( const int instanceIdx )
+{
+#ifdef MOTIONBLUR
+	if (instanceMotion[instanceIdx] >= 0) return motionTransforms->HostPtr()[instanceMotion[instanceIdx]].transform[1];
+#endif
+	return instanceArray->HostPtr()[instanceIdx].transform;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::InstanceMask                                                   |
+//  |  The visibility mask of an instance in the top-level structure: the mask    |
+//  |  set by the application, or zero if the mesh is evicted or its first BVH    |
+//  |  is still being built.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+uchar RenderCore::InstanceMask( const int instanceIdx ) const
+{
+	const int meshIdx = instanceMesh[instanceIdx];
+	return (meshIdx >= 0 && (!meshes[meshIdx]->resident || meshes[meshIdx]->streaming)) ? 0 : instanceMask[instanceIdx];
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateToplevel                                                 |
+//  |  After changing meshes, instances or instance transforms, we need to        |
+//  |  rebuild the top-level structure. If only transforms changed, the existing  |
+//  |  structure is refitted, which is much cheaper than a full rebuild.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateToplevel()
+{
+	nvtxRangePushA( "UpdateToplevel" );
+	const int instanceCount = (int)instanceMesh.size();
+	// compaction gives meshes new handles, so it precedes everything that stores them
+	if (meshesChanged) CompactMeshes();
+	// groups with a member mesh that received a new BVH are rebuilt; their members need new descriptors
+	if (meshesChanged) for (InstanceGroup* group : instanceGroups) if (group)
+	{
+		groupDescsDirty = true;
+		if (group->scattered > 0)
+		{
+			// scattered members are updated on the device
+			bool changed = false;
+			for (int s = (int)group->prototypes.size(), i = 0; i < s; i++)
+			{
+				const CoreMesh* mesh = meshes[group->prototypes[i]];
+				ScatterPrototype& proto = group->prototypeData->HostPtr()[i];
+				if (proto.handle == mesh->gasHandle && proto.triangles == mesh->ShadingData()) continue;
+				proto.handle = mesh->gasHandle, proto.triangles = mesh->ShadingData(), proto.packed = mesh->packedTriangles != 0;
+				changed = true;
+			}
+			if (!changed) continue;
+			group->prototypeData->CopyToDeviceAsync( updateStream );
+			refreshScatter( (ScatterRecord*)group->instances->DevPtr(), group->members->DevPtr(), group->prototypeData->DevPtr(), group->scattered, updateStream );
+			BuildInstanceGroup( group );
+			continue;
+		}
+		for (int s = (int)group->mesh.size(), i = 0; i < s; i++)
+			if (group->instances->HostPtr()[i].traversableHandle != meshes[group->mesh[i]]->gasHandle) { BuildInstanceGroup( group ); break; }
+	}
+	// meshes may have received a new BVH or new triangle buffers; only then all instances are visited
+	if (meshesChanged) for (int i = 0; i < instanceCount; i++)
+	{
+		OptixInstance& record = instanceArray->HostPtr()[i];
+		const OptixTraversableHandle handle = RecordHandle( i );
+		if (record.traversableHandle != handle)
+		{
+			record.traversableHandle = handle, instanceHandlesChanged = true;
+			firstDirtyInstance = min( firstDirtyInstance, i ), lastDirtyInstance = max( lastDirtyInstance, i );
+		}
+#ifdef MOTIONBLUR
+		// a moving instance refers to the BVH through its motion transform
+		if (instanceMotion[i] >= 0)
+		{
+			OptixMatrixMotionTransform& motion = motionTransforms->HostPtr()[instanceMotion[i]];
+			const OptixTraversableHandle child = InstanceHandle( instanceMesh[i] );
+			if (motion.child != child)
+			{
+				motion.child = child, instanceHandlesChanged = true;
+				firstDirtyMotion = min( firstDirtyMotion, instanceMotion[i] ), lastDirtyMotion = max( lastDirtyMotion, instanceMotion[i] );
+			}
+		}
+#endif
+		// meshes may have been evicted or reloaded, see UpdateResidency
+		const uchar mask = InstanceMask( i );
+		if (record.visibilityMask != mask)
+		{
+			record.visibilityMask = mask;
+			firstDirtyInstance = min( firstDirtyInstance, i ), lastDirtyInstance = max( lastDirtyInstance, i );
+		}
+		if (instanceMesh[i] < -1) continue;
+		// point the shading descriptor at the current triangle buffers
+		const CoreMesh* mesh = meshes[instanceMesh[i]];
+		CoreInstanceDesc& desc = instDescBuffer->HostPtr()[i];
+		CoreTri4* triangles = mesh->ShadingData();
+		if (desc.triangles != triangles)
+		{
+			desc.packed = mesh->packedTriangles != 0, desc.triangles = triangles;
+			firstDirtyDesc = min( firstDirtyDesc, i ), lastDirtyDesc = max( lastDirtyDesc, i );
+		}
+	}
+	meshesChanged = false;
+	if (groupDescsDirty || (instanceGroups.size() > 0 && instanceCount != groupLayoutBase)) LayoutGroupDescriptors( instanceCount );
+	// a new instance count or new mesh BVHs require a rebuild; otherwise, the tree is refitted
+	const bool rebuild = topBuffer == 0 || instanceCount != topInstanceCount || instanceHandlesChanged;
+#ifdef MOTIONBLUR
+	if (lastDirtyMotion >= firstDirtyMotion)
+		motionTransforms->CopyToDeviceAsync( firstDirtyMotion, lastDirtyMotion - firstDirtyMotion + 1, updateStream );
+	firstDirtyMotion = INT_MAX, lastDirtyMotion = -1;
+#endif
+	if (lastDirtyInstance >= firstDirtyInstance)
+		instanceArray->CopyToDeviceAsync( firstDirtyInstance, lastDirtyInstance - firstDirtyInstance + 1, updateStream );
+	firstDirtyInstance = INT_MAX, lastDirtyInstance = -1;
+	instanceHandlesChanged = false;
+	// a full build makes a background build obsolete; a completed one replaces the refitted tree
+	if (rebuild) topRebuildPending = false, topRefitCount = 0;
+	else if (FinishTopRebuild()) topRefitCount = 0;
+	// build or refit the top-level tree
+	OptixBuildInput buildInput = {};
+	buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+	buildInput.instanceArray.instances = (CUdeviceptr)instanceArray->DevPtr();
+	buildInput.instanceArray.numInstances = (uint)instanceCount;
+	OptixAccelBuildOptions options = {};
+	options.buildFlags = OPTIX_BUILD_FLAG_ALLOW_UPDATE;
+	options.operation = rebuild ? OPTIX_BUILD_OPERATION_BUILD : OPTIX_BUILD_OPERATION_UPDATE;
+	OptixAccelBufferSizes sizes;
+	CHK_OPTIX( optixAccelComputeMemoryUsage( optixContext, &options, &buildInput, 1, &sizes ) );
+	const size_t tempNeeded = rebuild ? sizes.tempSizeInBytes : sizes.tempUpdateSizeInBytes;
+	if (tempNeeded > reservedTopTemp)
+	{
+		reservedTopTemp = tempNeeded + 1024;
+		delete topTemp;
+		topTemp = new CoreBuffer<uchar>( reservedTopTemp, ON_DEVICE, 0, VRAMBVH );
+	}
+	if (rebuild && sizes.outputSizeInBytes > reservedTop)
+	{
+		reservedTop = sizes.outputSizeInBytes + 1024;
+		delete topBuffer;
+		topBuffer = new CoreBuffer<uchar>( reservedTop, ON_DEVICE, 0, VRAMBVH );
+	}
+	cudaEventRecord( topStart, updateStream );
+	topLevelPending = true;
+	CHK_OPTIX( optixAccelBuild( optixContext, updateStream, &options, &buildInput, 1, (CUdeviceptr)topTemp->DevPtr(),
+		reservedTopTemp, (CUdeviceptr)topBuffer->DevPtr(), reservedTop, &bvhRoot, 0, 0 ) );
+	// rendering waits for this event, not for the host
+	cudaEventRecord( updateDone, updateStream );
+	topInstanceCount = instanceCount;
+	// refits degrade the tree when instances move; with backgroundRebuilds, a full build runs on the build stream
+	if (!rebuild) topRefitCount++;
+	if (backgroundRebuilds && !topRebuildPending && topRefitCount >= topRebuildInterval) StartTopRebuild( buildInput, sizes );
+	// report what we did
+	coreStats.topLevelRefit = !rebuild;
+	if (rebuild) coreStats.topLevelRebuilds++; else coreStats.topLevelRefits++;
+	nvtxRangePop();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::StartTopRebuild                                                |
+//  |  Full build of the refitted top-level tree on the build stream, over a      |
+//  |  snapshot of the instances, so the updates of the next frames do not        |
+//  |  affect it. Nothing happens while an earlier, obsolete build still runs;    |
+//  |  see CoreMesh::StartRebuild for the same scheme for meshes.           LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::StartTopRebuild( const OptixBuildInput& buildInput, const OptixAccelBufferSizes& sizes )
+{
+	if (cudaEventQuery( topRebuildDone ) != cudaSuccess) return;
+	const int instanceCount = (int)buildInput.instanceArray.numInstances;
+	if (topRebuildInstances == 0 || topRebuildInstances->GetSize() < instanceCount)
+	{
+		delete topRebuildInstances;
+		topRebuildInstances = new CoreBuffer<OptixInstance>( instanceCount, ON_DEVICE, 0, VRAMScene );
+	}
+	cudaMemcpyAsync( topRebuildInstances->DevPtr(), instanceArray->DevPtr(), instanceCount * sizeof( OptixInstance ), cudaMemcpyDeviceToDevice, updateStream );
+	cudaEventRecord( topRebuildStart, updateStream );
+	cudaStreamWaitEvent( buildStream, topRebuildStart, 0 );
+	if (topRebuildTemp == 0 || (size_t)topRebuildTemp->GetSize() < sizes.tempSizeInBytes)
+	{
+		delete topRebuildTemp;
+		topRebuildTemp = new CoreBuffer<uchar>( sizes.tempSizeInBytes, ON_DEVICE, 0, VRAMBVH );
+	}
+	if (sizes.outputSizeInBytes > reservedTopRebuild)
+	{
+		reservedTopRebuild = sizes.outputSizeInBytes + 1024;
+		delete topRebuildBuffer;
+		topRebuildBuffer = new CoreBuffer<uchar>( reservedTopRebuild, ON_DEVICE, 0, VRAMBVH );
+	}
+	OptixBuildInput input = buildInput;
+	input.instanceArray.instances = (CUdeviceptr)topRebuildInstances->DevPtr();
+	OptixAccelBuildOptions options = {};
+	options.buildFlags = OPTIX_BUILD_FLAG_ALLOW_UPDATE;
+	options.operation = OPTIX_BUILD_OPERATION_BUILD;
+	OptixTraversableHandle handle; // not used: the tree is refitted after the swap, which yields the handle
+	CHK_OPTIX( optixAccelBuild( optixContext, buildStream, &options, &input, 1, (CUdeviceptr)topRebuildTemp->DevPtr(),
+		sizes.tempSizeInBytes, (CUdeviceptr)topRebuildBuffer->DevPtr(), reservedTopRebuild, &handle, 0, 0 ) );
+	cudaEventRecord( topRebuildDone, buildStream );
+	topRebuildPending = true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::FinishTopRebuild                                               |
+//  |  If the background build is done, swap it with the refitted tree. The       |
+//  |  caller, UpdateToplevel, refits it to the current instances right away, so  |
+//  |  the swap takes effect between two frames. Returns true if it did.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::FinishTopRebuild()
+{
+	if (!topRebuildPending || cudaEventQuery( topRebuildDone ) != cudaSuccess) return false;
+	std::swap( topBuffer, topRebuildBuffer );
+	std::swap( reservedTop, reservedTopRebuild );
+	topRebuildPending = false;
+	coreStats.topLevelBackgroundRebuilds++;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::CompactMeshes                                                  |
+//  |  Compact the BVHs of the meshes that were built for it since the last call. |
+//  |  The compacted sizes are read back in one go, and the BVHs are relocated    |
+//  |  into a single arena. The build buffers and scratch memory of these static  |
+//  |  meshes are then released, as are arenas that no longer hold a BVH.   LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::CompactMeshes()
+{
+	vector<CoreMesh*> pending;
+	for (CoreMesh* mesh : meshes) if (mesh->compactPending) pending.push_back( mesh );
+	if (pending.size() > 0)
+	{
+		// a single round trip for the compacted sizes
+		const int count = (int)pending.size();
+		vector<size_t> sizes( count ), offsets( count );
+		for (int i = 0; i < count; i++)
+			cudaMemcpyAsync( &sizes[i], (void*)pending[i]->compactedSize, sizeof( size_t ), cudaMemcpyDeviceToHost, updateStream );
+		cudaStreamSynchronize( updateStream );
+		size_t arenaSize = 0;
+		const size_t align = OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT;
+		for (int i = 0; i < count; i++) offsets[i] = arenaSize, arenaSize += (sizes[i] + align - 1) / align * align;
+		CoreBuffer<uchar>* arena = new CoreBuffer<uchar>( arenaSize, ON_DEVICE, 0, VRAMBVH );
+		const int arenaIdx = (int)gasArenas.size();
+		gasArenas.push_back( arena );
+		for (int i = 0; i < count; i++)
+		{
+			CoreMesh* mesh = pending[i];
+			mesh->gasData = (CUdeviceptr)(arena->DevPtr() + offsets[i]), mesh->gasSize = sizes[i];
+			CHK_OPTIX( optixAccelCompact( optixContext, updateStream, mesh->gasHandle, mesh->gasData, sizes[i], &mesh->gasHandle ) );
+			mesh->compactPending = false, mesh->gasArena = arenaIdx;
+		}
+		cudaStreamSynchronize( updateStream ); // the build buffers are read by the compaction
+		for (CoreMesh* mesh : pending)
+		{
+			delete mesh->buildBuffer, mesh->buildBuffer = 0;
+			delete mesh->buildTemp, mesh->buildTemp = 0;
+		}
+	}
+	// meshes leave their arena when rebuilt or evicted; an arena without meshes is released
+	vector<int> users( gasArenas.size(), 0 );
+	for (const CoreMesh* mesh : meshes) if (mesh->gasArena >= 0) users[mesh->gasArena]++;
+	for (size_t i = 0; i < gasArenas.size(); i++) if (gasArenas[i] && users[i] == 0) delete gasArenas[i], gasArenas[i] = 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::FinishStreamedMeshes                                           |
+//  |  Meshes whose background build completed replace their proxy by the BVH;    |
+//  |  their instances appear in the top-level structure. Returns true if any     |
+//  |  did. The others keep building; the frame does not wait for them.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::FinishStreamedMeshes()
+{
+	bool built = false;
+	coreStats.meshesBuilding = 0;
+	for (CoreMesh* mesh : meshes) if (mesh->streaming)
+	{
+		if (mesh->FinishStreaming( false )) built = true; else coreStats.meshesBuilding++;
+	}
+	if (built) meshesChanged = true, UpdateToplevel();
+	return built;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateResidency                                                |
+//  |  Geometry streaming: keep the meshes with the highest priority on the       |
+//  |  device, within geometryBudget, and evict the others to host memory. The    |
+//  |  priority of a mesh is the projected size of its nearest visible instance;  |
+//  |  meshes without visible instances keep it for STREAMGRACEFRAMES frames.     |
+//  |  Animated meshes, meshes that are rebuilt or refitted, and members of       |
+//  |  instance groups stay resident. At most geometryReloads meshes are reloaded |
+//  |  per frame. Returns true if the scene changed.                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::UpdateResidency( const ViewPyramid& view )
+{
+	coreStats.meshesStreamed = 0;
+	const int meshCount = (int)meshes.size(), instanceCount = (int)instanceMesh.size();
+	bool anyEvicted = false;
+	for (const CoreMesh* mesh : meshes) anyEvicted |= !mesh->resident;
+	if (geometryBudget <= 0 && !anyEvicted) { coreStats.meshesEvicted = 0; return false; }
+	residencyFrame++;
+	// only meshes with a compacted (static) BVH are streamed
+	vector<bool> streamable( meshCount );
+	for (int i = 0; i < meshCount; i++) streamable[i] = meshes[i]->basePositions == 0 && meshes[i]->triangleCount > 0 &&
+		(meshes[i]->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+	for (const InstanceGroup* group : instanceGroups) if (group)
+	{
+		for (const int m : group->mesh) streamable[m] = false;
+		for (const int m : group->prototypes) streamable[m] = false;
+	}
+	// projected size per mesh; behind the camera, meshes still matter for shadows and reflections, but less
+	const float3 forward = normalize( 0.5f * (view.p2 + view.p3) - view.pos );
+	vector<float> projected( meshCount, 0 );
+	for (int i = 0; i < instanceCount; i++)
+	{
+		const int meshIdx = instanceMesh[i];
+		if (meshIdx < 0 || instanceMask[i] == 0 || !streamable[meshIdx]) continue;
+		const CoreMesh* mesh = meshes[meshIdx];
+		const float* T = InstanceTransform( i );
+		const float3 c = 0.5f * (mesh->boundsMin + mesh->boundsMax);
+		const float3 P = make_float3( T[0] * c.x + T[1] * c.y + T[2] * c.z + T[3],
+			T[4] * c.x + T[5] * c.y + T[6] * c.z + T[7], T[8] * c.x + T[9] * c.y + T[10] * c.z + T[11] );
+		const float scale = sqrtf( max( T[0] * T[0] + T[4] * T[4] + T[8] * T[8],
+			max( T[1] * T[1] + T[5] * T[5] + T[9] * T[9], T[2] * T[2] + T[6] * T[6] + T[10] * T[10] ) ) );
+		const float r = 0.5f * length( mesh->boundsMax - mesh->boundsMin ) * scale;
+		const float3 D = P - view.pos;
+		float size = r / max( length( D ) - r, 0.01f * r + 1e-6f );
+		if (dot( D, forward ) < -r) size *= 0.25f;
+		projected[meshIdx] = max( projected[meshIdx], size );
+	}
+	// the budget left after the meshes that always stay resident
+	size_t budget = geometryBudget > 0 ? (size_t)(geometryBudget * 1048576.0f) : (size_t)-1;
+	vector<int> order;
+	for (int i = 0; i < meshCount; i++)
+	{
+		CoreMesh* mesh = meshes[i];
+		if (!streamable[i])
+		{
+			const size_t bytes = mesh->GeometryBytes();
+			budget = bytes < budget ? budget - bytes : 0;
+			continue;
+		}
+		if (projected[i] > 0) mesh->priority = projected[i], mesh->lastVisible = residencyFrame;
+		else if (residencyFrame - mesh->lastVisible > STREAMGRACEFRAMES) mesh->priority = 0;
+		order.push_back( i );
+	}
+	// rank by priority; resident meshes get a bonus, so meshes at the edge of the budget do not alternate
+	auto rank = [&]( const int i ) { return meshes[i]->priority * (meshes[i]->resident ? 1.25f : 1.0f); };
+	std::sort( order.begin(), order.end(), [&]( const int a, const int b ) { return rank( a ) > rank( b ); } );
+	// keep what fits, from high to low priority; evict the rest
+	vector<int> reload;
+	bool changed = false, idle = false;
+	size_t used = 0;
+	for (const int i : order)
+	{
+		CoreMesh* mesh = meshes[i];
+		const size_t bytes = mesh->GeometryBytes();
+		if (used + bytes <= budget)
+		{
+			used += bytes;
+			if (!mesh->resident && (mesh->priority > 0 || geometryBudget <= 0)) reload.push_back( i );
+		}
+		else if (mesh->resident)
+		{
+			if (!idle) cudaDeviceSynchronize(), idle = true; // the data may still be in use by the previous frame
+			mesh->Evict();
+			changed = true;
+		}
+	}
+	for (int s = min( (int)reload.size(), geometryReloads ), i = 0; i < s; i++) meshes[reload[i]]->Reload(), coreStats.meshesStreamed++;
+	if (coreStats.meshesStreamed > 0) changed = true;
+	coreStats.meshesEvicted = 0;
+	for (const CoreMesh* mesh : meshes) if (!mesh->resident) coreStats.meshesEvicted++;
+	// new proxies and BVHs: instances get new handles, masks and descriptors
+	if (changed) meshesChanged = true, UpdateToplevel();
+	return changed;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateRadianceCache                                            |
+//  |  Applies the radiance cache settings: the table gets the largest power of   |
+//  |  two slot count that fits radianceCacheBudget, and starts out empty. Then   |
+//  |  decays the cells, so they keep up with changes in the scene.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateRadianceCache( const cudaStream_t stream )
+{
+	if (radianceCacheDirty)
+	{
+		const size_t budget = (size_t)(radianceCacheBudget * 1024 * 1024), slotBytes = sizeof( float4 ) + sizeof( uint );
+		uint slots = budget >= 1024 * slotBytes ? 1024 : 0;
+		while (slots > 0 && slots < 0x40000000 && (size_t)slots * 2 * slotBytes <= budget) slots *= 2;
+		if (!radianceCells || radianceCells->GetSize() != slots)
+		{
+			delete radianceCells, radianceCells = 0;
+			delete radianceKeys, radianceKeys = 0;
+			if (slots > 0)
+			{
+				radianceCells = new CoreBuffer<float4>( slots, ON_DEVICE, 0, VRAMOther );
+				radianceKeys = new CoreBuffer<uint>( slots, ON_DEVICE, 0, VRAMOther );
+			}
+		}
+		if (radianceCells) radianceCells->Clear( ON_DEVICE ), radianceKeys->Clear( ON_DEVICE );
+		RadianceCache cache;
+		cache.cells = radianceCells ? radianceCells->DevPtr() : 0;
+		cache.keys = radianceKeys ? radianceKeys->DevPtr() : 0;
+		cache.mask = slots - 1;
+		cache.cellSize = radianceCacheCell;
+		cache.updateRate = radianceCacheRate;
+		SetRadianceCache( cache );
+		radianceCacheDirty = false;
+	}
+	if (radianceCells) decayRadianceCache( (uint)radianceCells->GetSize(), stream );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdatePathGuide                                                |
+//  |  Applies the path guiding settings, like UpdateRadianceCache. Then merges   |
+//  |  the training of the last frame into the histograms.                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdatePathGuide( const cudaStream_t stream )
+{
+	if (pathGuideDirty)
+	{
+		const size_t budget = (size_t)(pathGuideBudget * 1024 * 1024);
+		const size_t slotBytes = 2 * GUIDEBINS * sizeof( float ) + 2 * sizeof( float2 ) + sizeof( uint );
+		uint slots = budget >= 1024 * slotBytes ? 1024 : 0;
+		while (slots > 0 && slots < 0x40000000 && (size_t)slots * 2 * slotBytes <= budget) slots *= 2;
+		if (!guideKeys || guideKeys->GetSize() != slots)
+		{
+			delete guideBins, guideBins = 0;
+			delete guideTraining, guideTraining = 0;
+			delete guideStats, guideStats = 0;
+			delete guideTrainStats, guideTrainStats = 0;
+			delete guideKeys, guideKeys = 0;
+			if (slots > 0)
+			{
+				guideBins = new CoreBuffer<float>( slots * GUIDEBINS, ON_DEVICE, 0, VRAMOther );
+				guideTraining = new CoreBuffer<float>( slots * GUIDEBINS, ON_DEVICE, 0, VRAMOther );
+				guideStats = new CoreBuffer<float2>( slots, ON_DEVICE, 0, VRAMOther );
+				guideTrainStats = new CoreBuffer<float2>( slots, ON_DEVICE, 0, VRAMOther );
+				guideKeys = new CoreBuffer<uint>( slots, ON_DEVICE, 0, VRAMOther );
+			}
+		}
+		if (guideKeys)
+		{
+			guideBins->Clear( ON_DEVICE ), guideTraining->Clear( ON_DEVICE );
+			guideStats->Clear( ON_DEVICE ), guideTrainStats->Clear( ON_DEVICE ), guideKeys->Clear( ON_DEVICE );
+		}
+		PathGuide guide;
+		guide.bins = guideBins ? guideBins->DevPtr() : 0;
+		guide.training = guideTraining ? guideTraining->DevPtr() : 0;
+		guide.stats = guideStats ? guideStats->DevPtr() : 0;
+		guide.trainStats = guideTrainStats ? guideTrainStats->DevPtr() : 0;
+		guide.keys = guideKeys ? guideKeys->DevPtr() : 0;
+		guide.mask = slots - 1;
+		guide.cellSize = pathGuideCell;
+		guide.fraction = pathGuideFraction;
+		SetPathGuide( guide );
+		pathGuideDirty = false;
+	}
+	if (guideKeys) mergePathGuide( (uint)guideKeys->GetSize(), stream );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateProbes                                                   |
+//  |  Maps the probe positions to pixels of this frame and points the device at  |
+//  |  the next slot of the readback ring, cleared to NOHIT. Render copies the    |
+//  |  slot back after the wavefront loop; GetProbeResults reads it once it has   |
+//  |  arrived, so picking never waits for a frame.                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateProbes( const int rw, const int rh, const int bandY0, const bool banded, const cudaStream_t stream )
+{
+	if (probePositions.empty() && !probesSet) return;
+	ProbeControl control = {};
+	if (!probePositions.empty())
+	{
+		ProbeReadback& slot = probeRing[probeFrame % PROBERING];
+		if (slot.frame >= 0) cudaEventSynchronize( slot.done ); // PROBERING - 1 frames old: normally complete
+		if (!slot.results) slot.results = new CoreBuffer<float4>( MAXPROBES, ON_HOST | ON_DEVICE, 0, VRAMOther );
+		control.count = (int)probePositions.size();
+		for (int i = 0; i < control.count; i++)
+		{
+			const int2 p = probePositions[i];
+			const int y = banded ? p.y - bandY0 : p.y * rh / scrheight;
+			control.pixels[i] = (y >= 0 && y < rh && p.x >= 0 && p.x < scrwidth) ? (p.x * rw / scrwidth + rw * y) : -1;
+		}
+		control.results = slot.results->DevPtr();
+		cudaMemsetAsync( control.results, 255, control.count * sizeof( float4 ), stream );
+		slot.count = control.count;
+	}
+	SetProbes( control, stream );
+	probesSet = control.count > 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::TraceRayQueries                                                |
+//  |  Traces the rays submitted with QueryRays since the last frame, in a single |
+//  |  launch against the acceleration structures of this frame. The launch uses  |
+//  |  the extension ray phase of the pipeline, with the batch as path states.    |
+//  |  The hits are copied back asynchronously; GetRayQueryResults polls them.    |
+//  |  The batch takes the oldest of the RAYQUERYRING slots.                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::TraceRayQueries( const cudaStream_t stream )
+{
+	if (queryEnds.empty()) return;
+	RayQueryBatch& batch = queryBatches[nextQueryBatch];
+	nextQueryBatch = (nextQueryBatch + 1) % RAYQUERYRING;
+	if (batch.firstTicket >= 0) cudaEventSynchronize( batch.done ); // RAYQUERYRING - 1 frames old: normally complete
+	const int count = (int)queryOrigins.size();
+	if (!batch.hits || batch.hits->GetSize() < count)
+	{
+		delete batch.rays;
+		delete batch.hits;
+		const int capacity = (count + 1023) & ~1023;
+		batch.rays = new CoreBuffer<float4>( 2 * capacity, ON_HOST | ON_DEVICE, 0, VRAMOther );
+		batch.hits = new CoreBuffer<float4>( capacity, ON_HOST | ON_DEVICE, 0, VRAMOther );
+	}
+	const int capacity = (int)batch.hits->GetSize();
+	memcpy( batch.rays->HostPtr(), queryOrigins.data(), count * sizeof( float4 ) );
+	memcpy( batch.rays->HostPtr() + capacity, queryDirections.data(), count * sizeof( float4 ) );
+	batch.rays->CopyToDeviceAsync( 0, count, stream );
+	batch.rays->CopyToDeviceAsync( capacity, count, stream );
+	// the extension phase reads origins at pathStates[i] and directions at pathStates[i + stride], where
+	// stride is scrsize.x * scrsize.y * scrsize.z, and writes the hits to hitData[i]
+	Params& queryParams = pinnedParams[MAXPATHLENGTH + 1];
+	queryParams = params;
+	queryParams.phase = 1;
+	queryParams.rayMask = VISIBLE_ALL;
+	queryParams.scrsize = make_int3( capacity, 1, 1 );
+	queryParams.pathStates = batch.rays->DevPtr();
+	queryParams.hitData = batch.hits->DevPtr();
+	queryParams.bvhRoot = bvhRoot;
+	cudaMemcpyAsync( (void*)d_params, &queryParams, sizeof( Params ), cudaMemcpyHostToDevice, stream );
+	CHK_OPTIX( optixLaunch( pipeline, stream, d_params, sizeof( Params ), &sbt, count, 1, 1 ) );
+	cudaMemcpyAsync( batch.hits->HostPtr(), batch.hits->DevPtr(), count * sizeof( float4 ), cudaMemcpyDeviceToHost, stream );
+	cudaEventRecord( batch.done, stream );
+	batch.firstTicket = nextQueryTicket - (int)queryEnds.size();
+	batch.ends.swap( queryEnds );
+	queryEnds.clear();
+	queryOrigins.clear();
+	queryDirections.clear();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateReservoirs                                               |
+//  |  Light resampling: swaps the reservoir buffers, so that the reservoirs of   |
+//  |  the previous frame become the history of this one. The history is only     |
+//  |  used if it was rendered with the same path layout, and not in banded       |
+//  |  mode, where each band has its own view.                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateReservoirs( const ViewPyramid& view, const uint pathCount, const bool banded, const cudaStream_t stream )
+{
+	ReSTIRControl control = {};
+	if (!useReSTIR)
+	{
+		if (!reservoirBuffer[0]) return;
+		delete reservoirBuffer[0], reservoirBuffer[0] = 0;
+		delete reservoirBuffer[1], reservoirBuffer[1] = 0;
+		SetReSTIR( control, stream );
+		return;
+	}
+	if (!reservoirBuffer[0])
+	{
+		for (int i = 0; i < 2; i++) reservoirBuffer[i] = new CoreBuffer<float4>( pathStateBuffer->GetSize(), ON_DEVICE, 0, VRAMPathStates );
+		reservoirHistory = false;
+	}
+	swap( reservoirBuffer[0], reservoirBuffer[1] );
+	// paths that do not reach a diffuse primary vertex leave their reservoir empty
+	cudaMemsetAsync( reservoirBuffer[0]->DevPtr() + pathCount, 0, pathCount * sizeof( float4 ), stream );
+	control.reservoirs = reservoirBuffer[0]->DevPtr();
+	control.history = (reservoirHistory && !banded && pathCount == reservoirPaths) ? reservoirBuffer[1]->DevPtr() : 0;
+	control.prevPos = reservoirView.pos, control.prevP1 = reservoirView.p1;
+	control.prevRight = reservoirView.p2 - reservoirView.p1, control.prevUp = reservoirView.p3 - reservoirView.p1;
+	control.candidates = restirCandidates;
+	control.reuseTaps = restirReuseTaps;
+	control.maxHistory = restirMaxHistory;
+	SetReSTIR( control, stream );
+	reservoirHistory = true, reservoirView = view, reservoirPaths = pathCount;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::ReprojectAccumulator                                           |
+//  |  Temporal reprojection: on a restart, the previous frame is warped along    |
+//  |  the motion vectors into a history, with the sample count of each pixel;    |
+//  |  disoccluded pixels start empty. Every frame then presents the samples of   |
+//  |  the accumulator combined with that history, so a moving camera keeps the   |
+//  |  converged surfaces that stay in view. Returns the combined frame; its      |
+//  |  pixels are averages.                                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+const float4* RenderCore::ReprojectAccumulator( const int w, const int h, const bool restart )
+{
+	if (!reprojectFrame[0])
+	{
+		for (int i = 0; i < 2; i++)
+			reprojectFrame[i] = new CoreBuffer<float4>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers ),
+			reprojectHistory[i] = new CoreBuffer<float4>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers );
+		reprojectValid = false;
+	}
+	swap( reprojectFrame[0], reprojectFrame[1] ); // reprojectFrame[1]: the previous frame
+	const bool rebuild = restart || !reprojectValid;
+	if (rebuild)
+	{
+		swap( reprojectHistory[0], reprojectHistory[1] );
+		if (!reprojectValid) cudaMemsetAsync( reprojectHistory[0]->DevPtr(), 0, w * h * sizeof( float4 ) );
+	}
+	reprojectAccumulator( accumulator->DevPtr(), samplesTaken, hitMotionBuffer->DevPtr(), hitDepthBuffer->DevPtr(),
+		(rebuild && reprojectValid) ? reprojectFrame[1]->DevPtr() : 0, reprojectHistory[1]->DevPtr(), reprojectSpp,
+		reprojectHistory[0]->DevPtr(), reprojectFrame[0]->DevPtr(), w, h, reprojectMaxHistory, REPROJECTDEPTH );
+	reprojectValid = true, reprojectSpp = samplesTaken;
+	return reprojectFrame[0]->DevPtr();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateHitMotion                                                |
+//  |  Motion vectors: the shade kernel writes the screen space motion of each    |
+//  |  primary hit, using the transform that the instance had in the previous     |
+//  |  frame, see SetInstanceMotion. Moving objects thus reproject to where they  |
+//  |  were, rather than to where the camera saw that point. Used by upscale,     |
+//  |  for dynamic resolution.                                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateHitMotion( const bool enabled, const bool depth, const cudaStream_t stream )
+{
+	MotionControl control = {};
+	if (!enabled)
+	{
+		if (!hitMotionBuffer) return;
+		delete hitMotionBuffer, hitMotionBuffer = 0;
+		delete hitDepthBuffer, hitDepthBuffer = 0;
+		SetHitMotion( control, stream );
+		return;
+	}
+	if (!hitMotionBuffer) hitMotionBuffer = new CoreBuffer<float2>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers );
+	if (depth && !hitDepthBuffer) hitDepthBuffer = new CoreBuffer<float>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers );
+	if (!depth) delete hitDepthBuffer, hitDepthBuffer = 0;
+	control.motion = hitMotionBuffer->DevPtr();
+	control.prevDepth = hitDepthBuffer ? hitDepthBuffer->DevPtr() : 0;
+	control.prevPos = prevView.pos, control.prevP1 = prevView.p1;
+	control.prevRight = prevView.p2 - prevView.p1, control.prevUp = prevView.p3 - prevView.p1;
+	SetHitMotion( control, stream );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTextures                                                    |
+//  |  Set the texture data.                                                LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTextures( const CoreTexDesc* tex, const int textures )
+{
+	// determine the pool of each texture: its regular texel pool, or one of the pools for block
+	// compressed textures (BCTEXTURES) and hardware texture objects (HWTEXTURES).
+	vector<char> pools( textures );
+	for (int i = 0; i < textures; i++)
+	{
+		pools[i] = tex[i].storage;
+	#ifdef BCTEXTURES
+		if (compressTextures && Compressible( tex[i] )) pools[i] = BLOCKPOOL;
+	#endif
+	#ifdef HWTEXTURES
+		if (hardwareTextures) pools[i] = HARDWAREPOOL;
+	#endif
+	}
+	// determine which texel pools need to be rebuilt: a pool can be updated in place if each of
+	// its textures existed before with the same storage type, and still fits in its old range.
+	// the block compressed and hardware pools are rebuilt when any of their textures changes.
+#ifdef VIRTUALTEXTURES
+	bool rebuild[5] = { texel32Pager == 0, texel128Buffer == 0, normal32Pager == 0, bc1Buffer == 0, texObjectBuffer == 0 };
+#else
+	bool rebuild[5] = { texel32Buffer == 0, texel128Buffer == 0, normal32Buffer == 0, bc1Buffer == 0, texObjectBuffer == 0 };
+#endif
+	for (int i = 0; i < textures; i++)
+	{
+		const int pool = pools[i];
+		if (i >= textureCount) rebuild[pool] = true;
+		else if (pool != texPool[i] || tex[i].storage != texDescs[i].storage) rebuild[pool] = rebuild[texPool[i]] = true;
+		else if (pool >= BLOCKPOOL ? tex[i].changed : tex[i].pixelCount > texCapacity[i]) rebuild[pool] = true;
+	}
+	for (int i = textures; i < textureCount; i++) rebuild[texPool[i]] = true; // compact
+	// copy the supplied array of texture descriptors; keep offsets for pools that we update in place
+	CoreTexDesc* oldDescs = texDescs;
+	texDescs = textures > 0 ? new CoreTexDesc[textures] : 0;
+	if (textures > 0) memcpy( texDescs, tex, textures * sizeof( CoreTexDesc ) );
+	for (int i = 0; i < textures; i++) if (!rebuild[pools[i]]) texDescs[i].firstPixel = oldDescs[i].firstPixel;
+	delete oldDescs;
+	textureCount = textures;
+	texCapacity.resize( textureCount );
+	texPool = pools;
+	// copy texels for each type to the device
+	if (rebuild[TexelStorage::ARGB32]) SyncStorageType( TexelStorage::ARGB32 );
+	if (rebuild[TexelStorage::ARGB128]) SyncStorageType( TexelStorage::ARGB128 );
+	if (rebuild[TexelStorage::NRM32]) SyncStorageType( TexelStorage::NRM32 );
+#ifdef BCTEXTURES
+	if (rebuild[BLOCKPOOL]) SyncCompressedTextures();
+#endif
+#ifdef HWTEXTURES
+	if (rebuild[HARDWAREPOOL]) SyncTextureObjects();
+#endif
+	// in-place updates: copy only the texels of modified textures
+	for (int i = 0; i < textureCount; i++) if (texPool[i] == texDescs[i].storage && !rebuild[texPool[i]] && texDescs[i].changed)
+	{
+		const CoreTexDesc& t = texDescs[i];
+		switch (t.storage)
+		{
+	#ifdef VIRTUALTEXTURES
+		case TexelStorage::ARGB32:
+			texel32Pager->Write( t.firstPixel, (const uint*)t.idata, t.pixelCount );
+			texel32Pager->Invalidate( t.firstPixel, t.pixelCount );
+			break;
+		case TexelStorage::NRM32:
+			normal32Pager->Write( t.firstPixel, (const uint*)t.idata, t.pixelCount );
+			normal32Pager->Invalidate( t.firstPixel, t.pixelCount );
+			break;
+	#else
+		case TexelStorage::ARGB32: stagingRing->Upload( texel32Buffer->DevPtr() + t.firstPixel, t.idata, t.pixelCount * sizeof( uint ) ); break;
+		case TexelStorage::NRM32: stagingRing->Upload( normal32Buffer->DevPtr() + t.firstPixel, t.idata, t.pixelCount * sizeof( uint ) ); break;
+	#endif
+		case TexelStorage::ARGB128: stagingRing->Upload( texel128Buffer->DevPtr() + t.firstPixel, t.fdata, t.pixelCount * sizeof( float4 ) ); break;
+		}
+	}
+	// Notes: 
+	// - the three types are copied from the original HostTexture pixel data (to which the
+	//   descriptors point) straight to the GPU. There is no pixel storage on the host
+	//   in the RenderCore.
+	// - the types are copied one by one, through the pinned staging ring; apart from the
+	//   virtual texture pools, no temporary host-side copy of a pool is made.
+	// - each texture owns a range of texCapacity[i] texels in its pool. A modified texture
+	//   that still fits in this range is copied in place; other textures are not touched.
+	// - with VIRTUALTEXTURES, the ARGB32 and NRM32 pools are virtual: the RenderCore keeps them
+	//   on the host, and TexelPager streams the pages that the shading code uses to the device.
+	// - with BCTEXTURES and compressTextures, opaque ARGB32 textures are stored as BC1 and normal
+	//   maps as BC5, at a quarter of the size (BC5: half). These are not paged.
+	// - with HWTEXTURES and hardwareTextures, each texture is a CUDA mipmapped array, sampled
+	//   through a texture object. This takes precedence over block compression.
+}
+
+#ifdef HWTEXTURES
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SyncTextureObjects                                             |
+//  |  Copy the textures of the hardware pool to mipmapped arrays and create a    |
+//  |  texture object for each. The texel offset of these textures is the index   |
+//  |  of the texture object in texObjectBuffer, tagged with HWTEXTURE.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SyncTextureObjects()
+{
+	// release the previous set
+	if (texObjectBuffer) for (int i = 0; i < texObjectBuffer->GetSize(); i++) if (texObjectBuffer->HostPtr()[i])
+		CHK_CUDA( cudaDestroyTextureObject( texObjectBuffer->HostPtr()[i] ) );
+	for (cudaMipmappedArray_t a : texArrays) CHK_CUDA( cudaFreeMipmappedArray( a ) );
+	texArrays.clear();
+	delete texObjectBuffer;
+	texObjectBuffer = new CoreBuffer<cudaTextureObject_t>( max( 1, textureCount ), ON_HOST | ON_DEVICE, 0, VRAMTextures );
+	texObjectBuffer->Clear( ON_HOST );
+	for (int i = 0; i < textureCount; i++) if (texPool[i] == HARDWAREPOOL)
+	{
+		const CoreTexDesc& t = texDescs[i];
+		const bool hdr = t.storage == TexelStorage::ARGB128;
+		const size_t texelSize = hdr ? sizeof( float4 ) : sizeof( uint );
+		uint levels = 0;
+		while (levels < t.MIPlevels && (t.width >> levels) > 0 && (t.height >> levels) > 0) levels++;
+		// upload the MIP levels, which are stored consecutively in the HostTexture
+		const cudaChannelFormatDesc format = hdr ? cudaCreateChannelDesc<float4>() : cudaCreateChannelDesc<uchar4>();
+		cudaMipmappedArray_t array;
+		CHK_CUDA( cudaMallocMipmappedArray( &array, &format, make_cudaExtent( t.width, t.height, 0 ), levels ) );
+		texArrays.push_back( array );
+		const uchar* texels = (const uchar*)t.idata;
+		for (uint l = 0; l < levels; l++)
+		{
+			const size_t w = t.width >> l, h = t.height >> l;
+			cudaArray_t level;
+			CHK_CUDA( cudaGetMipmappedArrayLevel( &level, array, l ) );
+			CHK_CUDA( cudaMemcpy2DToArray( level, 0, 0, texels, w * texelSize, w * texelSize, h, cudaMemcpyHostToDevice ) );
+			texels += w * h * texelSize;
+		}
+		// create the texture object; filtering matches FetchTexel and FetchTexelTrilinear
+		cudaResourceDesc resource;
+		memset( &resource, 0, sizeof( resource ) );
+		resource.resType = cudaResourceTypeMipmappedArray;
+		resource.res.mipmap.mipmap = array;
+		cudaTextureDesc desc;
+		memset( &desc, 0, sizeof( desc ) );
+		desc.addressMode[0] = desc.addressMode[1] = cudaAddressModeWrap;
+	#ifdef BILINEAR
+		desc.filterMode = cudaFilterModeLinear;
+	#else
+		desc.filterMode = cudaFilterModePoint;
+	#endif
+		desc.mipmapFilterMode = cudaFilterModeLinear;
+		desc.maxMipmapLevelClamp = (float)(levels - 1);
+		desc.readMode = hdr ? cudaReadModeElementType : cudaReadModeNormalizedFloat;
+		desc.normalizedCoords = 1;
+		CHK_CUDA( cudaCreateTextureObject( texObjectBuffer->HostPtr() + i, &resource, &desc, 0 ) );
+		texDescs[i].firstPixel = HWTEXTURE | i;
+	}
+	texObjectBuffer->CopyToDevice();
+	SetTextureObjects( texObjectBuffer->DevPtr() );
+}
+#endif
+
+#ifdef BCTEXTURES
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Compressible                                                   |
+//  |  A texture can be block compressed if it is an ARGB32 texture without       |
+//  |  transparent texels, or a normal map.                                 LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::Compressible( const CoreTexDesc& tex )
+{
+	if (tex.storage == TexelStorage::ARGB128 || tex.width == 0 || tex.height == 0) return false;
+	if (tex.storage == TexelStorage::NRM32 || tex.blocks) return true;
+	// BC1 decodes to opaque texels; alpha testing compares against 0.5
+	for (uint i = 0; i < tex.pixelCount; i++) if (tex.idata[i].w < 128) return false;
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SyncCompressedTextures                                         |
+//  |  Encode the block compressed textures and copy them to the device. The      |
+//  |  texel offset of these textures is a block offset, tagged with BCTEXTURE.   |
+//  |  Textures that come with blocks (KTX2 files) are copied as they are.  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SyncCompressedTextures()
+{
+	// encode in parallel; each texture gets its own list of blocks
+	vector<vector<uint2>> bc1Blocks( textureCount );
+	vector<vector<uint4>> bc5Blocks( textureCount );
+	RunJobs( textureCount, [&]( const int i ) {
+		const CoreTexDesc& t = texDescs[i];
+		if (texPool[i] != BLOCKPOOL) return;
+		if (t.blocks && t.storage == TexelStorage::ARGB32) bc1Blocks[i].assign( (const uint2*)t.blocks, (const uint2*)t.blocks + t.blockCount );
+		else if (t.blocks) bc5Blocks[i].assign( (const uint4*)t.blocks, (const uint4*)t.blocks + t.blockCount );
+		else if (t.storage == TexelStorage::ARGB32) EncodeBC1( (const uint*)t.idata, t.width, t.height, t.MIPlevels, bc1Blocks[i] );
+		else EncodeBC5( (const uint*)t.idata, t.width, t.height, t.MIPlevels, bc5Blocks[i] );
+	} );
+	// construct the continuous arrays
+	size_t bc1Total = 0, bc5Total = 0;
+	for (int i = 0; i < textureCount; i++) bc1Total += bc1Blocks[i].size(), bc5Total += bc5Blocks[i].size();
+	delete bc1Buffer;
+	delete bc5Buffer;
+	bc1Buffer = new CoreBuffer<uint2>( max( (size_t)16, bc1Total ), ON_HOST | ON_DEVICE, 0, VRAMTextures );
+	bc5Buffer = new CoreBuffer<uint4>( max( (size_t)16, bc5Total ), ON_HOST | ON_DEVICE, 0, VRAMTextures );
+	coreStats.bcBlockCount = (uint)(bc1Total + bc5Total);
+	bc1Total = bc5Total = 0;
+	for (int i = 0; i < textureCount; i++) if (texPool[i] == BLOCKPOOL)
+	{
+		if (texDescs[i].storage == TexelStorage::ARGB32)
+		{
+			memcpy( bc1Buffer->HostPtr() + bc1Total, bc1Blocks[i].data(), bc1Blocks[i].size() * sizeof( uint2 ) );
+			texDescs[i].firstPixel = BCTEXTURE | (uint)bc1Total;
+			bc1Total += bc1Blocks[i].size();
+		}
+		else
+		{
+			memcpy( bc5Buffer->HostPtr() + bc5Total, bc5Blocks[i].data(), bc5Blocks[i].size() * sizeof( uint4 ) );
+			texDescs[i].firstPixel = BCTEXTURE | (uint)bc5Total;
+			bc5Total += bc5Blocks[i].size();
+		}
+	}
+	// move to device
+	bc1Buffer->MoveToDevice();
+	bc5Buffer->MoveToDevice();
+	SetBCPixels( bc1Buffer->DevPtr(), bc5Buffer->DevPtr() );
+}
+#endif
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SyncStorageType                                                |
+//  |  Copies texel data for one storage type (argb32, argb128 or nrm32) to the   |
+//  |  device. Note that this data is obtained from the original HostTexture      |
+//  |  texel arrays.                                                        LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SyncStorageType( const TexelStorage storage )
+{
+	uint texelTotal = 0;
+	for (int i = 0; i < textureCount; i++) if (texPool[i] == storage) texelTotal += texDescs[i].pixelCount;
+	texelTotal = max( 16, texelTotal ); // OptiX does not tolerate empty buffers...
+#ifdef VIRTUALTEXTURES
+	// the device memory budget for the virtual pools is divided over them by size
+	size_t pagedTotal = 0;
+	for (int i = 0; i < textureCount; i++) if (texPool[i] == TexelStorage::ARGB32 || texPool[i] == TexelStorage::NRM32) pagedTotal += texDescs[i].pixelCount;
+	const size_t budgetPages = (size_t)textureBudget * (1 << 20) / (TEXPAGESIZE * sizeof( uint ));
+	const int poolPages = (int)min( (size_t)INT_MAX, budgetPages * texelTotal / max( pagedTotal, (size_t)texelTotal ) );
+	// with a host budget, the virtual pools are stored in page files, and only a part is kept in host memory
+	const size_t hostBudgetPages = (size_t)textureHostBudget * (1 << 20) / (TEXPAGESIZE * sizeof( uint ));
+	const int hostPages = (int)min( (size_t)INT_MAX, hostBudgetPages * texelTotal / max( pagedTotal, (size_t)texelTotal ) );
+#endif
+	// construct the continuous arrays
+	switch (storage)
+	{
+	case TexelStorage::ARGB32:
+	#ifdef VIRTUALTEXTURES
+		delete texel32Pager;
+		texel32Pager = new TexelPager( texelTotal, poolPages, textureHostBudget > 0 ? "texelpool_argb32.bin" : 0, hostPages );
+		SetARGB32Pixels( texel32Pager->pool->DevPtr() );
+		SetARGB32Pages( texel32Pager->pageTable->DevPtr(), texel32Pager->usage->DevPtr() );
+	#else
+		delete texel32Buffer;
+		texel32Buffer = PoolBuffer<uint>( texelTotal, VRAMTextures );
+		SetARGB32Pixels( texel32Buffer->DevPtr() );
+	#endif
+		coreStats.argb32TexelCount = texelTotal;
+		break;
+	case TexelStorage::ARGB128:
+		delete texel128Buffer;
+		SetARGB128Pixels( (texel128Buffer = PoolBuffer<float4>( texelTotal, VRAMTextures ))->DevPtr() );
+		coreStats.argb128TexelCount = texelTotal;
+		break;
+	case TexelStorage::NRM32:
+	#ifdef VIRTUALTEXTURES
+		delete normal32Pager;
+		normal32Pager = new TexelPager( texelTotal, poolPages, textureHostBudget > 0 ? "texelpool_nrm32.bin" : 0, hostPages );
+		SetNRM32Pixels( normal32Pager->pool->DevPtr() );
+		SetNRM32Pages( normal32Pager->pageTable->DevPtr(), normal32Pager->usage->DevPtr() );
+	#else
+		delete normal32Buffer;
+		SetNRM32Pixels( (normal32Buffer = PoolBuffer<uint>( texelTotal, VRAMTextures ))->DevPtr() );
+	#endif
+		coreStats.nrm32TexelCount = texelTotal;
+		break;
+	}
+	// copy texel data to arrays
+	texelTotal = 0;
+	const size_t texelSize = storage == TexelStorage::ARGB128 ? sizeof( float4 ) : sizeof( uint );
+	for (int i = 0; i < textureCount; i++) if (texPool[i] == storage)
+	{
+		const size_t bytes = texDescs[i].pixelCount * texelSize;
+		switch (storage)
+		{
+	#ifdef VIRTUALTEXTURES
+		case TexelStorage::ARGB32:  texel32Pager->Write( texelTotal, (const uint*)texDescs[i].idata, texDescs[i].pixelCount ); break;
+		case TexelStorage::NRM32:   normal32Pager->Write( texelTotal, (const uint*)texDescs[i].idata, texDescs[i].pixelCount ); break;
+	#else
+		// straight from the HostTexture to the device, through the staging ring
+		case TexelStorage::ARGB32:  stagingRing->Upload( texel32Buffer->DevPtr() + texelTotal, texDescs[i].idata, bytes ); break;
+		case TexelStorage::NRM32:   stagingRing->Upload( normal32Buffer->DevPtr() + texelTotal, texDescs[i].idata, bytes ); break;
+	#endif
+		case TexelStorage::ARGB128: stagingRing->Upload( texel128Buffer->DevPtr() + texelTotal, texDescs[i].idata, bytes ); break;
+		}
+		texDescs[i].firstPixel = texelTotal;
+		texCapacity[i] = texDescs[i].pixelCount;
+		texelTotal += texDescs[i].pixelCount;
+	}
+#ifdef VIRTUALTEXTURES
+	// move to device
+	if (storage == TexelStorage::ARGB32) texel32Pager->Commit();
+	if (storage == TexelStorage::NRM32) normal32Pager->Commit();
+#endif
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::PatchMaterialTextures                                          |
+//  |  Replace the texture IDs of a material by the offsets of the textures in    |
+//  |  the continuous texel arrays.                                         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::PatchMaterialTextures( CoreMaterial& m, const CoreMaterialEx& e )
+{
+	if (e.texture[0] != -1) m.texaddr0 = texDescs[e.texture[0]].firstPixel;
+	if (e.texture[1] != -1) m.texaddr1 = texDescs[e.texture[1]].firstPixel;
+	if (e.texture[2] != -1) m.texaddr2 = texDescs[e.texture[2]].firstPixel;
+	if (e.texture[3] != -1) m.nmapaddr0 = texDescs[e.texture[3]].firstPixel;
+	if (e.texture[4] != -1) m.nmapaddr1 = texDescs[e.texture[4]].firstPixel;
+	if (e.texture[5] != -1) m.nmapaddr2 = texDescs[e.texture[5]].firstPixel;
+	if (e.texture[6] != -1) m.smapaddr = texDescs[e.texture[6]].firstPixel;
+	if (e.texture[7] != -1) m.rmapaddr = texDescs[e.texture[7]].firstPixel;
+	// if (e.texture[ 8] != -1) m.texaddr0 = texDescs[e.texture[ 8]].firstPixel; second roughness map is not used
+	if (e.texture[9] != -1) m.cmapaddr = texDescs[e.texture[9]].firstPixel;
+	if (e.texture[10] != -1) m.amapaddr = texDescs[e.texture[10]].firstPixel;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetMaterials                                                   |
+//  |  Set the material data.                                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount )
+{
+	// Notes:
+	// Call this after the textures have been set; CoreMaterials store the offset of each texture
+	// in the continuous arrays; this data is valid only when textures are in sync.
+	delete materialBuffer;
+	delete hostMaterialBuffer;
+	hostMaterialBuffer = new CoreMaterial[materialCount];
+	memcpy( hostMaterialBuffer, mat, materialCount * sizeof( CoreMaterial ) );
+	for (int i = 0; i < materialCount; i++) PatchMaterialTextures( hostMaterialBuffer[i], matEx[i] );
+	materialBuffer = new CoreBuffer<CoreMaterial>( materialCount, ON_DEVICE, 0, VRAMScene );
+	materialBuffer->SetHostData( hostMaterialBuffer ); // for alpha mapped tris
+	stagingRing->Upload( materialBuffer->DevPtr(), hostMaterialBuffer, materialCount * sizeof( CoreMaterial ) );
+	SetMaterialList( materialBuffer->DevPtr() );
+	delete materialClassBuffer;
+	materialClassBuffer = new CoreBuffer<uint>( max( materialCount, 1 ), ON_HOST | ON_DEVICE, 0, VRAMScene );
+	UpdateShadeClasses( 0, materialCount );
+	SetMaterialClasses( materialClassBuffer->DevPtr() );
+#ifdef SHADECOST
+	delete materialCostBuffer;
+	materialCostBuffer = new CoreBuffer<CoreMaterialCost>( max( materialCount, 1 ), ON_HOST | ON_DEVICE );
+	materialCostBuffer->Clear( ON_DEVICE );
+	SetMaterialCosts( materialCostBuffer->DevPtr() );
+#endif
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateMaterials                                                |
+//  |  Overwrite a range of the materials; the material count stays the same.     |
+//  |  Used when a few materials were edited.                               LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::UpdateMaterials( const CoreMaterial* mat, const CoreMaterialEx* matEx, const int first, const int count )
+{
+	if (materialBuffer == 0 || first < 0 || first + count > materialBuffer->GetSize()) return false;
+	if (count == 0) return true;
+	memcpy( hostMaterialBuffer + first, mat, count * sizeof( CoreMaterial ) );
+	for (int i = 0; i < count; i++) PatchMaterialTextures( hostMaterialBuffer[first + i], matEx[i] );
+	stagingRing->Upload( materialBuffer->DevPtr() + first, hostMaterialBuffer + first, count * sizeof( CoreMaterial ) );
+	UpdateShadeClasses( first, count );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateShadeClasses                                             |
+//  |  Classify a range of the materials for the specialized shade kernels: a     |
+//  |  material without subsurface, clearcoat and transmission is SHADE_BASIC.    |
+//  |  Texture maps do not affect these parameters, see GetShadingData.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateShadeClasses( const int first, const int count )
+{
+	uint* classes = materialClassBuffer->HostPtr();
+	for (int i = first; i < first + count; i++)
+	{
+		const uint4& p = hostMaterialBuffer[i].parameters;
+		classes[i] = ((p.x & 0xff00) == 0 && (p.z & 0xff00ff) == 0) ? SHADE_BASIC : SHADE_FULL;
+	}
+	if (count > 0) stagingRing->Upload( materialClassBuffer->DevPtr() + first, classes + first, count * sizeof( uint ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLights                                                      |
+//  |  Set the light data.                                                  LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLights( const CoreLightTri* areaLights, const int areaLightCount,
+	const CorePointLight* pointLights, const int pointLightCount,
+	const CoreSpotLight* spotLights, const int spotLightCount,
+	const CoreDirectionalLight* directionalLights, const int directionalLightCount )
+{
+	reservoirHistory = false; // light indices in the reservoirs refer to the old lights
+	delete areaLightBuffer;
 	delete pointLightBuffer;
 	delete spotLightBuffer;
 	delete directionalLightBuffer;
-	SetAreaLights( (areaLightBuffer = new CoreBuffer<CoreLightTri>( areaLightCount, ON_DEVICE, areaLights ))->DevPtr() );
-	SetPointLights( (pointLightBuffer = new CoreBuffer<CorePointLight>( pointLightCount, ON_DEVICE, pointLights ))->DevPtr() );
-	SetSpotLights( (spotLightBuffer = new CoreBuffer<CoreSpotLight>( spotLightCount, ON_DEVICE, spotLights ))->DevPtr() );
-	SetDirectionalLights( (directionalLightBuffer = new CoreBuffer<CoreDirectionalLight>( directionalLightCount, ON_DEVICE, directionalLights ))->DevPtr() );
+	SetAreaLights( (areaLightBuffer = new CoreBuffer<CoreLightTri>( areaLightCount, ON_DEVICE, 0, VRAMScene ))->DevPtr() );
+	SetPointLights( (pointLightBuffer = new CoreBuffer<CorePointLight>( pointLightCount, ON_DEVICE, 0, VRAMScene ))->DevPtr() );
+	SetSpotLights( (spotLightBuffer = new CoreBuffer<CoreSpotLight>( spotLightCount, ON_DEVICE, 0, VRAMScene ))->DevPtr() );
+	SetDirectionalLights( (directionalLightBuffer = new CoreBuffer<CoreDirectionalLight>( directionalLightCount, ON_DEVICE, 0, VRAMScene ))->DevPtr() );
+	stagingRing->Upload( areaLightBuffer->DevPtr(), areaLights, areaLightCount * sizeof( CoreLightTri ) );
+	stagingRing->Upload( pointLightBuffer->DevPtr(), pointLights, pointLightCount * sizeof( CorePointLight ) );
+	stagingRing->Upload( spotLightBuffer->DevPtr(), spotLights, spotLightCount * sizeof( CoreSpotLight ) );
+	stagingRing->Upload( directionalLightBuffer->DevPtr(), directionalLights, directionalLightCount * sizeof( CoreDirectionalLight ) );
 	SetLightCounts( areaLightCount, pointLightCount, spotLightCount, directionalLightCount );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateAreaLights                                               |
+//  |  Overwrite a range of the area lights; the light counts stay the same.      |
+//  |  Used when a few emissive instances moved.                            LH2'19|
+//  +-----------------------------------------------------------------------------+
+bool RenderCore::UpdateAreaLights( const CoreLightTri* areaLights, const int first, const int count )
+{
+	if (areaLightBuffer == 0 || first < 0 || first + count > areaLightBuffer->GetSize()) return false;
+	if (count > 0) stagingRing->Upload( areaLightBuffer->DevPtr() + first, areaLights, count * sizeof( CoreLightTri ) );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLightTree                                                   |
+//  |  Set the light tree, used for light selection with LIGHTTREE.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount )
+{
+	delete lightTreeBuffer;
+	SetLightTreeNodes( (lightTreeBuffer = new CoreBuffer<CoreLightTreeNode>( nodeCount, ON_DEVICE, 0, VRAMScene ))->DevPtr() );
+	stagingRing->Upload( lightTreeBuffer->DevPtr(), nodes, nodeCount * sizeof( CoreLightTreeNode ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetLightAliasTable                                             |
+//  |  Set the alias table, used for light selection with ALIASLIGHTS.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetLightAliasTable( const CoreLightAlias* table, const int count )
+{
+	delete lightAliasBuffer;
+	SetLightAliasEntries( (lightAliasBuffer = new CoreBuffer<CoreLightAlias>( count, ON_DEVICE, 0, VRAMScene ))->DevPtr() );
+	stagingRing->Upload( lightAliasBuffer->DevPtr(), table, count * sizeof( CoreLightAlias ) );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::SetSkyData                                                     |
-//  |  Set the sky dome data.                                               LH2'19|
+//  |  Set the sky dome data. It is stored as a pyramid of half precision         |
+//  |  texels; SampleSkydome picks the level from the ray cone.             LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetSkyData( const float3* pixels, const uint width, const uint height )
 {
+	vector<uint2> pyramid;
+	skylevels = CUDATools::BuildSkyPyramid( pixels, width, height, pyramid );
 	delete skyPixelBuffer;
-	skyPixelBuffer = new CoreBuffer<float3>( width * height, ON_DEVICE, pixels );
+	skyPixelBuffer = new CoreBuffer<uint2>( pyramid.size(), ON_DEVICE, pyramid.data(), VRAMScene );
 	SetSkyPixels( skyPixelBuffer->DevPtr() );
-	SetSkySize( width, height );
+	SetSkySize( width, height, skylevels );
 	skywidth = width;
 	skyheight = height;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetSkyImportance                                               |
+//  |  Set the cdf for next event estimation towards the sky dome.          LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetSkyImportance( const float* cdf, const uint width, const uint height )
+{
+	delete skyCDFBuffer;
+	skyCDFBuffer = cdf ? new CoreBuffer<float>( (height + 1) + height * (width + 1), ON_DEVICE, cdf, VRAMScene ) : 0;
+	SetSkyCDF( skyCDFBuffer ? skyCDFBuffer->DevPtr() : 0, width, height );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::Setting                                                        |
 //  |  Modify a render setting.                                             LH2'19|
@@ -582,65 +2612,580 @@ void RenderCore::Setting( const char* name, const float value )
 			SetClampValue( value );
 		}
 	}
+	else if (!strcmp( name, "asyncWavefront" ))
+	{
+		asyncWavefront = value != 0;
+		if (connectionBuffer) SizeConnections();
+	}
+	else if (!strcmp( name, "cudaGraph" ))
+	{
+		useCudaGraph = value != 0;
+	}
+	else if (!strcmp( name, "megakernel" ))
+	{
+		// trace and shade all segments of a path in the raygen program, keeping the path state in registers;
+		// ignored if .optix.cu has no __raygen__megakernel. Wavefront features (sorting, caches, ReSTIR) do not apply.
+		megakernel = value != 0;
+	}
+	else if (!strcmp( name, "shaderReordering" ))
+	{
+		// megakernel: reorder threads on this many bits of material coherence hint before shading, 0 disables;
+		// ignored unless .optix.cu was compiled with OptiX 8 or later and traces through TraceReordered
+		pathControl.reorderBits = (uint)max( 0, min( 16, (int)value ) );
+	}
+	else if (!strcmp( name, "videoKeyFrame" ))
+	{
+		// video target: encode the next frame as a key frame, e.g. when a client joins the stream
+		videoKeyFrame = value != 0;
+	}
+	else if (!strcmp( name, "gasRebuildInterval" ))
+	{
+		gasRebuildInterval = max( 0, (int)value );
+	}
+	else if (!strcmp( name, "topRebuildInterval" ))
+	{
+		topRebuildInterval = max( 0, (int)value );
+	}
+	else if (!strcmp( name, "backgroundRebuilds" ))
+	{
+		// refitted BVHs keep refitting while their full build runs on the build stream
+		backgroundRebuilds = value != 0;
+	}
+	else if (!strcmp( name, "textureBudget" ))
+	{
+		// device memory for the virtual texel pools, in MB; applies when the pools are rebuilt
+		textureBudget = max( 1, (int)value );
+	}
+	else if (!strcmp( name, "textureHostBudget" ))
+	{
+		// host memory for the virtual texel pools, in MB; 0 keeps the pools in host memory entirely.
+		// otherwise, the pools are stored in page files on disk. Applies when the pools are rebuilt.
+		textureHostBudget = max( 0, (int)value );
+	}
+	else if (!strcmp( name, "texturePageUploads" ))
+	{
+		texturePageUploads = max( 0, (int)value );
+	}
+	else if (!strcmp( name, "compressTextures" ))
+	{
+		// block compress opaque ARGB32 textures and normal maps; applies to the next SetTextures call
+		compressTextures = value != 0;
+	}
+	else if (!strcmp( name, "hardwareTextures" ))
+	{
+		// sample textures through CUDA texture objects; applies to the next SetTextures call
+		hardwareTextures = value != 0;
+	}
+	else if (!strcmp( name, "streamGeometry" ))
+	{
+		// applies to meshes sent after this point
+		streamGeometry = value != 0;
+	}
+	else if (!strcmp( name, "packTriangles" ))
+	{
+		// applies to meshes sent after this point
+		packTriangles = value != 0;
+	}
+	else if (!strcmp( name, "quantizePositions" ))
+	{
+		// applies to meshes sent after this point
+		quantizePositions = value != 0;
+	}
+	else if (!strcmp( name, "materialSort" ))
+	{
+		// sort paths by material before shading; see CoreStats::sortTime and sortShadeSaved for the trade-off
+		materialSort = value != 0;
+	}
+	else if (!strcmp( name, "shadeClasses" ))
+	{
+		// with materialSort: shade basic materials with a specialized kernel, see SORTCLASSES
+		shadeClasses = value != 0;
+	}
+	else if (!strcmp( name, "maxPathLength" ))
+	{
+		// number of path segments; the connection buffer is sized for MAXPATHLENGTH, see core_settings.h
+		pathControl.maxLength = max( 1, min( MAXPATHLENGTH, (int)value ) );
+	}
+	else if (!strcmp( name, "previewMode" ))
+	{
+		// fast shading for layout work, in the wavefront loop: 0: path tracing; 1: albedo; 2: direct light only;
+		// 3: ambient occlusion, see "aoDistance"; 4: direct light and one bounce
+		const int mode = max( (int)PREVIEW_OFF, min( (int)PREVIEW_ONEBOUNCE, (int)value ) );
+		if (mode != pathControl.preview) pathControl.preview = mode, previewChanged = true;
+	}
+	else if (!strcmp( name, "aoDistance" ))
+	{
+		// length of the ambient occlusion rays of previewMode 3, in world space
+		const float distance = max( 1e-4f, value );
+		if (distance != pathControl.aoDistance) pathControl.aoDistance = distance, previewChanged = pathControl.preview == PREVIEW_AO;
+	}
+	else if (!strcmp( name, "russianRoulette" ))
+	{
+		// path length from which paths are terminated with a probability based on their throughput; 0 disables it
+		pathControl.rrDepth = max( 0, (int)value );
+	}
+	else if (!strcmp( name, "singleBounce" ))
+	{
+		// terminate paths after their first diffuse bounce
+		pathControl.singleBounce = value != 0;
+	}
+	else if (!strcmp( name, "packedPathStates" ))
+	{
+		// half precision throughput stream; see CoreStats::pathStateTraffic for the bandwidth difference
+		pathControl.packedStates = value != 0;
+	}
+	else if (!strcmp( name, "rayStats" ))
+	{
+		// per-segment ray counts and shade kernel lane efficiency in CoreStats; costs a few warp-wide atomics per path
+		pathControl.rayStats = value != 0;
+	}
+	else if (!strcmp( name, "sampler" ))
+	{
+		// 1: Owen-scrambled Sobol with its own dimensions per bounce, unlimited sample count; 0: blue noise tables
+		pathControl.sampler = value != 0;
+	}
+	else if (!strcmp( name, "interleaveShadows" ))
+	{
+		// trace shadow rays after each bounce instead of once per frame, so the connection buffer only needs to hold
+		// those of one bounce; ignored in async wavefront mode
+		interleaveShadows = value != 0;
+		if (connectionBuffer) SizeConnections();
+	}
+	else if (!strcmp( name, "peerPools" ))
+	{
+		// multi-GPU systems: place large read-only pools (texels, triangle shading data) in the memory of other
+		// GPUs, which the render device reads through peer access. Slower than local memory, but the scene is no
+		// longer bounded by the memory of the render device. 1: NVLink peers only, 2: PCIe peers too. Applies
+		// to the pools created after the call.
+		EnablePeerPools( clamp( (int)value, 0, 2 ) );
+	}
+	else if (!strcmp( name, "aliasTransients" ))
+	{
+		// let the wavefront buffers and the denoiser and upscaling buffers share device memory; 0 gives
+		// each its own range, e.g. to rule out aliasing when debugging a stage
+		aliasTransients = value != 0;
+		PlaceTransients();
+	}
+	else if (!strcmp( name, "reprojection" ))
+	{
+		// temporal reprojection: a restart keeps the samples of surfaces that stay in view; ignored with
+		// dynamic resolution and the denoiser
+		reproject = value != 0;
+	}
+	else if (!strcmp( name, "reprojectHistory" ))
+	{
+		// temporal reprojection: cap on the inherited sample count per pixel; lower values adapt faster
+		reprojectMaxHistory = max( 0.0f, value );
+	}
+	else if (!strcmp( name, "traversalHeatmap" ))
+	{
+		// debug view: per pixel traversal cost as a false color ramp instead of the image; 1: cycles from optixTrace
+		// to closest hit or miss, 2: any-hit invocations. Needs the counters in the .optix.cu programs.
+		traversalHeatmap = clamp( (int)value, 0, 2 );
+		if (!traversalHeatmap) delete traversalCostBuffer, traversalCostBuffer = 0;
+	}
+	else if (!strcmp( name, "heatmapRange" ))
+	{
+		// traversal heatmap: trace cycles per sample that map to the top (red) of the ramp
+		heatmapRange = max( 1.0f, value );
+	}
+	else if (!strcmp( name, "frameBudget" ))
+	{
+		// dynamic resolution: render time to aim for, in milliseconds; 0 renders at the target resolution
+		frameBudget = max( 0.0f, value );
+	}
+	else if (!strcmp( name, "denoiser" ))
+	{
+		// filter the frame with the OptiX denoiser before presenting it; guides are produced by the shade kernel
+		useDenoiser = value != 0;
+		if (!useDenoiser && guideBuffer)
+		{
+			SetDenoiseGuides( 0 );
+			delete guideBuffer, guideBuffer = 0;
+			transients.Remove( denoiseLayers );
+			transients.Remove( denoiseScratch );
+			PlaceTransients();
+		}
+	}
+	else if (!strcmp( name, "bandStart" ) || !strcmp( name, "bandEnd" ))
+	{
+		// image-space split: render rows [bandStart, bandEnd) of the target, as fractions of its height
+		if (name[4] == 'S') renderBand.x = max( 0.0f, min( 1.0f, value ) ); else renderBand.y = max( 0.0f, min( 1.0f, value ) );
+	}
+	else if (!strcmp( name, "frameSpp" ))
+	{
+		// samples per pixel of the next frames, without restarting accumulation; set by the frame time controller
+		// of the RenderSystem. Only a sample count beyond the capacity of the path state buffers reallocates them.
+		const int spp = max( 1, (int)value );
+		if (scrwidth > 0 && spp != scrspp)
+		{
+			if (spp > currentSPP) ResizeTarget( scrwidth, scrheight, spp ); else scrspp = spp;
+			if (graphExec) cudaGraphExecDestroy( graphExec ), graphExec = 0; // captured with the old launch sizes
+		}
+	}
+	else if (!strcmp( name, "tileRows" ))
+	{
+		// tiled rendering: size the buffers for bands of this many rows, so huge targets fit in device memory.
+		// the application renders the target band by band, using bandStart and bandEnd; 0 disables tiling.
+		const int rows = max( 0, (int)value );
+		if (rows != tileRows)
+		{
+			tileRows = rows;
+			if (scrwidth > 0) ResizeTarget( scrwidth, scrheight, scrspp );
+		}
+	}
+	else if (!strcmp( name, "profile" ))
+	{
+		// record the GPU ranges of each frame, see GetProfileEvents
+		profile = value != 0;
+		if (!profile) profileEvents.clear();
+	}
+	else if (!strcmp( name, "minRenderScale" ))
+	{
+		// dynamic resolution: lowest internal resolution, relative to the target
+		minRenderScale = max( 0.1f, min( 1.0f, value ) );
+	}
+	else if (!strcmp( name, "persistentShade" ))
+	{
+		// shade with a device-filling grid of persistent threads instead of one thread per path
+		persistentShade = value != 0;
+	}
+#ifdef MOTIONBLUR
+	else if (!strcmp( name, "shutter" ))
+	{
+		// motion blur: fraction of the frame interval the shutter is open, ending at the current frame
+		shutter = max( 0.0f, min( 1.0f, value ) );
+	}
+#endif
+	else if (!strcmp( name, "geometryBudget" ))
+	{
+		// geometry streaming: device memory for meshes in MB, see UpdateResidency; 0 brings all meshes back
+		geometryBudget = max( 0.0f, value );
+	}
+	else if (!strcmp( name, "geometryReloads" ))
+	{
+		// geometry streaming: max meshes reloaded per frame
+		geometryReloads = max( 1, (int)value );
+	}
+	else if (!strcmp( name, "radianceCache" ))
+	{
+		// device memory for the world-space radiance cache in MB, see kernels/radiancecache.h; 0 disables the cache
+		if (radianceCacheBudget != max( 0.0f, value )) radianceCacheBudget = max( 0.0f, value ), radianceCacheDirty = true;
+	}
+	else if (!strcmp( name, "radianceCacheRate" ))
+	{
+		// radiance cache: fraction of the path vertices that update the cache each frame
+		if (radianceCacheRate != value) radianceCacheRate = max( 0.0f, min( 1.0f, value ) ), radianceCacheDirty = true;
+	}
+	else if (!strcmp( name, "radianceCacheCell" ))
+	{
+		// radiance cache: size of the cells near the camera, in world units; changing it empties the cache
+		if (radianceCacheCell != value) radianceCacheCell = max( 1e-4f, value ), radianceCacheDirty = true;
+	}
+	else if (!strcmp( name, "pathGuiding" ))
+	{
+		// device memory for the path guiding histograms in MB, see kernels/pathguiding.h; 0 disables guiding
+		if (pathGuideBudget != max( 0.0f, value )) pathGuideBudget = max( 0.0f, value ), pathGuideDirty = true;
+	}
+	else if (!strcmp( name, "pathGuidingFraction" ))
+	{
+		// path guiding: share of the diffuse bounces sampled from the histograms; the rest samples the bsdf
+		if (pathGuideFraction != value) pathGuideFraction = max( 0.0f, min( 0.9f, value ) ), pathGuideDirty = true;
+	}
+	else if (!strcmp( name, "pathGuidingCell" ))
+	{
+		// path guiding: size of the cells near the camera, in world units; changing it discards the training
+		if (pathGuideCell != value) pathGuideCell = max( 1e-4f, value ), pathGuideDirty = true;
+	}
+	else if (!strcmp( name, "restir" ))
+	{
+		// reservoir resampling of the light connections at the primary vertex, see kernels/restir.h
+		useReSTIR = value != 0;
+	}
+	else if (!strcmp( name, "restirCandidates" ))
+	{
+		// light resampling: light samples drawn per path
+		restirCandidates = max( 1, (int)value );
+	}
+	else if (!strcmp( name, "restirReuse" ))
+	{
+		// light resampling: reservoirs of the previous frame merged per path, at and around the reprojected pixel; 0 disables reuse
+		restirReuseTaps = max( 0, (int)value );
+	}
+	else if (!strcmp( name, "restirHistory" ))
+	{
+		// light resampling: cap on the sample count of a reused reservoir, in candidates
+		restirMaxHistory = max( 0.0f, value );
+	}
+	else if (!strcmp( name, "tuneKernels" ))
+	{
+		// rerun the launch configuration autotuning pass, replacing the cached result
+		if (value != 0) tuneFrame = 0;
+	}
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Launch configurations                                                      |
+//  |  shadeKernel is compiled for SHADEVARIANTS block sizes and occupancy goals, |
+//  |  finalizeRenderKernel takes one of FINALIZEVARIANTS block sizes. The best   |
+//  |  combination depends on the GPU; it is found by timing each variant over a  |
+//  |  few frames, and cached per device name.                              LH2'19|
+//  +-----------------------------------------------------------------------------+
+#define LAUNCHCONFIGFILE "../../lib/RenderCore_Optix7/kernels/.launchconfig.txt"
+#define TUNEFRAMES 5 // frames per variant during autotuning; the first is not timed
+static const int2 finalizeBlocks[FINALIZEVARIANTS] = { { 32, 8 }, { 32, 4 }, { 16, 16 }, { 64, 4 } };
+void RenderCore::LoadLaunchConfig()
+{
+	// defaults: the configurations this core used before autotuning
+	shadeVariant = computeCapability > 70 ? 1 : 2;
+	finalizeVariant = 0;
+	tuneFrame = 0;
+	if (FileExists( LAUNCHCONFIGFILE ))
+	{
+		// one line per GPU: shade variant, finalize variant, device name
+		string text = TextFileRead( LAUNCHCONFIGFILE );
+		for (size_t pos = 0; pos < text.size(); )
+		{
+			size_t eol = text.find( '\n', pos );
+			if (eol == string::npos) eol = text.size();
+			const string line = text.substr( pos, eol - pos );
+			int s, f;
+			char name[256];
+			if (sscanf( line.c_str(), "%i %i %255[^\r\n]", &s, &f, name ) == 3 && !strcmp( name, coreStats.deviceName ) &&
+				s >= 0 && s < SHADEVARIANTS && f >= 0 && f < FINALIZEVARIANTS)
+				shadeVariant = s, finalizeVariant = f, tuneFrame = -1;
+			pos = eol + 1;
+		}
+	}
+	SetFinalizeBlockSize( finalizeBlocks[finalizeVariant].x, finalizeBlocks[finalizeVariant].y );
+	if (tuneFrame == 0) printf( "no cached launch configuration for %s; autotuning during the first frames.\n", coreStats.deviceName );
+}
+void RenderCore::TuneLaunchConfig( const float finalizeTime )
+{
+	// shade and finalize are tuned simultaneously; frame f renders with variant f / TUNEFRAMES of each
+	const int variants = max( SHADEVARIANTS, FINALIZEVARIANTS ), variant = tuneFrame / TUNEFRAMES;
+	if (tuneFrame == 0) memset( tuneShade, 0, sizeof( tuneShade ) ), memset( tuneFinalize, 0, sizeof( tuneFinalize ) );
+	if (tuneFrame % TUNEFRAMES > 0)
+	{
+		// shade time per shaded path, so that camera movement during tuning matters less
+		if (variant < SHADEVARIANTS) tuneShade[variant] += coreStats.shadeTime / (float)max( 1u, coreStats.totalExtensionRays );
+		if (variant < FINALIZEVARIANTS) tuneFinalize[variant] += finalizeTime;
+	}
+	const int next = ++tuneFrame / TUNEFRAMES;
+	if (next < variants)
+	{
+		if (next < SHADEVARIANTS) shadeVariant = next;
+		if (next < FINALIZEVARIANTS) finalizeVariant = next;
+	}
+	else
+	{
+		// done: select the fastest variants and store them for this GPU
+		shadeVariant = finalizeVariant = 0;
+		for (int i = 1; i < SHADEVARIANTS; i++) if (tuneShade[i] < tuneShade[shadeVariant]) shadeVariant = i;
+		for (int i = 1; i < FINALIZEVARIANTS; i++) if (tuneFinalize[i] < tuneFinalize[finalizeVariant]) finalizeVariant = i;
+		tuneFrame = -1;
+		string text, entry = to_string( shadeVariant ) + " " + to_string( finalizeVariant ) + " " + coreStats.deviceName + "\n";
+		if (FileExists( LAUNCHCONFIGFILE ))
+		{
+			// keep the entries of other GPUs
+			const string old = TextFileRead( LAUNCHCONFIGFILE );
+			for (size_t pos = 0; pos < old.size(); )
+			{
+				size_t eol = old.find( '\n', pos );
+				if (eol == string::npos) eol = old.size();
+				const string line = old.substr( pos, eol - pos );
+				const size_t nameStart = line.find( ' ', line.find( ' ' ) + 1 );
+				if (nameStart != string::npos && line.substr( nameStart + 1 ) != coreStats.deviceName) text += line + "\n";
+				pos = eol + 1;
+			}
+		}
+		TextFileWrite( text + entry, LAUNCHCONFIGFILE );
+		printf( "launch configuration for %s: shade variant %i, finalize block %ix%i.\n", coreStats.deviceName,
+			shadeVariant, finalizeBlocks[finalizeVariant].x, finalizeBlocks[finalizeVariant].y );
+	}
+	SetFinalizeBlockSize( finalizeBlocks[finalizeVariant].x, finalizeBlocks[finalizeVariant].y );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::FramePathControl                                               |
+//  |  The path settings for the wavefront loop of this frame. The preview modes  |
+//  |  cut the paths short, so the loop skips the phases they do not need: the    |
+//  |  direct light ends the paths at the primary vertex, one bounce after the    |
+//  |  second. Albedo and ambient occlusion paths end at their first opaque hit   |
+//  |  in the shade kernel; only alpha tested surfaces extend them.         LH2'19|
+//  +-----------------------------------------------------------------------------+
+PathControl RenderCore::FramePathControl() const
+{
+	PathControl path = pathControl;
+	if (path.preview == PREVIEW_DIRECT) path.maxLength = 1;
+	if (path.preview == PREVIEW_ONEBOUNCE) path.maxLength = min( 2, path.maxLength ), path.singleBounce = 0;
+	if (path.preview != PREVIEW_OFF) path.rrDepth = 0;
+	return path;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::TraceShadowRays                                                |
+//  |  Traces the first 'count' connections in connectionBuffer (phase 2).  The   |
+//  |  occlusion hit group has no closest hit program: visibility only.     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::TraceShadowRays( const uint count )
+{
+	params.phase = 2;
+	params.rayMask = VISIBLE_SHADOW;
+	params.path = pathControl; // for connectStride
+	pinnedParams[MAXPATHLENGTH] = params;
+	cudaMemcpyAsync( (void*)d_params, &pinnedParams[MAXPATHLENGTH], sizeof( Params ), cudaMemcpyHostToDevice, 0 );
+	CHK_OPTIX( optixLaunch( pipeline, 0, d_params, sizeof( Params ), &sbt, count, 1, 1 ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::UpdateMegakernelScene                                          |
+//  |  The OptiX module does not see the constant memory of the cuda code, so the |
+//  |  megakernel receives the scene data through the launch parameters.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::UpdateMegakernelScene()
+{
+	MegakernelScene& scene = params.scene;
+	scene.instanceDescriptors = instDescBuffer ? instDescBuffer->DevPtr() : 0;
+	scene.materials = materialBuffer ? materialBuffer->DevPtr() : 0;
+	scene.areaLights = areaLightBuffer ? areaLightBuffer->DevPtr() : 0;
+	scene.pointLights = pointLightBuffer ? pointLightBuffer->DevPtr() : 0;
+	scene.spotLights = spotLightBuffer ? spotLightBuffer->DevPtr() : 0;
+	scene.directionalLights = directionalLightBuffer ? directionalLightBuffer->DevPtr() : 0;
+	scene.lightCounts = make_int4( areaLightBuffer ? (int)areaLightBuffer->GetSize() : 0, pointLightBuffer ? (int)pointLightBuffer->GetSize() : 0,
+		spotLightBuffer ? (int)spotLightBuffer->GetSize() : 0, directionalLightBuffer ? (int)directionalLightBuffer->GetSize() : 0 );
+#ifdef VIRTUALTEXTURES
+	scene.argb32 = texel32Pager ? texel32Pager->pool->DevPtr() : 0;
+	scene.argb32Pages = texel32Pager ? texel32Pager->pageTable->DevPtr() : 0;
+	scene.argb32Usage = texel32Pager ? texel32Pager->usage->DevPtr() : 0;
+	scene.nrm32 = normal32Pager ? normal32Pager->pool->DevPtr() : 0;
+	scene.nrm32Pages = normal32Pager ? normal32Pager->pageTable->DevPtr() : 0;
+	scene.nrm32Usage = normal32Pager ? normal32Pager->usage->DevPtr() : 0;
+#else
+	scene.argb32 = texel32Buffer ? texel32Buffer->DevPtr() : 0;
+	scene.nrm32 = normal32Buffer ? normal32Buffer->DevPtr() : 0;
+#endif
+	scene.argb128 = texel128Buffer ? texel128Buffer->DevPtr() : 0;
+	scene.skyPixels = skyPixelBuffer ? skyPixelBuffer->DevPtr() : 0;
+	scene.skySize = make_int2( skywidth, skyheight );
+	scene.skyLevels = skylevels;
+	scene.clampValue = vars.clampValue < 0 ? 10.0f : vars.clampValue; // SetClampValue( 10 ) in Init bypasses vars
 }
 
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::Render                                                         |
 //  |  Produce one image.                                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast )
+void RenderCore::Render( const ViewPyramid& fullView, const Convergence converge, const float brightness, const float contrast )
 {
-	// wait for OpenGL
-	glFinish();
+	// Note: no glFinish here. Mapping the render target in InteropTexture::BindSurface orders
+	// the OpenGL work on it before finalizeRender; the wavefront loop does not touch GL resources.
 	Timer timer;
+	if (!pipelineReady.Finished())
+	{
+		// first frame: the pipeline is still being created, see CreateOptixContext
+		pipelineReady.Wait();
+		printf( "optix7 startup: first frame waited %.1fms for the pipeline\n", timer.elapsed() * 1000 );
+		timer.reset();
+	}
+	nvtxRangePushA( "RenderCore::Render" );
+	cudaEventRecord( frameStart );
+#ifdef VIRTUALTEXTURES
+	// stream in the texture pages that the previous frame missed; this changes the image, so converging restarts
+	coreStats.texturePagesStreamed = 0;
+	if (texel32Pager) coreStats.texturePagesStreamed += texel32Pager->Update( texturePageUploads );
+	if (normal32Pager) coreStats.texturePagesStreamed += normal32Pager->Update( texturePageUploads );
+	coreStats.texturePagesRead = (texel32Pager ? texel32Pager->pagesRead : 0) + (normal32Pager ? normal32Pager->pagesRead : 0);
+	const bool texturesStreamed = coreStats.texturePagesStreamed > 0;
+#else
+	const bool texturesStreamed = false;
+#endif
+#ifdef MOTIONBLUR
+	// posed meshes that were not posed again since the last frame are at rest
+	bool settled = false;
+	for (CoreMesh* mesh : meshes)
+	{
+		if (mesh->motionState == 2) mesh->SettleMotion(), settled = true;
+		else if (mesh->motionState == 1) mesh->motionState = 2;
+	}
+	if (settled) meshesChanged = true, UpdateToplevel();
+	params.shutter = shutter;
+#endif
+	// stream geometry in and out; like texture streaming, this changes the image
+	const bool meshesBuilt = FinishStreamedMeshes();
+	const bool geometryStreamed = UpdateResidency( fullView ) || meshesBuilt;
+	// image-space split: render only a band of rows, through the matching part of the view pyramid;
+	// in tiled mode, the band is at most one tile, which is all the buffers can hold
+	ViewPyramid view = fullView;
+	int bandY0 = 0, rw = scrwidth, rh = scrheight;
+	const bool banded = tileRows > 0 || renderBand.x > 0 || renderBand.y < 1;
+	if (banded)
+	{
+		bandY0 = min( scrheight - 1, (int)(renderBand.x * scrheight + 0.5f) );
+		rh = max( bandY0 + 1, min( scrheight, (int)(renderBand.y * scrheight + 0.5f) ) ) - bandY0;
+		if (tileRows > 0) rh = min( rh, tileRows );
+		const float3 down = (fullView.p3 - fullView.p1) * (1.0f / scrheight);
+		view.p1 = fullView.p1 + down * (float)bandY0, view.p2 = fullView.p2 + down * (float)bandY0;
+		view.p3 = view.p1 + down * (float)rh;
+	}
+	// dynamic resolution: pick the internal resolution for this frame, based on the previous render time
+	if (frameBudget > 0 && !banded)
+	{
+		if (converge == Restart && coreStats.renderTime > 0)
+		{
+			// render time is roughly proportional to the pixel count; adapt gradually to avoid oscillation
+			const float target = renderScale * sqrtf( frameBudget * 0.001f / coreStats.renderTime );
+			renderScale = max( minRenderScale, min( 1.0f, 0.75f * renderScale + 0.25f * target ) );
+		}
+		rw = max( 8, (int)(scrwidth * renderScale) & ~7 ); // steps of 8 pixels, so small changes don't reset accumulation
+		rh = max( 1, scrheight * rw / scrwidth );
+		if (!motionBuffer)
+		{
+			// allocated before the wavefront: placing a transient may move the others, such as the denoiser output
+			for (int i = 1; i < 3; i++) upscaleBuffer[i] = new CoreBuffer<float4>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers );
+			transients.Declare( upscaleBuffer[0], maxPixels, POSTPROCESS, POSTPROCESS ); // the history buffers persist
+			PlaceTransients();
+			motionBuffer = new CoreBuffer<float2>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers );
+			historyValid = false;
+		}
+	}
+	else renderScale = 1;
+	const bool resized = rw != renderWidth || rh != renderHeight;
+	renderWidth = rw, renderHeight = rh;
+	params.scrsize = make_int3( rw, rh, scrspp );
+	coreStats.renderScale = (float)rw / scrwidth;
+	// denoiser: the shade kernel accumulates its guide layers from the first frame it is enabled
+	if (useDenoiser && !guideBuffer) CreateDenoiseGuides(), firstConvergingFrame = true;
+	// temporal reprojection: the frames before a restart live on in a history, see ReprojectAccumulator
+	const bool useReprojection = reproject && frameBudget == 0 && !useDenoiser && !banded && !(megakernel && megaPipeline != 0 && pathControl.preview == PREVIEW_OFF);
+	if (resized) reprojectValid = false;
 	// clean accumulator, if requested
-	if (converge == Restart || firstConvergingFrame)
+	const bool restart = converge == Restart || firstConvergingFrame || texturesStreamed || geometryStreamed || resized || previewChanged;
+	previewChanged = false;
+	if (restart)
 	{
 		accumulator->Clear( ON_DEVICE );
+		if (guideBuffer) guideBuffer->Clear( ON_DEVICE );
+		// with a history, the new samples must differ from the ones it holds
+		if (useReprojection && reprojectValid) passOffset = (passOffset + reprojectSpp) & 255;
+		else camRNGseed = 0x12345678, passOffset = 0; // same seed means same noise.
 		samplesTaken = 0;
 		firstConvergingFrame = true; // if we switch to converging, it will be the first converging frame.
-		camRNGseed = 0x12345678; // same seed means same noise.
 	}
 	if (converge == Converge) firstConvergingFrame = false;
 	// update instance descriptor array on device
 	// Note: we are not using the built-in OptiX instance system for shading. Instead,
 	// we figure out which triangle we hit, and to what instance it belongs; from there,
 	// we handle normal management and material acquisition in custom code.
-	if (instancesDirty)
+	// The descriptors are maintained in a host-side mirror by SetInstance and UpdateToplevel;
+	// here we only send the range that changed since the previous frame.
+	if (lastDirtyDesc >= firstDirtyDesc)
 	{
-		// prepare CoreInstanceDesc array. For any sane number of instances this should
-		// be efficient while yielding supreme flexibility.
-		vector<CoreInstanceDesc> instDescArray;
-		for (auto instance : instances)
-		{
-			CoreInstanceDesc id;
-			id.triangles = meshes[instance->mesh]->triangles->DevPtr();
-			mat4 T, invT;
-			if (instance->transform)
-			{
-				T = mat4::Identity();
-				memcpy( &T, instance->transform, 12 * sizeof( float ) );
-				invT = T.Inverted();
-			}
-			else
-			{
-				T = mat4::Identity();
-				invT = mat4::Identity();
-			}
-			id.invTransform = *(float4x4*)&invT;
-			instDescArray.push_back( id );
-		}
-		if (instDescBuffer == 0 || instDescBuffer->GetSize() < (int)instances.size())
-		{
-			delete instDescBuffer;
-			// size of instance list changed beyond capacity.
-			// Allocate a new buffer, with some slack, to prevent excessive reallocs.
-			instDescBuffer = new CoreBuffer<CoreInstanceDesc>( instances.size() * 2, ON_HOST | ON_DEVICE );
-			SetInstanceDescriptors( instDescBuffer->DevPtr() );
-		}
-		memcpy( instDescBuffer->HostPtr(), instDescArray.data(), instDescArray.size() * sizeof( CoreInstanceDesc ) );
-		instDescBuffer->CopyToDevice();
-		// instancesDirty = false;
+		// the host copies of scattered member descriptors are stale; layoutScatter rewrites them after the upload
+		if (lastDirtyDesc >= groupLayoutBase && scatterLayouts.size() > 0) scatterLayoutsPending = true;
+		stagingRing->Upload( instDescBuffer->DevPtr() + firstDirtyDesc, instDescBuffer->HostPtr() + firstDirtyDesc,
+			(lastDirtyDesc - firstDirtyDesc + 1) * sizeof( CoreInstanceDesc ) );
+		firstDirtyDesc = INT_MAX, lastDirtyDesc = -1;
 	}
 	// render image
 	coreStats.totalExtensionRays = coreStats.totalShadowRays = 0;
@@ -651,78 +3196,443 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 	params.right = make_float3( right.x, right.y, right.z );
 	params.up = make_float3( up.x, up.y, up.z );
 	params.p1 = make_float3( view.p1.x, view.p1.y, view.p1.z );
-	params.pass = samplesTaken;
+	params.pass = samplesTaken + passOffset;
+	// traversal heatmap: the programs add the cost of each ray to the pixel of its path
+	if (traversalHeatmap)
+	{
+		if (!traversalCostBuffer) traversalCostBuffer = new CoreBuffer<uint2>( maxPixels, ON_DEVICE, 0, VRAMFrameBuffers );
+		cudaMemsetAsync( traversalCostBuffer->DevPtr(), 0, rw * rh * sizeof( uint2 ), stream );
+	}
+	params.traversalCost = traversalHeatmap ? traversalCostBuffer->DevPtr() : 0;
 	// loop
 	params.bvhRoot = bvhRoot; // meshes[1]->gasHandle;
 	Counters counters;
 	coreStats.deepRayCount = 0;
-	uint pathCount = scrwidth * scrheight * scrspp;
-	for (int pathLength = 1; pathLength <= MAXPATHLENGTH; pathLength++)
+	uint pathCount = rw * rh * scrspp;
+	const int probeY = banded ? probePos.y - bandY0 : probePos.y * rh / scrheight;
+	const int probePixel = (probeY >= 0 && probeY < rh) ? (probePos.x * rw / scrwidth + rw * probeY) : -1;
+	if (materialSort && !sortKeyBuffer)
+	{
+		// out-of-place copies of the path states and hits, in material order
+		transients.Declare( sortedStateBuffer, pathStateBuffer->GetSize(), WAVEFRONT, WAVEFRONT );
+		transients.Declare( sortedHitBuffer, hitBuffer->GetSize(), WAVEFRONT, WAVEFRONT );
+		transients.Declare( sortKeyBuffer, hitBuffer->GetSize(), WAVEFRONT, WAVEFRONT );
+		PlaceTransients();
+		if (!sortBinBuffer) sortBinBuffer = new CoreBuffer<uint>( SORTBINS, ON_DEVICE, 0, VRAMPathStates );
+	}
+	int bounces = 0; // wavefront iterations executed for this frame
+	uint interleavedShadowRays = 0; // shadow rays traced inside the wavefront loop, see interleaveShadows
+	float interleavedShadowTime = 0;
+	// the megakernel replaces the wavefront loop with a single launch; the preview modes only exist in the wavefront loop
+	const bool useMegakernel = megakernel && megaPipeline != 0 && pathControl.preview == PREVIEW_OFF;
+	const PathControl path = FramePathControl();
+	// graph capture requires a loop without host round trips
+	const bool useGraph = useCudaGraph && asyncWavefront && tuneFrame < 0 && !useMegakernel; // autotuning needs the per-stage timings
+	const cudaStream_t stream = useGraph ? renderStream : 0;
+	stagingRing->Flush( stream ); // scene data uploads
+	if (scatterLayoutsPending) for (const ScatterLayout& layout : scatterLayouts)
+	{
+		const InstanceGroup* group = instanceGroups[layout.group];
+		layoutScatter( group->members->DevPtr(), group->scattered, layout.T, layout.invT, instDescBuffer->DevPtr() + layout.base, stream );
+	}
+	scatterLayoutsPending = false;
+	cudaStreamWaitEvent( stream, updateDone, 0 ); // mesh and top-level builds for this frame
+	UpdateRadianceCache( stream );
+	UpdatePathGuide( stream );
+	UpdateReservoirs( view, pathCount, banded, stream );
+	TraceRayQueries( stream );
+	UpdateProbes( rw, rh, bandY0, banded, stream );
+	UpdateHitMotion( (frameBudget > 0 || useReprojection) && !banded && !useMegakernel, useReprojection, stream );
+	// hybrid rendering: copy the rasterized primary hits, if they match this frame; mapping waits for OpenGL
+	const bool useVisibility = visibilityResource && scrspp == 1 && view.aperture == 0 && !banded && !useMegakernel &&
+		rw == visibilitySize.x && rh == visibilitySize.y;
+	if (useVisibility)
+	{
+		cudaArray* array;
+		CHK_CUDA( cudaGraphicsMapResources( 1, &visibilityResource, stream ) );
+		CHK_CUDA( cudaGraphicsSubResourceGetMappedArray( &array, visibilityResource, 0, 0 ) );
+		CHK_CUDA( cudaMemcpy2DFromArrayAsync( visibilityBuffer->DevPtr(), rw * sizeof( uint4 ), array, 0, 0, rw * sizeof( uint4 ), rh, cudaMemcpyDeviceToDevice, stream ) );
+		CHK_CUDA( cudaGraphicsUnmapResources( 1, &visibilityResource, stream ) );
+	}
+	if (useGraph) CHK_CUDA( cudaStreamBeginCapture( stream, cudaStreamCaptureModeThreadLocal ) );
+	nvtxRangePushA( "wavefront" );
+	if (useMegakernel)
+	{
+		// trace and shade all segments per path in the raygen program, including the shadow rays
+		UpdateMegakernelScene();
+		params.phase = 3;
+		params.rayMask = VISIBLE_PRIMARY; // the raygen program uses VISIBLE_SECONDARY after the first segment
+		params.R0 = RandomUInt( camRNGseed );
+		params.probePixelIdx = probePixel;
+		params.spreadAngle = view.spreadAngle;
+		params.path = pathControl;
+		if (!reorderSupported) params.path.reorderBits = 0;
+		coreStats.primaryRayCount = pathCount;
+		InitCountersForExtend( pathCount, stream );
+		pinnedParams[0] = params;
+		cudaMemcpyAsync( (void*)d_params, &pinnedParams[0], sizeof( Params ), cudaMemcpyHostToDevice, stream );
+		cudaEventRecord( traceStart[0] );
+		CHK_OPTIX( optixLaunch( megaPipeline, stream, d_params, sizeof( Params ), &megaSbt, params.scrsize.x, params.scrsize.y * scrspp, 1 ) );
+		cudaEventRecord( traceEnd[0] );
+	}
+	const int wavefrontLength = useMegakernel ? 0 : path.maxLength;
+	for (int pathLength = 1; pathLength <= wavefrontLength; pathLength++)
 	{
-		// generate / extend
-		cudaEventRecord( traceStart[pathLength - 1] );
+		// generate / extend; each launch gets its own pinned copy of the parameters,
+		// so that a captured graph reads the parameters of the current frame.
+		Params& launchParams = pinnedParams[pathLength - 1];
+		bounces = pathLength;
+		if (!useGraph) cudaEventRecord( traceStart[pathLength - 1] );
 		if (pathLength == 1)
 		{
 			// spawn and extend camera rays
 			params.phase = 0;
+			params.rayMask = VISIBLE_PRIMARY;
 			coreStats.primaryRayCount = pathCount;
-			InitCountersForExtend( pathCount );
-			cudaMemcpyAsync( (void*)d_params, &params, sizeof( Params ), cudaMemcpyHostToDevice, 0 );
-			CHK_OPTIX( optixLaunch( pipeline, 0, d_params, sizeof( Params ), &sbt, params.scrsize.x, params.scrsize.y * scrspp, 1 ) );
+			InitCountersForExtend( pathCount, stream );
+			if (useVisibility)
+			{
+				// hybrid rendering: the rasterized hits replace the primary trace
+				primaryFromVisibility( visibilityBuffer->DevPtr(), pathStateBuffer->DevPtr(), hitBuffer->DevPtr(), rw, rh,
+					view.pos, view.p1, right, up, stream );
+			}
+			else
+			{
+				launchParams = params;
+				cudaMemcpyAsync( (void*)d_params, &launchParams, sizeof( Params ), cudaMemcpyHostToDevice, stream );
+				CHK_OPTIX( optixLaunch( pipeline, stream, d_params, sizeof( Params ), &sbt, params.scrsize.x, params.scrsize.y * scrspp, 1 ) );
+			}
 		}
 		else
 		{
 			// extend bounced paths
 			if (pathLength == 2) coreStats.bounce1RayCount = pathCount; else coreStats.deepRayCount += pathCount;
 			params.phase = 1;
-			InitCountersSubsequent();
-			cudaMemcpyAsync( (void*)d_params, &params, sizeof( Params ), cudaMemcpyHostToDevice, 0 );
-			CHK_OPTIX( optixLaunch( pipeline, 0, d_params, sizeof( Params ), &sbt, pathCount, 1, 1 ) );
-		}
-		cudaEventRecord( traceEnd[pathLength - 1] );
-		// shade
-		cudaEventRecord( shadeStart[pathLength - 1] );
-		shade( pathCount, accumulator->DevPtr(), scrwidth * scrheight * scrspp,
-			pathStateBuffer->DevPtr(), hitBuffer->DevPtr(), connectionBuffer->DevPtr(),
-			RandomUInt( camRNGseed ) + pathLength * 91771, blueNoise->DevPtr(), samplesTaken,
-			probePos.x + scrwidth * probePos.y, pathLength, scrwidth, scrheight,
-			view.spreadAngle, view.p1, view.p2, view.p3, view.pos );
-		cudaEventRecord( shadeEnd[pathLength - 1] );
+			params.rayMask = VISIBLE_SECONDARY;
+			InitCountersSubsequent( stream );
+			launchParams = params;
+			cudaMemcpyAsync( (void*)d_params, &launchParams, sizeof( Params ), cudaMemcpyHostToDevice, stream );
+			CHK_OPTIX( optixLaunch( pipeline, stream, d_params, sizeof( Params ), &sbt, pathCount, 1, 1 ) );
+		}
+		if (!useGraph) cudaEventRecord( traceEnd[pathLength - 1] );
+		// optionally sort the paths by material, so that shading is more coherent
+		const float4* shadeStates = pathStateBuffer->DevPtr();
+		const float4* shadeHits = hitBuffer->DevPtr();
+		if (materialSort)
+		{
+			if (!useGraph) cudaEventRecord( sortStart[pathLength - 1] );
+			sortPaths( pathCount, pathStateBuffer->DevPtr(), hitBuffer->DevPtr(), sortKeyBuffer->DevPtr(), sortBinBuffer->DevPtr(),
+				sortedStateBuffer->DevPtr(), sortedHitBuffer->DevPtr(), rw * rh * scrspp, pathLength, pathControl.packedStates, stream );
+			if (!useGraph) cudaEventRecord( sortEnd[pathLength - 1] );
+			shadeStates = sortedStateBuffer->DevPtr(), shadeHits = sortedHitBuffer->DevPtr();
+		}
+		// shade; sorted paths can be shaded per shade class, with a specialized kernel for basic materials
+		const uint* classBins = (materialSort && shadeClasses && !persistentShade) ? sortBinBuffer->DevPtr() : 0;
+		if (!useGraph) cudaEventRecord( shadeStart[pathLength - 1] );
+		shade( pathCount, accumulator->DevPtr(), rw * rh * scrspp,
+			shadeStates, pathStateBuffer->DevPtr(), shadeHits, connectionBuffer->DevPtr(),
+			RandomUInt( camRNGseed ) + pathLength * 91771, blueNoise->DevPtr(), samplesTaken + passOffset,
+			probePixel, pathLength, rw, rh,
+			view.spreadAngle, view.p1, view.p2, view.p3, view.pos, path, shadeVariant, persistentShade ? SMcount : 0, classBins, stream );
+		if (!useGraph) cudaEventRecord( shadeEnd[pathLength - 1] );
+		// keep the launch size in async mode; the shade kernel skips paths beyond counters->activePaths
+		if (asyncWavefront) continue;
 		counterBuffer->CopyToHost();
 		counters = counterBuffer->HostPtr()[0];
 		pathCount = counters.extensionRays;
+		if (interleaveShadows && counters.shadowRays > 0)
+		{
+			// trace this bounce's connections right away, so the next bounce starts with an empty connection buffer
+			cudaEventRecord( shadowStart );
+			TraceShadowRays( counters.shadowRays );
+			ResetShadowRays( 0 );
+			cudaEventRecord( shadowEnd );
+			cudaEventSynchronize( shadowEnd );
+			interleavedShadowTime += CUDATools::Elapsed( shadowStart, shadowEnd );
+			interleavedShadowRays += counters.shadowRays, counters.shadowRays = 0;
+		}
 		if (pathCount == 0) break;
 	}
-	// connect to light sources
-	cudaEventRecord( shadowStart );
-	params.phase = 2;
-	if (counters.shadowRays > 0)
+	if (useGraph)
+	{
+		// update the instantiated graph with this frame's parameters; instantiate if the topology changed
+		cudaGraph_t graph;
+		CHK_CUDA( cudaStreamEndCapture( stream, &graph ) );
+		if (graphExec)
+		{
+			cudaGraphNode_t errorNode;
+			cudaGraphExecUpdateResult updateResult;
+			if (cudaGraphExecUpdate( graphExec, graph, &errorNode, &updateResult ) != cudaSuccess)
+			{
+				cudaGetLastError(); // clear the error
+				cudaGraphExecDestroy( graphExec );
+				graphExec = 0;
+			}
+		}
+		if (!graphExec) CHK_CUDA( cudaGraphInstantiate( &graphExec, graph, 0, 0, 0 ) ), coreStats.graphInstantiations++;
+		cudaGraphDestroy( graph );
+		CHK_CUDA( cudaGraphLaunch( graphExec, stream ) );
+	}
+	if (probesSet)
 	{
-		cudaMemcpyAsync( (void*)d_params, &params, sizeof( Params ), cudaMemcpyHostToDevice, 0 );
-		CHK_OPTIX( optixLaunch( pipeline, 0, d_params, sizeof( Params ), &sbt, counters.shadowRays, 1, 1 ) );
+		// picking: read back the probe hits without waiting for them, see GetProbeResults
+		ProbeReadback& slot = probeRing[probeFrame % PROBERING];
+		cudaMemcpyAsync( slot.results->HostPtr(), slot.results->DevPtr(), slot.count * sizeof( float4 ), cudaMemcpyDeviceToHost, stream );
+		cudaEventRecord( slot.done, stream );
+		slot.frame = probeFrame++;
+	}
+	if (asyncWavefront || useMegakernel)
+	{
+		// a single readback for the whole wavefront loop; per-bounce path counts are not known in this mode
+		counterBuffer->CopyToHost();
+		counters = counterBuffer->HostPtr()[0];
+		coreStats.bounce1RayCount = 0;
+		coreStats.deepRayCount = counters.totalExtensionRays - coreStats.primaryRayCount;
 	}
+	// connect to light sources
+	cudaEventRecord( shadowStart );
+	if (counters.shadowRays > 0) TraceShadowRays( counters.shadowRays );
 	cudaEventRecord( shadowEnd );
+	nvtxRangePop(); // wavefront
 	// gather ray tracing statistics
-	coreStats.totalShadowRays = counters.shadowRays;
+	coreStats.totalShadowRays = counters.shadowRays + interleavedShadowRays;
 	coreStats.totalExtensionRays = counters.totalExtensionRays;
+	for (int i = 0; i < min( MAXPATHLENGTH, RAYSTATSEGMENTS ); i++) // zero without the rayStats setting
+	{
+		coreStats.segmentRays[i] = counters.segmentRays[i];
+		coreStats.segmentShadowRays[i] = counters.segmentShadowRays[i];
+		coreStats.segmentMissed[i] = counters.segmentMissed[i];
+		coreStats.segmentEmitter[i] = counters.segmentEmitter[i];
+		coreStats.segmentRoulette[i] = counters.segmentRoulette[i];
+		coreStats.segmentAlpha[i] = counters.segmentAlpha[i];
+	}
+	coreStats.shadeLaneEfficiency = counters.activeLanes / (float)max( 1u, counters.laneSlots );
 	// present accumulator to final buffer
-	renderTarget.BindSurface();
+	InteropTexture& renderTarget = renderTargets[currentTarget];
+	float4* headlessTarget = HeadlessTarget();
+	SetFinalizeTarget( headlessTarget, bandY0 ); // 0 finalizes to the bound surface
+	if (!headlessTarget) renderTarget.BindSurface();
 	samplesTaken += scrspp;
-	finalizeRender( accumulator->DevPtr(), scrwidth, scrheight, samplesTaken, brightness, contrast );
-	renderTarget.UnbindSurface();
+	const float4* frame = accumulator->DevPtr();
+	int frameSpp = samplesTaken;
+	coreStats.denoiseTime = 0;
+	if (useDenoiser)
+	{
+		cudaEventRecord( denoiseStart );
+		frame = Denoise( rw, rh, view ), frameSpp = 1;
+		cudaEventRecord( denoiseEnd );
+	}
+	if (useReprojection) frame = ReprojectAccumulator( rw, rh, restart ), frameSpp = 1, prevView = view;
+	else reprojectValid = false;
+	if (traversalHeatmap)
+	{
+		// debug view: the cost of this frame's rays replaces the image; accumulation continues underneath
+		const float range = traversalHeatmap == 1 ? heatmapRange : HEATMAPANYHITS;
+		historyValid = false;
+		cudaEventRecord( finalizeStart );
+		finalizeHeatmap( traversalCostBuffer->DevPtr(), rw, rh, scrwidth, banded ? rh : scrheight, traversalHeatmap - 1, 1.0f / (range * scrspp) );
+		cudaEventRecord( finalizeEnd );
+	}
+	else if (frameBudget > 0 && !banded)
+	{
+		// dynamic resolution: upscale to the target, then blend with the reprojected previous frame
+		upscale( frame, rw, rh, frameSpp, upscaleBuffer[0]->DevPtr(), motionBuffer->DevPtr(),
+			hitMotionBuffer ? hitMotionBuffer->DevPtr() : 0, scrwidth, scrheight,
+			view.pos, view.p1, right, up, prevView.pos, prevView.p1, prevView.p2 - prevView.p1, prevView.p3 - prevView.p1 );
+		// TAA resolve, sharpening and presentation in one pass; the resolved frame goes to upscaleBuffer[2]
+		cudaEventRecord( finalizeStart );
+		finalizeTAA( upscaleBuffer[0]->DevPtr(), historyValid ? upscaleBuffer[1]->DevPtr() : 0, upscaleBuffer[2]->DevPtr(), motionBuffer->DevPtr(),
+			scrwidth, scrheight, brightness, contrast );
+		cudaEventRecord( finalizeEnd );
+		swap( upscaleBuffer[1], upscaleBuffer[2] ); // the result is the history for the next frame
+		historyValid = true, prevView = view;
+	}
+	else
+	{
+		historyValid = false;
+		cudaEventRecord( finalizeStart );
+		finalizeRender( frame, scrwidth, rh, frameSpp, brightness, contrast );
+		cudaEventRecord( finalizeEnd );
+	}
+	// frame readback: the copy runs on its own stream; unmapping there orders it before OpenGL reuses the texture
+	const bool readback = readbackEnabled && !banded;
+	if (readback) ReadbackFrame( renderTarget );
+	if (!headlessTarget) renderTarget.UnbindSurface( readback ? readbackStream : 0 );
+	// video target: the encoder input is written in place; bands are not full frames, and are not encoded
+	const bool encode = videoEncoder && !banded;
+	if (encode) packVideoFrame( headlessTarget, videoEncoder->GetInput(), videoEncoder->GetPitch(), scrwidth, scrheight );
+	presentTarget = currentTarget;
+	currentTarget = (currentTarget + 1) % targetCount;
 	// finalize statistics
 	cudaStreamSynchronize( 0 );
 	coreStats.renderTime = timer.elapsed();
+	coreStats.encodeTime = 0;
+	if (encode)
+	{
+		// the frame is complete on the device now; NVENC reads it from the packed buffer
+		const Timer encodeTimer;
+		videoEncoder->Encode( videoKeyFrame );
+		videoKeyFrame = false;
+		coreStats.encodeTime = encodeTimer.elapsed();
+	}
 	coreStats.totalRays = coreStats.totalExtensionRays + coreStats.totalShadowRays;
 	coreStats.traceTime0 = CUDATools::Elapsed( traceStart[0], traceEnd[0] );
-	coreStats.traceTime1 = CUDATools::Elapsed( traceStart[1], traceEnd[1] );
-	coreStats.shadowTraceTime = CUDATools::Elapsed( shadowStart, shadowEnd );
+	coreStats.traceTime1 = bounces > 1 ? CUDATools::Elapsed( traceStart[1], traceEnd[1] ) : 0;
+	coreStats.shadowTraceTime = CUDATools::Elapsed( shadowStart, shadowEnd ) + interleavedShadowTime;
+	if (useDenoiser) coreStats.denoiseTime = CUDATools::Elapsed( denoiseStart, denoiseEnd );
+	coreStats.finalizeTime = CUDATools::Elapsed( finalizeStart, finalizeEnd );
 	coreStats.traceTimeX = coreStats.shadeTime = 0;
-	for( int i = 2; i < MAXPATHLENGTH; i++ ) coreStats.traceTimeX += CUDATools::Elapsed( traceStart[i], traceEnd[i] ); 
-	for( int i = 0; i < MAXPATHLENGTH; i++ ) coreStats.shadeTime += CUDATools::Elapsed( shadeStart[i], shadeEnd[i] );
+	for( int i = 2; i < bounces; i++ ) coreStats.traceTimeX += CUDATools::Elapsed( traceStart[i], traceEnd[i] ); 
+	for( int i = 0; i < bounces; i++ ) coreStats.shadeTime += CUDATools::Elapsed( shadeStart[i], shadeEnd[i] );
+	// path state traffic of the shade kernels: every shaded path reads origin, direction and hit,
+	// paths beyond the camera rays also read a throughput, and each extension ray writes all three streams
+	const float throughputBytes = pathControl.packedStates ? 8.0f : 16.0f;
+	const float bouncedPaths = (float)(coreStats.totalExtensionRays - coreStats.primaryRayCount);
+	coreStats.pathStateTraffic = (coreStats.totalExtensionRays * 48.0f + bouncedPaths * (throughputBytes * 2 + 32)) / (1024 * 1024);
+	coreStats.sortTime = coreStats.sortShadeSaved = 0;
+	if (materialSort && !useGraph) for (int i = 0; i < bounces; i++) coreStats.sortTime += CUDATools::Elapsed( sortStart[i], sortEnd[i] );
+	if (useGraph) coreStats.traceTime0 = coreStats.traceTime1 = coreStats.traceTimeX = coreStats.shadeTime = 0; // not timed inside the graph
+	else
+	{
+		// running average of the shade time per path, with and without sorting, to estimate what sorting saves
+		const float perPath = coreStats.shadeTime / (float)max( 1u, coreStats.totalExtensionRays );
+		float& average = shadeTimePerPath[materialSort ? 1 : 0];
+		average = average == 0 ? perPath : (0.9f * average + 0.1f * perPath);
+		if (materialSort && shadeTimePerPath[0] > 0) coreStats.sortShadeSaved = (shadeTimePerPath[0] - shadeTimePerPath[1]) * coreStats.totalExtensionRays;
+	}
+	if (tuneFrame >= 0) TuneLaunchConfig( coreStats.finalizeTime );
+	if (profile) CollectProfileEvents( bounces, useGraph );
+	// collect timings of mesh BVH builds and refits since the previous frame
+	coreStats.gasRebuildTime = coreStats.gasRefitTime = 0;
+	for (CoreMesh* mesh : meshes) if (mesh->pendingBuild)
+	{
+		cudaEventSynchronize( mesh->buildEnd );
+		const float t = CUDATools::Elapsed( mesh->buildStart, mesh->buildEnd );
+		if (profile)
+		{
+			ProfileEvent e = { mesh->pendingBuild == 2 ? "GAS refit" : "GAS build", -1, 1 };
+			cudaEventElapsedTime( &e.start, frameStart, mesh->buildStart );
+			e.start *= 1000, e.duration = t * 1e6f;
+			profileEvents.push_back( e );
+		}
+		if (mesh->pendingBuild == 2) coreStats.gasRefitTime += t, coreStats.gasRefits++;
+		else coreStats.gasRebuildTime += t, coreStats.gasRebuilds++;
+		mesh->pendingBuild = 0;
+	}
+	// shading data footprint, compact versus full triangle records
+	coreStats.shadingDataBytes = coreStats.fullShadingDataBytes = 0;
+	for (CoreMesh* mesh : meshes) if (mesh->resident)
+	{
+		coreStats.shadingDataBytes += mesh->triangleCount * (mesh->packedTriangles ? sizeof( CoreTriPacked ) : sizeof( CoreTri4 ));
+		coreStats.fullShadingDataBytes += mesh->triangleCount * sizeof( CoreTri4 );
+	}
+	// device memory held by the core's buffers, per category
+	CoreBufferPool::GetVRAMStats( coreStats.VRAMInUse, coreStats.VRAMPeak, coreStats.VRAMPeakTotal, coreStats.VRAMCached );
+	const __int64 aliased = transients.DeclaredSize() - transients.HeapSize(); // negative without aliasing, due to alignment
+	coreStats.VRAMAliased = aliased > 0 ? (size_t)aliased : 0;
+	coreStats.VRAMPeer = PeerMemory::InUse();
 	coreStats.probedInstid = counters.probedInstid;
 	coreStats.probedTriid = counters.probedTriid;
 	coreStats.probedDist = counters.probedDist;
+	nvtxRangePop(); // RenderCore::Render
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Denoise                                                        |
+//  |  Filters the accumulated frame with the OptiX denoiser, using the albedo    |
+//  |  and normal guides written by the shade kernel. Frames larger than          |
+//  |  DENOISETILE are processed in overlapping tiles, which keeps the state and  |
+//  |  scratch memory bounded. Returns the denoised frame, at 1 spp.        LH2'19|
+//  +-----------------------------------------------------------------------------+
+static OptixImage2D DenoiseLayer( const float4* data, const int w, const int h, const int rowStride )
+{
+	OptixImage2D layer;
+	layer.data = (CUdeviceptr)data;
+	layer.width = w, layer.height = h;
+	layer.rowStrideInBytes = rowStride * sizeof( float4 );
+	layer.pixelStrideInBytes = sizeof( float4 );
+	layer.format = OPTIX_PIXEL_FORMAT_FLOAT4;
+	return layer;
+}
+const float4* RenderCore::Denoise( const int w, const int h, const ViewPyramid& view )
+{
+	if (!denoiser)
+	{
+		OptixDenoiserOptions options = {};
+		options.inputKind = OPTIX_DENOISER_INPUT_RGB_ALBEDO_NORMAL;
+		options.pixelFormat = OPTIX_PIXEL_FORMAT_FLOAT4;
+		CHK_OPTIX( optixDenoiserCreate( optixContext, &options, &denoiser ) );
+		CHK_OPTIX( optixDenoiserSetModel( denoiser, OPTIX_DENOISER_MODEL_KIND_HDR, 0, 0 ) );
+		denoiseIntensity = new CoreBuffer<float>( 1, ON_DEVICE, 0, VRAMFrameBuffers );
+	}
+	// (re)initialize for the current tile size
+	const int2 tile = make_int2( min( w, DENOISETILE ), min( h, DENOISETILE ) );
+	if (tile.x != denoiseTile.x || tile.y != denoiseTile.y || !denoiseScratch)
+	{
+		OptixDenoiserSizes sizes;
+		CHK_OPTIX( optixDenoiserComputeMemoryResources( denoiser, tile.x, tile.y, &sizes ) );
+		denoiseOverlap = (tile.x < w || tile.y < h) ? (int)sizes.overlapWindowSizeInPixels : 0;
+		const int sw = tile.x + 2 * denoiseOverlap, sh = tile.y + 2 * denoiseOverlap;
+		if (denoiseOverlap > 0) CHK_OPTIX( optixDenoiserComputeMemoryResources( denoiser, sw, sh, &sizes ) );
+		delete denoiseState;
+		denoiseState = new CoreBuffer<uchar>( sizes.stateSizeInBytes, ON_DEVICE, 0, VRAMFrameBuffers );
+		transients.Declare( denoiseScratch, sizes.recommendedScratchSizeInBytes, POSTPROCESS, POSTPROCESS );
+		PlaceTransients(); // may move the wavefront buffers; their contents are no longer needed
+		CHK_OPTIX( optixDenoiserSetup( denoiser, 0, sw, sh, (CUdeviceptr)denoiseState->DevPtr(), denoiseState->GetSize(),
+			(CUdeviceptr)denoiseScratch->DevPtr(), denoiseScratch->GetSize() ) );
+		denoiseTile = tile;
+	}
+	// normalized input layers; normals in camera space
+	const float3 right = normalize( view.p2 - view.p1 ), up = normalize( view.p3 - view.p1 );
+	const float3 forward = normalize( 0.5f * (view.p2 + view.p3) - view.pos );
+	float4* layers = denoiseLayers->DevPtr();
+	const int layerSize = w * h;
+	prepareDenoise( accumulator->DevPtr(), guideBuffer->DevPtr(), layers, w, h, samplesTaken, right, up, forward );
+	const CUdeviceptr scratch = (CUdeviceptr)denoiseScratch->DevPtr();
+	const OptixImage2D color = DenoiseLayer( layers, w, h, w );
+	CHK_OPTIX( optixDenoiserComputeIntensity( denoiser, 0, &color, (CUdeviceptr)denoiseIntensity->DevPtr(), scratch, denoiseScratch->GetSize() ) );
+	OptixDenoiserParams denoiseParams = {};
+	denoiseParams.hdrIntensity = (CUdeviceptr)denoiseIntensity->DevPtr();
+	for (int y = 0; y < h; y += tile.y) for (int x = 0; x < w; x += tile.x)
+	{
+		// input window: the tile plus its overlap, clipped to the frame
+		const int x0 = max( 0, x - denoiseOverlap ), y0 = max( 0, y - denoiseOverlap );
+		const int x1 = min( w, x + tile.x + denoiseOverlap ), y1 = min( h, y + tile.y + denoiseOverlap );
+		OptixImage2D input[3];
+		for (int i = 0; i < 3; i++) input[i] = DenoiseLayer( layers + i * layerSize + x0 + y0 * w, x1 - x0, y1 - y0, w );
+		const OptixImage2D output = DenoiseLayer( layers + 3 * layerSize + x + y * w, min( tile.x, w - x ), min( tile.y, h - y ), w );
+		CHK_OPTIX( optixDenoiserInvoke( denoiser, 0, &denoiseParams, (CUdeviceptr)denoiseState->DevPtr(), denoiseState->GetSize(),
+			input, 3, x - x0, y - y0, &output, scratch, denoiseScratch->GetSize() ) );
+	}
+	return layers + 3 * layerSize;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::CollectProfileEvents                                           |
+//  |  Turns the timing events of the last frame into profiler ranges, relative   |
+//  |  to the start of Render. Stages inside a CUDA graph are not timed.    LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::CollectProfileEvents( const int bounces, const bool useGraph )
+{
+	profileEvents.clear();
+	auto Add = [&]( const char* name, const int bounce, const int track, cudaEvent_t start, cudaEvent_t end )
+	{
+		ProfileEvent e = { name, bounce, track };
+		cudaEventElapsedTime( &e.start, frameStart, start );
+		cudaEventElapsedTime( &e.duration, start, end );
+		e.start *= 1000, e.duration *= 1000; // ms to us
+		profileEvents.push_back( e );
+	};
+	if (topLevelPending) Add( "top-level build", -1, 1, topStart, updateDone ), topLevelPending = false;
+	if (!useGraph) for (int i = 0; i < bounces; i++)
+	{
+		Add( "trace", i, 0, traceStart[i], traceEnd[i] );
+		if (materialSort) Add( "sort", i, 0, sortStart[i], sortEnd[i] );
+		Add( "shade", i, 0, shadeStart[i], shadeEnd[i] );
+	}
+	Add( "shadow rays", -1, 0, shadowStart, shadowEnd );
+	if (useDenoiser) Add( "denoise", -1, 0, denoiseStart, denoiseEnd );
+	Add( "finalize", -1, 0, finalizeStart, finalizeEnd );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -731,13 +3641,63 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, co
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Shutdown()
 {
+	for (CoreMesh* mesh : meshes) mesh->FinishStreaming( true );
+	delete stagingRing; // waits for pending uploads
+	ReleaseHostTarget();
+	ReleaseVideoTarget();
+	SetVisibilityBuffer( 0 );
+	cudaStreamDestroy( copyStream );
+	cudaStreamSynchronize( buildStream ); // background rebuilds
+	cudaStreamDestroy( buildStream );
+	cudaEventDestroy( topRebuildStart );
+	cudaEventDestroy( topRebuildDone );
+	delete topRebuildInstances;
+	delete topRebuildBuffer;
+	delete topRebuildTemp;
+	pipelineReady.Wait();
 	optixPipelineDestroy( pipeline );
-	for (int i = 0; i < 5; i++) optixProgramGroupDestroy( progGroup[i] );
+	for (int i = 0; i < PROGRAMGROUPS; i++) optixProgramGroupDestroy( progGroup[i] );
+	if (megaPipeline) optixPipelineDestroy( megaPipeline ), optixProgramGroupDestroy( megaRaygen ), cudaFree( (void*)megaSbt.raygenRecord );
 	optixModuleDestroy( ptxModule );
+	if (denoiser) optixDenoiserDestroy( denoiser );
 	optixDeviceContextDestroy( optixContext );
 	cudaFree( (void*)sbt.raygenRecord );
 	cudaFree( (void*)sbt.missRecordBase );
 	cudaFree( (void*)sbt.hitgroupRecordBase );
+	for (InstanceGroup* group : instanceGroups) if (group)
+		delete group->instances, delete group->bvh, delete group->members, delete group->prototypeData, delete group;
+	delete groupTemp;
+	for (CoreBuffer<uchar>* arena : gasArenas) delete arena;
+	delete radianceCells;
+	delete radianceKeys;
+	delete guideBins;
+	delete guideTraining;
+	delete guideStats;
+	delete guideTrainStats;
+	delete guideKeys;
+	delete reservoirBuffer[0];
+	delete reservoirBuffer[1];
+	for (int i = 0; i < RAYQUERYRING; i++)
+	{
+		delete queryBatches[i].rays;
+		delete queryBatches[i].hits;
+		cudaEventDestroy( queryBatches[i].done );
+	}
+	for (int i = 0; i < PROBERING; i++) delete probeRing[i].results, cudaEventDestroy( probeRing[i].done );
+	SetFrameReadback( false );
+	for (int i = 0; i < READBACKRING; i++) cudaEventDestroy( readbackRing[i].done );
+	checkpointWritten.Wait();
+	if (checkpointPixels) cudaFreeHost( checkpointPixels );
+	cudaEventDestroy( checkpointCopied );
+	cudaEventDestroy( readbackReady );
+	cudaStreamDestroy( readbackStream );
+#ifdef MOTIONBLUR
+	delete motionTransforms;
+#endif
+#ifdef GGXCOMPENSATION
+	cudaDestroyTextureObject( ggxAlbedoTexture );
+	cudaFreeArray( ggxAlbedoArray );
+#endif
 }
 
 // EOF
\ No newline at end of file
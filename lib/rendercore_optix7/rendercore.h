@@ -40,6 +40,11 @@ public:
 	void Render( const ViewPyramid& view, const Convergence converge, const float brightness, const float contrast );
 	void Setting( const char* name, const float value );
 	void SetTarget( GLTexture* target, const uint spp );
+	void SetTargets( GLTexture** targets, const int count, const uint spp );
+	void SetHostTarget( float4* pixels, const int width, const int height, const uint spp );
+	bool SetVideoTarget( const VideoTargetDesc& desc, const uint spp );
+	void SetVisibilityBuffer( GLTexture* visibility );
+	int GetPresentTarget() const { return presentTarget; }
 	void Shutdown();
 	void KeyDown( const uint key ) {}
 	void KeyUp( const uint key ) {}
@@ -47,44 +52,257 @@ public:
 	// property of the caller, and can be safely deleted or modified as soon as these calls return.
 	void SetTextures( const CoreTexDesc* tex, const int textureCount );
 	void SetMaterials( CoreMaterial* mat, const CoreMaterialEx* matEx, const int materialCount ); // textures must be in sync when calling this
+	bool UpdateMaterials( const CoreMaterial* mat, const CoreMaterialEx* matEx, const int first, const int count );
 	void SetLights( const CoreLightTri* areaLights, const int areaLightCount,
 		const CorePointLight* pointLights, const int pointLightCount,
 		const CoreSpotLight* spotLights, const int spotLightCount,
 		const CoreDirectionalLight* directionalLights, const int directionalLightCount );
+	bool UpdateAreaLights( const CoreLightTri* areaLights, const int first, const int count );
+	void SetLightTree( const CoreLightTreeNode* nodes, const int nodeCount );
+	void SetLightAliasTable( const CoreLightAlias* table, const int count );
 	void SetSkyData( const float3* pixels, const uint width, const uint height );
+	void SetSkyImportance( const float* cdf, const uint width, const uint height );
 	// geometry and instances:
 	// a scene is setup by first passing a number of meshes (geometry), then a number of instances.
 	// note that stored meshes can be used zero, one or multiple times in the scene.
 	// also note that, when using alpha flags, materials must be in sync.
-	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0 );
+	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
+	void SetIndexedGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const uint* indexData, const int triangleCount,
+		const CoreTri* triangles, const uint* alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
+	bool SetAnimationData( const int meshIdx, const float4* vertexData, const float3* normalData, const int vertexCount,
+		const uint4* joints, const float4* weights, const float3* morphPositions, const float3* morphNormals, const int morphTargets );
+	void SetPose( const int meshIdx, const mat4* jointMat, const int jointCount, const float* morphWeights, const int weightCount );
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform );
+	void SetInstances( const int first, const int count, const int* modelIdx, const mat4* transforms );
+	void SetInstanceVisibility( const int instanceIdx, const uint visibility );
+	void SetInstanceMotion( const int instanceIdx, const mat4& openTransform );
+	void RemoveInstance( const int instanceIdx );
+	bool SetInstanceGroup( const int groupIdx, const int count, const int* modelIdx, const mat4* transforms );
+	bool ScatterInstances( const int groupIdx, const CoreScatter& scatter );
 	void UpdateToplevel();
 	void SetProbePos( const int2 pos );
+	void SetProbePositions( const int2* pos, const int count );
+	int GetProbeResults( CoreRayHit* hits );
+	int GetMaterialCosts( CoreMaterialCost* costs, const int count );
+	bool SetFrameReadback( const bool enable );
+	int GetReadbackFrame( const float4** pixels, int& width, int& height, const bool wait );
+	bool SaveCheckpoint( const char* file );
+	bool LoadCheckpoint( const char* file );
+	int QueryRays( const float3* origins, const float3* directions, const int count );
+	int GetRayQueryResults( const int ticket, CoreRayHit* hits );
 	CoreMaterial& GetCoreMaterial( int materialIdx ) { return materialBuffer->HostPtr()[materialIdx]; }
+	// read-only pools: texels and triangle shading data; large ones may live on a peer device, see "peerPools"
+	template <class T> CoreBuffer<T>* PoolBuffer( const __int64 elements, const int tag )
+	{
+		const int device = PoolDevice( elements * sizeof( T ) );
+		return device < 0 ? new CoreBuffer<T>( elements, ON_DEVICE, 0, tag ) : CoreBuffer<T>::OnPeer( device, elements );
+	}
 	// internal methods
 private:
+	int PoolDevice( const size_t bytes );
+	void EnablePeerPools( const int mode );
 	void SyncStorageType( const TexelStorage storage );
+	void SyncCompressedTextures();
+	void SyncTextureObjects();
+	static bool Compressible( const CoreTexDesc& tex );
+	void PatchMaterialTextures( CoreMaterial& m, const CoreMaterialEx& e );
+	void UpdateShadeClasses( const int first, const int count );
 	void CreateOptixContext( int cc );
+	void CreatePipeline( int cc );
+	struct InstanceGroup;
+	void BuildInstanceGroup( InstanceGroup* group );
+	void CompactMeshes();
+	void LayoutGroupDescriptors( const int instanceCount );
+	OptixTraversableHandle InstanceHandle( const int modelIdx ) const;
+	OptixTraversableHandle RecordHandle( const int instanceIdx ) const;
+	const float* InstanceTransform( const int instanceIdx );
+	uchar InstanceMask( const int instanceIdx ) const;
+	bool UpdateResidency( const ViewPyramid& view );
+	bool FinishStreamedMeshes();
+	void StartTopRebuild( const OptixBuildInput& buildInput, const OptixAccelBufferSizes& sizes );
+	bool FinishTopRebuild();
+	void UpdateRadianceCache( const cudaStream_t stream );
+	void UpdatePathGuide( const cudaStream_t stream );
+	void UpdateReservoirs( const ViewPyramid& view, const uint pathCount, const bool banded, const cudaStream_t stream );
+	void UpdateHitMotion( const bool enabled, const bool depth, const cudaStream_t stream );
+	const float4* ReprojectAccumulator( const int w, const int h, const bool restart );
+	void TraceRayQueries( const cudaStream_t stream );
+	void UpdateProbes( const int rw, const int rh, const int bandY0, const bool banded, const cudaStream_t stream );
+	void ReadbackFrame( InteropTexture& target );
+	void CreateDenoiseGuides();
+#ifdef GGXCOMPENSATION
+	void CreateGGXAlbedo();
+#endif
+	void LoadLaunchConfig();
+	void TuneLaunchConfig( const float finalizeTime );
+	void TraceShadowRays( const uint count );
+	PathControl FramePathControl() const;
+	void UpdateMegakernelScene();
+	void ResizeTarget( const int width, const int height, const uint spp );
+	void SizeConnections();
+	void PlaceTransients();
+	void ReleaseHostTarget();
+	void ReleaseVideoTarget();
+	float4* HeadlessTarget() const { return hostTarget ? hostTargetDevPtr : videoEncoder ? videoFrame->DevPtr() : 0; }
+	void CollectProfileEvents( const int bounces, const bool useGraph );
+	const float4* Denoise( const int w, const int h, const ViewPyramid& view );
 	// data members
 	int scrwidth = 0, scrheight = 0;				// current screen width and height
 	int scrspp = 1;									// samples to be taken per screen pixel
 	int skywidth = 0, skyheight = 0;				// size of the skydome texture
+	int skylevels = 1;								// levels in the sky pyramid, see CUDATools::BuildSkyPyramid
 	int maxPixels = 0;								// max screen size buffers can accomodate without a realloc
 	int currentSPP = 0;								// spp count which will be accomodated without a realloc
 	int2 probePos = make_int2( 0 );					// triangle picking; primary ray for this pixel copies its triid to coreStats.probedTriid
 	vector<CoreMesh*> meshes;						// list of meshes, to be referenced by the instances
-	vector<CoreInstance*> instances;					// list of instances: model id plus transform
-	bool instancesDirty = true;						// we need to sync the instance array to the device
-	InteropTexture renderTarget;					// CUDA will render to this texture
+	vector<int> instanceMesh;						// per instance: mesh ID; transform and mask are in instanceArray
+	vector<uchar> instanceMask;						// per instance: mask set by the application, see InstanceMask
+	int firstDirtyInstance = INT_MAX, lastDirtyInstance = -1;	// range of instanceArray to sync to the device
+	bool instanceHandlesChanged = false;			// an instance refers to a different BVH: rebuild the top-level tree
+	bool meshesChanged = false;						// a mesh was rebuilt or animated since the last UpdateToplevel
+	// instance groups: sub-assemblies of mesh instances, built once into their own instance BVH
+	struct InstanceGroup
+	{
+		vector<int> mesh;							// per member: mesh ID
+		vector<mat4> transform;						// per member: transform relative to the group
+		CoreBuffer<OptixInstance>* instances = 0;	// build input of the group BVH
+		CoreBuffer<uchar>* bvh = 0;					// the group BVH
+		size_t reservedBVH = 0;						// allocated size of bvh
+		OptixTraversableHandle handle = 0;			// referenced by the top-level instances of the group
+		// scattered groups: the members exist on the device only, see ScatterInstances
+		int scattered = 0;							// member count of a scattered group, 0 for the other groups
+		vector<int> prototypes;						// mesh IDs that the scattered members pick from
+		CoreBuffer<ScatterPrototype>* prototypeData = 0;	// per prototype: BVH and shading data
+		CoreBuffer<CoreInstanceDesc>* members = 0;	// per scattered member: descriptor relative to the group
+		int Members() const { return scattered > 0 ? scattered : (int)mesh.size(); }
+	};
+	vector<InstanceGroup*> instanceGroups;			// indexed by group ID, see SetInstanceGroup
+	CoreBuffer<uchar>* groupTemp = 0;				// scratch memory for group builds
+	size_t reservedGroupTemp = 0;					// allocated size of groupTemp
+	bool groupDescsDirty = false;					// shading descriptors of group members need a new layout
+	int groupLayoutBase = 0;						// instance count at the last LayoutGroupDescriptors
+	struct ScatterLayout { int base, group; float4x4 T, invT; };
+	vector<ScatterLayout> scatterLayouts;			// per instance of a scattered group: descriptors written by layoutScatter
+	bool scatterLayoutsPending = false;				// the host copies of these descriptors were uploaded over them
+	int firstDirtyDesc = INT_MAX, lastDirtyDesc = -1;	// range of instDescBuffer to sync to the device
+	float geometryBudget = 0;						// geometry streaming: device memory for meshes, in MB; 0: all resident
+	int geometryReloads = 4;						// geometry streaming: max meshes reloaded per frame
+	int residencyFrame = 0;							// geometry streaming: frame counter, see CoreMesh::lastVisible
+	float radianceCacheBudget = 0;					// radiance cache: device memory, in MB; 0: disabled
+	float radianceCacheRate = 0.25f;				// radiance cache: fraction of the path vertices that update it
+	float radianceCacheCell = 0.1f;					// radiance cache: cell size near the camera, in world units
+	bool radianceCacheDirty = true;					// radiance cache: settings changed, see UpdateRadianceCache
+	CoreBuffer<float4>* radianceCells = 0;			// radiance cache: summed radiance and sample count per slot
+	CoreBuffer<uint>* radianceKeys = 0;				// radiance cache: owning cell per slot
+	float pathGuideBudget = 0;						// path guiding: device memory, in MB; 0: disabled
+	float pathGuideFraction = 0.5f;					// path guiding: share of the diffuse bounces sampled from the histograms
+	float pathGuideCell = 0.25f;					// path guiding: cell size near the camera, in world units
+	bool pathGuideDirty = true;						// path guiding: settings changed, see UpdatePathGuide
+	CoreBuffer<float>* guideBins = 0;				// path guiding: directional histogram per slot
+	CoreBuffer<float>* guideTraining = 0;			// path guiding: weights gathered this frame, merged into guideBins
+	CoreBuffer<float2>* guideStats = 0;				// path guiding: histogram total and sample count per slot
+	CoreBuffer<float2>* guideTrainStats = 0;		// path guiding: the same, for guideTraining
+	CoreBuffer<uint>* guideKeys = 0;				// path guiding: owning cell per slot
+	bool useReSTIR = false;							// light resampling at the primary vertex, see kernels/restir.h
+	int restirCandidates = 8;						// light resampling: light samples drawn per path
+	int restirReuseTaps = 3;						// light resampling: previous frame reservoirs merged per path
+	float restirMaxHistory = 20;					// light resampling: sample count cap of reused reservoirs, in candidates
+	CoreBuffer<float4>* reservoirBuffer[2] = { 0, 0 };	// light resampling: reservoirs of this frame and the previous one
+	bool reservoirHistory = false;					// reservoirBuffer[1] holds the reservoirs of the previous frame
+	uint reservoirPaths = 0;						// path count of the previous frame; its reservoirs use this stride
+	ViewPyramid reservoirView;						// view of the previous frame, for reprojection
+	// picking: probe positions of SetProbePositions; their hits are read back through a ring, see UpdateProbes
+	struct ProbeReadback
+	{
+		CoreBuffer<float4>* results = 0;			// MAXPROBES hits, copied back to the pinned host side
+		int count = 0;								// probes recorded in the frame
+		int frame = -1;								// frame in which the probes were recorded; -1: unused
+		cudaEvent_t done;							// recorded when the results arrived on the host
+	};
+	vector<int2> probePositions;					// picking: screen positions set with SetProbePositions
+	ProbeReadback probeRing[PROBERING];				// picking: readback slots of the last PROBERING frames with probes
+	int probeFrame = 0;								// picking: frames rendered with probes; selects the slot in probeRing
+	bool probesSet = false;							// picking: the device holds a non-empty ProbeControl
+	// frame readback: finished frames are copied to a ring of pinned host buffers, see ReadbackFrame
+	struct FrameReadback
+	{
+		float4* pixels = 0;							// pinned host memory
+		size_t capacity = 0;						// pixels allocated
+		int width = 0, height = 0;					// size of the frame
+		int frame = -1;								// number of the frame; -1: free, or handed out by GetReadbackFrame
+		cudaEvent_t done;							// recorded when the frame arrived on the host
+	};
+	FrameReadback readbackRing[READBACKRING];		// frame readback: copies of the last READBACKRING frames
+	int readbackFrame = 0;							// frame readback: number of the next frame; selects its slot
+	bool readbackEnabled = false;					// frame readback: copy each finished frame, see SetFrameReadback
+	cudaStream_t readbackStream;					// frame readback: non-blocking stream for the copies
+	cudaEvent_t readbackReady;						// frame readback: recorded on the render stream after finalize
+	// checkpoints: the accumulation state is copied on the readback stream and written by a job, see SaveCheckpoint
+	struct CheckpointHeader
+	{
+		uint version;								// CHECKPOINTVERSION
+		int width, height, spp;						// render target; a checkpoint only resumes on the same target
+		int samplesTaken;							// samples in the accumulator
+		uint camRNGseed;							// state of the RNG that seeds the frames
+		int guides;									// 1 if the denoiser guides follow the accumulator
+	};
+	float4* checkpointPixels = 0;					// checkpoints: pinned copy of the accumulator and the guides
+	size_t checkpointCapacity = 0;					// checkpoints: float4s allocated in checkpointPixels
+	cudaEvent_t checkpointCopied;					// checkpoints: recorded when the copy arrived on the host
+	WaitGroup checkpointWritten;					// checkpoints: the job that writes the file
+	// ray queries: rays submitted with QueryRays are traced in one launch per frame, see TraceRayQueries
+	struct RayQueryBatch
+	{
+		CoreBuffer<float4>* rays = 0;				// origins, then directions, at an offset of the capacity of hits
+		CoreBuffer<float4>* hits = 0;				// hit data of the rays, copied back to the pinned host side
+		vector<int> ends;							// per ticket: end of its rays in the batch
+		int firstTicket = -1;						// ticket of the first query in the batch; -1: unused
+		cudaEvent_t done;							// recorded when the hits arrived on the host
+	};
+	RayQueryBatch queryBatches[RAYQUERYRING];		// the last RAYQUERYRING traced batches
+	int nextQueryBatch = 0;							// slot in queryBatches for the next TraceRayQueries
+	vector<float4> queryOrigins, queryDirections;	// rays submitted since the last TraceRayQueries
+	vector<int> queryEnds;							// per submitted ticket: end of its rays in queryOrigins
+	int nextQueryTicket = 0;						// ticket returned by the next QueryRays call
+#ifdef MOTIONBLUR
+	CoreBuffer<OptixMatrixMotionTransform>* motionTransforms = 0;	// motion of moving instances, see SetInstanceMotion
+	vector<OptixTraversableHandle> motionHandles;	// per slot of motionTransforms: its traversable handle
+	vector<int> instanceMotion;						// per instance: slot in motionTransforms, or -1 if static
+	vector<int> freeMotionSlots;					// released slots below motionSlots
+	int motionSlots = 0;							// slots of motionTransforms in use or released
+	int firstDirtyMotion = INT_MAX, lastDirtyMotion = -1;	// range of motionTransforms to sync to the device
+	float shutter = 0;								// fraction of the frame interval the shutter is open; 0: no motion blur
+#endif
+	InteropTexture renderTargets[MAXTARGETS];		// CUDA will render to these textures, in turn
+	int targetCount = 1;							// number of render targets in use
+	int currentTarget = 0;							// render target for the next frame
+	int presentTarget = 0;							// most recently completed render target
+	float4* hostTarget = 0;							// headless rendering: registered host memory that receives the frame
+	float4* hostTargetDevPtr = 0;					// device side mapping of hostTarget
+	VideoEncoder* videoEncoder = 0;					// video target: encodes each frame on the device, see SetVideoTarget
+	CoreBuffer<float4>* videoFrame = 0;				// video target: the finalized frame, before it is packed for the encoder
+	bool videoKeyFrame = false;						// video target: make the next frame a key frame, see "videoKeyFrame"
+	cudaGraphicsResource* visibilityResource = 0;	// hybrid rendering: rasterized primary hits, see SetVisibilityBuffer
+	int2 visibilitySize = make_int2( 0 );			// hybrid rendering: size of the visibility buffer
+	CoreBuffer<uint4>* visibilityBuffer = 0;		// hybrid rendering: device copy of the visibility buffer for a frame
+	float2 renderBand = make_float2( 0, 1 );		// image-space split: rendered rows, as fractions of the target height
+	int tileRows = 0;								// tiled rendering: buffers hold this many rows of the target; 0: all
 	CoreBuffer<CoreMaterial>* materialBuffer = 0;	// material array
 	CoreMaterial* hostMaterialBuffer = 0;			// core-managed host-side copy of the materials for alpha tris
-	CoreBuffer<CoreLightTri>* areaLightBuffer;		// area lights
-	CoreBuffer<CorePointLight>* pointLightBuffer;	// point lights
-	CoreBuffer<CoreSpotLight>* spotLightBuffer;		// spot lights
-	CoreBuffer<CoreDirectionalLight>* directionalLightBuffer;	// directional lights
+	CoreBuffer<uint>* materialClassBuffer = 0;		// shade class per material, see UpdateShadeClasses
+#ifdef SHADECOST
+	CoreBuffer<CoreMaterialCost>* materialCostBuffer = 0;	// instrumentation build: shading cost per material, see GetMaterialCosts
+#endif
+	CoreBuffer<CoreLightTri>* areaLightBuffer = 0;	// area lights
+	CoreBuffer<CorePointLight>* pointLightBuffer = 0;	// point lights
+	CoreBuffer<CoreSpotLight>* spotLightBuffer = 0;	// spot lights
+	CoreBuffer<CoreDirectionalLight>* directionalLightBuffer = 0;	// directional lights
+	CoreBuffer<CoreLightTreeNode>* lightTreeBuffer = 0;	// light tree over area, point and spot lights
+	CoreBuffer<CoreLightAlias>* lightAliasBuffer = 0;	// alias table for power-proportional light selection
 	CoreBuffer<float4>* texel128Buffer = 0;			// texel buffer 1: hdr ARGB128 texture data
 	CoreBuffer<uint>* normal32Buffer = 0;			// texel buffer 2: integer-encoded normals
-	CoreBuffer<float3>* skyPixelBuffer = 0;			// skydome texture data
+	CoreBuffer<uint2>* skyPixelBuffer = 0;			// skydome texture pyramid, half precision; see SampleSkydome
+	CoreBuffer<float>* skyCDFBuffer = 0;			// skydome importance sampling data, see HostSkyDome::BuildImportanceCDF
 	CoreBuffer<float4>* accumulator = 0;			// accumulator buffer for the path tracer
 #ifdef USE_OPTIX_PERSISTENT_THREADS
 	CoreBuffer<Counters>* counterBuffer = 0;		// counters for persistent threads
@@ -93,36 +311,152 @@ private:
 #endif
 	CoreBuffer<CoreInstanceDesc>* instDescBuffer = 0; // instance descriptor array
 	CoreBuffer<uint>* texel32Buffer = 0;			// texel buffer 0: regular ARGB32 texture data
+	TexelPager* texel32Pager = 0;					// virtual texel buffer 0, replaces texel32Buffer with VIRTUALTEXTURES
+	TexelPager* normal32Pager = 0;					// virtual texel buffer 2, replaces normal32Buffer with VIRTUALTEXTURES
+	int textureBudget = 1024;						// device memory for the virtual texel pools, in MB
+	int textureHostBudget = 0;						// host memory for the virtual texel pools, in MB; 0: no page files
+	int texturePageUploads = 256;					// maximum number of texture pages streamed in per frame
+	CoreBuffer<uint2>* bc1Buffer = 0;				// block compressed ARGB32 textures, with BCTEXTURES
+	CoreBuffer<uint4>* bc5Buffer = 0;				// block compressed normal maps, with BCTEXTURES
+	bool compressTextures = false;					// block compress textures that allow it
+	CoreBuffer<cudaTextureObject_t>* texObjectBuffer = 0; // texture objects, indexed by texture ID, with HWTEXTURES
+	vector<cudaMipmappedArray_t> texArrays;			// texel storage for the texture objects
+	bool hardwareTextures = false;					// sample all textures through texture objects
+	enum { BLOCKPOOL = 3, HARDWAREPOOL = 4 };		// texture pools besides the three TexelStorage pools
+	vector<char> texPool;							// per texture: TexelStorage, BLOCKPOOL or HARDWAREPOOL
+	enum { WAVEFRONT = 0, POSTPROCESS = 1 };		// frame stages of the transient buffers
+	TransientHeap transients = TransientHeap( VRAMPathStates ); // buffers that live in one stage of a frame, see PlaceTransients
+	bool aliasTransients = true;					// let transient buffers of different stages share memory
 	CoreBuffer<float4>* hitBuffer = 0;				// intersection results
 	CoreBuffer<float4>* pathStateBuffer = 0;		// path state buffer
+	bool materialSort = false;						// sort paths by material before shading, see sorting_shared.h
+	CoreBuffer<float4>* sortedStateBuffer = 0;		// path states in material order
+	CoreBuffer<float4>* sortedHitBuffer = 0;		// intersection results in material order
+	CoreBuffer<uint>* sortKeyBuffer = 0;			// sort key per path
+	CoreBuffer<uint>* sortBinBuffer = 0;			// path count, then first index, per sort bin
+	bool shadeClasses = true;						// with materialSort: a specialized shade kernel per class, see SORTCLASSES
+	float shadeTimePerPath[2] = { 0, 0 };			// running average of shade time per path, without and with sorting
+	bool persistentShade = false;					// shade with persistent threads, see shadePersistentKernel
+	bool interleaveShadows = false;					// trace the connections of each bounce before the next one
+	float frameBudget = 0;							// dynamic resolution: target render time in ms; 0: disabled
+	int traversalHeatmap = 0;						// debug view: 1 shows trace cycles, 2 any-hit invocations per pixel; 0: disabled
+	float heatmapRange = HEATMAPCYCLES;				// traversal heatmap: cycles per sample at the top of the ramp
+	CoreBuffer<uint2>* traversalCostBuffer = 0;		// traversal heatmap: cycles and any-hit invocations per pixel, see Params
+	float minRenderScale = 0.5f;					// dynamic resolution: lowest internal resolution, relative to the target
+	float renderScale = 1;							// dynamic resolution: current internal resolution, relative to the target
+	int renderWidth = 0, renderHeight = 0;			// internal resolution of the last frame
+	CoreBuffer<float4>* upscaleBuffer[3] = { 0, 0, 0 };	// dynamic resolution: upscaled frame, TAA history, resolved frame
+	CoreBuffer<float2>* motionBuffer = 0;			// dynamic resolution: position in the previous frame, per target pixel
+	CoreBuffer<float2>* hitMotionBuffer = 0;		// dynamic resolution: motion of the primary hit, per rendered pixel
+	CoreBuffer<float>* hitDepthBuffer = 0;			// temporal reprojection: distance of the primary hit to the previous eye
+	bool reproject = false;							// temporal reprojection: a restart keeps the history, see ReprojectAccumulator
+	float reprojectMaxHistory = 32;					// temporal reprojection: cap on the inherited sample count per pixel
+	CoreBuffer<float4>* reprojectFrame[2] = { 0, 0 };	// temporal reprojection: presented average and depth, this and the previous frame
+	CoreBuffer<float4>* reprojectHistory[2] = { 0, 0 };	// temporal reprojection: inherited average and sample count, current and previous
+	bool reprojectValid = false;					// reprojectFrame[0] holds the previous frame
+	int reprojectSpp = 0;							// samples in the accumulator of the previous frame
+	int passOffset = 0;								// temporal reprojection: sample index of the first sample after a restart
+	bool historyValid = false;						// upscaleBuffer[1] holds the previous frame
+	ViewPyramid prevView;							// view of the previous frame, for reprojection
+	bool useDenoiser = false;						// replace the accumulated frame by the output of the OptiX denoiser
+	OptixDenoiser denoiser = 0;						// created on first use
+	int2 denoiseTile = make_int2( 0 );				// tile size the denoiser state was set up for
+	int denoiseOverlap = 0;							// overlap between denoiser tiles, in pixels
+	CoreBuffer<uchar>* denoiseState = 0;			// denoiser state, for one tile plus overlap
+	CoreBuffer<uchar>* denoiseScratch = 0;			// denoiser scratch memory
+	CoreBuffer<float>* denoiseIntensity = 0;		// average log intensity of the frame, for the HDR model
+	CoreBuffer<float4>* guideBuffer = 0;			// accumulated albedo and normal of the primary hits
+	CoreBuffer<float4>* denoiseLayers = 0;			// denoiser input: color, albedo, normal; then the output
+#ifdef SINGLEBOUNCE
+	PathControl pathControl = { PATHLENGTH, 0, 1, 0, 0, 0, 0, 0, PREVIEW_OFF, AODISTANCE };	// path length and termination settings
+#else
+	PathControl pathControl = { PATHLENGTH, 0, 0, 0, 0, 0, 0, 0, PREVIEW_OFF, AODISTANCE };	// path length and termination settings
+#endif
 	CoreBuffer<float4>* connectionBuffer = 0;		// shadow rays
 	CoreBuffer<OptixInstance>* instanceArray = 0;	// instance descriptors for Optix
+	CoreBuffer<uchar>* topBuffer = 0;				// top-level acceleration structure
+	CoreBuffer<uchar>* topTemp = 0;					// scratch memory for top-level builds and refits
+	size_t reservedTop = 0, reservedTopTemp = 0;	// allocated sizes of topBuffer and topTemp
+	int topInstanceCount = 0;						// instance count at last top-level build; refit requires a match
+	int topRefitCount = 0;							// top-level refits since the last full build
+	bool topRebuildPending = false;					// backgroundRebuilds: a top-level build is in flight on the build stream
+	CoreBuffer<OptixInstance>* topRebuildInstances = 0;	// snapshot of instanceArray for the background build
+	CoreBuffer<uchar>* topRebuildBuffer = 0;		// target of the background build; swapped with topBuffer when done
+	CoreBuffer<uchar>* topRebuildTemp = 0;			// scratch memory of the background build
+	size_t reservedTopRebuild = 0;					// allocated size of topRebuildBuffer
+	cudaEvent_t topRebuildStart, topRebuildDone;	// snapshot taken on the update stream; build done on the build stream
+	vector<CoreBuffer<uchar>*> gasArenas;			// compacted mesh BVHs, one buffer per CompactMeshes batch; 0 when unused
 	CoreBuffer<Params>* optixParams;				// parameters to be used in optix code
 	CoreTexDesc* texDescs = 0;						// array of texture descriptors
 	int textureCount = 0;							// size of texture descriptor array
+	vector<uint> texCapacity;						// per texture: number of texels reserved in its pool
 	int SMcount = 0;								// multiprocessor count, used for persistent threads
 	int computeCapability;							// device compute capability
+	int cudaDevice = 0;								// device selected in Init
+	vector<int> peerDevices;						// peer devices that accept read-only pools, see PoolDevice
+	WaitGroup pipelineReady;						// module, pipeline and SBT creation, see CreateOptixContext
 	int samplesTaken = 0;							// number of accumulated samples in accumulator
 	uint camRNGseed = 0x12345678;					// seed for the RNG that feeds the renderer
 	DeviceVars vars;								// copy of device-side variables, to detect changes
 	bool firstConvergingFrame = false;				// to reset accumulator for first converging frame
+	bool previewChanged = false;					// the "previewMode" or "aoDistance" changed; restarts accumulation
+	bool asyncWavefront = false;					// enqueue all bounces without reading back path counts
+	bool useCudaGraph = false;						// submit the wavefront loop as a CUDA graph (requires asyncWavefront)
+	bool megakernel = false;						// trace and shade all path segments in one launch, see the "megakernel" setting
+	int shadeVariant = 1;							// launch configuration of shadeKernel, see kernels/pathtracer.h
+	int finalizeVariant = 0;						// block size of finalizeRenderKernel
+	int tuneFrame = -1;								// frame of the launch configuration autotuning pass; -1: not tuning
+	float tuneShade[SHADEVARIANTS], tuneFinalize[FINALIZEVARIANTS];	// autotuning: accumulated timings per variant
+	cudaStream_t renderStream;						// stream used for capturing the wavefront loop
+	cudaGraphExec_t graphExec = 0;					// instantiated wavefront loop; updated every frame
+	Params* pinnedParams = 0;						// pinned per-launch copies of params, read by the captured memcpys
 	// blue noise table: contains the three tables distributed by Heitz.
 	// Offset 0: an Owen-scrambled Sobol sequence of 256 samples of 256 dimensions.
 	// Offset 65536: scrambling tile of 128x128 pixels; 128 * 128 * 8 values.
 	// Offset 65536 * 3: ranking tile of 128x128 pixels; 128 * 128 * 8 values. Total: 320KB.
 	CoreBuffer<uint>* blueNoise = 0;
+#ifdef GGXCOMPENSATION
+	cudaArray_t ggxAlbedoArray = 0;					// directional albedo of the specular lobe, see ggx_albedo.h
+	cudaTextureObject_t ggxAlbedoTexture = 0;		// linear filtered view of ggxAlbedoArray
+#endif
 	// timing
 	cudaEvent_t traceStart[MAXPATHLENGTH], traceEnd[MAXPATHLENGTH];
 	cudaEvent_t shadeStart[MAXPATHLENGTH], shadeEnd[MAXPATHLENGTH];
+	cudaEvent_t sortStart[MAXPATHLENGTH], sortEnd[MAXPATHLENGTH];
 	cudaEvent_t shadowStart, shadowEnd;
+	cudaEvent_t finalizeStart, finalizeEnd;
+	cudaEvent_t denoiseStart, denoiseEnd;
+	cudaEvent_t frameStart, topStart;				// profiler: time base of a frame, start of the last top-level build
+	bool profile = false;							// record profileEvents for each frame
+	bool topLevelPending = false;					// a top-level build has not been profiled yet
 public:
 	CoreStats coreStats;							// rendering statistics
+	vector<ProfileEvent> profileEvents;				// GPU ranges of the last frame, with profiling enabled
 	static OptixDeviceContext optixContext;			// static, for access from CoreMesh
-	enum { RAYGEN = 0, RAD_MISS, OCC_MISS, RAD_HIT, OCC_HIT };
+	cudaStream_t updateStream;						// uploads and acceleration structure builds
+	cudaEvent_t updateDone;							// recorded on updateStream when the top-level is ready
+	cudaStream_t buildStream;						// background builds, at the lowest priority: streamGeometry, backgroundRebuilds
+	cudaStream_t copyStream;						// host-to-device uploads through the staging ring
+	StagingRing* stagingRing = 0;					// pinned staging memory for scene data uploads
+	int gasRebuildInterval = 16;					// deforming meshes: full BVH build after this many refits
+	int topRebuildInterval = 16;					// backgroundRebuilds: full top-level build after this many refits
+	bool backgroundRebuilds = false;				// full builds of refitted BVHs run on buildStream, see CoreMesh::StartRebuild
+	bool streamGeometry = false;					// first mesh builds run in the background, see CoreMesh::SetGeometry
+	bool packTriangles = false;						// store compact CoreTriPacked shading records, see CoreMesh::SetGeometry
+	bool quantizePositions = false;					// static meshes: 16-bit vertices as BVH build input, see CoreMesh::SetGeometry
+#ifdef ANYHITALPHA
+	enum { RAYGEN = 0, RAD_MISS, OCC_MISS, RAD_HIT, OCC_HIT, RAD_HIT_ALPHA, OCC_HIT_ALPHA, PROGRAMGROUPS };
+#else
+	enum { RAYGEN = 0, RAD_MISS, OCC_MISS, RAD_HIT, OCC_HIT, PROGRAMGROUPS };
+#endif
 	OptixShaderBindingTable sbt;
 	OptixModule ptxModule;
 	OptixPipeline pipeline;
-	OptixProgramGroup progGroup[5];
+	OptixProgramGroup progGroup[PROGRAMGROUPS];
+	OptixPipeline megaPipeline = 0;					// __raygen__megakernel with the hit and miss groups of pipeline; 0 if the module lacks it
+	OptixProgramGroup megaRaygen = 0;
+	OptixShaderBindingTable megaSbt;				// sbt, with the megakernel raygen record
+	bool reorderSupported = false;					// the megakernel reorders threads, see kernels/reorder.h; requires OptiX 8
 	OptixTraversableHandle bvhRoot;
 	Params params;
 	CUdeviceptr d_params;
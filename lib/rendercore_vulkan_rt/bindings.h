@@ -50,6 +50,7 @@
 #define cSPOTLIGHT_BUFFER 18
 #define cDIRECTIONALLIGHT_BUFFER 19
 #define cBLUENOISE 20
+#define cTEXTURES 21 // only with BINDLESS_TEXTURES
 
 // Finalize bindings
 #define fACCUMULATION_BUFFER 0
@@ -66,4 +67,9 @@
 #define MAXPATHLENGTH 3
 #define MAX_TRIANGLE_BUFFERS 65536
 #define BLUENOISE
+
+// Textures as individual images with MIP chains, sampled through the cTEXTURES descriptor array;
+// the texture addresses in the materials then hold the index of the texture in this array.
+// #define BINDLESS_TEXTURES
+#define MAX_TEXTURES 4096
 #endif
\ No newline at end of file
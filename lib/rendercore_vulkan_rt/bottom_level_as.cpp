@@ -15,13 +15,21 @@
 
 #include "core_settings.h"
 
-BottomLevelAS::BottomLevelAS( VulkanDevice device, const float4 *vertices, uint32_t vertexCount, AccelerationStructureType type )
+BottomLevelAS::BottomLevelAS( VulkanDevice device, const float4 *vertices, uint32_t vertexCount, AccelerationStructureType type,
+							  const uint *indices, uint32_t indexCount )
 	: m_Device( device ), m_Type( type )
 {
 	assert( vertexCount > 0 );
 	m_Vertices = new VulkanCoreBuffer<float4>( m_Device, vertexCount, vk::MemoryPropertyFlagBits::eDeviceLocal,
 											   vk::BufferUsageFlagBits::eRayTracingNV | vk::BufferUsageFlagBits::eTransferDst );
-	m_Vertices->CopyToDevice( vertices, vertexCount * sizeof( float4 ) );
+	// Fresh buffers: staged and copied on the transfer queue, flushed before the build in BuildBatch
+	RenderCore::instance->uploader->Upload( *m_Vertices, vertices, vertexCount * sizeof( float4 ) );
+	if ( indices )
+	{
+		m_Indices = new VulkanCoreBuffer<uint>( m_Device, indexCount, vk::MemoryPropertyFlagBits::eDeviceLocal,
+												vk::BufferUsageFlagBits::eRayTracingNV | vk::BufferUsageFlagBits::eTransferDst );
+		RenderCore::instance->uploader->Upload( *m_Indices, indices, indexCount * sizeof( uint ) );
+	}
 	m_Flags = TypeToFlags( type );
 
 	m_Geometry.pNext = nullptr;
@@ -33,10 +41,10 @@ BottomLevelAS::BottomLevelAS( VulkanDevice device, const float4 *vertices, uint3
 	m_Geometry.geometry.triangles.vertexStride = sizeof( float4 );
 	m_Geometry.geometry.triangles.vertexFormat = vk::Format::eR32G32B32Sfloat;
 
-	m_Geometry.geometry.triangles.indexData = nullptr;
+	m_Geometry.geometry.triangles.indexData = m_Indices ? vk::Buffer( *m_Indices ) : nullptr;
 	m_Geometry.geometry.triangles.indexOffset = 0;
-	m_Geometry.geometry.triangles.indexCount = 0;
-	m_Geometry.geometry.triangles.indexType = vk::IndexType::eNoneNV;
+	m_Geometry.geometry.triangles.indexCount = m_Indices ? indexCount : 0;
+	m_Geometry.geometry.triangles.indexType = m_Indices ? vk::IndexType::eUint32 : vk::IndexType::eNoneNV;
 	m_Geometry.geometry.triangles.transformData = nullptr;
 	m_Geometry.geometry.triangles.transformOffset = 0;
 	m_Geometry.flags = vk::GeometryFlagBitsNV::eOpaque;
@@ -73,7 +81,7 @@ BottomLevelAS::BottomLevelAS( VulkanDevice device, const float4 *vertices, uint3
 											  vk::BufferUsageFlagBits::eRayTracingNV | vk::BufferUsageFlagBits::eTransferSrc );
 
 	// Bind the acceleration structure descriptor to the actual memory that will contain it
-	vk::BindAccelerationStructureMemoryInfoNV bindInfo = {m_Structure, *m_Memory, 0, 0, nullptr};
+	vk::BindAccelerationStructureMemoryInfoNV bindInfo = {m_Structure, *m_Memory, m_Memory->GetMemoryOffset(), 0, nullptr};
 	CheckVK( device->bindAccelerationStructureMemoryNV( 1, &bindInfo, RenderCore::instance->dynamicDispatcher ) );
 }
 
@@ -85,16 +93,22 @@ BottomLevelAS::~BottomLevelAS()
 void lh2core::BottomLevelAS::Cleanup()
 {
 	if ( m_Structure ) m_Device->destroyAccelerationStructureNV( m_Structure, nullptr, RenderCore::instance->dynamicDispatcher );
+	VulkanUploader *uploader = RenderCore::instance->uploader;
+	if ( m_Vertices && uploader ) uploader->Retire( *m_Vertices );
+	if ( m_Indices && uploader ) uploader->Retire( *m_Indices );
 	if ( m_Vertices ) delete m_Vertices;
+	if ( m_Indices ) delete m_Indices;
 	if ( m_Memory ) delete m_Memory;
 	m_Structure = nullptr;
 	m_Vertices = nullptr;
+	m_Indices = nullptr;
 	m_Memory = nullptr;
 }
 
 void BottomLevelAS::UpdateVertices( const float4 *vertices, uint32_t vertexCount )
 {
 	assert( m_Vertices->GetElementCount() == vertexCount );
+	RenderCore::instance->uploader->Retire( *m_Vertices ); // The synchronous copy must not be overtaken by a pending upload
 	m_Vertices->CopyToDevice( vertices, vertexCount * sizeof( float4 ) );
 }
 
@@ -124,92 +138,137 @@ uint32_t lh2core::BottomLevelAS::GetVertexCount() const
 void lh2core::BottomLevelAS::Build( bool update )
 {
 	assert( m_Vertices->GetElementCount() > 0 );
+	if ( !update )
+	{
+		BuildBatch( m_Device, {this} );
+		return;
+	}
 
 	// Create temporary scratch buffer
 	auto scratchBuffer = VulkanCoreBuffer<uint8_t>( m_Device, m_ScratchSize, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eRayTracingNV );
 
-	// Build the actual bottom-level AS
+	// Refit the bottom-level AS
 	vk::AccelerationStructureInfoNV buildInfo = {vk::AccelerationStructureTypeNV::eBottomLevel, m_Flags, 0, 1, &m_Geometry};
-
-	// Submit build command
 	auto commandBuffer = m_Device.CreateOneTimeCmdBuffer();
+	commandBuffer->buildAccelerationStructureNV( &buildInfo, nullptr, 0, true, m_Structure, m_Structure, scratchBuffer, 0, RenderCore::instance->dynamicDispatcher );
+	// Create memory barrier for building AS to make sure it can only be used when ready
+	vk::MemoryBarrier memoryBarrier = {vk::AccessFlagBits::eAccelerationStructureWriteNV | vk::AccessFlagBits::eAccelerationStructureReadNV,
+									   vk::AccessFlagBits::eAccelerationStructureReadNV};
+	commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV,
+								   vk::PipelineStageFlagBits::eRayTracingShaderNV, vk::DependencyFlags(), 1, &memoryBarrier,
+								   0, nullptr, 0, nullptr );
 	auto computeQueue = m_Device.GetComputeQueue();
+	commandBuffer.Submit( computeQueue, true );
+}
 
-	if ( m_Flags & vk::BuildAccelerationStructureFlagBitsNV::eAllowCompaction )
+void lh2core::BottomLevelAS::BuildBatch( VulkanDevice device, const std::vector<BottomLevelAS *> &structures )
+{
+	if ( structures.empty() ) return;
+	RenderCore::instance->uploader->Flush(); // Submits the acquire of the vertex and index uploads ahead of the builds
+	auto computeQueue = device.GetComputeQueue();
+	const auto alignScratch = []( vk::DeviceSize size ) { return ( size + 255 ) & ~vk::DeviceSize( 255 ); };
+
+	// One scratch arena for all builds; builds that run past its end wait for the earlier ones and start over
+	vk::DeviceSize totalScratch = 0, maxScratch = 0;
+	for ( const auto *as : structures ) totalScratch += alignScratch( as->m_ScratchSize ), maxScratch = std::max( maxScratch, as->m_ScratchSize );
+	const vk::DeviceSize arenaSize = std::max( maxScratch, std::min( totalScratch, SCRATCH_ARENA_SIZE ) );
+	auto scratchBuffer = VulkanCoreBuffer<uint8_t>( device, arenaSize, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eRayTracingNV );
+
+	vk::MemoryBarrier memoryBarrier = {vk::AccessFlagBits::eAccelerationStructureWriteNV | vk::AccessFlagBits::eAccelerationStructureReadNV,
+									   vk::AccessFlagBits::eAccelerationStructureReadNV};
+	std::vector<BottomLevelAS *> compactable;
+	std::vector<vk::AccelerationStructureNV> compactableStructures;
+
+	// Record all builds in a single command buffer
+	auto commandBuffer = device.CreateOneTimeCmdBuffer();
+	vk::DeviceSize scratchOffset = 0;
+	for ( auto *as : structures )
 	{
-		commandBuffer->buildAccelerationStructureNV( &buildInfo, nullptr, 0, update, m_Structure,
-													 update ? m_Structure : nullptr, scratchBuffer,
-													 0, RenderCore::instance->dynamicDispatcher );
-		// Create memory barrier for building AS to make sure it can only be used when ready
-		vk::MemoryBarrier memoryBarrier = {vk::AccessFlagBits::eAccelerationStructureWriteNV | vk::AccessFlagBits::eAccelerationStructureReadNV,
-										   vk::AccessFlagBits::eAccelerationStructureReadNV};
-		commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV,
-										vk::PipelineStageFlagBits::eRayTracingShaderNV, vk::DependencyFlags(), 1, &memoryBarrier,
-										0, nullptr, 0, nullptr );
-
-		// Create query pool to get compacted AS size
-		vk::QueryPoolCreateInfo queryPoolCreateInfo = vk::QueryPoolCreateInfo( vk::QueryPoolCreateFlags(), vk::QueryType::eAccelerationStructureCompactedSizeNV, 1 );
-		vk::QueryPool queryPool = m_Device->createQueryPool( queryPoolCreateInfo );
-
-		// Query for compacted size
-		commandBuffer->resetQueryPool( queryPool, 0, 1 );
-		commandBuffer->beginQuery( queryPool, 0, vk::QueryControlFlags() );
-		commandBuffer->writeAccelerationStructuresPropertiesNV( 1, &m_Structure, vk::QueryType::eAccelerationStructureCompactedSizeNV,
-																queryPool, 0, RenderCore::instance->dynamicDispatcher );
-		commandBuffer->endQuery( queryPool, 0 );
-		commandBuffer.Submit( computeQueue, true );
-
-		uint32_t size;
-		CheckVK( m_Device->getQueryPoolResults( queryPool, 0, 1, sizeof( uint32_t ),
-												&size, sizeof( uint32_t ), vk::QueryResultFlagBits::eWait ) );
-
-		if ( size > 0 ) // Only compact if the queried result returns a valid size value
+		assert( as->m_Vertices->GetElementCount() > 0 );
+		if ( scratchOffset + as->m_ScratchSize > arenaSize )
 		{
-			buildInfo.geometryCount = 0; // Must be zero for compacted AS
-			buildInfo.pGeometries = nullptr;
-			vk::AccelerationStructureCreateInfoNV accelerationStructureCreateInfo = {0, buildInfo};
-			accelerationStructureCreateInfo.compactedSize = size;
-			// Create AS handle
-			vk::AccelerationStructureNV compactedAS;
-			CheckVK( m_Device->createAccelerationStructureNV( &accelerationStructureCreateInfo, nullptr, &compactedAS, RenderCore::instance->dynamicDispatcher ) );
-			// Get new memory requirements
-			vk::AccelerationStructureMemoryRequirementsInfoNV memoryRequirementsInfo = {vk::AccelerationStructureMemoryRequirementsTypeNV::eObject, compactedAS};
-			vk::MemoryRequirements2 memoryRequirements;
-			m_Device->getAccelerationStructureMemoryRequirementsNV( &memoryRequirementsInfo, &memoryRequirements, RenderCore::instance->dynamicDispatcher );
-			// Create new, smaller buffer for compacted AS
-			auto newMemory = new VulkanCoreBuffer<uint8_t>( m_Device, memoryRequirements.memoryRequirements.size, vk::MemoryPropertyFlagBits::eDeviceLocal,
-															vk::BufferUsageFlagBits::eRayTracingNV | vk::BufferUsageFlagBits::eTransferDst );
-			// Bind the acceleration structure descriptor to the memory that will contain it
-			vk::BindAccelerationStructureMemoryInfoNV bindInfo = {compactedAS, *newMemory, 0, 0, nullptr};
-			CheckVK( m_Device->bindAccelerationStructureMemoryNV( 1, &bindInfo, RenderCore::instance->dynamicDispatcher ) );
-			// Submit copy & compact command to command buffer
-			commandBuffer.Begin();
-			commandBuffer->copyAccelerationStructureNV( compactedAS, m_Structure, vk::CopyAccelerationStructureModeNV::eCompact, RenderCore::instance->dynamicDispatcher );
-			commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV, vk::PipelineStageFlagBits::eRayTracingShaderNV,
-										   vk::DependencyFlags(), 1, &memoryBarrier, 0, nullptr, 0, nullptr );
-			commandBuffer.Submit( computeQueue, true );
-
-			// Cleanup
-			m_Device->destroyQueryPool( queryPool );
-			m_Device->destroyAccelerationStructureNV( m_Structure, nullptr, RenderCore::instance->dynamicDispatcher );
-			delete m_Memory;
-
-			// Assign new AS to this object
-			m_Memory = newMemory;
-			m_Structure = compactedAS;
+			// Scratch memory is reused, wait for the builds that are using it
+			commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV, vk::PipelineStageFlagBits::eAccelerationStructureBuildNV,
+											vk::DependencyFlags(), 1, &memoryBarrier, 0, nullptr, 0, nullptr );
+			scratchOffset = 0;
 		}
+		vk::AccelerationStructureInfoNV buildInfo = {vk::AccelerationStructureTypeNV::eBottomLevel, as->m_Flags, 0, 1, &as->m_Geometry};
+		commandBuffer->buildAccelerationStructureNV( &buildInfo, nullptr, 0, false, as->m_Structure, nullptr, scratchBuffer,
+													 scratchOffset, RenderCore::instance->dynamicDispatcher );
+		scratchOffset += alignScratch( as->m_ScratchSize );
+		as->m_Built = true;
+		if ( as->m_Flags & vk::BuildAccelerationStructureFlagBitsNV::eAllowCompaction )
+			compactable.push_back( as ), compactableStructures.push_back( as->m_Structure );
+	}
+	// Make sure the structures can only be used when ready
+	commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV,
+									vk::PipelineStageFlagBits::eAccelerationStructureBuildNV | vk::PipelineStageFlagBits::eRayTracingShaderNV,
+									vk::DependencyFlags(), 1, &memoryBarrier, 0, nullptr, 0, nullptr );
+
+	// Query compacted sizes of all compactable structures in the same submission
+	const uint32_t compactCount = (uint32_t)compactable.size();
+	vk::QueryPool queryPool = nullptr;
+	if ( compactCount > 0 )
+	{
+		queryPool = device->createQueryPool( vk::QueryPoolCreateInfo( vk::QueryPoolCreateFlags(), vk::QueryType::eAccelerationStructureCompactedSizeNV, compactCount ) );
+		commandBuffer->resetQueryPool( queryPool, 0, compactCount );
+		commandBuffer->writeAccelerationStructuresPropertiesNV( compactCount, compactableStructures.data(), vk::QueryType::eAccelerationStructureCompactedSizeNV,
+																queryPool, 0, RenderCore::instance->dynamicDispatcher );
 	}
-	else
+	commandBuffer.Submit( computeQueue, true );
+	if ( compactCount == 0 ) return;
+
+	std::vector<uint64_t> compactedSizes( compactCount );
+	CheckVK( device->getQueryPoolResults( queryPool, 0, compactCount, compactCount * sizeof( uint64_t ), compactedSizes.data(), sizeof( uint64_t ),
+										  vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait ) );
+	device->destroyQueryPool( queryPool );
+
+	// Copy into tightly sized structures, again in a single command buffer
+	std::vector<vk::AccelerationStructureNV> oldStructures;
+	std::vector<VulkanCoreBuffer<uint8_t> *> oldMemory;
+	vk::DeviceSize savedBytes = 0;
+	commandBuffer.Begin();
+	for ( uint32_t i = 0; i < compactCount; i++ )
 	{
-		commandBuffer->buildAccelerationStructureNV( &buildInfo, nullptr, 0, update, m_Structure, update ? m_Structure : nullptr,
-													scratchBuffer, 0, RenderCore::instance->dynamicDispatcher );
-		// Create memory barrier for building AS to make sure it can only be used when ready
-		vk::MemoryBarrier memoryBarrier = {vk::AccessFlagBits::eAccelerationStructureWriteNV | vk::AccessFlagBits::eAccelerationStructureReadNV,
-										   vk::AccessFlagBits::eAccelerationStructureReadNV};
-		commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV,
-									   vk::PipelineStageFlagBits::eRayTracingShaderNV, vk::DependencyFlags(), 1, &memoryBarrier,
-									   0, nullptr, 0, nullptr );
-		auto computeQueue = m_Device.GetComputeQueue();
-		commandBuffer.Submit( computeQueue, true );
+		BottomLevelAS *as = compactable[i];
+		if ( compactedSizes[i] == 0 || compactedSizes[i] >= as->m_ResultSize ) continue; // Only compact if the queried result returns a useful size
+
+		vk::AccelerationStructureInfoNV compactInfo = {vk::AccelerationStructureTypeNV::eBottomLevel, as->m_Flags, 0, 0, nullptr}; // Geometry count must be zero for compacted AS
+		vk::AccelerationStructureCreateInfoNV accelerationStructureCreateInfo = {compactedSizes[i], compactInfo};
+		// Create AS handle
+		vk::AccelerationStructureNV compactedAS;
+		CheckVK( device->createAccelerationStructureNV( &accelerationStructureCreateInfo, nullptr, &compactedAS, RenderCore::instance->dynamicDispatcher ) );
+		// Get new memory requirements
+		vk::AccelerationStructureMemoryRequirementsInfoNV memoryRequirementsInfo = {vk::AccelerationStructureMemoryRequirementsTypeNV::eObject, compactedAS};
+		vk::MemoryRequirements2 memoryRequirements;
+		device->getAccelerationStructureMemoryRequirementsNV( &memoryRequirementsInfo, &memoryRequirements, RenderCore::instance->dynamicDispatcher );
+		// Create new, smaller buffer for compacted AS
+		const vk::DeviceSize compactedSize = memoryRequirements.memoryRequirements.size;
+		auto newMemory = new VulkanCoreBuffer<uint8_t>( device, compactedSize, vk::MemoryPropertyFlagBits::eDeviceLocal,
+														vk::BufferUsageFlagBits::eRayTracingNV | vk::BufferUsageFlagBits::eTransferDst );
+		// Bind the acceleration structure descriptor to the memory that will contain it
+		vk::BindAccelerationStructureMemoryInfoNV bindInfo = {compactedAS, *newMemory, newMemory->GetMemoryOffset(), 0, nullptr};
+		CheckVK( device->bindAccelerationStructureMemoryNV( 1, &bindInfo, RenderCore::instance->dynamicDispatcher ) );
+		commandBuffer->copyAccelerationStructureNV( compactedAS, as->m_Structure, vk::CopyAccelerationStructureModeNV::eCompact, RenderCore::instance->dynamicDispatcher );
+
+		// The originals are released once the copies finished
+		oldStructures.push_back( as->m_Structure );
+		oldMemory.push_back( as->m_Memory );
+		savedBytes += as->m_ResultSize - std::min( as->m_ResultSize, compactedSize );
+
+		// Assign new AS to this object
+		as->m_Structure = compactedAS;
+		as->m_Memory = newMemory;
+		as->m_ResultSize = compactedSize;
 	}
+	commandBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAccelerationStructureBuildNV, vk::PipelineStageFlagBits::eRayTracingShaderNV,
+									vk::DependencyFlags(), 1, &memoryBarrier, 0, nullptr, 0, nullptr );
+	commandBuffer.Submit( computeQueue, true );
+
+	// Cleanup
+	for ( auto structure : oldStructures ) device->destroyAccelerationStructureNV( structure, nullptr, RenderCore::instance->dynamicDispatcher );
+	for ( auto *memory : oldMemory ) delete memory;
+	if ( !oldStructures.empty() )
+		printf( "Built %i bottom level structures, compacted %i, saving %.1fMB of device memory.\n",
+				(int)structures.size(), (int)oldStructures.size(), savedBytes / ( 1024.0f * 1024.0f ) );
 }
@@ -21,7 +21,8 @@ namespace lh2core
 class BottomLevelAS
 {
   public:
-	BottomLevelAS( VulkanDevice device, const float4 *vertices, uint32_t vertexCount, AccelerationStructureType type = FastestTrace );
+	BottomLevelAS( VulkanDevice device, const float4 *vertices, uint32_t vertexCount, AccelerationStructureType type = FastestTrace,
+				   const uint *indices = nullptr, uint32_t indexCount = 0 );
 	~BottomLevelAS();
 
 	void Cleanup();
@@ -29,11 +30,16 @@ class BottomLevelAS
 
 	void Build();
 	void Rebuild();
+	// Builds and compacts several structures in a few submissions, sharing their scratch memory
+	static void BuildBatch( VulkanDevice device, const std::vector<BottomLevelAS *> &structures );
 
 	uint64_t GetHandle();
 	uint32_t GetVertexCount() const;
 
 	bool CanUpdate() const { return uint( m_Flags & vk::BuildAccelerationStructureFlagBitsNV::eAllowUpdate ) > 0; }
+	AccelerationStructureType GetType() const { return m_Type; }
+	bool IsIndexed() const { return m_Indices != nullptr; }
+	bool IsBuilt() const { return m_Built; }
 	const vk::AccelerationStructureNV &GetAccelerationStructure() const { return m_Structure; }
 
   private:
@@ -52,7 +58,10 @@ class BottomLevelAS
 		}
 	}
 
+	static constexpr vk::DeviceSize SCRATCH_ARENA_SIZE = 64 * 1024 * 1024; // upper bound for the scratch memory of a batched build
+
 	VulkanDevice m_Device;
+	bool m_Built = false;
 	vk::DeviceSize m_ResultSize, m_ScratchSize;
 	AccelerationStructureType m_Type;
 	vk::BuildAccelerationStructureFlagsNV m_Flags;
@@ -60,6 +69,7 @@ class BottomLevelAS
 	vk::AccelerationStructureNV m_Structure;
 	VulkanCoreBuffer<uint8_t> *m_Memory = nullptr;
 	VulkanCoreBuffer<float4> *m_Vertices = nullptr;
+	VulkanCoreBuffer<uint> *m_Indices = nullptr;
 };
 
 } // namespace lh2core
\ No newline at end of file
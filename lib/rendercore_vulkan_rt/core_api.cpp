@@ -105,9 +105,16 @@ void CoreAPI::SetSkyData( const float3 *pixels, const uint width, const uint hei
 	core->SetSkyData( pixels, width, height );
 }
 
-void CoreAPI::SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags )
+void CoreAPI::SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags, const GeometryHint hint )
 {
-	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags );
+	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags, hint );
+}
+
+bool CoreAPI::SetIndexedGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const uint *indexData, const int triangleCount,
+								  const CoreTri *triangles, const uint *alphaFlags, const GeometryHint hint )
+{
+	core->SetGeometry( meshIdx, vertexData, vertexCount, triangleCount, triangles, alphaFlags, hint, indexData );
+	return true;
 }
 
 void CoreAPI::SetInstance( const int instanceIdx, const int modelIdx, const mat4 &transform )
@@ -115,6 +122,11 @@ void CoreAPI::SetInstance( const int instanceIdx, const int modelIdx, const mat4
 	core->SetInstance( instanceIdx, modelIdx, transform );
 }
 
+void CoreAPI::SetInstanceVisibility( const int instanceIdx, const uint visibility )
+{
+	core->SetInstanceVisibility( instanceIdx, visibility );
+}
+
 void CoreAPI::UpdateToplevel()
 {
 	core->UpdateToplevel();
@@ -53,9 +53,14 @@ class CoreAPI : public CoreAPI_Base
 	// SetSkyData: specify the data required for sky dome rendering.
 	void SetSkyData( const float3 *pixels, const uint width, const uint height );
 	// SetGeometry: update the geometry for a single mesh.
-	void SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags = 0 );
+	void SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
+	// SetIndexedGeometry: update the geometry for a single mesh, using shared vertices and an index buffer.
+	bool SetIndexedGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const uint *indexData, const int triangleCount,
+							 const CoreTri *triangles, const uint *alphaFlags = 0, const GeometryHint hint = DefaultGeometry );
 	// SetInstance: update the data on a single instance.
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4 &transform );
+	// SetInstanceVisibility: set the ray types that see the instance.
+	void SetInstanceVisibility( const int instanceIdx, const uint visibility );
 	// UpdateTopLevel: trigger a top-level BVH update.
 	void UpdateToplevel();
 };
@@ -30,38 +30,43 @@ CoreMesh::~CoreMesh()
 	Cleanup();
 }
 
-void CoreMesh::SetGeometry( const float4 *vertexData, const int vertexCount, const int triCount, const CoreTri *tris, const uint *alphaFlags )
+void CoreMesh::SetGeometry( const float4 *vertexData, const int vertexCount, const int triCount, const CoreTri *tris, const uint *alphaFlags,
+						   const GeometryHint hint, const uint *indexData )
 {
 	const bool sameTriCount = triangles && ( triangles->GetSize() / sizeof( CoreTri ) == triCount );
 
+	VulkanUploader *uploader = RenderCore::instance->uploader;
+	if ( triangles ) uploader->Retire( *triangles ); // Pending uploads would overwrite the copy below, or outlive the buffer
 	if ( !sameTriCount )
 	{
 		delete triangles;
 		triangles = new VulkanCoreBuffer<CoreTri>( m_Device, triCount, vk::MemoryPropertyFlagBits::eDeviceLocal,
 												   vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst );
+		uploader->Upload( *triangles, tris, triCount * sizeof( CoreTri ) );
 	}
+	else
+		triangles->CopyToDevice( tris, triCount * sizeof( CoreTri ) );
 
-	triangles->CopyToDevice( tris, triCount * sizeof( CoreTri ) );
+	// Select the acceleration structure type; without a hint, the first build is assumed to be static
+	AccelerationStructureType type = accelerationStructure ? FastTrace : FastestTrace;
+	if ( hint == StaticGeometry ) type = FastestTrace;
+	else if ( hint == DeformingGeometry ) type = FastTrace;
+	else if ( hint == DynamicGeometry ) type = FastestBuild;
 
-	if ( accelerationStructure != nullptr )
+	// Refit only if the topology is known to be unchanged; indices are not compared, so for indexed meshes we rely on the hint
+	const bool sameTopology = sameTriCount && accelerationStructure && accelerationStructure->GetVertexCount() == (uint32_t)vertexCount &&
+							  accelerationStructure->IsIndexed() == ( indexData != nullptr ) && ( indexData == nullptr || hint == DeformingGeometry );
+	if ( accelerationStructure != nullptr && accelerationStructure->GetType() == type && accelerationStructure->CanUpdate() && accelerationStructure->IsBuilt() && sameTopology )
 	{
-		if ( accelerationStructure->CanUpdate() && sameTriCount ) // Same data count, rebuild acceleration structure
-		{
-			accelerationStructure->UpdateVertices( vertexData, vertexCount );
-			accelerationStructure->Rebuild();
-		}
-		else
-		{
-			delete accelerationStructure;
-			accelerationStructure = nullptr;
-			accelerationStructure = new BottomLevelAS( m_Device, vertexData, vertexCount, FastTrace ); // Create new, update able acceleration structure
-			accelerationStructure->Build();
-		}
+		// Same data count, refit acceleration structure
+		accelerationStructure->UpdateVertices( vertexData, vertexCount );
+		accelerationStructure->Rebuild();
 	}
 	else
 	{
-		accelerationStructure = new BottomLevelAS( m_Device, vertexData, vertexCount, FastestTrace ); // Create initial acceleration structure
-		accelerationStructure->Build();
+		delete accelerationStructure;
+		// Built in a batch with the other new meshes in RenderCore::UpdateToplevel
+		accelerationStructure = new BottomLevelAS( m_Device, vertexData, vertexCount, type, indexData, indexData ? triCount * 3 : 0 );
 	}
 
 	assert( accelerationStructure );
@@ -70,6 +75,7 @@ void CoreMesh::SetGeometry( const float4 *vertexData, const int vertexCount, con
 void CoreMesh::Cleanup()
 {
 	if ( accelerationStructure ) delete accelerationStructure, accelerationStructure = nullptr;
+	if ( triangles && RenderCore::instance->uploader ) RenderCore::instance->uploader->Retire( *triangles );
 	if ( triangles ) delete triangles, triangles = nullptr;
 }
 
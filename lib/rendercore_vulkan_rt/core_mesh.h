@@ -30,7 +30,8 @@ class CoreMesh
 	~CoreMesh();
 
 	void Cleanup();
-	void SetGeometry( const float4 *vertexData, const int vertexCount, const int triCount, const CoreTri *tris, const uint *alphaFlags = 0 );
+	void SetGeometry( const float4 *vertexData, const int vertexCount, const int triCount, const CoreTri *tris, const uint *alphaFlags = 0,
+					  const GeometryHint hint = DefaultGeometry, const uint *indexData = nullptr );
 
 	VulkanCoreBuffer<CoreTri> *triangles = nullptr;
 	BottomLevelAS *accelerationStructure = nullptr;
@@ -175,9 +175,11 @@ static void _CheckVK( int line, const char *file, vk::Result x )
 #include "core_api.h"
 #include "core_api_base.h"
 
+#include "vulkan_memory_allocator.h"
 #include "vulkan_device.h"
 
 #include "vulkan_core_buffer.h"
+#include "vulkan_uploader.h"
 #include "vulkan_gl_texture_interop.h"
 
 #include "vulkan_core_buffer.h"
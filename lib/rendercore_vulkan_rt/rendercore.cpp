@@ -18,10 +18,15 @@
 namespace lh2core {
 
 constexpr std::array<const char *, 1> VALIDATION_LAYERS = { "VK_LAYER_LUNARG_standard_validation" };
-const std::vector<const char *> DEVICE_EXTENSIONS = { VK_NV_RAY_TRACING_EXTENSION_NAME };
+const std::vector<const char *> DEVICE_EXTENSIONS = { VK_NV_RAY_TRACING_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME };
 
 RenderCore *RenderCore::instance = nullptr;
 
+// Stages within a submission wait for the shader writes of the previous stage
+static const vk::MemoryBarrier STAGE_BARRIER( vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite );
+// The host reads the counters from mapped memory once a submission completed
+static const vk::MemoryBarrier COUNTER_BARRIER( vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead );
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::SetProbePos                                                    |
 //  |  Set the pixel for which the triid will be captured.                  LH2'19|
@@ -38,6 +43,7 @@ void RenderCore::InitRenderer()
 #ifndef NDEBUG
 	CreateDebugReportCallback();
 #endif
+	uploader = new VulkanUploader( m_Device );			  // Staging ring and transfer queue batches
 	CreateCommandBuffers();								  // Initialize blit buffers
 	m_TopLevelAS = new TopLevelAS( m_Device, FastTrace ); // Create a top level AS, Vulkan doesn't like unbound buffers
 	CreateDescriptorSets();								  // Create bindings for shaders
@@ -166,7 +172,22 @@ void RenderCore::CreateDevice()
 void RenderCore::CreateCommandBuffers()
 {
 	if (m_BlitCommandBuffer) m_Device.FreeCommandBuffer( m_BlitCommandBuffer );
+	if (m_PrimaryCommandBuffer) m_Device.FreeCommandBuffer( m_PrimaryCommandBuffer );
+	if (m_FinalizeCommandBuffer) m_Device.FreeCommandBuffer( m_FinalizeCommandBuffer );
+	if (m_ShadowCommandBuffer) m_Device.FreeCommandBuffer( m_ShadowCommandBuffer );
 	m_BlitCommandBuffer = m_Device.CreateCommandBuffer( vk::CommandBufferLevel::ePrimary );
+	m_PrimaryCommandBuffer = m_Device.CreateCommandBuffer( vk::CommandBufferLevel::ePrimary );
+	m_FinalizeCommandBuffer = m_Device.CreateCommandBuffer( vk::CommandBufferLevel::ePrimary );
+	m_ShadowCommandBuffer = m_Device.CreateCommandBuffer( vk::CommandBufferLevel::ePrimary );
+	if (!m_ShadowFence) m_ShadowFence = m_Device->createFence( vk::FenceCreateInfo() );
+
+	// Timestamp queries for the stage times in coreStats
+	const auto limits = m_Device.GetPhysicalDevice().getProperties().limits;
+	if (limits.timestampComputeAndGraphics && !m_TimestampPool)
+	{
+		m_TimestampPool = m_Device->createQueryPool( vk::QueryPoolCreateInfo( {}, vk::QueryType::eTimestamp, TS_COUNT ) );
+		m_TimestampPeriod = limits.timestampPeriod;
+	}
 }
 
 void RenderCore::CreateOffscreenBuffers()
@@ -190,9 +211,10 @@ void RenderCore::CreateOffscreenBuffers()
 void RenderCore::ResizeBuffers()
 {
 	const auto newPixelCount = uint32_t( (m_ScrWidth * m_ScrHeight) * 1.3f ); // Make buffer bigger than needed to prevent reallocating often
+	const auto newPathCount = uint32_t( (m_ScrWidth * m_ScrHeight * m_SamplesPP) * 1.3f ); // All samples of a frame are traced in one pass
 	const auto oldPixelCount = m_AccumulationBuffer->GetSize() / sizeof( float4 );
 
-	if (oldPixelCount >= newPixelCount) return; // No need to resize buffers
+	if (oldPixelCount >= newPixelCount && m_PathCapacity >= m_ScrWidth * m_ScrHeight * m_SamplesPP) return; // No need to resize buffers
 
 	delete m_CombinedStateBuffer[0];
 	delete m_CombinedStateBuffer[1];
@@ -200,17 +222,17 @@ void RenderCore::ResizeBuffers()
 	delete m_PotentialContributionBuffer;
 
 	const auto limits = m_Device.GetPhysicalDevice().getProperties().limits;
+	const vk::DeviceSize singleSize = NEXTMULTIPLEOF( newPathCount * sizeof( float4 ), 4 * limits.minUniformBufferOffsetAlignment );
+	m_PathCapacity = newPathCount;
 
 	// Create 2 path trace state buffers, these buffers are ping-ponged every path iteration
-	m_CombinedStateBuffer[0] = new VulkanCoreBuffer<float4>( m_Device, NEXTMULTIPLEOF( m_ScrWidth * m_ScrHeight * 4, limits.minUniformBufferOffsetAlignment ), vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer );
-	m_CombinedStateBuffer[1] = new VulkanCoreBuffer<float4>( m_Device, NEXTMULTIPLEOF( m_ScrWidth * m_ScrHeight * 4, limits.minUniformBufferOffsetAlignment ), vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer );
+	m_CombinedStateBuffer[0] = new VulkanCoreBuffer<float4>( m_Device, 4 * singleSize / sizeof( float4 ), vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer );
+	m_CombinedStateBuffer[1] = new VulkanCoreBuffer<float4>( m_Device, 4 * singleSize / sizeof( float4 ), vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer );
 
 	// Accumulation buffer for rendered image
 	m_AccumulationBuffer = new VulkanCoreBuffer<float4>( m_Device, newPixelCount, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst );
 	// Shadow ray buffer
-	m_PotentialContributionBuffer = new VulkanCoreBuffer<PotentialContribution>( m_Device, MAXPATHLENGTH * newPixelCount, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer );
-
-	const vk::DeviceSize singleSize = NEXTMULTIPLEOF( m_ScrWidth * m_ScrHeight * sizeof( float4 ), 4 * limits.minUniformBufferOffsetAlignment );
+	m_PotentialContributionBuffer = new VulkanCoreBuffer<PotentialContribution>( m_Device, MAXPATHLENGTH * newPathCount, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer );
 
 	// Buffers got recreated so we need to update our descriptor sets
 	rtDescriptorSet->Bind( rtPATH_STATES, { m_CombinedStateBuffer[0]->GetDescriptorBufferInfo( 0, singleSize ), m_CombinedStateBuffer[1]->GetDescriptorBufferInfo( 0, singleSize ) } );
@@ -307,6 +329,10 @@ void RenderCore::CreateDescriptorSets()
 	shadeDescriptorSet->AddBinding( cSPOTLIGHT_BUFFER, 1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute );
 	shadeDescriptorSet->AddBinding( cDIRECTIONALLIGHT_BUFFER, 1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute );
 	shadeDescriptorSet->AddBinding( cBLUENOISE, 1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute );
+#ifdef BINDLESS_TEXTURES
+	assert( limits.maxPerStageDescriptorSampledImages >= MAX_TEXTURES ); // Make sure the texture array fits
+	shadeDescriptorSet->AddBinding( cTEXTURES, MAX_TEXTURES, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, nullptr, vk::DescriptorBindingFlagBitsEXT::ePartiallyBound );
+#endif
 	shadeDescriptorSet->Finalize();
 
 	// Describe finalize descriptor set
@@ -355,22 +381,64 @@ void RenderCore::RecordCommandBuffers()
 		m_InteropTexture->GetImage(), vk::ImageLayout::eTransferDstOptimal, 1, &copyRegion );
 	m_InteropTexture->RecordTransitionToGL( m_BlitCommandBuffer ); // Make image usable by GL again
 	m_BlitCommandBuffer.end();
+
+	// Primary ray stage; its size only depends on the target size and spp
+	const uint pathCount = m_ScrWidth * m_ScrHeight * m_SamplesPP;
+	uint32_t pushConstant[3] = { 1, pathCount, STAGE_PRIMARY_RAY };
+	const vk::MemoryBarrier clearBarrier( vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite );
+	m_PrimaryCommandBuffer.begin( beginInfo );
+	if (m_TimestampPool) m_PrimaryCommandBuffer.resetQueryPool( m_TimestampPool, 0, TS_COUNT );
+	m_PrimaryCommandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eRayTracingShaderNV | vk::PipelineStageFlagBits::eComputeShader,
+		{}, clearBarrier, {}, {} ); // Make sure the accumulator clear of a restarted frame, and the finalize stage of the previous frame, finished
+	RecordTimestamp( m_PrimaryCommandBuffer, TS_PRIMARY_START );
+	rtPipeline->RecordPushConstant( m_PrimaryCommandBuffer, 0, 3 * sizeof( uint32_t ), pushConstant ); // Push intersection stage to shader
+	rtPipeline->RecordTraceCommand( m_PrimaryCommandBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
+	RecordTimestamp( m_PrimaryCommandBuffer, TS_PRIMARY_TRACED );
+	// Shade primary rays in the same submission; the barrier replaces a host wait
+	m_PrimaryCommandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eRayTracingShaderNV, vk::PipelineStageFlagBits::eComputeShader, {}, STAGE_BARRIER, {}, {} );
+	shadePipeline->RecordPushConstant( m_PrimaryCommandBuffer, 0, 2 * sizeof( uint32_t ), pushConstant );
+	shadePipeline->RecordDispatchCommand( m_PrimaryCommandBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
+	RecordTimestamp( m_PrimaryCommandBuffer, TS_PRIMARY_SHADED );
+	// Make the counters written by the shade stage visible to the host, which reads them from mapped memory
+	m_PrimaryCommandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, COUNTER_BARRIER, {}, {} );
+	m_PrimaryCommandBuffer.end();
+
+	// Finalize stage
+	m_FinalizeCommandBuffer.begin( beginInfo );
+	// Make sure off-screen render image is ready to be used
+	const auto finalizeBarrier = vk::ImageMemoryBarrier( vk::AccessFlags(), vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_OffscreenImage->GetImage(), subresourceRange );
+	m_FinalizeCommandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &finalizeBarrier );
+	finalizePipeline->RecordDispatchCommand( m_FinalizeCommandBuffer, m_ScrWidth, m_ScrHeight );
+	m_FinalizeCommandBuffer.end();
+}
+
+void RenderCore::RecordTimestamp( vk::CommandBuffer &cmdBuffer, const uint query )
+{
+	if (m_TimestampPool) cmdBuffer.writeTimestamp( vk::PipelineStageFlagBits::eBottomOfPipe, m_TimestampPool, query );
+}
+
+float RenderCore::StageTime( const uint startQuery, const uint endQuery )
+{
+	uint64_t timestamps[2];
+	if (m_Device->getQueryPoolResults( m_TimestampPool, startQuery, 1, sizeof( uint64_t ), &timestamps[0], sizeof( uint64_t ), vk::QueryResultFlagBits::e64 ) != vk::Result::eSuccess) return 0;
+	if (m_Device->getQueryPoolResults( m_TimestampPool, endQuery, 1, sizeof( uint64_t ), &timestamps[1], sizeof( uint64_t ), vk::QueryResultFlagBits::e64 ) != vk::Result::eSuccess) return 0;
+	return float( timestamps[1] - timestamps[0] ) * m_TimestampPeriod * 1e-9f; // Timestamp ticks to seconds
 }
 
 void RenderCore::CreateBuffers()
 {
 	const auto pixelCount = static_cast<vk::DeviceSize>(m_ScrWidth * m_ScrHeight);
-	m_CounterTransferBuffer = new VulkanCoreBuffer<Counters>( m_Device, 1, vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached | vk::MemoryPropertyFlagBits::eHostVisible,
-		vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst );
 	m_InvTransformsBuffer = new VulkanCoreBuffer<mat4>( m_Device, 1, vk::MemoryPropertyFlagBits::eDeviceLocal,
 		vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
 		ON_DEVICE | ON_HOST );
 
 	m_UniformCamera = new UniformCamera( m_Device );
 	m_UniformFinalizeParams = new UniformFinalizeParams( m_Device );
-	m_Counters = new VulkanCoreBuffer<Counters>( m_Device, 1, vk::MemoryPropertyFlagBits::eDeviceLocal,
-		vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
-		ON_DEVICE | ON_HOST );
+	// Counters are written by the shaders and read and reset by the host between stages; they stay mapped,
+	// in device local memory if the device has a host visible type of it, so the shader atomics stay local
+	m_Counters = new VulkanCoreBuffer<Counters>( m_Device, 1, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		vk::BufferUsageFlagBits::eStorageBuffer, ON_DEVICE, vk::MemoryPropertyFlagBits::eDeviceLocal );
 
 	// Bind uniforms
 	rtDescriptorSet->Bind( rtCAMERA, { m_UniformCamera->GetDescriptorBufferInfo() } );
@@ -420,7 +488,7 @@ void RenderCore::InitializeDescriptorSets()
 	rtDescriptorSet->Bind( rtACCELERATION_STRUCTURE, { m_TopLevelAS->GetDescriptorBufferInfo() } );
 	rtDescriptorSet->Bind( rtCAMERA, { m_UniformCamera->GetDescriptorBufferInfo() } );
 	const auto limits = m_Device.GetPhysicalDevice().getProperties().limits;
-	const vk::DeviceSize singleSize = NEXTMULTIPLEOF( m_ScrWidth * m_ScrHeight * sizeof( float4 ), limits.minUniformBufferOffsetAlignment );
+	const vk::DeviceSize singleSize = NEXTMULTIPLEOF( m_PathCapacity * sizeof( float4 ), 4 * limits.minUniformBufferOffsetAlignment ); // Same layout as in ResizeBuffers
 	rtDescriptorSet->Bind( rtPATH_STATES, { m_CombinedStateBuffer[0]->GetDescriptorBufferInfo( 0, singleSize ), m_CombinedStateBuffer[1]->GetDescriptorBufferInfo( 0, singleSize ) } );
 	rtDescriptorSet->Bind( rtPATH_ORIGINS, { m_CombinedStateBuffer[0]->GetDescriptorBufferInfo( singleSize, singleSize ), m_CombinedStateBuffer[1]->GetDescriptorBufferInfo( singleSize, singleSize ) } );
 	rtDescriptorSet->Bind( rtPATH_DIRECTIONS, { m_CombinedStateBuffer[0]->GetDescriptorBufferInfo( 2 * singleSize, singleSize ), m_CombinedStateBuffer[1]->GetDescriptorBufferInfo( 2 * singleSize, singleSize ) } );
@@ -482,7 +550,9 @@ void RenderCore::Init()
 
 	m_Initialized = false;
 	RenderCore::instance = this;
+	Timer timer;
 	CreateInstance();
+	printf( "vulkan startup: instance %.1fms\n", timer.elapsed() * 1000 );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -496,13 +566,18 @@ void RenderCore::SetTarget( GLTexture *target, const uint spp )
 
 	m_SamplesPP = spp;
 	m_SamplesTaken = 0;
+	m_First = true; // Re-record command buffers for the new size
 	m_ScrWidth = target->width;
 	m_ScrHeight = target->height;
 
 	if (!m_Initialized)
 	{
+		// shaders are compiled here; unchanged shaders are read from their .spvcache files
+		Timer timer;
 		CreateDevice();
+		const float deviceTime = timer.elapsed();
 		InitRenderer();
+		printf( "vulkan startup: device %.1fms, pipelines %.1fms\n", deviceTime * 1000, (timer.elapsed() - deviceTime) * 1000 );
 		m_Initialized = true;
 	}
 
@@ -535,7 +610,8 @@ void RenderCore::SetTarget( GLTexture *target, const uint spp )
 //  |  RenderCore::SetGeometry                                                    |
 //  |  Set the geometry data for a model.                                   LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderCore::SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags )
+void RenderCore::SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags,
+							  const GeometryHint hint, const uint *indexData )
 {
 	if (meshIdx >= m_Meshes.size())
 	{
@@ -543,7 +619,7 @@ void RenderCore::SetGeometry( const int meshIdx, const float4 *vertexData, const
 		m_MeshChanged.push_back( false );
 	}
 
-	m_Meshes[meshIdx]->SetGeometry( vertexData, vertexCount, triangleCount, triangles, alphaFlags );
+	m_Meshes[meshIdx]->SetGeometry( vertexData, vertexCount, triangleCount, triangles, alphaFlags, hint, indexData );
 	m_MeshChanged[meshIdx] = true;
 }
 
@@ -581,7 +657,7 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 	auto &curInstance = m_Instances.at( instanceIdx );
 
 	curInstance.instanceId = instanceIdx;
-	curInstance.mask = 0xFF;
+	curInstance.mask = VISIBLE_ALL; // see SetInstanceVisibility
 	curInstance.instanceOffset = 0;
 	curInstance.flags = (uint32_t)vk::GeometryInstanceFlagBitsNV::eTriangleCullDisable;
 
@@ -596,6 +672,22 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 
 	// Update acceleration structure handle
 	curInstance.accelerationStructureHandle = m_Meshes.at( meshIdx )->accelerationStructure->GetHandle();
+
+	// Write straight into the mapped top level instance buffer; instances beyond its capacity are copied when it is recreated
+	if (instanceIdx < m_TopLevelAS->GetInstanceCount()) m_TopLevelAS->SetInstance( instanceIdx, curInstance );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetInstanceVisibility                                          |
+//  |  Use VISIBLE_* flags as the instance mask; shaders pass the flag of the     |
+//  |  ray type they trace as the cull mask of traceNV.                     LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetInstanceVisibility( const int instanceIdx, const uint visibility )
+{
+	if (instanceIdx >= m_Instances.size()) return;
+	auto &curInstance = m_Instances.at( instanceIdx );
+	curInstance.mask = visibility & 0xFF;
+	if (instanceIdx < m_TopLevelAS->GetInstanceCount()) m_TopLevelAS->SetInstance( instanceIdx, curInstance );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -605,6 +697,12 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 //  +-----------------------------------------------------------------------------+
 void RenderCore::UpdateToplevel()
 {
+	// Build new bottom level structures in one batch; compaction changes their handles, so this precedes the handle updates
+	std::vector<BottomLevelAS *> newStructures;
+	for (uint i = 0; i < m_Meshes.size(); i++)
+		if (m_MeshChanged.at( i ) && m_Meshes[i]->accelerationStructure && !m_Meshes[i]->accelerationStructure->IsBuilt()) newStructures.push_back( m_Meshes[i]->accelerationStructure );
+	BottomLevelAS::BuildBatch( m_Device, newStructures );
+
 	for (uint i = 0; i < m_Instances.size(); i++)
 	{
 		// Meshes might have changed in the mean time
@@ -616,6 +714,7 @@ void RenderCore::UpdateToplevel()
 		// Update acceleration structure handle
 		instance.accelerationStructureHandle = mesh->accelerationStructure->GetHandle();
 		assert( instance.accelerationStructureHandle );
+		if (i < m_TopLevelAS->GetInstanceCount()) m_TopLevelAS->SetInstance( i, instance );
 	}
 
 	bool triangleBuffersDirty = false;					   // Initially we presume triangle buffers are up to date
@@ -650,30 +749,22 @@ void RenderCore::UpdateToplevel()
 	if (m_TopLevelAS->GetInstanceCount() < m_Instances.size()) // Recreate top level AS in case our number of instances changed
 	{
 		delete m_TopLevelAS;
-		m_TopLevelAS = new TopLevelAS( m_Device, FastestTrace, (uint32_t)m_Instances.size() );
-		m_TopLevelAS->UpdateInstances( m_Instances );
-		m_TopLevelAS->Build();
-
-		rtDescriptorSet->Bind( rtACCELERATION_STRUCTURE, { m_TopLevelAS->GetDescriptorBufferInfo() } );
-	}
-	else if (!m_TopLevelAS->CanUpdate()) // Recreate top level AS in case it cannot be updated
-	{
-		delete m_TopLevelAS;
-		m_TopLevelAS = new TopLevelAS( m_Device, FastTrace, (uint32_t)m_Instances.size() );
+		m_TopLevelAS = new TopLevelAS( m_Device, FastTrace, NEXTMULTIPLEOF( (uint32_t)m_Instances.size(), 32 ) );
 		m_TopLevelAS->UpdateInstances( m_Instances );
 		m_TopLevelAS->Build();
 
-		// Update descriptor set
 		rtDescriptorSet->Bind( rtACCELERATION_STRUCTURE, { m_TopLevelAS->GetDescriptorBufferInfo() } );
 	}
-	else // Rebuild (refit) our top level AS
+	else if (m_TopLevelAS->CanRefit()) // Only transforms changed: refit our top level AS
 	{
-		m_TopLevelAS->UpdateInstances( m_Instances );
-		assert( m_TopLevelAS->CanUpdate() );
 		m_TopLevelAS->Rebuild();
 
 		// No descriptor write needed, same acceleration structure object
 	}
+	else // Instances were added or their bottom level AS changed: full build in place
+	{
+		m_TopLevelAS->Build();
+	}
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -684,6 +775,10 @@ void RenderCore::SetTextures( const CoreTexDesc *tex, const int textures )
 {
 	// Store descriptors, we need them later to assign texture indices to materials
 	m_TexDescs = std::vector<CoreTexDesc>( tex, tex + textures );
+#ifdef BINDLESS_TEXTURES
+	SetTextureImages();
+	return;
+#endif
 
 	// Get buffers
 	std::vector<uint> ARGB32Data;
@@ -742,9 +837,10 @@ void RenderCore::SetTextures( const CoreTexDesc *tex, const int textures )
 		}
 	}
 
-	delete m_ARGB32Buffer;
-	delete m_ARGB128Buffer;
-	delete m_NRM32Buffer;
+	// Uploads into the old buffers may still be in flight
+	if (m_ARGB32Buffer) uploader->Retire( *m_ARGB32Buffer ), delete m_ARGB32Buffer;
+	if (m_ARGB128Buffer) uploader->Retire( *m_ARGB128Buffer ), delete m_ARGB128Buffer;
+	if (m_NRM32Buffer) uploader->Retire( *m_NRM32Buffer ), delete m_NRM32Buffer;
 
 	const auto ARGB32Size = std::max( ARGB32Data.size(), size_t( 1 ) );
 	const auto ARGB128Size = std::max( ARGB128Data.size(), size_t( 1 ) );
@@ -755,15 +851,67 @@ void RenderCore::SetTextures( const CoreTexDesc *tex, const int textures )
 	m_ARGB128Buffer = new VulkanCoreBuffer<float4>( m_Device, ARGB128Size, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst );
 	m_NRM32Buffer = new VulkanCoreBuffer<uint>( m_Device, NRM32Size, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst );
 
-	if (!ARGB32Data.empty()) m_ARGB32Buffer->CopyToDevice( ARGB32Data.data(), m_ARGB32Buffer->GetSize() );
-	if (!ARGB128Data.empty()) m_ARGB128Buffer->CopyToDevice( ARGB128Data.data(), m_ARGB128Buffer->GetSize() );
-	if (!NRM32Data.empty()) m_NRM32Buffer->CopyToDevice( NRM32Data.data(), m_NRM32Buffer->GetSize() );
+	// The new buffers are not in use yet; the copies overlap with the host work until the next frame
+	if (!ARGB32Data.empty()) uploader->Upload( *m_ARGB32Buffer, ARGB32Data.data(), m_ARGB32Buffer->GetSize() );
+	if (!ARGB128Data.empty()) uploader->Upload( *m_ARGB128Buffer, ARGB128Data.data(), m_ARGB128Buffer->GetSize() );
+	if (!NRM32Data.empty()) uploader->Upload( *m_NRM32Buffer, NRM32Data.data(), m_NRM32Buffer->GetSize() );
+	uploader->Flush();
 
 	shadeDescriptorSet->Bind( cTEXTURE_ARGB32, { m_ARGB32Buffer->GetDescriptorBufferInfo() } );
 	shadeDescriptorSet->Bind( cTEXTURE_ARGB128, { m_ARGB128Buffer->GetDescriptorBufferInfo() } );
 	shadeDescriptorSet->Bind( cTEXTURE_NRM32, { m_NRM32Buffer->GetDescriptorBufferInfo() } );
 }
 
+#ifdef BINDLESS_TEXTURES
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTextureImages                                               |
+//  |  Upload each texture to its own image, including its MIP levels, and bind   |
+//  |  the images to the texture array. Textures that did not change since the    |
+//  |  previous call keep their image; updates only send what changed.      LH2'19|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTextureImages()
+{
+	const uint textureCount = (uint)m_TexDescs.size();
+	if (textureCount > MAX_TEXTURES) FATALERROR( "Too many textures for the texture array." );
+	for (uint i = textureCount; i < m_TextureImages.size(); i++) delete m_TextureImages[i];
+	m_TextureImages.resize( textureCount, nullptr );
+
+	// Anisotropic filtering, if the device supports it
+	const auto physicalDevice = m_Device.GetPhysicalDevice();
+	const float maxAnisotropy = physicalDevice.getFeatures().samplerAnisotropy ? std::min( 8.0f, physicalDevice.getProperties().limits.maxSamplerAnisotropy ) : 1.0f;
+
+	std::vector<vk::DescriptorImageInfo> imageInfos( textureCount );
+	for (uint i = 0; i < textureCount; i++)
+	{
+		CoreTexDesc &tex = m_TexDescs[i];
+		tex.firstPixel = i; // The materials reference the texture by its index in the array
+		VulkanImage *&image = m_TextureImages[i];
+		const bool sameSize = image && image->GetExtent().width == tex.width && image->GetExtent().height == tex.height;
+		if (!sameSize || tex.changed)
+		{
+			// NRM32 texels are stored as four bytes as well; the shader decodes the normal
+			const bool hdr = tex.storage == TexelStorage::ARGB128;
+			const vk::Format format = hdr ? vk::Format::eR32G32B32A32Sfloat : vk::Format::eR8G8B8A8Unorm;
+			// HostTexture stops storing levels once a side reaches zero texels
+			uint levels = 1;
+			while (levels < tex.MIPlevels && (tex.width >> levels) > 0 && (tex.height >> levels) > 0) levels++;
+			delete image;
+			image = new VulkanImage( m_Device, vk::ImageType::e2D, format, vk::Extent3D( tex.width, tex.height, 1 ), vk::ImageTiling::eOptimal,
+				vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, levels );
+			image->SetData( tex.idata, tex.width, tex.height, hdr ? sizeof( float4 ) : sizeof( uint ) );
+			image->CreateImageView( vk::ImageViewType::e2D, format, vk::ImageSubresourceRange( vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1 ) );
+			image->CreateSampler( vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear, vk::SamplerAddressMode::eRepeat, maxAnisotropy );
+			image->TransitionToLayout( vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlags() );
+		}
+		imageInfos[i] = image->GetDescriptorImageInfo();
+	}
+
+	// The array is partially bound; a scene without textures binds the skybox, which is never indexed
+	if (imageInfos.empty()) imageInfos.push_back( m_SkyboxImage->GetDescriptorImageInfo() );
+	shadeDescriptorSet->Bind( cTEXTURES, imageInfos );
+}
+#endif
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore::SetMaterials                                                   |
 //  |  Set the material data.                                               LH2'19|
@@ -895,8 +1043,7 @@ void RenderCore::SetSkyData( const float3 *pixels, const uint width, const uint
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Setting( const char *name, const float value )
 {
-	// we have no settings yet
-	// TODO
+	if (!strcmp( name, "dumpmemory" )) m_Device.GetAllocator().DumpPools(); // print occupancy of the device memory pools
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -905,9 +1052,10 @@ void RenderCore::Setting( const char *name, const float value )
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Render( const ViewPyramid &view, const Convergence converge, const float brightness, const float contrast )
 {
-	VulkanCamera &camera = m_UniformCamera->GetData()[0];
-	Counters &c = m_Counters->GetHostBuffer()[0];
+	VulkanCamera &camera = m_UniformCamera->GetData()[0]; // Mapped; the previous frame finished all stages that read it
+	Counters c;
 
+	uploader->Flush(); // Frame commands must be submitted after the acquire of pending uploads
 	auto queue = m_Device.GetGraphicsQueue();
 	if (converge == Restart || m_FirstConvergingFrame)
 	{
@@ -929,7 +1077,7 @@ void RenderCore::Render( const ViewPyramid &view, const Convergence converge, co
 	// Get queue and command buffer for this frame
 	OneTimeCommandBuffer cmdBuffer = m_Device.CreateOneTimeCmdBuffer();
 
-	uint pathCount = m_ScrWidth * m_ScrHeight * 1;
+	uint pathCount = m_ScrWidth * m_ScrHeight * m_SamplesPP;
 	uint32_t pushConstant[3];
 
 	// Reset stats
@@ -946,173 +1094,160 @@ void RenderCore::Render( const ViewPyramid &view, const Convergence converge, co
 	coreStats.shadowTraceTime = 0.0f;
 	coreStats.renderTime = 0.0f;
 
-	Timer t, frameTime{};
+	Timer frameTime{};
+	uint lastBounce = 1;
+	bool shadowRaysTraced = false;
 
-	for (uint i = 0; i < m_SamplesPP; i++)
-	{
-		// Initialize out camera
-		camera = VulkanCamera( view, m_SamplesTaken, STAGE_PRIMARY_RAY ); // Reset camera
-		camera.scrwidth = m_ScrWidth;
-		camera.scrheight = m_ScrHeight;
-		m_UniformCamera->CopyToDevice();
-
-		// Initialize counters
-		c.Reset( m_LightCounts, m_ScrWidth, m_ScrHeight, 10.0f, 1e-4f );
-		c.probePixelIdx = m_ProbePos.x + m_ProbePos.y * m_ScrWidth;
-		m_Counters->CopyToDevice();
-
-		if (i != 0) cmdBuffer.Begin();
-		// Primary ray stage
-		if (m_SamplesTaken <= 1) cmdBuffer->fillBuffer( *m_AccumulationBuffer, 0, m_ScrWidth * m_ScrHeight * sizeof( float4 ), 0 );
-		pushConstant[0] = c.pathLength;
-		pushConstant[1] = pathCount;
-		pushConstant[2] = STAGE_PRIMARY_RAY;
-		rtPipeline->RecordPushConstant( cmdBuffer, 0, 3 * sizeof( uint32_t ), pushConstant ); // Push intersection stage to shader
-		rtPipeline->RecordTraceCommand( cmdBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
+	// Initialize out camera; all samples of the frame are traced in one pass, path i belongs to sample i / (width * height)
+	camera = VulkanCamera( view, m_SamplesTaken, STAGE_PRIMARY_RAY ); // Reset camera
+	camera.scrwidth = m_ScrWidth;
+	camera.scrheight = m_ScrHeight;
 
-		// Submit primary rays to queue
-		t.reset();
-		cmdBuffer.Submit( queue, true );
-		queue.waitIdle();
-		coreStats.traceTime0 += t.elapsed();
-		coreStats.primaryRayCount += pathCount;
-
-		// Record shade stage
-		cmdBuffer.Begin();
-		shadePipeline->RecordPushConstant( cmdBuffer, 0, 2 * sizeof( uint32_t ), pushConstant );
-		shadePipeline->RecordDispatchCommand( cmdBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
-		// Make sure shading finished before copying counters
-		cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {} );
-		RecordCopyCommand( m_CounterTransferBuffer, m_Counters, cmdBuffer );
-
-		// Submit command buffer
+	// Initialize counters
+	c.Reset( m_LightCounts, m_ScrWidth, m_ScrHeight, 10.0f, 1e-4f );
+	c.pathCount = pathCount;
+	c.probePixelIdx = m_ProbePos.x + m_ProbePos.y * m_ScrWidth;
+	Counters *counters = m_Counters->Map(); // Host writes to coherent memory are visible to the next submission
+	*counters = c;
+
+	// Clear the accumulator for a new frame; the primary ray command buffer waits for this
+	if (m_SamplesTaken == 0)
+	{
+		cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {} ); // The finalize stage of the previous frame may still read it
+		cmdBuffer->fillBuffer( *m_AccumulationBuffer, 0, m_ScrWidth * m_ScrHeight * sizeof( float4 ), 0 );
 		cmdBuffer.Submit( queue, true );
-		t.reset();
-		queue.waitIdle();
-		coreStats.shadeTime += t.elapsed();
+	}
+	else cmdBuffer.End();
 
-		// Prepare extension rays
-		auto *counters = m_CounterTransferBuffer->Map(); // Get Counters
-		pathCount = counters->extensionRays;			 // Get number of extension rays generated
-		c.extensionRays = 0;							 // Reset extension counter
-		c.pathLength++;									 // Increment path length
-		c.shadowRays = counters->shadowRays;			 // Make sure we keep count of the number of shadow rays
+	// Primary ray stage: trace, shade and copy counters, pre-recorded in RecordCommandBuffers
+	m_Device.SubmitCommandBuffer( m_PrimaryCommandBuffer, queue );
+	queue.waitIdle();
+	coreStats.primaryRayCount += pathCount;
 
-		coreStats.probedDist = c.probedDist;
-		coreStats.probedInstid = c.probedInstid;
-		coreStats.probedTriid = c.probedTriid;
+	// Prepare extension rays
+	pathCount = counters->extensionRays; // Get number of extension rays generated
+	c.extensionRays = 0;							 // Reset extension counter
+	c.pathLength++;									 // Increment path length
+	c.shadowRays = counters->shadowRays;			 // Make sure we keep count of the number of shadow rays
 
-		memcpy( counters, &c, sizeof( Counters ) ); // Reset counters
-		m_CounterTransferBuffer->Unmap();			// Unmap buffer so that it can be copied from again
-		coreStats.totalExtensionRays += pathCount;  // Update stats
-		coreStats.bounce1RayCount += pathCount;
+	coreStats.probedDist = c.probedDist;
+	coreStats.probedInstid = c.probedInstid;
+	coreStats.probedTriid = c.probedTriid;
 
-		for (uint i = 2; i <= MAXPATHLENGTH; i++)
-		{
-			if (pathCount > 0)
-			{
-				// Extension ray stage
-				cmdBuffer.Begin();
-				RecordCopyCommand( m_Counters, m_CounterTransferBuffer, cmdBuffer );
-				//m_Counters->GetBuffer()->RecordCopyToDeviceCommand( m_CounterTransferBuffer, sizeof( Counters ), cmdBuffer ); // Copy counters
-				pushConstant[0] = c.pathLength;
-				pushConstant[1] = pathCount;
-				pushConstant[2] = STAGE_SECONDARY_RAY;
-				rtPipeline->RecordPushConstant( cmdBuffer, 0, 3 * sizeof( uint32_t ), pushConstant ); // Push intersection stage to shader
-				cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eRayTracingShaderNV,
-					{}, {}, {}, {} ); // Make sure counters update transfer finished
-				rtPipeline->RecordTraceCommand( cmdBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
-
-				t.reset();
-				cmdBuffer.Submit( queue, true );		   // Run command buffer
-				coreStats.totalExtensionRays += pathCount; // Update stats
-
-				if (i == 2)
-				{
-					coreStats.bounce1RayCount = pathCount;
-					coreStats.traceTime1 += t.elapsed();
-				}
-				else
-				{
-					coreStats.deepRayCount += pathCount;
-					coreStats.traceTimeX += t.elapsed();
-				}
-
-				cmdBuffer.Begin();
-				// Shade extension rays
-				shadePipeline->RecordPushConstant( cmdBuffer, 0, 2 * sizeof( uint32_t ), pushConstant );
-				shadePipeline->RecordDispatchCommand( cmdBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
-				cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {} ); // Make sure shade stage finished
-				// Copy counters to host
-				RecordCopyCommand( m_CounterTransferBuffer, m_Counters, cmdBuffer );
-
-				// Submit command buffer
-				t.reset();
-				cmdBuffer.Submit( queue, true ); // Run command buffer
-				coreStats.shadeTime += t.elapsed();
-
-				counters = (Counters *)m_CounterTransferBuffer->Map(); // Get Counters
-				pathCount = counters->extensionRays;				   // Get number of extension rays generated
-				c.pathCount = pathCount;
-				c.extensionRays = 0;						// Reset extension counter
-				c.pathLength++;								// Increment path length
-				c.shadowRays = counters->shadowRays;		// Make sure we keep count of the number of shadow rays
-				memcpy( counters, &c, sizeof( Counters ) ); // Reset counters
-				m_CounterTransferBuffer->Unmap();			// Unmap buffer so that it can be copied from again
-				coreStats.totalExtensionRays += pathCount;  // Update stats
-			}
-			else
-			{
-				break; // All paths were terminated
-			}
-		}
+	*counters = c;								// Reset counters
+	coreStats.totalExtensionRays += pathCount; // Update stats
+	coreStats.bounce1RayCount += pathCount;
 
-		// Prepare shadow rays
-		counters = (Counters *)m_CounterTransferBuffer->Map(); // Get Counters
-		pathCount = counters->shadowRays;					   // Get number of shadow rays generated
-		m_CounterTransferBuffer->Unmap();					   // Unmap buffer so that it can be copied from again
+	for (uint i = 2; i <= MAXPATHLENGTH; i++)
+	{
 		if (pathCount > 0)
 		{
+			// Extension ray stage
+			const uint query = TS_BOUNCE + 3 * (i - 2);
 			cmdBuffer.Begin();
+			RecordTimestamp( cmdBuffer, query );
 			pushConstant[0] = c.pathLength;
 			pushConstant[1] = pathCount;
-			pushConstant[2] = STAGE_SHADOW_RAY;
+			pushConstant[2] = STAGE_SECONDARY_RAY;
 			rtPipeline->RecordPushConstant( cmdBuffer, 0, 3 * sizeof( uint32_t ), pushConstant ); // Push intersection stage to shader
 			rtPipeline->RecordTraceCommand( cmdBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
-
-			// Submit shadow rays
-			t.reset();
-			cmdBuffer.Submit( queue, true ); // Run command buffer
-			coreStats.shadowTraceTime += t.elapsed();
-			coreStats.totalShadowRays += pathCount;
+			RecordTimestamp( cmdBuffer, query + 1 );
+
+			// Shade extension rays in the same submission
+			cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eRayTracingShaderNV, vk::PipelineStageFlagBits::eComputeShader, {}, STAGE_BARRIER, {}, {} );
+			shadePipeline->RecordPushConstant( cmdBuffer, 0, 2 * sizeof( uint32_t ), pushConstant );
+			shadePipeline->RecordDispatchCommand( cmdBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
+			RecordTimestamp( cmdBuffer, query + 2 );
+			cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, COUNTER_BARRIER, {}, {} ); // Counters to host
+
+			// Submit trace and shade; one host wait per bounce, to read the extension ray count
+			cmdBuffer.Submit( queue, true );		   // Run command buffer
+			coreStats.totalExtensionRays += pathCount; // Update stats
+			if (i == 2) coreStats.bounce1RayCount = pathCount;
+			else coreStats.deepRayCount += pathCount;
+			lastBounce = i;
+
+			pathCount = counters->extensionRays;		// Get number of extension rays generated
+			c.pathCount = pathCount;
+			c.extensionRays = 0;						// Reset extension counter
+			c.pathLength++;								// Increment path length
+			c.shadowRays = counters->shadowRays;		// Make sure we keep count of the number of shadow rays
+			*counters = c;								// Reset counters
+			coreStats.totalExtensionRays += pathCount;  // Update stats
+		}
+		else
+		{
+			break; // All paths were terminated
 		}
-
-		m_SamplesTaken++;
 	}
 
+	m_SamplesTaken += m_SamplesPP;
+
 	// Initialize params for finalize stage
 	VulkanFinalizeParams &params = m_UniformFinalizeParams->GetData()[0];
-	params = VulkanFinalizeParams( m_ScrWidth, m_ScrHeight, m_SamplesTaken, brightness, contrast );
-	m_UniformFinalizeParams->CopyToDevice();
+	params = VulkanFinalizeParams( m_ScrWidth, m_ScrHeight, m_SamplesTaken, brightness, contrast ); // Mapped; the queue idled after the primary rays
+
+	// Shadow rays and finalize back to back; the shadow ray count is known from the last counter readback, and
+	// the finalize shader waits for the shadow ray contributions through a barrier instead of a host wait.
+	// The shadow command buffer is re-recorded each frame; the queue is idle after the bounces of the next one.
+	pathCount = c.shadowRays;
+	m_ShadowCommandBuffer.reset( {} );
+	m_ShadowCommandBuffer.begin( vk::CommandBufferBeginInfo( vk::CommandBufferUsageFlagBits::eOneTimeSubmit ) );
+	if (pathCount > 0)
+	{
+		RecordTimestamp( m_ShadowCommandBuffer, TS_SHADOW_START );
+		pushConstant[0] = c.pathLength;
+		pushConstant[1] = pathCount;
+		pushConstant[2] = STAGE_SHADOW_RAY;
+		rtPipeline->RecordPushConstant( m_ShadowCommandBuffer, 0, 3 * sizeof( uint32_t ), pushConstant ); // Push intersection stage to shader
+		rtPipeline->RecordTraceCommand( m_ShadowCommandBuffer, NEXTMULTIPLEOF( pathCount, 64 ) );
+		RecordTimestamp( m_ShadowCommandBuffer, TS_SHADOW_END );
+		m_ShadowCommandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eRayTracingShaderNV, vk::PipelineStageFlagBits::eComputeShader, {}, STAGE_BARRIER, {}, {} );
+		coreStats.totalShadowRays += pathCount;
+		shadowRaysTraced = true;
+	}
+	m_ShadowCommandBuffer.end();
+	m_Device->resetFences( m_ShadowFence );
+	m_Device.SubmitCommandBuffer( m_ShadowCommandBuffer, queue, m_ShadowFence );
 
-	cmdBuffer.Begin();
-	// Make sure off-screen render image is ready to be used
-	const auto subresourceRange = vk::ImageSubresourceRange( vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 );
-	const auto imageMemoryBarrier = vk::ImageMemoryBarrier( vk::AccessFlags(), vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
-		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_OffscreenImage->GetImage(), subresourceRange );
-	cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier );
-	// Dispatch finalize image shader
-	finalizePipeline->RecordDispatchCommand( cmdBuffer, m_ScrWidth, m_ScrHeight );
+	// Dispatch finalize image shader, pre-recorded in RecordCommandBuffers
+	m_Device.SubmitCommandBuffer( m_FinalizeCommandBuffer, queue );
 
-	// Run command buffer
-	cmdBuffer.Submit( queue, true );
+	// Blit image to OpenGL texture
+	if (m_InteropTexture->HasSemaphores())
+	{
+		// OpenGL signals when it is done with the texture and waits for the blit on the GPU; the host does not wait
+		vk::Semaphore glDone = m_InteropTexture->GetGLDoneSemaphore(), vulkanDone = m_InteropTexture->GetVulkanDoneSemaphore();
+		m_InteropTexture->SignalGLDone();
+		m_Device.SubmitCommandBuffer( m_BlitCommandBuffer, queue, nullptr, vk::PipelineStageFlagBits::eTransfer, 1, &glDone, 1, &vulkanDone );
+		m_InteropTexture->WaitVulkanDone();
+	}
+	else
+	{
+		// Ensure OpenGL finished
+		glFlush(), glFinish();
+		m_Device.SubmitCommandBuffer( m_BlitCommandBuffer, queue, nullptr, vk::PipelineStageFlagBits::eColorAttachmentOutput );
+		queue.waitIdle();
+	}
 
-	// Ensure OpenGL finished
-	glFlush(), glFinish();
+	// The shadow rays read the camera, which the next frame overwrites; finalize and blit may still run
+	const vk::Result shadowsDone = m_Device->waitForFences( m_ShadowFence, VK_TRUE, UINT64_MAX );
+	assert( shadowsDone == vk::Result::eSuccess );
 
-	// Blit image to OpenGL texture
-	m_Device.SubmitCommandBuffer( m_BlitCommandBuffer, queue, nullptr, vk::PipelineStageFlagBits::eColorAttachmentOutput );
-	queue.waitIdle();
+	// Stage times from the GPU timestamps; all stages up to the shadow rays finished, so the queries are available
+	if (m_TimestampPool)
+	{
+		coreStats.traceTime0 = StageTime( TS_PRIMARY_START, TS_PRIMARY_TRACED );
+		coreStats.shadeTime = StageTime( TS_PRIMARY_TRACED, TS_PRIMARY_SHADED );
+		for (uint i = 2; i <= lastBounce; i++)
+		{
+			const uint query = TS_BOUNCE + 3 * (i - 2);
+			if (i == 2) coreStats.traceTime1 = StageTime( query, query + 1 );
+			else coreStats.traceTimeX += StageTime( query, query + 1 );
+			coreStats.shadeTime += StageTime( query + 1, query + 2 );
+		}
+		if (shadowRaysTraced) coreStats.shadowTraceTime = StageTime( TS_SHADOW_START, TS_SHADOW_END );
+	}
 
 	coreStats.renderTime = frameTime.elapsed();
 	// OneTimeCommandBuffer automatically gets freed once it goes out of scope
@@ -1128,8 +1263,6 @@ void RenderCore::Shutdown()
 
 	m_Device->waitIdle();
 
-	if (m_CounterTransferBuffer) delete m_CounterTransferBuffer;
-
 	if (rtPipeline) delete rtPipeline;
 	if (rtDescriptorSet) delete rtDescriptorSet;
 
@@ -1140,8 +1273,14 @@ void RenderCore::Shutdown()
 	if (finalizeDescriptorSet) delete finalizeDescriptorSet;
 
 	if (m_BlitCommandBuffer) m_Device.FreeCommandBuffer( m_BlitCommandBuffer );
+	if (m_PrimaryCommandBuffer) m_Device.FreeCommandBuffer( m_PrimaryCommandBuffer );
+	if (m_FinalizeCommandBuffer) m_Device.FreeCommandBuffer( m_FinalizeCommandBuffer );
+	if (m_ShadowCommandBuffer) m_Device.FreeCommandBuffer( m_ShadowCommandBuffer );
+	if (m_ShadowFence) m_Device->destroyFence( m_ShadowFence );
+	if (m_TimestampPool) m_Device->destroyQueryPool( m_TimestampPool );
 	if (m_TopLevelAS) delete m_TopLevelAS;
 	for (auto *mesh : m_Meshes) delete mesh;
+	if (uploader) delete uploader, uploader = nullptr;
 
 	if (m_OffscreenImage != nullptr) delete m_OffscreenImage;
 
@@ -1158,6 +1297,8 @@ void RenderCore::Shutdown()
 	if (m_InstanceMeshMappingBuffer) delete m_InstanceMeshMappingBuffer;
 	if (m_Counters) delete m_Counters;
 	if (m_SkyboxImage) delete m_SkyboxImage;
+	for (auto image : m_TextureImages) delete image;
+	m_TextureImages.clear();
 	if (m_UniformCamera) delete m_UniformCamera;
 	if (m_UniformFinalizeParams) delete m_UniformFinalizeParams;
 	if (m_AccumulationBuffer) delete m_AccumulationBuffer;
@@ -33,6 +33,18 @@ struct DeviceVars
 	uint TAAEnabled = 1;
 };
 
+// GPU timestamp queries, written at the boundaries of the wavefront stages
+enum TimestampQuery
+{
+	TS_PRIMARY_START = 0,
+	TS_PRIMARY_TRACED,
+	TS_PRIMARY_SHADED,
+	TS_BOUNCE,											   // start, traced and shaded for each extension bounce
+	TS_SHADOW_START = TS_BOUNCE + 3 * (MAXPATHLENGTH - 1),
+	TS_SHADOW_END,
+	TS_COUNT
+};
+
 //  +-----------------------------------------------------------------------------+
 //  |  RenderCore                                                                 |
 //  |  Encapsulates device code.                                            LH2'19|
@@ -63,13 +75,16 @@ class RenderCore
 	// a scene is setup by first passing a number of meshes (geometry), then a number of instances.
 	// note that stored meshes can be used zero, one or multiple times in the scene.
 	// also note that, when using alpha flags, materials must be in sync.
-	void SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags = 0 );
+	void SetGeometry( const int meshIdx, const float4 *vertexData, const int vertexCount, const int triangleCount, const CoreTri *triangles, const uint *alphaFlags = 0,
+					  const GeometryHint hint = DefaultGeometry, const uint *indexData = nullptr );
 	void SetInstance( const int instanceIdx, const int modelIdx, const mat4 &transform );
+	void SetInstanceVisibility( const int instanceIdx, const uint visibility );
 	void UpdateToplevel();
 	void SetProbePos( const int2 pos );
 
 	// public data members
 	vk::DispatchLoaderDynamic dynamicDispatcher; // Dynamic dispatcher for extension functions such as NV_RT
+	VulkanUploader *uploader = nullptr;			 // Geometry and texture uploads through the transfer queue
 
   private:
 	// internal methods
@@ -88,12 +103,23 @@ class RenderCore
 	void CreateFinalizePipeline();
 	void CreateDescriptorSets();
 	void RecordCommandBuffers();
+	void RecordTimestamp( vk::CommandBuffer &cmdBuffer, const uint query );
+	float StageTime( const uint startQuery, const uint endQuery );
 	void CreateBuffers();
 	void InitializeDescriptorSets();
+#ifdef BINDLESS_TEXTURES
+	void SetTextureImages();
+#endif
 
 	vk::Instance m_VkInstance = nullptr;
 	vk::DebugUtilsMessengerEXT m_VkDebugMessenger = nullptr; // Debug validation messenger
 	vk::CommandBuffer m_BlitCommandBuffer;
+	vk::CommandBuffer m_PrimaryCommandBuffer;	// primary ray trace and shade, recorded with the blit buffer
+	vk::CommandBuffer m_FinalizeCommandBuffer;
+	vk::CommandBuffer m_ShadowCommandBuffer;	// shadow rays, re-recorded each frame for the shadow ray count
+	vk::Fence m_ShadowFence = nullptr;			// signaled when the shadow rays of the frame are traced
+	vk::QueryPool m_TimestampPool = nullptr;	// GPU timestamps for the stage times in coreStats
+	float m_TimestampPeriod = 0;				// nanoseconds per timestamp tick
 	std::vector<GeometryInstance> m_Instances;
 	std::vector<bool> m_MeshChanged = std::vector<bool>( 256 );
 	std::vector<vk::DescriptorBufferInfo> m_TriangleBufferInfos;
@@ -110,6 +136,7 @@ class RenderCore
 	int m_First = true;
 	int m_InstanceMeshMappingDirty = true;
 	int m_SamplesTaken = 0;
+	uint32_t m_PathCapacity = 0; // paths that fit in the path state buffers
 	uint4 m_LightCounts;
 	bool m_FirstConvergingFrame = false;
 
@@ -132,7 +159,6 @@ class RenderCore
 
 	// Storage buffers
 	VulkanCoreBuffer<mat4> *m_InvTransformsBuffer = nullptr;
-	VulkanCoreBuffer<Counters> *m_CounterTransferBuffer = nullptr;
 	VulkanCoreBuffer<uint> *m_ARGB32Buffer = nullptr;
 	VulkanCoreBuffer<float4> *m_ARGB128Buffer = nullptr;
 	VulkanCoreBuffer<uint> *m_NRM32Buffer = nullptr;
@@ -149,6 +175,7 @@ class RenderCore
 	VulkanCoreBuffer<PotentialContribution> *m_PotentialContributionBuffer = nullptr;
 
 	VulkanImage *m_SkyboxImage = nullptr;
+	std::vector<VulkanImage *> m_TextureImages; // BINDLESS_TEXTURES: one image per texture, bound to cTEXTURES
 	VulkanImage *m_OffscreenImage = nullptr; // Off-screen render image
 	int2 m_ProbePos = make_int2( 0 );		 // triangle picking; primary ray for this pixel copies its triid to coreStats.
   public:
@@ -18,8 +18,11 @@
 lh2core::TopLevelAS::TopLevelAS( const VulkanDevice &dev, AccelerationStructureType type, uint32_t instanceCount )
 	: m_Device( dev ), m_InstanceCnt( instanceCount ), m_Type( type ), m_Flags( TypeToFlags( type ) )
 {
-	m_InstanceBuffer = new VulkanCoreBuffer<GeometryInstance>( m_Device, instanceCount, vk::MemoryPropertyFlagBits::eDeviceLocal,
-															   vk::BufferUsageFlagBits::eRayTracingNV | vk::BufferUsageFlagBits::eTransferDst );
+	// Host visible so instances are written in place, mapped for the lifetime of the structure
+	m_InstanceBuffer = new VulkanCoreBuffer<GeometryInstance>( m_Device, instanceCount, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+															   vk::BufferUsageFlagBits::eRayTracingNV );
+	m_Instances = m_InstanceBuffer->Map();
+	memset( m_Instances, 0, instanceCount * sizeof( GeometryInstance ) );
 
 	vk::AccelerationStructureInfoNV accelerationStructureInfo{};
 	accelerationStructureInfo.pNext = nullptr;
@@ -55,6 +58,7 @@ lh2core::TopLevelAS::TopLevelAS( const VulkanDevice &dev, AccelerationStructureT
 	memoryRequirementsInfo.type = vk::AccelerationStructureMemoryRequirementsTypeNV::eUpdateScratch;
 	m_Device->getAccelerationStructureMemoryRequirementsNV( &memoryRequirementsInfo, &memoryRequirements, RenderCore::instance->dynamicDispatcher );
 	m_ScratchSize = std::max( m_ScratchSize, memoryRequirements.memoryRequirements.size );
+	m_ScratchBuffer = new VulkanCoreBuffer<uint8_t>( m_Device, m_ScratchSize, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eRayTracingNV );
 
 	// Create result memory
 	m_Memory = new VulkanCoreBuffer<uint8_t>( m_Device, m_ResultSize, vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible,
@@ -64,7 +68,7 @@ lh2core::TopLevelAS::TopLevelAS( const VulkanDevice &dev, AccelerationStructureT
 	bindInfo.pNext = nullptr;
 	bindInfo.accelerationStructure = m_Structure;
 	bindInfo.memory = *m_Memory;
-	bindInfo.memoryOffset = 0;
+	bindInfo.memoryOffset = m_Memory->GetMemoryOffset();
 	bindInfo.deviceIndexCount = 0;
 	bindInfo.pDeviceIndices = nullptr;
 	CheckVK( m_Device->bindAccelerationStructureMemoryNV( 1, &bindInfo, RenderCore::instance->dynamicDispatcher ) );
@@ -79,10 +83,13 @@ void lh2core::TopLevelAS::Cleanup()
 {
 	if ( m_Structure ) m_Device->destroyAccelerationStructureNV( m_Structure, nullptr, RenderCore::instance->dynamicDispatcher );
 	if ( m_Memory ) delete m_Memory;
-	if ( m_InstanceBuffer ) delete m_InstanceBuffer;
+	if ( m_InstanceBuffer ) m_InstanceBuffer->Unmap(), delete m_InstanceBuffer;
+	if ( m_ScratchBuffer ) delete m_ScratchBuffer;
 	m_Structure = nullptr;
 	m_Memory = nullptr;
 	m_InstanceBuffer = nullptr;
+	m_Instances = nullptr;
+	m_ScratchBuffer = nullptr;
 }
 
 vk::WriteDescriptorSetAccelerationStructureNV lh2core::TopLevelAS::GetDescriptorBufferInfo() const
@@ -93,12 +100,14 @@ vk::WriteDescriptorSetAccelerationStructureNV lh2core::TopLevelAS::GetDescriptor
 void lh2core::TopLevelAS::Build( bool update )
 {
 	// Build the acceleration structure and store it in the result memory
-	vk::AccelerationStructureInfoNV buildInfo = {vk::AccelerationStructureTypeNV::eTopLevel, m_Flags, m_InstanceCnt, 0, nullptr};
-	auto scratchBuffer = VulkanCoreBuffer<uint8_t>( m_Device, m_ScratchSize, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::BufferUsageFlagBits::eRayTracingNV );
+	assert( !update || CanRefit() );
+	vk::AccelerationStructureInfoNV buildInfo = {vk::AccelerationStructureTypeNV::eTopLevel, m_Flags, m_ActiveCnt, 0, nullptr};
 
 	auto commandBuffer = m_Device.CreateOneTimeCmdBuffer();
 	commandBuffer->buildAccelerationStructureNV( &buildInfo, *m_InstanceBuffer, 0, update, m_Structure, update ? m_Structure : nullptr,
-												scratchBuffer, 0, RenderCore::instance->dynamicDispatcher );
+												*m_ScratchBuffer, 0, RenderCore::instance->dynamicDispatcher );
+	m_BuiltCnt = m_ActiveCnt;
+	m_HandlesChanged = false;
 
 	// Ensure that the build will be finished before using the AS using a barrier
 	vk::MemoryBarrier memoryBarrier = {vk::AccessFlagBits::eAccelerationStructureWriteNV | vk::AccessFlagBits::eAccelerationStructureReadNV,
@@ -113,7 +122,17 @@ void lh2core::TopLevelAS::Build( bool update )
 void lh2core::TopLevelAS::UpdateInstances( const std::vector<GeometryInstance> &instances )
 {
 	assert( instances.size() <= m_InstanceCnt );
-	m_InstanceBuffer->CopyToDevice( instances.data(), instances.size() * sizeof( GeometryInstance ) );
+	for ( uint32_t i = 0; i < instances.size(); i++ ) SetInstance( i, instances[i] );
+	m_ActiveCnt = (uint32_t)instances.size();
+}
+
+void lh2core::TopLevelAS::SetInstance( const uint32_t idx, const GeometryInstance &instance )
+{
+	assert( idx < m_InstanceCnt );
+	// Transform changes can be refit, a different bottom level structure needs a full build
+	if ( m_Instances[idx].accelerationStructureHandle != instance.accelerationStructureHandle ) m_HandlesChanged = true;
+	m_Instances[idx] = instance;
+	m_ActiveCnt = std::max( m_ActiveCnt, idx + 1 );
 }
 
 void lh2core::TopLevelAS::Build()
@@ -35,6 +35,7 @@ class TopLevelAS
 	void Cleanup();
 
 	void UpdateInstances( const std::vector<GeometryInstance> &instances );
+	void SetInstance( const uint32_t idx, const GeometryInstance &instance );
 	void Build();
 	void Rebuild();
 
@@ -42,6 +43,8 @@ class TopLevelAS
 	uint32_t GetInstanceCount() const;
 
 	bool CanUpdate() const { return uint( m_Flags & vk::BuildAccelerationStructureFlagBitsNV::eAllowUpdate ) > 0; }
+	// A refit is only valid for the same instances and bottom level structures as the last build
+	bool CanRefit() const { return CanUpdate() && m_BuiltCnt > 0 && m_ActiveCnt == m_BuiltCnt && !m_HandlesChanged; }
 	const vk::AccelerationStructureNV &GetAccelerationStructure() const { return m_Structure; }
 	vk::WriteDescriptorSetAccelerationStructureNV GetDescriptorBufferInfo() const;
 
@@ -63,12 +66,17 @@ class TopLevelAS
 	}
 
 	VulkanDevice m_Device;
-	uint32_t m_InstanceCnt = 0;
+	uint32_t m_InstanceCnt = 0;		// capacity of the instance buffer
+	uint32_t m_ActiveCnt = 0;		// instances in use
+	uint32_t m_BuiltCnt = 0;		// instances in the last build, 0 if not built yet
+	bool m_HandlesChanged = false;	// a bottom level structure changed since the last build
 	vk::DeviceSize m_ResultSize{}, m_ScratchSize{};
 	AccelerationStructureType m_Type{};
 	vk::BuildAccelerationStructureFlagsNV m_Flags{};
 	vk::AccelerationStructureNV m_Structure{};
 	VulkanCoreBuffer<uint8_t> *m_Memory = nullptr;
 	VulkanCoreBuffer<GeometryInstance> *m_InstanceBuffer = nullptr;
+	GeometryInstance *m_Instances = nullptr; // persistently mapped instance buffer
+	VulkanCoreBuffer<uint8_t> *m_ScratchBuffer = nullptr;
 };
 } // namespace lh2core
\ No newline at end of file
@@ -17,30 +17,29 @@
 
 namespace lh2core
 {
+/**
+ * Uniform data lives in host visible, coherent memory that stays mapped (see VulkanMemoryAllocator), preferably
+ * device local. Writes through GetData are seen by the next submission; no copy is recorded or submitted.
+ * The caller must make sure the GPU no longer reads the data it overwrites.
+ */
 template <typename T>
 class UniformObject
 {
   public:
 	static_assert( sizeof( T ) == 4 || ( sizeof( T ) % 8 ) == 0 ); // Make sure object is either at least 4 bytes big or 8 byte aligned
 	UniformObject( VulkanDevice device, vk::BufferUsageFlagBits usage = vk::BufferUsageFlagBits(), vk::DeviceSize count = 1 )
-		: m_Buffer( device, 1, vk::MemoryPropertyFlagBits::eDeviceLocal,
-					usage | vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, ON_HOST | ON_DEVICE )
+		: m_Buffer( device, count, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+					usage | vk::BufferUsageFlagBits::eUniformBuffer, ON_DEVICE, vk::MemoryPropertyFlagBits::eDeviceLocal )
 	{
 	}
 	~UniformObject() { Cleanup(); }
 
-	void CopyToDevice() { m_Buffer.CopyToDevice(); }
 	void UpdateData( const T *data, uint32_t index = 0, uint32_t count = 1 )
 	{
-		assert( index + count < m_Buffer.GetElementCount() );
-		memcpy( m_Buffer.GetHostBuffer() + index, data, count * sizeof( T ) );
-	}
-	T *GetData() { return m_Buffer.GetHostBuffer(); }
-	T *ReadDataFromDevice()
-	{
-		m_Buffer.CopyToHost();
-		return m_Buffer.GetHostBuffer();
+		assert( index + count <= m_Buffer.GetElementCount() );
+		memcpy( m_Buffer.Map() + index, data, count * sizeof( T ) );
 	}
+	T *GetData() { return m_Buffer.Map(); }
 
 	void Cleanup() { m_Buffer.Cleanup(); }
 
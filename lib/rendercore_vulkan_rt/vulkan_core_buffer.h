@@ -27,7 +27,9 @@ template <typename T>
 class VulkanCoreBuffer
 {
   public:
-	VulkanCoreBuffer( const VulkanDevice &device, vk::DeviceSize elementCount, vk::MemoryPropertyFlags memFlags, vk::BufferUsageFlags usageFlags, uint location = ON_DEVICE )
+	// preferredFlags are used when a memory type has them in addition to memFlags, e.g. device local host visible memory
+	VulkanCoreBuffer( const VulkanDevice &device, vk::DeviceSize elementCount, vk::MemoryPropertyFlags memFlags, vk::BufferUsageFlags usageFlags, uint location = ON_DEVICE,
+					  vk::MemoryPropertyFlags preferredFlags = {} )
 		: m_Device( device ), m_Elements( elementCount ), m_MemFlags( memFlags ), m_UsageFlags( usageFlags ), m_Flags( location )
 	{
 		vk::Device vkDevice = device.GetVkDevice();
@@ -43,14 +45,13 @@ class VulkanCoreBuffer
 		m_Buffer = vkDevice.createBuffer( createInfo );
 		const vk::MemoryRequirements memReqs = vkDevice.getBufferMemoryRequirements( m_Buffer );
 
-		vk::MemoryAllocateInfo memoryAllocateInfo{};
-		memoryAllocateInfo.setPNext( nullptr );
-		memoryAllocateInfo.setAllocationSize( memReqs.size );
-		memoryAllocateInfo.setMemoryTypeIndex( device.GetMemoryType( memReqs, memFlags ) );
+		// Host visible transfer-only buffers are staging buffers that live for a single copy
+		const bool staging = ( memFlags & vk::MemoryPropertyFlagBits::eHostVisible ) &&
+							 !( usageFlags & ~( vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst ) );
+		const uint32_t memoryType = preferredFlags ? device.GetMemoryType( memReqs, memFlags, preferredFlags ) : device.GetMemoryType( memReqs, memFlags );
+		m_Allocation = device.GetAllocator().Allocate( memReqs, memoryType, staging ? LinearAllocation : BuddyAllocation );
 
-		m_Memory = vkDevice.allocateMemory( memoryAllocateInfo );
-
-		vkDevice.bindBufferMemory( m_Buffer, m_Memory, 0 );
+		vkDevice.bindBufferMemory( m_Buffer, m_Allocation.memory, m_Allocation.offset );
 
 		if ( location & ON_HOST ) m_HostBuffer = new T[elementCount];
 	}
@@ -60,12 +61,11 @@ class VulkanCoreBuffer
 	{
 		if ( m_HostBuffer ) delete[] m_HostBuffer;
 		if ( m_Buffer ) m_Device->destroyBuffer( m_Buffer );
-		if ( m_Memory ) m_Device->freeMemory( m_Memory );
+		if ( m_Allocation ) m_Device.GetAllocator().Free( m_Allocation );
 
 		m_Flags = 0;
 		m_HostBuffer = nullptr;
 		m_Buffer = nullptr;
-		m_Memory = nullptr;
 		m_Elements = 0;
 	}
 
@@ -130,23 +130,23 @@ class VulkanCoreBuffer
 		auto cmdBuffer = m_Device.CreateOneTimeCmdBuffer();
 		vk::BufferCopy copyRegion = vk::BufferCopy( 0, 0, m_Elements * sizeof( T ) );
 		cmdBuffer->copyBuffer( m_Buffer, *buffer, 1, &copyRegion );
-		
-		auto transferQueue = m_Device.GetTransferQueue();
-		cmdBuffer.Submit( transferQueue, true );
+
+		// One-time command buffers come from the graphics family pool; see VulkanUploader for the transfer queue
+		auto queue = m_Device.GetGraphicsQueue();
+		cmdBuffer.Submit( queue, true );
 	}
 
 	T *Map()
 	{
+		// Memory blocks stay mapped, see VulkanMemoryAllocator
 		assert( CanMap() );
-		void *memory = m_Device->mapMemory( m_Memory, 0, m_Elements * sizeof( T ) );
-		assert( memory );
-		return (T *)( memory );
+		assert( m_Allocation.mapped );
+		return (T *)( m_Allocation.mapped );
 	}
 
 	void Unmap()
 	{
 		assert( CanMap() );
-		m_Device->unmapMemory( m_Memory );
 	}
 
 	vk::DescriptorBufferInfo GetDescriptorBufferInfo( vk::DeviceSize offset = 0, vk::DeviceSize range = 0 ) const
@@ -159,11 +159,11 @@ class VulkanCoreBuffer
 	}
 
 	operator vk::Buffer() const { return m_Buffer; }
-	operator vk::DeviceMemory() const { return m_Memory; }
+	operator vk::DeviceMemory() const { return m_Allocation.memory; }
 	operator vk::Buffer *() { return &m_Buffer; }
-	operator vk::DeviceMemory *() { return &m_Memory; }
+	operator vk::DeviceMemory *() { return &m_Allocation.memory; }
 	operator const vk::Buffer *() const { return &m_Buffer; }
-	operator const vk::DeviceMemory *() const { return &m_Memory; }
+	operator const vk::DeviceMemory *() const { return &m_Allocation.memory; }
 	operator vk::DescriptorBufferInfo() const { return GetDescriptorBufferInfo( 0, 0 ); }
 
 	constexpr bool CanMap() const
@@ -175,6 +175,7 @@ class VulkanCoreBuffer
 	T *GetHostBuffer() { return m_HostBuffer; }
 	vk::DeviceSize GetElementCount() const { return m_Elements; }
 	vk::DeviceSize GetSize() const { return m_Elements * sizeof( T ); }
+	vk::DeviceSize GetMemoryOffset() const { return m_Allocation.offset; } // Offset of the buffer in its memory block
 	vk::MemoryPropertyFlags GetMemoryProperties() const { return m_MemFlags; }
 	vk::BufferUsageFlags GetBufferUsageFlags() const { return m_UsageFlags; }
 
@@ -183,7 +184,7 @@ class VulkanCoreBuffer
 	T *m_HostBuffer = nullptr;
 	VulkanDevice m_Device;
 	vk::Buffer m_Buffer = nullptr;
-	vk::DeviceMemory m_Memory = nullptr;
+	VulkanAllocation m_Allocation{};
 	vk::DeviceSize m_Elements = 0;
 	vk::MemoryPropertyFlags m_MemFlags;
 	vk::BufferUsageFlags m_UsageFlags;
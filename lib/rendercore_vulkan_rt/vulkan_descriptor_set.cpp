@@ -32,13 +32,14 @@ void lh2core::VulkanDescriptorSet::Cleanup()
 	m_Generated = false;
 	m_Dirty = true;
 	m_Bindings.clear();
+	m_BindingFlags.clear();
 	m_Buffers.Clear();
 	m_Images.Clear();
 	m_AccelerationStructures.Clear();
 }
 
 void lh2core::VulkanDescriptorSet::AddBinding( uint32_t binding, uint32_t descriptorCount, vk::DescriptorType type,
-											   vk::ShaderStageFlags stage, vk::Sampler *sampler )
+											   vk::ShaderStageFlags stage, vk::Sampler *sampler, vk::DescriptorBindingFlagsEXT flags )
 {
 	if ( m_Generated ) FATALERROR( "Cannot add bindings after descriptor set has been generated." );
 	vk::DescriptorSetLayoutBinding b{};
@@ -60,6 +61,7 @@ void lh2core::VulkanDescriptorSet::AddBinding( uint32_t binding, uint32_t descri
 	}
 
 	m_Bindings[binding] = b;
+	m_BindingFlags[binding] = flags;
 }
 
 void lh2core::VulkanDescriptorSet::Finalize()
@@ -149,15 +151,28 @@ void lh2core::VulkanDescriptorSet::GenerateLayout()
 {
 	m_Generated = true;
 	std::vector<vk::DescriptorSetLayoutBinding> bindings;
+	std::vector<vk::DescriptorBindingFlagsEXT> bindingFlags;
 	bindings.reserve( m_Bindings.size() );
+	bindingFlags.reserve( m_Bindings.size() );
 
+	bool hasFlags = false;
 	for ( const auto &b : m_Bindings )
+	{
 		bindings.push_back( b.second );
+		bindingFlags.push_back( m_BindingFlags[b.first] );
+		if ( bindingFlags.back() ) hasFlags = true;
+	}
 
 	vk::DescriptorSetLayoutCreateInfo layoutInfo{};
 	layoutInfo.setBindingCount( (uint32_t)m_Bindings.size() );
 	layoutInfo.setPBindings( bindings.data() );
 
+	// Binding flags are only chained in when a binding uses them
+	vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo{};
+	flagsInfo.setBindingCount( (uint32_t)bindingFlags.size() );
+	flagsInfo.setPBindingFlags( bindingFlags.data() );
+	if ( hasFlags ) layoutInfo.setPNext( &flagsInfo );
+
 	m_Layout = m_Device->createDescriptorSetLayout( layoutInfo, nullptr, RenderCore::instance->dynamicDispatcher );
 }
 
@@ -30,8 +30,9 @@ class VulkanDescriptorSet
 
 	void Cleanup();
 
+	// Flags such as ePartiallyBound allow descriptor arrays that are not filled completely
 	void AddBinding( uint32_t binding, uint32_t descriptorCount,
-					 vk::DescriptorType type, vk::ShaderStageFlags stage, vk::Sampler *sampler = nullptr );
+					 vk::DescriptorType type, vk::ShaderStageFlags stage, vk::Sampler *sampler = nullptr, vk::DescriptorBindingFlagsEXT flags = {} );
 
 	void Finalize();
 
@@ -144,6 +145,7 @@ class VulkanDescriptorSet
 	bool m_Generated = false;
 
 	std::unordered_map<uint32_t, vk::DescriptorSetLayoutBinding> m_Bindings;
+	std::unordered_map<uint32_t, vk::DescriptorBindingFlagsEXT> m_BindingFlags;
 	WriteInfo<vk::DescriptorBufferInfo, offsetof( VkWriteDescriptorSet, pBufferInfo )> m_Buffers;
 	WriteInfo<vk::DescriptorImageInfo, offsetof( VkWriteDescriptorSet, pImageInfo )> m_Images;
 	WriteInfo<vk::WriteDescriptorSetAccelerationStructureNV, offsetof( VkWriteDescriptorSet, pNext )> m_AccelerationStructures;
@@ -45,6 +45,19 @@ QueueFamilyIndices::QueueFamilyIndices( vk::PhysicalDevice device, std::optional
 		}
 		++i;
 	}
+
+	// Prefer a transfer-only family: its DMA engines copy while the graphics queue builds and traces
+	i = 0u;
+	for ( const auto &qf : queueFamilies )
+	{
+		if ( qf.queueCount > 0 && ( qf.queueFlags & vk::QueueFlagBits::eTransfer ) &&
+			 !( qf.queueFlags & ( vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute ) ) )
+		{
+			this->transferIdx = i;
+			break;
+		}
+		++i;
+	}
 }
 
 bool QueueFamilyIndices::IsComplete() const
@@ -83,7 +96,7 @@ VulkanDevice::VulkanDevice( vk::PhysicalDevice physicalDevice, const std::vector
 	std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos{};
 	std::set<uint32_t> uniqueQueueFamilies = {
 		m_Members->m_Indices.graphicsIdx.value(),
-		m_Members->m_Indices.computeIdx.has_value(),
+		m_Members->m_Indices.computeIdx.value(),
 		m_Members->m_Indices.transferIdx.value(),
 		surface.has_value() ? m_Members->m_Indices.presentIdx.value() : m_Members->m_Indices.graphicsIdx.value()};
 
@@ -118,6 +131,7 @@ VulkanDevice::VulkanDevice( vk::PhysicalDevice physicalDevice, const std::vector
 		m_Members->m_PresentQueue = m_Members->m_VkDevice.getQueue( m_Members->m_Indices.presentIdx.value(), 0 );
 
 	m_Members->m_MemProps = m_Members->m_PhysicalDevice.getMemoryProperties();
+	m_Members->m_Allocator = new VulkanMemoryAllocator( m_Members->m_VkDevice, m_Members->m_MemProps );
 
 	vk::CommandPoolCreateInfo cmdPoolCreateInfo{};
 	cmdPoolCreateInfo.setPNext( nullptr );
@@ -143,6 +157,21 @@ uint32_t VulkanDevice::GetMemoryType( const vk::MemoryRequirements &memReqs, vk:
 	return 0;
 }
 
+uint32_t VulkanDevice::GetMemoryType( const vk::MemoryRequirements &memReqs, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred ) const
+{
+	// A type with all required and preferred properties, else one with all required properties
+	const vk::MemoryPropertyFlags wanted[2] = { required | preferred, required };
+	for ( const vk::MemoryPropertyFlags flags : wanted )
+		for ( uint32_t memoryTypeIndex = 0; memoryTypeIndex < m_Members->m_MemProps.memoryTypeCount; ++memoryTypeIndex )
+		{
+			if ( memReqs.memoryTypeBits & ( 1u << memoryTypeIndex ) )
+				if ( ( m_Members->m_MemProps.memoryTypes[memoryTypeIndex].propertyFlags & flags ) == flags )
+					return memoryTypeIndex;
+		}
+
+	return GetMemoryType( memReqs, required );
+}
+
 void VulkanDevice::Cleanup()
 {
 	if ( m_Members ) m_Members->Cleanup();
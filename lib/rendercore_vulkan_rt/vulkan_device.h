@@ -59,6 +59,8 @@ class VulkanDevice
 	vk::PhysicalDeviceMemoryProperties GetMemoryProperties() const { return m_Members->m_MemProps; }
 	vk::CommandPool GetCommandPool() const { return m_Members->m_CommandPool; }
 	uint32_t GetMemoryType( const vk::MemoryRequirements &memReqs, vk::MemoryPropertyFlags memProps ) const;
+	uint32_t GetMemoryType( const vk::MemoryRequirements &memReqs, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred ) const;
+	VulkanMemoryAllocator &GetAllocator() const { return *m_Members->m_Allocator; }
 	void Cleanup();
 
 	vk::CommandBuffer CreateCommandBuffer( vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary );
@@ -103,6 +105,7 @@ class VulkanDevice
 			if ( m_VkDevice )
 			{
 				m_VkDevice.waitIdle();
+				if ( m_Allocator ) delete m_Allocator, m_Allocator = nullptr;
 				m_VkDevice.destroyCommandPool( m_CommandPool );
 				m_VkDevice.destroy();
 				m_VkDevice = nullptr;
@@ -114,6 +117,7 @@ class VulkanDevice
 		vk::PhysicalDevice m_PhysicalDevice;
 		vk::PhysicalDeviceMemoryProperties m_MemProps;
 		vk::Device m_VkDevice;
+		VulkanMemoryAllocator *m_Allocator = nullptr;
 		vk::Queue m_GraphicsQueue;
 		vk::Queue m_ComputeQueue;
 		vk::Queue m_TransferQueue;
@@ -17,10 +17,24 @@
 
 #ifdef WIN32
 static PFN_vkGetMemoryWin32HandleKHR getMemoryWin32HandleKHR = nullptr;
+static PFN_vkGetSemaphoreWin32HandleKHR getSemaphoreWin32HandleKHR = nullptr;
 #else
 static PFN_vkGetMemoryFdKHR getMemoryFdKHR = nullptr;
 #endif
 
+// GL_EXT_semaphore and GL_EXT_semaphore_win32 are not part of the glad build, so they are loaded here
+#define GL_LAYOUT_COLOR_ATTACHMENT_EXT 0x958E
+typedef void( APIENTRYP PFNGLGENSEMAPHORESEXTPROC )( GLsizei n, GLuint *semaphores );
+typedef void( APIENTRYP PFNGLDELETESEMAPHORESEXTPROC )( GLsizei n, const GLuint *semaphores );
+typedef void( APIENTRYP PFNGLIMPORTSEMAPHOREWIN32HANDLEEXTPROC )( GLuint semaphore, GLenum handleType, void *handle );
+typedef void( APIENTRYP PFNGLWAITSEMAPHOREEXTPROC )( GLuint semaphore, GLuint numBufferBarriers, const GLuint *buffers, GLuint numTextureBarriers, const GLuint *textures, const GLenum *srcLayouts );
+typedef void( APIENTRYP PFNGLSIGNALSEMAPHOREEXTPROC )( GLuint semaphore, GLuint numBufferBarriers, const GLuint *buffers, GLuint numTextureBarriers, const GLuint *textures, const GLenum *dstLayouts );
+static PFNGLGENSEMAPHORESEXTPROC glGenSemaphoresEXT = nullptr;
+static PFNGLDELETESEMAPHORESEXTPROC glDeleteSemaphoresEXT = nullptr;
+static PFNGLIMPORTSEMAPHOREWIN32HANDLEEXTPROC glImportSemaphoreWin32HandleEXT = nullptr;
+static PFNGLWAITSEMAPHOREEXTPROC glWaitSemaphoreEXT = nullptr;
+static PFNGLSIGNALSEMAPHOREEXTPROC glSignalSemaphoreEXT = nullptr;
+
 lh2core::VulkanGLTextureInterop::VulkanGLTextureInterop( const VulkanDevice &device, uint32_t width, uint32_t height )
 {
 	m_Device = device;
@@ -130,6 +144,64 @@ lh2core::VulkanGLTextureInterop::VulkanGLTextureInterop( const VulkanDevice &dev
 	glTextureStorageMem2DEXT( m_TexID, 1, GL_RGBA32F, m_Width, m_Height, m_GLMemoryObj, 0 );
 	// Check for any errors
 	CheckGL();
+
+	CreateSemaphores();
+}
+
+void lh2core::VulkanGLTextureInterop::CreateSemaphores()
+{
+#ifdef WIN32
+	// Resolve the OpenGL and Vulkan entry points; without them, the render core falls back to glFinish and a queue idle
+	if ( glGenSemaphoresEXT == nullptr )
+	{
+		glGenSemaphoresEXT = (PFNGLGENSEMAPHORESEXTPROC)wglGetProcAddress( "glGenSemaphoresEXT" );
+		glDeleteSemaphoresEXT = (PFNGLDELETESEMAPHORESEXTPROC)wglGetProcAddress( "glDeleteSemaphoresEXT" );
+		glImportSemaphoreWin32HandleEXT = (PFNGLIMPORTSEMAPHOREWIN32HANDLEEXTPROC)wglGetProcAddress( "glImportSemaphoreWin32HandleEXT" );
+		glWaitSemaphoreEXT = (PFNGLWAITSEMAPHOREEXTPROC)wglGetProcAddress( "glWaitSemaphoreEXT" );
+		glSignalSemaphoreEXT = (PFNGLSIGNALSEMAPHOREEXTPROC)wglGetProcAddress( "glSignalSemaphoreEXT" );
+	}
+	if ( getSemaphoreWin32HandleKHR == nullptr )
+		getSemaphoreWin32HandleKHR = reinterpret_cast<PFN_vkGetSemaphoreWin32HandleKHR>( vkGetDeviceProcAddr( m_Device.GetVkDevice(), "vkGetSemaphoreWin32HandleKHR" ) );
+	if ( !glGenSemaphoresEXT || !glDeleteSemaphoresEXT || !glImportSemaphoreWin32HandleEXT || !glWaitSemaphoreEXT || !glSignalSemaphoreEXT || !getSemaphoreWin32HandleKHR )
+		return;
+	m_GLDone = CreateExportedSemaphore( m_GLDoneGL );
+	m_VulkanDone = CreateExportedSemaphore( m_VulkanDoneGL );
+	CheckGL();
+#endif
+}
+
+vk::Semaphore lh2core::VulkanGLTextureInterop::CreateExportedSemaphore( uint32_t &glSemaphore )
+{
+#ifdef WIN32
+	vk::ExportSemaphoreCreateInfo exportInfo( vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueWin32 );
+	vk::SemaphoreCreateInfo createInfo{};
+	createInfo.pNext = &exportInfo;
+	vk::Semaphore semaphore = m_Device->createSemaphore( createInfo );
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	vk::SemaphoreGetWin32HandleInfoKHR getHandleInfo( semaphore, vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueWin32 );
+	getSemaphoreWin32HandleKHR( m_Device.GetVkDevice(), (VkSemaphoreGetWin32HandleInfoKHR *)&getHandleInfo, &handle );
+	assert( handle != INVALID_HANDLE_VALUE && handle != nullptr );
+	glGenSemaphoresEXT( 1, &glSemaphore );
+	glImportSemaphoreWin32HandleEXT( glSemaphore, GL_HANDLE_TYPE_OPAQUE_WIN32_EXT, handle );
+	return semaphore;
+#else
+	return nullptr;
+#endif
+}
+
+void lh2core::VulkanGLTextureInterop::SignalGLDone()
+{
+	// Flushes the OpenGL commands that use the texture; Vulkan may overwrite it once they complete
+	const GLenum layout = GL_LAYOUT_COLOR_ATTACHMENT_EXT;
+	glSignalSemaphoreEXT( m_GLDoneGL, 0, nullptr, 1, &m_TexID, &layout );
+	glFlush();
+}
+
+void lh2core::VulkanGLTextureInterop::WaitVulkanDone()
+{
+	// OpenGL commands issued after this wait for the blit; the host does not wait
+	const GLenum layout = GL_LAYOUT_COLOR_ATTACHMENT_EXT;
+	glWaitSemaphoreEXT( m_VulkanDoneGL, 0, nullptr, 1, &m_TexID, &layout );
 }
 
 lh2core::VulkanGLTextureInterop::~VulkanGLTextureInterop()
@@ -183,6 +255,14 @@ void lh2core::VulkanGLTextureInterop::Cleanup()
 {
 	glFlush();
 	glFinish();
+	if ( m_GLDone )
+	{
+		glDeleteSemaphoresEXT( 1, &m_GLDoneGL );
+		glDeleteSemaphoresEXT( 1, &m_VulkanDoneGL );
+		m_Device->destroySemaphore( m_GLDone );
+		m_Device->destroySemaphore( m_VulkanDone );
+		m_GLDone = m_VulkanDone = nullptr;
+	}
 	if ( m_Image )
 	{
 		m_Device->destroyImage( m_Image );
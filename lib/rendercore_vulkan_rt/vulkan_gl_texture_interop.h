@@ -29,6 +29,14 @@ class VulkanGLTextureInterop
 	void TransitionImageToInitialState( vk::CommandBuffer &cmdBuffer, vk::Queue &queue );
 	void Cleanup();
 
+	// Synchronization without host waits, if OpenGL supports GL_EXT_semaphore: OpenGL signals GetGLDoneSemaphore
+	// when it no longer uses the texture, the blit waits for it and signals GetVulkanDoneSemaphore, which OpenGL waits for.
+	bool HasSemaphores() const { return m_GLDone && m_VulkanDone; }
+	vk::Semaphore GetGLDoneSemaphore() const { return m_GLDone; }
+	vk::Semaphore GetVulkanDoneSemaphore() const { return m_VulkanDone; }
+	void SignalGLDone();
+	void WaitVulkanDone();
+
 	vk::Image GetImage() const { return m_Image; }
 	vk::DeviceMemory GetMemory() const { return m_Memory; }
 	vk::DeviceSize GetBufferSize() const { return m_Width * m_Height * 4 * sizeof( float ); }
@@ -41,6 +49,9 @@ class VulkanGLTextureInterop
 	operator vk::Image() const { return m_Image; }
 
   private:
+	void CreateSemaphores();
+	vk::Semaphore CreateExportedSemaphore( uint32_t &glSemaphore );
+
 	vk::Image m_Image = nullptr;
 	vk::DeviceMemory m_Memory = nullptr;
 	VulkanDevice m_Device;
@@ -48,5 +59,7 @@ class VulkanGLTextureInterop
 	uint32_t m_TexID = 0;
 	uint32_t m_GLMemoryObj = 0;
 	uint32_t m_Width = 0, m_Height = 0;
+	vk::Semaphore m_GLDone = nullptr, m_VulkanDone = nullptr;
+	uint32_t m_GLDoneGL = 0, m_VulkanDoneGL = 0; // the same semaphores, imported into OpenGL
 };
 } // namespace lh2core
\ No newline at end of file
@@ -16,8 +16,8 @@
 #include "core_settings.h"
 
 VulkanImage::VulkanImage( const VulkanDevice &dev, vk::ImageType type, vk::Format format, vk::Extent3D extent,
-						  vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags memProps )
-	: m_Device( dev ), m_Extent( extent )
+						  vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags memProps, uint32_t mipLevels )
+	: m_Device( dev ), m_Extent( extent ), m_MipLevels( mipLevels )
 {
 	vk::ImageCreateInfo imageCreateInfo{};
 	imageCreateInfo.setPNext( nullptr );
@@ -25,7 +25,7 @@ VulkanImage::VulkanImage( const VulkanDevice &dev, vk::ImageType type, vk::Forma
 	imageCreateInfo.setImageType( type );
 	imageCreateInfo.setFormat( format );
 	imageCreateInfo.setExtent( m_Extent );
-	imageCreateInfo.setMipLevels( 1 );
+	imageCreateInfo.setMipLevels( m_MipLevels );
 	imageCreateInfo.setArrayLayers( 1 );
 	imageCreateInfo.setSamples( vk::SampleCountFlagBits::e1 );
 	imageCreateInfo.setTiling( tiling );
@@ -40,16 +40,12 @@ VulkanImage::VulkanImage( const VulkanDevice &dev, vk::ImageType type, vk::Forma
 		FATALERROR( "Could not create image." );
 
 	const auto memoryRequirements = m_Device->getImageMemoryRequirements( m_Image );
-	vk::MemoryAllocateInfo memoryAllocateInfo{};
-	memoryAllocateInfo.setPNext( nullptr );
-	memoryAllocateInfo.setAllocationSize( memoryRequirements.size );
-	memoryAllocateInfo.setMemoryTypeIndex( m_Device.GetMemoryType( memoryRequirements, memProps ) );
-	m_Memory = m_Device->allocateMemory( memoryAllocateInfo );
+	m_Allocation = m_Device.GetAllocator().Allocate( memoryRequirements, m_Device.GetMemoryType( memoryRequirements, memProps ), BuddyAllocation, true );
 
-	if ( !m_Memory )
+	if ( !m_Allocation )
 		FATALERROR( "Could not allocate memory for image." );
 
-	m_Device->bindImageMemory( m_Image, m_Memory, 0 );
+	m_Device->bindImageMemory( m_Image, m_Allocation.memory, m_Allocation.offset );
 }
 
 VulkanImage::~VulkanImage()
@@ -76,16 +72,14 @@ void VulkanImage::Cleanup()
 		device.destroyImage( m_Image );
 		m_Image = nullptr;
 	}
-	if ( m_Memory )
-	{
-		device.freeMemory( m_Memory );
-		m_Memory = nullptr;
-	}
+	if ( m_Allocation ) m_Device.GetAllocator().Free( m_Allocation );
 }
 
 bool VulkanImage::SetData( const void *data, uint32_t width, uint32_t height, uint32_t stride )
 {
-	vk::DeviceSize imageSize = width * height * stride;
+	vk::DeviceSize imageSize = 0;
+	for ( uint32_t level = 0; level < m_MipLevels; level++ )
+		imageSize += std::max( width >> level, 1u ) * std::max( height >> level, 1u ) * stride;
 
 	auto stagingBuffer = VulkanCoreBuffer<uint8_t>( m_Device, imageSize, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
 													vk::BufferUsageFlagBits::eTransferSrc );
@@ -101,20 +95,27 @@ bool VulkanImage::SetData( const void *data, uint32_t width, uint32_t height, ui
 	barrier.setSrcQueueFamilyIndex( VK_QUEUE_FAMILY_IGNORED );
 	barrier.setDstQueueFamilyIndex( VK_QUEUE_FAMILY_IGNORED );
 	barrier.setImage( m_Image );
-	barrier.setSubresourceRange( {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1} );
+	barrier.setSubresourceRange( {vk::ImageAspectFlagBits::eColor, 0, m_MipLevels, 0, 1} );
 
 	cmdBuffer->pipelineBarrier( vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
 								vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier );
 
-	vk::BufferImageCopy region{};
-	region.setBufferOffset( 0 );
-	region.setBufferRowLength( 0 );
-	region.setBufferImageHeight( 0 );
-	region.setImageSubresource( vk::ImageSubresourceLayers( vk::ImageAspectFlagBits::eColor, 0, 0, 1 ) );
-	region.setImageOffset( {0, 0, 0} );
-	region.setImageExtent( {width, height, 1} );
+	// One copy region per MIP level
+	std::vector<vk::BufferImageCopy> regions( m_MipLevels );
+	vk::DeviceSize offset = 0;
+	for ( uint32_t level = 0; level < m_MipLevels; level++ )
+	{
+		const uint32_t w = std::max( width >> level, 1u ), h = std::max( height >> level, 1u );
+		regions[level].setBufferOffset( offset );
+		regions[level].setBufferRowLength( 0 );
+		regions[level].setBufferImageHeight( 0 );
+		regions[level].setImageSubresource( vk::ImageSubresourceLayers( vk::ImageAspectFlagBits::eColor, level, 0, 1 ) );
+		regions[level].setImageOffset( {0, 0, 0} );
+		regions[level].setImageExtent( {w, h, 1} );
+		offset += w * h * stride;
+	}
 
-	cmdBuffer->copyBufferToImage( stagingBuffer, m_Image, vk::ImageLayout::eTransferDstOptimal, 1, &region );
+	cmdBuffer->copyBufferToImage( stagingBuffer, m_Image, vk::ImageLayout::eTransferDstOptimal, m_MipLevels, regions.data() );
 
 	barrier.setSrcAccessMask( vk::AccessFlagBits::eTransferWrite );
 	barrier.setDstAccessMask( vk::AccessFlagBits::eShaderRead );
@@ -125,7 +126,7 @@ bool VulkanImage::SetData( const void *data, uint32_t width, uint32_t height, ui
 
 	m_CurLayout = vk::ImageLayout::eTransferDstOptimal;
 
-	auto queue = m_Device.GetTransferQueue();
+	auto queue = m_Device.GetGraphicsQueue();
 	cmdBuffer.Submit( queue, true );
 	return true;
 }
@@ -150,7 +151,7 @@ bool VulkanImage::CreateImageView( vk::ImageViewType viewType, vk::Format format
 	return true;
 }
 
-bool VulkanImage::CreateSampler( vk::Filter magFilter, vk::Filter minFilter, vk::SamplerMipmapMode mipmapMode, vk::SamplerAddressMode addressMode )
+bool VulkanImage::CreateSampler( vk::Filter magFilter, vk::Filter minFilter, vk::SamplerMipmapMode mipmapMode, vk::SamplerAddressMode addressMode, float maxAnisotropy )
 {
 	vk::SamplerCreateInfo samplerCreateInfo{};
 	samplerCreateInfo.setPNext( nullptr );
@@ -162,12 +163,12 @@ bool VulkanImage::CreateSampler( vk::Filter magFilter, vk::Filter minFilter, vk:
 	samplerCreateInfo.setAddressModeV( addressMode );
 	samplerCreateInfo.setAddressModeW( addressMode );
 	samplerCreateInfo.setMipLodBias( 0.0f );
-	samplerCreateInfo.setAnisotropyEnable( false );
-	samplerCreateInfo.setMaxAnisotropy( 1 );
+	samplerCreateInfo.setAnisotropyEnable( maxAnisotropy > 1.0f );
+	samplerCreateInfo.setMaxAnisotropy( std::max( maxAnisotropy, 1.0f ) );
 	samplerCreateInfo.setCompareEnable( false );
 	samplerCreateInfo.setCompareOp( vk::CompareOp::eAlways );
 	samplerCreateInfo.setMinLod( 0.0f );
-	samplerCreateInfo.setMaxLod( 0.0f );
+	samplerCreateInfo.setMaxLod( float( m_MipLevels - 1 ) );
 	samplerCreateInfo.setBorderColor( vk::BorderColor::eIntOpaqueBlack );
 	samplerCreateInfo.setUnnormalizedCoordinates( false );
 
@@ -188,7 +189,7 @@ void lh2core::VulkanImage::TransitionToLayout( vk::ImageLayout dstLayout, vk::Ac
 	barrier.setSrcQueueFamilyIndex( VK_QUEUE_FAMILY_IGNORED );
 	barrier.setDstQueueFamilyIndex( VK_QUEUE_FAMILY_IGNORED );
 	barrier.setImage( m_Image );
-	barrier.setSubresourceRange( {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1} );
+	barrier.setSubresourceRange( {vk::ImageAspectFlagBits::eColor, 0, m_MipLevels, 0, 1} );
 
 	if ( !cmdBuffer )
 	{
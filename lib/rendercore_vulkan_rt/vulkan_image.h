@@ -21,7 +21,7 @@ class VulkanImage
 {
   public:
 	VulkanImage( const VulkanDevice &device, vk::ImageType type, vk::Format format, vk::Extent3D extent,
-				 vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags memProps );
+				 vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags memProps, uint32_t mipLevels = 1 );
 	~VulkanImage();
 
 	void Cleanup();
@@ -31,17 +31,19 @@ class VulkanImage
 	{
 		return SetData( data.data(), width, height, sizeof( T ) );
 	}
+	// Uploads all MIP levels; data holds the levels one after the other, each half the size of the previous one
 	bool SetData( const void *data, uint32_t width, uint32_t height, uint32_t stride );
 	bool CreateImageView( vk::ImageViewType viewType, vk::Format format, vk::ImageSubresourceRange subresourceRange );
-	bool CreateSampler( vk::Filter magFilter, vk::Filter minFilter, vk::SamplerMipmapMode mipmapMode, vk::SamplerAddressMode addressMode );
+	bool CreateSampler( vk::Filter magFilter, vk::Filter minFilter, vk::SamplerMipmapMode mipmapMode, vk::SamplerAddressMode addressMode, float maxAnisotropy = 1.0f );
 	void TransitionToLayout( vk::ImageLayout layout, vk::AccessFlags dstAccessMask, vk::CommandBuffer cmdBuffer = nullptr );
 	vk::DescriptorImageInfo GetDescriptorImageInfo() const;
 
 	vk::Extent3D GetExtent() const { return m_Extent; }
+	uint32_t GetMipLevels() const { return m_MipLevels; }
 	vk::Image GetImage() const { return m_Image; }
 	vk::ImageView GetImageView() const { return m_ImageView; }
 	vk::Sampler GetSampler() const { return m_Sampler; }
-	vk::DeviceMemory GetMemory() const { return m_Memory; }
+	vk::DeviceMemory GetMemory() const { return m_Allocation.memory; }
 
 	operator vk::Image() const { return m_Image; }
 	operator vk::ImageView() const { return m_ImageView; }
@@ -51,8 +53,9 @@ class VulkanImage
 	vk::ImageLayout m_CurLayout = vk::ImageLayout::eUndefined;
 	VulkanDevice m_Device;
 	vk::Extent3D m_Extent;
+	uint32_t m_MipLevels = 1;
 	vk::Image m_Image = nullptr;
-	vk::DeviceMemory m_Memory = nullptr;
+	VulkanAllocation m_Allocation{};
 	vk::ImageView m_ImageView = nullptr;
 	vk::Sampler m_Sampler = nullptr;
 };
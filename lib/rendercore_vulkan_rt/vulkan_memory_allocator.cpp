@@ -0,0 +1,224 @@
+/* vulkan_memory_allocator.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+namespace lh2core
+{
+
+VulkanMemoryAllocator::VulkanMemoryAllocator( vk::Device device, const vk::PhysicalDeviceMemoryProperties &memProps )
+	: m_Device( device ), m_MemProps( memProps )
+{
+}
+
+VulkanMemoryAllocator::~VulkanMemoryAllocator()
+{
+	Cleanup();
+}
+
+void VulkanMemoryAllocator::Cleanup()
+{
+	for ( uint32_t i = 0; i < m_Blocks.size(); i++ )
+		if ( m_Blocks[i] ) ReleaseBlock( i );
+	m_Blocks.clear();
+}
+
+VulkanAllocation VulkanMemoryAllocator::Allocate( const vk::MemoryRequirements &memReqs, uint32_t memoryType, AllocationStrategy strategy, bool image )
+{
+	VulkanAllocation allocation{};
+	const vk::DeviceSize size = std::max( memReqs.size, memReqs.alignment );
+
+	// Large resources get a block of their own
+	if ( size > BLOCK_SIZE / 2 )
+	{
+		allocation.block = CreateBlock( memReqs.size, memoryType, strategy, image, true );
+		MemoryBlock &block = *m_Blocks[allocation.block];
+		block.used = block.size, block.allocations = 1;
+		allocation.memory = block.memory;
+		allocation.size = memReqs.size;
+		allocation.mapped = block.mapped;
+		return allocation;
+	}
+
+	// Buddy ranges are aligned to their own size, which covers the alignment requirement
+	uint32_t order = MIN_ORDER;
+	while (( vk::DeviceSize( 1 ) << order ) < size) order++;
+	order -= MIN_ORDER;
+
+	for ( uint32_t pass = 0; pass < 2; pass++ )
+	{
+		for ( uint32_t i = 0; i < m_Blocks.size(); i++ )
+		{
+			MemoryBlock *block = m_Blocks[i];
+			if ( !block || block->dedicated || block->memoryType != memoryType || block->strategy != strategy || block->image != image ) continue;
+			vk::DeviceSize offset = 0;
+			if ( strategy == BuddyAllocation )
+			{
+				if ( !AllocateBuddy( *block, order, offset ) ) continue;
+				block->used += vk::DeviceSize( 1 ) << ( order + MIN_ORDER );
+			}
+			else
+			{
+				offset = ( block->top + memReqs.alignment - 1 ) / memReqs.alignment * memReqs.alignment;
+				if ( offset + memReqs.size > block->size ) continue;
+				block->used += offset + memReqs.size - block->top;
+				block->top = offset + memReqs.size;
+			}
+			block->allocations++;
+			allocation.memory = block->memory;
+			allocation.offset = offset;
+			allocation.size = memReqs.size;
+			allocation.mapped = block->mapped ? (uint8_t *)block->mapped + offset : nullptr;
+			allocation.block = i;
+			allocation.order = order;
+			return allocation;
+		}
+		// No block had room; add one and retry
+		CreateBlock( BLOCK_SIZE, memoryType, strategy, image, false );
+	}
+	FATALERROR( "Could not sub-allocate device memory." );
+	return allocation;
+}
+
+void VulkanMemoryAllocator::Free( VulkanAllocation &allocation )
+{
+	if ( !allocation ) return;
+	MemoryBlock &block = *m_Blocks[allocation.block];
+	assert( block.memory == allocation.memory && block.allocations > 0 );
+	block.allocations--;
+	if ( block.dedicated )
+	{
+		ReleaseBlock( allocation.block );
+	}
+	else if ( block.strategy == BuddyAllocation )
+	{
+		FreeBuddy( block, allocation.offset, allocation.order );
+		block.used -= vk::DeviceSize( 1 ) << ( allocation.order + MIN_ORDER );
+	}
+	else
+	{
+		// Freeing the top of the stack gives its memory back; anything else waits until the block is empty
+		if ( allocation.offset + allocation.size == block.top ) block.used -= block.top - allocation.offset, block.top = allocation.offset;
+		if ( block.allocations == 0 ) block.top = 0, block.used = 0;
+	}
+
+	// Empty blocks are returned to the driver, unless it is the last one of its pool
+	if ( m_Blocks[allocation.block] && block.allocations == 0 )
+	{
+		for ( uint32_t i = 0; i < m_Blocks.size(); i++ )
+		{
+			const MemoryBlock *other = m_Blocks[i];
+			if ( i == allocation.block || !other || other->dedicated ) continue;
+			if ( other->memoryType == block.memoryType && other->strategy == block.strategy && other->image == block.image )
+			{
+				ReleaseBlock( allocation.block );
+				break;
+			}
+		}
+	}
+	allocation = VulkanAllocation();
+}
+
+uint32_t VulkanMemoryAllocator::CreateBlock( vk::DeviceSize size, uint32_t memoryType, AllocationStrategy strategy, bool image, bool dedicated )
+{
+	MemoryBlock *block = new MemoryBlock();
+	block->size = size;
+	block->memoryType = memoryType;
+	block->strategy = strategy;
+	block->image = image;
+	block->dedicated = dedicated;
+	block->memory = m_Device.allocateMemory( vk::MemoryAllocateInfo( size, memoryType ) );
+	if ( !block->memory ) FATALERROR( "Could not allocate device memory block." );
+
+	// Host visible blocks are mapped once, a memory object can only be mapped once at a time
+	const auto flags = m_MemProps.memoryTypes[memoryType].propertyFlags;
+	if ( flags & vk::MemoryPropertyFlagBits::eHostVisible ) block->mapped = m_Device.mapMemory( block->memory, 0, VK_WHOLE_SIZE );
+	if ( !dedicated && strategy == BuddyAllocation ) block->free[ORDERS - 1].insert( 0 );
+
+	// Reuse a slot of a released block
+	for ( uint32_t i = 0; i < m_Blocks.size(); i++ )
+		if ( !m_Blocks[i] ) return m_Blocks[i] = block, i;
+	m_Blocks.push_back( block );
+	return (uint32_t)m_Blocks.size() - 1;
+}
+
+void VulkanMemoryAllocator::ReleaseBlock( uint32_t idx )
+{
+	MemoryBlock *block = m_Blocks[idx];
+	if ( block->mapped ) m_Device.unmapMemory( block->memory );
+	m_Device.freeMemory( block->memory );
+	delete block;
+	m_Blocks[idx] = nullptr;
+}
+
+bool VulkanMemoryAllocator::AllocateBuddy( MemoryBlock &block, uint32_t order, vk::DeviceSize &offset )
+{
+	// Find the smallest free range that fits, then split it down to the requested order
+	uint32_t o = order;
+	while (o < ORDERS && block.free[o].empty()) o++;
+	if ( o == ORDERS ) return false;
+	offset = *block.free[o].begin();
+	block.free[o].erase( block.free[o].begin() );
+	while (o > order)
+	{
+		o--;
+		block.free[o].insert( offset + ( vk::DeviceSize( 1 ) << ( o + MIN_ORDER ) ) ); // Upper half stays free
+	}
+	return true;
+}
+
+void VulkanMemoryAllocator::FreeBuddy( MemoryBlock &block, vk::DeviceSize offset, uint32_t order )
+{
+	// Merge with the buddy range for as long as it is free
+	while (order < ORDERS - 1)
+	{
+		const vk::DeviceSize buddy = offset ^ ( vk::DeviceSize( 1 ) << ( order + MIN_ORDER ) );
+		auto it = block.free[order].find( buddy );
+		if ( it == block.free[order].end() ) break;
+		block.free[order].erase( it );
+		offset = std::min( offset, buddy );
+		order++;
+	}
+	block.free[order].insert( offset );
+}
+
+void VulkanMemoryAllocator::DumpPools() const
+{
+	vk::DeviceSize totalSize = 0, totalUsed = 0;
+	printf( "Vulkan memory pools:\n" );
+	for ( uint32_t i = 0; i < m_Blocks.size(); i++ )
+	{
+		const MemoryBlock *block = m_Blocks[i];
+		if ( !block ) continue;
+		totalSize += block->size, totalUsed += block->used;
+		const char *kind = block->dedicated ? "dedicated" : block->strategy == BuddyAllocation ? "buddy" : "linear";
+		// Largest range that can still be handed out, a measure of fragmentation
+		vk::DeviceSize largestFree = 0;
+		if ( !block->dedicated && block->strategy == LinearAllocation ) largestFree = block->size - block->top;
+		else if ( !block->dedicated )
+			for ( int o = ORDERS - 1; o >= 0; o-- )
+				if ( !block->free[o].empty() )
+				{
+					largestFree = vk::DeviceSize( 1 ) << ( o + MIN_ORDER );
+					break;
+				}
+		printf( "  block %3i: type %2i %-9s %-6s %8.2fMB, %8.2fMB used by %5i allocations, largest free range %8.2fMB\n", i, block->memoryType, kind,
+				block->image ? "images" : "buffers", block->size / ( 1024.0f * 1024.0f ), block->used / ( 1024.0f * 1024.0f ), block->allocations,
+				largestFree / ( 1024.0f * 1024.0f ) );
+	}
+	printf( "  total: %.2fMB reserved, %.2fMB used\n", totalSize / ( 1024.0f * 1024.0f ), totalUsed / ( 1024.0f * 1024.0f ) );
+}
+
+} // namespace lh2core
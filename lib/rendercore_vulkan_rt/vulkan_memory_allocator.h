@@ -0,0 +1,86 @@
+/* vulkan_memory_allocator.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+enum AllocationStrategy
+{
+	BuddyAllocation,  // Power-of-two blocks that are merged again when freed, for long lived resources
+	LinearAllocation, // Stack-wise allocation, for short lived resources such as staging buffers
+};
+
+// A range of a memory block; memory and offset are what gets bound to a buffer or image
+struct VulkanAllocation
+{
+	vk::DeviceMemory memory = nullptr;
+	vk::DeviceSize offset = 0, size = 0;
+	void *mapped = nullptr; // Host pointer for host visible memory, blocks stay mapped
+	uint32_t block = 0;		// Index of the owning block in the allocator
+	uint32_t order = 0;		// Buddy order of the range
+
+	operator bool() const { return memory; }
+};
+
+/*
+ * Sub-allocates device memory from large blocks, one pool of blocks per memory type
+ * and strategy. Images and buffers never share a block, so bufferImageGranularity
+ * does not need to be respected. Allocations that are larger than half a block get
+ * a dedicated block.
+ */
+class VulkanMemoryAllocator
+{
+  public:
+	VulkanMemoryAllocator( vk::Device device, const vk::PhysicalDeviceMemoryProperties &memProps );
+	~VulkanMemoryAllocator();
+
+	VulkanAllocation Allocate( const vk::MemoryRequirements &memReqs, uint32_t memoryType, AllocationStrategy strategy = BuddyAllocation, bool image = false );
+	void Free( VulkanAllocation &allocation );
+	void Cleanup();
+	void DumpPools() const; // Print occupancy of all blocks
+
+  private:
+	static constexpr uint32_t BLOCK_ORDER = 26; // Blocks of 64MB
+	static constexpr uint32_t MIN_ORDER = 8;	  // Smallest buddy range is 256 bytes
+	static constexpr uint32_t ORDERS = BLOCK_ORDER - MIN_ORDER + 1;
+	static constexpr vk::DeviceSize BLOCK_SIZE = vk::DeviceSize( 1 ) << BLOCK_ORDER;
+
+	struct MemoryBlock
+	{
+		vk::DeviceMemory memory = nullptr;
+		vk::DeviceSize size = 0;
+		void *mapped = nullptr;
+		uint32_t memoryType = 0;
+		AllocationStrategy strategy = BuddyAllocation;
+		bool image = false, dedicated = false;
+		vk::DeviceSize used = 0;				// Bytes handed out, including buddy and alignment padding
+		uint32_t allocations = 0;				// Live allocations
+		vk::DeviceSize top = 0;					// Linear: first free byte
+		std::set<vk::DeviceSize> free[ORDERS]; // Buddy: free range offsets per order
+	};
+
+	uint32_t CreateBlock( vk::DeviceSize size, uint32_t memoryType, AllocationStrategy strategy, bool image, bool dedicated );
+	void ReleaseBlock( uint32_t idx );
+	bool AllocateBuddy( MemoryBlock &block, uint32_t order, vk::DeviceSize &offset );
+	void FreeBuddy( MemoryBlock &block, vk::DeviceSize offset, uint32_t order );
+
+	vk::Device m_Device;
+	vk::PhysicalDeviceMemoryProperties m_MemProps;
+	std::vector<MemoryBlock *> m_Blocks; // Released blocks leave a nullptr so indices stay valid
+};
+
+} // namespace lh2core
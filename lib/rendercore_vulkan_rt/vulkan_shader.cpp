@@ -127,7 +127,16 @@ VulkanShader::VulkanShader( const VulkanDevice &device, const std::string_view &
 		const std::string sourceString = ReadTextFile( fileLocation );			  // Get source of shader
 		const auto kind = InferKindFromFileName( fileLocation );				  // Infer shader kind
 		const auto result = PreprocessShader( fileLocation, sourceString, kind ); // Preprocess source file
-		const auto binary = CompileFile( fileLocation, result, kind );			  // Produce SPIR-V binary
+
+		// The preprocessed source includes all headers and definitions, so its hash identifies the binary
+		const std::string cacheLocation = fileLocation + ".spvcache";
+		const uint64_t key = HashSource( result, kind );
+		std::vector<uint32_t> binary;
+		if ( !ReadCachedBinary( cacheLocation, key, binary ) )
+		{
+			binary = CompileFile( fileLocation, result, kind ); // Produce SPIR-V binary
+			WriteCachedBinary( cacheLocation, key, binary );
+		}
 
 		m_Module = m_Device->createShaderModule( vk::ShaderModuleCreateInfo( {}, binary.size() * sizeof( uint32_t ), binary.data() ) );
 		if ( !m_Module )
@@ -183,6 +192,48 @@ std::vector<char> VulkanShader::ReadFile( const std::string_view &fileName )
 	return data;
 }
 
+uint64_t VulkanShader::HashSource( const std::string &source, shaderc_shader_kind shaderKind )
+{
+	// 64-bit FNV-1a over the shader kind and the preprocessed source
+	uint64_t hash = 14695981039346656037ull;
+	const auto combine = [&hash]( const uint8_t byte ) { hash = ( hash ^ byte ) * 1099511628211ull; };
+	for ( int i = 0; i < 4; i++ )
+		combine( (uint8_t)( (uint32_t)shaderKind >> ( i * 8 ) ) );
+	for ( const char c : source )
+		combine( (uint8_t)c );
+	return hash;
+}
+
+bool VulkanShader::ReadCachedBinary( const std::string &fileName, const uint64_t key, std::vector<uint32_t> &binary )
+{
+	std::ifstream fileStream( fileName.data(), std::ios::binary | std::ios::in | std::ios::ate );
+	if ( !fileStream.is_open() )
+		return false;
+
+	// Layout: 64-bit source hash, followed by the SPIR-V words
+	const size_t size = fileStream.tellg();
+	if ( size <= sizeof( uint64_t ) || ( size - sizeof( uint64_t ) ) % sizeof( uint32_t ) != 0 )
+		return false;
+	uint64_t storedKey = 0;
+	fileStream.seekg( 0, std::ios::beg );
+	fileStream.read( (char *)&storedKey, sizeof( uint64_t ) );
+	if ( storedKey != key )
+		return false;
+	binary.resize( ( size - sizeof( uint64_t ) ) / sizeof( uint32_t ) );
+	fileStream.read( (char *)binary.data(), binary.size() * sizeof( uint32_t ) );
+	return fileStream.good();
+}
+
+void VulkanShader::WriteCachedBinary( const std::string &fileName, const uint64_t key, const std::vector<uint32_t> &binary )
+{
+	// Failing to write the cache is not an error; the shader is simply compiled again next time
+	std::ofstream fileStream( fileName.data(), std::ios::binary | std::ios::out | std::ios::trunc );
+	if ( !fileStream.is_open() )
+		return;
+	fileStream.write( (const char *)&key, sizeof( uint64_t ) );
+	fileStream.write( (const char *)binary.data(), binary.size() * sizeof( uint32_t ) );
+}
+
 std::string VulkanShader::ReadTextFile( const std::string_view &fileName )
 {
 	std::string buffer;
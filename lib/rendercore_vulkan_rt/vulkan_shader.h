@@ -83,6 +83,9 @@ class VulkanShader
 
 	static std::vector<char> ReadFile( const std::string_view &fileName );
 	static std::string ReadTextFile( const std::string_view &fileName );
+	static uint64_t HashSource( const std::string &source, shaderc_shader_kind shaderKind );
+	static bool ReadCachedBinary( const std::string &fileName, const uint64_t key, std::vector<uint32_t> &binary );
+	static void WriteCachedBinary( const std::string &fileName, const uint64_t key, const std::vector<uint32_t> &binary );
 };
 
 } // namespace lh2core
\ No newline at end of file
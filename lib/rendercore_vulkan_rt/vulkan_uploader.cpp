@@ -0,0 +1,194 @@
+/* vulkan_uploader.cpp - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core_settings.h"
+
+namespace lh2core
+{
+
+VulkanUploader::VulkanUploader( VulkanDevice device ) : m_Device( device )
+{
+	const QueueFamilyIndices &indices = m_Device.GetQueueIndices();
+	m_TransferFamily = indices.transferIdx.value();
+	m_GraphicsFamily = indices.graphicsIdx.value();
+
+	// The ring outlives the staging buffers of the linear pool, which are freed from the top and stack on top of it
+	m_Ring = new VulkanCoreBuffer<uint8_t>( m_Device, RING_SIZE, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+											vk::BufferUsageFlagBits::eTransferSrc );
+
+	vk::CommandPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.setPNext( nullptr );
+	poolCreateInfo.setFlags( vk::CommandPoolCreateFlagBits::eResetCommandBuffer );
+	poolCreateInfo.setQueueFamilyIndex( m_TransferFamily );
+	m_TransferPool = m_Device->createCommandPool( poolCreateInfo );
+
+	const auto copies = m_Device->allocateCommandBuffers( vk::CommandBufferAllocateInfo( m_TransferPool, vk::CommandBufferLevel::ePrimary, BATCHES ) );
+	for ( uint32_t i = 0; i < BATCHES; i++ )
+	{
+		Batch &batch = m_Batches[i];
+		batch.copies = copies[i];
+		batch.acquire = m_Device.CreateCommandBuffer();
+		batch.copied = m_Device->createSemaphore( vk::SemaphoreCreateInfo() );
+		batch.done = m_Device->createFence( vk::FenceCreateInfo() );
+	}
+}
+
+VulkanUploader::~VulkanUploader()
+{
+	Cleanup();
+}
+
+void VulkanUploader::Upload( vk::Buffer target, const void *data, vk::DeviceSize size, vk::DeviceSize offset )
+{
+	const uint8_t *src = (const uint8_t *)data;
+	while ( size > 0 )
+	{
+		// Large uploads are split, so a single upload never has to wait for the whole ring
+		const vk::DeviceSize chunk = std::min( size, MAX_CHUNK );
+		const vk::DeviceSize staged = Reserve( chunk );
+		memcpy( m_Ring->Map() + staged, src, chunk );
+
+		Batch &batch = m_Batches[m_Current];
+		batch.copies.copyBuffer( *m_Ring, target, {vk::BufferCopy( staged, offset, chunk )} );
+		if ( batch.targets.empty() || batch.targets.back() != target ) batch.targets.push_back( target );
+		src += chunk, offset += chunk, size -= chunk;
+	}
+}
+
+void VulkanUploader::Flush()
+{
+	Batch &batch = m_Batches[m_Current];
+	if ( !batch.recording ) return;
+
+	// With a dedicated transfer family the targets change owner: released here, acquired by the graphics queue
+	const bool transferOwnership = m_TransferFamily != m_GraphicsFamily;
+	std::vector<vk::BufferMemoryBarrier> barriers;
+	for ( const vk::Buffer target : batch.targets )
+	{
+		barriers.emplace_back( vk::AccessFlagBits::eTransferWrite, vk::AccessFlags(), transferOwnership ? m_TransferFamily : VK_QUEUE_FAMILY_IGNORED,
+							   transferOwnership ? m_GraphicsFamily : VK_QUEUE_FAMILY_IGNORED, target, 0, VK_WHOLE_SIZE );
+	}
+	if ( transferOwnership )
+		batch.copies.pipelineBarrier( vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), {}, barriers, {} );
+	batch.copies.end();
+
+	// The acquire makes the copies visible to everything the graphics queue does next: BLAS builds, shading, tracing
+	batch.acquire.begin( vk::CommandBufferBeginInfo( vk::CommandBufferUsageFlagBits::eOneTimeSubmit ) );
+	for ( auto &barrier : barriers )
+	{
+		barrier.setSrcAccessMask( transferOwnership ? vk::AccessFlags() : vk::AccessFlagBits::eTransferWrite );
+		barrier.setDstAccessMask( vk::AccessFlagBits::eMemoryRead );
+	}
+	batch.acquire.pipelineBarrier( transferOwnership ? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands,
+								   vk::DependencyFlags(), {}, barriers, {} );
+	batch.acquire.end();
+
+	vk::SubmitInfo copySubmit{};
+	copySubmit.setCommandBufferCount( 1 );
+	copySubmit.setPCommandBuffers( &batch.copies );
+	copySubmit.setSignalSemaphoreCount( 1 );
+	copySubmit.setPSignalSemaphores( &batch.copied );
+	m_Device.GetTransferQueue().submit( {copySubmit}, nullptr );
+
+	const vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+	vk::SubmitInfo acquireSubmit{};
+	acquireSubmit.setWaitSemaphoreCount( 1 );
+	acquireSubmit.setPWaitSemaphores( &batch.copied );
+	acquireSubmit.setPWaitDstStageMask( &waitStage );
+	acquireSubmit.setCommandBufferCount( 1 );
+	acquireSubmit.setPCommandBuffers( &batch.acquire );
+	m_Device.GetGraphicsQueue().submit( {acquireSubmit}, batch.done );
+
+	batch.recording = false, batch.pending = true;
+	m_Current = ( m_Current + 1 ) % BATCHES;
+}
+
+void VulkanUploader::Retire( vk::Buffer target )
+{
+	const auto writes = [target]( const Batch &batch ) { return std::find( batch.targets.begin(), batch.targets.end(), target ) != batch.targets.end(); };
+	if ( m_Batches[m_Current].recording && writes( m_Batches[m_Current] ) ) Flush();
+	for ( auto &batch : m_Batches )
+		if ( batch.pending && writes( batch ) ) Complete( batch );
+}
+
+void VulkanUploader::WaitIdle()
+{
+	Flush();
+	for ( auto &batch : m_Batches )
+		if ( batch.pending ) Complete( batch );
+}
+
+void VulkanUploader::Cleanup()
+{
+	if ( !m_Ring ) return;
+	WaitIdle();
+	for ( auto &batch : m_Batches )
+	{
+		m_Device.FreeCommandBuffer( batch.acquire );
+		m_Device->destroySemaphore( batch.copied );
+		m_Device->destroyFence( batch.done );
+		batch = Batch();
+	}
+	m_Device->destroyCommandPool( m_TransferPool ); // Frees the copy command buffers
+	m_TransferPool = nullptr;
+	delete m_Ring;
+	m_Ring = nullptr;
+}
+
+vk::DeviceSize VulkanUploader::Reserve( vk::DeviceSize size )
+{
+	size = ( size + 15 ) & ~vk::DeviceSize( 15 );
+	if ( m_Head + size > RING_SIZE )
+	{
+		// A batch uses a contiguous range of the ring; wrap around in a new one
+		Flush();
+		m_Head = 0;
+	}
+
+	// Staged data of earlier batches must be copied before it is overwritten
+	for ( auto &batch : m_Batches )
+		if ( batch.pending && batch.begin < m_Head + size && m_Head < batch.end ) Complete( batch );
+
+	Batch &batch = Current();
+	const vk::DeviceSize offset = m_Head;
+	m_Head += size;
+	batch.end = m_Head;
+	return offset;
+}
+
+VulkanUploader::Batch &VulkanUploader::Current()
+{
+	Batch &batch = m_Batches[m_Current];
+	if ( !batch.recording )
+	{
+		if ( batch.pending ) Complete( batch ); // All batches are in flight; reuse the oldest
+		batch.copies.begin( vk::CommandBufferBeginInfo( vk::CommandBufferUsageFlagBits::eOneTimeSubmit ) );
+		batch.begin = batch.end = m_Head;
+		batch.recording = true;
+	}
+	return batch;
+}
+
+void VulkanUploader::Complete( Batch &batch )
+{
+	CheckVK( m_Device->waitForFences( 1, &batch.done, true, UINT64_MAX ) );
+	CheckVK( m_Device->resetFences( 1, &batch.done ) );
+	batch.targets.clear();
+	batch.pending = false;
+}
+
+} // namespace lh2core
+
+// EOF
\ No newline at end of file
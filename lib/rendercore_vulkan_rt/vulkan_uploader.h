@@ -0,0 +1,71 @@
+/* vulkan_uploader.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+namespace lh2core
+{
+
+/*
+ * Streams data into device local buffers through the transfer queue, which is a dedicated
+ * queue family when the device has one. Data is staged in a persistently mapped ring; the
+ * copies of a batch are submitted by Flush, which does not wait on the host. The graphics
+ * queue waits for the batch with a semaphore and acquires the target buffers, so work that
+ * is submitted to it after Flush (batched BLAS builds, rendering) sees the data.
+ * Uploads are meant for buffers that the GPU does not use yet: the transfer queue does not
+ * wait for earlier reads of the graphics queue.
+ */
+class VulkanUploader
+{
+  public:
+	VulkanUploader( VulkanDevice device );
+	~VulkanUploader();
+
+	void Upload( vk::Buffer target, const void *data, vk::DeviceSize size, vk::DeviceSize offset = 0 );
+	void Flush();					  // Submit the pending copies
+	void Retire( vk::Buffer target ); // Wait for pending copies into target, before it is destroyed
+	void WaitIdle();				  // Wait for all submitted copies
+	void Cleanup();
+
+  private:
+	static constexpr vk::DeviceSize RING_SIZE = 32 * 1024 * 1024; // Staging memory; larger uploads are split
+	static constexpr vk::DeviceSize MAX_CHUNK = RING_SIZE / 4;	   // Largest copy per batch
+	static constexpr uint32_t BATCHES = 4;						   // Batches in flight
+
+	struct Batch
+	{
+		vk::CommandBuffer copies;			// Transfer queue: copies and the release of the targets
+		vk::CommandBuffer acquire;			// Graphics queue: acquire of the targets
+		vk::Semaphore copied;				// Signaled by copies, waited for by acquire
+		vk::Fence done;						// Signaled by acquire, which completes after copies
+		vk::DeviceSize begin = 0, end = 0;	// Range of the ring used by the copies
+		std::vector<vk::Buffer> targets;	// Buffers written by the copies
+		bool recording = false, pending = false;
+	};
+
+	vk::DeviceSize Reserve( vk::DeviceSize size );
+	Batch &Current();
+	void Complete( Batch &batch );
+
+	VulkanDevice m_Device;
+	VulkanCoreBuffer<uint8_t> *m_Ring = nullptr;
+	vk::CommandPool m_TransferPool = nullptr; // Command buffers for the transfer queue family
+	uint32_t m_TransferFamily = 0, m_GraphicsFamily = 0;
+	Batch m_Batches[BATCHES];
+	uint32_t m_Current = 0;		// Batch that records new copies
+	vk::DeviceSize m_Head = 0; // First free byte of the ring
+};
+
+} // namespace lh2core
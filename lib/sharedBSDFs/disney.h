@@ -183,6 +183,16 @@ LH2_DEVFUNC float3 BSDFEval( const ShadingData shadingData, const float3 N, cons
 			const float3 Fs = disney_lerp( Cspec0, make_float3( 1.0f ), FH );
 			const float Gs = SmithGGX( NDotV, a ) * SmithGGX( NDotL, a );
 
+			// multiscatter energy compensation: the lobe loses the light that scatters between microfacets;
+			// scaling it by 1 + F0 (1 - E) / E, with E its directional albedo, restores that energy (Turquin 2019).
+			// GGXALBEDO( cosTheta, alpha ) is provided by the core, see ggx_albedo.h.
+		#ifdef GGXALBEDO
+			const float Ess = max( 0.01f, GGXALBEDO( NDotV, a ) );
+			const float3 Ems = make_float3( 1.0f ) + Cspec0 * ((1.0f - Ess) / Ess);
+		#else
+			const float3 Ems = make_float3( 1.0f );
+		#endif
+
 			// Diffuse fresnel - go from 1 at normal incidence to .5 at grazing
 			// and mix in diffuse retro-reflection based on roughness
 			const float FL = SchlickFresnel( NDotL ), FV = SchlickFresnel( NDotV );
@@ -194,7 +204,7 @@ LH2_DEVFUNC float3 BSDFEval( const ShadingData shadingData, const float3 N, cons
 			const float Fc = disney_lerp( .04f, 1.0f, FH );
 			const float Gr = SmithGGX( NDotL, .25 ) * SmithGGX( NDotV, .25 );
 
-			brdf = INVPI * Fd * Cdlin * (1.0f - METALLIC) * (1.0f - SUBSURFACE) + Gs * Fs * Ds + CLEARCOAT * Gr * Fc * Dr;
+			brdf = INVPI * Fd * Cdlin * (1.0f - METALLIC) * (1.0f - SUBSURFACE) + Gs * Fs * Ds * Ems + CLEARCOAT * Gr * Fc * Dr;
 		}
 	}
 
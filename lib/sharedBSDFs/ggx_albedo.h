@@ -0,0 +1,65 @@
+/* ggx_albedo.h - Copyright 2019 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Directional albedo of the single scattering GGX specular lobe in
+   disney.h, with a white Fresnel term: the fraction of the light arriving
+   from direction wo that leaves the surface after one microfacet bounce.
+   Row j holds alpha = (j + 0.5) / GGXALBEDORES, column i holds
+   cos theta = (i + 0.5) / GGXALBEDORES, so linear filtering with
+   normalized coordinates (cos theta, alpha) interpolates the table.
+   Integrated offline by importance sampling the GGX NDF (1M samples per
+   entry). Host data; cores upload it, see GGXALBEDO in disney.h.
+*/
+
+#ifndef GGX_ALBEDO_H
+#define GGX_ALBEDO_H
+
+static const float ggxAlbedoTable[GGXALBEDORES * GGXALBEDORES] = {
+	0.8766f, 0.9419f, 0.9749f, 0.9869f, 0.9921f, 0.9947f, 0.9962f, 0.9971f, 0.9977f, 0.9982f, 0.9985f, 0.9987f, 0.9989f, 0.9991f, 0.9992f, 0.9993f, 0.9994f, 0.9994f, 0.9995f, 0.9995f, 0.9996f, 0.9996f, 0.9997f, 0.9997f, 0.9997f, 0.9997f, 0.9997f, 0.9998f, 0.9998f, 0.9998f, 1.0000f, 1.0000f,
+	0.8969f, 0.8761f, 0.8944f, 0.9202f, 0.9413f, 0.9565f, 0.9671f, 0.9745f, 0.9798f, 0.9836f, 0.9865f, 0.9887f, 0.9904f, 0.9917f, 0.9927f, 0.9936f, 0.9943f, 0.9948f, 0.9953f, 0.9957f, 0.9960f, 0.9962f, 0.9964f, 0.9965f, 0.9965f, 0.9967f, 0.9969f, 0.9971f, 0.9973f, 0.9975f, 0.9976f, 0.9975f,
+	0.9065f, 0.8806f, 0.8746f, 0.8832f, 0.8979f, 0.9134f, 0.9275f, 0.9394f, 0.9491f, 0.9570f, 0.9633f, 0.9683f, 0.9724f, 0.9756f, 0.9782f, 0.9803f, 0.9819f, 0.9836f, 0.9851f, 0.9864f, 0.9875f, 0.9884f, 0.9892f, 0.9898f, 0.9903f, 0.9908f, 0.9913f, 0.9917f, 0.9921f, 0.9924f, 0.9927f, 0.9930f,
+	0.9094f, 0.8873f, 0.8743f, 0.8716f, 0.8763f, 0.8853f, 0.8960f, 0.9068f, 0.9170f, 0.9261f, 0.9341f, 0.9409f, 0.9469f, 0.9525f, 0.9573f, 0.9614f, 0.9649f, 0.9678f, 0.9703f, 0.9724f, 0.9744f, 0.9762f, 0.9777f, 0.9790f, 0.9801f, 0.9812f, 0.9821f, 0.9830f, 0.9837f, 0.9844f, 0.9850f, 0.9856f,
+	0.9089f, 0.8902f, 0.8758f, 0.8679f, 0.8659f, 0.8684f, 0.8739f, 0.8811f, 0.8889f, 0.8970f, 0.9056f, 0.9136f, 0.9209f, 0.9275f, 0.9333f, 0.9384f, 0.9431f, 0.9473f, 0.9510f, 0.9543f, 0.9572f, 0.9599f, 0.9622f, 0.9643f, 0.9662f, 0.9679f, 0.9694f, 0.9708f, 0.9720f, 0.9732f, 0.9742f, 0.9751f,
+	0.9060f, 0.8896f, 0.8753f, 0.8650f, 0.8590f, 0.8569f, 0.8579f, 0.8613f, 0.8671f, 0.8740f, 0.8811f, 0.8882f, 0.8950f, 0.9016f, 0.9080f, 0.9138f, 0.9192f, 0.9241f, 0.9287f, 0.9328f, 0.9366f, 0.9401f, 0.9432f, 0.9461f, 0.9487f, 0.9511f, 0.9532f, 0.9552f, 0.9570f, 0.9587f, 0.9602f, 0.9616f,
+	0.9011f, 0.8862f, 0.8723f, 0.8609f, 0.8526f, 0.8475f, 0.8455f, 0.8470f, 0.8502f, 0.8545f, 0.8595f, 0.8650f, 0.8711f, 0.8771f, 0.8830f, 0.8889f, 0.8944f, 0.8997f, 0.9046f, 0.9093f, 0.9136f, 0.9177f, 0.9214f, 0.9249f, 0.9282f, 0.9312f, 0.9339f, 0.9365f, 0.9389f, 0.9411f, 0.9431f, 0.9450f,
+	0.8946f, 0.8807f, 0.8672f, 0.8553f, 0.8458f, 0.8390f, 0.8358f, 0.8348f, 0.8354f, 0.8373f, 0.8405f, 0.8446f, 0.8491f, 0.8541f, 0.8593f, 0.8645f, 0.8697f, 0.8748f, 0.8798f, 0.8846f, 0.8892f, 0.8935f, 0.8976f, 0.9016f, 0.9052f, 0.9087f, 0.9120f, 0.9150f, 0.9179f, 0.9205f, 0.9231f, 0.9254f,
+	0.8870f, 0.8736f, 0.8604f, 0.8483f, 0.8382f, 0.8309f, 0.8263f, 0.8233f, 0.8219f, 0.8221f, 0.8235f, 0.8258f, 0.8289f, 0.8326f, 0.8367f, 0.8411f, 0.8456f, 0.8502f, 0.8548f, 0.8594f, 0.8639f, 0.8683f, 0.8725f, 0.8766f, 0.8805f, 0.8842f, 0.8878f, 0.8912f, 0.8944f, 0.8975f, 0.9004f, 0.9031f,
+	0.8784f, 0.8653f, 0.8523f, 0.8402f, 0.8298f, 0.8224f, 0.8164f, 0.8119f, 0.8092f, 0.8078f, 0.8075f, 0.8084f, 0.8100f, 0.8124f, 0.8153f, 0.8186f, 0.8222f, 0.8261f, 0.8301f, 0.8342f, 0.8383f, 0.8425f, 0.8465f, 0.8505f, 0.8545f, 0.8583f, 0.8620f, 0.8655f, 0.8690f, 0.8723f, 0.8754f, 0.8785f,
+	0.8690f, 0.8561f, 0.8431f, 0.8310f, 0.8209f, 0.8129f, 0.8059f, 0.8005f, 0.7965f, 0.7938f, 0.7922f, 0.7917f, 0.7920f, 0.7931f, 0.7948f, 0.7970f, 0.7996f, 0.8026f, 0.8058f, 0.8093f, 0.8128f, 0.8165f, 0.8202f, 0.8239f, 0.8276f, 0.8313f, 0.8349f, 0.8385f, 0.8419f, 0.8453f, 0.8486f, 0.8518f,
+	0.8589f, 0.8460f, 0.8331f, 0.8210f, 0.8111f, 0.8024f, 0.7948f, 0.7887f, 0.7837f, 0.7799f, 0.7772f, 0.7754f, 0.7745f, 0.7744f, 0.7750f, 0.7761f, 0.7777f, 0.7797f, 0.7821f, 0.7847f, 0.7876f, 0.7906f, 0.7938f, 0.7971f, 0.8004f, 0.8037f, 0.8071f, 0.8105f, 0.8138f, 0.8171f, 0.8204f, 0.8235f,
+	0.8483f, 0.8353f, 0.8223f, 0.8103f, 0.8004f, 0.7912f, 0.7832f, 0.7763f, 0.7706f, 0.7659f, 0.7622f, 0.7594f, 0.7574f, 0.7562f, 0.7557f, 0.7558f, 0.7563f, 0.7574f, 0.7588f, 0.7606f, 0.7627f, 0.7650f, 0.7675f, 0.7702f, 0.7730f, 0.7759f, 0.7789f, 0.7819f, 0.7849f, 0.7880f, 0.7910f, 0.7941f,
+	0.8372f, 0.8240f, 0.8110f, 0.7992f, 0.7889f, 0.7793f, 0.7709f, 0.7635f, 0.7571f, 0.7516f, 0.7471f, 0.7434f, 0.7405f, 0.7383f, 0.7368f, 0.7358f, 0.7355f, 0.7356f, 0.7361f, 0.7370f, 0.7382f, 0.7398f, 0.7416f, 0.7435f, 0.7457f, 0.7480f, 0.7505f, 0.7530f, 0.7557f, 0.7583f, 0.7611f, 0.7638f,
+	0.8257f, 0.8123f, 0.7991f, 0.7874f, 0.7768f, 0.7669f, 0.7581f, 0.7502f, 0.7432f, 0.7371f, 0.7318f, 0.7273f, 0.7236f, 0.7205f, 0.7181f, 0.7163f, 0.7150f, 0.7142f, 0.7138f, 0.7138f, 0.7142f, 0.7150f, 0.7160f, 0.7172f, 0.7187f, 0.7204f, 0.7222f, 0.7242f, 0.7263f, 0.7285f, 0.7308f, 0.7332f,
+	0.8138f, 0.8002f, 0.7868f, 0.7751f, 0.7641f, 0.7541f, 0.7448f, 0.7365f, 0.7290f, 0.7223f, 0.7164f, 0.7112f, 0.7067f, 0.7028f, 0.6996f, 0.6969f, 0.6948f, 0.6931f, 0.6919f, 0.6911f, 0.6907f, 0.6906f, 0.6908f, 0.6913f, 0.6921f, 0.6931f, 0.6942f, 0.6956f, 0.6971f, 0.6987f, 0.7005f, 0.7024f,
+	0.8017f, 0.7878f, 0.7743f, 0.7624f, 0.7511f, 0.7408f, 0.7312f, 0.7225f, 0.7145f, 0.7073f, 0.7008f, 0.6949f, 0.6898f, 0.6852f, 0.6812f, 0.6778f, 0.6749f, 0.6724f, 0.6704f, 0.6688f, 0.6676f, 0.6668f, 0.6662f, 0.6659f, 0.6660f, 0.6662f, 0.6667f, 0.6674f, 0.6682f, 0.6693f, 0.6704f, 0.6717f,
+	0.7893f, 0.7751f, 0.7614f, 0.7493f, 0.7378f, 0.7271f, 0.7172f, 0.7081f, 0.6997f, 0.6920f, 0.6850f, 0.6786f, 0.6728f, 0.6676f, 0.6630f, 0.6589f, 0.6552f, 0.6521f, 0.6493f, 0.6470f, 0.6450f, 0.6434f, 0.6421f, 0.6411f, 0.6404f, 0.6399f, 0.6397f, 0.6397f, 0.6399f, 0.6403f, 0.6408f, 0.6415f,
+	0.7767f, 0.7622f, 0.7484f, 0.7360f, 0.7242f, 0.7132f, 0.7030f, 0.6935f, 0.6847f, 0.6766f, 0.6691f, 0.6622f, 0.6559f, 0.6501f, 0.6449f, 0.6401f, 0.6359f, 0.6320f, 0.6286f, 0.6256f, 0.6229f, 0.6206f, 0.6186f, 0.6169f, 0.6155f, 0.6143f, 0.6134f, 0.6127f, 0.6122f, 0.6119f, 0.6118f, 0.6119f,
+	0.7640f, 0.7492f, 0.7352f, 0.7224f, 0.7104f, 0.6991f, 0.6885f, 0.6787f, 0.6695f, 0.6610f, 0.6531f, 0.6457f, 0.6389f, 0.6327f, 0.6269f, 0.6216f, 0.6167f, 0.6123f, 0.6082f, 0.6046f, 0.6013f, 0.5983f, 0.5956f, 0.5933f, 0.5912f, 0.5893f, 0.5878f, 0.5864f, 0.5853f, 0.5844f, 0.5836f, 0.5831f,
+	0.7511f, 0.7360f, 0.7218f, 0.7087f, 0.6964f, 0.6848f, 0.6740f, 0.6638f, 0.6543f, 0.6454f, 0.6371f, 0.6293f, 0.6221f, 0.6153f, 0.6090f, 0.6032f, 0.5978f, 0.5928f, 0.5882f, 0.5840f, 0.5801f, 0.5765f, 0.5733f, 0.5703f, 0.5676f, 0.5651f, 0.5629f, 0.5610f, 0.5592f, 0.5577f, 0.5563f, 0.5551f,
+	0.7382f, 0.7228f, 0.7084f, 0.6949f, 0.6823f, 0.6705f, 0.6593f, 0.6488f, 0.6390f, 0.6297f, 0.6210f, 0.6129f, 0.6053f, 0.5981f, 0.5914f, 0.5851f, 0.5792f, 0.5737f, 0.5686f, 0.5639f, 0.5594f, 0.5553f, 0.5515f, 0.5479f, 0.5447f, 0.5417f, 0.5389f, 0.5363f, 0.5340f, 0.5319f, 0.5299f, 0.5282f,
+	0.7253f, 0.7095f, 0.6949f, 0.6811f, 0.6682f, 0.6561f, 0.6446f, 0.6338f, 0.6237f, 0.6141f, 0.6051f, 0.5966f, 0.5886f, 0.5810f, 0.5739f, 0.5672f, 0.5609f, 0.5550f, 0.5494f, 0.5442f, 0.5393f, 0.5347f, 0.5303f, 0.5263f, 0.5225f, 0.5190f, 0.5156f, 0.5126f, 0.5097f, 0.5070f, 0.5045f, 0.5022f,
+	0.7123f, 0.6962f, 0.6813f, 0.6673f, 0.6541f, 0.6417f, 0.6299f, 0.6189f, 0.6084f, 0.5985f, 0.5892f, 0.5804f, 0.5720f, 0.5641f, 0.5567f, 0.5496f, 0.5429f, 0.5366f, 0.5306f, 0.5250f, 0.5196f, 0.5146f, 0.5098f, 0.5053f, 0.5011f, 0.4970f, 0.4933f, 0.4897f, 0.4863f, 0.4832f, 0.4802f, 0.4774f,
+	0.6993f, 0.6829f, 0.6678f, 0.6535f, 0.6400f, 0.6273f, 0.6153f, 0.6040f, 0.5932f, 0.5831f, 0.5734f, 0.5643f, 0.5557f, 0.5475f, 0.5397f, 0.5323f, 0.5252f, 0.5186f, 0.5122f, 0.5062f, 0.5005f, 0.4951f, 0.4899f, 0.4850f, 0.4803f, 0.4759f, 0.4717f, 0.4677f, 0.4639f, 0.4603f, 0.4569f, 0.4536f,
+	0.6864f, 0.6697f, 0.6543f, 0.6397f, 0.6260f, 0.6130f, 0.6008f, 0.5892f, 0.5782f, 0.5677f, 0.5578f, 0.5484f, 0.5395f, 0.5310f, 0.5229f, 0.5152f, 0.5079f, 0.5009f, 0.4943f, 0.4879f, 0.4819f, 0.4761f, 0.4706f, 0.4654f, 0.4603f, 0.4555f, 0.4510f, 0.4466f, 0.4424f, 0.4384f, 0.4346f, 0.4310f,
+	0.6735f, 0.6565f, 0.6409f, 0.6260f, 0.6120f, 0.5988f, 0.5863f, 0.5745f, 0.5632f, 0.5526f, 0.5424f, 0.5328f, 0.5236f, 0.5149f, 0.5065f, 0.4986f, 0.4910f, 0.4837f, 0.4768f, 0.4702f, 0.4638f, 0.4578f, 0.4520f, 0.4464f, 0.4411f, 0.4360f, 0.4311f, 0.4264f, 0.4219f, 0.4176f, 0.4134f, 0.4094f,
+	0.6607f, 0.6434f, 0.6275f, 0.6125f, 0.5982f, 0.5848f, 0.5720f, 0.5600f, 0.5485f, 0.5376f, 0.5272f, 0.5174f, 0.5080f, 0.4990f, 0.4904f, 0.4822f, 0.4744f, 0.4669f, 0.4597f, 0.4529f, 0.4463f, 0.4400f, 0.4339f, 0.4281f, 0.4225f, 0.4171f, 0.4120f, 0.4070f, 0.4022f, 0.3976f, 0.3932f, 0.3890f,
+	0.6480f, 0.6305f, 0.6143f, 0.5990f, 0.5846f, 0.5709f, 0.5579f, 0.5456f, 0.5340f, 0.5229f, 0.5123f, 0.5022f, 0.4926f, 0.4834f, 0.4747f, 0.4663f, 0.4582f, 0.4505f, 0.4432f, 0.4361f, 0.4293f, 0.4228f, 0.4165f, 0.4105f, 0.4047f, 0.3991f, 0.3937f, 0.3885f, 0.3835f, 0.3787f, 0.3740f, 0.3695f,
+	0.6354f, 0.6176f, 0.6012f, 0.5857f, 0.5710f, 0.5572f, 0.5440f, 0.5315f, 0.5196f, 0.5083f, 0.4976f, 0.4873f, 0.4775f, 0.4682f, 0.4592f, 0.4507f, 0.4425f, 0.4346f, 0.4271f, 0.4198f, 0.4128f, 0.4062f, 0.3997f, 0.3935f, 0.3875f, 0.3818f, 0.3762f, 0.3708f, 0.3656f, 0.3606f, 0.3558f, 0.3511f,
+	0.6229f, 0.6049f, 0.5883f, 0.5726f, 0.5577f, 0.5436f, 0.5303f, 0.5176f, 0.5055f, 0.4941f, 0.4832f, 0.4727f, 0.4628f, 0.4533f, 0.4442f, 0.4355f, 0.4271f, 0.4191f, 0.4114f, 0.4040f, 0.3969f, 0.3901f, 0.3835f, 0.3772f, 0.3710f, 0.3651f, 0.3594f, 0.3539f, 0.3486f, 0.3435f, 0.3385f, 0.3337f,
+	0.6105f, 0.5924f, 0.5755f, 0.5596f, 0.5445f, 0.5303f, 0.5168f, 0.5039f, 0.4917f, 0.4801f, 0.4690f, 0.4585f, 0.4484f, 0.4388f, 0.4295f, 0.4207f, 0.4122f, 0.4041f, 0.3963f, 0.3888f, 0.3816f, 0.3746f, 0.3679f, 0.3615f, 0.3552f, 0.3492f, 0.3434f, 0.3378f, 0.3324f, 0.3272f, 0.3221f, 0.3172f
+};
+
+#endif // GGX_ALBEDO_H
+
+// EOF
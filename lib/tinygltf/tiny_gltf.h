@@ -807,6 +807,7 @@ struct BufferView {
   size_t byteStride;  // minimum 4, maximum 252 (multiple of 4), default 0 =
                       // understood to be tightly packed
   int target;         // ["ARRAY_BUFFER", "ELEMENT_ARRAY_BUFFER"]
+  ExtensionMap extensions;
   Value extras;
   bool dracoDecoded;  // Flag indicating this has been draco decoded
 
@@ -819,6 +820,7 @@ struct BufferView {
                                           byteLength(rhs.byteLength),
                                           byteStride(rhs.byteStride),
                                           target(rhs.target),
+                                          extensions(std::move(rhs.extensions)),
                                           extras(std::move(rhs.extras)),
                                           dracoDecoded(rhs.dracoDecoded) {}
   bool operator==(const BufferView &) const;
@@ -1108,11 +1110,13 @@ struct Buffer {
   Buffer(Buffer &&rhs) noexcept : name(std::move(rhs.name)),
                                   data(std::move(rhs.data)),
                                   uri(std::move(rhs.uri)),
+                                  extensions(std::move(rhs.extensions)),
                                   extras(std::move(rhs.extras)) {}
   std::string name;
   std::vector<unsigned char> data;
   std::string
       uri;  // considered as required here but not in the spec (need to clarify)
+  ExtensionMap extensions;
   Value extras;
 
   bool operator==(const Buffer &) const;
@@ -3795,6 +3799,17 @@ static bool ParseBuffer(Buffer *buffer, std::string *err, const json &o,
   // In glTF 2.0, uri is not mandatory anymore
   buffer->uri.clear();
   ParseStringProperty(&buffer->uri, err, o, "uri", false, "Buffer");
+  ParseExtensionsProperty(&buffer->extensions, err, o);
+
+  // EXT_meshopt_compression fallback buffer without data: reserve the space
+  // that the decoded buffer views will be written to
+  if (buffer->uri.empty() &&
+      buffer->extensions.find("EXT_meshopt_compression") !=
+          buffer->extensions.end()) {
+    buffer->data.resize(byteLength);
+    ParseStringProperty(&buffer->name, err, o, "name", false);
+    return true;
+  }
 
   // having an empty uri for a non embedded image should not be valid
   if (!is_binary && buffer->uri.empty()) {
@@ -3934,6 +3949,7 @@ static bool ParseBufferView(BufferView *bufferView, std::string *err,
   bufferView->target = target;
 
   ParseStringProperty(&bufferView->name, err, o, "name", false);
+  ParseExtensionsProperty(&bufferView->extensions, err, o);
 
   bufferView->buffer = buffer;
   bufferView->byteOffset = byteOffset;